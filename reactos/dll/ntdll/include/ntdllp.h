@@ -8,8 +8,11 @@
 
 #pragma once
 
-#define LDR_HASH_TABLE_ENTRIES 32
-#define LDR_GET_HASH_ENTRY(x) (RtlUpcaseUnicodeChar((x)) & (LDR_HASH_TABLE_ENTRIES - 1))
+#define LDR_HASH_TABLE_ENTRIES 64
+#define LDR_GET_HASH_ENTRY(x) (LdrpHashUnicodeName((x)) & (LDR_HASH_TABLE_ENTRIES - 1))
+
+/* Export tables with fewer names than this are searched without an index */
+#define LDRP_EXPORT_INDEX_THRESHOLD 64
 
 /* LdrpUpdateLoadCount2 flags */
 #define LDRP_UPDATE_REFCOUNT   0x01
@@ -29,10 +32,45 @@ typedef struct _LDRP_TLS_DATA
     IMAGE_TLS_DIRECTORY TlsDirectory;
 } LDRP_TLS_DATA, *PLDRP_TLS_DATA;
 
+typedef struct _LDRP_EXPORT_NAME_INDEX
+{
+    LIST_ENTRY IndexLinks;
+    PVOID DllBase;
+    ULONG NumberOfNames;
+    ULONG BucketMask;
+    PULONG Buckets;
+    PULONG Chain;
+} LDRP_EXPORT_NAME_INDEX, *PLDRP_EXPORT_NAME_INDEX;
+
+#ifdef _M_IX86
+/* Resolver stub installed in an IAT slot by the lazy import snap mode */
+#include <pshpack1.h>
+typedef struct _LDRP_LAZY_THUNK
+{
+    UCHAR PushOpcode;
+    struct _LDRP_LAZY_THUNK *Self;
+    UCHAR JmpOpcode;
+    LONG JmpOffset;
+    UCHAR Padding[2];
+    PIMAGE_THUNK_DATA Thunk;
+    PVOID ExportBase;
+    LPSTR ImportName;
+    ULONG Ordinal;
+} LDRP_LAZY_THUNK, *PLDRP_LAZY_THUNK;
+#include <poppack.h>
+
+/* Stubs are only installed for the main image and share one region */
+#define LDRP_LAZY_THUNK_ARENA_COUNT (0x10000 / sizeof(LDRP_LAZY_THUNK))
+#endif
+
 /* Global data */
 extern RTL_CRITICAL_SECTION LdrpLoaderLock;
 extern BOOLEAN LdrpInLdrInit;
 extern LIST_ENTRY LdrpHashTable[LDR_HASH_TABLE_ENTRIES];
+extern LIST_ENTRY LdrpExportNameIndexList;
+extern ULONG LdrpLazyImportSnap;
+extern ULONG LdrpLazyThunksPresent;
+extern ULONG LdrpLazyThunksResolved;
 extern BOOLEAN ShowSnaps;
 extern UNICODE_STRING LdrpDefaultPath;
 extern HANDLE LdrpKnownDllObjectDirectory;
@@ -77,6 +115,10 @@ NTSTATUS NTAPI
 LdrpWalkImportDescriptor(IN LPWSTR DllPath OPTIONAL,
                          IN PLDR_DATA_TABLE_ENTRY LdrEntry);
 
+VOID NTAPI
+LdrpFreeExportNameIndex(IN PVOID DllBase);
+
+
 
 /* ldrutils.c */
 NTSTATUS NTAPI
@@ -89,6 +131,9 @@ LdrpGetProcedureAddress(IN PVOID BaseAddress,
 PLDR_DATA_TABLE_ENTRY NTAPI
 LdrpAllocateDataTableEntry(IN PVOID BaseAddress);
 
+ULONG NTAPI
+LdrpHashUnicodeName(IN PUNICODE_STRING Name);
+
 VOID NTAPI
 LdrpInsertMemoryTableEntry(IN PLDR_DATA_TABLE_ENTRY LdrEntry);
 
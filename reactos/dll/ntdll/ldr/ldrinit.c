@@ -50,6 +50,7 @@ PVOID NtDllBase;
 extern LARGE_INTEGER RtlpTimeout;
 BOOLEAN RtlpTimeoutDisable;
 LIST_ENTRY LdrpHashTable[LDR_HASH_TABLE_ENTRIES];
+LIST_ENTRY LdrpExportNameIndexList;
 LIST_ENTRY LdrpDllNotificationList;
 HANDLE LdrpKnownDllObjectDirectory;
 UNICODE_STRING LdrpKnownDllPath;
@@ -910,6 +911,14 @@ LdrShutdownProcess(VOID)
     if (ShowSnaps)
     {
         DPRINT1("\n");
+
+        /* Report how much of the lazy import snapping paid off */
+        if (LdrpLazyThunksPresent)
+        {
+            DPRINT1("LDR: %lu of %lu lazy import thunks were resolved\n",
+                    LdrpLazyThunksResolved,
+                    LdrpLazyThunksPresent);
+        }
     }
 
     /* Set the shutdown variables */
@@ -1395,6 +1404,13 @@ LdrpInitializeExecutionOptions(PUNICODE_STRING ImagePathName, PPEB Peb, PHANDLE
                                    sizeof(RtlpShutdownProcessFlags),
                                    NULL);
 
+        LdrQueryImageFileKeyOption(KeyHandle,
+                                   L"LazyImportSnap",
+                                   REG_DWORD,
+                                   &LdrpLazyImportSnap,
+                                   sizeof(LdrpLazyImportSnap),
+                                   NULL);
+
         LdrQueryImageFileKeyOption(KeyHandle,
                                    L"MinimumStackCommitInBytes",
                                    REG_DWORD,
@@ -1650,6 +1666,9 @@ LdrpInitializeProcess(IN PCONTEXT Context,
         InitializeListHead(&LdrpHashTable[i]);
     }
 
+    /* Initialize the list of export name indexes */
+    InitializeListHead(&LdrpExportNameIndexList);
+
     /* Initialize the Loader Lock */
     // FIXME: What's the point of initing it manually, if two lines lower
     //        a call to RtlInitializeCriticalSection() is being made anyway?
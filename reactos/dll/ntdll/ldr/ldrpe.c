@@ -17,6 +17,15 @@
 
 PLDR_MANIFEST_PROBER_ROUTINE LdrpManifestProberRoutine;
 ULONG LdrpNormalSnap;
+ULONG LdrpLazyImportSnap;
+ULONG LdrpLazyThunksPresent;
+ULONG LdrpLazyThunksResolved;
+
+#ifdef _M_IX86
+PLDRP_LAZY_THUNK LdrpLazyThunkArena;
+VOID NTAPI LdrpLazySnapThunkDispatch(VOID);
+USHORT NTAPI LdrpNameToOrdinal(LPSTR, ULONG, PVOID, PULONG, PUSHORT);
+#endif
 
 /* FUNCTIONS *****************************************************************/
 
@@ -32,6 +41,303 @@ AVrfPageHeapDllNotification(IN PLDR_DATA_TABLE_ENTRY LdrEntry)
     UNIMPLEMENTED;
 }
 
+#ifdef _M_IX86
+PVOID
+NTAPI
+LdrpResolveLazyThunk(IN PLDRP_LAZY_THUNK LazyThunk)
+{
+    ANSI_STRING ImportName;
+    MEMORY_BASIC_INFORMATION MemoryInfo;
+    PVOID Address, ProtectBase;
+    SIZE_T ProtectSize;
+    ULONG OldProtect;
+    NTSTATUS Status;
+
+    /* Serialize with other threads resolving the same slot */
+    if (!LdrpInLdrInit) RtlEnterCriticalSection(&LdrpLoaderLock);
+
+    /* Check if another thread beat us to it */
+    Address = (PVOID)LazyThunk->Thunk->u1.Function;
+    if (Address == (PVOID)LazyThunk)
+    {
+        /* Look the import up, running the initializers of any forwarder DLL */
+        if (LazyThunk->ImportName) RtlInitAnsiString(&ImportName, LazyThunk->ImportName);
+        Status = LdrpGetProcedureAddress(LazyThunk->ExportBase,
+                                         LazyThunk->ImportName ? &ImportName : NULL,
+                                         LazyThunk->Ordinal,
+                                         &Address,
+                                         TRUE);
+        if (!NT_SUCCESS(Status))
+        {
+            /* There is nobody to return an error to, raise it like a static snap */
+            if (!LdrpInLdrInit) RtlLeaveCriticalSection(&LdrpLoaderLock);
+            DPRINT1("LDR: Failed to resolve lazy import %s (ordinal 0x%lx)\n",
+                    LazyThunk->ImportName ? LazyThunk->ImportName : "",
+                    LazyThunk->Ordinal);
+            RtlRaiseStatus(LazyThunk->ImportName ? STATUS_ENTRYPOINT_NOT_FOUND :
+                                                   STATUS_ORDINAL_NOT_FOUND);
+        }
+
+        /* The IAT was protected again after loading, open the slot up. It
+         * can share its page with code other threads are running, so keep
+         * the page executable if it was */
+        Status = NtQueryVirtualMemory(NtCurrentProcess(),
+                                      LazyThunk->Thunk,
+                                      MemoryBasicInformation,
+                                      &MemoryInfo,
+                                      sizeof(MemoryInfo),
+                                      NULL);
+        if (NT_SUCCESS(Status))
+        {
+            ProtectBase = LazyThunk->Thunk;
+            ProtectSize = sizeof(IMAGE_THUNK_DATA);
+            Status = NtProtectVirtualMemory(NtCurrentProcess(),
+                                            &ProtectBase,
+                                            &ProtectSize,
+                                            (MemoryInfo.Protect & (PAGE_EXECUTE |
+                                                                   PAGE_EXECUTE_READ |
+                                                                   PAGE_EXECUTE_READWRITE |
+                                                                   PAGE_EXECUTE_WRITECOPY)) ?
+                                            PAGE_EXECUTE_READWRITE : PAGE_READWRITE,
+                                            &OldProtect);
+        }
+        if (NT_SUCCESS(Status))
+        {
+            /* Patch the slot so the next call goes straight to the target */
+            LazyThunk->Thunk->u1.Function = (ULONG_PTR)Address;
+            NtProtectVirtualMemory(NtCurrentProcess(),
+                                   &ProtectBase,
+                                   &ProtectSize,
+                                   OldProtect,
+                                   &OldProtect);
+            LdrpLazyThunksResolved++;
+        }
+    }
+
+    /* Release the lock and let the dispatcher jump to the target */
+    if (!LdrpInLdrInit) RtlLeaveCriticalSection(&LdrpLoaderLock);
+    return Address;
+}
+
+/* Only code can sit behind a resolver stub. Data exports and forwarders
+ * are snapped right away */
+static
+BOOLEAN
+LdrpIsCodeExport(IN PVOID ExportBase,
+                 IN PVOID ImportBase,
+                 IN PIMAGE_THUNK_DATA OriginalThunk,
+                 IN PIMAGE_EXPORT_DIRECTORY ExportEntry,
+                 IN ULONG ExportSize)
+{
+    PIMAGE_IMPORT_BY_NAME AddressOfData;
+    PIMAGE_SECTION_HEADER Section;
+    PULONG NameTable, AddressOfFunctions;
+    PUSHORT OrdinalTable;
+    ULONG Ordinal, Rva, ExportRva;
+
+    if (IMAGE_SNAP_BY_ORDINAL(OriginalThunk->u1.Ordinal))
+    {
+        Ordinal = IMAGE_ORDINAL(OriginalThunk->u1.Ordinal) - ExportEntry->Base;
+    }
+    else
+    {
+        AddressOfData = (PIMAGE_IMPORT_BY_NAME)
+                        ((ULONG_PTR)ImportBase +
+                        ((ULONG_PTR)OriginalThunk->u1.AddressOfData & 0xffffffff));
+        NameTable = (PULONG)((ULONG_PTR)ExportBase +
+                             (ULONG_PTR)ExportEntry->AddressOfNames);
+        OrdinalTable = (PUSHORT)((ULONG_PTR)ExportBase +
+                                 (ULONG_PTR)ExportEntry->AddressOfNameOrdinals);
+
+        if (((ULONG)AddressOfData->Hint < ExportEntry->NumberOfNames) &&
+            (!strcmp((LPSTR)AddressOfData->Name,
+                     (LPSTR)((ULONG_PTR)ExportBase + NameTable[AddressOfData->Hint]))))
+        {
+            Ordinal = OrdinalTable[AddressOfData->Hint];
+        }
+        else
+        {
+            Ordinal = LdrpNameToOrdinal((LPSTR)AddressOfData->Name,
+                                        ExportEntry->NumberOfNames,
+                                        ExportBase,
+                                        NameTable,
+                                        OrdinalTable);
+        }
+    }
+
+    /* Let the regular snap report bad imports */
+    if (Ordinal >= ExportEntry->NumberOfFunctions) return FALSE;
+
+    AddressOfFunctions = (PULONG)((ULONG_PTR)ExportBase +
+                                  (ULONG_PTR)ExportEntry->AddressOfFunctions);
+    Rva = AddressOfFunctions[Ordinal];
+
+    /* Forwarders point into the export directory */
+    ExportRva = (ULONG)((ULONG_PTR)ExportEntry - (ULONG_PTR)ExportBase);
+    if ((Rva >= ExportRva) && (Rva < ExportRva + ExportSize)) return FALSE;
+
+    Section = RtlImageRvaToSection(RtlImageNtHeader(ExportBase), ExportBase, Rva);
+    return (Section && (Section->Characteristics & IMAGE_SCN_MEM_EXECUTE));
+}
+
+/* Carves stubs out of a single reserved region, so the descriptors of the
+ * image share pages instead of taking an allocation each */
+static
+PLDRP_LAZY_THUNK
+LdrpAllocateLazyThunks(IN ULONG Count)
+{
+    PVOID Base;
+    SIZE_T Size;
+    ULONG OldProtect;
+    NTSTATUS Status;
+
+    if (Count > LDRP_LAZY_THUNK_ARENA_COUNT - LdrpLazyThunksPresent) return NULL;
+
+    if (!LdrpLazyThunkArena)
+    {
+        Size = LDRP_LAZY_THUNK_ARENA_COUNT * sizeof(LDRP_LAZY_THUNK);
+        Status = NtAllocateVirtualMemory(NtCurrentProcess(),
+                                         (PVOID*)&LdrpLazyThunkArena,
+                                         0,
+                                         &Size,
+                                         MEM_RESERVE,
+                                         PAGE_READWRITE);
+        if (!NT_SUCCESS(Status)) return NULL;
+    }
+
+    /* Commit what is needed, or make the pages written before writable again.
+     * The first page may hold stubs already in use, so it stays executable */
+    Base = &LdrpLazyThunkArena[LdrpLazyThunksPresent];
+    Size = Count * sizeof(LDRP_LAZY_THUNK);
+    Status = NtAllocateVirtualMemory(NtCurrentProcess(),
+                                     &Base,
+                                     0,
+                                     &Size,
+                                     MEM_COMMIT,
+                                     PAGE_EXECUTE_READWRITE);
+    if (NT_SUCCESS(Status))
+    {
+        Status = NtProtectVirtualMemory(NtCurrentProcess(),
+                                        &Base,
+                                        &Size,
+                                        PAGE_EXECUTE_READWRITE,
+                                        &OldProtect);
+    }
+    if (!NT_SUCCESS(Status)) return NULL;
+
+    return &LdrpLazyThunkArena[LdrpLazyThunksPresent];
+}
+
+NTSTATUS
+NTAPI
+LdrpInstallLazyThunks(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
+                      IN PLDR_DATA_TABLE_ENTRY ImportLdrEntry,
+                      IN PIMAGE_THUNK_DATA OriginalThunk,
+                      IN PIMAGE_THUNK_DATA FirstThunk,
+                      IN PIMAGE_EXPORT_DIRECTORY ExportDirectory,
+                      IN ULONG ExportSize,
+                      IN LPSTR ImportName)
+{
+    PLDRP_LAZY_THUNK Thunks, LazyThunk;
+    PIMAGE_IMPORT_BY_NAME AddressOfData;
+    PVOID ProtectBase;
+    SIZE_T ProtectSize;
+    ULONG Count, Stubs, i, OldProtect;
+    NTSTATUS Status;
+
+    /* Count the thunks of this descriptor that can be stubbed */
+    for (Count = 0, Stubs = 0; OriginalThunk[Count].u1.AddressOfData; Count++)
+    {
+        if (LdrpIsCodeExport(ExportLdrEntry->DllBase,
+                             ImportLdrEntry->DllBase,
+                             &OriginalThunk[Count],
+                             ExportDirectory,
+                             ExportSize))
+        {
+            Stubs++;
+        }
+    }
+    if (!Stubs) return STATUS_NOT_SUPPORTED;
+
+    Thunks = LdrpAllocateLazyThunks(Stubs);
+    if (!Thunks) return STATUS_NO_MEMORY;
+
+    for (i = 0, LazyThunk = Thunks; i < Count; i++)
+    {
+        if (!LdrpIsCodeExport(ExportLdrEntry->DllBase,
+                              ImportLdrEntry->DllBase,
+                              &OriginalThunk[i],
+                              ExportDirectory,
+                              ExportSize))
+        {
+            /* Data has to be there before the first access */
+            Status = LdrpSnapThunk(ExportLdrEntry->DllBase,
+                                   ImportLdrEntry->DllBase,
+                                   &OriginalThunk[i],
+                                   &FirstThunk[i],
+                                   ExportDirectory,
+                                   ExportSize,
+                                   TRUE,
+                                   ImportName);
+            if (!NT_SUCCESS(Status)) return Status;
+            continue;
+        }
+
+        /* Build one "push <stub>; jmp LdrpLazySnapThunkDispatch" */
+        LazyThunk->PushOpcode = 0x68;
+        LazyThunk->Self = LazyThunk;
+        LazyThunk->JmpOpcode = 0xE9;
+        LazyThunk->JmpOffset = (LONG)((ULONG_PTR)LdrpLazySnapThunkDispatch -
+                                      (ULONG_PTR)(&LazyThunk->JmpOffset + 1));
+        LazyThunk->Padding[0] = LazyThunk->Padding[1] = 0xCC;
+        LazyThunk->Thunk = &FirstThunk[i];
+        LazyThunk->ExportBase = ExportLdrEntry->DllBase;
+
+        /* Remember what to look up on the first call */
+        if (IMAGE_SNAP_BY_ORDINAL(OriginalThunk[i].u1.Ordinal))
+        {
+            LazyThunk->ImportName = NULL;
+            LazyThunk->Ordinal = IMAGE_ORDINAL(OriginalThunk[i].u1.Ordinal);
+        }
+        else
+        {
+            AddressOfData = (PIMAGE_IMPORT_BY_NAME)
+                            ((ULONG_PTR)ImportLdrEntry->DllBase +
+                             OriginalThunk[i].u1.AddressOfData);
+            LazyThunk->ImportName = (LPSTR)AddressOfData->Name;
+            LazyThunk->Ordinal = 0;
+        }
+
+        /* Point the IAT slot at the stub */
+        FirstThunk[i].u1.Function = (ULONG_PTR)LazyThunk;
+        LazyThunk++;
+    }
+
+    /* The stubs never change again, make them executable only */
+    ProtectBase = Thunks;
+    ProtectSize = Stubs * sizeof(LDRP_LAZY_THUNK);
+    NtProtectVirtualMemory(NtCurrentProcess(),
+                           &ProtectBase,
+                           &ProtectSize,
+                           PAGE_EXECUTE_READ,
+                           &OldProtect);
+    NtFlushInstructionCache(NtCurrentProcess(), Thunks, Stubs * sizeof(LDRP_LAZY_THUNK));
+
+    LdrpLazyThunksPresent += Stubs;
+
+    /* Show debug message */
+    if (ShowSnaps)
+    {
+        DPRINT1("LDR: Installed %lu lazy import thunks in %wZ for %wZ\n",
+                Stubs,
+                &ImportLdrEntry->BaseDllName,
+                &ExportLdrEntry->BaseDllName);
+    }
+
+    return STATUS_SUCCESS;
+}
+#endif
+
 NTSTATUS
 NTAPI
 LdrpSnapIAT(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
@@ -222,6 +528,25 @@ LdrpSnapIAT(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
         ImportName = (LPSTR)((ULONG_PTR)ImportLdrEntry->DllBase +
                              IatEntry->Name);
 
+#ifdef _M_IX86
+        /* In lazy mode, resolver stubs replace the code thunks of the
+           main image if possible. DLLs are always snapped up front */
+        if ((LdrpLazyImportSnap) &&
+            (ImportLdrEntry->DllBase == NtCurrentPeb()->ImageBaseAddress) &&
+            (OriginalThunk != FirstThunk) &&
+            (NT_SUCCESS(LdrpInstallLazyThunks(ExportLdrEntry,
+                                              ImportLdrEntry,
+                                              OriginalThunk,
+                                              FirstThunk,
+                                              ExportDirectory,
+                                              ExportSize,
+                                              ImportName))))
+        {
+            /* Nothing is left to snap */
+            goto Done;
+        }
+#endif
+
         /* Loop while it's valid */
         while (OriginalThunk->u1.AddressOfData)
         {
@@ -251,6 +576,9 @@ LdrpSnapIAT(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
         }
     }
 
+#ifdef _M_IX86
+Done:
+#endif
     /* Protect the IAT again */
     NtProtectVirtualMemory(NtCurrentProcess(),
                            &Iat,
@@ -534,6 +862,7 @@ LdrpHandleOneOldFormatImportDescriptor(IN LPWSTR DllPath OPTIONAL,
     PLDR_DATA_TABLE_ENTRY DllLdrEntry;
     PIMAGE_THUNK_DATA FirstThunk;
     PPEB Peb = NtCurrentPeb();
+    BOOLEAN EntriesValid;
 
     /* Get the import name's VA */
     ImportName = (LPSTR)((ULONG_PTR)LdrEntry->DllBase + (*ImportEntry)->Name);
@@ -590,8 +919,24 @@ LdrpHandleOneOldFormatImportDescriptor(IN LPWSTR DllPath OPTIONAL,
                        &DllLdrEntry->InInitializationOrderLinks);
     }
 
+    /*
+     * Old-style binding: a time stamp other than -1 that still matches the
+     * loaded DLL means the IAT was pre-snapped by the linker, so only the
+     * forwarders need to be resolved.
+     */
+    EntriesValid = (((*ImportEntry)->TimeDateStamp) &&
+                    ((*ImportEntry)->TimeDateStamp != (ULONG)-1) &&
+                    ((*ImportEntry)->TimeDateStamp == DllLdrEntry->TimeDateStamp) &&
+                    !(DllLdrEntry->Flags & LDRP_IMAGE_NOT_AT_BASE));
+    if ((ShowSnaps) && (EntriesValid))
+    {
+        DPRINT1("LDR: %wZ has correct old-style binding to %s\n",
+                &LdrEntry->BaseDllName,
+                ImportName);
+    }
+
     /* Now snap the IAT Entry */
-    Status = LdrpSnapIAT(DllLdrEntry, LdrEntry, *ImportEntry, FALSE);
+    Status = LdrpSnapIAT(DllLdrEntry, LdrEntry, *ImportEntry, EntriesValid);
     if (!NT_SUCCESS(Status))
     {
         /* Fail */
@@ -634,6 +979,106 @@ LdrpHandleOldFormatImportDescriptors(IN LPWSTR DllPath OPTIONAL,
     return STATUS_SUCCESS;
 }
 
+static
+ULONG
+LdrpHashExportName(IN LPSTR Name)
+{
+    ULONG Hash = 0;
+
+    /* Export names are case-sensitive, so hash the raw bytes */
+    while (*Name) Hash = (Hash * 65599) + (UCHAR)*Name++;
+
+    /* Fold the high bits in, since only the low ones select a bucket */
+    return Hash ^ (Hash >> 16);
+}
+
+PLDRP_EXPORT_NAME_INDEX
+NTAPI
+LdrpGetExportNameIndex(IN PVOID ExportBase,
+                       IN ULONG NumberOfNames,
+                       IN PULONG NameTable)
+{
+    PLIST_ENTRY ListHead, Next;
+    PLDRP_EXPORT_NAME_INDEX Index;
+    ULONG BucketCount, Bucket, i;
+
+    /* Look for an index that was already built for this module */
+    ListHead = &LdrpExportNameIndexList;
+    Next = ListHead->Flink;
+    while (Next != ListHead)
+    {
+        Index = CONTAINING_RECORD(Next, LDRP_EXPORT_NAME_INDEX, IndexLinks);
+        if (Index->DllBase == ExportBase)
+        {
+            /* Keep the most recently used module in front, imports come in runs */
+            if (Next != ListHead->Flink)
+            {
+                RemoveEntryList(&Index->IndexLinks);
+                InsertHeadList(ListHead, &Index->IndexLinks);
+            }
+            return Index;
+        }
+
+        Next = Next->Flink;
+    }
+
+    /* Use a power of two bucket count, keeping chains about one entry long */
+    BucketCount = LDRP_EXPORT_INDEX_THRESHOLD;
+    while ((BucketCount < NumberOfNames) && (BucketCount < 0x10000)) BucketCount <<= 1;
+
+    /* Allocate the index header, the buckets and the chains in one block */
+    Index = RtlAllocateHeap(RtlGetProcessHeap(),
+                            HEAP_ZERO_MEMORY,
+                            sizeof(LDRP_EXPORT_NAME_INDEX) +
+                            (BucketCount + NumberOfNames) * sizeof(ULONG));
+    if (!Index) return NULL;
+
+    /* Set it up */
+    Index->DllBase = ExportBase;
+    Index->NumberOfNames = NumberOfNames;
+    Index->BucketMask = BucketCount - 1;
+    Index->Buckets = (PULONG)(Index + 1);
+    Index->Chain = Index->Buckets + BucketCount;
+
+    /* Link every name in. Slots are stored biased by one, so zero ends a chain */
+    for (i = 0; i < NumberOfNames; i++)
+    {
+        Bucket = LdrpHashExportName((LPSTR)((ULONG_PTR)ExportBase + NameTable[i])) &
+                 Index->BucketMask;
+        Index->Chain[i] = Index->Buckets[Bucket];
+        Index->Buckets[Bucket] = i + 1;
+    }
+
+    /* Remember it for the next lookup in this module */
+    InsertHeadList(&LdrpExportNameIndexList, &Index->IndexLinks);
+    return Index;
+}
+
+VOID
+NTAPI
+LdrpFreeExportNameIndex(IN PVOID DllBase)
+{
+    PLIST_ENTRY ListHead, Next;
+    PLDRP_EXPORT_NAME_INDEX Index;
+
+    /* Find the index belonging to this module, if any */
+    ListHead = &LdrpExportNameIndexList;
+    Next = ListHead->Flink;
+    while (Next != ListHead)
+    {
+        Index = CONTAINING_RECORD(Next, LDRP_EXPORT_NAME_INDEX, IndexLinks);
+        if (Index->DllBase == DllBase)
+        {
+            /* Unlink and free it */
+            RemoveEntryList(&Index->IndexLinks);
+            RtlFreeHeap(RtlGetProcessHeap(), 0, Index);
+            return;
+        }
+
+        Next = Next->Flink;
+    }
+}
+
 USHORT
 NTAPI
 LdrpNameToOrdinal(IN LPSTR ImportName,
@@ -643,6 +1088,33 @@ LdrpNameToOrdinal(IN LPSTR ImportName,
                   IN PUSHORT OrdinalTable)
 {
     LONG Start, End, Next, CmpResult;
+    PLDRP_EXPORT_NAME_INDEX Index;
+    ULONG Slot;
+
+    /* Large export tables get a hash index, built on the first miss */
+    if (NumberOfNames >= LDRP_EXPORT_INDEX_THRESHOLD)
+    {
+        Index = LdrpGetExportNameIndex(ExportBase, NumberOfNames, NameTable);
+        if ((Index) && (Index->NumberOfNames == NumberOfNames))
+        {
+            /* Walk the chain for this name */
+            Slot = Index->Buckets[LdrpHashExportName(ImportName) & Index->BucketMask];
+            while (Slot)
+            {
+                if (!strcmp(ImportName,
+                            (PCHAR)((ULONG_PTR)ExportBase + NameTable[Slot - 1])))
+                {
+                    /* Found it */
+                    return OrdinalTable[Slot - 1];
+                }
+
+                Slot = Index->Chain[Slot - 1];
+            }
+
+            /* The index covers every name, so this one isn't exported */
+            return -1;
+        }
+    }
 
     /* Use classical binary search to find the ordinal */
     Start = Next = 0;
@@ -1402,6 +1402,19 @@ SkipCheck:
                 goto FailRelocate;
             }
 
+            /* Check if the kernel already shares a copy relocated for this base */
+            if ((ULONG_PTR)NtHeaders->OptionalHeader.ImageBase == (ULONG_PTR)ViewBase)
+            {
+                if (ShowSnaps)
+                {
+                    DPRINT1("LDR: %wZ is already relocated to %p\n",
+                            &BaseDllName,
+                            ViewBase);
+                }
+
+                goto NoRelocNeeded;
+            }
+
             /* Change the protection to prepare for relocation */
             Status = LdrpSetProtection(ViewBase, FALSE);
 
@@ -1541,6 +1554,30 @@ LdrpAllocateDataTableEntry(IN PVOID BaseAddress)
     return LdrEntry;
 }
 
+ULONG
+NTAPI
+LdrpHashUnicodeName(IN PUNICODE_STRING Name)
+{
+    ULONG Hash = 0, i;
+    WCHAR Char;
+
+    /* Hash the whole name case-insensitively, not just its first character */
+    for (i = 0; i < Name->Length / sizeof(WCHAR); i++)
+    {
+        /* Avoid the NLS table for plain ASCII, which is what module names are */
+        Char = Name->Buffer[i];
+        if ((Char >= L'a') && (Char <= L'z'))
+            Char -= L'a' - L'A';
+        else if (Char > 0x7F)
+            Char = RtlUpcaseUnicodeChar(Char);
+
+        Hash = (Hash * 65599) + Char;
+    }
+
+    /* Fold the high bits in, since the caller only keeps the low ones */
+    return Hash ^ (Hash >> 16);
+}
+
 VOID
 NTAPI
 LdrpInsertMemoryTableEntry(IN PLDR_DATA_TABLE_ENTRY LdrEntry)
@@ -1549,7 +1586,7 @@ LdrpInsertMemoryTableEntry(IN PLDR_DATA_TABLE_ENTRY LdrEntry)
     ULONG i;
 
     /* Insert into hash table */
-    i = LDR_GET_HASH_ENTRY(LdrEntry->BaseDllName.Buffer[0]);
+    i = LDR_GET_HASH_ENTRY(&LdrEntry->BaseDllName);
     InsertTailList(&LdrpHashTable[i], &LdrEntry->HashLinks);
 
     /* Insert into other lists */
@@ -1573,6 +1610,9 @@ LdrpFinalizeAndDeallocateDataTableEntry(IN PLDR_DATA_TABLE_ENTRY Entry)
         Entry->EntryPointActivationContext = INVALID_HANDLE_VALUE;
     }
 
+    /* Release the export name index, if one was built for this module */
+    if (Entry->DllBase) LdrpFreeExportNameIndex(Entry->DllBase);
+
     /* Release the full dll name string */
     if (Entry->FullDllName.Buffer) LdrpFreeUnicodeString(&Entry->FullDllName);
 
@@ -1973,7 +2013,7 @@ lookinhash:
     if (Flag)
     {
         /* Get hash index */
-        HashIndex = LDR_GET_HASH_ENTRY(DllName->Buffer[0]);
+        HashIndex = LDR_GET_HASH_ENTRY(DllName);
 
         /* Traverse that list */
         ListHead = &LdrpHashTable[HashIndex];
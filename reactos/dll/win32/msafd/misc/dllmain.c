@@ -1979,6 +1979,211 @@ WSPGetPeerName(IN SOCKET s,
     return MsafdReturnWithErrno ( Status, lpErrno, 0, NULL );
 }
 
+/* Polls an array of sockets with a single AFD select (SIO_EXT_POLL) */
+static
+INT
+SockPoll(IN SOCKET Handle,
+         IN OUT LPWSAPOLLDATA PollData,
+         IN DWORD Length,
+         OUT LPINT lpErrno)
+{
+    IO_STATUS_BLOCK     IOSB;
+    PAFD_POLL_INFO      PollInfo;
+    NTSTATUS            Status;
+    ULONG               PollBufferSize;
+    ULONG               i, Events;
+    SHORT               Revents;
+    INT                 OutCount = 0;
+    HANDLE              SockEvent;
+
+    if (Length < FIELD_OFFSET(WSAPOLLDATA, fdArray) ||
+        PollData->fds == 0 ||
+        (Length - FIELD_OFFSET(WSAPOLLDATA, fdArray)) / sizeof(WSAPOLLFD) < PollData->fds)
+    {
+        *lpErrno = WSAEINVAL;
+        return SOCKET_ERROR;
+    }
+
+    PollBufferSize = FIELD_OFFSET(AFD_POLL_INFO, Handles) + PollData->fds * sizeof(AFD_HANDLE);
+    PollInfo = HeapAlloc(GlobalHeap, HEAP_ZERO_MEMORY, PollBufferSize);
+    if (!PollInfo)
+    {
+        *lpErrno = WSAENOBUFS;
+        return SOCKET_ERROR;
+    }
+
+    Status = NtCreateEvent(&SockEvent,
+                           EVENT_ALL_ACCESS,
+                           NULL,
+                           1,
+                           FALSE);
+    if (!NT_SUCCESS(Status))
+    {
+        HeapFree(GlobalHeap, 0, PollInfo);
+        return MsafdReturnWithErrno(Status, lpErrno, 0, NULL);
+    }
+
+    /* Convert the timeout, a negative one waits forever */
+    if (PollData->timeout < 0)
+    {
+        PollInfo->Timeout.u.LowPart = -1;
+        PollInfo->Timeout.u.HighPart = 0x7FFFFFFF;
+    }
+    else
+    {
+        PollInfo->Timeout = RtlEnlargedIntegerMultiply(PollData->timeout, -10000);
+    }
+
+    PollInfo->Exclusive = FALSE;
+    PollInfo->HandleCount = PollData->fds;
+
+    for (i = 0; i < PollData->fds; i++)
+    {
+        PollData->fdArray[i].revents = 0;
+
+        /* AFD skips null handles */
+        if (PollData->fdArray[i].fd == INVALID_SOCKET)
+            continue;
+
+        /* Hang ups and errors are always reported */
+        Events = AFD_EVENT_DISCONNECT | AFD_EVENT_ABORT | AFD_EVENT_CLOSE |
+                 AFD_EVENT_CONNECT_FAIL;
+        if (PollData->fdArray[i].events & POLLRDNORM)
+            Events |= AFD_EVENT_RECEIVE | AFD_EVENT_ACCEPT;
+        if (PollData->fdArray[i].events & POLLRDBAND)
+            Events |= AFD_EVENT_OOB_RECEIVE;
+        if (PollData->fdArray[i].events & POLLWRNORM)
+            Events |= AFD_EVENT_SEND | AFD_EVENT_CONNECT;
+
+        PollInfo->Handles[i].Handle = PollData->fdArray[i].fd;
+        PollInfo->Handles[i].Events = Events;
+    }
+
+    /* Send IOCTL */
+    Status = NtDeviceIoControlFile((HANDLE)Handle,
+                                   SockEvent,
+                                   NULL,
+                                   NULL,
+                                   &IOSB,
+                                   IOCTL_AFD_SELECT,
+                                   PollInfo,
+                                   PollBufferSize,
+                                   PollInfo,
+                                   PollBufferSize);
+
+    /* Wait for Completition */
+    if (Status == STATUS_PENDING)
+    {
+        WaitForSingleObject(SockEvent, INFINITE);
+        Status = IOSB.Status;
+    }
+
+    NtClose(SockEvent);
+
+    if (Status != STATUS_SUCCESS && Status != STATUS_TIMEOUT)
+    {
+        ERR("Poll failed with 0x%08x\n", Status);
+        HeapFree(GlobalHeap, 0, PollInfo);
+        return MsafdReturnWithErrno(Status, lpErrno, 0, NULL);
+    }
+
+    for (i = 0; i < PollData->fds; i++)
+    {
+        Events = PollInfo->Handles[i].Events;
+        Revents = 0;
+
+        if (Events & (AFD_EVENT_RECEIVE | AFD_EVENT_ACCEPT))
+            Revents |= POLLRDNORM;
+        if (Events & AFD_EVENT_OOB_RECEIVE)
+            Revents |= POLLRDBAND;
+        if (Events & (AFD_EVENT_SEND | AFD_EVENT_CONNECT))
+            Revents |= POLLWRNORM;
+        if (Events & (AFD_EVENT_DISCONNECT | AFD_EVENT_ABORT | AFD_EVENT_CLOSE))
+            Revents |= POLLHUP;
+        if (Events & AFD_EVENT_CONNECT_FAIL)
+            Revents |= POLLERR;
+
+        PollData->fdArray[i].revents = Revents;
+        if (Revents)
+            OutCount++;
+    }
+
+    HeapFree(GlobalHeap, 0, PollInfo);
+
+    TRACE("%d sockets ready\n", OutCount);
+
+    PollData->result = OutCount;
+    *lpErrno = NO_ERROR;
+    return NO_ERROR;
+}
+
+/* Hands a socket notification registration (SIO_SOCK_NOTIFY) to AFD */
+static
+INT
+SockSetNotify(IN SOCKET Handle,
+              IN PSOCK_NOTIFY_REQUEST Request,
+              OUT LPINT lpErrno)
+{
+    IO_STATUS_BLOCK              IOSB;
+    FILE_COMPLETION_INFORMATION  CompletionInfo;
+    AFD_NOTIFY_INFO              NotifyInfo;
+    NTSTATUS                     Status;
+    HANDLE                       SockEvent;
+
+    /*
+     * AFD posts the notifications to the port the socket is associated
+     * with. This fails if the socket is associated already, AFD then
+     * checks that it is the same port.
+     */
+    if (Request->Registration.operation == SOCK_NOTIFY_OP_ENABLE)
+    {
+        CompletionInfo.Port = Request->CompletionPort;
+        CompletionInfo.Key = Request->Registration.completionKey;
+        NtSetInformationFile((HANDLE)Handle,
+                             &IOSB,
+                             &CompletionInfo,
+                             sizeof(CompletionInfo),
+                             FileCompletionInformation);
+    }
+
+    Status = NtCreateEvent(&SockEvent,
+                           EVENT_ALL_ACCESS,
+                           NULL,
+                           1,
+                           FALSE);
+    if (!NT_SUCCESS(Status))
+        return MsafdReturnWithErrno(Status, lpErrno, 0, NULL);
+
+    NotifyInfo.CompletionPort = Request->CompletionPort;
+    NotifyInfo.CompletionKey = Request->Registration.completionKey;
+    NotifyInfo.EventFilter = Request->Registration.eventFilter;
+    NotifyInfo.Operation = Request->Registration.operation;
+    NotifyInfo.TriggerFlags = Request->Registration.triggerFlags;
+
+    /* Send IOCTL */
+    Status = NtDeviceIoControlFile((HANDLE)Handle,
+                                   SockEvent,
+                                   NULL,
+                                   NULL,
+                                   &IOSB,
+                                   IOCTL_AFD_SET_NOTIFY,
+                                   &NotifyInfo,
+                                   sizeof(NotifyInfo),
+                                   NULL,
+                                   0);
+
+    /* Wait for return */
+    if (Status == STATUS_PENDING)
+    {
+        WaitForSingleObject(SockEvent, INFINITE);
+        Status = IOSB.Status;
+    }
+
+    NtClose(SockEvent);
+
+    return MsafdReturnWithErrno(Status, lpErrno, 0, NULL);
+}
+
 INT
 WSPAPI
 WSPIoctl(IN  SOCKET Handle,
@@ -2056,8 +2261,66 @@ WSPIoctl(IN  SOCKET Handle,
             *lpErrno = NO_ERROR;
             return NO_ERROR;
         case SIO_GET_EXTENSION_FUNCTION_POINTER:
-            *lpErrno = WSAEINVAL;
-            return SOCKET_ERROR;
+            if (cbInBuffer < sizeof(GUID) || cbOutBuffer < sizeof(PVOID) ||
+                IS_INTRESOURCE(lpvInBuffer) || IS_INTRESOURCE(lpvOutBuffer))
+            {
+                *lpErrno = WSAEFAULT;
+                return SOCKET_ERROR;
+            }
+
+            *(PVOID*)lpvOutBuffer = SockGetExtensionFunction((LPGUID)lpvInBuffer);
+            if (!*(PVOID*)lpvOutBuffer)
+            {
+                *lpErrno = WSAEINVAL;
+                return SOCKET_ERROR;
+            }
+
+            *lpcbBytesReturned = sizeof(PVOID);
+            *lpErrno = NO_ERROR;
+            return NO_ERROR;
+
+        case SIO_EXT_POLL:
+            if (lpvInBuffer != lpvOutBuffer || cbInBuffer != cbOutBuffer ||
+                IS_INTRESOURCE(lpvInBuffer))
+            {
+                *lpErrno = WSAEFAULT;
+                return SOCKET_ERROR;
+            }
+
+            if (SockPoll(Handle, (LPWSAPOLLDATA)lpvInBuffer, cbInBuffer, lpErrno) != NO_ERROR)
+                return SOCKET_ERROR;
+
+            *lpcbBytesReturned = cbOutBuffer;
+            return NO_ERROR;
+
+        case SIO_EXT_SENDMSG:
+        {
+            LPWSASENDMSG SendMsg = (LPWSASENDMSG)lpvInBuffer;
+
+            if (cbInBuffer < sizeof(WSASENDMSG) || IS_INTRESOURCE(lpvInBuffer))
+            {
+                *lpErrno = WSAEFAULT;
+                return SOCKET_ERROR;
+            }
+
+            return SockSendMsg(Handle,
+                               SendMsg->lpMsg,
+                               SendMsg->dwFlags,
+                               SendMsg->lpNumberOfBytesSent,
+                               SendMsg->lpOverlapped,
+                               SendMsg->lpCompletionRoutine,
+                               lpThreadId,
+                               lpErrno);
+        }
+
+        case SIO_SOCK_NOTIFY:
+            if (cbInBuffer < sizeof(SOCK_NOTIFY_REQUEST) || IS_INTRESOURCE(lpvInBuffer))
+            {
+                *lpErrno = WSAEFAULT;
+                return SOCKET_ERROR;
+            }
+
+            return SockSetNotify(Handle, (PSOCK_NOTIFY_REQUEST)lpvInBuffer, lpErrno);
 
         case SIO_ADDRESS_LIST_QUERY:
             if (cbOutBuffer < (sizeof(SOCKET_ADDRESS_LIST) + sizeof(Socket->WSLocalAddress)) || IS_INTRESOURCE(lpvOutBuffer))
@@ -2339,15 +2602,39 @@ WSPSetSockOpt(
               return 0;
 
            case SO_SNDBUF:
+           case SO_RCVBUF:
+           {
+              ULONG BufferSize;
+
               if (optlen < sizeof(DWORD))
               {
                   *lpErrno = WSAEFAULT;
                   return SOCKET_ERROR;
               }
 
-              /* TODO: The total per-socket buffer space reserved for sends */
-              ERR("Setting send buf to %x is not implemented yet\n", optval);
+              /* AFD needs a buffer to work with, so only remember a zero size */
+              BufferSize = *(PULONG)optval;
+              if (BufferSize)
+              {
+                  if (SetSocketInformation(Socket,
+                                           optname == SO_SNDBUF ?
+                                           AFD_INFO_SEND_WINDOW_SIZE :
+                                           AFD_INFO_RECEIVE_WINDOW_SIZE,
+                                           NULL,
+                                           &BufferSize,
+                                           NULL) != NO_ERROR)
+                  {
+                      *lpErrno = WSAENOBUFS;
+                      return SOCKET_ERROR;
+                  }
+              }
+
+              if (optname == SO_SNDBUF)
+                  Socket->SharedData.SizeOfSendBuffer = BufferSize;
+              else
+                  Socket->SharedData.SizeOfRecvBuffer = BufferSize;
               return 0;
+           }
 
            case SO_SNDTIMEO:
               if (optlen < sizeof(DWORD))
@@ -2378,6 +2665,26 @@ WSPSetSockOpt(
               /* These go directly to the helper dll */
               goto SendToHelper;
 
+           case SO_UPDATE_ACCEPT_CONTEXT:
+              /* AFD connected the socket in AcceptEx, catch up with it */
+              if (optlen < sizeof(SOCKET))
+              {
+                  *lpErrno = WSAEFAULT;
+                  return SOCKET_ERROR;
+              }
+              if (!GetSocketStructure(*(SOCKET*)optval))
+              {
+                  *lpErrno = WSAENOTSOCK;
+                  return SOCKET_ERROR;
+              }
+              Socket->SharedData.State = SocketConnected;
+              return 0;
+
+           case SO_UPDATE_CONNECT_CONTEXT:
+              /* Same for ConnectEx */
+              Socket->SharedData.State = SocketConnected;
+              return 0;
+
            default:
               /* Obviously this is a hack */
               ERR("MSAFD: Set unknown optname %x\n", optname);
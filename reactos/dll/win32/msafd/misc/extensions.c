@@ -0,0 +1,741 @@
+/*
+ * COPYRIGHT:   See COPYING in the top level directory
+ * PROJECT:     ReactOS Ancillary Function Driver DLL
+ * FILE:        dll/win32/msafd/misc/extensions.c
+ * PURPOSE:     Microsoft extensions to Winsock
+ * PROGRAMMERS: ReactOS Team
+ */
+
+#include <msafd.h>
+
+#include <wine/debug.h>
+WINE_DEFAULT_DEBUG_CHANNEL(msafd);
+
+/* Issues an AFD request on the caller's overlapped structure, or waits
+ * for it when there is none */
+static
+NTSTATUS
+SockExtensionIoctl(SOCKET Handle,
+                   ULONG IoControlCode,
+                   PVOID InputBuffer,
+                   ULONG InputBufferLength,
+                   PVOID OutputBuffer,
+                   ULONG OutputBufferLength,
+                   LPOVERLAPPED lpOverlapped,
+                   PULONG_PTR Information)
+{
+    PIO_STATUS_BLOCK        IOSB;
+    IO_STATUS_BLOCK         DummyIOSB;
+    NTSTATUS                Status;
+    PVOID                   APCContext;
+    HANDLE                  Event;
+    HANDLE                  SockEvent = NULL;
+
+    if (lpOverlapped == NULL)
+    {
+        Status = NtCreateEvent(&SockEvent, EVENT_ALL_ACCESS, NULL, 1, FALSE);
+        if (!NT_SUCCESS(Status))
+            return Status;
+
+        APCContext = NULL;
+        Event = SockEvent;
+        IOSB = &DummyIOSB;
+    }
+    else
+    {
+        APCContext = lpOverlapped;
+        Event = lpOverlapped->hEvent;
+        IOSB = (PIO_STATUS_BLOCK)&lpOverlapped->Internal;
+    }
+
+    IOSB->Status = STATUS_PENDING;
+    IOSB->Information = 0;
+
+    Status = NtDeviceIoControlFile((HANDLE)Handle,
+                                   Event,
+                                   NULL,
+                                   APCContext,
+                                   IOSB,
+                                   IoControlCode,
+                                   InputBuffer,
+                                   InputBufferLength,
+                                   OutputBuffer,
+                                   OutputBufferLength);
+
+    /* Wait for completion of not overlapped */
+    if (Status == STATUS_PENDING && lpOverlapped == NULL)
+    {
+        WaitForSingleObject(SockEvent, INFINITE);
+        Status = IOSB->Status;
+    }
+
+    if (SockEvent)
+        NtClose(SockEvent);
+
+    *Information = (Status == STATUS_PENDING) ? 0 : IOSB->Information;
+
+    return Status;
+}
+
+/* The extensions report errors through the last error */
+static
+BOOL
+SockExtensionResult(NTSTATUS Status,
+                    ULONG_PTR Information,
+                    LPDWORD lpBytes)
+{
+    INT Errno;
+
+    if (MsafdReturnWithErrno(Status, &Errno, (DWORD)Information, lpBytes) == SOCKET_ERROR)
+    {
+        SetLastError(Errno);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static
+BOOL
+PASCAL
+SockTransmit(SOCKET Handle,
+             LPTRANSMIT_PACKETS_ELEMENT lpPacketArray,
+             DWORD nElementCount,
+             DWORD nSendSize,
+             LPOVERLAPPED lpOverlapped,
+             DWORD dwFlags)
+{
+    PSOCKET_INFORMATION     Socket;
+    AFD_TRANSMIT_INFO       TransmitInfo;
+    AFD_TRANSMIT_ELEMENT    EmptyElement;
+    PAFD_TRANSMIT_ELEMENT   Elements;
+    ULONG_PTR               Information;
+    NTSTATUS                Status;
+    DWORD                   i;
+
+    Socket = GetSocketStructure(Handle);
+    if (!Socket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return FALSE;
+    }
+
+    if (Socket->SharedData.State != SocketConnected)
+    {
+        SetLastError(WSAENOTCONN);
+        return FALSE;
+    }
+
+    if ((dwFlags & TF_REUSE_SOCKET) && !(dwFlags & TF_DISCONNECT))
+    {
+        SetLastError(WSAEINVAL);
+        return FALSE;
+    }
+
+    if (nElementCount)
+    {
+        Elements = HeapAlloc(GetProcessHeap(), 0, nElementCount * sizeof(*Elements));
+        if (!Elements)
+        {
+            SetLastError(WSAENOBUFS);
+            return FALSE;
+        }
+    }
+    else
+    {
+        /* AFD wants something to send, even if it is only a disconnect */
+        Elements = &EmptyElement;
+        RtlZeroMemory(&EmptyElement, sizeof(EmptyElement));
+        EmptyElement.Flags = AFD_TP_MEMORY;
+    }
+
+    for (i = 0; i < nElementCount; i++)
+    {
+        Elements[i].Length = lpPacketArray[i].cLength;
+        Elements[i].FileHandle = NULL;
+        Elements[i].FileOffset.QuadPart = 0;
+        Elements[i].Buffer = NULL;
+
+        if (lpPacketArray[i].dwElFlags & TP_ELEMENT_FILE)
+        {
+            Elements[i].Flags = AFD_TP_FILE;
+            Elements[i].FileHandle = lpPacketArray[i].hFile;
+            Elements[i].FileOffset = lpPacketArray[i].nFileOffset;
+        }
+        else
+        {
+            Elements[i].Flags = AFD_TP_MEMORY;
+            Elements[i].Buffer = lpPacketArray[i].pBuffer;
+        }
+    }
+
+    TransmitInfo.ElementArray = Elements;
+    TransmitInfo.ElementCount = nElementCount ? nElementCount : 1;
+    TransmitInfo.SendSize = nSendSize;
+    TransmitInfo.Flags = 0;
+
+    if (dwFlags & TF_DISCONNECT)
+        TransmitInfo.Flags |= AFD_TF_DISCONNECT;
+    if (dwFlags & TF_REUSE_SOCKET)
+        TransmitInfo.Flags |= AFD_TF_REUSE_SOCKET;
+
+    /* AFD takes its own copy of the elements */
+    Status = SockExtensionIoctl(Handle,
+                                IOCTL_AFD_TRANSMIT_PACKETS,
+                                &TransmitInfo,
+                                sizeof(TransmitInfo),
+                                NULL,
+                                0,
+                                lpOverlapped,
+                                &Information);
+
+    if (Elements != &EmptyElement)
+        HeapFree(GetProcessHeap(), 0, Elements);
+
+    if (NT_SUCCESS(Status) && (dwFlags & TF_DISCONNECT))
+    {
+        Socket->SharedData.SendShutdown = TRUE;
+
+        /* The socket can be handed to AcceptEx or ConnectEx again */
+        if (dwFlags & TF_REUSE_SOCKET)
+            Socket->SharedData.State = SocketOpen;
+    }
+
+    SockReenableAsyncSelectEvent(Socket, FD_WRITE);
+
+    return SockExtensionResult(Status, Information, NULL);
+}
+
+BOOL
+PASCAL
+MsafdTransmitPackets(SOCKET hSocket,
+                     LPTRANSMIT_PACKETS_ELEMENT lpPacketArray,
+                     DWORD nElementCount,
+                     DWORD nSendSize,
+                     LPOVERLAPPED lpOverlapped,
+                     DWORD dwFlags)
+{
+    TRACE("Called (%x)\n", hSocket);
+
+    if (nElementCount && !lpPacketArray)
+    {
+        SetLastError(WSAEINVAL);
+        return FALSE;
+    }
+
+    return SockTransmit(hSocket, lpPacketArray, nElementCount, nSendSize, lpOverlapped, dwFlags);
+}
+
+BOOL
+PASCAL
+MsafdTransmitFile(SOCKET hSocket,
+                  HANDLE hFile,
+                  DWORD nNumberOfBytesToWrite,
+                  DWORD nNumberOfBytesPerSend,
+                  LPOVERLAPPED lpOverlapped,
+                  LPTRANSMIT_FILE_BUFFERS lpTransmitBuffers,
+                  DWORD dwFlags)
+{
+    TRANSMIT_PACKETS_ELEMENT Elements[3];
+    LARGE_INTEGER Zero;
+    DWORD Count = 0;
+
+    TRACE("Called (%x)\n", hSocket);
+
+    /* TransmitFile is a transmit of head, file and tail */
+    if (lpTransmitBuffers && lpTransmitBuffers->HeadLength)
+    {
+        Elements[Count].dwElFlags = TP_ELEMENT_MEMORY;
+        Elements[Count].cLength = lpTransmitBuffers->HeadLength;
+        Elements[Count].pBuffer = lpTransmitBuffers->Head;
+        Count++;
+    }
+
+    if (hFile)
+    {
+        Elements[Count].dwElFlags = TP_ELEMENT_FILE;
+        Elements[Count].cLength = nNumberOfBytesToWrite;
+        Elements[Count].hFile = hFile;
+
+        /* The offset comes from the overlapped structure or the file */
+        if (lpOverlapped)
+        {
+            Elements[Count].nFileOffset.LowPart = lpOverlapped->Offset;
+            Elements[Count].nFileOffset.HighPart = lpOverlapped->OffsetHigh;
+        }
+        else
+        {
+            Zero.QuadPart = 0;
+            if (!SetFilePointerEx(hFile, Zero, &Elements[Count].nFileOffset, FILE_CURRENT))
+                return FALSE;
+        }
+        Count++;
+    }
+
+    if (lpTransmitBuffers && lpTransmitBuffers->TailLength)
+    {
+        Elements[Count].dwElFlags = TP_ELEMENT_MEMORY;
+        Elements[Count].cLength = lpTransmitBuffers->TailLength;
+        Elements[Count].pBuffer = lpTransmitBuffers->Tail;
+        Count++;
+    }
+
+    return SockTransmit(hSocket, Elements, Count, nNumberOfBytesPerSend, lpOverlapped, dwFlags);
+}
+
+BOOL
+PASCAL
+MsafdAcceptEx(SOCKET sListenSocket,
+              SOCKET sAcceptSocket,
+              PVOID lpOutputBuffer,
+              DWORD dwReceiveDataLength,
+              DWORD dwLocalAddressLength,
+              DWORD dwRemoteAddressLength,
+              LPDWORD lpdwBytesReceived,
+              LPOVERLAPPED lpOverlapped)
+{
+    PSOCKET_INFORMATION     ListenSocket;
+    PSOCKET_INFORMATION     AcceptSocket;
+    AFD_SUPER_ACCEPT_INFO   AcceptInfo;
+    ULONG_PTR               Information;
+    NTSTATUS                Status;
+
+    TRACE("Called (%x, %x)\n", sListenSocket, sAcceptSocket);
+
+    ListenSocket = GetSocketStructure(sListenSocket);
+    AcceptSocket = GetSocketStructure(sAcceptSocket);
+    if (!ListenSocket || !AcceptSocket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return FALSE;
+    }
+
+    if (!ListenSocket->SharedData.Listening ||
+        AcceptSocket->SharedData.State != SocketOpen ||
+        !lpOutputBuffer || !lpOverlapped)
+    {
+        SetLastError(WSAEINVAL);
+        return FALSE;
+    }
+
+    AcceptInfo.AcceptHandle = (HANDLE)sAcceptSocket;
+    AcceptInfo.ReceiveDataLength = dwReceiveDataLength;
+    AcceptInfo.LocalAddressLength = dwLocalAddressLength;
+    AcceptInfo.RemoteAddressLength = dwRemoteAddressLength;
+
+    Status = SockExtensionIoctl(sListenSocket,
+                                IOCTL_AFD_SUPER_ACCEPT,
+                                &AcceptInfo,
+                                sizeof(AcceptInfo),
+                                lpOutputBuffer,
+                                dwReceiveDataLength + dwLocalAddressLength + dwRemoteAddressLength,
+                                lpOverlapped,
+                                &Information);
+
+    SockReenableAsyncSelectEvent(ListenSocket, FD_ACCEPT);
+
+    return SockExtensionResult(Status, Information, lpdwBytesReceived);
+}
+
+VOID
+PASCAL
+MsafdGetAcceptExSockaddrs(PVOID lpOutputBuffer,
+                          DWORD dwReceiveDataLength,
+                          DWORD dwLocalAddressLength,
+                          DWORD dwRemoteAddressLength,
+                          struct sockaddr **LocalSockaddr,
+                          LPINT LocalSockaddrLength,
+                          struct sockaddr **RemoteSockaddr,
+                          LPINT RemoteSockaddrLength)
+{
+    PAFD_ACCEPT_ADDRESS LocalAddress;
+    PAFD_ACCEPT_ADDRESS RemoteAddress;
+
+    UNREFERENCED_PARAMETER(dwRemoteAddressLength);
+
+    /* The address areas follow the received data */
+    LocalAddress = (PAFD_ACCEPT_ADDRESS)((PCHAR)lpOutputBuffer + dwReceiveDataLength);
+    RemoteAddress = (PAFD_ACCEPT_ADDRESS)((PCHAR)LocalAddress + dwLocalAddressLength);
+
+    *LocalSockaddr = (struct sockaddr *)&LocalAddress->Family;
+    *LocalSockaddrLength = LocalAddress->Length;
+    *RemoteSockaddr = (struct sockaddr *)&RemoteAddress->Family;
+    *RemoteSockaddrLength = RemoteAddress->Length;
+}
+
+BOOL
+PASCAL
+MsafdConnectEx(SOCKET s,
+               const struct sockaddr *name,
+               int namelen,
+               PVOID lpSendBuffer,
+               DWORD dwSendDataLength,
+               LPDWORD lpdwBytesSent,
+               LPOVERLAPPED lpOverlapped)
+{
+    PSOCKET_INFORMATION     Socket;
+    PAFD_CONNECT_INFO       ConnectInfo;
+    ULONG_PTR               Information;
+    NTSTATUS                Status;
+    INT                     SocketDataLength;
+    ULONG                   ConnectInfoLength;
+
+    TRACE("Called (%x)\n", s);
+
+    Socket = GetSocketStructure(s);
+    if (!Socket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return FALSE;
+    }
+
+    /* Unlike connect() the socket has to be bound already */
+    if (Socket->SharedData.State != SocketBound || !lpOverlapped)
+    {
+        SetLastError(WSAEINVAL);
+        return FALSE;
+    }
+
+    if (!name || namelen < (int)sizeof(struct sockaddr))
+    {
+        SetLastError(WSAEFAULT);
+        return FALSE;
+    }
+
+    /* Calculate the size of name->sa_data */
+    SocketDataLength = namelen - FIELD_OFFSET(struct sockaddr, sa_data);
+    ConnectInfoLength = FIELD_OFFSET(AFD_CONNECT_INFO,
+                                     RemoteAddress.Address[0].Address[SocketDataLength]);
+
+    ConnectInfo = HeapAlloc(GetProcessHeap(), 0, ConnectInfoLength);
+    if (!ConnectInfo)
+    {
+        SetLastError(WSAENOBUFS);
+        return FALSE;
+    }
+
+    /* Set up Address in TDI Format */
+    ConnectInfo->Root = 0;
+    ConnectInfo->UseSAN = FALSE;
+    ConnectInfo->Unknown = 0;
+    ConnectInfo->RemoteAddress.TAAddressCount = 1;
+    ConnectInfo->RemoteAddress.Address[0].AddressLength = SocketDataLength;
+    ConnectInfo->RemoteAddress.Address[0].AddressType = name->sa_family;
+    RtlCopyMemory(ConnectInfo->RemoteAddress.Address[0].Address,
+                  name->sa_data,
+                  SocketDataLength);
+
+    if (Socket->SharedData.AsyncEvents & FD_CONNECT)
+    {
+        Socket->SharedData.AsyncDisabledEvents |= FD_CONNECT | FD_WRITE;
+    }
+
+    /* The data to send goes in as the output buffer */
+    Status = SockExtensionIoctl(s,
+                                IOCTL_AFD_SUPER_CONNECT,
+                                ConnectInfo,
+                                ConnectInfoLength,
+                                lpSendBuffer,
+                                lpSendBuffer ? dwSendDataLength : 0,
+                                lpOverlapped,
+                                &Information);
+
+    HeapFree(GetProcessHeap(), 0, ConnectInfo);
+
+    SockReenableAsyncSelectEvent(Socket, FD_WRITE);
+    SockReenableAsyncSelectEvent(Socket, FD_CONNECT);
+
+    return SockExtensionResult(Status, Information, lpdwBytesSent);
+}
+
+BOOL
+PASCAL
+MsafdDisconnectEx(SOCKET s,
+                  LPOVERLAPPED lpOverlapped,
+                  DWORD dwFlags,
+                  DWORD dwReserved)
+{
+    PSOCKET_INFORMATION     Socket;
+    AFD_DISCONNECT_INFO     DisconnectInfo;
+    ULONG_PTR               Information;
+    NTSTATUS                Status;
+
+    TRACE("Called (%x)\n", s);
+
+    Socket = GetSocketStructure(s);
+    if (!Socket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return FALSE;
+    }
+
+    if (dwReserved || (dwFlags & ~TF_REUSE_SOCKET))
+    {
+        SetLastError(WSAEINVAL);
+        return FALSE;
+    }
+
+    if (Socket->SharedData.State != SocketConnected)
+    {
+        SetLastError(WSAENOTCONN);
+        return FALSE;
+    }
+
+    /* A graceful close, with the socket recycled if asked */
+    DisconnectInfo.Timeout = RtlConvertLongToLargeInteger(-1000000);
+    DisconnectInfo.DisconnectType = AFD_DISCONNECT_SEND;
+    if (dwFlags & TF_REUSE_SOCKET)
+        DisconnectInfo.DisconnectType |= AFD_DISCONNECT_REUSE;
+
+    Status = SockExtensionIoctl(s,
+                                IOCTL_AFD_DISCONNECT,
+                                &DisconnectInfo,
+                                sizeof(DisconnectInfo),
+                                NULL,
+                                0,
+                                lpOverlapped,
+                                &Information);
+
+    if (NT_SUCCESS(Status))
+    {
+        Socket->SharedData.SendShutdown = TRUE;
+
+        if (dwFlags & TF_REUSE_SOCKET)
+            Socket->SharedData.State = SocketOpen;
+    }
+
+    return SockExtensionResult(Status, Information, NULL);
+}
+
+INT
+PASCAL
+MsafdWSARecvMsg(SOCKET s,
+                LPWSAMSG lpMsg,
+                LPDWORD lpdwNumberOfBytesRecvd,
+                LPWSAOVERLAPPED lpOverlapped,
+                LPWSAOVERLAPPED_COMPLETION_ROUTINE lpCompletionRoutine)
+{
+    PSOCKET_INFORMATION     Socket;
+    INT                     Errno;
+    INT                     Result;
+
+    TRACE("Called (%x)\n", s);
+
+    Socket = GetSocketStructure(s);
+    if (!Socket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return SOCKET_ERROR;
+    }
+
+    if (!lpMsg)
+    {
+        SetLastError(WSAEFAULT);
+        return SOCKET_ERROR;
+    }
+
+    if (!(Socket->SharedData.ServiceFlags1 & XP1_CONNECTIONLESS))
+    {
+        SetLastError(WSAEINVAL);
+        return SOCKET_ERROR;
+    }
+
+    /* No control data is delivered */
+    lpMsg->Control.len = 0;
+
+    Result = WSPRecvFrom(s,
+                         lpMsg->lpBuffers,
+                         lpMsg->dwBufferCount,
+                         lpdwNumberOfBytesRecvd,
+                         &lpMsg->dwFlags,
+                         lpMsg->name,
+                         lpMsg->name ? &lpMsg->namelen : NULL,
+                         lpOverlapped,
+                         lpCompletionRoutine,
+                         NULL,
+                         &Errno);
+
+    if (Result == SOCKET_ERROR)
+    {
+        if (Errno == WSAEMSGSIZE)
+            lpMsg->dwFlags |= MSG_TRUNC;
+
+        SetLastError(Errno);
+    }
+
+    return Result;
+}
+
+/* The records are filled in by AFD as they are */
+C_ASSERT(sizeof(RECVDATAGRAM) == sizeof(AFD_RECEIVED_DATAGRAM));
+C_ASSERT(FIELD_OFFSET(RECVDATAGRAM, Data) == FIELD_OFFSET(AFD_RECEIVED_DATAGRAM, Data));
+C_ASSERT(RECVDATAGRAM_TRUNCATED == AFD_DATAGRAM_TRUNCATED);
+
+INT
+PASCAL
+MsafdRecvDatagrams(SOCKET s,
+                   LPWSABUF lpBuffer,
+                   DWORD dwMaxDatagrams,
+                   LPDWORD lpdwNumberOfBytesRecvd,
+                   LPWSAOVERLAPPED lpOverlapped)
+{
+    PSOCKET_INFORMATION     Socket;
+    AFD_RECV_DATAGRAMS_INFO RecvInfo;
+    ULONG_PTR               Information;
+    NTSTATUS                Status;
+    INT                     Errno;
+
+    TRACE("Called (%x)\n", s);
+
+    Socket = GetSocketStructure(s);
+    if (!Socket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return SOCKET_ERROR;
+    }
+
+    if (!lpBuffer)
+    {
+        SetLastError(WSAEFAULT);
+        return SOCKET_ERROR;
+    }
+
+    if (!(Socket->SharedData.ServiceFlags1 & XP1_CONNECTIONLESS))
+    {
+        SetLastError(WSAEINVAL);
+        return SOCKET_ERROR;
+    }
+
+    RecvInfo.BufferArray = (PAFD_WSABUF)lpBuffer;
+    RecvInfo.BufferCount = 1;
+    RecvInfo.AfdFlags = Socket->SharedData.NonBlocking ? AFD_IMMEDIATE : 0;
+    RecvInfo.MaxDatagrams = dwMaxDatagrams;
+    if (lpOverlapped)
+        RecvInfo.AfdFlags |= AFD_OVERLAPPED;
+
+    Status = SockExtensionIoctl(s,
+                                IOCTL_AFD_RECV_DATAGRAMS,
+                                &RecvInfo,
+                                sizeof(RecvInfo),
+                                NULL,
+                                0,
+                                lpOverlapped,
+                                &Information);
+
+    /* Re-enable Async Event */
+    SockReenableAsyncSelectEvent(Socket, FD_READ);
+
+    if (MsafdReturnWithErrno(Status, &Errno, (DWORD)Information, lpdwNumberOfBytesRecvd) == SOCKET_ERROR)
+    {
+        SetLastError(Errno);
+        return SOCKET_ERROR;
+    }
+
+    return NO_ERROR;
+}
+
+/* Also reached through SIO_EXT_SENDMSG, which is how ws2_32 sends */
+INT
+SockSendMsg(SOCKET s,
+            LPWSAMSG lpMsg,
+            DWORD dwFlags,
+            LPDWORD lpNumberOfBytesSent,
+            LPWSAOVERLAPPED lpOverlapped,
+            LPWSAOVERLAPPED_COMPLETION_ROUTINE lpCompletionRoutine,
+            LPWSATHREADID lpThreadId,
+            LPINT lpErrno)
+{
+    if (!lpMsg)
+    {
+        *lpErrno = WSAEFAULT;
+        return SOCKET_ERROR;
+    }
+
+    /* No control data is understood */
+    if (lpMsg->Control.len != 0)
+    {
+        *lpErrno = WSAEINVAL;
+        return SOCKET_ERROR;
+    }
+
+    if (lpMsg->name)
+    {
+        return WSPSendTo(s,
+                         lpMsg->lpBuffers,
+                         lpMsg->dwBufferCount,
+                         lpNumberOfBytesSent,
+                         dwFlags,
+                         lpMsg->name,
+                         lpMsg->namelen,
+                         lpOverlapped,
+                         lpCompletionRoutine,
+                         lpThreadId,
+                         lpErrno);
+    }
+
+    return WSPSend(s,
+                   lpMsg->lpBuffers,
+                   lpMsg->dwBufferCount,
+                   lpNumberOfBytesSent,
+                   dwFlags,
+                   lpOverlapped,
+                   lpCompletionRoutine,
+                   lpThreadId,
+                   lpErrno);
+}
+
+INT
+PASCAL
+MsafdWSASendMsg(SOCKET s,
+                LPWSAMSG lpMsg,
+                DWORD dwFlags,
+                LPDWORD lpNumberOfBytesSent,
+                LPWSAOVERLAPPED lpOverlapped,
+                LPWSAOVERLAPPED_COMPLETION_ROUTINE lpCompletionRoutine)
+{
+    INT Errno;
+
+    TRACE("Called (%x)\n", s);
+
+    if (SockSendMsg(s, lpMsg, dwFlags, lpNumberOfBytesSent, lpOverlapped,
+                    lpCompletionRoutine, NULL, &Errno) == SOCKET_ERROR)
+    {
+        SetLastError(Errno);
+        return SOCKET_ERROR;
+    }
+
+    return NO_ERROR;
+}
+
+static const struct
+{
+    GUID Guid;
+    PVOID Function;
+} SockExtensionFunctions[] =
+{
+    { WSAID_ACCEPTEX, MsafdAcceptEx },
+    { WSAID_CONNECTEX, MsafdConnectEx },
+    { WSAID_DISCONNECTEX, MsafdDisconnectEx },
+    { WSAID_GETACCEPTEXSOCKADDRS, MsafdGetAcceptExSockaddrs },
+    { WSAID_TRANSMITFILE, MsafdTransmitFile },
+    { WSAID_TRANSMITPACKETS, MsafdTransmitPackets },
+    { WSAID_WSARECVMSG, MsafdWSARecvMsg },
+    { WSAID_WSASENDMSG, MsafdWSASendMsg },
+    { WSAID_RECVDATAGRAMS, MsafdRecvDatagrams },
+};
+
+PVOID
+SockGetExtensionFunction(LPGUID Guid)
+{
+    ULONG i;
+
+    for (i = 0; i < sizeof(SockExtensionFunctions) / sizeof(SockExtensionFunctions[0]); i++)
+    {
+        if (IsEqualGUID(Guid, &SockExtensionFunctions[i].Guid))
+            return SockExtensionFunctions[i].Function;
+    }
+
+    return NULL;
+}
+
+/* EOF */
@@ -14,9 +14,15 @@
 #define _INC_WINDOWS
 #define COM_NO_WINDOWS_H
 
+/* WSAPoll and the socket notifications need Vista headers */
+#undef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+
 #include <windef.h>
 #include <winbase.h>
 #include <ws2spi.h>
+#include <mswsock.h>
+#include <winsock/mswinsock.h>
 #define NTOS_MODE_USER
 #include <ndk/exfuncs.h>
 #include <ndk/iofuncs.h>
@@ -476,6 +482,23 @@ SockReenableAsyncSelectEvent (
     IN ULONG Event
     );
 
+PVOID
+SockGetExtensionFunction(
+    LPGUID Guid
+);
+
+INT
+SockSendMsg(
+    SOCKET s,
+    LPWSAMSG lpMsg,
+    DWORD dwFlags,
+    LPDWORD lpNumberOfBytesSent,
+    LPWSAOVERLAPPED lpOverlapped,
+    LPWSAOVERLAPPED_COMPLETION_ROUTINE lpCompletionRoutine,
+    LPWSATHREADID lpThreadId,
+    LPINT lpErrno
+);
+
 typedef VOID (*PASYNC_COMPLETION_ROUTINE)(PVOID Context, PIO_STATUS_BLOCK IoStatusBlock);
 
 FORCEINLINE
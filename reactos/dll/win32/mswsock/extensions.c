@@ -51,4 +51,70 @@ TransmitFile(SOCKET Socket,
                          Flags);
 }
 
+/*
+ * @implemented
+ */
+BOOL
+WINAPI
+AcceptEx(SOCKET ListenSocket,
+         SOCKET AcceptSocket,
+         PVOID OutputBuffer,
+         DWORD ReceiveDataLength,
+         DWORD LocalAddressLength,
+         DWORD RemoteAddressLength,
+         LPDWORD BytesReceived,
+         LPOVERLAPPED Overlapped)
+{
+  static GUID AcceptExGUID = WSAID_ACCEPTEX;
+  LPFN_ACCEPTEX pfnAcceptEx;
+  DWORD cbBytesReturned;
+
+  if (WSAIoctl(ListenSocket,
+               SIO_GET_EXTENSION_FUNCTION_POINTER,
+               &AcceptExGUID,
+               sizeof(AcceptExGUID),
+               &pfnAcceptEx,
+               sizeof(pfnAcceptEx),
+               &cbBytesReturned,
+               NULL,
+               NULL) == SOCKET_ERROR)
+  {
+    return FALSE;
+  }
+
+  return pfnAcceptEx(ListenSocket,
+                     AcceptSocket,
+                     OutputBuffer,
+                     ReceiveDataLength,
+                     LocalAddressLength,
+                     RemoteAddressLength,
+                     BytesReceived,
+                     Overlapped);
+}
+
+/*
+ * @implemented
+ */
+VOID
+WINAPI
+GetAcceptExSockaddrs(PVOID OutputBuffer,
+                     DWORD ReceiveDataLength,
+                     DWORD LocalAddressLength,
+                     DWORD RemoteAddressLength,
+                     LPSOCKADDR* LocalSockaddr,
+                     LPINT LocalSockaddrLength,
+                     LPSOCKADDR* RemoteSockaddr,
+                     LPINT RemoteSockaddrLength)
+{
+  PCHAR LocalArea = (PCHAR)OutputBuffer + ReceiveDataLength;
+  PCHAR RemoteArea = LocalArea + LocalAddressLength;
+
+  /* There is no socket to ask, but AcceptEx leaves each address area
+   * as the address length followed by the address */
+  *LocalSockaddrLength = *(PINT)LocalArea;
+  *LocalSockaddr = (LPSOCKADDR)(LocalArea + sizeof(INT));
+  *RemoteSockaddrLength = *(PINT)RemoteArea;
+  *RemoteSockaddr = (LPSOCKADDR)(RemoteArea + sizeof(INT));
+}
+
 /* EOF */
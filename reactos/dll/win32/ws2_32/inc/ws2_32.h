@@ -11,7 +11,9 @@
 #define WIN32_NO_STATUS
 #define _INC_WINDOWS
 #define COM_NO_WINDOWS_H
-//#define _WIN32_WINNT 0x502
+/* WSAPoll and the socket notifications need Vista headers */
+#undef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
 #define NTOS_MODE_USER
 #define _CRT_SECURE_NO_DEPRECATE
 #define WINSOCK_API_LINKAGE
@@ -27,12 +29,14 @@
 #include <winnls.h>
 #include <winuser.h>
 #include <ws2spi.h>
+#include <ndk/iofuncs.h>
 #include <ndk/rtlfuncs.h>
 #include <pseh/pseh2.h>
 
 /* Winsock Helper Header */
 #include <ws2help.h>
 
+#include <mswinsock.h>
 #include <nsp_dns.h>
 #include <iptypes.h>
 
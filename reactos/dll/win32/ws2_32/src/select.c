@@ -114,6 +114,344 @@ select(IN INT s,
     return SOCKET_ERROR;
 }
 
+/* Polls the sockets of fdArray that belong to Provider with one call */
+static
+INT
+WsPollProvider(IN PTPROVIDER Provider,
+               IN OUT LPWSAPOLLFD fdArray,
+               IN PWSSOCKET *Sockets,
+               IN ULONG fds,
+               IN LPWSAPOLLDATA PollData,
+               IN INT timeout,
+               IN LPWSATHREADID ThreadId,
+               OUT LPINT lpErrno)
+{
+    SOCKET Handle = INVALID_SOCKET;
+    DWORD PollDataSize, BytesReturned;
+    ULONG i, j;
+    INT Status;
+
+    for (i = 0, j = 0; i < fds; i++)
+    {
+        if (!Sockets[i] || Sockets[i]->Provider != Provider) continue;
+
+        if (Handle == INVALID_SOCKET) Handle = fdArray[i].fd;
+        PollData->fdArray[j++] = fdArray[i];
+    }
+
+    PollDataSize = FIELD_OFFSET(WSAPOLLDATA, fdArray) + j * sizeof(WSAPOLLFD);
+    PollData->result = 0;
+    PollData->fds = j;
+    PollData->timeout = timeout;
+
+    /* Make the call */
+    Status = Provider->Service.lpWSPIoctl(Handle,
+                                          SIO_EXT_POLL,
+                                          PollData,
+                                          PollDataSize,
+                                          PollData,
+                                          PollDataSize,
+                                          &BytesReturned,
+                                          NULL,
+                                          NULL,
+                                          ThreadId,
+                                          lpErrno);
+    if (Status != ERROR_SUCCESS)
+    {
+        /* If everything seemed fine, then the WSP call failed itself */
+        if (*lpErrno == NO_ERROR) *lpErrno = WSASYSCALLFAILURE;
+        return SOCKET_ERROR;
+    }
+
+    /* Copy the results back in the caller's order */
+    for (i = 0, j = 0; i < fds; i++)
+    {
+        if (!Sockets[i] || Sockets[i]->Provider != Provider) continue;
+
+        fdArray[i].revents = PollData->fdArray[j++].revents;
+    }
+
+    return PollData->result;
+}
+
+/*
+ * @implemented
+ *
+ * A provider can only wait on its own sockets, so only a set from a
+ * single provider is waited on with one call. A set mixing providers is
+ * polled round after round, sleeping in between, which delays the wake up
+ * by up to a round and costs CPU time while nothing is ready. Waiting on all
+ * the providers at once would need WSPEventSelect, which would change the
+ * event selection and blocking mode of the caller's sockets.
+ */
+INT
+WSAAPI
+WSAPoll(IN OUT LPWSAPOLLFD fdArray,
+        IN ULONG fds,
+        IN INT timeout)
+{
+    PWSSOCKET *Sockets;
+    PTPROVIDER Provider = NULL;
+    LPWSAPOLLDATA PollData;
+    LPWSATHREADID ThreadId;
+    BOOLEAN Mixed = FALSE;
+    DWORD StartTime, Elapsed;
+    ULONG i, j, Count = 0;
+    INT Invalid = 0, Ready;
+    INT Status;
+    INT Wait;
+    INT ErrorCode;
+
+    DPRINT("WSAPoll: %p %lu %d\n", fdArray, fds, timeout);
+
+    /* Check for WSAStartup */
+    ErrorCode = WsQuickPrologTid(&ThreadId);
+
+    if (ErrorCode != ERROR_SUCCESS)
+    {
+        SetLastError(ErrorCode);
+        return SOCKET_ERROR;
+    }
+
+    if (!fdArray || !fds)
+    {
+        SetLastError(WSAEINVAL);
+        return SOCKET_ERROR;
+    }
+
+    Sockets = HeapAlloc(WsSockHeap, HEAP_ZERO_MEMORY, fds * sizeof(PWSSOCKET));
+    if (!Sockets)
+    {
+        SetLastError(WSAENOBUFS);
+        return SOCKET_ERROR;
+    }
+
+    /* Unknown sockets are reported right away, the others keep their
+     * reference for the call */
+    for (i = 0; i < fds; i++)
+    {
+        fdArray[i].revents = 0;
+
+        if (fdArray[i].fd == INVALID_SOCKET) continue;
+
+        Sockets[i] = WsSockGetSocket(fdArray[i].fd);
+        if (!Sockets[i])
+        {
+            fdArray[i].revents = POLLNVAL;
+            Invalid++;
+            continue;
+        }
+
+        if (!Provider) Provider = Sockets[i]->Provider;
+        else if (Sockets[i]->Provider != Provider) Mixed = TRUE;
+
+        Count++;
+    }
+
+    /* Nothing to wait for */
+    if (!Count)
+    {
+        HeapFree(WsSockHeap, 0, Sockets);
+
+        if (Invalid) return Invalid;
+
+        SetLastError(WSAEINVAL);
+        return SOCKET_ERROR;
+    }
+
+    PollData = HeapAlloc(WsSockHeap,
+                         0,
+                         FIELD_OFFSET(WSAPOLLDATA, fdArray) + Count * sizeof(WSAPOLLFD));
+    if (!PollData)
+    {
+        Status = SOCKET_ERROR;
+        ErrorCode = WSAENOBUFS;
+        goto Quickie;
+    }
+
+    /* When the sockets come from more than one provider, each provider
+     * is polled in turn without waiting until something is ready or the
+     * timeout runs out. This is a known limitation, see above */
+    StartTime = GetTickCount();
+    for (;;)
+    {
+        /* Don't wait if we have something to report already */
+        Wait = (Invalid || Mixed) ? 0 : timeout;
+        Ready = 0;
+
+        for (i = 0; i < fds; i++)
+        {
+            if (!Sockets[i]) continue;
+
+            /* Skip providers that were polled already in this round */
+            for (j = 0; j < i; j++)
+            {
+                if (Sockets[j] && Sockets[j]->Provider == Sockets[i]->Provider) break;
+            }
+            if (j < i) continue;
+
+            Status = WsPollProvider(Sockets[i]->Provider,
+                                    fdArray,
+                                    Sockets,
+                                    fds,
+                                    PollData,
+                                    Wait,
+                                    ThreadId,
+                                    &ErrorCode);
+            if (Status == SOCKET_ERROR) goto Quickie;
+
+            Ready += Status;
+        }
+
+        if (Ready || Invalid || !Mixed || !timeout) break;
+
+        if (timeout > 0)
+        {
+            Elapsed = GetTickCount() - StartTime;
+            if (Elapsed >= (DWORD)timeout) break;
+            Sleep((DWORD)timeout - Elapsed < 10 ? (DWORD)timeout - Elapsed : 10);
+        }
+        else
+        {
+            Sleep(10);
+        }
+    }
+
+    Status = Ready + Invalid;
+
+Quickie:
+    /* Deference the Socket Contexts */
+    for (i = 0; i < fds; i++)
+    {
+        if (Sockets[i]) WsSockDereference(Sockets[i]);
+    }
+
+    HeapFree(WsSockHeap, 0, Sockets);
+    if (PollData) HeapFree(WsSockHeap, 0, PollData);
+
+    /* Return with an error */
+    if (Status == SOCKET_ERROR) SetLastError(ErrorCode);
+    return Status;
+}
+
+/*
+ * @implemented
+ */
+DWORD
+WSAAPI
+ProcessSocketNotifications(IN HANDLE completionPort,
+                           IN UINT32 registrationCount,
+                           IN OUT SOCK_NOTIFY_REGISTRATION *registrationInfos,
+                           IN UINT32 timeoutMs,
+                           IN ULONG completionCount,
+                           OUT OVERLAPPED_ENTRY *completionPortEntries,
+                           OUT UINT32 *receivedEntryCount)
+{
+    PWSSOCKET Socket;
+    SOCK_NOTIFY_REQUEST Request;
+    LPWSATHREADID ThreadId;
+    IO_STATUS_BLOCK IoStatus;
+    LARGE_INTEGER Timeout;
+    PLARGE_INTEGER TimePtr;
+    PVOID CompletionKey, ApcContext;
+    NTSTATUS NtStatus;
+    DWORD BytesReturned;
+    ULONG i;
+    INT Status;
+    INT ErrorCode;
+
+    DPRINT("ProcessSocketNotifications: %p %u %p %u %lu\n",
+           completionPort, registrationCount, registrationInfos,
+           timeoutMs, completionCount);
+
+    /* Check for WSAStartup */
+    ErrorCode = WsQuickPrologTid(&ThreadId);
+    if (ErrorCode != ERROR_SUCCESS) return ErrorCode;
+
+    if (!completionPort ||
+        (registrationCount && !registrationInfos) ||
+        (completionCount && (!completionPortEntries || !receivedEntryCount)))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    /* Hand every registration to the provider of its socket */
+    for (i = 0; i < registrationCount; i++)
+    {
+        Socket = WsSockGetSocket(registrationInfos[i].socket);
+        if (!Socket)
+        {
+            registrationInfos[i].registrationResult = WSAENOTSOCK;
+            continue;
+        }
+
+        Request.CompletionPort = completionPort;
+        Request.Registration = registrationInfos[i];
+
+        Status = Socket->Provider->Service.lpWSPIoctl(registrationInfos[i].socket,
+                                                      SIO_SOCK_NOTIFY,
+                                                      &Request,
+                                                      sizeof(Request),
+                                                      NULL,
+                                                      0,
+                                                      &BytesReturned,
+                                                      NULL,
+                                                      NULL,
+                                                      ThreadId,
+                                                      &ErrorCode);
+
+        /* Deference the Socket Context */
+        WsSockDereference(Socket);
+
+        if (Status == ERROR_SUCCESS) ErrorCode = ERROR_SUCCESS;
+        else if (ErrorCode == NO_ERROR) ErrorCode = WSASYSCALLFAILURE;
+
+        registrationInfos[i].registrationResult = ErrorCode;
+    }
+
+    /* Only registering */
+    if (!completionCount) return ERROR_SUCCESS;
+
+    /* Convert the timeout */
+    if (timeoutMs == INFINITE)
+    {
+        TimePtr = NULL;
+    }
+    else
+    {
+        Timeout.QuadPart = -(LONGLONG)UInt32x32To64(timeoutMs, 10000);
+        TimePtr = &Timeout;
+    }
+
+    /* Wait for the first entry, then take whatever else is queued */
+    for (i = 0; i < completionCount; i++)
+    {
+        NtStatus = NtRemoveIoCompletion(completionPort,
+                                        &CompletionKey,
+                                        &ApcContext,
+                                        &IoStatus,
+                                        TimePtr);
+        if (NtStatus == STATUS_TIMEOUT) break;
+
+        if (!NT_SUCCESS(NtStatus))
+        {
+            if (i) break;
+            return RtlNtStatusToDosError(NtStatus);
+        }
+
+        completionPortEntries[i].lpCompletionKey = (ULONG_PTR)CompletionKey;
+        completionPortEntries[i].lpOverlapped = ApcContext;
+        completionPortEntries[i].Internal = IoStatus.Status;
+        completionPortEntries[i].dwNumberOfBytesTransferred = (DWORD)IoStatus.Information;
+
+        Timeout.QuadPart = 0;
+        TimePtr = &Timeout;
+    }
+
+    *receivedEntryCount = i;
+    return i ? ERROR_SUCCESS : WAIT_TIMEOUT;
+}
+
 /*
  * @unimplemented
  */
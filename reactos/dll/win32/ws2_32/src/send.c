@@ -239,6 +239,72 @@ WSASendDisconnect(IN SOCKET s,
     return SOCKET_ERROR;
 }
 
+/*
+ * @implemented
+ */
+INT
+WSAAPI
+WSASendMsg(IN SOCKET Handle,
+           IN LPWSAMSG lpMsg,
+           IN DWORD dwFlags,
+           OUT LPDWORD lpNumberOfBytesSent,
+           IN LPWSAOVERLAPPED lpOverlapped,
+           IN LPWSAOVERLAPPED_COMPLETION_ROUTINE lpCompletionRoutine)
+{
+    PWSSOCKET Socket;
+    INT Status;
+    INT ErrorCode;
+    LPWSATHREADID ThreadId;
+    WSASENDMSG SendMsg;
+    DWORD BytesReturned;
+    DPRINT("WSASendMsg: %lx, %lx, %p\n", Handle, dwFlags, lpMsg);
+
+    /* Check for WSAStartup */
+    if ((ErrorCode = WsQuickPrologTid(&ThreadId)) == ERROR_SUCCESS)
+    {
+        /* Get the Socket Context */
+        if ((Socket = WsSockGetSocket(Handle)))
+        {
+            /* The provider takes the message through an ioctl */
+            SendMsg.lpMsg = lpMsg;
+            SendMsg.dwFlags = dwFlags;
+            SendMsg.lpNumberOfBytesSent = lpNumberOfBytesSent;
+            SendMsg.lpOverlapped = lpOverlapped;
+            SendMsg.lpCompletionRoutine = lpCompletionRoutine;
+
+            /* Make the call */
+            Status = Socket->Provider->Service.lpWSPIoctl(Handle,
+                                                          SIO_EXT_SENDMSG,
+                                                          &SendMsg,
+                                                          sizeof(SendMsg),
+                                                          NULL,
+                                                          0,
+                                                          &BytesReturned,
+                                                          NULL,
+                                                          NULL,
+                                                          ThreadId,
+                                                          &ErrorCode);
+            /* Deference the Socket Context */
+            WsSockDereference(Socket);
+
+            /* Return Provider Value */
+            if (Status == ERROR_SUCCESS) return Status;
+
+            /* If everything seemed fine, then the WSP call failed itself */
+            if (ErrorCode == NO_ERROR) ErrorCode = WSASYSCALLFAILURE;
+        }
+        else
+        {
+            /* No Socket Context Found */
+            ErrorCode = WSAENOTSOCK;
+        }
+    }
+
+    /* Return with an Error */
+    SetLastError(ErrorCode);
+    return SOCKET_ERROR;
+}
+
 /*
  * @implemented
  */
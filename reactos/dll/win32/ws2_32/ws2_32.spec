@@ -46,6 +46,7 @@
 @ stdcall WSANSPIoctl(long long ptr long ptr long ptr ptr)
 @ stdcall WSANtohl(long long ptr)
 @ stdcall WSANtohs(long long ptr)
+@ stdcall WSAPoll(ptr long long)
 @ stdcall WSAProviderConfigChange(ptr ptr ptr)
 @ stdcall WSARecv(long ptr long ptr ptr ptr ptr)
 @ stdcall WSARecvDisconnect(long ptr)
@@ -54,6 +55,7 @@
 @ stdcall WSAResetEvent(long)
 @ stdcall WSASend(long ptr long ptr long ptr ptr)
 @ stdcall WSASendDisconnect(long ptr)
+@ stdcall WSASendMsg(long ptr long ptr ptr ptr)
 @ stdcall WSASendTo(long ptr long ptr long ptr long ptr ptr)
 109 stdcall WSASetBlockingHook(ptr)
 @ stdcall WSASetEvent(long)
@@ -115,3 +117,4 @@
 23  stdcall  socket(long long long)
 @ stdcall GetAddrInfoW(wstr wstr ptr ptr)
 @ stdcall GetNameInfoW(ptr long wstr long wstr long long)
+@ stdcall ProcessSocketNotifications(ptr long ptr long long ptr ptr)
@@ -213,6 +213,9 @@ GetTdiTypeId(
              case TCP_NODELAY:
                  *TdiId = TCP_SOCKET_NODELAY;
                  return;
+             case TCP_CORK:
+                 *TdiId = TCP_SOCKET_CORK;
+                 return;
              default:
                  break;
           }
@@ -709,6 +712,7 @@ WSHSetSocketInformation(
             switch (OptionName)
             {
                 case TCP_NODELAY:
+                case TCP_CORK:
                     if (OptionLength < sizeof(CHAR))
                     {
                         return WSAEFAULT;
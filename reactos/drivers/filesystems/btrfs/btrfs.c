@@ -2025,6 +2025,21 @@ void STDCALL uninit(device_extension* Vcb, BOOL flush) {
     
     ExFreePool(Vcb->threads.threads);
     
+    for (i = 0; i < Vcb->calcthreads.num_threads; i++) {
+        Vcb->calcthreads.threads[i].quit = TRUE;
+    }
+    
+    KeSetEvent(&Vcb->calcthreads.event, 0, FALSE);
+    
+    for (i = 0; i < Vcb->calcthreads.num_threads; i++) {
+        KeWaitForSingleObject(&Vcb->calcthreads.threads[i].finished, Executive, KernelMode, FALSE, NULL);
+        
+        ZwClose(Vcb->calcthreads.threads[i].handle);
+    }
+    
+    if (Vcb->calcthreads.threads)
+        ExFreePool(Vcb->calcthreads.threads);
+    
     time.QuadPart = 0;
     KeSetTimer(&Vcb->flush_thread_timer, time, NULL); // trigger the timer early
     KeWaitForSingleObject(&Vcb->flush_thread_finished, Executive, KernelMode, FALSE, NULL);
@@ -3420,6 +3435,43 @@ static NTSTATUS create_worker_threads(PDEVICE_OBJECT DeviceObject) {
     return STATUS_SUCCESS;
 }
 
+static void create_calc_threads(PDEVICE_OBJECT DeviceObject) {
+    device_extension* Vcb = DeviceObject->DeviceExtension;
+    ULONG i;
+    NTSTATUS Status;
+    
+    InitializeListHead(&Vcb->calcthreads.job_list);
+    KeInitializeSpinLock(&Vcb->calcthreads.spin_lock);
+    KeInitializeEvent(&Vcb->calcthreads.event, NotificationEvent, FALSE);
+    
+    Vcb->calcthreads.num_threads = 0;
+    
+    // without threads, calculations are done inline, so this isn't fatal
+    Vcb->calcthreads.threads = ExAllocatePoolWithTag(NonPagedPool, sizeof(drv_calc_thread) * KeQueryActiveProcessorCount(NULL), ALLOC_TAG);
+    if (!Vcb->calcthreads.threads) {
+        WARN("out of memory, calculating inline\n");
+        return;
+    }
+    
+    RtlZeroMemory(Vcb->calcthreads.threads, sizeof(drv_calc_thread) * KeQueryActiveProcessorCount(NULL));
+    
+    // one thread per CPU
+    for (i = 0; i < KeQueryActiveProcessorCount(NULL); i++) {
+        Vcb->calcthreads.threads[i].DeviceObject = DeviceObject;
+        KeInitializeEvent(&Vcb->calcthreads.threads[i].finished, NotificationEvent, FALSE);
+        
+        Status = PsCreateSystemThread(&Vcb->calcthreads.threads[i].handle, 0, NULL, NULL, NULL, calc_thread, &Vcb->calcthreads.threads[i]);
+        if (!NT_SUCCESS(Status)) {
+            ERR("PsCreateSystemThread returned %08x\n", Status);
+            break;
+        }
+        
+        Vcb->calcthreads.num_threads++;
+    }
+    
+    // if we couldn't create any thread, everything is just done inline
+}
+
 BOOL add_thread_job(device_extension* Vcb, PIRP Irp) {
     ULONG threadnum;
     thread_job* tj;
@@ -3874,6 +3926,9 @@ static NTSTATUS STDCALL mount_vol(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
         goto exit;
     }
     
+    // can't fail, calculations are done inline without threads
+    create_calc_threads(NewDeviceObject);
+    
     Status = registry_mark_volume_mounted(&Vcb->superblock.uuid);
     if (!NT_SUCCESS(Status))
         WARN("registry_mark_volume_mounted returned %08x\n", Status);
@@ -426,6 +426,40 @@ typedef struct {
     LONG pending_jobs;
 } drv_threads;
 
+#define CALC_JOB_CRC32C     0
+#define CALC_JOB_COMPRESS   1
+
+typedef struct {
+    UINT8 type;
+    UINT8 compression;
+    UINT8* in;
+    UINT32 inlen;
+    UINT32* csum;
+    UINT8* out;
+    UINT32 outlen;
+    NTSTATUS Status;
+    LONG not_started;
+    LONG left;
+    LONG refcount;
+    KEVENT event;
+    LIST_ENTRY list_entry;
+} calc_job;
+
+typedef struct {
+    PDEVICE_OBJECT DeviceObject;
+    HANDLE handle;
+    KEVENT finished;
+    BOOL quit;
+} drv_calc_thread;
+
+typedef struct {
+    ULONG num_threads;
+    LIST_ENTRY job_list;
+    KSPIN_LOCK spin_lock;
+    KEVENT event;
+    drv_calc_thread* threads;
+} drv_calc_threads;
+
 typedef struct {
     BOOL ignore;
     BOOL compress;
@@ -497,6 +531,7 @@ typedef struct _device_extension {
     KTIMER flush_thread_timer;
     KEVENT flush_thread_finished;
     drv_threads threads;
+    drv_calc_threads calcthreads;
     PFILE_OBJECT root_file;
     LIST_ENTRY list_entry;
 } device_extension;
@@ -873,6 +908,14 @@ void STDCALL worker_thread(void* context);
 void do_read_job(PIRP Irp);
 void do_write_job(device_extension* Vcb, PIRP Irp);
 
+// in calcthread.c
+void STDCALL calc_thread(void* context);
+NTSTATUS add_calc_job(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32* csum, calc_job** pcj);
+NTSTATUS add_calc_job_comp(device_extension* Vcb, UINT8 compression, UINT8* in, UINT32 inlen, calc_job** pcj);
+void wait_calc_job(device_extension* Vcb, calc_job* cj);
+void free_calc_job(calc_job* cj);
+void calc_csum(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32* csum);
+
 // in registry.c
 void STDCALL read_registry(PUNICODE_STRING regpath);
 NTSTATUS registry_mark_volume_mounted(BTRFS_UUID* uuid);
@@ -881,7 +924,10 @@ NTSTATUS registry_load_volume_options(device_extension* Vcb);
 
 // in compress.c
 NTSTATUS decompress(UINT8 type, UINT8* inbuf, UINT64 inlen, UINT8* outbuf, UINT64 outlen);
-NTSTATUS write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, BOOL* compressed, LIST_ENTRY* changed_sector_list, PIRP Irp, LIST_ENTRY* rollback);
+UINT8 get_compression_type(device_extension* Vcb);
+NTSTATUS compress_extent(device_extension* Vcb, UINT8 type, UINT8* in, UINT32 inlen, UINT8** out, UINT32* outlen);
+NTSTATUS write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, UINT8 compression, UINT8* comp_data, UINT32 comp_length,
+                              LIST_ENTRY* changed_sector_list, PIRP Irp, LIST_ENTRY* rollback);
 
 #define fast_io_possible(fcb) (!FsRtlAreThereCurrentFileLocks(&fcb->lock) && !fcb->Vcb->readonly ? FastIoIsPossible : FastIoIsQuestionable)
 
@@ -0,0 +1,210 @@
+/* Copyright (c) Mark Harmstone 2016
+ * 
+ * This file is part of WinBtrfs.
+ * 
+ * WinBtrfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public Licence as published by
+ * the Free Software Foundation, either version 3 of the Licence, or
+ * (at your option) any later version.
+ * 
+ * WinBtrfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public Licence for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public Licence
+ * along with WinBtrfs.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "btrfs_drv.h"
+
+// Number of sectors checksummed by a thread in one go
+#define SECTOR_BLOCK 16
+
+// The calc threads only ever run CPU-bound work (checksums and compression), and the
+// thread which queued a job always helps with it before waiting, so jobs can't deadlock
+// even when every calc thread is busy.
+
+static NTSTATUS queue_calc_job(device_extension* Vcb, calc_job* cj, LONG parts) {
+    KIRQL irql;
+    
+    if (Vcb->calcthreads.num_threads == 0)
+        return STATUS_INTERNAL_ERROR;
+    
+    cj->Status = STATUS_SUCCESS;
+    cj->not_started = parts;
+    cj->left = parts;
+    cj->refcount = 1;
+    KeInitializeEvent(&cj->event, NotificationEvent, FALSE);
+    
+    KeAcquireSpinLock(&Vcb->calcthreads.spin_lock, &irql);
+    InsertTailList(&Vcb->calcthreads.job_list, &cj->list_entry);
+    KeSetEvent(&Vcb->calcthreads.event, 0, FALSE);
+    KeReleaseSpinLock(&Vcb->calcthreads.spin_lock, irql);
+    
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS add_calc_job(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32* csum, calc_job** pcj) {
+    calc_job* cj;
+    NTSTATUS Status;
+    
+    cj = ExAllocatePoolWithTag(NonPagedPool, sizeof(calc_job), ALLOC_TAG);
+    if (!cj) {
+        ERR("out of memory\n");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    
+    cj->type = CALC_JOB_CRC32C;
+    cj->in = data;
+    cj->inlen = sectors;
+    cj->csum = csum;
+    cj->out = NULL;
+    
+    Status = queue_calc_job(Vcb, cj, (sectors + SECTOR_BLOCK - 1) / SECTOR_BLOCK);
+    if (!NT_SUCCESS(Status)) {
+        ExFreePool(cj);
+        return Status;
+    }
+    
+    *pcj = cj;
+    
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS add_calc_job_comp(device_extension* Vcb, UINT8 compression, UINT8* in, UINT32 inlen, calc_job** pcj) {
+    calc_job* cj;
+    NTSTATUS Status;
+    
+    cj = ExAllocatePoolWithTag(NonPagedPool, sizeof(calc_job), ALLOC_TAG);
+    if (!cj) {
+        ERR("out of memory\n");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    
+    cj->type = CALC_JOB_COMPRESS;
+    cj->compression = compression;
+    cj->in = in;
+    cj->inlen = inlen;
+    cj->csum = NULL;
+    cj->out = NULL;
+    cj->outlen = 0;
+    
+    Status = queue_calc_job(Vcb, cj, 1);
+    if (!NT_SUCCESS(Status)) {
+        ExFreePool(cj);
+        return Status;
+    }
+    
+    *pcj = cj;
+    
+    return STATUS_SUCCESS;
+}
+
+void free_calc_job(calc_job* cj) {
+    LONG rc = InterlockedDecrement(&cj->refcount);
+    
+    if (rc == 0)
+        ExFreePool(cj);
+}
+
+static BOOL do_calc_job(device_extension* Vcb, calc_job* cj) {
+    LONG part;
+    KIRQL irql;
+    
+    part = InterlockedDecrement(&cj->not_started);
+    if (part < 0)
+        return FALSE;
+    
+    if (part == 0) { // nothing left to hand out
+        KeAcquireSpinLock(&Vcb->calcthreads.spin_lock, &irql);
+        RemoveEntryList(&cj->list_entry);
+        KeReleaseSpinLock(&Vcb->calcthreads.spin_lock, irql);
+    }
+    
+    if (cj->type == CALC_JOB_COMPRESS) {
+        cj->Status = compress_extent(Vcb, cj->compression, cj->in, cj->inlen, &cj->out, &cj->outlen);
+    } else {
+        UINT32 i, first, last;
+        
+        first = part * SECTOR_BLOCK;
+        last = min(first + SECTOR_BLOCK, cj->inlen);
+        
+        for (i = first; i < last; i++) {
+            cj->csum[i] = ~calc_crc32c(0xffffffff, cj->in + (i * Vcb->superblock.sector_size), Vcb->superblock.sector_size);
+        }
+    }
+    
+    if (InterlockedDecrement(&cj->left) == 0)
+        KeSetEvent(&cj->event, 0, FALSE);
+    
+    return TRUE;
+}
+
+void wait_calc_job(device_extension* Vcb, calc_job* cj) {
+    while (do_calc_job(Vcb, cj)) { }
+    
+    KeWaitForSingleObject(&cj->event, Executive, KernelMode, FALSE, NULL);
+}
+
+void calc_csum(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32* csum) {
+    calc_job* cj;
+    UINT32 i;
+    
+    // not worth the context switches for small writes
+    if (sectors >= 2 * SECTOR_BLOCK && NT_SUCCESS(add_calc_job(Vcb, data, sectors, csum, &cj))) {
+        wait_calc_job(Vcb, cj);
+        free_calc_job(cj);
+        return;
+    }
+    
+    for (i = 0; i < sectors; i++) {
+        csum[i] = ~calc_crc32c(0xffffffff, data + (i * Vcb->superblock.sector_size), Vcb->superblock.sector_size);
+    }
+}
+
+void STDCALL calc_thread(void* context) {
+    drv_calc_thread* thread = context;
+    device_extension* Vcb = thread->DeviceObject->DeviceExtension;
+    
+    ObReferenceObject(thread->DeviceObject);
+    
+    while (TRUE) {
+        KeWaitForSingleObject(&Vcb->calcthreads.event, Executive, KernelMode, FALSE, NULL);
+        
+        FsRtlEnterFileSystem();
+        
+        while (TRUE) {
+            calc_job* cj;
+            KIRQL irql;
+            
+            KeAcquireSpinLock(&Vcb->calcthreads.spin_lock, &irql);
+            
+            if (IsListEmpty(&Vcb->calcthreads.job_list)) {
+                if (!thread->quit)
+                    KeClearEvent(&Vcb->calcthreads.event);
+                
+                KeReleaseSpinLock(&Vcb->calcthreads.spin_lock, irql);
+                break;
+            }
+            
+            cj = CONTAINING_RECORD(Vcb->calcthreads.job_list.Flink, calc_job, list_entry);
+            InterlockedIncrement(&cj->refcount);
+            
+            KeReleaseSpinLock(&Vcb->calcthreads.spin_lock, irql);
+            
+            do_calc_job(Vcb, cj);
+            free_calc_job(cj);
+        }
+        
+        FsRtlExitFileSystem();
+        
+        if (thread->quit)
+            break;
+    }
+    
+    ObDereferenceObject(thread->DeviceObject);
+    
+    KeSetEvent(&thread->finished, 0, FALSE);
+    
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
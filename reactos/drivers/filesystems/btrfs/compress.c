@@ -357,53 +357,33 @@ NTSTATUS decompress(UINT8 type, UINT8* inbuf, UINT64 inlen, UINT8* outbuf, UINT6
     }
 }
 
-static NTSTATUS zlib_write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, BOOL* compressed, LIST_ENTRY* changed_sector_list, PIRP Irp, LIST_ENTRY* rollback) {
-    NTSTATUS Status;
-    UINT8 compression;
-    UINT64 comp_length;
-    UINT8* comp_data;
-    UINT32 out_left;
-    LIST_ENTRY* le;
-    chunk* c;
+static NTSTATUS zlib_compress(UINT8* inbuf, UINT32 inlen, UINT8* outbuf, UINT32* outlen, unsigned int level, UINT32 sector_size) {
     z_stream c_stream;
+    UINT32 out_left;
     int ret;
     
-    comp_data = ExAllocatePoolWithTag(PagedPool, end_data - start_data, ALLOC_TAG);
-    if (!comp_data) {
-        ERR("out of memory\n");
-        return STATUS_INSUFFICIENT_RESOURCES;
-    }
-    
-    Status = excise_extents(fcb->Vcb, fcb, start_data, end_data, Irp, rollback);
-    if (!NT_SUCCESS(Status)) {
-        ERR("excise_extents returned %08x\n", Status);
-        ExFreePool(comp_data);
-        return Status;
-    }
-    
     c_stream.zalloc = zlib_alloc;
     c_stream.zfree = zlib_free;
     c_stream.opaque = (voidpf)0;
 
-    ret = deflateInit(&c_stream, fcb->Vcb->options.zlib_level);
+    ret = deflateInit(&c_stream, level);
     
     if (ret != Z_OK) {
         ERR("deflateInit returned %08x\n", ret);
-        ExFreePool(comp_data);
         return STATUS_INTERNAL_ERROR;
     }
     
-    c_stream.avail_in = end_data - start_data;
-    c_stream.next_in = data;
-    c_stream.avail_out = end_data - start_data;
-    c_stream.next_out = comp_data;
+    c_stream.avail_in = inlen;
+    c_stream.next_in = inbuf;
+    c_stream.avail_out = inlen;
+    c_stream.next_out = outbuf;
     
     do {
         ret = deflate(&c_stream, Z_FINISH);
         
         if (ret == Z_STREAM_ERROR) {
             ERR("deflate returned %x\n", ret);
-            ExFreePool(comp_data);
+            deflateEnd(&c_stream);
             return STATUS_INTERNAL_ERROR;
         }
     } while (c_stream.avail_in > 0 && c_stream.avail_out > 0);
@@ -414,82 +394,15 @@ static NTSTATUS zlib_write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 en
     
     if (ret != Z_OK) {
         ERR("deflateEnd returned %08x\n", ret);
-        ExFreePool(comp_data);
         return STATUS_INTERNAL_ERROR;
     }
     
-    if (out_left < fcb->Vcb->superblock.sector_size) { // compressed extent would be larger than or same size as uncompressed extent
-        ExFreePool(comp_data);
-        
-        comp_length = end_data - start_data;
-        comp_data = data;
-        compression = BTRFS_COMPRESSION_NONE;
-        
-        *compressed = FALSE;
-    } else {
-        UINT32 cl;
-        
-        compression = BTRFS_COMPRESSION_ZLIB;
-        cl = end_data - start_data - out_left;
-        comp_length = sector_align(cl, fcb->Vcb->superblock.sector_size);
-        
-        RtlZeroMemory(comp_data + cl, comp_length - cl);
-        
-        *compressed = TRUE;
-    }
+    if (out_left < sector_size) // compressed extent would be larger than or same size as uncompressed extent
+        return STATUS_BUFFER_OVERFLOW;
     
-    ExAcquireResourceSharedLite(&fcb->Vcb->chunk_lock, TRUE);
+    *outlen = inlen - out_left;
     
-    le = fcb->Vcb->chunks.Flink;
-    while (le != &fcb->Vcb->chunks) {
-        c = CONTAINING_RECORD(le, chunk, list_entry);
-        
-        ExAcquireResourceExclusiveLite(&c->lock, TRUE);
-        
-        if (c->chunk_item->type == fcb->Vcb->data_flags && (c->chunk_item->size - c->used) >= comp_length) {
-            if (insert_extent_chunk(fcb->Vcb, fcb, c, start_data, comp_length, FALSE, comp_data, changed_sector_list, Irp, rollback, compression, end_data - start_data)) {
-                ExReleaseResourceLite(&c->lock);
-                ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
-                
-                if (compression != BTRFS_COMPRESSION_NONE)
-                    ExFreePool(comp_data);
-                
-                return STATUS_SUCCESS;
-            }
-        }
-        
-        ExReleaseResourceLite(&c->lock);
-
-        le = le->Flink;
-    }
-    
-    ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
-    
-    ExAcquireResourceExclusiveLite(&fcb->Vcb->chunk_lock, TRUE);
-    
-    if ((c = alloc_chunk(fcb->Vcb, fcb->Vcb->data_flags))) {
-        ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
-        
-        ExAcquireResourceExclusiveLite(&c->lock, TRUE);
-        
-        if (c->chunk_item->type == fcb->Vcb->data_flags && (c->chunk_item->size - c->used) >= comp_length) {
-            if (insert_extent_chunk(fcb->Vcb, fcb, c, start_data, comp_length, FALSE, comp_data, changed_sector_list, Irp, rollback, compression, end_data - start_data)) {
-                ExReleaseResourceLite(&c->lock);
-                
-                if (compression != BTRFS_COMPRESSION_NONE)
-                    ExFreePool(comp_data);
-                
-                return STATUS_SUCCESS;
-            }
-        }
-        
-        ExReleaseResourceLite(&c->lock);
-    } else
-        ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
-    
-    WARN("couldn't find any data chunks with %llx bytes free\n", comp_length);
-
-    return STATUS_DISK_FULL;
+    return STATUS_SUCCESS;
 }
 
 static NTSTATUS lzo_do_compress(const UINT8* in, UINT32 in_len, UINT8* out, UINT32* out_len, void* wrkmem) {
@@ -733,63 +646,36 @@ static __inline UINT32 lzo_max_outlen(UINT32 inlen) {
     return inlen + (inlen / 16) + 64 + 3; // formula comes from LZO.FAQ
 }
 
-static NTSTATUS lzo_write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, BOOL* compressed, LIST_ENTRY* changed_sector_list, PIRP Irp, LIST_ENTRY* rollback) {
+static NTSTATUS lzo_compress(UINT8* inbuf, UINT32 inlen, UINT8* outbuf, UINT32* outlen, UINT32 sector_size) {
     NTSTATUS Status;
-    UINT8 compression;
-    UINT64 comp_length;
-    ULONG comp_data_len, num_pages, i;
-    UINT8* comp_data;
-    BOOL skip_compression = FALSE;
+    ULONG num_pages, i;
     lzo_stream stream;
     UINT32* out_size;
-    LIST_ENTRY* le;
-    chunk* c;
-    
-    num_pages = (sector_align(end_data - start_data, LINUX_PAGE_SIZE)) / LINUX_PAGE_SIZE;
     
-    // Four-byte overall header
-    // Another four-byte header page
-    // Each page has a maximum size of lzo_max_outlen(LINUX_PAGE_SIZE)
-    // Plus another four bytes for possible padding
-    comp_data_len = sizeof(UINT32) + ((lzo_max_outlen(LINUX_PAGE_SIZE) + (2 * sizeof(UINT32))) * num_pages);
-    
-    comp_data = ExAllocatePoolWithTag(PagedPool, comp_data_len, ALLOC_TAG);
-    if (!comp_data) {
-        ERR("out of memory\n");
-        return STATUS_INSUFFICIENT_RESOURCES;
-    }
+    num_pages = (sector_align(inlen, LINUX_PAGE_SIZE)) / LINUX_PAGE_SIZE;
     
     stream.wrkmem = ExAllocatePoolWithTag(PagedPool, LZO1X_MEM_COMPRESS, ALLOC_TAG);
     if (!stream.wrkmem) {
         ERR("out of memory\n");
-        ExFreePool(comp_data);
         return STATUS_INSUFFICIENT_RESOURCES;
     }
     
-    Status = excise_extents(fcb->Vcb, fcb, start_data, end_data, Irp, rollback);
-    if (!NT_SUCCESS(Status)) {
-        ERR("excise_extents returned %08x\n", Status);
-        ExFreePool(comp_data);
-        ExFreePool(stream.wrkmem);
-        return Status;
-    }
-    
-    out_size = (UINT32*)comp_data;
+    out_size = (UINT32*)outbuf;
     *out_size = sizeof(UINT32);
     
-    stream.in = data;
-    stream.out = comp_data + (2 * sizeof(UINT32));
+    stream.in = inbuf;
+    stream.out = outbuf + (2 * sizeof(UINT32));
     
     for (i = 0; i < num_pages; i++) {
         UINT32* pagelen = (UINT32*)(stream.out - sizeof(UINT32));
         
-        stream.inlen = min(LINUX_PAGE_SIZE, end_data - start_data - (i * LINUX_PAGE_SIZE));
+        stream.inlen = min(LINUX_PAGE_SIZE, inlen - (i * LINUX_PAGE_SIZE));
         
         Status = lzo1x_1_compress(&stream);
         if (!NT_SUCCESS(Status)) {
             ERR("lzo1x_1_compress returned %08x\n", Status);
-            skip_compression = TRUE;
-            break;
+            ExFreePool(stream.wrkmem);
+            return STATUS_BUFFER_OVERFLOW; // write it uncompressed
         }
         
         *pagelen = stream.outlen;
@@ -807,21 +693,92 @@ static NTSTATUS lzo_write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end
     
     ExFreePool(stream.wrkmem);
     
-    if (skip_compression || *out_size >= end_data - start_data - fcb->Vcb->superblock.sector_size) { // compressed extent would be larger than or same size as uncompressed extent
+    if (*out_size >= inlen - sector_size) // compressed extent would be larger than or same size as uncompressed extent
+        return STATUS_BUFFER_OVERFLOW;
+    
+    *outlen = *out_size;
+    
+    return STATUS_SUCCESS;
+}
+
+UINT8 get_compression_type(device_extension* Vcb) {
+    UINT8 type;
+    
+    if (Vcb->options.compress_type != 0)
+        type = Vcb->options.compress_type;
+    else {
+        if (Vcb->superblock.incompat_flags & BTRFS_INCOMPAT_FLAGS_COMPRESS_LZO)
+            type = BTRFS_COMPRESSION_LZO;
+        else
+            type = BTRFS_COMPRESSION_ZLIB;
+    }
+    
+    if (type == BTRFS_COMPRESSION_LZO)
+        Vcb->superblock.incompat_flags |= BTRFS_INCOMPAT_FLAGS_COMPRESS_LZO;
+    
+    return type;
+}
+
+// Doesn't touch the FCB or the trees, so that it can run on the calc threads. Returns
+// STATUS_BUFFER_OVERFLOW if the data isn't worth compressing. On success, *out is
+// sector-aligned, zero-padded and of length *outlen.
+NTSTATUS compress_extent(device_extension* Vcb, UINT8 type, UINT8* in, UINT32 inlen, UINT8** out, UINT32* outlen) {
+    NTSTATUS Status;
+    UINT8* comp_data;
+    ULONG comp_data_len;
+    UINT32 cl, comp_length;
+    
+    if (type == BTRFS_COMPRESSION_LZO) {
+        // Four-byte overall header
+        // Another four-byte header page
+        // Each page has a maximum size of lzo_max_outlen(LINUX_PAGE_SIZE)
+        // Plus another four bytes for possible padding
+        comp_data_len = sizeof(UINT32) + ((lzo_max_outlen(LINUX_PAGE_SIZE) + (2 * sizeof(UINT32))) * (sector_align(inlen, LINUX_PAGE_SIZE) / LINUX_PAGE_SIZE));
+    } else
+        comp_data_len = inlen;
+    
+    comp_data = ExAllocatePoolWithTag(PagedPool, comp_data_len, ALLOC_TAG);
+    if (!comp_data) {
+        ERR("out of memory\n");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    
+    if (type == BTRFS_COMPRESSION_LZO)
+        Status = lzo_compress(in, inlen, comp_data, &cl, Vcb->superblock.sector_size);
+    else
+        Status = zlib_compress(in, inlen, comp_data, &cl, Vcb->options.zlib_level, Vcb->superblock.sector_size);
+    
+    if (!NT_SUCCESS(Status) || Status == STATUS_BUFFER_OVERFLOW) {
         ExFreePool(comp_data);
-        
+        return Status;
+    }
+    
+    comp_length = sector_align(cl, Vcb->superblock.sector_size);
+    RtlZeroMemory(comp_data + cl, comp_length - cl);
+    
+    *out = comp_data;
+    *outlen = comp_length;
+    
+    return STATUS_SUCCESS;
+}
+
+// comp_data is NULL if the extent is to be written uncompressed
+NTSTATUS write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, UINT8 compression, UINT8* comp_data, UINT32 comp_length,
+                              LIST_ENTRY* changed_sector_list, PIRP Irp, LIST_ENTRY* rollback) {
+    NTSTATUS Status;
+    LIST_ENTRY* le;
+    chunk* c;
+    
+    if (!comp_data) {
         comp_length = end_data - start_data;
         comp_data = data;
         compression = BTRFS_COMPRESSION_NONE;
-        
-        *compressed = FALSE;
-    } else {
-        compression = BTRFS_COMPRESSION_LZO;
-        comp_length = sector_align(*out_size, fcb->Vcb->superblock.sector_size);
-        
-        RtlZeroMemory(comp_data + *out_size, comp_length - *out_size);
-        
-        *compressed = TRUE;
+    }
+    
+    Status = excise_extents(fcb->Vcb, fcb, start_data, end_data, Irp, rollback);
+    if (!NT_SUCCESS(Status)) {
+        ERR("excise_extents returned %08x\n", Status);
+        return Status;
     }
     
     ExAcquireResourceSharedLite(&fcb->Vcb->chunk_lock, TRUE);
@@ -837,9 +794,6 @@ static NTSTATUS lzo_write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end
                 ExReleaseResourceLite(&c->lock);
                 ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
                 
-                if (compression != BTRFS_COMPRESSION_NONE)
-                    ExFreePool(comp_data);
-                
                 return STATUS_SUCCESS;
             }
         }
@@ -862,9 +816,6 @@ static NTSTATUS lzo_write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end
             if (insert_extent_chunk(fcb->Vcb, fcb, c, start_data, comp_length, FALSE, comp_data, changed_sector_list, Irp, rollback, compression, end_data - start_data)) {
                 ExReleaseResourceLite(&c->lock);
                 
-                if (compression != BTRFS_COMPRESSION_NONE)
-                    ExFreePool(comp_data);
-                
                 return STATUS_SUCCESS;
             }
         }
@@ -877,22 +828,3 @@ static NTSTATUS lzo_write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end
 
     return STATUS_DISK_FULL;
 }
-
-NTSTATUS write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, BOOL* compressed, LIST_ENTRY* changed_sector_list, PIRP Irp, LIST_ENTRY* rollback) {
-    UINT8 type;
-
-    if (fcb->Vcb->options.compress_type != 0)
-        type = fcb->Vcb->options.compress_type;
-    else {
-        if (fcb->Vcb->superblock.incompat_flags & BTRFS_INCOMPAT_FLAGS_COMPRESS_LZO)
-            type = BTRFS_COMPRESSION_LZO;
-        else
-            type = BTRFS_COMPRESSION_ZLIB;
-    }
-    
-    if (type == BTRFS_COMPRESSION_LZO) {
-        fcb->Vcb->superblock.incompat_flags |= BTRFS_INCOMPAT_FLAGS_COMPRESS_LZO;
-        return lzo_write_compressed_bit(fcb, start_data, end_data, data, compressed, changed_sector_list, Irp, rollback);
-    } else
-        return zlib_write_compressed_bit(fcb, start_data, end_data, data, compressed, changed_sector_list, Irp, rollback);
-}
@@ -5988,7 +5988,6 @@ end:
 static NTSTATUS do_write_data(device_extension* Vcb, UINT64 address, void* data, UINT64 length, LIST_ENTRY* changed_sector_list, PIRP Irp) {
     NTSTATUS Status;
     changed_sector* sc;
-    int i;
     
     Status = write_data_complete(Vcb, address, data, length, Irp, NULL);
     if (!NT_SUCCESS(Status)) {
@@ -6014,9 +6013,7 @@ static NTSTATUS do_write_data(device_extension* Vcb, UINT64 address, void* data,
             return STATUS_INSUFFICIENT_RESOURCES;
         }
         
-        for (i = 0; i < sc->length; i++) {
-            sc->checksums[i] = ~calc_crc32c(0xffffffff, (UINT8*)data + (i * Vcb->superblock.sector_size), Vcb->superblock.sector_size);
-        }
+        calc_csum(Vcb, data, sc->length, sc->checksums);
 
         insert_into_ordered_list(changed_sector_list, &sc->ol);
     }
@@ -6295,7 +6292,6 @@ static BOOL extend_data(device_extension* Vcb, fcb* fcb, UINT64 start_data, UINT
     }
     
     if (changed_sector_list) {
-        int i;
         changed_sector* sc = ExAllocatePoolWithTag(PagedPool, sizeof(changed_sector), ALLOC_TAG);
         if (!sc) {
             ERR("out of memory\n");
@@ -6313,9 +6309,7 @@ static BOOL extend_data(device_extension* Vcb, fcb* fcb, UINT64 start_data, UINT
             return FALSE;
         }
         
-        for (i = 0; i < sc->length; i++) {
-            sc->checksums[i] = ~calc_crc32c(0xffffffff, (UINT8*)data + (i * Vcb->superblock.sector_size), Vcb->superblock.sector_size);
-        }
+        calc_csum(Vcb, data, sc->length, sc->checksums);
         insert_into_ordered_list(changed_sector_list, &sc->ol);
     }
     
@@ -7801,45 +7795,133 @@ nextitem:
     return STATUS_SUCCESS;
 }
 
+// Compression runs on the calc threads, a window of extents at a time. The extents are
+// then written in order on this thread, as that needs the tree and chunk locks.
 NTSTATUS write_compressed(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, LIST_ENTRY* changed_sector_list, PIRP Irp, LIST_ENTRY* rollback) {
     NTSTATUS Status;
-    UINT64 i;
+    UINT64 i, num_extents;
+    ULONG j, window, n;
+    UINT8 type;
+    calc_job** jobs;
     
-    for (i = 0; i < sector_align(end_data - start_data, COMPRESSED_EXTENT_SIZE) / COMPRESSED_EXTENT_SIZE; i++) {
-        UINT64 s2, e2;
-        BOOL compressed;
-        
-        s2 = start_data + (i * COMPRESSED_EXTENT_SIZE);
-        e2 = min(s2 + COMPRESSED_EXTENT_SIZE, end_data);
+    num_extents = sector_align(end_data - start_data, COMPRESSED_EXTENT_SIZE) / COMPRESSED_EXTENT_SIZE;
+    
+    // bound the amount of compressed data in flight
+    window = (ULONG)min(num_extents, 2 * max(fcb->Vcb->calcthreads.num_threads, 1));
+    
+    jobs = ExAllocatePoolWithTag(PagedPool, sizeof(calc_job*) * window, ALLOC_TAG);
+    if (!jobs) {
+        ERR("out of memory\n");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    
+    type = get_compression_type(fcb->Vcb);
+    
+    for (i = 0; i < num_extents; i += n) {
+        // If the first 128 KB of a file turns out to be incompressible, we won't compress the rest,
+        // so don't bother queueing anything else with it.
+        if (i == 0 && start_data == 0 && !fcb->Vcb->options.compress_force)
+            n = 1;
+        else
+            n = (ULONG)min(window, num_extents - i);
         
-        Status = write_compressed_bit(fcb, s2, e2, (UINT8*)data + (i * COMPRESSED_EXTENT_SIZE), &compressed, changed_sector_list, Irp, rollback);
+        for (j = 0; j < n; j++) {
+            UINT64 s2 = start_data + ((i + j) * COMPRESSED_EXTENT_SIZE);
+            UINT64 e2 = min(s2 + COMPRESSED_EXTENT_SIZE, end_data);
+            
+            Status = add_calc_job_comp(fcb->Vcb, type, (UINT8*)data + ((i + j) * COMPRESSED_EXTENT_SIZE), (UINT32)(e2 - s2), &jobs[j]);
+            if (!NT_SUCCESS(Status)) {
+                // no calc threads, or out of memory - compress on this thread instead
+                jobs[j] = ExAllocatePoolWithTag(NonPagedPool, sizeof(calc_job), ALLOC_TAG);
+                if (!jobs[j]) {
+                    ERR("out of memory\n");
+                    Status = STATUS_INSUFFICIENT_RESOURCES;
+                    n = j;
+                    goto end;
+                }
+                
+                jobs[j]->out = NULL;
+                jobs[j]->not_started = 0;
+                jobs[j]->left = 0;
+                jobs[j]->refcount = 1;
+                jobs[j]->Status = compress_extent(fcb->Vcb, type, (UINT8*)data + ((i + j) * COMPRESSED_EXTENT_SIZE), (UINT32)(e2 - s2),
+                                                  &jobs[j]->out, &jobs[j]->outlen);
+                KeInitializeEvent(&jobs[j]->event, NotificationEvent, TRUE);
+            }
+        }
         
-        if (!NT_SUCCESS(Status)) {
-            ERR("write_compressed_bit returned %08x\n", Status);
-            return Status;
+        for (j = 0; j < n; j++) {
+            wait_calc_job(fcb->Vcb, jobs[j]);
         }
         
-        // If the first 128 KB of a file is incompressible, we set the nocompress flag so we don't
-        // bother with the rest of it.
-        if (s2 == 0 && e2 == COMPRESSED_EXTENT_SIZE && !compressed && !fcb->Vcb->options.compress_force) {
-            fcb->inode_item.flags |= BTRFS_INODE_NOCOMPRESS;
-            mark_fcb_dirty(fcb);
+        for (j = 0; j < n; j++) {
+            UINT64 s2 = start_data + ((i + j) * COMPRESSED_EXTENT_SIZE);
+            UINT64 e2 = min(s2 + COMPRESSED_EXTENT_SIZE, end_data);
+            BOOL compressed;
+            
+            if (jobs[j]->Status == STATUS_BUFFER_OVERFLOW)
+                compressed = FALSE;
+            else if (!NT_SUCCESS(jobs[j]->Status)) {
+                ERR("compress_extent returned %08x\n", jobs[j]->Status);
+                Status = jobs[j]->Status;
+                goto end;
+            } else
+                compressed = TRUE;
             
-            // write subsequent data non-compressed
-            if (e2 < end_data) {
-                Status = do_write_file(fcb, e2, end_data, (UINT8*)data + e2, changed_sector_list, Irp, rollback);
+            Status = write_compressed_bit(fcb, s2, e2, (UINT8*)data + ((i + j) * COMPRESSED_EXTENT_SIZE), type, compressed ? jobs[j]->out : NULL,
+                                          compressed ? jobs[j]->outlen : 0, changed_sector_list, Irp, rollback);
+            
+            if (!NT_SUCCESS(Status)) {
+                ERR("write_compressed_bit returned %08x\n", Status);
+                goto end;
+            }
+            
+            // If the first 128 KB of a file is incompressible, we set the nocompress flag so we don't
+            // bother with the rest of it.
+            if (s2 == 0 && e2 == COMPRESSED_EXTENT_SIZE && !compressed && !fcb->Vcb->options.compress_force) {
+                fcb->inode_item.flags |= BTRFS_INODE_NOCOMPRESS;
+                mark_fcb_dirty(fcb);
                 
-                if (!NT_SUCCESS(Status)) {
-                    ERR("do_write_file returned %08x\n", Status);
-                    return Status;
+                // write subsequent data non-compressed
+                if (e2 < end_data) {
+                    Status = do_write_file(fcb, e2, end_data, (UINT8*)data + e2, changed_sector_list, Irp, rollback);
+                    
+                    if (!NT_SUCCESS(Status)) {
+                        ERR("do_write_file returned %08x\n", Status);
+                        goto end;
+                    }
                 }
+                
+                Status = STATUS_SUCCESS;
+                goto end;
             }
+        }
+        
+        for (j = 0; j < n; j++) {
+            if (jobs[j]->out)
+                ExFreePool(jobs[j]->out);
             
-            return STATUS_SUCCESS;
+            free_calc_job(jobs[j]);
         }
     }
     
+    ExFreePool(jobs);
+    
     return STATUS_SUCCESS;
+    
+end:
+    for (j = 0; j < n; j++) {
+        wait_calc_job(fcb->Vcb, jobs[j]);
+        
+        if (jobs[j]->out)
+            ExFreePool(jobs[j]->out);
+        
+        free_calc_job(jobs[j]);
+    }
+    
+    ExFreePool(jobs);
+    
+    return Status;
 }
 
 NTSTATUS write_file2(device_extension* Vcb, PIRP Irp, LARGE_INTEGER offset, void* buf, ULONG* length, BOOL paging_io, BOOL no_cache,
@@ -283,6 +283,14 @@ FindFile(
             ExFreePool(PathNameBuffer);
             return Status;
         }
+
+        /* Large directories are indexed, a miss there is final */
+        Status = vfatNameIndexLookup(DeviceExt, Parent, FileToFindU, DirContext);
+        if (Status != STATUS_MORE_PROCESSING_REQUIRED)
+        {
+            ExFreePool(PathNameBuffer);
+            return NT_SUCCESS(Status) ? STATUS_SUCCESS : STATUS_NO_MORE_ENTRIES;
+        }
     }
 
     /* FsRtlIsNameInExpression need the searched string to be upcase,
@@ -821,10 +821,17 @@ VfatAddEntry(
     IN UCHAR ReqAttr,
     IN PVFAT_MOVE_CONTEXT MoveContext)
 {
+    NTSTATUS Status;
+
     if (DeviceExt->Flags & VCB_IS_FATX)
         return FATXAddEntry(DeviceExt, NameU, Fcb, ParentFcb, RequestedOptions, ReqAttr, MoveContext);
-    else
-        return FATAddEntry(DeviceExt, NameU, Fcb, ParentFcb, RequestedOptions, ReqAttr, MoveContext);
+
+    Status = FATAddEntry(DeviceExt, NameU, Fcb, ParentFcb, RequestedOptions, ReqAttr, MoveContext);
+    if (NT_SUCCESS(Status))
+    {
+        vfatNameIndexInsert(ParentFcb, *Fcb);
+    }
+    return Status;
 }
 
 /*
@@ -895,6 +902,7 @@ FATDelEntry(
     /* In case of moving, don't delete data */
     if (MoveContext == NULL)
     {
+        VfatMcbTruncate(pFcb, 0);
         while (CurrentCluster && CurrentCluster != 0xffffffff)
         {
             GetNextCluster(DeviceExt, CurrentCluster, &NextCluster);
@@ -902,6 +910,7 @@ FATDelEntry(
             WriteCluster(DeviceExt, CurrentCluster, 0);
             CurrentCluster = NextCluster;
         }
+        VfatMcbTruncate(pFcb, 0);
     }
 
     return STATUS_SUCCESS;
@@ -962,6 +971,7 @@ FATXDelEntry(
     /* In case of moving, don't delete data */
     if (MoveContext == NULL)
     {
+        VfatMcbTruncate(pFcb, 0);
         while (CurrentCluster && CurrentCluster != 0xffffffff)
         {
             GetNextCluster(DeviceExt, CurrentCluster, &NextCluster);
@@ -969,6 +979,7 @@ FATXDelEntry(
             WriteCluster(DeviceExt, CurrentCluster, 0);
             CurrentCluster = NextCluster;
         }
+        VfatMcbTruncate(pFcb, 0);
     }
 
     return STATUS_SUCCESS;
@@ -980,10 +991,17 @@ VfatDelEntry(
     IN PVFATFCB pFcb,
     OUT PVFAT_MOVE_CONTEXT MoveContext)
 {
+    NTSTATUS Status;
+
     if (DeviceExt->Flags & VCB_IS_FATX)
         return FATXDelEntry(DeviceExt, pFcb, MoveContext);
-    else
-        return FATDelEntry(DeviceExt, pFcb, MoveContext);
+
+    Status = FATDelEntry(DeviceExt, pFcb, MoveContext);
+    if (NT_SUCCESS(Status))
+    {
+        vfatNameIndexRemove(pFcb->parentFcb, pFcb);
+    }
+    return Status;
 }
 
 /*
@@ -413,7 +413,11 @@ FAT12CountAvailableClusters(
         }
 
         if (Entry == 0)
+        {
             ulCount++;
+            if (DeviceExt->FreeClusterBitmap.Buffer)
+                RtlClearBit(&DeviceExt->FreeClusterBitmap, i);
+        }
     }
 
     CcUnpinData(Context);
@@ -464,7 +468,11 @@ FAT16CountAvailableClusters(
         while (Block < BlockEnd && i < FatLength)
         {
             if (*Block == 0)
+            {
                 ulCount++;
+                if (DeviceExt->FreeClusterBitmap.Buffer)
+                    RtlClearBit(&DeviceExt->FreeClusterBitmap, i);
+            }
             Block++;
             i++;
         }
@@ -520,7 +528,11 @@ FAT32CountAvailableClusters(
         while (Block < BlockEnd && i < FatLength)
         {
             if ((*Block & 0x0fffffff) == 0)
+            {
                 ulCount++;
+                if (DeviceExt->FreeClusterBitmap.Buffer)
+                    RtlClearBit(&DeviceExt->FreeClusterBitmap, i);
+            }
             Block++;
             i++;
         }
@@ -556,6 +568,62 @@ CountAvailableClusters(
     return Status;
 }
 
+/*
+ * FUNCTION: Builds the in-memory free cluster bitmap of a volume. This
+ *           scans the whole FAT, so it is only done once clusters are to
+ *           be allocated. It also leaves an exact free cluster count.
+ */
+NTSTATUS
+VfatInitializeFreeClusterBitmap(
+    PDEVICE_EXTENSION DeviceExt)
+{
+    PULONG Buffer;
+    ULONG BitmapSize;
+    LARGE_INTEGER Clusters;
+    NTSTATUS Status;
+
+    BitmapSize = DeviceExt->FatInfo.NumberOfClusters + 2;
+    Buffer = ExAllocatePoolWithTag(PagedPool, ROUND_UP(BitmapSize, 32) / 8, TAG_VFAT);
+    if (Buffer == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    ExAcquireResourceExclusiveLite(&DeviceExt->FatResource, TRUE);
+
+    /* Start with everything in use, the scan clears the free clusters */
+    RtlInitializeBitMap(&DeviceExt->FreeClusterBitmap, Buffer, BitmapSize);
+    RtlSetAllBits(&DeviceExt->FreeClusterBitmap);
+    DeviceExt->AvailableClustersValid = FALSE;
+    Status = CountAvailableClusters(DeviceExt, &Clusters);
+    if (NT_SUCCESS(Status))
+    {
+        DeviceExt->FreeClusterBitmapValid = TRUE;
+        DPRINT("Free cluster bitmap built, %u free clusters\n", Clusters.u.LowPart);
+    }
+    else
+    {
+        DeviceExt->FreeClusterBitmap.Buffer = NULL;
+        ExFreePoolWithTag(Buffer, TAG_VFAT);
+    }
+
+    ExReleaseResourceLite(&DeviceExt->FatResource);
+
+    return Status;
+}
+
+VOID
+VfatUninitializeFreeClusterBitmap(
+    PDEVICE_EXTENSION DeviceExt)
+{
+    DeviceExt->FreeClusterBitmapValid = FALSE;
+    if (DeviceExt->FreeClusterBitmap.Buffer)
+    {
+        ExFreePoolWithTag(DeviceExt->FreeClusterBitmap.Buffer, TAG_VFAT);
+        DeviceExt->FreeClusterBitmap.Buffer = NULL;
+    }
+}
+
 
 /*
  * FUNCTION: Writes a cluster to the FAT12 physical and in-memory tables
@@ -713,6 +781,14 @@ WriteCluster(
         else if (OldValue == 0 && NewValue)
             InterlockedDecrement((PLONG)&DeviceExt->AvailableClusters);
     }
+    if (NT_SUCCESS(Status) && DeviceExt->FreeClusterBitmapValid &&
+        ClusterToWrite < DeviceExt->FreeClusterBitmap.SizeOfBitMap)
+    {
+        if (NewValue == 0)
+            RtlClearBit(&DeviceExt->FreeClusterBitmap, ClusterToWrite);
+        else
+            RtlSetBit(&DeviceExt->FreeClusterBitmap, ClusterToWrite);
+    }
     ExReleaseResourceLite(&DeviceExt->FatResource);
     return Status;
 }
@@ -760,6 +836,159 @@ GetNextCluster(
     return Status;
 }
 
+/*
+ * FUNCTION: Allocates up to ClusterCount contiguous clusters, preferably at
+ *           or after HintCluster, and links them into a chain terminated by
+ *           an EOF mark. The free cluster bitmap is built on first use, if
+ *           that fails a single cluster is allocated. The caller must hold
+ *           the FAT resource exclusively.
+ */
+static
+NTSTATUS
+FindAndMarkAvailableClusters(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG HintCluster,
+    ULONG ClusterCount,
+    PULONG Cluster,
+    PULONG Allocated)
+{
+    PRTL_BITMAP Bitmap;
+    ULONG Start, Count, i;
+    ULONG OldValue;
+    NTSTATUS Status;
+
+    if (!DeviceExt->FreeClusterBitmapValid &&
+        !DeviceExt->FreeClusterBitmapFailed &&
+        !NT_SUCCESS(VfatInitializeFreeClusterBitmap(DeviceExt)))
+    {
+        DPRINT1("Failed to build the free cluster bitmap, falling back to FAT scans\n");
+        DeviceExt->FreeClusterBitmapFailed = TRUE;
+    }
+
+    if (!DeviceExt->FreeClusterBitmapValid)
+    {
+        *Allocated = 1;
+        return DeviceExt->FindAndMarkAvailableCluster(DeviceExt, Cluster);
+    }
+
+    Bitmap = &DeviceExt->FreeClusterBitmap;
+    if (HintCluster < 2 || HintCluster >= Bitmap->SizeOfBitMap)
+        HintCluster = DeviceExt->LastAvailableCluster;
+
+    Start = RtlFindClearBits(Bitmap, ClusterCount, HintCluster);
+    if (Start == MAXULONG)
+    {
+        /* No run is large enough, take the next free run instead */
+        Count = RtlFindNextForwardRunClear(Bitmap, HintCluster, &Start);
+        if (Count == 0)
+            Count = RtlFindFirstRunClear(Bitmap, &Start);
+        if (Count == 0)
+            return STATUS_DISK_FULL;
+
+        ClusterCount = min(ClusterCount, Count);
+    }
+
+    DPRINT("Found %u available clusters at 0x%x\n", ClusterCount, Start);
+
+    for (i = 0; i < ClusterCount; i++)
+    {
+        Status = DeviceExt->WriteCluster(DeviceExt, Start + i,
+                                         i + 1 < ClusterCount ? Start + i + 1 : 0xffffffff,
+                                         &OldValue);
+        if (!NT_SUCCESS(Status))
+        {
+            while (i-- > 0)
+            {
+                DeviceExt->WriteCluster(DeviceExt, Start + i, 0, &OldValue);
+            }
+            return Status;
+        }
+    }
+
+    RtlSetBits(Bitmap, Start, ClusterCount);
+    if (DeviceExt->AvailableClustersValid)
+        InterlockedExchangeAdd((PLONG)&DeviceExt->AvailableClusters, -(LONG)ClusterCount);
+
+    DeviceExt->LastAvailableCluster = Start + ClusterCount;
+    if (DeviceExt->LastAvailableCluster >= Bitmap->SizeOfBitMap)
+        DeviceExt->LastAvailableCluster = 2;
+
+    *Cluster = Start;
+    *Allocated = ClusterCount;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * FUNCTION: Appends ClusterCount clusters to the chain ending at LastCluster,
+ *           or creates a new chain if LastCluster is 0. Contiguous runs are
+ *           preferred. On failure the original chain is left unchanged.
+ */
+NTSTATUS
+ExtendClusterChain(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG LastCluster,
+    ULONG ClusterCount,
+    PULONG FirstNewCluster)
+{
+    ULONG Start, Allocated, Tail, NextCluster;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    DPRINT("ExtendClusterChain(DeviceExt %p, LastCluster %x, ClusterCount %u)\n",
+           DeviceExt, LastCluster, ClusterCount);
+
+    *FirstNewCluster = 0;
+    Tail = LastCluster;
+
+    ExAcquireResourceExclusiveLite(&DeviceExt->FatResource, TRUE);
+    while (ClusterCount > 0)
+    {
+        Status = FindAndMarkAvailableClusters(DeviceExt, Tail ? Tail + 1 : 0,
+                                              ClusterCount, &Start, &Allocated);
+        if (!NT_SUCCESS(Status))
+            break;
+
+        if (Tail != 0)
+        {
+            /* Link the new run to the end of the chain */
+            Status = WriteCluster(DeviceExt, Tail, Start);
+            if (!NT_SUCCESS(Status))
+            {
+                while (Allocated-- > 0)
+                {
+                    WriteCluster(DeviceExt, Start + Allocated, 0);
+                }
+                break;
+            }
+        }
+
+        if (*FirstNewCluster == 0)
+            *FirstNewCluster = Start;
+
+        Tail = Start + Allocated - 1;
+        ClusterCount -= Allocated;
+    }
+
+    if (!NT_SUCCESS(Status) && *FirstNewCluster != 0)
+    {
+        /* Restore the end of the original chain and free what was added */
+        if (LastCluster != 0)
+            WriteCluster(DeviceExt, LastCluster, 0xffffffff);
+
+        Start = *FirstNewCluster;
+        while (Start != 0xffffffff && Start > 1)
+        {
+            if (!NT_SUCCESS(DeviceExt->GetNextCluster(DeviceExt, Start, &NextCluster)))
+                break;
+            WriteCluster(DeviceExt, Start, 0);
+            Start = NextCluster;
+        }
+        *FirstNewCluster = 0;
+    }
+    ExReleaseResourceLite(&DeviceExt->FatResource);
+
+    return Status;
+}
+
 /*
  * FUNCTION: Retrieve the next cluster depending on the FAT type
  */
@@ -770,6 +999,7 @@ GetNextClusterExtend(
     PULONG NextCluster)
 {
     ULONG NewCluster;
+    ULONG Allocated;
     NTSTATUS Status;
 
     DPRINT("GetNextClusterExtend(DeviceExt %p, CurrentCluster %x)\n",
@@ -782,7 +1012,7 @@ GetNextClusterExtend(
      */
     if (CurrentCluster == 0)
     {
-        Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &NewCluster);
+        Status = FindAndMarkAvailableClusters(DeviceExt, 0, 1, &NewCluster, &Allocated);
         if (!NT_SUCCESS(Status))
         {
             ExReleaseResourceLite(&DeviceExt->FatResource);
@@ -801,7 +1031,8 @@ GetNextClusterExtend(
         /* We are after last existing cluster, we must add one to file */
         /* Firstly, find the next available open allocation unit and
            mark it as end of file */
-        Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &NewCluster);
+        Status = FindAndMarkAvailableClusters(DeviceExt, CurrentCluster + 1, 1,
+                                              &NewCluster, &Allocated);
         if (!NT_SUCCESS(Status))
         {
             ExReleaseResourceLite(&DeviceExt->FatResource);
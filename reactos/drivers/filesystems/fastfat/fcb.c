@@ -150,6 +150,7 @@ vfatNewFCB(
     ExInitializeResourceLite(&rcFCB->MainResource);
     FsRtlInitializeFileLock(&rcFCB->FileLock, NULL, NULL);
     ExInitializeFastMutex(&rcFCB->LastMutex);
+    FsRtlInitializeLargeMcb(&rcFCB->ClusterMcb, PagedPool);
     rcFCB->RFCB.PagingIoResource = &rcFCB->PagingIoResource;
     rcFCB->RFCB.Resource = &rcFCB->MainResource;
     rcFCB->RFCB.IsFastIoPossible = FastIoIsNotPossible;
@@ -268,6 +269,8 @@ vfatDestroyFCB(
     PVFATFCB pFCB)
 {
     FsRtlUninitializeFileLock(&pFCB->FileLock);
+    FsRtlUninitializeLargeMcb(&pFCB->ClusterMcb);
+    vfatNameIndexDestroy(pFCB);
     if (!vfatFCBIsRoot(pFCB) &&
         !BooleanFlagOn(pFCB->Flags, FCB_IS_FAT) && !BooleanFlagOn(pFCB->Flags, FCB_IS_VOLUME))
     {
@@ -764,6 +767,290 @@ vfatAttachFCBToFileObject(
     return STATUS_SUCCESS;
 }
 
+static
+ULONG
+vfatNameIndexHash(
+    PUNICODE_STRING NameU)
+{
+    PWCHAR curr, last;
+    ULONG hash = 0;
+
+    /* Must fold case like RtlEqualUnicodeString does */
+    curr = NameU->Buffer;
+    last = NameU->Buffer + NameU->Length / sizeof(WCHAR);
+    while (curr < last)
+    {
+        hash = hash * 65599 + RtlUpcaseUnicodeChar(*curr++);
+    }
+    return hash;
+}
+
+static
+BOOLEAN
+vfatNameIndexAdd(
+    PVFAT_NAME_INDEX Index,
+    PUNICODE_STRING NameU,
+    ULONG StartIndex)
+{
+    PVFAT_NAME_INDEX_ENTRY Entry;
+
+    Entry = ExAllocatePoolWithTag(PagedPool, sizeof(VFAT_NAME_INDEX_ENTRY), TAG_NAME_INDEX);
+    if (Entry == NULL)
+    {
+        return FALSE;
+    }
+
+    Entry->Hash = vfatNameIndexHash(NameU);
+    Entry->StartIndex = StartIndex;
+    Entry->Next = Index->Buckets[Entry->Hash & Index->BucketMask];
+    Index->Buckets[Entry->Hash & Index->BucketMask] = Entry;
+    return TRUE;
+}
+
+static
+VOID
+vfatNameIndexDel(
+    PVFAT_NAME_INDEX Index,
+    PUNICODE_STRING NameU,
+    ULONG StartIndex)
+{
+    PVFAT_NAME_INDEX_ENTRY *Link, Entry;
+    ULONG Hash;
+
+    Hash = vfatNameIndexHash(NameU);
+    for (Link = &Index->Buckets[Hash & Index->BucketMask]; *Link != NULL; Link = &Entry->Next)
+    {
+        Entry = *Link;
+        if (Entry->Hash == Hash && Entry->StartIndex == StartIndex)
+        {
+            *Link = Entry->Next;
+            ExFreePoolWithTag(Entry, TAG_NAME_INDEX);
+            return;
+        }
+    }
+}
+
+VOID
+vfatNameIndexDestroy(
+    PVFATFCB DirFcb)
+{
+    PVFAT_NAME_INDEX Index = DirFcb->NameIndex;
+    PVFAT_NAME_INDEX_ENTRY Entry;
+    ULONG i;
+
+    if (Index == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i <= Index->BucketMask; i++)
+    {
+        while ((Entry = Index->Buckets[i]) != NULL)
+        {
+            Index->Buckets[i] = Entry->Next;
+            ExFreePoolWithTag(Entry, TAG_NAME_INDEX);
+        }
+    }
+
+    ExFreePoolWithTag(Index, TAG_NAME_INDEX);
+    DirFcb->NameIndex = NULL;
+}
+
+VOID
+vfatNameIndexInsert(
+    PVFATFCB DirFcb,
+    PVFATFCB Fcb)
+{
+    if (DirFcb->NameIndex == NULL)
+    {
+        return;
+    }
+
+    if (!vfatNameIndexAdd(DirFcb->NameIndex, &Fcb->LongNameU, Fcb->startIndex) ||
+        (Fcb->ShortNameU.Length != 0 &&
+         !RtlEqualUnicodeString(&Fcb->LongNameU, &Fcb->ShortNameU, TRUE) &&
+         !vfatNameIndexAdd(DirFcb->NameIndex, &Fcb->ShortNameU, Fcb->startIndex)))
+    {
+        /* An incomplete index is useless, drop it */
+        vfatNameIndexDestroy(DirFcb);
+    }
+}
+
+VOID
+vfatNameIndexRemove(
+    PVFATFCB DirFcb,
+    PVFATFCB Fcb)
+{
+    if (DirFcb == NULL || DirFcb->NameIndex == NULL)
+    {
+        return;
+    }
+
+    vfatNameIndexDel(DirFcb->NameIndex, &Fcb->LongNameU, Fcb->startIndex);
+    if (Fcb->ShortNameU.Length != 0)
+    {
+        vfatNameIndexDel(DirFcb->NameIndex, &Fcb->ShortNameU, Fcb->startIndex);
+    }
+}
+
+static
+NTSTATUS
+vfatNameIndexBuild(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb)
+{
+    PVFAT_NAME_INDEX Index;
+    ULONG BucketCount, Slots;
+    NTSTATUS Status;
+    PVOID Context = NULL;
+    PVOID Page = NULL;
+    BOOLEAN First = TRUE;
+    VFAT_DIRENTRY_CONTEXT DirContext;
+    WCHAR LongNameBuffer[260];
+    WCHAR ShortNameBuffer[13];
+
+    Slots = DirFcb->RFCB.FileSize.u.LowPart / sizeof(FAT_DIR_ENTRY);
+    for (BucketCount = 64; BucketCount < Slots / 2 && BucketCount < 0x10000; BucketCount <<= 1);
+
+    Index = ExAllocatePoolWithTag(PagedPool,
+                                  FIELD_OFFSET(VFAT_NAME_INDEX, Buckets) + BucketCount * sizeof(PVFAT_NAME_INDEX_ENTRY),
+                                  TAG_NAME_INDEX);
+    if (Index == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    RtlZeroMemory(Index, FIELD_OFFSET(VFAT_NAME_INDEX, Buckets) + BucketCount * sizeof(PVFAT_NAME_INDEX_ENTRY));
+    Index->BucketMask = BucketCount - 1;
+    DirFcb->NameIndex = Index;
+
+    DirContext.DirIndex = 0;
+    DirContext.LongNameU.Buffer = LongNameBuffer;
+    DirContext.LongNameU.Length = 0;
+    DirContext.LongNameU.MaximumLength = sizeof(LongNameBuffer);
+    DirContext.ShortNameU.Buffer = ShortNameBuffer;
+    DirContext.ShortNameU.Length = 0;
+    DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
+
+    while (TRUE)
+    {
+        Status = DeviceExt->GetNextDirEntry(&Context, &Page, DirFcb, &DirContext, First);
+        First = FALSE;
+        if (Status == STATUS_NO_MORE_ENTRIES)
+        {
+            Status = STATUS_SUCCESS;
+            break;
+        }
+        if (!NT_SUCCESS(Status))
+        {
+            break;
+        }
+
+        if (!ENTRY_VOLUME(DeviceExt, &DirContext.DirEntry) &&
+            DirContext.LongNameU.Length != 0 &&
+            DirContext.ShortNameU.Length != 0)
+        {
+            if (!vfatNameIndexAdd(Index, &DirContext.LongNameU, DirContext.StartIndex) ||
+                (!RtlEqualUnicodeString(&DirContext.LongNameU, &DirContext.ShortNameU, TRUE) &&
+                 !vfatNameIndexAdd(Index, &DirContext.ShortNameU, DirContext.StartIndex)))
+            {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                break;
+            }
+        }
+        DirContext.DirIndex++;
+    }
+
+    if (Context)
+    {
+        CcUnpinData(Context);
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        vfatNameIndexDestroy(DirFcb);
+    }
+
+    DPRINT("Name index of '%wZ' built, Status %lx\n", &DirFcb->PathNameU, Status);
+    return Status;
+}
+
+/*
+ * Look up a file name in the name index of a directory, building the index
+ * on first use. Only entries starting at or after DirContext->DirIndex are
+ * considered. Returns STATUS_MORE_PROCESSING_REQUIRED if the directory
+ * isn't indexed (small directory, FATX or out of memory) and the caller
+ * must scan it.
+ */
+NTSTATUS
+vfatNameIndexLookup(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    PUNICODE_STRING FileToFindU,
+    PVFAT_DIRENTRY_CONTEXT DirContext)
+{
+    PVFAT_NAME_INDEX_ENTRY Entry;
+    ULONG Hash, MinIndex;
+    PVOID Context;
+    PVOID Page;
+    NTSTATUS Status;
+
+    if (DirFcb->NameIndex == NULL)
+    {
+        if ((DeviceExt->Flags & VCB_IS_FATX) ||
+            DirFcb->RFCB.FileSize.u.LowPart / sizeof(FAT_DIR_ENTRY) < VFAT_NAME_INDEX_MIN_ENTRIES ||
+            !NT_SUCCESS(vfatNameIndexBuild(DeviceExt, DirFcb)))
+        {
+            return STATUS_MORE_PROCESSING_REQUIRED;
+        }
+    }
+
+    MinIndex = DirContext->DirIndex;
+    Hash = vfatNameIndexHash(FileToFindU);
+    for (Entry = DirFcb->NameIndex->Buckets[Hash & DirFcb->NameIndex->BucketMask];
+         Entry != NULL;
+         Entry = Entry->Next)
+    {
+        if (Entry->Hash != Hash || Entry->StartIndex < MinIndex)
+        {
+            continue;
+        }
+
+        /* Read the entry back and check the name */
+        Context = NULL;
+        DirContext->DirIndex = Entry->StartIndex;
+        Status = DeviceExt->GetNextDirEntry(&Context, &Page, DirFcb, DirContext, TRUE);
+        if (Context)
+        {
+            CcUnpinData(Context);
+        }
+
+        if (NT_SUCCESS(Status) && !ENTRY_VOLUME(DeviceExt, &DirContext->DirEntry))
+        {
+            if (RtlEqualUnicodeString(FileToFindU, &DirContext->LongNameU, TRUE) ||
+                RtlEqualUnicodeString(FileToFindU, &DirContext->ShortNameU, TRUE))
+            {
+                return STATUS_SUCCESS;
+            }
+
+            /* Hash collision with another name of that entry */
+            if (vfatNameIndexHash(&DirContext->LongNameU) == Hash ||
+                vfatNameIndexHash(&DirContext->ShortNameU) == Hash)
+            {
+                continue;
+            }
+        }
+
+        /* The index doesn't match the directory anymore, go back to scanning */
+        DPRINT1("Stale name index for '%wZ'\n", &DirFcb->PathNameU);
+        vfatNameIndexDestroy(DirFcb);
+        DirContext->DirIndex = MinIndex;
+        return STATUS_MORE_PROCESSING_REQUIRED;
+    }
+
+    DirContext->DirIndex = MinIndex;
+    return STATUS_OBJECT_NAME_NOT_FOUND;
+}
+
 NTSTATUS
 vfatDirFindFile(
     PDEVICE_EXTENSION pDeviceExt,
@@ -799,6 +1086,19 @@ vfatDirFindFile(
     DirContext.ShortNameU.Length = 0;
     DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
 
+    status = vfatNameIndexLookup(pDeviceExt, pDirectoryFCB, FileToFindU, &DirContext);
+    if (status != STATUS_MORE_PROCESSING_REQUIRED)
+    {
+        if (NT_SUCCESS(status))
+        {
+            status = vfatMakeFCBFromDirEntry(pDeviceExt,
+                pDirectoryFCB,
+                &DirContext,
+                pFoundFCB);
+        }
+        return status;
+    }
+
     while (TRUE)
     {
         status = pDeviceExt->GetNextDirEntry(&Context,
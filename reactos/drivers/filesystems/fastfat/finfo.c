@@ -1249,35 +1249,16 @@ VfatSetAllocationSizeInformation(
         if (FirstCluster == 0)
         {
             Fcb->LastCluster = Fcb->LastOffset = 0;
-            Status = NextCluster(DeviceExt, FirstCluster, &FirstCluster, TRUE);
+            VfatMcbTruncate(Fcb, 0);
+            Status = ExtendClusterChain(DeviceExt, 0,
+                                        (NewSize - 1) / ClusterSize + 1,
+                                        &FirstCluster);
             if (!NT_SUCCESS(Status))
             {
-                DPRINT1("NextCluster failed. Status = %x\n", Status);
+                DPRINT1("ExtendClusterChain failed. Status = %x\n", Status);
                 return Status;
             }
 
-            if (FirstCluster == 0xffffffff)
-            {
-                return STATUS_DISK_FULL;
-            }
-
-            Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                     ROUND_DOWN(NewSize - 1, ClusterSize),
-                                     &NCluster, TRUE);
-            if (NCluster == 0xffffffff || !NT_SUCCESS(Status))
-            {
-                /* disk is full */
-                NCluster = Cluster = FirstCluster;
-                Status = STATUS_SUCCESS;
-                while (NT_SUCCESS(Status) && Cluster != 0xffffffff && Cluster > 1)
-                {
-                    Status = NextCluster(DeviceExt, FirstCluster, &NCluster, FALSE);
-                    WriteCluster(DeviceExt, Cluster, 0);
-                    Cluster = NCluster;
-                }
-                return STATUS_DISK_FULL;
-            }
-
             if (Fcb->Flags & FCB_IS_FATX_ENTRY)
             {
                 Fcb->entry.FatX.FirstCluster = FirstCluster;
@@ -1327,25 +1308,15 @@ VfatSetAllocationSizeInformation(
             Fcb->LastCluster = Cluster;
             Fcb->LastOffset = Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize;
 
-            /* FIXME: Check status */
             /* Cluster points now to the last cluster within the chain */
-            Status = OffsetToCluster(DeviceExt, Cluster,
-                                     ROUND_DOWN(NewSize - 1, ClusterSize) - Fcb->LastOffset,
-                                     &NCluster, TRUE);
-            if (NCluster == 0xffffffff || !NT_SUCCESS(Status))
+            Status = ExtendClusterChain(DeviceExt, Cluster,
+                                        (NewSize - 1) / ClusterSize + 1 -
+                                        Fcb->RFCB.AllocationSize.u.LowPart / ClusterSize,
+                                        &NCluster);
+            if (!NT_SUCCESS(Status))
             {
-                /* disk is full */
-                NCluster = Cluster;
-                Status = NextCluster(DeviceExt, FirstCluster, &NCluster, FALSE);
-                WriteCluster(DeviceExt, Cluster, 0xffffffff);
-                Cluster = NCluster;
-                while (NT_SUCCESS(Status) && Cluster != 0xffffffff && Cluster > 1)
-                {
-                    Status = NextCluster(DeviceExt, FirstCluster, &NCluster, FALSE);
-                    WriteCluster(DeviceExt, Cluster, 0);
-                    Cluster = NCluster;
-                }
-                return STATUS_DISK_FULL;
+                DPRINT1("ExtendClusterChain failed. Status = %x\n", Status);
+                return Status;
             }
         }
         UpdateFileSize(FileObject, Fcb, NewSize, ClusterSize);
@@ -1364,6 +1335,7 @@ VfatSetAllocationSizeInformation(
         AllocSizeChanged = TRUE;
         /* FIXME: Use the cached cluster/offset better way. */
         Fcb->LastCluster = Fcb->LastOffset = 0;
+        VfatMcbTruncate(Fcb, ROUND_UP(NewSize, ClusterSize) / ClusterSize);
         UpdateFileSize(FileObject, Fcb, NewSize, ClusterSize);
         if (NewSize > 0)
         {
@@ -1405,6 +1377,10 @@ VfatSetAllocationSizeInformation(
             WriteCluster(DeviceExt, Cluster, 0);
             Cluster = NCluster;
         }
+
+        /* A walk between the first trim and the chain update may have
+         * cached the clusters just freed */
+        VfatMcbTruncate(Fcb, ROUND_UP(NewSize, ClusterSize) / ClusterSize);
     }
     else
     {
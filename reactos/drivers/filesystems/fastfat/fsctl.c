@@ -227,6 +227,7 @@ VfatHasFileSystem(
                     FatInfo.RootCluster = ((struct _BootSector32*) Boot)->RootCluster;
                     FatInfo.rootStart = FatInfo.dataStart + ((FatInfo.RootCluster - 2) * FatInfo.SectorsPerCluster);
                     FatInfo.VolumeID = ((struct _BootSector32*) Boot)->VolumeID;
+                    FatInfo.FSInfoSector = ((struct _BootSector32*) Boot)->FSInfoSector;
                 }
                 else
                 {
@@ -331,6 +332,62 @@ VfatHasFileSystem(
     return Status;
 }
 
+/*
+ * FUNCTION: Reads the allocation hints from the FAT32 FSInfo sector. These
+ *           are only hints: the next free cluster seeds the allocator and the
+ *           free cluster count is used only if the FAT wasn't scanned.
+ */
+static
+VOID
+VfatReadFsInfo(
+    PDEVICE_EXTENSION DeviceExt,
+    PDEVICE_OBJECT DeviceToMount)
+{
+    struct _FsInfoSector *FsInfo;
+    LARGE_INTEGER Offset;
+    NTSTATUS Status;
+
+    if (DeviceExt->FatInfo.FatType != FAT32 ||
+        DeviceExt->FatInfo.FSInfoSector == 0 ||
+        DeviceExt->FatInfo.FSInfoSector == 0xffff ||
+        DeviceExt->FatInfo.BytesPerSector < sizeof(struct _FsInfoSector))
+    {
+        return;
+    }
+
+    FsInfo = ExAllocatePoolWithTag(NonPagedPool, DeviceExt->FatInfo.BytesPerSector, TAG_VFAT);
+    if (FsInfo == NULL)
+    {
+        return;
+    }
+
+    Offset.QuadPart = (LONGLONG)DeviceExt->FatInfo.FSInfoSector * DeviceExt->FatInfo.BytesPerSector;
+    Status = VfatReadDisk(DeviceToMount, &Offset, DeviceExt->FatInfo.BytesPerSector, (PUCHAR)FsInfo, FALSE);
+    if (NT_SUCCESS(Status) &&
+        FsInfo->ExtBootSignature2 == 0x41615252 &&
+        FsInfo->FSINFOSignature == 0x61417272 &&
+        FsInfo->Signatur2 == 0xaa550000)
+    {
+        DPRINT("FSInfo: free %x, next %x\n", FsInfo->FreeCluster, FsInfo->NextCluster);
+
+        if (FsInfo->NextCluster >= 2 &&
+            FsInfo->NextCluster < DeviceExt->FatInfo.NumberOfClusters + 2)
+        {
+            DeviceExt->LastAvailableCluster = FsInfo->NextCluster;
+        }
+
+        /* 0xffffffff means unknown, leave it to CountAvailableClusters */
+        if (!DeviceExt->AvailableClustersValid &&
+            FsInfo->FreeCluster <= DeviceExt->FatInfo.NumberOfClusters)
+        {
+            DeviceExt->AvailableClusters = FsInfo->FreeCluster;
+            DeviceExt->AvailableClustersValid = TRUE;
+        }
+    }
+
+    ExFreePoolWithTag(FsInfo, TAG_VFAT);
+}
+
 /*
  * FUNCTION: Mounts the device
  */
@@ -590,6 +647,10 @@ VfatMount(
     /* read volume label */
     ReadVolumeLabel(DeviceExt,  DeviceObject->Vpb);
 
+    /* The FSInfo free count avoids a FAT scan at mount. The free cluster
+     * bitmap is built when clusters are first allocated. */
+    VfatReadFsInfo(DeviceExt, DeviceToMount);
+
     /* read clean shutdown bit status */
     Status = GetNextCluster(DeviceExt, 1, &eocMark);
     if (NT_SUCCESS(Status))
@@ -972,6 +1033,7 @@ VfatDismountVolume(
     ExReleaseResourceLite(&DeviceExt->FatResource);
 
     /* Release a few resources and quit, we're done */
+    VfatUninitializeFreeClusterBitmap(DeviceExt);
     ExDeleteResourceLite(&DeviceExt->DirResource);
     ExDeleteResourceLite(&DeviceExt->FatResource);
     ObDereferenceObject(DeviceExt->FATFileObject);
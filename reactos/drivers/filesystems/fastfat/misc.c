@@ -435,6 +435,9 @@ VfatCheckForDismount(
     {
         PVPB DelVpb;
 
+        /* The device extension goes away with the volume device */
+        VfatUninitializeFreeClusterBitmap(DeviceExt);
+
         /* If we have a local VPB, we'll have to delete it
          * but we won't dismount us - something went bad before
          */
@@ -106,6 +106,198 @@ OffsetToCluster(
    }
 }
 
+/*
+ * Append a run to the cached cluster chain of the FCB. The run is only
+ * added if it directly follows what is already cached, so that concurrent
+ * walkers can't leave a hole in the map, and if the map was not trimmed
+ * since the walk started, as the run may then describe clusters that no
+ * longer belong to the file.
+ */
+static
+VOID
+VfatMcbAppendRun(
+    PVFATFCB Fcb,
+    ULONG Generation,
+    ULONG Vcn,
+    ULONG Lcn,
+    ULONG Count)
+{
+    ExAcquireFastMutex(&Fcb->LastMutex);
+    if (Fcb->McbGeneration == Generation &&
+        Fcb->McbClusterCount == Vcn &&
+        FsRtlAddLargeMcbEntry(&Fcb->ClusterMcb, Vcn, Lcn, Count))
+    {
+        Fcb->McbClusterCount = Vcn + Count;
+    }
+    ExReleaseFastMutex(&Fcb->LastMutex);
+}
+
+/*
+ * Drop the cached cluster runs beyond ClusterCount file clusters. Must be
+ * called whenever clusters are removed from the chain of the file, or the
+ * chain is replaced.
+ */
+VOID
+VfatMcbTruncate(
+    PVFATFCB Fcb,
+    ULONG ClusterCount)
+{
+    ExAcquireFastMutex(&Fcb->LastMutex);
+    Fcb->McbGeneration++;
+    if (Fcb->McbClusterCount > ClusterCount)
+    {
+        FsRtlTruncateLargeMcb(&Fcb->ClusterMcb, ClusterCount);
+        Fcb->McbClusterCount = ClusterCount;
+    }
+    ExReleaseFastMutex(&Fcb->LastMutex);
+}
+
+/*
+ * Map a file offset to the disk cluster holding it and return how many
+ * physically contiguous clusters follow in the file (including that one).
+ * On a cache miss the FAT is walked from the last cached cluster only, and
+ * the walk goes on while the chain stays contiguous, up to ClustersWanted
+ * clusters, so that the caller can issue a single I/O for the whole run.
+ * Returns 0xffffffff in Cluster if the chain ends before FileOffset.
+ */
+NTSTATUS
+VfatMcbOffsetToCluster(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb,
+    ULONG FirstCluster,
+    ULONG FileOffset,
+    ULONG ClustersWanted,
+    PULONG Cluster,
+    PULONG RunClusters)
+{
+    LONGLONG Lcn, Count;
+    ULONG Vcn, Index, Current, Next, Generation;
+    ULONG RunStart, RunLcn, RunCount;
+    NTSTATUS Status;
+
+    ASSERT(FirstCluster > 1);
+
+    Vcn = FileOffset / DeviceExt->FatInfo.BytesPerCluster;
+    if (ClustersWanted == 0)
+        ClustersWanted = 1;
+
+    /* Fast path, the offset is already mapped */
+    if (FsRtlLookupLargeMcbEntry(&Fcb->ClusterMcb, Vcn, &Lcn, &Count, NULL, NULL, NULL) &&
+        Lcn != -1)
+    {
+        *Cluster = (ULONG)Lcn;
+        *RunClusters = (ULONG)min(Count, MAXULONG);
+        goto Verify;
+    }
+
+    /*
+     * Find the last cached cluster to resume the walk from. Look the offset
+     * up again first, a concurrent walk may have mapped it since, and then
+     * the walk would have to start past it.
+     */
+    ExAcquireFastMutex(&Fcb->LastMutex);
+    if (FsRtlLookupLargeMcbEntry(&Fcb->ClusterMcb, Vcn, &Lcn, &Count, NULL, NULL, NULL) &&
+        Lcn != -1)
+    {
+        ExReleaseFastMutex(&Fcb->LastMutex);
+        *Cluster = (ULONG)Lcn;
+        *RunClusters = (ULONG)min(Count, MAXULONG);
+        goto Verify;
+    }
+
+    /* The mapped clusters are leading ones, so the offset is not among them */
+    Index = Fcb->McbClusterCount;
+    Generation = Fcb->McbGeneration;
+    ASSERT(Index <= Vcn);
+    if (Index > Vcn ||
+        Index == 0 ||
+        !FsRtlLookupLargeMcbEntry(&Fcb->ClusterMcb, Index - 1, &Lcn, NULL, NULL, NULL, NULL) ||
+        Lcn == -1)
+    {
+        Lcn = -1;
+    }
+    ExReleaseFastMutex(&Fcb->LastMutex);
+
+    if (Lcn == -1)
+    {
+        Index = 0;
+        Current = FirstCluster;
+    }
+    else
+    {
+        Status = GetNextCluster(DeviceExt, (ULONG)Lcn, &Current);
+        if (!NT_SUCCESS(Status))
+            return Status;
+        if (Current == 0xffffffff)
+        {
+            *Cluster = 0xffffffff;
+            *RunClusters = 0;
+            return STATUS_SUCCESS;
+        }
+    }
+
+    /* Walk the chain, collecting contiguous runs */
+    RunStart = Index;
+    RunLcn = Current;
+    RunCount = 1;
+    while (Index < Vcn || Index - Vcn + 1 < ClustersWanted)
+    {
+        Status = GetNextCluster(DeviceExt, Current, &Next);
+        if (!NT_SUCCESS(Status))
+        {
+            VfatMcbAppendRun(Fcb, Generation, RunStart, RunLcn, RunCount);
+            return Status;
+        }
+
+        if (Next == 0xffffffff)
+            break;
+
+        if (Next != Current + 1)
+        {
+            /* Past the target and no longer contiguous, we're done */
+            if (Index >= Vcn)
+                break;
+
+            VfatMcbAppendRun(Fcb, Generation, RunStart, RunLcn, RunCount);
+            RunStart = Index + 1;
+            RunLcn = Next;
+            RunCount = 0;
+        }
+
+        Current = Next;
+        Index++;
+        RunCount++;
+    }
+    VfatMcbAppendRun(Fcb, Generation, RunStart, RunLcn, RunCount);
+
+    if (Index < Vcn)
+    {
+        /* The chain ends before the offset */
+        *Cluster = 0xffffffff;
+        *RunClusters = 0;
+        return STATUS_SUCCESS;
+    }
+
+    /* The walk started at or before the offset, so the last run holds it */
+    ASSERT(RunStart <= Vcn);
+    *Cluster = RunLcn + (Vcn - RunStart);
+    *RunClusters = Index - Vcn + 1;
+
+Verify:
+#ifdef DEBUG_VERIFY_OFFSET_CACHING
+    /* DEBUG VERIFICATION */
+    {
+        ULONG CorrectCluster;
+        OffsetToCluster(DeviceExt, FirstCluster,
+                        ROUND_DOWN(FileOffset, DeviceExt->FatInfo.BytesPerCluster),
+                        &CorrectCluster, FALSE);
+        if (CorrectCluster != *Cluster)
+            KeBugCheck(FAT_FILE_SYSTEM);
+    }
+#endif
+    return STATUS_SUCCESS;
+}
+
 /*
  * FUNCTION: Reads data from a file
  */
@@ -119,18 +311,15 @@ VfatReadFileData(
 {
     ULONG CurrentCluster;
     ULONG FirstCluster;
-    ULONG StartCluster;
     ULONG ClusterCount;
+    ULONG ClusterOffset;
     LARGE_INTEGER StartOffset;
     PDEVICE_EXTENSION DeviceExt;
-    BOOLEAN First = TRUE;
     PVFATFCB Fcb;
-    NTSTATUS Status;
+    NTSTATUS Status = STATUS_SUCCESS;
     ULONG BytesDone;
     ULONG BytesPerSector;
     ULONG BytesPerCluster;
-    ULONG LastCluster;
-    ULONG LastOffset;
 
     /* PRECONDITION */
     ASSERT(IrpContext);
@@ -208,87 +397,27 @@ VfatReadFileData(
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    LastCluster = Fcb->LastCluster;
-    LastOffset = Fcb->LastOffset;
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
-    /* Find the cluster to start the read from */
-    if (LastCluster > 0 && ReadOffset.u.LowPart >= LastOffset)
-    {
-        Status = OffsetToCluster(DeviceExt, LastCluster,
-                                 ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster) -
-                                 LastOffset,
-                                 &CurrentCluster, FALSE);
-#ifdef DEBUG_VERIFY_OFFSET_CACHING
-        /* DEBUG VERIFICATION */
-        {
-            ULONG CorrectCluster;
-            OffsetToCluster(DeviceExt, FirstCluster,
-                            ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
-                            &CorrectCluster, FALSE);
-            if (CorrectCluster != CurrentCluster)
-                KeBugCheck(FAT_FILE_SYSTEM);
-        }
-#endif
-    }
-    else
-    {
-        Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                 ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
-                                 &CurrentCluster, FALSE);
-    }
-
-    if (!NT_SUCCESS(Status))
-    {
-        return Status;
-    }
-
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    Fcb->LastCluster = CurrentCluster;
-    Fcb->LastOffset = ROUND_DOWN (ReadOffset.u.LowPart, BytesPerCluster);
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     KeInitializeEvent(&IrpContext->Event, NotificationEvent, FALSE);
     IrpContext->RefCount = 1;
 
-    while (Length > 0 && CurrentCluster != 0xffffffff)
+    while (Length > 0)
     {
-        StartCluster = CurrentCluster;
-        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector;
-        BytesDone = 0;
-        ClusterCount = 0;
-
-        do
+        /* Map the current offset to a run of contiguous clusters */
+        ClusterOffset = ReadOffset.u.LowPart % BytesPerCluster;
+        Status = VfatMcbOffsetToCluster(DeviceExt, Fcb, FirstCluster,
+                                        ReadOffset.u.LowPart,
+                                        (ULONG)(((ULONGLONG)ClusterOffset + Length + BytesPerCluster - 1) / BytesPerCluster),
+                                        &CurrentCluster, &ClusterCount);
+        if (!NT_SUCCESS(Status) || CurrentCluster == 0xffffffff)
         {
-            ClusterCount++;
-            if (First)
-            {
-                BytesDone =  min (Length, BytesPerCluster - (ReadOffset.u.LowPart % BytesPerCluster));
-                StartOffset.QuadPart += ReadOffset.u.LowPart % BytesPerCluster;
-                First = FALSE;
-            }
-            else
-            {
-                if (Length - BytesDone > BytesPerCluster)
-                {
-                    BytesDone += BytesPerCluster;
-                }
-                else
-                {
-                    BytesDone = Length;
-                }
-            }
-            Status = NextCluster(DeviceExt, FirstCluster, &CurrentCluster, FALSE);
+            break;
         }
-        while (StartCluster + ClusterCount == CurrentCluster && NT_SUCCESS(Status) && Length > BytesDone);
-        DPRINT("start %08x, next %08x, count %u\n",
-               StartCluster, CurrentCluster, ClusterCount);
 
-        ExAcquireFastMutex(&Fcb->LastMutex);
-        Fcb->LastCluster = StartCluster + (ClusterCount - 1);
-        Fcb->LastOffset = ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster) + (ClusterCount - 1) * BytesPerCluster;
-        ExReleaseFastMutex(&Fcb->LastMutex);
+        StartOffset.QuadPart = ClusterToSector(DeviceExt, CurrentCluster) * BytesPerSector + ClusterOffset;
+        BytesDone = (ULONG)min((ULONGLONG)Length,
+                               (ULONGLONG)ClusterCount * BytesPerCluster - ClusterOffset);
+        DPRINT("start %08x, count %u, bytes %u\n",
+               CurrentCluster, ClusterCount, BytesDone);
 
         /* Fire up the read command */
         Status = VfatReadDiskPartial (IrpContext, &StartOffset, BytesDone, *LengthRead, FALSE);
@@ -334,16 +463,13 @@ VfatWriteFileData(
     ULONG FirstCluster;
     ULONG CurrentCluster;
     ULONG BytesDone;
-    ULONG StartCluster;
     ULONG ClusterCount;
+    ULONG ClusterOffset;
     NTSTATUS Status = STATUS_SUCCESS;
-    BOOLEAN First = TRUE;
     ULONG BytesPerSector;
     ULONG BytesPerCluster;
     LARGE_INTEGER StartOffset;
     ULONG BufferOffset;
-    ULONG LastCluster;
-    ULONG LastOffset;
 
     /* PRECONDITION */
     ASSERT(IrpContext);
@@ -421,89 +547,27 @@ VfatWriteFileData(
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    LastCluster = Fcb->LastCluster;
-    LastOffset = Fcb->LastOffset;
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
-    /*
-     * Find the cluster to start the write from
-     */
-    if (LastCluster > 0 && WriteOffset.u.LowPart >= LastOffset)
-    {
-        Status = OffsetToCluster(DeviceExt, LastCluster,
-                                 ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster) -
-                                 LastOffset,
-                                 &CurrentCluster, FALSE);
-#ifdef DEBUG_VERIFY_OFFSET_CACHING
-        /* DEBUG VERIFICATION */
-        {
-            ULONG CorrectCluster;
-            OffsetToCluster(DeviceExt, FirstCluster,
-                            ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
-                            &CorrectCluster, FALSE);
-            if (CorrectCluster != CurrentCluster)
-                KeBugCheck(FAT_FILE_SYSTEM);
-        }
-#endif
-    }
-    else
-    {
-        Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                 ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
-                                 &CurrentCluster, FALSE);
-    }
-
-    if (!NT_SUCCESS(Status))
-    {
-        return Status;
-    }
-
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    Fcb->LastCluster = CurrentCluster;
-    Fcb->LastOffset = ROUND_DOWN (WriteOffset.u.LowPart, BytesPerCluster);
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     IrpContext->RefCount = 1;
     BufferOffset = 0;
 
-    while (Length > 0 && CurrentCluster != 0xffffffff)
+    while (Length > 0)
     {
-        StartCluster = CurrentCluster;
-        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector;
-        BytesDone = 0;
-        ClusterCount = 0;
-
-        do
+        /* Map the current offset to a run of contiguous clusters */
+        ClusterOffset = WriteOffset.u.LowPart % BytesPerCluster;
+        Status = VfatMcbOffsetToCluster(DeviceExt, Fcb, FirstCluster,
+                                        WriteOffset.u.LowPart,
+                                        (ULONG)(((ULONGLONG)ClusterOffset + Length + BytesPerCluster - 1) / BytesPerCluster),
+                                        &CurrentCluster, &ClusterCount);
+        if (!NT_SUCCESS(Status) || CurrentCluster == 0xffffffff)
         {
-            ClusterCount++;
-            if (First)
-            {
-                BytesDone =  min (Length, BytesPerCluster - (WriteOffset.u.LowPart % BytesPerCluster));
-                StartOffset.QuadPart += WriteOffset.u.LowPart % BytesPerCluster;
-                First = FALSE;
-            }
-            else
-            {
-                if (Length - BytesDone > BytesPerCluster)
-                {
-                    BytesDone += BytesPerCluster;
-                }
-                else
-                {
-                    BytesDone = Length;
-                }
-            }
-            Status = NextCluster(DeviceExt, FirstCluster, &CurrentCluster, FALSE);
+            break;
         }
-        while (StartCluster + ClusterCount == CurrentCluster && NT_SUCCESS(Status) && Length > BytesDone);
-        DPRINT("start %08x, next %08x, count %u\n",
-               StartCluster, CurrentCluster, ClusterCount);
 
-        ExAcquireFastMutex(&Fcb->LastMutex);
-        Fcb->LastCluster = StartCluster + (ClusterCount - 1);
-        Fcb->LastOffset = ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster) + (ClusterCount - 1) * BytesPerCluster;
-        ExReleaseFastMutex(&Fcb->LastMutex);
+        StartOffset.QuadPart = ClusterToSector(DeviceExt, CurrentCluster) * BytesPerSector + ClusterOffset;
+        BytesDone = (ULONG)min((ULONGLONG)Length,
+                               (ULONGLONG)ClusterCount * BytesPerCluster - ClusterOffset);
+        DPRINT("start %08x, count %u, bytes %u\n",
+               CurrentCluster, ClusterCount, BytesDone);
 
         // Fire up the write command
         Status = VfatWriteDiskPartial (IrpContext, &StartOffset, BytesDone, BufferOffset, FALSE);
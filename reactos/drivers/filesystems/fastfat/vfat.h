@@ -254,6 +254,7 @@ typedef struct
     ULONG NumberOfClusters;
     ULONG FatType;
     ULONG Sectors;
+    ULONG FSInfoSector;
     BOOLEAN FixedMedia;
 } FATINFO, *PFATINFO;
 
@@ -293,6 +294,13 @@ typedef struct DEVICE_EXTENSION
     ULONG LastAvailableCluster;
     ULONG AvailableClusters;
     BOOLEAN AvailableClustersValid;
+
+    /* In-memory copy of the FAT allocation state, a set bit is a used cluster.
+     * It is built on the first allocation, FreeClusterBitmapFailed stops
+     * further attempts once that failed. */
+    RTL_BITMAP FreeClusterBitmap;
+    BOOLEAN FreeClusterBitmapValid;
+    BOOLEAN FreeClusterBitmapFailed;
     ULONG Flags;
     struct _VFATFCB *VolumeFcb;
 
@@ -430,8 +438,44 @@ typedef struct _VFATFCB
     FAST_MUTEX LastMutex;
     ULONG LastCluster;
     ULONG LastOffset;
+
+    /*
+     * Runs of the cluster chain (file cluster -> disk cluster), built lazily
+     * by VfatMcbOffsetToCluster. McbClusterCount is the number of leading
+     * file clusters mapped. Both are protected by LastMutex and are trimmed
+     * when the allocation shrinks. McbGeneration changes on every trim, so
+     * that runs found by a walk which raced with it are not added.
+     */
+    LARGE_MCB ClusterMcb;
+    ULONG McbClusterCount;
+    ULONG McbGeneration;
+
+    /* Name lookup index of a large directory, see vfatNameIndexLookup */
+    struct _VFAT_NAME_INDEX *NameIndex;
 } VFATFCB, *PVFATFCB;
 
+/*
+ * Case-insensitive index of the long and short names of a directory. Each
+ * name maps to the index of the first directory entry of its file. Once
+ * built, the index is complete, so a name it doesn't know doesn't exist.
+ * Protected by the DirResource of the volume.
+ */
+typedef struct _VFAT_NAME_INDEX_ENTRY
+{
+    struct _VFAT_NAME_INDEX_ENTRY *Next;
+    ULONG Hash;
+    ULONG StartIndex;
+} VFAT_NAME_INDEX_ENTRY, *PVFAT_NAME_INDEX_ENTRY;
+
+typedef struct _VFAT_NAME_INDEX
+{
+    ULONG BucketMask;
+    PVFAT_NAME_INDEX_ENTRY Buckets[1];
+} VFAT_NAME_INDEX, *PVFAT_NAME_INDEX;
+
+/* Directories with fewer entry slots than that are just scanned */
+#define VFAT_NAME_INDEX_MIN_ENTRIES 1024
+
 typedef struct _VFATCCB
 {
     LARGE_INTEGER  CurrentByteOffset;
@@ -445,6 +489,7 @@ typedef struct _VFATCCB
 #define TAG_FCB  'BCFV'
 #define TAG_IRP  'PRIV'
 #define TAG_VFAT 'TAFV'
+#define TAG_NAME_INDEX 'INFV'
 
 #define ENTRIES_PER_SECTOR (BLOCKSIZE / sizeof(FATDirEntry))
 
@@ -799,6 +844,21 @@ GetNextClusterExtend(
     ULONG CurrentCluster,
     PULONG NextCluster);
 
+NTSTATUS
+ExtendClusterChain(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG LastCluster,
+    ULONG ClusterCount,
+    PULONG FirstNewCluster);
+
+NTSTATUS
+VfatInitializeFreeClusterBitmap(
+    PDEVICE_EXTENSION DeviceExt);
+
+VOID
+VfatUninitializeFreeClusterBitmap(
+    PDEVICE_EXTENSION DeviceExt);
+
 NTSTATUS
 CountAvailableClusters(
     PDEVICE_EXTENSION DeviceExt,
@@ -875,6 +935,27 @@ vfatAttachFCBToFileObject(
     PVFATFCB fcb,
     PFILE_OBJECT fileObject);
 
+NTSTATUS
+vfatNameIndexLookup(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    PUNICODE_STRING FileToFindU,
+    PVFAT_DIRENTRY_CONTEXT DirContext);
+
+VOID
+vfatNameIndexInsert(
+    PVFATFCB DirFcb,
+    PVFATFCB Fcb);
+
+VOID
+vfatNameIndexRemove(
+    PVFATFCB DirFcb,
+    PVFATFCB Fcb);
+
+VOID
+vfatNameIndexDestroy(
+    PVFATFCB DirFcb);
+
 NTSTATUS
 vfatDirFindFile(
     PDEVICE_EXTENSION pVCB,
@@ -1003,6 +1084,21 @@ NextCluster(
     PULONG CurrentCluster,
     BOOLEAN Extend);
 
+NTSTATUS
+VfatMcbOffsetToCluster(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb,
+    ULONG FirstCluster,
+    ULONG FileOffset,
+    ULONG ClustersWanted,
+    PULONG Cluster,
+    PULONG RunClusters);
+
+VOID
+VfatMcbTruncate(
+    PVFATFCB Fcb,
+    ULONG ClusterCount);
+
 /* shutdown.c */
 
 DRIVER_DISPATCH
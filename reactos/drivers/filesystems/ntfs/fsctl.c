@@ -189,6 +189,60 @@ NtfsQueryMftZoneReservation(VOID)
 }
 
 
+/*
+ * Load $UpCase, which defines the collation order of file name indexes.
+ * On failure, the system upcase table is used instead.
+ */
+static
+VOID
+NtfsReadUpcaseTable(PDEVICE_EXTENSION DeviceExt)
+{
+    PFILE_RECORD_HEADER UpcaseRecord;
+    PNTFS_ATTR_CONTEXT DataContext;
+    ULONGLONG Size;
+    PWCHAR Table;
+    NTSTATUS Status;
+
+    UpcaseRecord = ExAllocatePoolWithTag(NonPagedPool,
+                                         DeviceExt->NtfsInfo.BytesPerFileRecord,
+                                         TAG_NTFS);
+    if (UpcaseRecord == NULL)
+    {
+        return;
+    }
+
+    Status = ReadFileRecord(DeviceExt, NTFS_FILE_UPCASE, UpcaseRecord);
+    if (NT_SUCCESS(Status))
+    {
+        Status = FindAttribute(DeviceExt, UpcaseRecord, AttributeData, L"", 0, &DataContext);
+    }
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Can't read $UpCase, using the system upcase table\n");
+        ExFreePoolWithTag(UpcaseRecord, TAG_NTFS);
+        return;
+    }
+
+    Size = min(AttributeDataLength(&DataContext->Record), 0x10000 * sizeof(WCHAR));
+    Table = ExAllocatePoolWithTag(PagedPool, (ULONG)Size, TAG_NTFS);
+    if (Table != NULL)
+    {
+        if (ReadAttribute(DeviceExt, DataContext, 0, (PCHAR)Table, (ULONG)Size) == Size)
+        {
+            DeviceExt->UpcaseTable = Table;
+            DeviceExt->UpcaseTableSize = (ULONG)Size / sizeof(WCHAR);
+        }
+        else
+        {
+            ExFreePoolWithTag(Table, TAG_NTFS);
+        }
+    }
+
+    ReleaseAttributeContext(DataContext);
+    ExFreePoolWithTag(UpcaseRecord, TAG_NTFS);
+}
+
+
 static
 NTSTATUS
 NtfsGetVolumeData(PDEVICE_OBJECT DeviceObject,
@@ -396,10 +450,54 @@ NtfsGetVolumeData(PDEVICE_OBJECT DeviceObject,
 
     NtfsInfo->MftZoneReservation = NtfsQueryMftZoneReservation();
 
+    NtfsReadUpcaseTable(DeviceExt);
+
     return Status;
 }
 
 
+/*
+ * Releases what a VCB owns besides its FCBs. Every path that gives up a
+ * volume device, whether its mount failed or the volume goes away, has
+ * to go through here.
+ */
+VOID
+NtfsCleanupVcb(PNTFS_VCB Vcb)
+{
+    CACHE_UNINITIALIZE_EVENT UninitializeEvent;
+    PFILE_OBJECT FileObject;
+    PNTFS_FCB Fcb;
+
+    NtfsFlushFileRecordCache(Vcb);
+
+    /* Give up the $MFT stream file records were read through */
+    FileObject = Vcb->MftFileObject;
+    if (FileObject)
+    {
+        Vcb->MftFileObject = NULL;
+        Fcb = FileObject->FsContext;
+
+        /* The shared cache map points into the FCB, wait for it to go */
+        KeInitializeEvent(&UninitializeEvent.Event, NotificationEvent, FALSE);
+        CcUninitializeCacheMap(FileObject, NULL, &UninitializeEvent);
+        KeWaitForSingleObject(&UninitializeEvent.Event, Executive, KernelMode, FALSE, NULL);
+
+        /* Closing a stream file object frees its CCB, but not its FCB */
+        ObDereferenceObject(FileObject);
+        NtfsDestroyFCB(Fcb);
+    }
+
+    if (Vcb->UpcaseTable)
+    {
+        ExFreePoolWithTag(Vcb->UpcaseTable, TAG_NTFS);
+        Vcb->UpcaseTable = NULL;
+        Vcb->UpcaseTableSize = 0;
+    }
+
+    ExDeleteResourceLite(&Vcb->MftContextLock);
+}
+
+
 static
 NTSTATUS
 NtfsMountVolume(PDEVICE_OBJECT DeviceObject,
@@ -447,6 +545,9 @@ NtfsMountVolume(PDEVICE_OBJECT DeviceObject,
     Vcb->Identifier.Type = NTFS_TYPE_VCB;
     Vcb->Identifier.Size = sizeof(NTFS_TYPE_VCB);
 
+    ExInitializeResourceLite(&Vcb->MftContextLock);
+    NtfsInitializeFileRecordCache(Vcb);
+
     Status = NtfsGetVolumeData(DeviceToMount,
                                Vcb);
     if (!NT_SUCCESS(Status))
@@ -520,6 +621,11 @@ NtfsMountVolume(PDEVICE_OBJECT DeviceObject,
     }
     _SEH2_END;
 
+    /* From now on, read file records through the cache */
+    Status = NtfsCreateMftStream(Vcb);
+    if (!NT_SUCCESS(Status))
+        goto ByeBye;
+
     ExInitializeResourceLite(&Vcb->DirResource);
 
     KeInitializeSpinLock(&Vcb->FcbListLock);
@@ -550,6 +656,9 @@ ByeBye:
         if (Ccb)
             ExFreePool(Ccb);
 
+        if (Vcb)
+            NtfsCleanupVcb(Vcb);
+
         if (NewDeviceObject)
             IoDeleteDevice(NewDeviceObject);
     }
@@ -191,9 +191,11 @@ ReadAttribute(PDEVICE_EXTENSION Vcb,
 
     AlreadyRead = 0;
 
-    // FIXME: Cache seems to be non-working. Disable it for now
-    //if(Context->CacheRunOffset <= Offset && Offset < Context->CacheRunOffset + Context->CacheRunLength * Volume->ClusterSize)
-    if (0)
+    /*
+     * The context remembers the run where the previous read stopped, so that
+     * sequential reads don't decode the mapping pairs from the beginning.
+     */
+    if (Context->CacheRunLength != 0 && Offset >= Context->CacheRunCurrentOffset)
     {
         DataRun = Context->CacheRun;
         LastLCN = Context->CacheRunLastLCN;
@@ -207,33 +209,40 @@ ReadAttribute(PDEVICE_EXTENSION Vcb,
         DataRun = (PUCHAR)&Context->Record + Context->Record.NonResident.MappingPairsOffset;
         CurrentOffset = 0;
 
-        while (1)
+        DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
+        if (DataRunOffset != -1)
         {
-            DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
-            if (DataRunOffset != -1)
-            {
-                /* Normal data run. */
-                DataRunStartLCN = LastLCN + DataRunOffset;
-                LastLCN = DataRunStartLCN;
-            }
-            else
-            {
-                /* Sparse data run. */
-                DataRunStartLCN = -1;
-            }
-
-            if (Offset >= CurrentOffset &&
-                Offset < CurrentOffset + (DataRunLength * Vcb->NtfsInfo.BytesPerCluster))
-            {
-                break;
-            }
+            /* Normal data run. */
+            DataRunStartLCN = LastLCN + DataRunOffset;
+            LastLCN = DataRunStartLCN;
+        }
+        else
+        {
+            /* Sparse data run. */
+            DataRunStartLCN = -1;
+        }
+    }
 
-            if (*DataRun == 0)
-            {
-                return AlreadyRead;
-            }
+    while (Offset < CurrentOffset ||
+           Offset >= CurrentOffset + (DataRunLength * Vcb->NtfsInfo.BytesPerCluster))
+    {
+        if (*DataRun == 0)
+        {
+            return AlreadyRead;
+        }
 
-            CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
+        CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
+        DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
+        if (DataRunOffset != -1)
+        {
+            /* Normal data run. */
+            DataRunStartLCN = LastLCN + DataRunOffset;
+            LastLCN = DataRunStartLCN;
+        }
+        else
+        {
+            /* Sparse data run. */
+            DataRunStartLCN = -1;
         }
     }
 
@@ -334,16 +343,265 @@ ReadAttribute(PDEVICE_EXTENSION Vcb,
 }
 
 
+VOID
+NtfsInitializeFileRecordCache(PDEVICE_EXTENSION Vcb)
+{
+    ExInitializeFastMutex(&Vcb->FileRecordCacheLock);
+    InitializeListHead(&Vcb->FileRecordCacheListHead);
+    Vcb->FileRecordCacheCount = 0;
+}
+
+
+static
+BOOLEAN
+NtfsLookupFileRecordCache(PDEVICE_EXTENSION Vcb,
+                          ULONGLONG index,
+                          PFILE_RECORD_HEADER file)
+{
+    PLIST_ENTRY ListEntry;
+    PNTFS_FILE_RECORD_CACHE_ENTRY Entry;
+
+    ExAcquireFastMutex(&Vcb->FileRecordCacheLock);
+
+    for (ListEntry = Vcb->FileRecordCacheListHead.Flink;
+         ListEntry != &Vcb->FileRecordCacheListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        Entry = CONTAINING_RECORD(ListEntry, NTFS_FILE_RECORD_CACHE_ENTRY, ListEntry);
+        if (Entry->MFTIndex == index)
+        {
+            /* Move it to the front */
+            RemoveEntryList(&Entry->ListEntry);
+            InsertHeadList(&Vcb->FileRecordCacheListHead, &Entry->ListEntry);
+            RtlCopyMemory(file, &Entry->Record, Vcb->NtfsInfo.BytesPerFileRecord);
+            ExReleaseFastMutex(&Vcb->FileRecordCacheLock);
+            return TRUE;
+        }
+    }
+
+    ExReleaseFastMutex(&Vcb->FileRecordCacheLock);
+    return FALSE;
+}
+
+
+static
+VOID
+NtfsInsertFileRecordCache(PDEVICE_EXTENSION Vcb,
+                          ULONGLONG index,
+                          PFILE_RECORD_HEADER file)
+{
+    PLIST_ENTRY ListEntry;
+    PNTFS_FILE_RECORD_CACHE_ENTRY Entry;
+
+    ExAcquireFastMutex(&Vcb->FileRecordCacheLock);
+
+    /* Someone may have raced us reading the same record */
+    for (ListEntry = Vcb->FileRecordCacheListHead.Flink;
+         ListEntry != &Vcb->FileRecordCacheListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        Entry = CONTAINING_RECORD(ListEntry, NTFS_FILE_RECORD_CACHE_ENTRY, ListEntry);
+        if (Entry->MFTIndex == index)
+        {
+            ExReleaseFastMutex(&Vcb->FileRecordCacheLock);
+            return;
+        }
+    }
+
+    if (Vcb->FileRecordCacheCount < NTFS_FILE_RECORD_CACHE_SIZE)
+    {
+        Entry = ExAllocatePoolWithTag(PagedPool,
+                                      FIELD_OFFSET(NTFS_FILE_RECORD_CACHE_ENTRY, Record) + Vcb->NtfsInfo.BytesPerFileRecord,
+                                      TAG_NTFS);
+        if (Entry == NULL)
+        {
+            ExReleaseFastMutex(&Vcb->FileRecordCacheLock);
+            return;
+        }
+        Vcb->FileRecordCacheCount++;
+    }
+    else
+    {
+        /* Recycle the least recently used record */
+        ListEntry = RemoveTailList(&Vcb->FileRecordCacheListHead);
+        Entry = CONTAINING_RECORD(ListEntry, NTFS_FILE_RECORD_CACHE_ENTRY, ListEntry);
+    }
+
+    Entry->MFTIndex = index;
+    RtlCopyMemory(&Entry->Record, file, Vcb->NtfsInfo.BytesPerFileRecord);
+    InsertHeadList(&Vcb->FileRecordCacheListHead, &Entry->ListEntry);
+
+    ExReleaseFastMutex(&Vcb->FileRecordCacheLock);
+}
+
+
+/*
+ * Must be called by anything that modifies a file record on disk.
+ */
+VOID
+NtfsInvalidateFileRecord(PDEVICE_EXTENSION Vcb,
+                         ULONGLONG index)
+{
+    PLIST_ENTRY ListEntry;
+    PNTFS_FILE_RECORD_CACHE_ENTRY Entry;
+
+    ExAcquireFastMutex(&Vcb->FileRecordCacheLock);
+
+    for (ListEntry = Vcb->FileRecordCacheListHead.Flink;
+         ListEntry != &Vcb->FileRecordCacheListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        Entry = CONTAINING_RECORD(ListEntry, NTFS_FILE_RECORD_CACHE_ENTRY, ListEntry);
+        if (Entry->MFTIndex == index)
+        {
+            RemoveEntryList(&Entry->ListEntry);
+            ExFreePoolWithTag(Entry, TAG_NTFS);
+            Vcb->FileRecordCacheCount--;
+            break;
+        }
+    }
+
+    ExReleaseFastMutex(&Vcb->FileRecordCacheLock);
+}
+
+
+VOID
+NtfsFlushFileRecordCache(PDEVICE_EXTENSION Vcb)
+{
+    PLIST_ENTRY ListEntry;
+    PNTFS_FILE_RECORD_CACHE_ENTRY Entry;
+
+    ExAcquireFastMutex(&Vcb->FileRecordCacheLock);
+
+    while (!IsListEmpty(&Vcb->FileRecordCacheListHead))
+    {
+        ListEntry = RemoveHeadList(&Vcb->FileRecordCacheListHead);
+        Entry = CONTAINING_RECORD(ListEntry, NTFS_FILE_RECORD_CACHE_ENTRY, ListEntry);
+        ExFreePoolWithTag(Entry, TAG_NTFS);
+    }
+    Vcb->FileRecordCacheCount = 0;
+
+    ExReleaseFastMutex(&Vcb->FileRecordCacheLock);
+}
+
+
+/*
+ * Create a stream file object for the $MFT data, so that file records
+ * are read through the cache manager. Paging reads on it are served
+ * by NtfsRead straight from Vcb->MFTContext.
+ */
+NTSTATUS
+NtfsCreateMftStream(PDEVICE_EXTENSION Vcb)
+{
+    PFILE_OBJECT FileObject;
+    PNTFS_FCB Fcb;
+    PNTFS_CCB Ccb;
+
+    Fcb = NtfsCreateFCB(NULL, NULL, Vcb);
+    if (Fcb == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Ccb = ExAllocatePoolWithTag(NonPagedPool, sizeof(NTFS_CCB), TAG_CCB);
+    if (Ccb == NULL)
+    {
+        NtfsDestroyFCB(Fcb);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(Ccb, sizeof(NTFS_CCB));
+
+    Ccb->Identifier.Type = NTFS_TYPE_CCB;
+    Ccb->Identifier.Size = sizeof(NTFS_TYPE_CCB);
+
+    Fcb->Flags = FCB_IS_MFT_STREAM;
+    Fcb->MFTIndex = NTFS_FILE_MFT;
+    Fcb->RFCB.FileSize.QuadPart = Vcb->MFTContext->Record.NonResident.DataSize;
+    Fcb->RFCB.ValidDataLength.QuadPart = Vcb->MFTContext->Record.NonResident.InitializedSize;
+    Fcb->RFCB.AllocationSize.QuadPart = Vcb->MFTContext->Record.NonResident.AllocatedSize;
+
+    FileObject = IoCreateStreamFileObject(NULL, Vcb->StorageDevice);
+    FileObject->FsContext = Fcb;
+    FileObject->FsContext2 = Ccb;
+    FileObject->SectionObjectPointer = &Fcb->SectionObjectPointers;
+    FileObject->PrivateCacheMap = NULL;
+    FileObject->Vpb = Vcb->Vpb;
+    Ccb->PtrFileObject = FileObject;
+    Fcb->FileObject = FileObject;
+
+    _SEH2_TRY
+    {
+        CcInitializeCacheMap(FileObject,
+                             (PCC_FILE_SIZES)(&Fcb->RFCB.AllocationSize),
+                             TRUE,
+                             &(NtfsGlobalData->CacheMgrCallbacks),
+                             Fcb);
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        FileObject->FsContext2 = NULL;
+        ExFreePoolWithTag(Ccb, TAG_CCB);
+        ObDereferenceObject(FileObject);
+        NtfsDestroyFCB(Fcb);
+        return _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    Vcb->MftFileObject = FileObject;
+    return STATUS_SUCCESS;
+}
+
+
 NTSTATUS
 ReadFileRecord(PDEVICE_EXTENSION Vcb,
                ULONGLONG index,
                PFILE_RECORD_HEADER file)
 {
     ULONGLONG BytesRead;
+    LARGE_INTEGER Offset;
+    IO_STATUS_BLOCK IoStatus;
+    NTSTATUS Status;
 
     DPRINT("ReadFileRecord(%p, %I64x, %p)\n", Vcb, index, file);
 
-    BytesRead = ReadAttribute(Vcb, Vcb->MFTContext, index * Vcb->NtfsInfo.BytesPerFileRecord, (PCHAR)file, Vcb->NtfsInfo.BytesPerFileRecord);
+    if (NtfsLookupFileRecordCache(Vcb, index, file))
+    {
+        return STATUS_SUCCESS;
+    }
+
+    if (Vcb->MftFileObject != NULL)
+    {
+        Offset.QuadPart = index * Vcb->NtfsInfo.BytesPerFileRecord;
+        _SEH2_TRY
+        {
+            CcCopyRead(Vcb->MftFileObject, &Offset, Vcb->NtfsInfo.BytesPerFileRecord, TRUE, file, &IoStatus);
+            Status = IoStatus.Status;
+            BytesRead = IoStatus.Information;
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            Status = _SEH2_GetExceptionCode();
+            BytesRead = 0;
+        }
+        _SEH2_END;
+
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("ReadFileRecord failed: %lx\n", Status);
+            return Status;
+        }
+    }
+    else
+    {
+        /* Still mounting, no stream yet */
+        KeEnterCriticalRegion();
+        ExAcquireResourceExclusiveLite(&Vcb->MftContextLock, TRUE);
+        BytesRead = ReadAttribute(Vcb, Vcb->MFTContext, index * Vcb->NtfsInfo.BytesPerFileRecord, (PCHAR)file, Vcb->NtfsInfo.BytesPerFileRecord);
+        ExReleaseResourceLite(&Vcb->MftContextLock);
+        KeLeaveCriticalRegion();
+    }
+
     if (BytesRead != Vcb->NtfsInfo.BytesPerFileRecord)
     {
         DPRINT1("ReadFileRecord failed: %I64u read, %u expected\n", BytesRead, Vcb->NtfsInfo.BytesPerFileRecord);
@@ -351,7 +609,13 @@ ReadFileRecord(PDEVICE_EXTENSION Vcb,
     }
 
     /* Apply update sequence array fixups. */
-    return FixupUpdateSequenceArray(Vcb, &file->Ntfs);
+    Status = FixupUpdateSequenceArray(Vcb, &file->Ntfs);
+    if (NT_SUCCESS(Status))
+    {
+        NtfsInsertFileRecordCache(Vcb, index, file);
+    }
+
+    return Status;
 }
 
 
@@ -469,6 +733,264 @@ DumpIndexEntry(PINDEX_ENTRY_ATTRIBUTE IndexEntry)
 }
 #endif
 
+static
+WCHAR
+NtfsUpcaseChar(PDEVICE_EXTENSION Vcb,
+               WCHAR Char)
+{
+    if (Vcb->UpcaseTable != NULL && Char < Vcb->UpcaseTableSize)
+    {
+        return Vcb->UpcaseTable[Char];
+    }
+
+    return RtlUpcaseUnicodeChar(Char);
+}
+
+/*
+ * Collate a name against a $I30 index entry, the way NTFS orders them
+ * (COLLATION_FILE_NAME): case-insensitive using the volume upcase table.
+ */
+static
+LONG
+NtfsCollateFileName(PDEVICE_EXTENSION Vcb,
+                    PUNICODE_STRING FileName,
+                    PINDEX_ENTRY_ATTRIBUTE IndexEntry)
+{
+    ULONG NameLength, i;
+    WCHAR Char1, Char2;
+
+    NameLength = FileName->Length / sizeof(WCHAR);
+    for (i = 0; i < NameLength && i < IndexEntry->FileName.NameLength; i++)
+    {
+        Char1 = NtfsUpcaseChar(Vcb, FileName->Buffer[i]);
+        Char2 = NtfsUpcaseChar(Vcb, IndexEntry->FileName.Name[i]);
+        if (Char1 != Char2)
+        {
+            return (Char1 < Char2) ? -1 : 1;
+        }
+    }
+
+    if (NameLength == IndexEntry->FileName.NameLength)
+    {
+        return 0;
+    }
+
+    return (NameLength < IndexEntry->FileName.NameLength) ? -1 : 1;
+}
+
+/*
+ * Translate an offset in a non-resident attribute into a volume offset, and
+ * return how many bytes are contiguous on disk from there.
+ */
+static
+NTSTATUS
+NtfsAttributeOffsetToVolume(PDEVICE_EXTENSION Vcb,
+                            PNTFS_ATTR_CONTEXT Context,
+                            ULONGLONG Offset,
+                            PLONGLONG VolumeOffset,
+                            PULONGLONG Contiguous)
+{
+    PUCHAR DataRun;
+    LONGLONG DataRunOffset;
+    ULONGLONG DataRunLength;
+    LONGLONG LastLCN = 0;
+    ULONGLONG CurrentOffset = 0;
+
+    DataRun = (PUCHAR)&Context->Record + Context->Record.NonResident.MappingPairsOffset;
+    while (*DataRun != 0)
+    {
+        DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
+        if (DataRunOffset != -1)
+        {
+            LastLCN += DataRunOffset;
+        }
+
+        if (Offset < CurrentOffset + DataRunLength * Vcb->NtfsInfo.BytesPerCluster)
+        {
+            if (DataRunOffset == -1)
+            {
+                /* Index buffers are never sparse */
+                return STATUS_FILE_CORRUPT_ERROR;
+            }
+
+            *VolumeOffset = LastLCN * Vcb->NtfsInfo.BytesPerCluster + (Offset - CurrentOffset);
+            *Contiguous = CurrentOffset + DataRunLength * Vcb->NtfsInfo.BytesPerCluster - Offset;
+            return STATUS_SUCCESS;
+        }
+
+        CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
+    }
+
+    return STATUS_END_OF_FILE;
+}
+
+/*
+ * Read an index buffer through the volume stream, so that the cache manager
+ * keeps the buffers of hot directories around.
+ */
+static
+NTSTATUS
+NtfsReadIndexBuffer(PDEVICE_EXTENSION Vcb,
+                    PNTFS_ATTR_CONTEXT IndexAllocationCtx,
+                    ULONGLONG Vcn,
+                    ULONG IndexBlockSize,
+                    PINDEX_BUFFER IndexBuffer)
+{
+    ULONGLONG Offset, Contiguous;
+    LARGE_INTEGER VolumeOffset;
+    IO_STATUS_BLOCK IoStatus;
+    ULONG Read, ToRead;
+    NTSTATUS Status;
+
+    /* VCNs are in clusters, or in 512 bytes blocks for index buffers smaller than a cluster */
+    if (IndexBlockSize >= Vcb->NtfsInfo.BytesPerCluster)
+        Offset = Vcn * Vcb->NtfsInfo.BytesPerCluster;
+    else
+        Offset = Vcn * 512;
+
+    for (Read = 0; Read < IndexBlockSize; Read += ToRead)
+    {
+        Status = NtfsAttributeOffsetToVolume(Vcb, IndexAllocationCtx, Offset + Read, &VolumeOffset.QuadPart, &Contiguous);
+        if (!NT_SUCCESS(Status))
+        {
+            return Status;
+        }
+
+        ToRead = (ULONG)min(Contiguous, IndexBlockSize - Read);
+
+        _SEH2_TRY
+        {
+            CcCopyRead(Vcb->StreamFileObject, &VolumeOffset, ToRead, TRUE, (PCHAR)IndexBuffer + Read, &IoStatus);
+            Status = IoStatus.Status;
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            Status = _SEH2_GetExceptionCode();
+        }
+        _SEH2_END;
+
+        if (!NT_SUCCESS(Status))
+        {
+            return Status;
+        }
+    }
+
+    Status = FixupUpdateSequenceArray(Vcb, &IndexBuffer->Ntfs);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    if (IndexBuffer->Ntfs.Type != NRH_INDX_TYPE ||
+        IndexBuffer->Header.AllocatedSize + FIELD_OFFSET(INDEX_BUFFER, Header) != IndexBlockSize ||
+        IndexBuffer->Header.TotalSizeOfEntries > IndexBuffer->Header.AllocatedSize)
+    {
+        DPRINT1("Invalid index buffer at VCN %I64u\n", Vcn);
+        return STATUS_FILE_CORRUPT_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+#define NTFS_INDEX_MAX_DEPTH 32
+
+/*
+ * Descend the $I30 B+tree from the given node, looking for an exact name.
+ * Only the index buffers on the search path are read.
+ */
+static
+NTSTATUS
+NtfsLookupIndexNode(PDEVICE_EXTENSION Vcb,
+                    PNTFS_ATTR_CONTEXT IndexAllocationCtx,
+                    ULONG IndexBlockSize,
+                    PINDEX_ENTRY_ATTRIBUTE FirstEntry,
+                    PINDEX_ENTRY_ATTRIBUTE LastEntry,
+                    PUNICODE_STRING FileName,
+                    ULONG Depth,
+                    ULONGLONG *OutMFTIndex)
+{
+    NTSTATUS Status;
+    LONG Comparison;
+    ULONGLONG Vcn;
+    PINDEX_ENTRY_ATTRIBUTE IndexEntry;
+    PINDEX_BUFFER IndexBuffer;
+
+    IndexEntry = FirstEntry;
+    while (IndexEntry < LastEntry && IndexEntry->Length >= FIELD_OFFSET(INDEX_ENTRY_ATTRIBUTE, FileName))
+    {
+        if (IndexEntry->Flags & NTFS_INDEX_ENTRY_END)
+        {
+            /* Anything sorts before the end entry */
+            Comparison = -1;
+        }
+        else
+        {
+            Comparison = NtfsCollateFileName(Vcb, FileName, IndexEntry);
+            if (Comparison == 0 &&
+                (IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK) > 0x10 &&
+                IndexEntry->FileName.NameType != NTFS_FILE_NAME_DOS &&
+                CompareFileName(FileName, IndexEntry, FALSE))
+            {
+                *OutMFTIndex = (IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK);
+                return STATUS_SUCCESS;
+            }
+        }
+
+        if (Comparison <= 0)
+        {
+            /*
+             * The name can only be in the subnode on the left. If this entry
+             * collates equal but didn't match (DOS name, POSIX case), other
+             * spellings may be both on the left and further right.
+             */
+            if (IndexEntry->Flags & NTFS_INDEX_ENTRY_NODE)
+            {
+                if (IndexAllocationCtx == NULL || Depth >= NTFS_INDEX_MAX_DEPTH)
+                {
+                    DPRINT1("Corrupted index!\n");
+                    return STATUS_FILE_CORRUPT_ERROR;
+                }
+
+                IndexBuffer = ExAllocatePoolWithTag(NonPagedPool, IndexBlockSize, TAG_NTFS);
+                if (IndexBuffer == NULL)
+                {
+                    return STATUS_INSUFFICIENT_RESOURCES;
+                }
+
+                Vcn = *(PULONGLONG)((PCHAR)IndexEntry + IndexEntry->Length - sizeof(ULONGLONG));
+                Status = NtfsReadIndexBuffer(Vcb, IndexAllocationCtx, Vcn, IndexBlockSize, IndexBuffer);
+                if (NT_SUCCESS(Status))
+                {
+                    Status = NtfsLookupIndexNode(Vcb,
+                                                 IndexAllocationCtx,
+                                                 IndexBlockSize,
+                                                 (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)&IndexBuffer->Header + IndexBuffer->Header.FirstEntryOffset),
+                                                 (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)&IndexBuffer->Header + IndexBuffer->Header.TotalSizeOfEntries),
+                                                 FileName,
+                                                 Depth + 1,
+                                                 OutMFTIndex);
+                }
+
+                ExFreePoolWithTag(IndexBuffer, TAG_NTFS);
+
+                if (Status != STATUS_OBJECT_PATH_NOT_FOUND)
+                {
+                    return Status;
+                }
+            }
+
+            if (Comparison < 0)
+            {
+                return STATUS_OBJECT_PATH_NOT_FOUND;
+            }
+        }
+
+        IndexEntry = (PINDEX_ENTRY_ATTRIBUTE)((PCHAR)IndexEntry + IndexEntry->Length);
+    }
+
+    return STATUS_OBJECT_PATH_NOT_FOUND;
+}
+
 NTSTATUS
 BrowseIndexEntries(PDEVICE_EXTENSION Vcb,
                    PFILE_RECORD_HEADER MftRecord,
@@ -568,6 +1090,7 @@ NtfsFindMftRecord(PDEVICE_EXTENSION Vcb,
 {
     PFILE_RECORD_HEADER MftRecord;
     PNTFS_ATTR_CONTEXT IndexRootCtx;
+    PNTFS_ATTR_CONTEXT IndexAllocationCtx;
     PINDEX_ROOT_ATTRIBUTE IndexRoot;
     PCHAR IndexRecord;
     PINDEX_ENTRY_ATTRIBUTE IndexEntry, IndexEntryEnd;
@@ -616,7 +1139,26 @@ NtfsFindMftRecord(PDEVICE_EXTENSION Vcb,
 
     DPRINT("IndexRecordSize: %x IndexBlockSize: %x\n", Vcb->NtfsInfo.BytesPerIndexRecord, IndexRoot->SizeOfEntry);
 
-    Status = BrowseIndexEntries(Vcb, MftRecord, IndexRecord, IndexRoot->SizeOfEntry, IndexEntry, IndexEntryEnd, FileName, FirstEntry, &CurrentEntry, DirSearch, OutMFTIndex);
+    if (!DirSearch)
+    {
+        /* Exact name: descend the B+tree instead of walking all the entries */
+        if (!NT_SUCCESS(FindAttribute(Vcb, MftRecord, AttributeIndexAllocation, L"$I30", 4, &IndexAllocationCtx)))
+        {
+            /* Small directory, everything fits in the root */
+            IndexAllocationCtx = NULL;
+        }
+
+        Status = NtfsLookupIndexNode(Vcb, IndexAllocationCtx, IndexRoot->SizeOfEntry, IndexEntry, IndexEntryEnd, FileName, 0, OutMFTIndex);
+
+        if (IndexAllocationCtx != NULL)
+        {
+            ReleaseAttributeContext(IndexAllocationCtx);
+        }
+    }
+    else
+    {
+        Status = BrowseIndexEntries(Vcb, MftRecord, IndexRecord, IndexRoot->SizeOfEntry, IndexEntry, IndexEntryEnd, FileName, FirstEntry, &CurrentEntry, DirSearch, OutMFTIndex);
+    }
 
     ExFreePoolWithTag(IndexRecord, TAG_NTFS);
     ExFreePoolWithTag(MftRecord, TAG_NTFS);
@@ -114,6 +114,18 @@ typedef struct
     struct _FILE_RECORD_HEADER* MasterFileTable;
     struct _FCB *VolumeFcb;
 
+    PFILE_OBJECT MftFileObject;
+    /* Serializes the use of MFTContext. Not a fast mutex, reads under it
+     * wait for the disk and need the I/O completion APC */
+    ERESOURCE MftContextLock;
+
+    PWCHAR UpcaseTable;
+    ULONG UpcaseTableSize;
+
+    FAST_MUTEX FileRecordCacheLock;
+    LIST_ENTRY FileRecordCacheListHead;
+    ULONG FileRecordCacheCount;
+
     NTFS_INFO NtfsInfo;
 
     ULONG Flags;
@@ -439,6 +451,7 @@ typedef struct _NTFS_ATTR_CONTEXT
 #define FCB_CACHE_INITIALIZED   0x0001
 #define FCB_IS_VOLUME_STREAM    0x0002
 #define FCB_IS_VOLUME           0x0004
+#define FCB_IS_MFT_STREAM       0x0008
 #define MAX_PATH                260
 
 typedef struct _FCB
@@ -474,6 +487,16 @@ typedef struct _FCB
 
 } NTFS_FCB, *PNTFS_FCB;
 
+/* Decoded (fixed up) file records, most recently used first */
+typedef struct _NTFS_FILE_RECORD_CACHE_ENTRY
+{
+    LIST_ENTRY ListEntry;
+    ULONGLONG MFTIndex;
+    FILE_RECORD_HEADER Record;
+} NTFS_FILE_RECORD_CACHE_ENTRY, *PNTFS_FILE_RECORD_CACHE_ENTRY;
+
+#define NTFS_FILE_RECORD_CACHE_SIZE 64
+
 typedef struct _FIND_ATTR_CONTXT
 {
     PDEVICE_EXTENSION Vcb;
@@ -723,6 +746,9 @@ NtfsQueryInformation(PNTFS_IRP_CONTEXT IrpContext);
 
 /* fsctl.c */
 
+VOID
+NtfsCleanupVcb(PNTFS_VCB Vcb);
+
 NTSTATUS
 NtfsFileSystemControl(PNTFS_IRP_CONTEXT IrpContext);
 
@@ -752,6 +778,19 @@ ReadFileRecord(PDEVICE_EXTENSION Vcb,
                ULONGLONG index,
                PFILE_RECORD_HEADER file);
 
+VOID
+NtfsInitializeFileRecordCache(PDEVICE_EXTENSION Vcb);
+
+VOID
+NtfsInvalidateFileRecord(PDEVICE_EXTENSION Vcb,
+                         ULONGLONG index);
+
+VOID
+NtfsFlushFileRecordCache(PDEVICE_EXTENSION Vcb);
+
+NTSTATUS
+NtfsCreateMftStream(PDEVICE_EXTENSION Vcb);
+
 NTSTATUS
 FindAttribute(PDEVICE_EXTENSION Vcb,
               PFILE_RECORD_HEADER MftRecord,
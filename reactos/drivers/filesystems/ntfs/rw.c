@@ -34,6 +34,58 @@
 
 /* FUNCTIONS ****************************************************************/
 
+/*
+ * FUNCTION: Reads data from the $MFT stream, on behalf of the cache manager
+ */
+static
+NTSTATUS
+NtfsReadMftStream(PDEVICE_EXTENSION DeviceExt,
+                  PUCHAR Buffer,
+                  ULONG Length,
+                  ULONGLONG ReadOffset,
+                  PULONG LengthRead)
+{
+    ULONGLONG StreamSize;
+    ULONG ToRead;
+    ULONG RealLengthRead;
+
+    DPRINT("NtfsReadMftStream(%p, %p, %u, %I64u, %p)\n", DeviceExt, Buffer, Length, ReadOffset, LengthRead);
+
+    *LengthRead = 0;
+
+    StreamSize = AttributeDataLength(&DeviceExt->MFTContext->Record);
+    if (ReadOffset >= StreamSize)
+    {
+        return STATUS_END_OF_FILE;
+    }
+
+    ToRead = Length;
+    if (ReadOffset + Length > StreamSize)
+        ToRead = (ULONG)(StreamSize - ReadOffset);
+
+    /* The MFT context and its run cache are shared by the whole volume */
+    KeEnterCriticalRegion();
+    ExAcquireResourceExclusiveLite(&DeviceExt->MftContextLock, TRUE);
+    RealLengthRead = ReadAttribute(DeviceExt, DeviceExt->MFTContext, ReadOffset, (PCHAR)Buffer, ToRead);
+    ExReleaseResourceLite(&DeviceExt->MftContextLock);
+    KeLeaveCriticalRegion();
+
+    if (RealLengthRead != ToRead)
+    {
+        DPRINT1("MFT read failure: %lu read, %lu expected\n", RealLengthRead, ToRead);
+        return STATUS_UNEXPECTED_IO_ERROR;
+    }
+
+    if (ToRead != Length)
+    {
+        RtlZeroMemory(Buffer + ToRead, Length - ToRead);
+    }
+
+    *LengthRead = ToRead;
+    return STATUS_SUCCESS;
+}
+
+
 /*
  * FUNCTION: Reads data from a file
  */
@@ -214,6 +266,8 @@ NtfsRead(PNTFS_IRP_CONTEXT IrpContext)
     ULONG ReadLength;
     LARGE_INTEGER ReadOffset;
     ULONG ReturnedReadLength = 0;
+    LONGLONG VolumeSize;
+    ULONG ToRead;
     NTSTATUS Status = STATUS_SUCCESS;
     PIRP Irp;
     PDEVICE_OBJECT DeviceObject;
@@ -230,13 +284,54 @@ NtfsRead(PNTFS_IRP_CONTEXT IrpContext)
     ReadOffset = Stack->Parameters.Read.ByteOffset;
     Buffer = NtfsGetUserBuffer(Irp, BooleanFlagOn(Irp->Flags, IRP_PAGING_IO));
 
-    Status = NtfsReadFile(DeviceExt,
-                          FileObject,
-                          Buffer,
-                          ReadLength,
-                          ReadOffset.u.LowPart,
-                          Irp->Flags,
-                          &ReturnedReadLength);
+    if (((PNTFS_FCB)FileObject->FsContext)->Flags & FCB_IS_VOLUME_STREAM)
+    {
+        /* Raw volume access, used to cache index buffers. Paging reads
+         * come in whole pages and may run past the end of the volume */
+        VolumeSize = ((PNTFS_FCB)FileObject->FsContext)->RFCB.FileSize.QuadPart;
+        if (ReadOffset.QuadPart >= VolumeSize)
+        {
+            Status = STATUS_END_OF_FILE;
+        }
+        else
+        {
+            ToRead = ReadLength;
+            if (ReadOffset.QuadPart + ReadLength > VolumeSize)
+                ToRead = (ULONG)(VolumeSize - ReadOffset.QuadPart);
+
+            Status = NtfsReadDisk(DeviceExt->StorageDevice,
+                                  ReadOffset.QuadPart,
+                                  ToRead,
+                                  DeviceExt->NtfsInfo.BytesPerSector,
+                                  Buffer,
+                                  FALSE);
+            if (NT_SUCCESS(Status))
+            {
+                if (ToRead != ReadLength)
+                    RtlZeroMemory((PUCHAR)Buffer + ToRead, ReadLength - ToRead);
+
+                ReturnedReadLength = ToRead;
+            }
+        }
+    }
+    else if (((PNTFS_FCB)FileObject->FsContext)->Flags & FCB_IS_MFT_STREAM)
+    {
+        Status = NtfsReadMftStream(DeviceExt,
+                                   Buffer,
+                                   ReadLength,
+                                   ReadOffset.QuadPart,
+                                   &ReturnedReadLength);
+    }
+    else
+    {
+        Status = NtfsReadFile(DeviceExt,
+                              FileObject,
+                              Buffer,
+                              ReadLength,
+                              ReadOffset.u.LowPart,
+                              Irp->Flags,
+                              &ReturnedReadLength);
+    }
     if (NT_SUCCESS(Status))
     {
         if (FileObject->Flags & FO_SYNCHRONOUS_IO)
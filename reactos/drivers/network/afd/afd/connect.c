@@ -240,6 +240,12 @@ WarmSocketForConnection(PAFD_FCB FCB) {
                                           FCB->Connection.Object );
     }
 
+    /* Pass on a receive buffer size that was set before connecting.
+     * Transports that don't take one just keep their default. */
+    if( NT_SUCCESS(Status) && FCB->Recv.Size ) {
+        TdiSetReceiveWindow( FCB->Connection.Object, FCB->Recv.Size );
+    }
+
     return Status;
 }
 
@@ -299,6 +305,60 @@ MakeSocketIntoConnection(PAFD_FCB FCB) {
    return Status;
 }
 
+/* Tells a super connect that brought data apart from a plain connect */
+static BOOLEAN HasConnectData( PIRP Irp ) {
+    PIO_STACK_LOCATION IrpSp = IoGetCurrentIrpStackLocation( Irp );
+
+    return IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_SUPER_CONNECT &&
+           IrpSp->Parameters.DeviceIoControl.OutputBufferLength != 0;
+}
+
+static VOID CompleteConnect( PIRP Irp, NTSTATUS Status, ULONG_PTR Information ) {
+    PAFD_SEND_INFO SendReq;
+
+    if( HasConnectData( Irp ) ) {
+        SendReq = GetLockedData( Irp, IoGetCurrentIrpStackLocation( Irp ) );
+        UnlockBuffers( SendReq->BufferArray, SendReq->BufferCount, FALSE );
+    }
+
+    Irp->IoStatus.Status = Status;
+    Irp->IoStatus.Information = Information;
+    if( Irp->MdlAddress ) UnlockRequest( Irp, IoGetCurrentIrpStackLocation( Irp ) );
+    (void)IoSetCancelRoutine(Irp, NULL);
+    IoCompleteRequest( Irp, IO_NETWORK_INCREMENT );
+}
+
+/* The data of a super connect goes out once we are connected, so its
+ * request gives way to a send request describing that data */
+static NTSTATUS LockConnectData( PIRP Irp, PIO_STACK_LOCATION IrpSp,
+                                 KPROCESSOR_MODE LockMode ) {
+    PAFD_SEND_INFO SendReq;
+    AFD_WSABUF Buffer;
+
+    SendReq = ExAllocatePool( NonPagedPool, sizeof(*SendReq) );
+    if( !SendReq ) return STATUS_NO_MEMORY;
+
+    Buffer.buf = Irp->UserBuffer;
+    Buffer.len = IrpSp->Parameters.DeviceIoControl.OutputBufferLength;
+
+    SendReq->BufferArray = LockBuffers( &Buffer, 1,
+                                        NULL, NULL,
+                                        FALSE, FALSE, LockMode );
+    if( !SendReq->BufferArray ) {
+        ExFreePool( SendReq );
+        return STATUS_ACCESS_VIOLATION;
+    }
+
+    SendReq->BufferCount = 1;
+    SendReq->AfdFlags = AFD_OVERLAPPED;
+    SendReq->TdiFlags = 0;
+
+    ExFreePool( Irp->Tail.Overlay.DriverContext[0] );
+    Irp->Tail.Overlay.DriverContext[0] = SendReq;
+
+    return STATUS_SUCCESS;
+}
+
 static IO_COMPLETION_ROUTINE StreamSocketConnectComplete;
 static
 NTSTATUS
@@ -309,6 +369,7 @@ StreamSocketConnectComplete(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     PAFD_FCB FCB = (PAFD_FCB)Context;
     PLIST_ENTRY NextIrpEntry;
     PIRP NextIrp;
+    LIST_ENTRY ConnectDataList;
 
     AFD_DbgPrint(MID_TRACE,("Called: FCB %p, FO %p\n",
                             Context, FCB->FileObject));
@@ -329,11 +390,7 @@ StreamSocketConnectComplete(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_CONNECT] ) ) {
                NextIrpEntry = RemoveHeadList(&FCB->PendingIrpList[FUNCTION_CONNECT]);
                NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
-               NextIrp->IoStatus.Status = STATUS_FILE_CLOSED;
-               NextIrp->IoStatus.Information = 0;
-               if( NextIrp->MdlAddress ) UnlockRequest( NextIrp, IoGetCurrentIrpStackLocation( NextIrp ) );
-               (void)IoSetCancelRoutine(NextIrp, NULL);
-               IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
+               CompleteConnect( NextIrp, STATUS_FILE_CLOSED, 0 );
         }
         SocketStateUnlock( FCB );
         return STATUS_FILE_CLOSED;
@@ -347,22 +404,37 @@ StreamSocketConnectComplete(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         PollReeval( FCB->DeviceExt, FCB->FileObject );
     }
 
+    InitializeListHead( &ConnectDataList );
+
     /* Succeed pending irps on the FUNCTION_CONNECT list */
     while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_CONNECT] ) ) {
         NextIrpEntry = RemoveHeadList(&FCB->PendingIrpList[FUNCTION_CONNECT]);
         NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
+
+        /* Those with data complete once it has been sent */
+        if( NT_SUCCESS(Status) && HasConnectData( NextIrp ) ) {
+            InsertTailList( &ConnectDataList, &NextIrp->Tail.Overlay.ListEntry );
+            continue;
+        }
+
+        /* A super connect reports bytes sent, not the connection handle */
         AFD_DbgPrint(MID_TRACE,("Completing connect %p\n", NextIrp));
-        NextIrp->IoStatus.Status = Status;
-        NextIrp->IoStatus.Information = NT_SUCCESS(Status) ? ((ULONG_PTR)FCB->Connection.Handle) : 0;
-        if( NextIrp->MdlAddress ) UnlockRequest( NextIrp, IoGetCurrentIrpStackLocation( NextIrp ) );
-        (void)IoSetCancelRoutine(NextIrp, NULL);
-        IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
+        CompleteConnect( NextIrp, Status,
+                         NT_SUCCESS(Status) &&
+                         IoGetCurrentIrpStackLocation( NextIrp )->Parameters.DeviceIoControl.IoControlCode !=
+                         IOCTL_AFD_SUPER_CONNECT ? ((ULONG_PTR)FCB->Connection.Handle) : 0 );
     }
 
     if( NT_SUCCESS(Status) ) {
         Status = MakeSocketIntoConnection( FCB );
 
         if( !NT_SUCCESS(Status) ) {
+            while( !IsListEmpty( &ConnectDataList ) ) {
+                NextIrpEntry = RemoveHeadList( &ConnectDataList );
+                NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
+                CompleteConnect( NextIrp, Status, 0 );
+            }
+
             SocketStateUnlock( FCB );
             return Status;
         }
@@ -395,6 +467,13 @@ StreamSocketConnectComplete(PDEVICE_OBJECT DeviceObject, PIRP Irp,
                   FALSE );
         }
 
+        while( !IsListEmpty( &ConnectDataList ) ) {
+            NextIrpEntry = RemoveHeadList( &ConnectDataList );
+            NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
+            AFD_DbgPrint(MID_TRACE,("Sending data for connect %p\n", NextIrp));
+            SendConnectData( FCB, NextIrp );
+        }
+
         if( Status == STATUS_PENDING )
             Status = STATUS_SUCCESS;
     }
@@ -416,15 +495,26 @@ AfdStreamSocketConnect(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     PFILE_OBJECT FileObject = IrpSp->FileObject;
     PAFD_FCB FCB = FileObject->FsContext;
     PAFD_CONNECT_INFO ConnectReq;
+    KPROCESSOR_MODE LockMode;
+    BOOLEAN SuperConnect =
+        IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_SUPER_CONNECT;
     AFD_DbgPrint(MID_TRACE,("Called on %p\n", FCB));
 
     UNREFERENCED_PARAMETER(DeviceObject);
 
     if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
-    if( !(ConnectReq = LockRequest( Irp, IrpSp, FALSE, NULL )) )
+    if( !(ConnectReq = LockRequest( Irp, IrpSp, FALSE, &LockMode )) )
         return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp,
                                        0 );
 
+    /* A super connect wants a bound stream socket */
+    if( SuperConnect &&
+        ((FCB->Flags & AFD_ENDPOINT_CONNECTIONLESS) ||
+         FCB->State != SOCKET_STATE_BOUND) ) {
+        AFD_DbgPrint(MIN_TRACE,("Super connect on an unbound socket\n"));
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+    }
+
     AFD_DbgPrint(MID_TRACE,("Connect request:\n"));
 #if 0
     OskitDumpBuffer
@@ -507,6 +597,11 @@ AfdStreamSocketConnect(PDEVICE_OBJECT DeviceObject, PIRP Irp,
             FCB->ConnectCallInfo->Options = FCB->ConnectOptions;
             FCB->ConnectCallInfo->OptionsLength = FCB->ConnectOptionsSize;
 
+        if( SuperConnect && IrpSp->Parameters.DeviceIoControl.OutputBufferLength ) {
+            Status = LockConnectData( Irp, IrpSp, LockMode );
+            if( !NT_SUCCESS(Status) ) break;
+        }
+
         FCB->State = SOCKET_STATE_CONNECTING;
 
         AFD_DbgPrint(MID_TRACE,("Queueing IRP %p\n", Irp));
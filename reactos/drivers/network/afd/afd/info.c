@@ -98,6 +98,79 @@ AfdGetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
     return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
 }
 
+/* Swaps in a receive window of the given size, keeping the unread data.
+ * Only call this while no receive is in flight. */
+NTSTATUS AfdResizeRecvWindow( PAFD_FCB FCB, UINT Size ) {
+    UINT Unread = FCB->Recv.Content - FCB->Recv.BytesUsed;
+    PCHAR NewBuffer;
+
+    ASSERT(!FCB->ReceiveIrp.InFlightRequest);
+    FCB->Recv.PendingSize = 0;
+
+    /* A datagram socket only lands one datagram at a time in the window,
+     * its content counts the datagrams queued apart from it */
+    if (FCB->Flags & AFD_ENDPOINT_CONNECTIONLESS)
+    {
+        NewBuffer = ExAllocatePool(PagedPool, Size);
+        if (!NewBuffer)
+            return STATUS_NO_MEMORY;
+
+        if (FCB->Recv.Window)
+            ExFreePool(FCB->Recv.Window);
+
+        FCB->Recv.Window = NewBuffer;
+        FCB->Recv.Size = Size;
+        return STATUS_SUCCESS;
+    }
+
+    /* The transport already acknowledged what we hold, so don't drop it */
+    Size = max(Size, Unread);
+
+    NewBuffer = ExAllocatePool(PagedPool, Size);
+    if (!NewBuffer)
+        return STATUS_NO_MEMORY;
+
+    if (FCB->Recv.Window)
+    {
+        RtlCopyMemory(NewBuffer, FCB->Recv.Window + FCB->Recv.BytesUsed, Unread);
+        ExFreePool(FCB->Recv.Window);
+    }
+
+    FCB->Recv.Window = NewBuffer;
+    FCB->Recv.Size = Size;
+    FCB->Recv.Content = Unread;
+    FCB->Recv.BytesUsed = 0;
+
+    return STATUS_SUCCESS;
+}
+
+/* Swaps in a send window of the given size, keeping the buffered data.
+ * Only call this while no send is in flight. */
+NTSTATUS AfdResizeSendWindow( PAFD_FCB FCB, UINT Size ) {
+    PCHAR NewBuffer;
+
+    ASSERT(!FCB->SendIrp.InFlightRequest);
+    FCB->Send.PendingSize = 0;
+
+    /* Sends we buffered were already completed to the caller */
+    Size = max(Size, FCB->Send.BytesUsed);
+
+    NewBuffer = ExAllocatePool(PagedPool, Size);
+    if (!NewBuffer)
+        return STATUS_NO_MEMORY;
+
+    if (FCB->Send.Window)
+    {
+        RtlCopyMemory(NewBuffer, FCB->Send.Window, FCB->Send.BytesUsed);
+        ExFreePool(FCB->Send.Window);
+    }
+
+    FCB->Send.Window = NewBuffer;
+    FCB->Send.Size = Size;
+
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS NTAPI
 AfdSetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
             PIO_STACK_LOCATION IrpSp ) {
@@ -105,7 +178,6 @@ AfdSetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
     PAFD_INFO InfoReq = LockRequest(Irp, IrpSp, FALSE, NULL);
     PFILE_OBJECT FileObject = IrpSp->FileObject;
     PAFD_FCB FCB = FileObject->FsContext;
-    PCHAR NewBuffer;
 
     UNREFERENCED_PARAMETER(DeviceObject);
 
@@ -124,56 +196,33 @@ AfdSetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
                 FCB->OobInline = InfoReq->Information.Boolean;
                 break;
             case AFD_INFO_RECEIVE_WINDOW_SIZE:
-                NewBuffer = ExAllocatePool(PagedPool, InfoReq->Information.Ulong);
-                if (NewBuffer)
+                if (FCB->ReceiveIrp.InFlightRequest)
                 {
-                    if (FCB->Recv.Content > InfoReq->Information.Ulong)
-                        FCB->Recv.Content = InfoReq->Information.Ulong;
-
-                    if (FCB->Recv.Window)
-                    {
-                        RtlCopyMemory(NewBuffer,
-                                      FCB->Recv.Window,
-                                      FCB->Recv.Content);
-
-                        ExFreePool(FCB->Recv.Window);
-                    }
-
-                    FCB->Recv.Size = InfoReq->Information.Ulong;
-                    FCB->Recv.Window = NewBuffer;
-
-                    Status = STATUS_SUCCESS;
+                    /* The transport is filling our buffer, the receive
+                     * completion swaps it once it gets it back */
+                    FCB->Recv.PendingSize = InfoReq->Information.Ulong;
                 }
                 else
                 {
-                    Status = STATUS_NO_MEMORY;
+                    Status = AfdResizeRecvWindow(FCB, InfoReq->Information.Ulong);
+                    if (!NT_SUCCESS(Status))
+                        break;
                 }
+
+                /* Have the transport advertise a matching window */
+                if (FCB->Connection.Object)
+                    TdiSetReceiveWindow(FCB->Connection.Object, InfoReq->Information.Ulong);
                 break;
             case AFD_INFO_SEND_WINDOW_SIZE:
-                NewBuffer = ExAllocatePool(PagedPool, InfoReq->Information.Ulong);
-                if (NewBuffer)
-                {
-                    if (FCB->Send.BytesUsed > InfoReq->Information.Ulong)
-                        FCB->Send.BytesUsed = InfoReq->Information.Ulong;
-
-                    if (FCB->Send.Window)
-                    {
-                        RtlCopyMemory(NewBuffer,
-                                      FCB->Send.Window,
-                                      FCB->Send.BytesUsed);
-
-                        ExFreePool(FCB->Send.Window);
-                    }
-
-                    FCB->Send.Size = InfoReq->Information.Ulong;
-                    FCB->Send.Window = NewBuffer;
-
-                    Status = STATUS_SUCCESS;
-                }
-                else
+                if (FCB->SendIrp.InFlightRequest)
                 {
-                    Status = STATUS_NO_MEMORY;
+                    /* The transport is sending from our buffer, the next
+                     * send swaps it */
+                    FCB->Send.PendingSize = InfoReq->Information.Ulong;
+                    break;
                 }
+
+                Status = AfdResizeSendWindow(FCB, InfoReq->Information.Ulong);
                 break;
             default:
                 AFD_DbgPrint(MIN_TRACE,("Unknown request %u\n", InfoReq->InformationClass));
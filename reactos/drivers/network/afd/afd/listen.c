@@ -10,21 +10,10 @@
 
 #include "afd.h"
 
-static NTSTATUS SatisfyAccept( PAFD_DEVICE_EXTENSION DeviceExt,
-                               PIRP Irp,
-                               PFILE_OBJECT NewFileObject,
-                               PAFD_TDI_OBJECT_QELT Qelt ) {
-    PAFD_FCB FCB = NewFileObject->FsContext;
+/* Transfer the connection to the new socket, launch the opening read */
+static NTSTATUS AcceptConnection( PAFD_FCB FCB, PAFD_TDI_OBJECT_QELT Qelt ) {
     NTSTATUS Status;
 
-    UNREFERENCED_PARAMETER(DeviceExt);
-
-    if( !SocketAcquireStateLock( FCB ) )
-        return LostSocket( Irp );
-
-    /* Transfer the connection to the new socket, launch the opening read */
-    AFD_DbgPrint(MID_TRACE,("Completing a real accept (FCB %p)\n", FCB));
-
     FCB->Connection = Qelt->Object;
 
     if( FCB->RemoteAddress ) ExFreePool( FCB->RemoteAddress );
@@ -42,9 +31,170 @@ static NTSTATUS SatisfyAccept( PAFD_DEVICE_EXTENSION DeviceExt,
     if (NT_SUCCESS(Status))
         Status = TdiBuildConnectionInfo(&FCB->ConnectReturnInfo, FCB->RemoteAddress);
 
+    return Status;
+}
+
+static NTSTATUS SatisfyAccept( PAFD_DEVICE_EXTENSION DeviceExt,
+                               PIRP Irp,
+                               PFILE_OBJECT NewFileObject,
+                               PAFD_TDI_OBJECT_QELT Qelt ) {
+    PAFD_FCB FCB = NewFileObject->FsContext;
+    NTSTATUS Status;
+
+    UNREFERENCED_PARAMETER(DeviceExt);
+
+    if( !SocketAcquireStateLock( FCB ) )
+        return LostSocket( Irp );
+
+    AFD_DbgPrint(MID_TRACE,("Completing a real accept (FCB %p)\n", FCB));
+
+    Status = AcceptConnection( FCB, Qelt );
+
     return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
 }
 
+/* A wildcard listen doesn't say which address the peer reached, so ask
+ * the transport about the new connection */
+static PTRANSPORT_ADDRESS QueryAcceptAddress( PAFD_FCB FCB,
+                                              PTRANSPORT_ADDRESS ListenAddress ) {
+    UINT Length = FIELD_OFFSET(TDI_ADDRESS_INFO, Address) +
+        TaLengthOfTransportAddress( ListenAddress );
+    PTDI_ADDRESS_INFO AddressInfo;
+    PTRANSPORT_ADDRESS Address = NULL;
+    NTSTATUS Status = STATUS_SUCCESS;
+    PMDL Mdl;
+
+    AddressInfo = ExAllocatePool( NonPagedPool, Length );
+    if( !AddressInfo ) return NULL;
+
+    Mdl = IoAllocateMdl( AddressInfo, Length, FALSE, FALSE, NULL );
+    if( !Mdl ) {
+        ExFreePool( AddressInfo );
+        return NULL;
+    }
+
+    _SEH2_TRY {
+        MmProbeAndLockPages( Mdl, KernelMode, IoModifyAccess );
+    } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+        Status = _SEH2_GetExceptionCode();
+    } _SEH2_END;
+
+    if( !NT_SUCCESS(Status) ) {
+        IoFreeMdl( Mdl );
+        ExFreePool( AddressInfo );
+        return NULL;
+    }
+
+    /* The query irp takes the mdl with it */
+    Status = TdiQueryInformation( FCB->Connection.Object,
+                                  TDI_QUERY_ADDRESS_INFO,
+                                  Mdl );
+    if( NT_SUCCESS(Status) )
+        Address = TaCopyTransportAddress( &AddressInfo->Address );
+
+    ExFreePool( AddressInfo );
+    return Address;
+}
+
+/* Writes an address area the way GetAcceptExSockaddrs reads it back */
+static VOID FillAcceptAddress( PCHAR Area, ULONG AreaLength,
+                               PTRANSPORT_ADDRESS Address ) {
+    PAFD_ACCEPT_ADDRESS AcceptAddress = (PAFD_ACCEPT_ADDRESS)Area;
+    ULONG Length = MIN( Address->Address[0].AddressLength,
+                        AreaLength - FIELD_OFFSET(AFD_ACCEPT_ADDRESS, Data) );
+
+    AcceptAddress->Length = sizeof(USHORT) + Length;
+    AcceptAddress->Family = Address->Address[0].AddressType;
+    RtlCopyMemory( AcceptAddress->Data, Address->Address[0].Address, Length );
+}
+
+static VOID CompleteSuperAccept( PIRP Irp, NTSTATUS Status ) {
+    PAFD_SUPER_ACCEPT_REQUEST AcceptReq = Irp->Tail.Overlay.DriverContext[0];
+
+    UnlockBuffers( AcceptReq->RecvInfo.BufferArray, 1, FALSE );
+    if( AcceptReq->AcceptFileObject )
+        ObDereferenceObject( AcceptReq->AcceptFileObject );
+
+    Irp->IoStatus.Status = Status;
+    Irp->IoStatus.Information = 0;
+    UnlockRequest( Irp, IoGetCurrentIrpStackLocation( Irp ) );
+    (void)IoSetCancelRoutine(Irp, NULL);
+    IoCompleteRequest( Irp, IO_NETWORK_INCREMENT );
+}
+
+/* Hand a connection to the socket named by a super accept.  If the
+ * request wants data as well it moves over to wait on that socket. */
+static VOID SatisfySuperAccept( PAFD_FCB FCB, PIRP Irp,
+                                PAFD_TDI_OBJECT_QELT Qelt ) {
+    PAFD_SUPER_ACCEPT_REQUEST AcceptReq = Irp->Tail.Overlay.DriverContext[0];
+    PFILE_OBJECT AcceptFileObject = AcceptReq->AcceptFileObject;
+    PAFD_FCB AcceptFCB = AcceptFileObject->FsContext;
+    PAFD_MAPBUF Map = (PAFD_MAPBUF)(AcceptReq->RecvInfo.BufferArray + 1);
+    PTRANSPORT_ADDRESS LocalAddress;
+    PCHAR Buffer;
+    NTSTATUS Status;
+
+    if( !SocketAcquireStateLock( AcceptFCB ) ) {
+        InsertHeadList( &FCB->PendingConnections, &Qelt->ListEntry );
+        CompleteSuperAccept( Irp, STATUS_FILE_CLOSED );
+        return;
+    }
+
+    /* The connection stays queued if the accept socket can't take it */
+    if( AcceptFCB->State != SOCKET_STATE_CREATED ||
+        (AcceptFCB->Flags & AFD_ENDPOINT_CONNECTIONLESS) ||
+        (AcceptFileObject->Flags & FO_CLEANUP_COMPLETE) ) {
+        AFD_DbgPrint(MIN_TRACE,("Accept socket %p is not usable (s%x)\n",
+                                AcceptFCB, AcceptFCB->State));
+        SocketStateUnlock( AcceptFCB );
+        InsertHeadList( &FCB->PendingConnections, &Qelt->ListEntry );
+        CompleteSuperAccept( Irp, STATUS_INVALID_PARAMETER );
+        return;
+    }
+
+    AFD_DbgPrint(MID_TRACE,("Completing a super accept (FCB %p)\n", AcceptFCB));
+
+    Status = AcceptConnection( AcceptFCB, Qelt );
+
+    ExFreePool( Qelt->ConnInfo );
+    ExFreePool( Qelt );
+
+    if( NT_SUCCESS(Status) ) {
+        LocalAddress = QueryAcceptAddress( AcceptFCB, FCB->LocalAddress );
+
+        Buffer = MmMapLockedPages( Map[0].Mdl, KernelMode );
+
+        FillAcceptAddress( Buffer + AcceptReq->ReceiveDataLength,
+                           AcceptReq->LocalAddressLength,
+                           LocalAddress ? LocalAddress : FCB->LocalAddress );
+        FillAcceptAddress( Buffer + AcceptReq->ReceiveDataLength +
+                           AcceptReq->LocalAddressLength,
+                           AcceptReq->RemoteAddressLength,
+                           AcceptFCB->RemoteAddress );
+
+        MmUnmapLockedPages( Buffer, Map[0].Mdl );
+
+        if( LocalAddress ) ExFreePool( LocalAddress );
+
+        if( AcceptReq->ReceiveDataLength ) {
+            /* Only the front of the buffer takes data.  Cleaning up the
+             * accept socket cancels the irp now, so our reference can go. */
+            AcceptReq->RecvInfo.BufferArray[0].len = AcceptReq->ReceiveDataLength;
+            AcceptReq->AcceptFileObject = NULL;
+            Irp->Tail.Overlay.DriverContext[2] = AcceptFCB;
+
+            QueueAcceptReceive( AcceptFCB, Irp );
+
+            SocketStateUnlock( AcceptFCB );
+            ObDereferenceObject( AcceptFileObject );
+            return;
+        }
+    }
+
+    SocketStateUnlock( AcceptFCB );
+    CompleteSuperAccept( Irp, Status );
+}
+
 static NTSTATUS SatisfyPreAccept( PIRP Irp, PAFD_TDI_OBJECT_QELT Qelt ) {
     PAFD_RECEIVED_ACCEPT_DATA ListenReceive =
         (PAFD_RECEIVED_ACCEPT_DATA)Irp->AssociatedIrp.SystemBuffer;
@@ -112,6 +262,12 @@ static NTSTATUS NTAPI ListenComplete( PDEVICE_OBJECT DeviceObject,
            IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
         }
 
+        while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_ACCEPT] ) ) {
+           NextIrpEntry = RemoveHeadList(&FCB->PendingIrpList[FUNCTION_ACCEPT]);
+           NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
+           CompleteSuperAccept( NextIrp, STATUS_FILE_CLOSED );
+        }
+
         /* Free ConnectionReturnInfo and ConnectionCallInfo */
         if (FCB->ListenIrp.ConnectionReturnInfo)
         {
@@ -161,6 +317,21 @@ static NTSTATUS NTAPI ListenComplete( PDEVICE_OBJECT DeviceObject,
         }
     }
 
+    /* A super accept takes the connection before anyone gets to see it */
+    while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_ACCEPT] ) &&
+           !IsListEmpty( &FCB->PendingConnections ) ) {
+        PLIST_ENTRY PendingIrp  =
+            RemoveHeadList( &FCB->PendingIrpList[FUNCTION_ACCEPT] );
+        PLIST_ENTRY PendingConn =
+            RemoveHeadList( &FCB->PendingConnections );
+        SatisfySuperAccept
+            ( FCB,
+              CONTAINING_RECORD( PendingIrp, IRP,
+                                 Tail.Overlay.ListEntry ),
+              CONTAINING_RECORD( PendingConn, AFD_TDI_OBJECT_QELT,
+                                 ListEntry ) );
+    }
+
     /* Satisfy a pre-accept request if one is available */
     if( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_PREACCEPT] ) &&
         !IsListEmpty( &FCB->PendingConnections ) ) {
@@ -336,6 +507,7 @@ NTSTATUS AfdAccept( PDEVICE_OBJECT DeviceObject, PIRP Irp,
     if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
 
     FCB->EventSelectDisabled &= ~AFD_EVENT_ACCEPT;
+    NotifyRearm( FCB, AFD_EVENT_ACCEPT );
 
     for( PendingConn = FCB->PendingConnections.Flink;
          PendingConn != &FCB->PendingConnections;
@@ -391,3 +563,128 @@ NTSTATUS AfdAccept( PDEVICE_OBJECT DeviceObject, PIRP Irp,
 
     return UnlockAndMaybeComplete( FCB, STATUS_UNSUCCESSFUL, Irp, 0 );
 }
+
+NTSTATUS AfdSuperAccept( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+                         PIO_STACK_LOCATION IrpSp ) {
+    NTSTATUS Status;
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PAFD_FCB FCB = FileObject->FsContext;
+    ULONG OutputLength = IrpSp->Parameters.DeviceIoControl.OutputBufferLength;
+    PAFD_SUPER_ACCEPT_INFO AcceptInfo;
+    PAFD_SUPER_ACCEPT_REQUEST AcceptReq;
+    PFILE_OBJECT AcceptFileObject;
+    KPROCESSOR_MODE LockMode;
+    AFD_WSABUF Buffer;
+    PLIST_ENTRY PendingConn;
+    ULONG AddressLength;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    AFD_DbgPrint(MID_TRACE,("Called on %p\n", FCB));
+
+    if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
+
+    if( IrpSp->Parameters.DeviceIoControl.InputBufferLength < sizeof(*AcceptInfo) )
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+
+    if( !(AcceptInfo = LockRequest( Irp, IrpSp, FALSE, &LockMode )) )
+        return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp, 0 );
+
+    if( FCB->State != SOCKET_STATE_LISTENING || !Irp->UserBuffer ) {
+        AFD_DbgPrint(MIN_TRACE,("Super accept on a socket that isn't listening\n"));
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+    }
+
+    /* Data first, then room for an address of our kind on either end */
+    AddressLength = FIELD_OFFSET(AFD_ACCEPT_ADDRESS, Data) +
+        FCB->LocalAddress->Address[0].AddressLength;
+
+    if( AcceptInfo->LocalAddressLength < AddressLength ||
+        AcceptInfo->RemoteAddressLength < AddressLength ||
+        AcceptInfo->ReceiveDataLength > OutputLength ||
+        AcceptInfo->LocalAddressLength >
+            OutputLength - AcceptInfo->ReceiveDataLength ||
+        AcceptInfo->RemoteAddressLength >
+            OutputLength - AcceptInfo->ReceiveDataLength -
+            AcceptInfo->LocalAddressLength ) {
+        AFD_DbgPrint(MIN_TRACE,("Super accept buffer too small\n"));
+        return UnlockAndMaybeComplete( FCB, STATUS_BUFFER_TOO_SMALL, Irp, 0 );
+    }
+
+    Status = ObReferenceObjectByHandle
+        ( AcceptInfo->AcceptHandle,
+          FILE_ALL_ACCESS,
+          *IoFileObjectType,
+          Irp->RequestorMode,
+          (PVOID *)&AcceptFileObject,
+          NULL );
+
+    if( !NT_SUCCESS(Status) ) return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+
+    if( AcceptFileObject == FileObject ||
+        AcceptFileObject->DeviceObject != FileObject->DeviceObject ||
+        !AcceptFileObject->FsContext ) {
+        AFD_DbgPrint(MIN_TRACE,("Accept handle is not another socket\n"));
+        ObDereferenceObject( AcceptFileObject );
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_HANDLE, Irp, 0 );
+    }
+
+    AcceptReq = ExAllocatePool( NonPagedPool, sizeof(*AcceptReq) );
+    if( !AcceptReq ) {
+        ObDereferenceObject( AcceptFileObject );
+        return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp, 0 );
+    }
+
+    Buffer.buf = Irp->UserBuffer;
+    Buffer.len = OutputLength;
+
+    AcceptReq->RecvInfo.BufferArray = LockBuffers( &Buffer, 1,
+                                                   NULL, NULL,
+                                                   TRUE, FALSE, LockMode );
+    if( !AcceptReq->RecvInfo.BufferArray ) {
+        ExFreePool( AcceptReq );
+        ObDereferenceObject( AcceptFileObject );
+        return UnlockAndMaybeComplete( FCB, STATUS_ACCESS_VIOLATION, Irp, 0 );
+    }
+
+    AcceptReq->RecvInfo.BufferCount = 1;
+    AcceptReq->RecvInfo.AfdFlags = AFD_OVERLAPPED;
+    AcceptReq->RecvInfo.TdiFlags = TDI_RECEIVE_NORMAL;
+    AcceptReq->AcceptFileObject = AcceptFileObject;
+    AcceptReq->ReceiveDataLength = AcceptInfo->ReceiveDataLength;
+    AcceptReq->LocalAddressLength = AcceptInfo->LocalAddressLength;
+    AcceptReq->RemoteAddressLength = AcceptInfo->RemoteAddressLength;
+
+    /* From here on the request is what we keep for the irp */
+    ExFreePool( Irp->Tail.Overlay.DriverContext[0] );
+    Irp->Tail.Overlay.DriverContext[0] = AcceptReq;
+    Irp->Tail.Overlay.DriverContext[2] = NULL;
+
+    FCB->EventSelectDisabled &= ~AFD_EVENT_ACCEPT;
+    NotifyRearm( FCB, AFD_EVENT_ACCEPT );
+
+    Status = QueueUserModeIrp( FCB, Irp, FUNCTION_ACCEPT );
+
+    if( Status == STATUS_PENDING &&
+        !IsListEmpty( &FCB->PendingConnections ) ) {
+        /* We have a pending connection ... hand it over right away */
+        RemoveEntryList( &Irp->Tail.Overlay.ListEntry );
+        PendingConn = RemoveHeadList( &FCB->PendingConnections );
+
+        SatisfySuperAccept
+            ( FCB, Irp,
+              CONTAINING_RECORD( PendingConn, AFD_TDI_OBJECT_QELT, ListEntry ) );
+
+        if( !IsListEmpty( &FCB->PendingConnections ) )
+        {
+            FCB->PollState |= AFD_EVENT_ACCEPT;
+            FCB->PollStatus[FD_ACCEPT_BIT] = STATUS_SUCCESS;
+            PollReeval( FCB->DeviceExt, FCB->FileObject );
+        } else
+            FCB->PollState &= ~AFD_EVENT_ACCEPT;
+    }
+
+    SocketStateUnlock( FCB );
+
+    return Status;
+}
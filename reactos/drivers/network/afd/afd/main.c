@@ -429,6 +429,10 @@ AfdCleanupSocket(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     }
 
     KillSelectsForFCB( FCB->DeviceExt, FileObject, FALSE );
+    RemoveNotifyForFCB( FCB->DeviceExt, FileObject );
+
+    /* A super accept must not hand a connection to this socket anymore */
+    FileObject->Flags |= FO_CLEANUP_COMPLETE;
 
     return UnlockAndMaybeComplete(FCB, STATUS_SUCCESS, Irp, 0);
 }
@@ -443,6 +447,7 @@ AfdCloseSocket(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     PAFD_IN_FLIGHT_REQUEST InFlightRequest[IN_FLIGHT_REQUESTS];
     PAFD_TDI_OBJECT_QELT Qelt;
     PLIST_ENTRY QeltEntry;
+    PAFD_STORED_DATAGRAM DatagramRecv;
 
 
     AFD_DbgPrint(MID_TRACE,("AfdClose(DeviceObject %p Irp %p)\n",
@@ -473,7 +478,9 @@ AfdCloseSocket(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     ASSERT(IsListEmpty(&FCB->PendingIrpList[FUNCTION_SEND]));
     ASSERT(IsListEmpty(&FCB->PendingIrpList[FUNCTION_RECV]));
     ASSERT(IsListEmpty(&FCB->PendingIrpList[FUNCTION_PREACCEPT]));
+    ASSERT(IsListEmpty(&FCB->PendingIrpList[FUNCTION_ACCEPT]));
     ASSERT(IsListEmpty(&FCB->PendingIrpList[FUNCTION_DISCONNECT]));
+    ASSERT(IsListEmpty(&FCB->PendingIrpList[FUNCTION_TRANSMIT]));
 
     while (!IsListEmpty(&FCB->PendingConnections))
     {
@@ -502,6 +509,16 @@ AfdCloseSocket(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     if( FCB->Send.Window )
         ExFreePool( FCB->Send.Window );
 
+    /* Datagrams nobody received may still sit in the ring */
+    while( !IsListEmpty( &FCB->DatagramList ) ) {
+        DatagramRecv = CONTAINING_RECORD(RemoveHeadList(&FCB->DatagramList),
+                                         AFD_STORED_DATAGRAM, ListEntry);
+        FreeStoredDatagram( FCB, DatagramRecv );
+    }
+
+    if( FCB->DatagramRing )
+        ExFreePool( FCB->DatagramRing );
+
     if( FCB->AddressFrom )
         ExFreePool( FCB->AddressFrom );
 
@@ -568,6 +585,97 @@ AfdCloseSocket(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     return STATUS_SUCCESS;
 }
 
+/* Takes a disconnected socket back to where it was right after creation
+ * so a super accept or connect can use it again */
+static
+VOID
+RecycleSocket(PAFD_FCB FCB)
+{
+    AFD_DbgPrint(MID_TRACE,("Recycling FCB %p\n", FCB));
+
+    if (FCB->Connection.Object)
+    {
+        TdiDisassociateAddressFile(FCB->Connection.Object);
+        ObDereferenceObject(FCB->Connection.Object);
+        FCB->Connection.Object = NULL;
+    }
+
+    if (FCB->Connection.Handle != INVALID_HANDLE_VALUE)
+    {
+        ZwClose(FCB->Connection.Handle);
+        FCB->Connection.Handle = INVALID_HANDLE_VALUE;
+    }
+
+    if (FCB->AddressFile.Object)
+    {
+        ObDereferenceObject(FCB->AddressFile.Object);
+        FCB->AddressFile.Object = NULL;
+    }
+
+    if (FCB->AddressFile.Handle != INVALID_HANDLE_VALUE)
+    {
+        ZwClose(FCB->AddressFile.Handle);
+        FCB->AddressFile.Handle = INVALID_HANDLE_VALUE;
+    }
+
+    if (FCB->Recv.Window)
+    {
+        ExFreePool(FCB->Recv.Window);
+        FCB->Recv.Window = NULL;
+    }
+
+    if (FCB->Send.Window)
+    {
+        ExFreePool(FCB->Send.Window);
+        FCB->Send.Window = NULL;
+    }
+
+    FCB->Recv.BytesUsed = FCB->Recv.Content = 0;
+    FCB->Send.BytesUsed = FCB->Send.Content = 0;
+
+    if (FCB->LocalAddress)
+    {
+        ExFreePool(FCB->LocalAddress);
+        FCB->LocalAddress = NULL;
+    }
+
+    if (FCB->RemoteAddress)
+    {
+        ExFreePool(FCB->RemoteAddress);
+        FCB->RemoteAddress = NULL;
+    }
+
+    if (FCB->AddressFrom)
+    {
+        ExFreePool(FCB->AddressFrom);
+        FCB->AddressFrom = NULL;
+    }
+
+    if (FCB->ConnectCallInfo)
+    {
+        ExFreePool(FCB->ConnectCallInfo);
+        FCB->ConnectCallInfo = NULL;
+    }
+
+    if (FCB->ConnectReturnInfo)
+    {
+        ExFreePool(FCB->ConnectReturnInfo);
+        FCB->ConnectReturnInfo = NULL;
+    }
+
+    FCB->Overread = FALSE;
+    FCB->TdiReceiveClosed = FALSE;
+    FCB->SendClosed = FALSE;
+    FCB->DisconnectReuse = FALSE;
+    FCB->LastReceiveStatus = STATUS_SUCCESS;
+    FCB->FilledConnectData = FCB->FilledConnectOptions = 0;
+    FCB->FilledDisconnectData = FCB->FilledDisconnectOptions = 0;
+    FCB->PollState = 0;
+    RtlZeroMemory(FCB->PollStatus, sizeof(FCB->PollStatus));
+
+    FCB->State = SOCKET_STATE_CREATED;
+}
+
 static IO_COMPLETION_ROUTINE DisconnectComplete;
 static
 NTSTATUS
@@ -613,12 +721,33 @@ DisconnectComplete(PDEVICE_OBJECT DeviceObject,
 
     FCB->DisconnectPending = FALSE;
 
+    if (NT_SUCCESS(Irp->IoStatus.Status) && FCB->DisconnectReuse)
+    {
+        /* Nothing more comes in on a socket that is going to be reused */
+        FCB->TdiReceiveClosed = TRUE;
+
+        if (FCB->ReceiveIrp.InFlightRequest)
+            IoCancelIrp(FCB->ReceiveIrp.InFlightRequest);
+
+        if (!FCB->ReceiveIrp.InFlightRequest && !FCB->SendIrp.InFlightRequest &&
+            IsListEmpty(&FCB->PendingIrpList[FUNCTION_RECV]) &&
+            IsListEmpty(&FCB->PendingIrpList[FUNCTION_SEND]))
+        {
+            RecycleSocket(FCB);
+        }
+        else
+        {
+            AFD_DbgPrint(MIN_TRACE,("FCB %p is still busy and can't be reused\n", FCB));
+            FCB->DisconnectReuse = FALSE;
+        }
+    }
+
+    /* A transmit that disconnected keeps the byte count it got */
     while (!IsListEmpty(&FCB->PendingIrpList[FUNCTION_DISCONNECT]))
     {
         CurrentEntry = RemoveHeadList(&FCB->PendingIrpList[FUNCTION_DISCONNECT]);
         CurrentIrp = CONTAINING_RECORD(CurrentEntry, IRP, Tail.Overlay.ListEntry);
         CurrentIrp->IoStatus.Status = Irp->IoStatus.Status;
-        CurrentIrp->IoStatus.Information = 0;
         UnlockRequest(CurrentIrp, IoGetCurrentIrpStackLocation(CurrentIrp));
         (void)IoSetCancelRoutine(CurrentIrp, NULL);
         IoCompleteRequest(CurrentIrp, IO_NETWORK_INCREMENT );
@@ -679,7 +808,8 @@ RetryDisconnectCompletion(PAFD_FCB FCB)
 {
     ASSERT(FCB->RemoteAddress);
 
-    if (IsListEmpty(&FCB->PendingIrpList[FUNCTION_SEND]) && !FCB->SendIrp.InFlightRequest && FCB->DisconnectPending)
+    if (IsListEmpty(&FCB->PendingIrpList[FUNCTION_SEND]) && !FCB->SendIrp.InFlightRequest &&
+        IsListEmpty(&FCB->PendingIrpList[FUNCTION_TRANSMIT]) && FCB->DisconnectPending)
     {
         /* Sends are done; fire off a TDI_DISCONNECT request */
         DoDisconnect(FCB);
@@ -783,13 +913,15 @@ AfdDisconnect(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         FCB->DisconnectFlags = Flags;
         FCB->DisconnectTimeout = DisReq->Timeout;
         FCB->DisconnectPending = TRUE;
+        FCB->DisconnectReuse = (DisReq->DisconnectType & AFD_DISCONNECT_REUSE) != 0;
         FCB->SendClosed = TRUE;
         FCB->PollState &= ~AFD_EVENT_SEND;
 
         Status = QueueUserModeIrp(FCB, Irp, FUNCTION_DISCONNECT);
         if (Status == STATUS_PENDING)
         {
-            if ((IsListEmpty(&FCB->PendingIrpList[FUNCTION_SEND]) && !FCB->SendIrp.InFlightRequest) ||
+            if ((IsListEmpty(&FCB->PendingIrpList[FUNCTION_SEND]) && !FCB->SendIrp.InFlightRequest &&
+                 IsListEmpty(&FCB->PendingIrpList[FUNCTION_TRANSMIT])) ||
                 (FCB->DisconnectFlags & TDI_DISCONNECT_ABORT))
             {
                 /* Go ahead and execute the disconnect because we're ready for it */
@@ -877,6 +1009,7 @@ AfdDispatch(PDEVICE_OBJECT DeviceObject, PIRP Irp)
             return AfdBindSocket( DeviceObject, Irp, IrpSp );
 
         case IOCTL_AFD_CONNECT:
+        case IOCTL_AFD_SUPER_CONNECT:
             return AfdStreamSocketConnect( DeviceObject, Irp, IrpSp );
 
         case IOCTL_AFD_START_LISTEN:
@@ -895,9 +1028,15 @@ AfdDispatch(PDEVICE_OBJECT DeviceObject, PIRP Irp)
         case IOCTL_AFD_ENUM_NETWORK_EVENTS:
             return AfdEnumEvents( DeviceObject, Irp, IrpSp );
 
+        case IOCTL_AFD_SET_NOTIFY:
+            return AfdSetNotify( DeviceObject, Irp, IrpSp );
+
         case IOCTL_AFD_RECV_DATAGRAM:
             return AfdPacketSocketReadData( DeviceObject, Irp, IrpSp );
 
+        case IOCTL_AFD_RECV_DATAGRAMS:
+            return AfdPacketSocketReadBatch( DeviceObject, Irp, IrpSp );
+
         case IOCTL_AFD_SEND:
             return AfdConnectedSocketWriteData( DeviceObject, Irp, IrpSp,
                                                 FALSE );
@@ -926,6 +1065,12 @@ AfdDispatch(PDEVICE_OBJECT DeviceObject, PIRP Irp)
         case IOCTL_AFD_ACCEPT:
             return AfdAccept( DeviceObject, Irp, IrpSp );
 
+        case IOCTL_AFD_SUPER_ACCEPT:
+            return AfdSuperAccept( DeviceObject, Irp, IrpSp );
+
+        case IOCTL_AFD_TRANSMIT_PACKETS:
+            return AfdTransmitPackets( DeviceObject, Irp, IrpSp );
+
         case IOCTL_AFD_DISCONNECT:
             return AfdDisconnect( DeviceObject, Irp, IrpSp );
 
@@ -1029,9 +1174,10 @@ BOOLEAN CheckUnlockExtraBuffers(PAFD_FCB FCB, PIO_STACK_LOCATION IrpSp)
                 /* recvfrom() call - extra buffers */
                 return TRUE;
             }
-            else if (IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_RECV)
+            else if (IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_RECV ||
+                     IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_RECV_DATAGRAMS)
             {
-                /* recv() call - no extra buffers */
+                /* recv() call or batch of datagrams - no extra buffers */
                 return FALSE;
             }
             else if (IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_SEND ||
@@ -1067,6 +1213,7 @@ CleanupPendingIrp(PAFD_FCB FCB, PIRP Irp, PIO_STACK_LOCATION IrpSp, PAFD_ACTIVE_
     PAFD_RECV_INFO RecvReq;
     PAFD_SEND_INFO SendReq;
     PAFD_POLL_INFO PollReq;
+    PAFD_SUPER_ACCEPT_REQUEST AcceptReq;
 
     if (IrpSp->MajorFunction == IRP_MJ_READ)
     {
@@ -1082,7 +1229,8 @@ CleanupPendingIrp(PAFD_FCB FCB, PIRP Irp, PIO_STACK_LOCATION IrpSp, PAFD_ACTIVE_
     {
         ASSERT(IrpSp->MajorFunction == IRP_MJ_DEVICE_CONTROL);
 
-        if (IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_RECV)
+        if (IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_RECV ||
+            IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_RECV_DATAGRAMS)
         {
             RecvReq = GetLockedData(Irp, IrpSp);
             UnlockBuffers(RecvReq->BufferArray, RecvReq->BufferCount, CheckUnlockExtraBuffers(FCB, IrpSp));
@@ -1100,6 +1248,26 @@ CleanupPendingIrp(PAFD_FCB FCB, PIRP Irp, PIO_STACK_LOCATION IrpSp, PAFD_ACTIVE_
             ZeroEvents(PollReq->Handles, PollReq->HandleCount);
             SignalSocket(Poll, NULL, PollReq, STATUS_CANCELLED);
         }
+        else if (IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_SUPER_ACCEPT)
+        {
+            AcceptReq = GetLockedData(Irp, IrpSp);
+            UnlockBuffers(AcceptReq->RecvInfo.BufferArray, AcceptReq->RecvInfo.BufferCount, FALSE);
+            if (AcceptReq->AcceptFileObject)
+                ObDereferenceObject(AcceptReq->AcceptFileObject);
+        }
+        else if (IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_SUPER_CONNECT)
+        {
+            /* Only a super connect with data has buffers locked */
+            if (IrpSp->Parameters.DeviceIoControl.OutputBufferLength)
+            {
+                SendReq = GetLockedData(Irp, IrpSp);
+                UnlockBuffers(SendReq->BufferArray, SendReq->BufferCount, FALSE);
+            }
+        }
+        else if (IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_TRANSMIT_PACKETS)
+        {
+            CleanupTransmit(Irp);
+        }
     }
 }
 
@@ -1120,6 +1288,14 @@ AfdCancelHandler(PDEVICE_OBJECT DeviceObject,
 
     IoReleaseCancelSpinLock(Irp->CancelIrql);
 
+    /* A super accept waiting for its data sits on the accepted socket */
+    if (IrpSp->MajorFunction == IRP_MJ_DEVICE_CONTROL &&
+        IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_SUPER_ACCEPT &&
+        Irp->Tail.Overlay.DriverContext[2])
+    {
+        FCB = Irp->Tail.Overlay.DriverContext[2];
+    }
+
     if (!SocketAcquireStateLock(FCB))
         return;
 
@@ -1146,11 +1322,30 @@ AfdCancelHandler(PDEVICE_OBJECT DeviceObject,
     switch (IoctlCode)
     {
         case IOCTL_AFD_RECV:
+            /* The transport finishes a receive it is filling directly */
+            if (CancelDirectReceive(FCB, Irp))
+            {
+                SocketStateUnlock(FCB);
+                return;
+            }
+            Function = FUNCTION_RECV;
+            break;
+
         case IOCTL_AFD_RECV_DATAGRAM:
+        case IOCTL_AFD_RECV_DATAGRAMS:
             Function = FUNCTION_RECV;
             break;
 
         case IOCTL_AFD_SEND:
+            /* The transport finishes a send it is taking directly */
+            if (CancelDirectSend(FCB, Irp))
+            {
+                SocketStateUnlock(FCB);
+                return;
+            }
+            Function = FUNCTION_SEND;
+            break;
+
         case IOCTL_AFD_SEND_DATAGRAM:
             Function = FUNCTION_SEND;
             break;
@@ -1159,10 +1354,29 @@ AfdCancelHandler(PDEVICE_OBJECT DeviceObject,
             Function = FUNCTION_CONNECT;
             break;
 
+        case IOCTL_AFD_SUPER_CONNECT:
+            /* It becomes a send once its data is on the way */
+            Function = (FCB->State == SOCKET_STATE_CONNECTING) ? FUNCTION_CONNECT : FUNCTION_SEND;
+            break;
+
         case IOCTL_AFD_WAIT_FOR_LISTEN:
             Function = FUNCTION_PREACCEPT;
             break;
 
+        case IOCTL_AFD_SUPER_ACCEPT:
+            Function = Irp->Tail.Overlay.DriverContext[2] ? FUNCTION_RECV : FUNCTION_ACCEPT;
+            break;
+
+        case IOCTL_AFD_TRANSMIT_PACKETS:
+            /* The transmit being sent finishes on its own */
+            if (CancelActiveTransmit(FCB, Irp))
+            {
+                SocketStateUnlock(FCB);
+                return;
+            }
+            Function = FUNCTION_TRANSMIT;
+            break;
+
         case IOCTL_AFD_SELECT:
             KeAcquireSpinLock(&DeviceExt->Lock, &OldIrql);
 
@@ -18,6 +18,10 @@ static VOID RefillSocketBuffer( PAFD_FCB FCB )
     /* Now ensure that receive is still allowed */
     if (FCB->TdiReceiveClosed) return;
 
+    /* The window size changed while the transport had our buffer */
+    if (FCB->Recv.PendingSize)
+        AfdResizeRecvWindow(FCB, FCB->Recv.PendingSize);
+
     /* Check if the buffer is full */
     if (FCB->Recv.Content == FCB->Recv.Size)
     {
@@ -59,6 +63,11 @@ static VOID HandleReceiveComplete( PAFD_FCB FCB, NTSTATUS Status, ULONG_PTR Info
     {
         /* The received data is discarded */
     }
+    /* We took our receive back to post a user buffer instead (see ReceiveDirect) */
+    else if (Status == STATUS_CANCELLED)
+    {
+        ASSERT(Information == 0);
+    }
     /* Receive successful */
     else if (Status == STATUS_SUCCESS)
     {
@@ -71,11 +80,6 @@ static VOID HandleReceiveComplete( PAFD_FCB FCB, NTSTATUS Status, ULONG_PTR Info
             /* Receive is closed */
             FCB->TdiReceiveClosed = TRUE;
         }
-        else
-        {
-            /* Issue another receive IRP to keep the buffer well stocked */
-            RefillSocketBuffer(FCB);
-        }
     }
     /* Receive failed with no data (unexpected closure) */
     else
@@ -142,9 +146,6 @@ static NTSTATUS TryToSatisfyRecvRequestFromBuffer( PAFD_FCB FCB,
         }
     }
 
-    /* Issue another receive IRP to keep the buffer well stocked */
-    RefillSocketBuffer(FCB);
-
     return STATUS_SUCCESS;
 }
 
@@ -266,6 +267,180 @@ static NTSTATUS ReceiveActivity( PAFD_FCB FCB, PIRP Irp ) {
     return RetStatus;
 }
 
+static PMDL ChainRecvBuffers( PAFD_RECV_INFO RecvReq, PUINT TotalLength ) {
+    PAFD_MAPBUF Map = (PAFD_MAPBUF)(RecvReq->BufferArray + RecvReq->BufferCount);
+    PMDL First = NULL, Last = NULL;
+    UINT i;
+
+    *TotalLength = 0;
+
+    for( i = 0; i < RecvReq->BufferCount; i++ ) {
+        if( !Map[i].Mdl ) continue;
+
+        if( Last ) Last->Next = Map[i].Mdl;
+        else First = Map[i].Mdl;
+        Last = Map[i].Mdl;
+
+        *TotalLength += RecvReq->BufferArray[i].len;
+    }
+
+    return First;
+}
+
+static VOID UnchainRecvBuffers( PAFD_RECV_INFO RecvReq ) {
+    PAFD_MAPBUF Map = (PAFD_MAPBUF)(RecvReq->BufferArray + RecvReq->BufferCount);
+    UINT i;
+
+    for( i = 0; i < RecvReq->BufferCount; i++ ) {
+        if( Map[i].Mdl ) Map[i].Mdl->Next = NULL;
+    }
+}
+
+static BOOLEAN CanReceiveDirect( PAFD_FCB FCB, PIRP Irp ) {
+    PIO_STACK_LOCATION IrpSp = IoGetCurrentIrpStackLocation( Irp );
+    PAFD_RECV_INFO RecvReq = GetLockedData(Irp, IrpSp);
+
+    /* Super accepts complete differently */
+    if( IrpSp->MajorFunction != IRP_MJ_READ &&
+        !(IrpSp->MajorFunction == IRP_MJ_DEVICE_CONTROL &&
+          IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_RECV) )
+        return FALSE;
+
+    /* A peek has to leave the data in our buffer */
+    if( RecvReq->TdiFlags & TDI_RECEIVE_PEEK )
+        return FALSE;
+
+    /* Non-blocking receives are completed instead of waiting */
+    if( !(RecvReq->AfdFlags & AFD_OVERLAPPED) &&
+        ((RecvReq->AfdFlags & AFD_IMMEDIATE) || FCB->NonBlocking) )
+        return FALSE;
+
+    return TRUE;
+}
+
+static IO_COMPLETION_ROUTINE DirectReceiveComplete;
+
+/* A receive that has to wait for data gets its own buffers posted to the
+ * transport, so the data is copied once, straight from the received packet
+ * into the caller's buffer.  Our buffer only holds what arrives while nobody
+ * is waiting.  The head of the receive queue can complete from in here, so
+ * only call this once that is safe. */
+static VOID ReceiveDirect( PAFD_FCB FCB ) {
+    PIRP NextIrp;
+    PIO_STACK_LOCATION NextIrpSp;
+    PAFD_RECV_INFO RecvReq;
+    PMDL Mdl;
+    UINT Length;
+    NTSTATUS Status;
+
+    if( FCB->Flags & AFD_ENDPOINT_CONNECTIONLESS ) return;
+    if( FCB->State != SOCKET_STATE_CONNECTED || FCB->TdiReceiveClosed ) return;
+
+    /* Data we have buffered goes first */
+    if( FCB->Recv.Content != FCB->Recv.BytesUsed ) return;
+
+    if( IsListEmpty( &FCB->PendingIrpList[FUNCTION_RECV] ) ) return;
+
+    NextIrp = CONTAINING_RECORD(FCB->PendingIrpList[FUNCTION_RECV].Flink,
+                                IRP, Tail.Overlay.ListEntry);
+    if( !CanReceiveDirect( FCB, NextIrp ) ) return;
+
+    if( FCB->ReceiveIrp.InFlightRequest ) {
+        /* Our buffer hasn't got anything yet, so take that receive back.
+         * ReceiveComplete calls us again to post the user buffers. */
+        if( !FCB->DirectRecvIrp )
+            IoCancelIrp( FCB->ReceiveIrp.InFlightRequest );
+        return;
+    }
+
+    NextIrpSp = IoGetCurrentIrpStackLocation( NextIrp );
+    RecvReq = GetLockedData(NextIrp, NextIrpSp);
+
+    Mdl = ChainRecvBuffers( RecvReq, &Length );
+    if( !Mdl ) return;
+
+    AFD_DbgPrint(MID_TRACE,("Receiving directly into %p (%u)\n", NextIrp, Length));
+
+    RemoveEntryList( &NextIrp->Tail.Overlay.ListEntry );
+    FCB->DirectRecvIrp = NextIrp;
+
+    /* Nothing is buffered, so start over at the beginning of our buffer */
+    FCB->Recv.Content = FCB->Recv.BytesUsed = 0;
+
+    Status = TdiReceiveMdl( &FCB->ReceiveIrp.InFlightRequest,
+                            FCB->Connection.Object,
+                            TDI_RECEIVE_NORMAL,
+                            Mdl,
+                            Length,
+                            DirectReceiveComplete,
+                            FCB );
+    if( Status != STATUS_PENDING ) {
+        FCB->DirectRecvIrp = NULL;
+        UnchainRecvBuffers( RecvReq );
+        InsertHeadList( &FCB->PendingIrpList[FUNCTION_RECV],
+                        &NextIrp->Tail.Overlay.ListEntry );
+    }
+}
+
+/* Hands the result of a direct receive to the request that owns the buffers.
+ * Returns FALSE if the request went back in the queue, in which case the
+ * status is handled like that of any other receive. */
+static BOOLEAN CompleteDirectReceive( PAFD_FCB FCB, PIRP Irp ) {
+    PIRP NextIrp = FCB->DirectRecvIrp;
+    PIO_STACK_LOCATION NextIrpSp = IoGetCurrentIrpStackLocation( NextIrp );
+    PAFD_RECV_INFO RecvReq = GetLockedData(NextIrp, NextIrpSp);
+
+    FCB->DirectRecvIrp = NULL;
+
+    UnchainRecvBuffers( RecvReq );
+
+    if( !(Irp->IoStatus.Status == STATUS_SUCCESS && Irp->IoStatus.Information) &&
+        !(Irp->IoStatus.Status == STATUS_CANCELLED && NextIrp->Cancel) ) {
+        InsertHeadList( &FCB->PendingIrpList[FUNCTION_RECV],
+                        &NextIrp->Tail.Overlay.ListEntry );
+        return FALSE;
+    }
+
+    AFD_DbgPrint(MID_TRACE,("Completing direct recv %p (%u)\n", NextIrp,
+                            (UINT)Irp->IoStatus.Information));
+
+    UnlockBuffers( RecvReq->BufferArray, RecvReq->BufferCount, FALSE );
+    NextIrp->IoStatus.Status = Irp->IoStatus.Status;
+    NextIrp->IoStatus.Information = Irp->IoStatus.Information;
+    if( NextIrp->MdlAddress ) UnlockRequest( NextIrp, NextIrpSp );
+    (void)IoSetCancelRoutine(NextIrp, NULL);
+    IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
+
+    return TRUE;
+}
+
+/* Called from the cancel routine.  The transport finishes a direct receive,
+ * with whatever it managed to put in the buffers. */
+BOOLEAN CancelDirectReceive( PAFD_FCB FCB, PIRP Irp ) {
+    if( FCB->DirectRecvIrp != Irp ) return FALSE;
+
+    if( FCB->ReceiveIrp.InFlightRequest )
+        IoCancelIrp( FCB->ReceiveIrp.InFlightRequest );
+
+    return TRUE;
+}
+
+/* The receive half of a super accept.  The irp belongs to the listening
+ * socket and is already pending, it just waits here for the first data. */
+VOID QueueAcceptReceive( PAFD_FCB FCB, PIRP Irp ) {
+    AFD_DbgPrint(MID_TRACE,("Accept receive %p on FCB %p\n", Irp, FCB));
+
+    Irp->IoStatus.Status = STATUS_PENDING;
+    Irp->IoStatus.Information = 0;
+
+    InsertTailList( &FCB->PendingIrpList[FUNCTION_RECV],
+                    &Irp->Tail.Overlay.ListEntry );
+
+    ReceiveActivity( FCB, Irp );
+
+    RefillSocketBuffer( FCB );
+}
+
 NTSTATUS NTAPI ReceiveComplete
 ( PDEVICE_OBJECT DeviceObject,
   PIRP Irp,
@@ -275,6 +450,7 @@ NTSTATUS NTAPI ReceiveComplete
     PIRP NextIrp;
     PAFD_RECV_INFO RecvReq;
     PIO_STACK_LOCATION NextIrpSp;
+    BOOLEAN Direct = FALSE;
 
     UNREFERENCED_PARAMETER(DeviceObject);
 
@@ -286,6 +462,9 @@ NTSTATUS NTAPI ReceiveComplete
     ASSERT(FCB->ReceiveIrp.InFlightRequest == Irp);
     FCB->ReceiveIrp.InFlightRequest = NULL;
 
+    if( FCB->DirectRecvIrp )
+        Direct = CompleteDirectReceive( FCB, Irp );
+
     if( FCB->State == SOCKET_STATE_CLOSED ) {
         /* Cleanup our IRP queue because the FCB is being destroyed */
         while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_RECV] ) ) {
@@ -308,15 +487,129 @@ NTSTATUS NTAPI ReceiveComplete
         return STATUS_INVALID_PARAMETER;
     }
 
-    HandleReceiveComplete( FCB, Irp->IoStatus.Status, Irp->IoStatus.Information );
+    if( !Direct )
+        HandleReceiveComplete( FCB, Irp->IoStatus.Status, Irp->IoStatus.Information );
 
     ReceiveActivity( FCB, NULL );
 
+    /* Keep a receive going, into the next waiting request if there is one */
+    ReceiveDirect( FCB );
+    RefillSocketBuffer( FCB );
+
     SocketStateUnlock( FCB );
 
     return STATUS_SUCCESS;
 }
 
+static NTSTATUS NTAPI DirectReceiveComplete
+( PDEVICE_OBJECT DeviceObject,
+  PIRP Irp,
+  PVOID Context ) {
+    /* The MDLs belong to the user request, don't let the I/O manager free
+     * them, whatever happened to the socket */
+    Irp->MdlAddress = NULL;
+
+    return ReceiveComplete( DeviceObject, Irp, Context );
+}
+
+/* Picks the ring size for the socket.  The ring can only be swapped while
+ * it is empty, as the queued datagrams point into it. */
+static PAFD_DATAGRAM_RING GetDatagramRing( PAFD_FCB FCB ) {
+    PAFD_DATAGRAM_RING Ring = FCB->DatagramRing;
+    UINT Limit, SlotCount;
+
+    /* Don't hold more than the receive window in slots */
+    Limit = MIN( FCB->Recv.Size / AFD_DATAGRAM_SLOT_SIZE,
+                 AFD_DATAGRAM_RING_MAX_SLOTS );
+    if( !Limit ) Limit = 1;
+
+    if( !Ring ) {
+        SlotCount = MIN( AFD_DATAGRAM_RING_MIN_SLOTS, Limit );
+    } else if( Ring->Count ) {
+        return Ring;
+    } else if( Ring->SlotCount > Limit ) {
+        SlotCount = Limit;
+    } else if( Ring->Overflowed && Ring->SlotCount < Limit ) {
+        SlotCount = MIN( Ring->SlotCount * 2, Limit );
+    } else {
+        return Ring;
+    }
+
+    Ring = ExAllocatePool( NonPagedPool,
+                           sizeof(AFD_DATAGRAM_RING) +
+                           SlotCount * AFD_DATAGRAM_SLOT_SIZE );
+    if( !Ring ) return FCB->DatagramRing;
+
+    AFD_DbgPrint(MID_TRACE,("Ring of %u slots for %p\n", SlotCount, FCB));
+
+    Ring->Head = Ring->Count = 0;
+    Ring->SlotCount = SlotCount;
+    Ring->Overflowed = FALSE;
+    Ring->Slots = (PCHAR)(Ring + 1);
+
+    if( FCB->DatagramRing )
+        ExFreePool( FCB->DatagramRing );
+    FCB->DatagramRing = Ring;
+
+    return Ring;
+}
+
+/* Stores a received datagram along with the sender's address, in the ring
+ * when it fits in a slot and one is free */
+static PAFD_STORED_DATAGRAM
+AllocateStoredDatagram( PAFD_FCB FCB, UINT Len, PTRANSPORT_ADDRESS Address ) {
+    PAFD_DATAGRAM_RING Ring;
+    PAFD_STORED_DATAGRAM DatagramRecv = NULL;
+    UINT AddrOffset = ALIGN_UP_BY(FIELD_OFFSET(AFD_STORED_DATAGRAM, Buffer) + Len,
+                                  sizeof(PVOID));
+    UINT AddrLen = TaLengthOfTransportAddress( Address );
+
+    if( !AddrLen ) return NULL;
+
+    if( AddrOffset + AddrLen <= AFD_DATAGRAM_SLOT_SIZE ) {
+        Ring = GetDatagramRing( FCB );
+
+        if( Ring && Ring->Count < Ring->SlotCount ) {
+            DatagramRecv = (PAFD_STORED_DATAGRAM)
+                (Ring->Slots + ((Ring->Head + Ring->Count) % Ring->SlotCount) *
+                               AFD_DATAGRAM_SLOT_SIZE);
+            Ring->Count++;
+            DatagramRecv->InRing = TRUE;
+        } else if( Ring ) {
+            /* Have the next ring hold more */
+            Ring->Overflowed = TRUE;
+        }
+    }
+
+    if( !DatagramRecv ) {
+        DatagramRecv = ExAllocatePool( NonPagedPool, AddrOffset + AddrLen );
+        if( !DatagramRecv ) return NULL;
+        DatagramRecv->InRing = FALSE;
+    }
+
+    DatagramRecv->Len = Len;
+    DatagramRecv->Address = (PTRANSPORT_ADDRESS)((PCHAR)DatagramRecv + AddrOffset);
+    RtlCopyMemory( DatagramRecv->Address, Address, AddrLen );
+
+    return DatagramRecv;
+}
+
+VOID FreeStoredDatagram( PAFD_FCB FCB, PAFD_STORED_DATAGRAM DatagramRecv ) {
+    PAFD_DATAGRAM_RING Ring = FCB->DatagramRing;
+
+    if( !DatagramRecv->InRing ) {
+        ExFreePool( DatagramRecv );
+        return;
+    }
+
+    /* Only the oldest datagram in the ring can go */
+    ASSERT(Ring->Count != 0);
+    ASSERT((PCHAR)DatagramRecv == Ring->Slots + Ring->Head * AFD_DATAGRAM_SLOT_SIZE);
+
+    Ring->Head = (Ring->Head + 1) % Ring->SlotCount;
+    Ring->Count--;
+}
+
 static NTSTATUS NTAPI
 SatisfyPacketRecvRequest( PAFD_FCB FCB, PIRP Irp,
                          PAFD_STORED_DATAGRAM DatagramRecv,
@@ -409,8 +702,7 @@ SatisfyPacketRecvRequest( PAFD_FCB FCB, PIRP Irp,
     if (!(RecvReq->TdiFlags & TDI_RECEIVE_PEEK))
     {
         FCB->Recv.Content -= DatagramRecv->Len;
-        ExFreePool( DatagramRecv->Address );
-        ExFreePool( DatagramRecv );
+        FreeStoredDatagram( FCB, DatagramRecv );
     }
 
     AFD_DbgPrint(MID_TRACE,("Done\n"));
@@ -418,6 +710,83 @@ SatisfyPacketRecvRequest( PAFD_FCB FCB, PIRP Irp,
     return Status;
 }
 
+static BOOLEAN IsBatchRecv( PIO_STACK_LOCATION IrpSp ) {
+    return IrpSp->MajorFunction == IRP_MJ_DEVICE_CONTROL &&
+           IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_RECV_DATAGRAMS;
+}
+
+/* Copies queued datagrams into the caller's buffer one after the other.
+ * The first one is always taken, cut short if it has to be, the ones after
+ * it only while they fit whole. */
+static NTSTATUS
+SatisfyPacketRecvBatch( PAFD_FCB FCB, PIRP Irp ) {
+    PIO_STACK_LOCATION IrpSp = IoGetCurrentIrpStackLocation( Irp );
+    PAFD_RECV_DATAGRAMS_INFO RecvReq = GetLockedData(Irp, IrpSp);
+    PAFD_MAPBUF Map = (PAFD_MAPBUF)(RecvReq->BufferArray + RecvReq->BufferCount);
+    PAFD_STORED_DATAGRAM DatagramRecv;
+    PAFD_RECEIVED_DATAGRAM Record;
+    PCHAR Buffer;
+    UINT BufferLength = RecvReq->BufferArray[0].len;
+    UINT Offset = 0, Count = 0, BytesToCopy, AddrLen, RecordLength;
+
+    if( !Map[0].Mdl ||
+        BufferLength < FIELD_OFFSET(AFD_RECEIVED_DATAGRAM, Data) ) {
+        Irp->IoStatus.Information = 0;
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    Buffer = MmMapLockedPages( Map[0].Mdl, KernelMode );
+
+    while( !IsListEmpty( &FCB->DatagramList ) &&
+           (!RecvReq->MaxDatagrams || Count < RecvReq->MaxDatagrams) ) {
+        DatagramRecv = CONTAINING_RECORD( FCB->DatagramList.Flink,
+                                          AFD_STORED_DATAGRAM, ListEntry );
+
+        if( BufferLength - Offset < FIELD_OFFSET(AFD_RECEIVED_DATAGRAM, Data) )
+            break;
+
+        BytesToCopy = MIN( DatagramRecv->Len,
+                           BufferLength - Offset -
+                           FIELD_OFFSET(AFD_RECEIVED_DATAGRAM, Data) );
+        if( BytesToCopy < DatagramRecv->Len && Count )
+            break;
+
+        Record = (PAFD_RECEIVED_DATAGRAM)(Buffer + Offset);
+
+        AddrLen = MIN( DatagramRecv->Address->Address->AddressLength +
+                       sizeof(USHORT),
+                       sizeof(Record->Address) );
+        RtlCopyMemory( Record->Address,
+                       &DatagramRecv->Address->Address->AddressType,
+                       AddrLen );
+        Record->AddressLength = AddrLen;
+
+        RtlCopyMemory( Record->Data, DatagramRecv->Buffer, BytesToCopy );
+        Record->DataLength = BytesToCopy;
+        Record->Flags = BytesToCopy < DatagramRecv->Len ? AFD_DATAGRAM_TRUNCATED : 0;
+
+        /* Keep the next record aligned as long as there is room for it */
+        RecordLength = ALIGN_UP_BY(FIELD_OFFSET(AFD_RECEIVED_DATAGRAM, Data) +
+                                   BytesToCopy, sizeof(ULONG));
+        RecordLength = MIN( RecordLength, BufferLength - Offset );
+        Record->RecordLength = RecordLength;
+        Offset += RecordLength;
+
+        AFD_DbgPrint(MID_TRACE,("Datagram %u: %u bytes\n", Count, BytesToCopy));
+
+        RemoveHeadList( &FCB->DatagramList );
+        FCB->Recv.Content -= DatagramRecv->Len;
+        FreeStoredDatagram( FCB, DatagramRecv );
+        Count++;
+    }
+
+    MmUnmapLockedPages( Buffer, Map[0].Mdl );
+
+    Irp->IoStatus.Information = Offset;
+
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS NTAPI
 AfdConnectedSocketReadData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
                            PIO_STACK_LOCATION IrpSp, BOOLEAN Short) {
@@ -438,6 +807,7 @@ AfdConnectedSocketReadData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
 
     FCB->EventSelectDisabled &= ~AFD_EVENT_RECEIVE;
+    NotifyRearm( FCB, AFD_EVENT_RECEIVE );
 
     if( !(FCB->Flags & AFD_ENDPOINT_CONNECTIONLESS) &&
         FCB->State != SOCKET_STATE_CONNECTED &&
@@ -526,16 +896,23 @@ AfdConnectedSocketReadData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         TotalBytesCopied = 0;
         RemoveEntryList( &Irp->Tail.Overlay.ListEntry );
         UnlockBuffers( RecvReq->BufferArray, RecvReq->BufferCount, FALSE );
+        RefillSocketBuffer( FCB );
         return UnlockAndMaybeComplete( FCB, Status, Irp,
                                        TotalBytesCopied );
     } else if( Status == STATUS_PENDING ) {
         AFD_DbgPrint(MID_TRACE,("Leaving read irp\n"));
         IoMarkIrpPending( Irp );
         (void)IoSetCancelRoutine(Irp, AfdCancelHandler);
+
+        /* The irp may complete in here now that it is marked pending */
+        ReceiveDirect( FCB );
     } else {
         AFD_DbgPrint(MID_TRACE,("Completed with status %x\n", Status));
     }
 
+    /* Reading may have made room in our buffer */
+    RefillSocketBuffer( FCB );
+
     SocketStateUnlock( FCB );
     return Status;
 }
@@ -552,7 +929,6 @@ PacketSocketRecvComplete(
     PLIST_ENTRY ListEntry;
     PAFD_RECV_INFO RecvReq;
     PAFD_STORED_DATAGRAM DatagramRecv;
-    UINT DGSize = Irp->IoStatus.Information + sizeof( AFD_STORED_DATAGRAM );
     PLIST_ENTRY NextIrpEntry, DatagramRecvEntry;
 
     UNREFERENCED_PARAMETER(DeviceObject);
@@ -584,8 +960,7 @@ PacketSocketRecvComplete(
         while( !IsListEmpty( &FCB->DatagramList ) ) {
                DatagramRecvEntry = RemoveHeadList(&FCB->DatagramList);
                DatagramRecv = CONTAINING_RECORD(DatagramRecvEntry, AFD_STORED_DATAGRAM, ListEntry);
-               ExFreePool( DatagramRecv->Address );
-               ExFreePool( DatagramRecv );
+               FreeStoredDatagram( FCB, DatagramRecv );
         }
 
         SocketStateUnlock( FCB );
@@ -604,26 +979,18 @@ PacketSocketRecvComplete(
         return STATUS_FILE_CLOSED;
     }
 
-    DatagramRecv = ExAllocatePool( NonPagedPool, DGSize );
-
-    if( DatagramRecv ) {
-        DatagramRecv->Len = Irp->IoStatus.Information;
-        RtlCopyMemory( DatagramRecv->Buffer, FCB->Recv.Window,
-                       DatagramRecv->Len );
-        AFD_DbgPrint(MID_TRACE,("Received (A %p)\n",
-                                FCB->AddressFrom->RemoteAddress));
-        DatagramRecv->Address =
-            TaCopyTransportAddress( FCB->AddressFrom->RemoteAddress );
+    AFD_DbgPrint(MID_TRACE,("Received (A %p)\n",
+                            FCB->AddressFrom->RemoteAddress));
 
-        if( !DatagramRecv->Address ) Status = STATUS_NO_MEMORY;
+    DatagramRecv = AllocateStoredDatagram( FCB, Irp->IoStatus.Information,
+                                           FCB->AddressFrom->RemoteAddress );
 
-    } else Status = STATUS_NO_MEMORY;
-
-    if( !NT_SUCCESS( Status ) ) {
-        if( DatagramRecv ) ExFreePool( DatagramRecv );
+    if( !DatagramRecv ) {
         SocketStateUnlock( FCB );
-        return Status;
+        return STATUS_NO_MEMORY;
     } else {
+        RtlCopyMemory( DatagramRecv->Buffer, FCB->Recv.Window,
+                       DatagramRecv->Len );
         FCB->Recv.Content += DatagramRecv->Len;
         InsertTailList( &FCB->DatagramList, &DatagramRecv->ListEntry );
     }
@@ -633,26 +1000,32 @@ PacketSocketRecvComplete(
     while( !IsListEmpty( &FCB->DatagramList ) &&
            !IsListEmpty( &FCB->PendingIrpList[FUNCTION_RECV] ) ) {
         AFD_DbgPrint(MID_TRACE,("Looping trying to satisfy request\n"));
-        ListEntry = RemoveHeadList( &FCB->DatagramList );
-        DatagramRecv = CONTAINING_RECORD( ListEntry, AFD_STORED_DATAGRAM,
-                                          ListEntry );
         ListEntry = RemoveHeadList( &FCB->PendingIrpList[FUNCTION_RECV] );
         NextIrp = CONTAINING_RECORD( ListEntry, IRP, Tail.Overlay.ListEntry );
         NextIrpSp = IoGetCurrentIrpStackLocation( NextIrp );
         RecvReq = GetLockedData(NextIrp, NextIrpSp);
 
-        AFD_DbgPrint(MID_TRACE,("RecvReq: %p, DatagramRecv: %p\n",
-                                RecvReq, DatagramRecv));
+        if( IsBatchRecv( NextIrpSp ) ) {
+            AFD_DbgPrint(MID_TRACE,("Satisfying batch %p\n", RecvReq));
+            Status = SatisfyPacketRecvBatch( FCB, NextIrp );
+        } else {
+            ListEntry = RemoveHeadList( &FCB->DatagramList );
+            DatagramRecv = CONTAINING_RECORD( ListEntry, AFD_STORED_DATAGRAM,
+                                              ListEntry );
 
-        AFD_DbgPrint(MID_TRACE,("Satisfying\n"));
-        Status = SatisfyPacketRecvRequest
-        ( FCB, NextIrp, DatagramRecv,
-         (PUINT)&NextIrp->IoStatus.Information );
+            AFD_DbgPrint(MID_TRACE,("RecvReq: %p, DatagramRecv: %p\n",
+                                    RecvReq, DatagramRecv));
 
-        if (RecvReq->TdiFlags & TDI_RECEIVE_PEEK)
-        {
-            InsertHeadList(&FCB->DatagramList,
-                           &DatagramRecv->ListEntry);
+            AFD_DbgPrint(MID_TRACE,("Satisfying\n"));
+            Status = SatisfyPacketRecvRequest
+            ( FCB, NextIrp, DatagramRecv,
+             (PUINT)&NextIrp->IoStatus.Information );
+
+            if (RecvReq->TdiFlags & TDI_RECEIVE_PEEK)
+            {
+                InsertHeadList(&FCB->DatagramList,
+                               &DatagramRecv->ListEntry);
+            }
         }
 
         AFD_DbgPrint(MID_TRACE,("Unlocking\n"));
@@ -675,6 +1048,10 @@ PacketSocketRecvComplete(
         FCB->PollState &= ~AFD_EVENT_RECEIVE;
 
     if( NT_SUCCESS(Irp->IoStatus.Status) ) {
+        /* The window size changed while the transport had our buffer */
+        if (FCB->Recv.PendingSize)
+            AfdResizeRecvWindow(FCB, FCB->Recv.PendingSize);
+
         /* Now relaunch the datagram request */
         Status = TdiReceiveDatagram
             ( &FCB->ReceiveIrp.InFlightRequest,
@@ -710,6 +1087,7 @@ AfdPacketSocketReadData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
 
     FCB->EventSelectDisabled &= ~AFD_EVENT_RECEIVE;
+    NotifyRearm( FCB, AFD_EVENT_RECEIVE );
 
     /* Check that the socket is bound */
     if( FCB->State != SOCKET_STATE_BOUND )
@@ -780,3 +1158,84 @@ AfdPacketSocketReadData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         return LeaveIrpUntilLater( FCB, Irp, FUNCTION_RECV );
     }
 }
+
+/* recvfrom() for many datagrams at once.  Completes as soon as anything is
+ * queued, with whatever is queued by then. */
+NTSTATUS NTAPI
+AfdPacketSocketReadBatch(PDEVICE_OBJECT DeviceObject, PIRP Irp,
+                         PIO_STACK_LOCATION IrpSp ) {
+    NTSTATUS Status = STATUS_SUCCESS;
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PAFD_FCB FCB = FileObject->FsContext;
+    PAFD_RECV_DATAGRAMS_INFO RecvReq;
+    KPROCESSOR_MODE LockMode;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    AFD_DbgPrint(MID_TRACE,("Called on %p\n", FCB));
+
+    if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
+
+    FCB->EventSelectDisabled &= ~AFD_EVENT_RECEIVE;
+    NotifyRearm( FCB, AFD_EVENT_RECEIVE );
+
+    if( !(FCB->Flags & AFD_ENDPOINT_CONNECTIONLESS) ||
+        FCB->State != SOCKET_STATE_BOUND )
+    {
+        AFD_DbgPrint(MIN_TRACE,("Invalid socket state\n"));
+        return UnlockAndMaybeComplete(FCB, STATUS_INVALID_PARAMETER, Irp, 0);
+    }
+
+    if (FCB->TdiReceiveClosed)
+    {
+        AFD_DbgPrint(MIN_TRACE,("Receive closed\n"));
+        return UnlockAndMaybeComplete(FCB, STATUS_FILE_CLOSED, Irp, 0);
+    }
+
+    if( !(RecvReq = LockRequest( Irp, IrpSp, FALSE, &LockMode )) )
+        return UnlockAndMaybeComplete(FCB, STATUS_NO_MEMORY, Irp, 0);
+
+    if( RecvReq->BufferCount == 0 )
+        return UnlockAndMaybeComplete(FCB, STATUS_INVALID_PARAMETER, Irp, 0);
+
+    RecvReq->BufferArray = LockBuffers( RecvReq->BufferArray,
+                                        RecvReq->BufferCount,
+                                        NULL, NULL,
+                                        TRUE, FALSE, LockMode );
+
+    if( !RecvReq->BufferArray ) { /* access violation in userspace */
+        return UnlockAndMaybeComplete(FCB, STATUS_ACCESS_VIOLATION, Irp, 0);
+    }
+
+    if (!IsListEmpty(&FCB->DatagramList))
+    {
+        Status = SatisfyPacketRecvBatch(FCB, Irp);
+
+        if (!IsListEmpty(&FCB->DatagramList))
+        {
+            FCB->PollState |= AFD_EVENT_RECEIVE;
+            FCB->PollStatus[FD_READ_BIT] = STATUS_SUCCESS;
+            PollReeval( FCB->DeviceExt, FCB->FileObject );
+        }
+        else
+            FCB->PollState &= ~AFD_EVENT_RECEIVE;
+
+        UnlockBuffers(RecvReq->BufferArray, RecvReq->BufferCount, FALSE);
+
+        return UnlockAndMaybeComplete(FCB, Status, Irp, Irp->IoStatus.Information);
+    }
+    else if (!(RecvReq->AfdFlags & AFD_OVERLAPPED) &&
+            ((RecvReq->AfdFlags & AFD_IMMEDIATE) || (FCB->NonBlocking)))
+    {
+        AFD_DbgPrint(MID_TRACE,("Nonblocking\n"));
+        Status = STATUS_CANT_WAIT;
+        FCB->PollState &= ~AFD_EVENT_RECEIVE;
+        UnlockBuffers( RecvReq->BufferArray, RecvReq->BufferCount, FALSE );
+        return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+    }
+    else
+    {
+        FCB->PollState &= ~AFD_EVENT_RECEIVE;
+        return LeaveIrpUntilLater( FCB, Irp, FUNCTION_RECV );
+    }
+}
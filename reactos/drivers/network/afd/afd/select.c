@@ -376,6 +376,226 @@ AfdEnumEvents( PDEVICE_OBJECT DeviceObject, PIRP Irp,
     return UnlockAndMaybeComplete( FCB, STATUS_SUCCESS, Irp, 0 );
 }
 
+static USHORT NotifyEventsFromPollState( DWORD PollState ) {
+    USHORT Events = 0;
+
+    if( PollState & (AFD_EVENT_RECEIVE | AFD_EVENT_OOB_RECEIVE |
+                     AFD_EVENT_ACCEPT | AFD_EVENT_DISCONNECT) )
+        Events |= AFD_NOTIFY_EVENT_IN;
+    if( PollState & (AFD_EVENT_SEND | AFD_EVENT_CONNECT) )
+        Events |= AFD_NOTIFY_EVENT_OUT;
+    if( PollState & (AFD_EVENT_DISCONNECT | AFD_EVENT_ABORT | AFD_EVENT_CLOSE) )
+        Events |= AFD_NOTIFY_EVENT_HANGUP;
+    if( PollState & AFD_EVENT_CONNECT_FAIL )
+        Events |= AFD_NOTIFY_EVENT_ERR;
+
+    return Events;
+}
+
+/* * * NOTE CALLED WITH THE DEVICE EXTENSION LOCK HELD * * */
+static BOOLEAN PostNotify( PAFD_FCB FCB, PFILE_OBJECT FileObject, USHORT Events ) {
+    NTSTATUS Status;
+
+    /* The completion context stays until the file object is deleted */
+    Status = IoSetIoCompletion( FileObject->CompletionContext->Port,
+                                FCB->NotifyKey,
+                                NULL,
+                                STATUS_SUCCESS,
+                                Events,
+                                FALSE );
+    if( !NT_SUCCESS(Status) ) {
+        AFD_DbgPrint(MIN_TRACE,("Failed to post notification (0x%x)\n", Status));
+        return FALSE;
+    }
+
+    AFD_DbgPrint(MID_TRACE,("Posted %x for %p\n", Events, FCB));
+
+    /* A one shot registration is disabled until it is enabled again */
+    if( FCB->NotifyTriggers & AFD_NOTIFY_TRIGGER_ONESHOT )
+        FCB->NotifyEnabled = FALSE;
+
+    return TRUE;
+}
+
+/* * * NOTE CALLED WITH THE DEVICE EXTENSION LOCK HELD * * */
+static USHORT NotifyPendingEvents( PAFD_FCB FCB ) {
+    /* Errors are reported whatever the filter says */
+    return NotifyEventsFromPollState( FCB->PollState ) &
+           (FCB->NotifyFilter | AFD_NOTIFY_EVENT_ERR);
+}
+
+/* * * NOTE CALLED WITH THE DEVICE EXTENSION LOCK HELD * * */
+static VOID NotifyReadyEvents( PAFD_FCB FCB, PFILE_OBJECT FileObject ) {
+    USHORT Events, Post;
+
+    if( !FCB->NotifyRegistered ) return;
+
+    Events = NotifyPendingEvents( FCB );
+
+    /* An event that went away can be reported again when it comes back */
+    FCB->NotifyReported &= Events;
+
+    if( FCB->NotifyTriggers & AFD_NOTIFY_TRIGGER_EDGE ) {
+        /* Only the events that weren't pending at the last post */
+        Post = Events & ~FCB->NotifyReported;
+    } else {
+        /* One packet at a time until the registration is re-armed */
+        Post = FCB->NotifyReported ? 0 : Events;
+    }
+
+    if( !Post || !FCB->NotifyEnabled ) return;
+
+    if( PostNotify( FCB, FileObject, Post ) )
+        FCB->NotifyReported |= Post;
+}
+
+/* * * NOTE CALLED WITH THE DEVICE EXTENSION LOCK HELD * * */
+static VOID RemoveNotify( PAFD_FCB FCB, PFILE_OBJECT FileObject ) {
+    if( !FCB->NotifyRegistered ) return;
+
+    FCB->NotifyRegistered = FALSE;
+    FCB->NotifyEnabled = FALSE;
+    FCB->NotifyReported = 0;
+
+    /* This is the last notification the registration delivers */
+    PostNotify( FCB, FileObject, AFD_NOTIFY_EVENT_REMOVE );
+}
+
+VOID RemoveNotifyForFCB( PAFD_DEVICE_EXTENSION DeviceExt,
+                         PFILE_OBJECT FileObject ) {
+    PAFD_FCB FCB = FileObject->FsContext;
+    KIRQL OldIrql;
+
+    KeAcquireSpinLock( &DeviceExt->Lock, &OldIrql );
+    RemoveNotify( FCB, FileObject );
+    KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
+}
+
+/* The socket was serviced for PollEvents, so the registration may report
+ * them again. A level triggered one gets its next packet from here on */
+VOID NotifyRearm( PAFD_FCB FCB, DWORD PollEvents ) {
+    KIRQL OldIrql;
+
+    KeAcquireSpinLock( &FCB->DeviceExt->Lock, &OldIrql );
+    if( FCB->NotifyTriggers & AFD_NOTIFY_TRIGGER_LEVEL )
+        FCB->NotifyReported = 0;
+    else
+        FCB->NotifyReported &= ~NotifyEventsFromPollState( PollEvents );
+    KeReleaseSpinLock( &FCB->DeviceExt->Lock, OldIrql );
+}
+
+NTSTATUS NTAPI
+AfdSetNotify( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+              PIO_STACK_LOCATION IrpSp ) {
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PAFD_NOTIFY_INFO NotifyInfo =
+        (PAFD_NOTIFY_INFO)LockRequest( Irp, IrpSp, FALSE, NULL );
+    PAFD_FCB FCB = FileObject->FsContext;
+    PAFD_DEVICE_EXTENSION DeviceExt = DeviceObject->DeviceExtension;
+    PVOID Port;
+    UCHAR Triggers;
+    NTSTATUS Status;
+    KIRQL OldIrql;
+
+    if( !SocketAcquireStateLock( FCB ) ) {
+        return LostSocket( Irp );
+    }
+
+    if ( !NotifyInfo ) {
+         return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp,
+                                        0 );
+    }
+    AFD_DbgPrint(MID_TRACE,("Called (Key %p Filter %x Operation %x Triggers %x)\n",
+                            NotifyInfo->CompletionKey,
+                            NotifyInfo->EventFilter,
+                            NotifyInfo->Operation,
+                            NotifyInfo->TriggerFlags));
+
+    /* An enabled registration is one shot or persistent, and level or
+     * edge triggered */
+    Triggers = NotifyInfo->TriggerFlags;
+    switch( NotifyInfo->Operation ) {
+    case AFD_NOTIFY_OP_ENABLE:
+        if( (NotifyInfo->EventFilter & ~AFD_NOTIFY_EVENTS_ALL) ||
+            (Triggers & ~(AFD_NOTIFY_TRIGGER_ONESHOT | AFD_NOTIFY_TRIGGER_PERSISTENT |
+                          AFD_NOTIFY_TRIGGER_LEVEL | AFD_NOTIFY_TRIGGER_EDGE)) ||
+            ((Triggers & AFD_NOTIFY_TRIGGER_ONESHOT) != 0) ==
+            ((Triggers & AFD_NOTIFY_TRIGGER_PERSISTENT) != 0) ||
+            ((Triggers & AFD_NOTIFY_TRIGGER_LEVEL) != 0) ==
+            ((Triggers & AFD_NOTIFY_TRIGGER_EDGE) != 0) ) {
+            return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER,
+                                           Irp, 0 );
+        }
+        break;
+
+    case AFD_NOTIFY_OP_DISABLE:
+    case AFD_NOTIFY_OP_REMOVE:
+        if( !FCB->NotifyRegistered ) {
+            return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+        }
+        break;
+
+    default:
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER,
+                                       Irp, 0 );
+    }
+
+    /* Notifications go to the port the socket is associated with, so
+     * the caller has to name that one */
+    Status = ObReferenceObjectByHandle( NotifyInfo->CompletionPort,
+                                        IO_COMPLETION_MODIFY_STATE,
+                                        IoCompletionObjectType,
+                                        Irp->RequestorMode,
+                                        &Port,
+                                        NULL );
+    if( !NT_SUCCESS(Status) ) {
+        AFD_DbgPrint(MIN_TRACE,("Failed to reference port (0x%x)\n", Status));
+        return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+    }
+
+    if( !FileObject->CompletionContext ||
+        FileObject->CompletionContext->Port != Port ) {
+        ObDereferenceObject( Port );
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+    }
+
+    ObDereferenceObject( Port );
+
+    KeAcquireSpinLock( &DeviceExt->Lock, &OldIrql );
+
+    switch( NotifyInfo->Operation ) {
+    case AFD_NOTIFY_OP_ENABLE:
+        FCB->NotifyKey = NotifyInfo->CompletionKey;
+        FCB->NotifyFilter = NotifyInfo->EventFilter;
+        FCB->NotifyTriggers = Triggers;
+        FCB->NotifyRegistered = TRUE;
+        FCB->NotifyEnabled = TRUE;
+
+        /* Enabling re-arms the registration. A level triggered one reports
+         * a socket that is ready already, an edge triggered one waits for
+         * the next change */
+        if( Triggers & AFD_NOTIFY_TRIGGER_LEVEL )
+            FCB->NotifyReported = 0;
+        else
+            FCB->NotifyReported = NotifyPendingEvents( FCB );
+
+        NotifyReadyEvents( FCB, FileObject );
+        break;
+
+    case AFD_NOTIFY_OP_DISABLE:
+        FCB->NotifyEnabled = FALSE;
+        break;
+
+    case AFD_NOTIFY_OP_REMOVE:
+        RemoveNotify( FCB, FileObject );
+        break;
+    }
+
+    KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
+
+    return UnlockAndMaybeComplete( FCB, STATUS_SUCCESS, Irp, 0 );
+}
+
 /* * * NOTE ALWAYS CALLED AT DISPATCH_LEVEL * * */
 static BOOLEAN UpdatePollWithFCB( PAFD_ACTIVE_POLL Poll, PFILE_OBJECT FileObject ) {
     UINT i;
@@ -438,6 +658,10 @@ VOID PollReeval( PAFD_DEVICE_EXTENSION DeviceExt, PFILE_OBJECT FileObject ) {
             ThePollEnt = ThePollEnt->Flink;
     }
 
+    /* Then the registered notification, if this brought anything it
+     * hasn't reported yet */
+    NotifyReadyEvents( FCB, FileObject );
+
     KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
 
     if((FCB->EventSelect) &&
@@ -0,0 +1,646 @@
+/*
+ * COPYRIGHT:        See COPYING in the top level directory
+ * PROJECT:          ReactOS kernel
+ * FILE:             drivers/net/afd/afd/transmit.c
+ * PURPOSE:          Ancillary functions driver
+ * PROGRAMMER:       ReactOS Team
+ */
+
+#include "afd.h"
+
+/* Bytes given to the transport in one send unless the caller says */
+#define TRANSMIT_SEND_SIZE      0x10000
+#define TRANSMIT_MAX_SEND_SIZE  0x100000
+#define TRANSMIT_MAX_ELEMENTS   0x10000
+
+/* A transmit replaces its locked request with this.  Only the transmit
+ * at the head of the list is ever active; it is sent one piece at a time
+ * from a work item so files can be read at passive level. */
+typedef struct _AFD_TRANSMIT_CONTEXT {
+    PAFD_TRANSMIT_ELEMENT Elements;
+    PFILE_OBJECT *FileObjects;
+    PAFD_WSABUF BufferArray;
+    ULONG ElementCount;
+    ULONG SendSize;
+    ULONG Flags;
+
+    /* The element being sent and what is left of it */
+    ULONG Element;
+    BOOLEAN ElementStarted;
+    ULONGLONG Remaining;
+    LARGE_INTEGER FileOffset;
+
+    /* A cache manager read and the link of it being sent */
+    PMDL MdlChain;
+    PMDL ChainLink;
+    PFILE_OBJECT ChainFileObject;
+
+    /* Used when the file system can't hand out cache pages */
+    PVOID ReadBuffer;
+    PMDL ReadMdl;
+
+    /* Where the next piece comes from */
+    PMDL SourceMdl;
+    ULONG SourceOffset;
+    ULONG SourceLength;
+    PMDL PartialMdl;
+
+    ULONG BytesSent;
+    NTSTATUS Status;
+    BOOLEAN Active;
+    BOOLEAN Sending;
+    PIO_WORKITEM WorkItem;
+} AFD_TRANSMIT_CONTEXT, *PAFD_TRANSMIT_CONTEXT;
+
+static IO_WORKITEM_ROUTINE TransmitWorker;
+
+static VOID SetTransmitSource( PAFD_TRANSMIT_CONTEXT Transmit,
+                               PMDL Mdl, ULONG Length ) {
+    Transmit->SourceMdl = Mdl;
+    Transmit->SourceOffset = 0;
+    Transmit->SourceLength = Length;
+}
+
+static VOID FreePartialMdl( PAFD_TRANSMIT_CONTEXT Transmit ) {
+    if( Transmit->PartialMdl ) {
+        MmPrepareMdlForReuse( Transmit->PartialMdl );
+        IoFreeMdl( Transmit->PartialMdl );
+        Transmit->PartialMdl = NULL;
+    }
+}
+
+static VOID ReleaseCacheRead( PAFD_TRANSMIT_CONTEXT Transmit ) {
+    if( Transmit->MdlChain ) {
+        FsRtlMdlReadComplete( Transmit->ChainFileObject, Transmit->MdlChain );
+        Transmit->MdlChain = NULL;
+        Transmit->ChainLink = NULL;
+        Transmit->ChainFileObject = NULL;
+    }
+}
+
+/* Plain read into our own buffer for file systems without MDL reads */
+static NTSTATUS ReadTransmitBuffer( PAFD_TRANSMIT_CONTEXT Transmit,
+                                    PFILE_OBJECT FileObject,
+                                    PDEVICE_OBJECT DeviceObject,
+                                    ULONG Length,
+                                    PULONG BytesRead ) {
+    IO_STATUS_BLOCK IoStatus;
+    KEVENT Event;
+    PIRP ReadIrp;
+    NTSTATUS Status;
+
+    if( !Transmit->ReadBuffer ) {
+        Transmit->ReadBuffer = ExAllocatePool( NonPagedPool, Transmit->SendSize );
+        if( !Transmit->ReadBuffer ) return STATUS_INSUFFICIENT_RESOURCES;
+
+        Transmit->ReadMdl = IoAllocateMdl( Transmit->ReadBuffer,
+                                           Transmit->SendSize,
+                                           FALSE, FALSE, NULL );
+        if( !Transmit->ReadMdl ) return STATUS_INSUFFICIENT_RESOURCES;
+
+        MmBuildMdlForNonPagedPool( Transmit->ReadMdl );
+    }
+
+    KeInitializeEvent( &Event, NotificationEvent, FALSE );
+
+    ReadIrp = IoBuildSynchronousFsdRequest( IRP_MJ_READ,
+                                            DeviceObject,
+                                            Transmit->ReadBuffer,
+                                            Length,
+                                            &Transmit->FileOffset,
+                                            &Event,
+                                            &IoStatus );
+    if( !ReadIrp ) return STATUS_INSUFFICIENT_RESOURCES;
+
+    IoGetNextIrpStackLocation( ReadIrp )->FileObject = FileObject;
+
+    Status = IoCallDriver( DeviceObject, ReadIrp );
+    if( Status == STATUS_PENDING ) {
+        KeWaitForSingleObject( &Event, Executive, KernelMode, FALSE, NULL );
+        Status = IoStatus.Status;
+    }
+
+    if( Status == STATUS_END_OF_FILE ) {
+        *BytesRead = 0;
+        return STATUS_SUCCESS;
+    }
+
+    *BytesRead = (ULONG)IoStatus.Information;
+    return Status;
+}
+
+/* Reads the next stretch of a file element, from the cache if we can */
+static NTSTATUS ReadTransmitFile( PAFD_TRANSMIT_CONTEXT Transmit ) {
+    PFILE_OBJECT FileObject = Transmit->FileObjects[Transmit->Element];
+    PDEVICE_OBJECT DeviceObject = IoGetRelatedDeviceObject( FileObject );
+    PFAST_IO_DISPATCH FastIoDispatch = DeviceObject->DriverObject->FastIoDispatch;
+    ULONG Length = (ULONG)MIN( Transmit->Remaining, Transmit->SendSize );
+    IO_STATUS_BLOCK IoStatus;
+    PMDL MdlChain = NULL;
+    BOOLEAN Done = FALSE;
+    ULONG BytesRead;
+    NTSTATUS Status;
+
+    if( FastIoDispatch && FastIoDispatch->MdlRead ) {
+        Done = FastIoDispatch->MdlRead( FileObject, &Transmit->FileOffset,
+                                        Length, 0, &MdlChain, &IoStatus,
+                                        DeviceObject );
+    } else if( FastIoDispatch && FastIoDispatch->FastIoCheckIfPossible ) {
+        Done = FsRtlMdlReadDev( FileObject, &Transmit->FileOffset,
+                                Length, 0, &MdlChain, &IoStatus,
+                                DeviceObject );
+    }
+
+    if( Done && IoStatus.Status == STATUS_END_OF_FILE ) {
+        BytesRead = 0;
+    } else if( Done && NT_SUCCESS(IoStatus.Status) && MdlChain ) {
+        AFD_DbgPrint(MID_TRACE,("Cache read of %u bytes\n", IoStatus.Information));
+
+        Transmit->MdlChain = Transmit->ChainLink = MdlChain;
+        Transmit->ChainFileObject = FileObject;
+        SetTransmitSource( Transmit, MdlChain, MmGetMdlByteCount( MdlChain ) );
+        BytesRead = (ULONG)IoStatus.Information;
+    } else if( Done && !NT_SUCCESS(IoStatus.Status) ) {
+        return IoStatus.Status;
+    } else {
+        Status = ReadTransmitBuffer( Transmit, FileObject, DeviceObject,
+                                     Length, &BytesRead );
+        if( !NT_SUCCESS(Status) ) return Status;
+
+        SetTransmitSource( Transmit, Transmit->ReadMdl, BytesRead );
+    }
+
+    /* The file ended early, there is no more of this element */
+    if( BytesRead == 0 ) {
+        Transmit->Remaining = 0;
+        return STATUS_SUCCESS;
+    }
+
+    Transmit->FileOffset.QuadPart += BytesRead;
+    Transmit->Remaining -= BytesRead;
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS StartTransmitElement( PAFD_TRANSMIT_CONTEXT Transmit ) {
+    PAFD_TRANSMIT_ELEMENT Element = &Transmit->Elements[Transmit->Element];
+    FILE_STANDARD_INFORMATION StandardInfo;
+    ULONG Length;
+    NTSTATUS Status;
+
+    Transmit->ElementStarted = TRUE;
+    Transmit->Remaining = Element->Length;
+
+    if( !(Element->Flags & AFD_TP_FILE) ) return STATUS_SUCCESS;
+
+    Transmit->FileOffset = Element->FileOffset;
+
+    /* No length means the rest of the file */
+    if( !Element->Length ) {
+        Status = IoQueryFileInformation( Transmit->FileObjects[Transmit->Element],
+                                         FileStandardInformation,
+                                         sizeof(StandardInfo),
+                                         &StandardInfo,
+                                         &Length );
+        if( !NT_SUCCESS(Status) ) return Status;
+
+        if( StandardInfo.EndOfFile.QuadPart > Transmit->FileOffset.QuadPart )
+            Transmit->Remaining = StandardInfo.EndOfFile.QuadPart -
+                Transmit->FileOffset.QuadPart;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/* Finds the next piece to send and describes it with a partial mdl.  A
+ * length of zero means the whole transmit went out. */
+static NTSTATUS NextTransmitPiece( PAFD_TRANSMIT_CONTEXT Transmit,
+                                   PULONG Length ) {
+    PAFD_MAPBUF Map = (PAFD_MAPBUF)(Transmit->BufferArray + Transmit->ElementCount);
+    PCHAR VirtualAddress;
+    NTSTATUS Status;
+
+    *Length = 0;
+
+    while( Transmit->SourceOffset == Transmit->SourceLength ) {
+        /* The transport only looks at the first mdl of a send, so a
+         * cache read goes out one link at a time */
+        if( Transmit->ChainLink && Transmit->ChainLink->Next ) {
+            Transmit->ChainLink = Transmit->ChainLink->Next;
+            SetTransmitSource( Transmit, Transmit->ChainLink,
+                               MmGetMdlByteCount( Transmit->ChainLink ) );
+            continue;
+        }
+
+        ReleaseCacheRead( Transmit );
+
+        if( Transmit->Element == Transmit->ElementCount )
+            return STATUS_SUCCESS;
+
+        if( !Transmit->ElementStarted ) {
+            Status = StartTransmitElement( Transmit );
+            if( !NT_SUCCESS(Status) ) return Status;
+        }
+
+        if( !Transmit->Remaining ) {
+            Transmit->Element++;
+            Transmit->ElementStarted = FALSE;
+            continue;
+        }
+
+        if( Transmit->Elements[Transmit->Element].Flags & AFD_TP_FILE ) {
+            Status = ReadTransmitFile( Transmit );
+            if( !NT_SUCCESS(Status) ) return Status;
+        } else {
+            /* Memory was locked up front and goes out as it is */
+            SetTransmitSource( Transmit, Map[Transmit->Element].Mdl,
+                               (ULONG)Transmit->Remaining );
+            Transmit->Remaining = 0;
+        }
+    }
+
+    *Length = MIN( Transmit->SourceLength - Transmit->SourceOffset,
+                   Transmit->SendSize );
+
+    VirtualAddress = (PCHAR)MmGetMdlVirtualAddress( Transmit->SourceMdl ) +
+        Transmit->SourceOffset;
+
+    Transmit->PartialMdl = IoAllocateMdl( VirtualAddress, *Length,
+                                          FALSE, FALSE, NULL );
+    if( !Transmit->PartialMdl ) return STATUS_INSUFFICIENT_RESOURCES;
+
+    IoBuildPartialMdl( Transmit->SourceMdl, Transmit->PartialMdl,
+                       VirtualAddress, *Length );
+
+    return STATUS_SUCCESS;
+}
+
+static VOID FinishTransmit( PAFD_FCB FCB, PIRP Irp, NTSTATUS Status ) {
+    PAFD_TRANSMIT_CONTEXT Transmit = Irp->Tail.Overlay.DriverContext[0];
+    ULONG Flags = Transmit->Flags;
+
+    AFD_DbgPrint(MID_TRACE,("Transmit %p done, %u bytes, status %x\n",
+                            Irp, Transmit->BytesSent, Status));
+
+    RemoveEntryList( &Irp->Tail.Overlay.ListEntry );
+    (void)IoSetCancelRoutine(Irp, NULL);
+
+    Irp->IoStatus.Status = Status;
+    Irp->IoStatus.Information = Transmit->BytesSent;
+
+    CleanupTransmit( Irp );
+
+    if( NT_SUCCESS(Status) && (Flags & AFD_TF_DISCONNECT) &&
+        !FCB->DisconnectPending ) {
+        /* Close our side the way shutdown() does, the irp completes
+         * with the disconnect */
+        FCB->DisconnectFlags = TDI_DISCONNECT_RELEASE;
+        FCB->DisconnectTimeout.QuadPart = -1000000;
+        FCB->DisconnectPending = TRUE;
+        FCB->DisconnectReuse = (Flags & AFD_TF_REUSE_SOCKET) != 0;
+        FCB->SendClosed = TRUE;
+        FCB->PollState &= ~AFD_EVENT_SEND;
+
+        InsertTailList( &FCB->PendingIrpList[FUNCTION_DISCONNECT],
+                        &Irp->Tail.Overlay.ListEntry );
+    } else {
+        UnlockRequest( Irp, IoGetCurrentIrpStackLocation( Irp ) );
+        IoCompleteRequest( Irp, IO_NETWORK_INCREMENT );
+    }
+
+    RestartSend( FCB );
+}
+
+static IO_COMPLETION_ROUTINE TransmitSendComplete;
+static NTSTATUS NTAPI TransmitSendComplete
+( PDEVICE_OBJECT DeviceObject,
+  PIRP Irp,
+  PVOID Context ) {
+    PIRP TransmitIrp = Context;
+    PAFD_FCB FCB = IoGetCurrentIrpStackLocation( TransmitIrp )->FileObject->FsContext;
+    PAFD_TRANSMIT_CONTEXT Transmit = TransmitIrp->Tail.Overlay.DriverContext[0];
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    AFD_DbgPrint(MID_TRACE,("Called, status %x, %u bytes sent\n",
+                            Irp->IoStatus.Status,
+                            Irp->IoStatus.Information));
+
+    /* The partial mdl is still ours, whatever happened to the socket */
+    Irp->MdlAddress = NULL;
+
+    if( !SocketAcquireStateLock( FCB ) )
+        return STATUS_FILE_CLOSED;
+
+    ASSERT(FCB->SendIrp.InFlightRequest == Irp);
+    FCB->SendIrp.InFlightRequest = NULL;
+    Transmit->Sending = FALSE;
+
+    Transmit->Status = Irp->IoStatus.Status;
+    if( NT_SUCCESS(Irp->IoStatus.Status) ) {
+        Transmit->SourceOffset += Irp->IoStatus.Information;
+        Transmit->BytesSent += Irp->IoStatus.Information;
+
+        /* Don't spin on a transport that stopped taking data */
+        if( !Irp->IoStatus.Information )
+            Transmit->Status = STATUS_UNEXPECTED_NETWORK_ERROR;
+    }
+
+    IoQueueWorkItem( Transmit->WorkItem, TransmitWorker,
+                     DelayedWorkQueue, TransmitIrp );
+
+    SocketStateUnlock( FCB );
+
+    return STATUS_SUCCESS;
+}
+
+static VOID NTAPI TransmitWorker( PDEVICE_OBJECT DeviceObject,
+                                  PVOID Context ) {
+    PIRP Irp = Context;
+    PAFD_FCB FCB = IoGetCurrentIrpStackLocation( Irp )->FileObject->FsContext;
+    PAFD_TRANSMIT_CONTEXT Transmit = Irp->Tail.Overlay.DriverContext[0];
+    NTSTATUS Status = Transmit->Status;
+    ULONG Length = 0;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    FreePartialMdl( Transmit );
+
+    /* Reading the file can take a while, keep the socket unlocked */
+    if( NT_SUCCESS(Status) && !Irp->Cancel )
+        Status = NextTransmitPiece( Transmit, &Length );
+
+    if( !SocketAcquireStateLock( FCB ) ) return;
+
+    if( Irp->Cancel )
+        Status = STATUS_CANCELLED;
+
+    if( NT_SUCCESS(Status) && Length ) {
+        ASSERT(!FCB->SendIrp.InFlightRequest);
+        Transmit->Sending = TRUE;
+
+        Status = TdiSendMdl( &FCB->SendIrp.InFlightRequest,
+                             FCB->Connection.Object,
+                             0,
+                             Transmit->PartialMdl,
+                             Length,
+                             TransmitSendComplete,
+                             Irp );
+
+        if( Status == STATUS_PENDING ) {
+            SocketStateUnlock( FCB );
+            return;
+        }
+
+        Transmit->Sending = FALSE;
+    }
+
+    FinishTransmit( FCB, Irp, Status );
+
+    SocketStateUnlock( FCB );
+}
+
+/* Starts the transmit at the head of the list unless it runs already */
+VOID StartTransmit( PAFD_FCB FCB ) {
+    PIRP Irp;
+    PAFD_TRANSMIT_CONTEXT Transmit;
+
+    ASSERT(!IsListEmpty(&FCB->PendingIrpList[FUNCTION_TRANSMIT]));
+
+    Irp = CONTAINING_RECORD(FCB->PendingIrpList[FUNCTION_TRANSMIT].Flink,
+                            IRP, Tail.Overlay.ListEntry);
+    Transmit = Irp->Tail.Overlay.DriverContext[0];
+
+    if( Transmit->Active ) return;
+
+    AFD_DbgPrint(MID_TRACE,("Starting transmit %p\n", Irp));
+
+    Transmit->Active = TRUE;
+    IoQueueWorkItem( Transmit->WorkItem, TransmitWorker,
+                     DelayedWorkQueue, Irp );
+}
+
+/* An active transmit can't just be pulled off the list, so we stop its
+ * send and let the worker complete it */
+BOOLEAN CancelActiveTransmit( PAFD_FCB FCB, PIRP Irp ) {
+    PAFD_TRANSMIT_CONTEXT Transmit = Irp->Tail.Overlay.DriverContext[0];
+
+    if( !Transmit->Active ) return FALSE;
+
+    if( Transmit->Sending && FCB->SendIrp.InFlightRequest )
+        IoCancelIrp( FCB->SendIrp.InFlightRequest );
+
+    return TRUE;
+}
+
+/* Frees what the transmit holds.  The context itself goes with the irp. */
+VOID CleanupTransmit( PIRP Irp ) {
+    PAFD_TRANSMIT_CONTEXT Transmit = Irp->Tail.Overlay.DriverContext[0];
+    UINT i;
+
+    FreePartialMdl( Transmit );
+    ReleaseCacheRead( Transmit );
+
+    if( Transmit->ReadMdl ) {
+        IoFreeMdl( Transmit->ReadMdl );
+        Transmit->ReadMdl = NULL;
+    }
+
+    if( Transmit->ReadBuffer ) {
+        ExFreePool( Transmit->ReadBuffer );
+        Transmit->ReadBuffer = NULL;
+    }
+
+    if( Transmit->BufferArray ) {
+        UnlockBuffers( Transmit->BufferArray, Transmit->ElementCount, FALSE );
+        Transmit->BufferArray = NULL;
+    }
+
+    if( Transmit->FileObjects ) {
+        for( i = 0; i < Transmit->ElementCount; i++ ) {
+            if( Transmit->FileObjects[i] )
+                ObDereferenceObject( Transmit->FileObjects[i] );
+        }
+        ExFreePool( Transmit->FileObjects );
+        Transmit->FileObjects = NULL;
+    }
+
+    if( Transmit->Elements ) {
+        ExFreePool( Transmit->Elements );
+        Transmit->Elements = NULL;
+    }
+
+    if( Transmit->WorkItem ) {
+        IoFreeWorkItem( Transmit->WorkItem );
+        Transmit->WorkItem = NULL;
+    }
+}
+
+/* Takes the elements from the caller, references the files and locks
+ * the memory so nothing has to be touched in the caller's context later */
+static NTSTATUS LockTransmitElements( PAFD_TRANSMIT_CONTEXT Transmit,
+                                      PAFD_TRANSMIT_ELEMENT ElementArray,
+                                      PIRP Irp,
+                                      KPROCESSOR_MODE LockMode ) {
+    PAFD_WSABUF Buffers;
+    NTSTATUS Status = STATUS_SUCCESS;
+    UINT i;
+
+    Transmit->Elements = ExAllocatePool( PagedPool,
+        Transmit->ElementCount * sizeof(AFD_TRANSMIT_ELEMENT) );
+    if( !Transmit->Elements ) return STATUS_NO_MEMORY;
+
+    _SEH2_TRY {
+        if( Irp->RequestorMode != KernelMode )
+            ProbeForRead( ElementArray,
+                          Transmit->ElementCount * sizeof(AFD_TRANSMIT_ELEMENT),
+                          sizeof(ULONG) );
+        RtlCopyMemory( Transmit->Elements, ElementArray,
+                       Transmit->ElementCount * sizeof(AFD_TRANSMIT_ELEMENT) );
+    } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+        AFD_DbgPrint(MIN_TRACE,("Access violation copying transmit elements\n"));
+        Status = _SEH2_GetExceptionCode();
+    } _SEH2_END;
+
+    if( !NT_SUCCESS(Status) ) return Status;
+
+    Transmit->FileObjects = ExAllocatePool( PagedPool,
+        Transmit->ElementCount * sizeof(PFILE_OBJECT) );
+    if( !Transmit->FileObjects ) return STATUS_NO_MEMORY;
+
+    RtlZeroMemory( Transmit->FileObjects,
+                   Transmit->ElementCount * sizeof(PFILE_OBJECT) );
+
+    Buffers = ExAllocatePool( PagedPool,
+        Transmit->ElementCount * sizeof(AFD_WSABUF) );
+    if( !Buffers ) return STATUS_NO_MEMORY;
+
+    for( i = 0; i < Transmit->ElementCount; i++ ) {
+        PAFD_TRANSMIT_ELEMENT Element = &Transmit->Elements[i];
+
+        Buffers[i].buf = NULL;
+        Buffers[i].len = 0;
+
+        if( Element->Flags == AFD_TP_FILE ) {
+            Status = ObReferenceObjectByHandle( Element->FileHandle,
+                                                FILE_READ_DATA,
+                                                *IoFileObjectType,
+                                                Irp->RequestorMode,
+                                                (PVOID *)&Transmit->FileObjects[i],
+                                                NULL );
+            if( !NT_SUCCESS(Status) ) break;
+
+            if( Element->FileOffset.QuadPart < 0 ) {
+                Status = STATUS_INVALID_PARAMETER;
+                break;
+            }
+        } else if( Element->Flags == AFD_TP_MEMORY ) {
+            if( Element->Length && !Element->Buffer ) {
+                Status = STATUS_INVALID_PARAMETER;
+                break;
+            }
+
+            Buffers[i].buf = Element->Buffer;
+            Buffers[i].len = Element->Length;
+        } else {
+            Status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+    }
+
+    if( NT_SUCCESS(Status) ) {
+        Transmit->BufferArray = LockBuffers( Buffers, Transmit->ElementCount,
+                                             NULL, NULL,
+                                             FALSE, FALSE, LockMode );
+        if( !Transmit->BufferArray ) Status = STATUS_ACCESS_VIOLATION;
+    }
+
+    ExFreePool( Buffers );
+
+    return Status;
+}
+
+NTSTATUS NTAPI
+AfdTransmitPackets(PDEVICE_OBJECT DeviceObject, PIRP Irp,
+                   PIO_STACK_LOCATION IrpSp) {
+    NTSTATUS Status;
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PAFD_FCB FCB = FileObject->FsContext;
+    PAFD_TRANSMIT_INFO TransmitReq;
+    PAFD_TRANSMIT_CONTEXT Transmit;
+    PAFD_TRANSMIT_ELEMENT ElementArray;
+    KPROCESSOR_MODE LockMode;
+
+    AFD_DbgPrint(MID_TRACE,("Called on %p\n", FCB));
+
+    if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
+
+    FCB->EventSelectDisabled &= ~AFD_EVENT_SEND;
+    NotifyRearm( FCB, AFD_EVENT_SEND );
+
+    if( IrpSp->Parameters.DeviceIoControl.InputBufferLength < sizeof(*TransmitReq) )
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+
+    if( !(TransmitReq = LockRequest( Irp, IrpSp, FALSE, &LockMode )) )
+        return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp, 0 );
+
+    if( (FCB->Flags & AFD_ENDPOINT_CONNECTIONLESS) ||
+        FCB->State != SOCKET_STATE_CONNECTED ) {
+        AFD_DbgPrint(MIN_TRACE,("Socket not connected\n"));
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_CONNECTION, Irp, 0 );
+    }
+
+    if( FCB->PollState & (AFD_EVENT_CLOSE | AFD_EVENT_ABORT) ) {
+        AFD_DbgPrint(MIN_TRACE,("Connection is gone\n"));
+        return UnlockAndMaybeComplete( FCB, FCB->PollStatus[FD_CLOSE_BIT], Irp, 0 );
+    }
+
+    if( FCB->SendClosed ) {
+        AFD_DbgPrint(MIN_TRACE,("No more sends\n"));
+        return UnlockAndMaybeComplete( FCB, STATUS_FILE_CLOSED, Irp, 0 );
+    }
+
+    if( !TransmitReq->ElementCount ||
+        TransmitReq->ElementCount > TRANSMIT_MAX_ELEMENTS ) {
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+    }
+
+    Transmit = ExAllocatePool( NonPagedPool, sizeof(*Transmit) );
+    if( !Transmit )
+        return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp, 0 );
+
+    RtlZeroMemory( Transmit, sizeof(*Transmit) );
+
+    ElementArray = TransmitReq->ElementArray;
+    Transmit->ElementCount = TransmitReq->ElementCount;
+    Transmit->Flags = TransmitReq->Flags;
+    Transmit->SendSize = TransmitReq->SendSize ?
+        MIN( TransmitReq->SendSize, TRANSMIT_MAX_SEND_SIZE ) : TRANSMIT_SEND_SIZE;
+    Transmit->Status = STATUS_SUCCESS;
+
+    /* From here on the context is what we keep for the irp */
+    ExFreePool( Irp->Tail.Overlay.DriverContext[0] );
+    Irp->Tail.Overlay.DriverContext[0] = Transmit;
+
+    Transmit->WorkItem = IoAllocateWorkItem( DeviceObject );
+    if( !Transmit->WorkItem ) {
+        Status = STATUS_NO_MEMORY;
+    } else {
+        Status = LockTransmitElements( Transmit, ElementArray, Irp, LockMode );
+    }
+
+    if( !NT_SUCCESS(Status) ) {
+        CleanupTransmit( Irp );
+        return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+    }
+
+    FCB->PollState &= ~AFD_EVENT_SEND;
+
+    Status = QueueUserModeIrp( FCB, Irp, FUNCTION_TRANSMIT );
+    if( Status == STATUS_PENDING )
+        RestartSend( FCB );
+
+    SocketStateUnlock( FCB );
+
+    return Status;
+}
@@ -11,6 +11,337 @@
 #include "afd.h"
 
 static IO_COMPLETION_ROUTINE SendComplete;
+static IO_COMPLETION_ROUTINE DirectSendComplete;
+
+/* Completes every send still queued, the stream can't continue after them */
+static VOID FailPendingSends( PAFD_FCB FCB, NTSTATUS Status ) {
+    PLIST_ENTRY NextIrpEntry;
+    PIRP NextIrp;
+    PIO_STACK_LOCATION NextIrpSp;
+    PAFD_SEND_INFO SendReq;
+
+    while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_SEND] ) ) {
+        NextIrpEntry = RemoveHeadList(&FCB->PendingIrpList[FUNCTION_SEND]);
+        NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
+        NextIrpSp = IoGetCurrentIrpStackLocation( NextIrp );
+        SendReq = GetLockedData(NextIrp, NextIrpSp);
+
+        UnlockBuffers( SendReq->BufferArray,
+                       SendReq->BufferCount,
+                       FALSE );
+
+        NextIrp->IoStatus.Status = Status;
+        NextIrp->IoStatus.Information = 0;
+
+        if ( NextIrp->MdlAddress ) UnlockRequest( NextIrp, NextIrpSp );
+        (void)IoSetCancelRoutine(NextIrp, NULL);
+        IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
+    }
+}
+
+static UINT GetSendLength( PAFD_SEND_INFO SendReq ) {
+    UINT SendLength = 0, i;
+
+    for (i = 0; i < SendReq->BufferCount; i++)
+    {
+        SendLength += SendReq->BufferArray[i].len;
+    }
+
+    return SendLength;
+}
+
+/* The send queue holds the requests whose data is in our buffer, followed
+ * by the ones still waiting for room (DriverContext[3] is zero for those).
+ * New sends have to queue up behind a waiting one to keep the stream in
+ * order. */
+static BOOLEAN SendsAreWaiting( PAFD_FCB FCB ) {
+    PIRP LastIrp;
+
+    if( IsListEmpty( &FCB->PendingIrpList[FUNCTION_SEND] ) ) return FALSE;
+
+    LastIrp = CONTAINING_RECORD(FCB->PendingIrpList[FUNCTION_SEND].Blink,
+                                IRP, Tail.Overlay.ListEntry);
+
+    return LastIrp->Tail.Overlay.DriverContext[3] == NULL;
+}
+
+/* A send that can wait and won't fit in our buffer anyway goes out from the
+ * caller's buffers instead of through ours */
+static BOOLEAN CanSendDirect( PAFD_FCB FCB, PAFD_SEND_INFO SendReq, UINT SendLength ) {
+    if( SendLength <= FCB->Send.Size ) return FALSE;
+
+    /* Non-blocking sends take what fits and complete */
+    if( !(SendReq->AfdFlags & AFD_OVERLAPPED) &&
+        ((SendReq->AfdFlags & AFD_IMMEDIATE) || FCB->NonBlocking) )
+        return FALSE;
+
+    return TRUE;
+}
+
+static PMDL ChainSendBuffers( PAFD_SEND_INFO SendReq ) {
+    PAFD_MAPBUF Map = (PAFD_MAPBUF)(SendReq->BufferArray + SendReq->BufferCount);
+    PMDL First = NULL, Last = NULL;
+    UINT i;
+
+    for( i = 0; i < SendReq->BufferCount; i++ ) {
+        if( !Map[i].Mdl ) continue;
+
+        if( Last ) Last->Next = Map[i].Mdl;
+        else First = Map[i].Mdl;
+        Last = Map[i].Mdl;
+    }
+
+    return First;
+}
+
+static VOID UnchainSendBuffers( PAFD_SEND_INFO SendReq ) {
+    PAFD_MAPBUF Map = (PAFD_MAPBUF)(SendReq->BufferArray + SendReq->BufferCount);
+    UINT i;
+
+    for( i = 0; i < SendReq->BufferCount; i++ ) {
+        if( Map[i].Mdl ) Map[i].Mdl->Next = NULL;
+    }
+}
+
+/* Copies the waiting sends into our buffer, as many as fit, so the next
+ * TdiSend takes all of them at once.  A blocking send that would fit in
+ * an empty buffer waits for the room, and so does everything behind it. */
+static VOID CopyWaitingSends( PAFD_FCB FCB ) {
+    PLIST_ENTRY NextIrpEntry;
+    PIRP NextIrp;
+    PIO_STACK_LOCATION NextIrpSp;
+    PAFD_SEND_INFO SendReq;
+    PAFD_MAPBUF Map;
+    UINT TotalBytesCopied, SpaceAvail, SendLength, BytesCopied, i;
+
+    NextIrpEntry = FCB->PendingIrpList[FUNCTION_SEND].Flink;
+    while( NextIrpEntry != &FCB->PendingIrpList[FUNCTION_SEND] ) {
+        NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
+        NextIrpEntry = NextIrpEntry->Flink;
+
+        /* Already in our buffer */
+        if( NextIrp->Tail.Overlay.DriverContext[3] ) continue;
+
+        NextIrpSp = IoGetCurrentIrpStackLocation( NextIrp );
+        SendReq = GetLockedData(NextIrp, NextIrpSp);
+        Map = (PAFD_MAPBUF)(SendReq->BufferArray + SendReq->BufferCount);
+
+        AFD_DbgPrint(MID_TRACE,("SendReq @ %p\n", SendReq));
+
+        SpaceAvail = FCB->Send.Size - FCB->Send.BytesUsed;
+        SendLength = GetSendLength( SendReq );
+
+        /* RestartSend sends this one straight from the caller's buffers
+         * once our buffer is empty */
+        if( CanSendDirect( FCB, SendReq, SendLength ) )
+            break;
+
+        /* Make sure we've got the space */
+        if( SendLength > SpaceAvail ) {
+            /* Blocking sockets have to wait here */
+            if( SendLength <= FCB->Send.Size &&
+                !((SendReq->AfdFlags & AFD_IMMEDIATE) || (FCB->NonBlocking)) )
+                break;
+
+            /* Check if we can send anything */
+            if( SpaceAvail == 0 )
+                break;
+        }
+
+        TotalBytesCopied = 0;
+        for( i = 0; SpaceAvail > 0 && i < SendReq->BufferCount; i++ ) {
+            if( !Map[i].Mdl ) continue;
+
+            BytesCopied = MIN(SendReq->BufferArray[i].len, SpaceAvail);
+
+            Map[i].BufferAddress =
+               MmMapLockedPages( Map[i].Mdl, KernelMode );
+
+            RtlCopyMemory( FCB->Send.Window + FCB->Send.BytesUsed,
+                           Map[i].BufferAddress,
+                           BytesCopied );
+
+            MmUnmapLockedPages( Map[i].BufferAddress, Map[i].Mdl );
+
+            TotalBytesCopied += BytesCopied;
+            SpaceAvail -= BytesCopied;
+            FCB->Send.BytesUsed += BytesCopied;
+        }
+
+        NextIrp->IoStatus.Information = TotalBytesCopied;
+        NextIrp->Tail.Overlay.DriverContext[3] = (PVOID)NextIrp->IoStatus.Information;
+
+        if( TotalBytesCopied == 0 ) {
+            /* Nothing to send, so there is nothing to wait for either */
+            RemoveEntryList( &NextIrp->Tail.Overlay.ListEntry );
+            UnlockBuffers( SendReq->BufferArray, SendReq->BufferCount, FALSE );
+            NextIrp->IoStatus.Status = STATUS_SUCCESS;
+            if( NextIrp->MdlAddress ) UnlockRequest( NextIrp, NextIrpSp );
+            (void)IoSetCancelRoutine(NextIrp, NULL);
+            IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
+        }
+    }
+}
+
+static VOID UpdateSendPollState( PAFD_FCB FCB ) {
+    if (FCB->Send.Size - FCB->Send.BytesUsed != 0 && !FCB->SendClosed &&
+        IsListEmpty(&FCB->PendingIrpList[FUNCTION_SEND]) && !FCB->DirectSendIrp)
+    {
+        FCB->PollState |= AFD_EVENT_SEND;
+        FCB->PollStatus[FD_WRITE_BIT] = STATUS_SUCCESS;
+        PollReeval( FCB->DeviceExt, FCB->FileObject );
+    }
+    else
+    {
+        FCB->PollState &= ~AFD_EVENT_SEND;
+    }
+}
+
+/* Hands the send at the head of the queue to the transport as one chain of
+ * the caller's MDLs.  Only used while nothing else is being sent, our
+ * buffer is empty then, so the data stays in order. */
+static BOOLEAN SendDirect( PAFD_FCB FCB ) {
+    PIRP NextIrp;
+    PIO_STACK_LOCATION NextIrpSp;
+    PAFD_SEND_INFO SendReq;
+    PMDL Mdl;
+    UINT SendLength;
+    NTSTATUS Status;
+
+    if( FCB->SendIrp.InFlightRequest || FCB->Send.BytesUsed ) return FALSE;
+    if( FCB->State != SOCKET_STATE_CONNECTED ) return FALSE;
+    if( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_TRANSMIT] ) ) return FALSE;
+    if( IsListEmpty( &FCB->PendingIrpList[FUNCTION_SEND] ) ) return FALSE;
+
+    NextIrp = CONTAINING_RECORD(FCB->PendingIrpList[FUNCTION_SEND].Flink,
+                                IRP, Tail.Overlay.ListEntry);
+    if( NextIrp->Tail.Overlay.DriverContext[3] ) return FALSE;
+
+    NextIrpSp = IoGetCurrentIrpStackLocation( NextIrp );
+    SendReq = GetLockedData(NextIrp, NextIrpSp);
+    SendLength = GetSendLength( SendReq );
+
+    if( !CanSendDirect( FCB, SendReq, SendLength ) ) return FALSE;
+
+    Mdl = ChainSendBuffers( SendReq );
+    if( !Mdl ) return FALSE;
+
+    AFD_DbgPrint(MID_TRACE,("Sending directly from %p (%u)\n", NextIrp, SendLength));
+
+    RemoveEntryList( &NextIrp->Tail.Overlay.ListEntry );
+    FCB->DirectSendIrp = NextIrp;
+
+    Status = TdiSendMdl( &FCB->SendIrp.InFlightRequest,
+                         FCB->Connection.Object,
+                         0,
+                         Mdl,
+                         SendLength,
+                         DirectSendComplete,
+                         FCB );
+    if( Status != STATUS_PENDING ) {
+        FCB->DirectSendIrp = NULL;
+        UnchainSendBuffers( SendReq );
+        UnlockBuffers( SendReq->BufferArray, SendReq->BufferCount, FALSE );
+        NextIrp->IoStatus.Status = Status;
+        NextIrp->IoStatus.Information = 0;
+        if( NextIrp->MdlAddress ) UnlockRequest( NextIrp, NextIrpSp );
+        (void)IoSetCancelRoutine(NextIrp, NULL);
+        IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Called from the cancel routine.  The transport finishes a direct send,
+ * with whatever it has taken from the buffers. */
+BOOLEAN CancelDirectSend( PAFD_FCB FCB, PIRP Irp ) {
+    if( FCB->DirectSendIrp != Irp ) return FALSE;
+
+    if( FCB->SendIrp.InFlightRequest )
+        IoCancelIrp( FCB->SendIrp.InFlightRequest );
+
+    return TRUE;
+}
+
+static NTSTATUS NTAPI DirectSendComplete
+( PDEVICE_OBJECT DeviceObject,
+  PIRP Irp,
+  PVOID Context ) {
+    NTSTATUS Status = Irp->IoStatus.Status;
+    PAFD_FCB FCB = (PAFD_FCB)Context;
+    PIRP NextIrp;
+    PIO_STACK_LOCATION NextIrpSp;
+    PAFD_SEND_INFO SendReq;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    AFD_DbgPrint(MID_TRACE,("Called, status %x, %u bytes sent\n",
+                            Irp->IoStatus.Status,
+                            Irp->IoStatus.Information));
+
+    /* The MDLs belong to the user request, don't let the I/O manager free
+     * them, whatever happened to the socket */
+    Irp->MdlAddress = NULL;
+
+    if( !SocketAcquireStateLock( FCB ) )
+        return STATUS_FILE_CLOSED;
+
+    ASSERT(FCB->SendIrp.InFlightRequest == Irp);
+    FCB->SendIrp.InFlightRequest = NULL;
+
+    NextIrp = FCB->DirectSendIrp;
+    FCB->DirectSendIrp = NULL;
+
+    if( NextIrp ) {
+        NextIrpSp = IoGetCurrentIrpStackLocation( NextIrp );
+        SendReq = GetLockedData(NextIrp, NextIrpSp);
+
+        UnchainSendBuffers( SendReq );
+        UnlockBuffers( SendReq->BufferArray, SendReq->BufferCount, FALSE );
+
+        /* Like a send bigger than our buffer, this completes with what
+         * the transport took */
+        NextIrp->IoStatus.Status = Status;
+        NextIrp->IoStatus.Information = Irp->IoStatus.Information;
+        if( NextIrp->MdlAddress ) UnlockRequest( NextIrp, NextIrpSp );
+        (void)IoSetCancelRoutine(NextIrp, NULL);
+        IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
+    }
+
+    if( FCB->State == SOCKET_STATE_CLOSED ) {
+        /* Cleanup our IRP queue because the FCB is being destroyed */
+        FailPendingSends( FCB, STATUS_FILE_CLOSED );
+        RetryDisconnectCompletion(FCB);
+        SocketStateUnlock( FCB );
+        return STATUS_FILE_CLOSED;
+    }
+
+    if( !NT_SUCCESS(Status) ) {
+        /* Complete all following send IRPs with error */
+        FailPendingSends( FCB, Status );
+
+        /* A waiting transmit finds out about the error itself */
+        if( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_TRANSMIT] ) )
+            StartTransmit(FCB);
+        else
+            RetryDisconnectCompletion(FCB);
+
+        SocketStateUnlock( FCB );
+        return STATUS_SUCCESS;
+    }
+
+    CopyWaitingSends( FCB );
+    UpdateSendPollState( FCB );
+
+    /* Send what is waiting or try to complete a pending disconnect */
+    RestartSend(FCB);
+
+    SocketStateUnlock( FCB );
+
+    return STATUS_SUCCESS;
+}
+
 static NTSTATUS NTAPI SendComplete
 ( PDEVICE_OBJECT DeviceObject,
   PIRP Irp,
@@ -21,10 +352,8 @@ static NTSTATUS NTAPI SendComplete
     PIRP NextIrp = NULL;
     PIO_STACK_LOCATION NextIrpSp;
     PAFD_SEND_INFO SendReq = NULL;
-    PAFD_MAPBUF Map;
-    UINT TotalBytesCopied = 0, TotalBytesProcessed = 0, SpaceAvail, i;
-    UINT SendLength, BytesCopied;
-    BOOLEAN HaltSendQueue;
+    UINT TotalBytesCopied = 0, TotalBytesProcessed = 0;
+    UINT SendLength;
 
     UNREFERENCED_PARAMETER(DeviceObject);
 
@@ -50,18 +379,7 @@ static NTSTATUS NTAPI SendComplete
 
     if( FCB->State == SOCKET_STATE_CLOSED ) {
         /* Cleanup our IRP queue because the FCB is being destroyed */
-        while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_SEND] ) ) {
-            NextIrpEntry = RemoveHeadList(&FCB->PendingIrpList[FUNCTION_SEND]);
-            NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
-            NextIrpSp = IoGetCurrentIrpStackLocation( NextIrp );
-            SendReq = GetLockedData(NextIrp, NextIrpSp);
-            NextIrp->IoStatus.Status = STATUS_FILE_CLOSED;
-            NextIrp->IoStatus.Information = 0;
-            UnlockBuffers(SendReq->BufferArray, SendReq->BufferCount, FALSE);
-            if( NextIrp->MdlAddress ) UnlockRequest( NextIrp, IoGetCurrentIrpStackLocation( NextIrp ) );
-            (void)IoSetCancelRoutine(NextIrp, NULL);
-            IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
-        }
+        FailPendingSends( FCB, STATUS_FILE_CLOSED );
 
         RetryDisconnectCompletion(FCB);
 
@@ -71,28 +389,13 @@ static NTSTATUS NTAPI SendComplete
 
     if( !NT_SUCCESS(Status) ) {
         /* Complete all following send IRPs with error */
+        FailPendingSends( FCB, Status );
 
-        while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_SEND] ) ) {
-            NextIrpEntry =
-                RemoveHeadList(&FCB->PendingIrpList[FUNCTION_SEND]);
-            NextIrp =
-                CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
-            NextIrpSp = IoGetCurrentIrpStackLocation( NextIrp );
-            SendReq = GetLockedData(NextIrp, NextIrpSp);
-
-            UnlockBuffers( SendReq->BufferArray,
-                           SendReq->BufferCount,
-                           FALSE );
-
-            NextIrp->IoStatus.Status = Status;
-            NextIrp->IoStatus.Information = 0;
-
-            if ( NextIrp->MdlAddress ) UnlockRequest( NextIrp, IoGetCurrentIrpStackLocation( NextIrp ) );
-            (void)IoSetCancelRoutine(NextIrp, NULL);
-            IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
-        }
-
-        RetryDisconnectCompletion(FCB);
+        /* A waiting transmit finds out about the error itself */
+        if( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_TRANSMIT] ) )
+            StartTransmit(FCB);
+        else
+            RetryDisconnectCompletion(FCB);
 
         SocketStateUnlock( FCB );
 
@@ -105,13 +408,11 @@ static NTSTATUS NTAPI SendComplete
 
     TotalBytesProcessed = 0;
     SendLength = Irp->IoStatus.Information;
-    HaltSendQueue = FALSE;
     while (!IsListEmpty(&FCB->PendingIrpList[FUNCTION_SEND]) && SendLength > 0) {
         NextIrpEntry = RemoveHeadList(&FCB->PendingIrpList[FUNCTION_SEND]);
         NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
         NextIrpSp = IoGetCurrentIrpStackLocation( NextIrp );
         SendReq = GetLockedData(NextIrp, NextIrpSp);
-        Map = (PAFD_MAPBUF)(SendReq->BufferArray + SendReq->BufferCount);
 
         TotalBytesCopied = (ULONG_PTR)NextIrp->Tail.Overlay.DriverContext[3];
         ASSERT(TotalBytesCopied != 0);
@@ -131,7 +432,6 @@ static NTSTATUS NTAPI SendComplete
             /* Pend the IRP */
             InsertHeadList(&FCB->PendingIrpList[FUNCTION_SEND],
                            &NextIrp->Tail.Overlay.ListEntry);
-            HaltSendQueue = TRUE;
             break;
         }
 
@@ -156,105 +456,141 @@ static NTSTATUS NTAPI SendComplete
 
     ASSERT(SendLength == 0);
 
-   if ( !HaltSendQueue && !IsListEmpty( &FCB->PendingIrpList[FUNCTION_SEND] ) ) {
-        NextIrpEntry = FCB->PendingIrpList[FUNCTION_SEND].Flink;
-        NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
-        NextIrpSp = IoGetCurrentIrpStackLocation( NextIrp );
-        SendReq = GetLockedData(NextIrp, NextIrpSp);
-        Map = (PAFD_MAPBUF)(SendReq->BufferArray + SendReq->BufferCount);
+    /* Everything that fits now goes out with the next send */
+    CopyWaitingSends( FCB );
+    UpdateSendPollState( FCB );
 
-        AFD_DbgPrint(MID_TRACE,("SendReq @ %p\n", SendReq));
+    /* Send what is still waiting or try to complete a pending disconnect */
+    RestartSend(FCB);
 
-        SpaceAvail = FCB->Send.Size - FCB->Send.BytesUsed;
-        TotalBytesCopied = 0;
+    SocketStateUnlock( FCB );
 
-        /* Count the total transfer size */
-        SendLength = 0;
-        for (i = 0; i < SendReq->BufferCount; i++)
-        {
-            SendLength += SendReq->BufferArray[i].len;
-        }
+    return STATUS_SUCCESS;
+}
 
-        /* Make sure we've got the space */
-        if (SendLength > SpaceAvail)
-        {
-           /* Blocking sockets have to wait here */
-           if (SendLength <= FCB->Send.Size && !((SendReq->AfdFlags & AFD_IMMEDIATE) || (FCB->NonBlocking)))
-           {
-               FCB->PollState &= ~AFD_EVENT_SEND;
+/* Keeps the send path going once nothing is in flight.  Buffered data
+ * goes out before a transmit starts and data buffered while a transmit
+ * runs waits for it to finish. */
+VOID RestartSend( PAFD_FCB FCB ) {
+    if( FCB->SendIrp.InFlightRequest ) return;
 
-               NextIrp = NULL;
-           }
+    /* The window size changed while the transport had our buffer */
+    if( FCB->Send.PendingSize )
+        AfdResizeSendWindow( FCB, FCB->Send.PendingSize );
 
-           /* Check if we can send anything */
-           if (SpaceAvail == 0)
-           {
-               FCB->PollState &= ~AFD_EVENT_SEND;
+    /* Some data is still waiting */
+    if( FCB->Send.BytesUsed )
+    {
+        TdiSend( &FCB->SendIrp.InFlightRequest,
+                 FCB->Connection.Object,
+                 0,
+                 FCB->Send.Window,
+                 FCB->Send.BytesUsed,
+                 SendComplete,
+                 FCB );
+    }
+    else if( SendDirect(FCB) )
+    {
+        /* A big send went out from the caller's buffers */
+    }
+    else if( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_TRANSMIT] ) )
+    {
+        StartTransmit(FCB);
+    }
+    else
+    {
+        /* Nothing is waiting so try to complete a pending disconnect */
+        RetryDisconnectCompletion(FCB);
+    }
+}
 
-               /* We should never be non-overlapped and get to this point */
-               ASSERT(SendReq->AfdFlags & AFD_OVERLAPPED);
+/* Sends the data that came with a super connect.  The irp completes from
+ * SendComplete like any other send once that data is out. */
+VOID SendConnectData( PAFD_FCB FCB, PIRP Irp ) {
+    PAFD_SEND_INFO SendReq = GetLockedData(Irp, IoGetCurrentIrpStackLocation(Irp));
+    PAFD_MAPBUF Map = (PAFD_MAPBUF)(SendReq->BufferArray + SendReq->BufferCount);
+    UINT BytesCopied = 0;
 
-               NextIrp = NULL;
-           }
-        }
+    if( Map[0].Mdl ) {
+        BytesCopied = MIN(SendReq->BufferArray[0].len,
+                          FCB->Send.Size - FCB->Send.BytesUsed);
 
-        if (NextIrp != NULL)
-        {
-            for( i = 0; i < SendReq->BufferCount; i++ ) {
-                BytesCopied = MIN(SendReq->BufferArray[i].len, SpaceAvail);
+        Map[0].BufferAddress = MmMapLockedPages( Map[0].Mdl, KernelMode );
 
-                Map[i].BufferAddress =
-                   MmMapLockedPages( Map[i].Mdl, KernelMode );
+        RtlCopyMemory( FCB->Send.Window + FCB->Send.BytesUsed,
+                       Map[0].BufferAddress,
+                       BytesCopied );
 
-                RtlCopyMemory( FCB->Send.Window + FCB->Send.BytesUsed,
-                               Map[i].BufferAddress,
-                               BytesCopied );
+        MmUnmapLockedPages( Map[0].BufferAddress, Map[0].Mdl );
 
-                MmUnmapLockedPages( Map[i].BufferAddress, Map[i].Mdl );
+        FCB->Send.BytesUsed += BytesCopied;
+    }
 
-                TotalBytesCopied += BytesCopied;
-                SpaceAvail -= BytesCopied;
-                FCB->Send.BytesUsed += BytesCopied;
-            }
+    AFD_DbgPrint(MID_TRACE,("Sending %u bytes of connect data\n", BytesCopied));
 
-            NextIrp->IoStatus.Information = TotalBytesCopied;
-            NextIrp->Tail.Overlay.DriverContext[3] = (PVOID)NextIrp->IoStatus.Information;
-        }
+    if( BytesCopied == 0 ) {
+        UnlockBuffers( SendReq->BufferArray, SendReq->BufferCount, FALSE );
+        Irp->IoStatus.Status = STATUS_SUCCESS;
+        Irp->IoStatus.Information = 0;
+        UnlockRequest( Irp, IoGetCurrentIrpStackLocation( Irp ) );
+        (void)IoSetCancelRoutine(Irp, NULL);
+        IoCompleteRequest( Irp, IO_NETWORK_INCREMENT );
+        return;
     }
 
-    if (FCB->Send.Size - FCB->Send.BytesUsed != 0 && !FCB->SendClosed &&
-        IsListEmpty(&FCB->PendingIrpList[FUNCTION_SEND]))
-    {
-        FCB->PollState |= AFD_EVENT_SEND;
-        FCB->PollStatus[FD_WRITE_BIT] = STATUS_SUCCESS;
-        PollReeval( FCB->DeviceExt, FCB->FileObject );
-    }
-    else
-    {
-        FCB->PollState &= ~AFD_EVENT_SEND;
-    }
+    Irp->IoStatus.Information = BytesCopied;
+    Irp->Tail.Overlay.DriverContext[3] = (PVOID)Irp->IoStatus.Information;
 
+    InsertTailList( &FCB->PendingIrpList[FUNCTION_SEND],
+                    &Irp->Tail.Overlay.ListEntry );
 
-    /* Some data is still waiting */
-    if( FCB->Send.BytesUsed )
+    if( !FCB->SendIrp.InFlightRequest )
     {
-        Status = TdiSend( &FCB->SendIrp.InFlightRequest,
-                          FCB->Connection.Object,
-                          0,
-                          FCB->Send.Window,
-                          FCB->Send.BytesUsed,
-                          SendComplete,
-                          FCB );
+        TdiSend(&FCB->SendIrp.InFlightRequest,
+                FCB->Connection.Object,
+                0,
+                FCB->Send.Window,
+                FCB->Send.BytesUsed,
+                SendComplete,
+                FCB);
     }
-    else
-    {
-        /* Nothing is waiting so try to complete a pending disconnect */
-        RetryDisconnectCompletion(FCB);
+}
+
+/* The transport takes a datagram as one buffer, so one that comes in pieces
+ * is put together first.  The copy belongs to the send request and stays in
+ * DriverContext[3] until the request completes. */
+static PCHAR GatherDatagram( PIRP Irp, PAFD_WSABUF BufferArray,
+                             UINT BufferCount, PUINT Length ) {
+    PCHAR Datagram;
+    UINT i, Offset = 0;
+
+    Irp->Tail.Overlay.DriverContext[3] = NULL;
+
+    *Length = 0;
+    for( i = 0; i < BufferCount; i++ )
+        *Length += BufferArray[i].len;
+
+    if( BufferCount == 1 || *Length == 0 )
+        return BufferArray[0].buf;
+
+    Datagram = ExAllocatePool( NonPagedPool, *Length );
+    if( !Datagram ) return NULL;
+
+    for( i = 0; i < BufferCount; i++ ) {
+        RtlCopyMemory( Datagram + Offset, BufferArray[i].buf, BufferArray[i].len );
+        Offset += BufferArray[i].len;
     }
 
-    SocketStateUnlock( FCB );
+    Irp->Tail.Overlay.DriverContext[3] = Datagram;
 
-    return STATUS_SUCCESS;
+    return Datagram;
+}
+
+static VOID FreeGatheredDatagram( PIRP Irp ) {
+    if( Irp->Tail.Overlay.DriverContext[3] ) {
+        ExFreePool( Irp->Tail.Overlay.DriverContext[3] );
+        Irp->Tail.Overlay.DriverContext[3] = NULL;
+    }
 }
 
 static IO_COMPLETION_ROUTINE PacketSocketSendComplete;
@@ -289,6 +625,7 @@ static NTSTATUS NTAPI PacketSocketSendComplete
             NextIrp->IoStatus.Status = STATUS_FILE_CLOSED;
             NextIrp->IoStatus.Information = 0;
             (void)IoSetCancelRoutine(NextIrp, NULL);
+            FreeGatheredDatagram(NextIrp);
             UnlockBuffers(SendReq->BufferArray, SendReq->BufferCount, FALSE);
             UnlockRequest( NextIrp, IoGetCurrentIrpStackLocation( NextIrp ) );
             IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
@@ -310,6 +647,8 @@ static NTSTATUS NTAPI PacketSocketSendComplete
 
     (void)IoSetCancelRoutine(NextIrp, NULL);
 
+    FreeGatheredDatagram(NextIrp);
+
     UnlockBuffers(SendReq->BufferArray, SendReq->BufferCount, FALSE);
 
     UnlockRequest(NextIrp, IoGetCurrentIrpStackLocation(NextIrp));
@@ -343,11 +682,14 @@ AfdConnectedSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
 
     FCB->EventSelectDisabled &= ~AFD_EVENT_SEND;
+    NotifyRearm( FCB, AFD_EVENT_SEND );
 
     if( FCB->Flags & AFD_ENDPOINT_CONNECTIONLESS )
     {
         PAFD_SEND_INFO_UDP SendReq;
         PTDI_CONNECTION_INFORMATION TargetAddress;
+        PCHAR Datagram;
+        UINT DatagramLength;
 
         /* Check that the socket is bound */
         if( FCB->State != SOCKET_STATE_BOUND || !FCB->RemoteAddress )
@@ -379,19 +721,25 @@ AfdConnectedSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
             Status = QueueUserModeIrp(FCB, Irp, FUNCTION_SEND);
             if (Status == STATUS_PENDING)
             {
-                Status = TdiSendDatagram(&FCB->SendIrp.InFlightRequest,
-                                         FCB->AddressFile.Object,
-                                         SendReq->BufferArray[0].buf,
-                                         SendReq->BufferArray[0].len,
-                                         TargetAddress,
-                                         PacketSocketSendComplete,
-                                         FCB);
+                Datagram = GatherDatagram(Irp, SendReq->BufferArray,
+                                          SendReq->BufferCount, &DatagramLength);
+                if (!Datagram)
+                    Status = STATUS_INSUFFICIENT_RESOURCES;
+                else
+                    Status = TdiSendDatagram(&FCB->SendIrp.InFlightRequest,
+                                             FCB->AddressFile.Object,
+                                             Datagram,
+                                             DatagramLength,
+                                             TargetAddress,
+                                             PacketSocketSendComplete,
+                                             FCB);
                 if (Status != STATUS_PENDING)
                 {
                     NT_VERIFY(RemoveHeadList(&FCB->PendingIrpList[FUNCTION_SEND]) == &Irp->Tail.Overlay.ListEntry);
                     Irp->IoStatus.Status = Status;
                     Irp->IoStatus.Information = 0;
                     (void)IoSetCancelRoutine(Irp, NULL);
+                    FreeGatheredDatagram(Irp);
                     UnlockBuffers(SendReq->BufferArray, SendReq->BufferCount, FALSE);
                     UnlockRequest(Irp, IoGetCurrentIrpStackLocation(Irp));
                     IoCompleteRequest(Irp, IO_NETWORK_INCREMENT);
@@ -460,21 +808,36 @@ AfdConnectedSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     AFD_DbgPrint(MID_TRACE,("FCB->Send.BytesUsed = %u\n",
                             FCB->Send.BytesUsed));
 
-    SpaceAvail = FCB->Send.Size - FCB->Send.BytesUsed;
+    /* Our buffer is only open to this send once the ones before it are in */
+    if (SendsAreWaiting(FCB) || FCB->DirectSendIrp)
+        SpaceAvail = 0;
+    else
+        SpaceAvail = FCB->Send.Size - FCB->Send.BytesUsed;
 
     AFD_DbgPrint(MID_TRACE,("We can accept %u bytes\n",
                             SpaceAvail));
 
     /* Count the total transfer size */
-    SendLength = 0;
-    for (i = 0; i < SendReq->BufferCount; i++)
-    {
-        SendLength += SendReq->BufferArray[i].len;
-    }
+    SendLength = GetSendLength(SendReq);
 
     /* Make sure we've got the space */
     if (SendLength > SpaceAvail)
     {
+        /* Waiting is marked by DriverContext[3] being zero */
+        Irp->Tail.Overlay.DriverContext[3] = NULL;
+
+        /* A big send waits for the connection to go quiet, then goes out
+         * from the caller's buffers */
+        if (CanSendDirect(FCB, SendReq, SendLength))
+        {
+            FCB->PollState &= ~AFD_EVENT_SEND;
+            Status = QueueUserModeIrp(FCB, Irp, FUNCTION_SEND);
+            if (Status == STATUS_PENDING)
+                SendDirect(FCB);
+            SocketStateUnlock(FCB);
+            return Status;
+        }
+
         /* Blocking sockets have to wait here */
         if (SendLength <= FCB->Send.Size && !((SendReq->AfdFlags & AFD_IMMEDIATE) || (FCB->NonBlocking)))
         {
@@ -543,8 +906,10 @@ AfdConnectedSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     /* We use the IRP tail for some temporary storage here */
     Irp->Tail.Overlay.DriverContext[3] = (PVOID)Irp->IoStatus.Information;
 
+    /* A running transmit owns the connection until it is done */
     Status = QueueUserModeIrp(FCB, Irp, FUNCTION_SEND);
-    if (Status == STATUS_PENDING && !FCB->SendIrp.InFlightRequest)
+    if (Status == STATUS_PENDING && !FCB->SendIrp.InFlightRequest &&
+        IsListEmpty(&FCB->PendingIrpList[FUNCTION_TRANSMIT]))
     {
         TdiSend(&FCB->SendIrp.InFlightRequest,
                 FCB->Connection.Object,
@@ -569,6 +934,8 @@ AfdPacketSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     PAFD_FCB FCB = FileObject->FsContext;
     PAFD_SEND_INFO_UDP SendReq;
     KPROCESSOR_MODE LockMode;
+    PCHAR Datagram;
+    UINT DatagramLength;
 
     UNREFERENCED_PARAMETER(DeviceObject);
 
@@ -577,6 +944,7 @@ AfdPacketSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
 
     FCB->EventSelectDisabled &= ~AFD_EVENT_SEND;
+    NotifyRearm( FCB, AFD_EVENT_SEND );
 
     /* Check that the socket is bound */
     if( FCB->State != SOCKET_STATE_BOUND &&
@@ -641,19 +1009,25 @@ AfdPacketSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         Status = QueueUserModeIrp(FCB, Irp, FUNCTION_SEND);
         if (Status == STATUS_PENDING)
         {
-            Status = TdiSendDatagram(&FCB->SendIrp.InFlightRequest,
-                                     FCB->AddressFile.Object,
-                                     SendReq->BufferArray[0].buf,
-                                     SendReq->BufferArray[0].len,
-                                     TargetAddress,
-                                     PacketSocketSendComplete,
-                                     FCB);
+            Datagram = GatherDatagram(Irp, SendReq->BufferArray,
+                                      SendReq->BufferCount, &DatagramLength);
+            if (!Datagram)
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+            else
+                Status = TdiSendDatagram(&FCB->SendIrp.InFlightRequest,
+                                         FCB->AddressFile.Object,
+                                         Datagram,
+                                         DatagramLength,
+                                         TargetAddress,
+                                         PacketSocketSendComplete,
+                                         FCB);
             if (Status != STATUS_PENDING)
             {
                 NT_VERIFY(RemoveHeadList(&FCB->PendingIrpList[FUNCTION_SEND]) == &Irp->Tail.Overlay.ListEntry);
                 Irp->IoStatus.Status = Status;
                 Irp->IoStatus.Information = 0;
                 (void)IoSetCancelRoutine(Irp, NULL);
+                FreeGatheredDatagram(Irp);
                 UnlockBuffers(SendReq->BufferArray, SendReq->BufferCount, FALSE);
                 UnlockRequest(Irp, IoGetCurrentIrpStackLocation(Irp));
                 IoCompleteRequest(Irp, IO_NETWORK_INCREMENT);
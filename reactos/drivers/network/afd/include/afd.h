@@ -31,6 +31,24 @@
 #define MIN(x,y) (((x)<(y))?(x):(y))
 #endif
 
+#ifndef IO_COMPLETION_MODIFY_STATE
+#define IO_COMPLETION_MODIFY_STATE 0x0002
+#endif
+
+/* Exported by the kernel but missing from our DDK headers */
+extern POBJECT_TYPE NTSYSAPI IoCompletionObjectType;
+
+NTKERNELAPI
+NTSTATUS
+NTAPI
+IoSetIoCompletion(
+    IN PVOID IoCompletion,
+    IN PVOID KeyContext,
+    IN PVOID ApcContext,
+    IN NTSTATUS IoStatus,
+    IN ULONG_PTR IoStatusInformation,
+    IN BOOLEAN Quota);
+
 #define TL_INSTANCE 0
 #define	IP_MIB_STATS_ID 1
 #define	IP_MIB_ADDRTABLE_ENTRY_ID 0x102
@@ -70,7 +88,8 @@ typedef struct IPADDR_ENTRY {
 #define FUNCTION_ACCEPT                 4
 #define FUNCTION_DISCONNECT             5
 #define FUNCTION_CLOSE                  6
-#define MAX_FUNCTIONS                   7
+#define FUNCTION_TRANSMIT               7
+#define MAX_FUNCTIONS                   8
 
 #define IN_FLIGHT_REQUESTS              5
 
@@ -131,15 +150,43 @@ typedef struct _AFD_IN_FLIGHT_REQUEST {
 typedef struct _AFD_DATA_WINDOW {
     PCHAR Window;
     UINT BytesUsed, Size, Content;
+    UINT PendingSize; /* Set while the transport uses the window */
 } AFD_DATA_WINDOW, *PAFD_DATA_WINDOW;
 
+/* The sender's address is stored right after the data */
 typedef struct _AFD_STORED_DATAGRAM {
     LIST_ENTRY ListEntry;
     UINT Len;
+    BOOLEAN InRing;
     PTRANSPORT_ADDRESS Address;
     CHAR Buffer[1];
 } AFD_STORED_DATAGRAM, *PAFD_STORED_DATAGRAM;
 
+/* Slots for small datagrams, so a busy datagram socket doesn't allocate
+ * for every packet.  Datagrams are received in the order they are queued,
+ * so the slots are handed out and given back in order as well.  A ring
+ * starts small and grows while the socket keeps it full, up to what the
+ * receive window holds. */
+#define AFD_DATAGRAM_SLOT_SIZE 2048
+#define AFD_DATAGRAM_RING_MIN_SLOTS 4
+#define AFD_DATAGRAM_RING_MAX_SLOTS 32
+
+typedef struct _AFD_DATAGRAM_RING {
+    UINT Head, Count, SlotCount;
+    BOOLEAN Overflowed;
+    PCHAR Slots;
+} AFD_DATAGRAM_RING, *PAFD_DATAGRAM_RING;
+
+/* A super accept replaces its locked request with this.  Once the
+ * connection is accepted it waits on the new socket like any receive. */
+typedef struct _AFD_SUPER_ACCEPT_REQUEST {
+    AFD_RECV_INFO RecvInfo;
+    PFILE_OBJECT AcceptFileObject;
+    ULONG ReceiveDataLength;
+    ULONG LocalAddressLength;
+    ULONG RemoteAddressLength;
+} AFD_SUPER_ACCEPT_REQUEST, *PAFD_SUPER_ACCEPT_REQUEST;
+
 typedef struct _AFD_FCB {
     BOOLEAN Locked, Critical, Overread, NonBlocking, OobInline, TdiReceiveClosed, SendClosed;
     UINT State, Flags, GroupID, GroupType;
@@ -152,16 +199,24 @@ typedef struct _AFD_FCB {
     UINT ConnSeq;
     USHORT DisconnectFlags;
     BOOLEAN DisconnectPending;
+    BOOLEAN DisconnectReuse;
     LARGE_INTEGER DisconnectTimeout;
     PTRANSPORT_ADDRESS LocalAddress, RemoteAddress;
     PTDI_CONNECTION_INFORMATION AddressFrom, ConnectCallInfo, ConnectReturnInfo;
     AFD_TDI_OBJECT AddressFile, Connection;
     AFD_IN_FLIGHT_REQUEST ConnectIrp, ListenIrp, ReceiveIrp, SendIrp, DisconnectIrp;
     AFD_DATA_WINDOW Send, Recv;
+    PIRP DirectRecvIrp;
+    PIRP DirectSendIrp;
     KMUTEX Mutex;
     PKEVENT EventSelect;
     DWORD EventSelectTriggers;
     DWORD EventSelectDisabled;
+    PVOID NotifyKey;
+    USHORT NotifyFilter;
+    UCHAR NotifyTriggers;
+    USHORT NotifyReported;
+    BOOLEAN NotifyRegistered, NotifyEnabled;
     UNICODE_STRING TdiDeviceName;
     PVOID Context;
     DWORD PollState;
@@ -182,6 +237,7 @@ typedef struct _AFD_FCB {
     UINT DisconnectOptionsSize;
     LIST_ENTRY PendingIrpList[MAX_FUNCTIONS];
     LIST_ENTRY DatagramList;
+    PAFD_DATAGRAM_RING DatagramRing;
     LIST_ENTRY PendingConnections;
 } AFD_FCB, *PAFD_FCB;
 
@@ -240,6 +296,10 @@ NTSTATUS NTAPI
 AfdSetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
 	    PIO_STACK_LOCATION IrpSp );
 
+NTSTATUS AfdResizeRecvWindow( PAFD_FCB FCB, UINT Size );
+
+NTSTATUS AfdResizeSendWindow( PAFD_FCB FCB, UINT Size );
+
 NTSTATUS NTAPI
 AfdGetSockName( PDEVICE_OBJECT DeviceObject, PIRP Irp,
                 PIO_STACK_LOCATION IrpSp );
@@ -258,6 +318,9 @@ NTSTATUS AfdListenSocket(PDEVICE_OBJECT DeviceObject, PIRP Irp,
 NTSTATUS AfdAccept( PDEVICE_OBJECT DeviceObject, PIRP Irp,
 		    PIO_STACK_LOCATION IrpSp );
 
+NTSTATUS AfdSuperAccept( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+			 PIO_STACK_LOCATION IrpSp );
+
 /* lock.c */
 
 PAFD_WSABUF LockBuffers( PAFD_WSABUF Buf, UINT Count,
@@ -298,6 +361,12 @@ AfdConnectedSocketReadData(PDEVICE_OBJECT DeviceObject, PIRP Irp, PIO_STACK_LOCA
 NTSTATUS NTAPI
 AfdPacketSocketReadData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
 			PIO_STACK_LOCATION IrpSp );
+NTSTATUS NTAPI
+AfdPacketSocketReadBatch(PDEVICE_OBJECT DeviceObject, PIRP Irp,
+			 PIO_STACK_LOCATION IrpSp );
+VOID FreeStoredDatagram( PAFD_FCB FCB, PAFD_STORED_DATAGRAM DatagramRecv );
+VOID QueueAcceptReceive( PAFD_FCB FCB, PIRP Irp );
+BOOLEAN CancelDirectReceive( PAFD_FCB FCB, PIRP Irp );
 
 /* select.c */
 
@@ -310,6 +379,12 @@ AfdEventSelect( PDEVICE_OBJECT DeviceObject, PIRP Irp,
 NTSTATUS NTAPI
 AfdEnumEvents( PDEVICE_OBJECT DeviceObject, PIRP Irp,
 	       PIO_STACK_LOCATION IrpSp );
+NTSTATUS NTAPI
+AfdSetNotify( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+	      PIO_STACK_LOCATION IrpSp );
+VOID RemoveNotifyForFCB( PAFD_DEVICE_EXTENSION DeviceExt,
+                         PFILE_OBJECT FileObject );
+VOID NotifyRearm( PAFD_FCB FCB, DWORD PollEvents );
 VOID PollReeval( PAFD_DEVICE_EXTENSION DeviceObject, PFILE_OBJECT FileObject );
 VOID KillSelectsForFCB( PAFD_DEVICE_EXTENSION DeviceExt,
                         PFILE_OBJECT FileObject, BOOLEAN ExclusiveOnly );
@@ -352,6 +427,15 @@ NTSTATUS TdiReceive
   PIO_COMPLETION_ROUTINE  CompletionRoutine,
   PVOID CompletionContext);
 
+NTSTATUS TdiReceiveMdl
+( PIRP *Irp,
+  PFILE_OBJECT ConnectionObject,
+  USHORT Flags,
+  PMDL Mdl,
+  UINT BufferLength,
+  PIO_COMPLETION_ROUTINE  CompletionRoutine,
+  PVOID CompletionContext);
+
 NTSTATUS TdiSend
 ( PIRP *Irp,
   PFILE_OBJECT ConnectionObject,
@@ -361,6 +445,15 @@ NTSTATUS TdiSend
   PIO_COMPLETION_ROUTINE  CompletionRoutine,
   PVOID CompletionContext);
 
+NTSTATUS TdiSendMdl
+( PIRP *Irp,
+  PFILE_OBJECT ConnectionObject,
+  USHORT Flags,
+  PMDL Mdl,
+  UINT BufferLength,
+  PIO_COMPLETION_ROUTINE  CompletionRoutine,
+  PVOID CompletionContext);
+
 NTSTATUS TdiReceiveDatagram(
     PIRP *Irp,
     PFILE_OBJECT TransportObject,
@@ -384,6 +477,15 @@ NTSTATUS TdiQueryMaxDatagramLength(
         PFILE_OBJECT FileObject,
         PUINT MaxDatagramLength);
 
+/* transmit.c */
+
+NTSTATUS NTAPI
+AfdTransmitPackets(PDEVICE_OBJECT DeviceObject, PIRP Irp,
+		   PIO_STACK_LOCATION IrpSp);
+VOID StartTransmit( PAFD_FCB FCB );
+BOOLEAN CancelActiveTransmit( PAFD_FCB FCB, PIRP Irp );
+VOID CleanupTransmit( PIRP Irp );
+
 /* write.c */
 
 NTSTATUS NTAPI
@@ -392,5 +494,8 @@ AfdConnectedSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
 NTSTATUS NTAPI
 AfdPacketSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
 			 PIO_STACK_LOCATION IrpSp);
+VOID SendConnectData( PAFD_FCB FCB, PIRP Irp );
+BOOLEAN CancelDirectSend( PAFD_FCB FCB, PIRP Irp );
+VOID RestartSend( PAFD_FCB FCB );
 
 #endif /* _AFD_H */
@@ -0,0 +1,876 @@
+/*
+ * PROJECT:     ReactOS Virtio Network Driver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        drivers/network/dd/vionet/hardware.c
+ * PURPOSE:     Device setup, virtqueues and the control queue
+ * PROGRAMMERS: ReactOS Team
+ */
+
+#include "nic.h"
+
+#define NDEBUG
+#include <debug.h>
+
+static
+NDIS_STATUS
+NICAllocateSharedMemory (
+    IN PVIONET_ADAPTER Adapter,
+    IN ULONG Length,
+    OUT PVIONET_SHARED_MEMORY Memory
+    )
+{
+    //
+    // Virtio devices see guest memory through the host's caches,
+    // so there is no reason to map any of it uncached
+    //
+    Memory->Length = Length;
+    NdisMAllocateSharedMemory(Adapter->MiniportAdapterHandle,
+                              Length,
+                              TRUE,
+                              &Memory->VirtualAddress,
+                              &Memory->PhysicalAddress);
+    if (Memory->VirtualAddress == NULL)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Unable to allocate %d bytes of shared memory\n", Length));
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    NdisZeroMemory(Memory->VirtualAddress, Length);
+    return NDIS_STATUS_SUCCESS;
+}
+
+static
+VOID
+NICFreeSharedMemory (
+    IN PVIONET_ADAPTER Adapter,
+    IN PVIONET_SHARED_MEMORY Memory
+    )
+{
+    if (Memory->VirtualAddress != NULL)
+    {
+        NdisMFreeSharedMemory(Adapter->MiniportAdapterHandle,
+                              Memory->Length,
+                              TRUE,
+                              Memory->VirtualAddress,
+                              Memory->PhysicalAddress);
+        Memory->VirtualAddress = NULL;
+    }
+}
+
+static
+NDIS_STATUS
+NICAllocateRing (
+    IN PVIONET_ADAPTER Adapter,
+    OUT PVIRTQUEUE Queue,
+    IN USHORT Index,
+    IN ULONG MaxIndirect,
+    OUT PVIONET_SHARED_MEMORY Ring
+    )
+{
+    NDIS_STATUS status;
+    USHORT size;
+
+    //
+    // The legacy transport doesn't let us pick the ring size
+    //
+    size = VirtioGetQueueSize(&Adapter->Device, Index);
+    if (size == 0)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Queue %d doesn't exist\n", Index));
+        return NDIS_STATUS_FAILURE;
+    }
+
+    status = NICAllocateSharedMemory(Adapter,
+                                     VirtioQueueMemorySize(size, MaxIndirect),
+                                     Ring);
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    VirtioQueueInitialize(Queue,
+                          &Adapter->Device,
+                          Index,
+                          size,
+                          MaxIndirect,
+                          Ring->VirtualAddress,
+                          Ring->PhysicalAddress);
+
+    return NDIS_STATUS_SUCCESS;
+}
+
+static
+ULONG
+NICBufferCount (
+    IN PVIRTQUEUE Queue,
+    IN ULONG Maximum
+    )
+{
+    ULONG count;
+
+    //
+    // Without indirect tables every frame takes two ring descriptors
+    //
+    count = (Queue->MaxIndirect != 0) ? Queue->Size : Queue->Size / 2;
+
+    return min(count, Maximum);
+}
+
+static
+NDIS_STATUS
+NICAllocateBuffers (
+    IN PVIONET_ADAPTER Adapter,
+    IN PVIONET_QUEUE_PAIR QueuePair,
+    IN ULONG Count,
+    OUT PVIONET_BUFFER *Buffers,
+    OUT PVIONET_SHARED_MEMORY Blocks
+    )
+{
+    PVIONET_SHARED_MEMORY block;
+    PVIONET_BUFFER buffer;
+    NDIS_STATUS status;
+    ULONG i, offset;
+
+    status = NdisAllocateMemoryWithTag((PVOID*)Buffers,
+                                       Count * sizeof(VIONET_BUFFER),
+                                       BUFFER_TAG);
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        *Buffers = NULL;
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    NdisZeroMemory(*Buffers, Count * sizeof(VIONET_BUFFER));
+
+    for (i = 0; i < Count; i++)
+    {
+        block = &Blocks[i / VIONET_BUFFERS_PER_BLOCK];
+        offset = (i % VIONET_BUFFERS_PER_BLOCK) * VIONET_BUFFER_SIZE;
+
+        if (offset == 0)
+        {
+            status = NICAllocateSharedMemory(Adapter,
+                                             min(Count - i, VIONET_BUFFERS_PER_BLOCK) * VIONET_BUFFER_SIZE,
+                                             block);
+            if (status != NDIS_STATUS_SUCCESS)
+            {
+                return status;
+            }
+        }
+
+        buffer = &(*Buffers)[i];
+        buffer->VirtualAddress = (PUCHAR)block->VirtualAddress + offset;
+        buffer->PhysicalAddress = block->PhysicalAddress.QuadPart + offset;
+        buffer->QueuePair = QueuePair;
+    }
+
+    return NDIS_STATUS_SUCCESS;
+}
+
+static
+NDIS_STATUS
+NICSendControlCommand (
+    IN PVIONET_ADAPTER Adapter,
+    IN UCHAR Class,
+    IN UCHAR Command,
+    IN PVOID Data,
+    IN ULONG DataLength
+    )
+{
+    PUCHAR base = Adapter->ControlBuffer.VirtualAddress;
+    ULONGLONG physical = Adapter->ControlBuffer.PhysicalAddress.QuadPart;
+    PVIRTIO_NET_CTRL_HEADER header = (PVIRTIO_NET_CTRL_HEADER)base;
+    volatile UCHAR *ack = base + VIONET_CONTROL_ACK_OFFSET;
+    VIRTIO_BUFFER buffers[3];
+    ULONG count, i;
+
+    if (!Adapter->ControlQueueEnabled)
+    {
+        return NDIS_STATUS_NOT_SUPPORTED;
+    }
+
+    ASSERT(DataLength <= VIONET_CONTROL_ACK_OFFSET - VIONET_CONTROL_DATA_OFFSET);
+
+    header->Class = Class;
+    header->Command = Command;
+    NdisMoveMemory(base + VIONET_CONTROL_DATA_OFFSET, Data, DataLength);
+    *ack = VIRTIO_NET_ERR;
+
+    count = 0;
+    buffers[count].Address = physical;
+    buffers[count].Length = sizeof(*header);
+    count++;
+    if (DataLength != 0)
+    {
+        buffers[count].Address = physical + VIONET_CONTROL_DATA_OFFSET;
+        buffers[count].Length = DataLength;
+        count++;
+    }
+    buffers[count].Address = physical + VIONET_CONTROL_ACK_OFFSET;
+    buffers[count].Length = sizeof(UCHAR);
+
+    if (!VirtioQueueAddBuffers(&Adapter->ControlQueue, buffers, count, 1, Adapter))
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Control queue is full\n"));
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    VirtioQueueKickPrepare(&Adapter->ControlQueue);
+    VirtioQueueNotify(&Adapter->ControlQueue);
+
+    //
+    // QEMU handles the command while we notify, so this normally
+    // finds it done on the first look
+    //
+    for (i = 0; i < VIONET_CONTROL_TIMEOUT; i++)
+    {
+        if (VirtioQueueGetBuffer(&Adapter->ControlQueue, NULL) != NULL)
+        {
+            if (*ack != VIRTIO_NET_OK)
+            {
+                NDIS_DbgPrint(MIN_TRACE, ("Control command %d/%d failed\n", Class, Command));
+                return NDIS_STATUS_FAILURE;
+            }
+
+            return NDIS_STATUS_SUCCESS;
+        }
+
+        NdisStallExecution(10);
+    }
+
+    NDIS_DbgPrint(MIN_TRACE, ("Control command %d/%d timed out\n", Class, Command));
+    return NDIS_STATUS_FAILURE;
+}
+
+NDIS_STATUS
+NTAPI
+NICInitializeDevice (
+    IN PVIONET_ADAPTER Adapter
+    )
+{
+    LARGE_INTEGER systemTime;
+    USHORT maxPairs;
+    ULONG wanted;
+
+    VirtioInitialize(&Adapter->Device, Adapter->IoBase);
+
+    wanted = VIRTIO_FEATURE(VIRTIO_NET_F_MAC) |
+             VIRTIO_FEATURE(VIRTIO_NET_F_STATUS) |
+             VIRTIO_FEATURE(VIRTIO_RING_F_INDIRECT_DESC) |
+             VIRTIO_FEATURE(VIRTIO_RING_F_EVENT_IDX);
+
+    //
+    // Filtering and multiple queues are both set up through the control queue
+    //
+    if (Adapter->Device.HostFeatures & VIRTIO_FEATURE(VIRTIO_NET_F_CTRL_VQ))
+    {
+        wanted |= VIRTIO_FEATURE(VIRTIO_NET_F_CTRL_VQ) |
+                  VIRTIO_FEATURE(VIRTIO_NET_F_CTRL_RX) |
+                  VIRTIO_FEATURE(VIRTIO_NET_F_MQ);
+    }
+
+    VirtioNegotiateFeatures(&Adapter->Device, wanted);
+    Adapter->ControlQueueEnabled = VirtioHasFeature(&Adapter->Device, VIRTIO_NET_F_CTRL_VQ);
+
+    NDIS_DbgPrint(MID_TRACE, ("Negotiated features 0x%x\n", Adapter->Device.GuestFeatures));
+
+    if (VirtioHasFeature(&Adapter->Device, VIRTIO_NET_F_MAC))
+    {
+        VirtioReadConfig(&Adapter->Device,
+                         VIRTIO_NET_CONFIG_MAC,
+                         Adapter->PermanentMacAddress,
+                         IEEE_802_ADDR_LENGTH);
+    }
+    else
+    {
+        //
+        // Make up a locally administered address, the device forwards
+        // whatever we put in our frames
+        //
+        NdisGetCurrentSystemTime(&systemTime);
+        Adapter->PermanentMacAddress[0] = 0x02;
+        Adapter->PermanentMacAddress[1] = 0x00;
+        NdisMoveMemory(&Adapter->PermanentMacAddress[2], &systemTime.LowPart, sizeof(ULONG));
+    }
+
+    //
+    // The control queue follows the device's last queue pair, even the
+    // ones we leave unused
+    //
+    Adapter->MaxQueuePairs = 1;
+    if (VirtioHasFeature(&Adapter->Device, VIRTIO_NET_F_MQ))
+    {
+        VirtioReadConfig(&Adapter->Device,
+                         VIRTIO_NET_CONFIG_MAX_PAIRS,
+                         &maxPairs,
+                         sizeof(maxPairs));
+        if (maxPairs > 1)
+        {
+            Adapter->MaxQueuePairs = maxPairs;
+        }
+    }
+
+    //
+    // One pair per processor, more would only spread the same work thinner
+    //
+    Adapter->QueuePairCount = min(Adapter->MaxQueuePairs, VIONET_MAX_QUEUE_PAIRS);
+    Adapter->QueuePairCount = min(Adapter->QueuePairCount, (ULONG)NdisSystemProcessorCount());
+
+    NDIS_DbgPrint(MID_TRACE, ("Using %d of %d queue pairs\n",
+                              Adapter->QueuePairCount, Adapter->MaxQueuePairs));
+
+    NICUpdateLinkStatus(Adapter);
+
+    return NDIS_STATUS_SUCCESS;
+}
+
+NDIS_STATUS
+NTAPI
+NICAllocateQueues (
+    IN PVIONET_ADAPTER Adapter
+    )
+{
+    PVIONET_QUEUE_PAIR pair;
+    PVIONET_BUFFER buffer;
+    NDIS_STATUS status;
+    ULONG i, j, receiveCount;
+
+    receiveCount = 0;
+
+    for (i = 0; i < Adapter->QueuePairCount; i++)
+    {
+        pair = &Adapter->QueuePairs[i];
+        pair->Adapter = Adapter;
+        pair->Number = i;
+        NdisAllocateSpinLock(&pair->RxLock);
+        NdisAllocateSpinLock(&pair->TxLock);
+        InitializeListHead(&pair->TxFreeList);
+        InitializeListHead(&pair->TxWaitList);
+
+        status = NICAllocateRing(Adapter,
+                                 &pair->RxQueue,
+                                 VIRTIO_NET_RX_QUEUE(i),
+                                 VIONET_MAX_INDIRECT,
+                                 &pair->RxRing);
+        if (status != NDIS_STATUS_SUCCESS)
+        {
+            return status;
+        }
+
+        status = NICAllocateRing(Adapter,
+                                 &pair->TxQueue,
+                                 VIRTIO_NET_TX_QUEUE(i),
+                                 VIONET_MAX_INDIRECT,
+                                 &pair->TxRing);
+        if (status != NDIS_STATUS_SUCCESS)
+        {
+            return status;
+        }
+
+        pair->RxBufferCount = NICBufferCount(&pair->RxQueue, VIONET_MAX_RX_BUFFERS);
+        status = NICAllocateBuffers(Adapter,
+                                    pair,
+                                    pair->RxBufferCount,
+                                    &pair->RxBuffers,
+                                    pair->RxBlocks);
+        if (status != NDIS_STATUS_SUCCESS)
+        {
+            return status;
+        }
+
+        pair->TxBufferCount = NICBufferCount(&pair->TxQueue, VIONET_MAX_TX_BUFFERS);
+        status = NICAllocateBuffers(Adapter,
+                                    pair,
+                                    pair->TxBufferCount,
+                                    &pair->TxBuffers,
+                                    pair->TxBlocks);
+        if (status != NDIS_STATUS_SUCCESS)
+        {
+            return status;
+        }
+
+        for (j = 0; j < pair->TxBufferCount; j++)
+        {
+            InsertTailList(&pair->TxFreeList, &pair->TxBuffers[j].ListEntry);
+        }
+
+        receiveCount += pair->RxBufferCount;
+    }
+
+    //
+    // Every receive buffer gets a packet describing its frame, so we can
+    // indicate it without copying
+    //
+    NdisAllocatePacketPool(&status,
+                           &Adapter->PacketPool,
+                           receiveCount,
+                           PROTOCOL_RESERVED_SIZE_IN_PACKET);
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Unable to allocate packet pool\n"));
+        Adapter->PacketPool = NULL;
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    NdisAllocateBufferPool(&status, &Adapter->BufferPool, receiveCount);
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Unable to allocate buffer pool\n"));
+        Adapter->BufferPool = NULL;
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    for (i = 0; i < Adapter->QueuePairCount; i++)
+    {
+        pair = &Adapter->QueuePairs[i];
+
+        for (j = 0; j < pair->RxBufferCount; j++)
+        {
+            buffer = &pair->RxBuffers[j];
+
+            NdisAllocatePacket(&status, &buffer->Packet, Adapter->PacketPool);
+            if (status != NDIS_STATUS_SUCCESS)
+            {
+                buffer->Packet = NULL;
+                return NDIS_STATUS_RESOURCES;
+            }
+
+            NdisAllocateBuffer(&status,
+                               &buffer->NdisBuffer,
+                               Adapter->BufferPool,
+                               buffer->VirtualAddress + VIONET_FRAME_OFFSET,
+                               MAXIMUM_FRAME_SIZE);
+            if (status != NDIS_STATUS_SUCCESS)
+            {
+                buffer->NdisBuffer = NULL;
+                return NDIS_STATUS_RESOURCES;
+            }
+
+            NdisChainBufferAtFront(buffer->Packet, buffer->NdisBuffer);
+            NDIS_SET_PACKET_HEADER_SIZE(buffer->Packet, sizeof(ETH_HEADER));
+            PACKET_RX_BUFFER(buffer->Packet) = buffer;
+        }
+    }
+
+    if (Adapter->ControlQueueEnabled)
+    {
+        status = NICAllocateRing(Adapter,
+                                 &Adapter->ControlQueue,
+                                 VIRTIO_NET_CTRL_QUEUE(Adapter->MaxQueuePairs),
+                                 0,
+                                 &Adapter->ControlRing);
+        if (status != NDIS_STATUS_SUCCESS)
+        {
+            return status;
+        }
+
+        status = NICAllocateSharedMemory(Adapter, VIONET_CONTROL_SIZE, &Adapter->ControlBuffer);
+        if (status != NDIS_STATUS_SUCCESS)
+        {
+            return status;
+        }
+
+        //
+        // Commands are polled for, they never need an interrupt
+        //
+        VirtioQueueDisableInterrupt(&Adapter->ControlQueue);
+    }
+
+    return NDIS_STATUS_SUCCESS;
+}
+
+VOID
+NTAPI
+NICFreeQueues (
+    IN PVIONET_ADAPTER Adapter
+    )
+{
+    PVIONET_QUEUE_PAIR pair;
+    PVIONET_BUFFER buffer;
+    ULONG i, j;
+
+    for (i = 0; i < Adapter->QueuePairCount; i++)
+    {
+        pair = &Adapter->QueuePairs[i];
+        if (pair->Adapter == NULL)
+        {
+            break;
+        }
+
+        if (pair->RxBuffers != NULL)
+        {
+            for (j = 0; j < pair->RxBufferCount; j++)
+            {
+                buffer = &pair->RxBuffers[j];
+                if (buffer->NdisBuffer != NULL)
+                {
+                    NdisFreeBuffer(buffer->NdisBuffer);
+                }
+                if (buffer->Packet != NULL)
+                {
+                    NdisFreePacket(buffer->Packet);
+                }
+            }
+
+            NdisFreeMemory(pair->RxBuffers, pair->RxBufferCount * sizeof(VIONET_BUFFER), 0);
+            pair->RxBuffers = NULL;
+        }
+
+        if (pair->TxBuffers != NULL)
+        {
+            NdisFreeMemory(pair->TxBuffers, pair->TxBufferCount * sizeof(VIONET_BUFFER), 0);
+            pair->TxBuffers = NULL;
+        }
+
+        for (j = 0; j < VIONET_MAX_BLOCKS; j++)
+        {
+            NICFreeSharedMemory(Adapter, &pair->RxBlocks[j]);
+            NICFreeSharedMemory(Adapter, &pair->TxBlocks[j]);
+        }
+
+        if (pair->RxRing.VirtualAddress != NULL)
+        {
+            VirtioQueueDelete(&pair->RxQueue);
+            NICFreeSharedMemory(Adapter, &pair->RxRing);
+        }
+
+        if (pair->TxRing.VirtualAddress != NULL)
+        {
+            VirtioQueueDelete(&pair->TxQueue);
+            NICFreeSharedMemory(Adapter, &pair->TxRing);
+        }
+
+        NdisFreeSpinLock(&pair->RxLock);
+        NdisFreeSpinLock(&pair->TxLock);
+    }
+
+    if (Adapter->ControlRing.VirtualAddress != NULL)
+    {
+        VirtioQueueDelete(&Adapter->ControlQueue);
+        NICFreeSharedMemory(Adapter, &Adapter->ControlRing);
+    }
+    NICFreeSharedMemory(Adapter, &Adapter->ControlBuffer);
+
+    if (Adapter->BufferPool != NULL)
+    {
+        NdisFreeBufferPool(Adapter->BufferPool);
+        Adapter->BufferPool = NULL;
+    }
+
+    if (Adapter->PacketPool != NULL)
+    {
+        NdisFreePacketPool(Adapter->PacketPool);
+        Adapter->PacketPool = NULL;
+    }
+}
+
+NDIS_STATUS
+NTAPI
+NICStartDevice (
+    IN PVIONET_ADAPTER Adapter
+    )
+{
+    PVIONET_QUEUE_PAIR pair;
+    NDIS_STATUS status;
+    USHORT pairs;
+    ULONG i, j;
+
+    //
+    // Hand the device all receive buffers before it goes live
+    //
+    for (i = 0; i < Adapter->QueuePairCount; i++)
+    {
+        pair = &Adapter->QueuePairs[i];
+
+        for (j = 0; j < pair->RxBufferCount; j++)
+        {
+            NICPostReceiveBuffer(pair, &pair->RxBuffers[j]);
+        }
+
+        //
+        // Sent buffers are reaped by the next send. The transmit interrupt
+        // is only armed while packets wait for a free buffer.
+        //
+        VirtioQueueDisableInterrupt(&pair->TxQueue);
+    }
+
+    VirtioSetDriverOk(&Adapter->Device);
+
+    for (i = 0; i < Adapter->QueuePairCount; i++)
+    {
+        pair = &Adapter->QueuePairs[i];
+
+        if (VirtioQueueKickPrepare(&pair->RxQueue))
+        {
+            VirtioQueueNotify(&pair->RxQueue);
+        }
+    }
+
+    //
+    // Only the first pair is active until we ask for more
+    //
+    if (Adapter->QueuePairCount > 1)
+    {
+        pairs = (USHORT)Adapter->QueuePairCount;
+        status = NICSendControlCommand(Adapter,
+                                       VIRTIO_NET_CTRL_MQ,
+                                       VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET,
+                                       &pairs,
+                                       sizeof(pairs));
+        if (status != NDIS_STATUS_SUCCESS)
+        {
+            NDIS_DbgPrint(MIN_TRACE, ("Unable to enable %d queue pairs\n", pairs));
+            return status;
+        }
+    }
+
+    //
+    // QEMU starts out promiscuous, bring it in line with our empty filter
+    //
+    return NICApplyPacketFilter(Adapter);
+}
+
+VOID
+NTAPI
+NICStopDevice (
+    IN PVIONET_ADAPTER Adapter
+    )
+{
+    if (Adapter->Device.IoBase != NULL)
+    {
+        VirtioReset(&Adapter->Device);
+    }
+}
+
+VOID
+NTAPI
+NICUpdateLinkStatus (
+    IN PVIONET_ADAPTER Adapter
+    )
+{
+    USHORT status;
+
+    if (!VirtioHasFeature(&Adapter->Device, VIRTIO_NET_F_STATUS))
+    {
+        Adapter->MediaState = NdisMediaStateConnected;
+        return;
+    }
+
+    VirtioReadConfig(&Adapter->Device, VIRTIO_NET_CONFIG_STATUS, &status, sizeof(status));
+
+    Adapter->MediaState = (status & VIRTIO_NET_S_LINK_UP) ?
+                              NdisMediaStateConnected : NdisMediaStateDisconnected;
+}
+
+NDIS_STATUS
+NTAPI
+NICApplyPacketFilter (
+    IN PVIONET_ADAPTER Adapter
+    )
+{
+    NDIS_STATUS status;
+    UCHAR enable;
+
+    if (!VirtioHasFeature(&Adapter->Device, VIRTIO_NET_F_CTRL_RX))
+    {
+        //
+        // The device passes everything it has for us, NDIS filters the rest
+        //
+        return NDIS_STATUS_SUCCESS;
+    }
+
+    enable = (Adapter->PacketFilter & NDIS_PACKET_TYPE_PROMISCUOUS) ? 1 : 0;
+    status = NICSendControlCommand(Adapter,
+                                   VIRTIO_NET_CTRL_RX,
+                                   VIRTIO_NET_CTRL_RX_PROMISC,
+                                   &enable,
+                                   sizeof(enable));
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    enable = (Adapter->PacketFilter & NDIS_PACKET_TYPE_ALL_MULTICAST) ? 1 : 0;
+    return NICSendControlCommand(Adapter,
+                                 VIRTIO_NET_CTRL_RX,
+                                 VIRTIO_NET_CTRL_RX_ALLMULTI,
+                                 &enable,
+                                 sizeof(enable));
+}
+
+NDIS_STATUS
+NTAPI
+NICApplyMulticastList (
+    IN PVIONET_ADAPTER Adapter
+    )
+{
+    UCHAR table[2 * sizeof(ULONG) + sizeof(Adapter->MulticastList)];
+    ULONG entries;
+
+    if (!VirtioHasFeature(&Adapter->Device, VIRTIO_NET_F_CTRL_RX))
+    {
+        return NDIS_STATUS_SUCCESS;
+    }
+
+    //
+    // The command takes a unicast table, which we leave empty,
+    // followed by the multicast table
+    //
+    entries = 0;
+    NdisMoveMemory(table, &entries, sizeof(ULONG));
+
+    entries = Adapter->MulticastCount;
+    NdisMoveMemory(table + sizeof(ULONG), &entries, sizeof(ULONG));
+    NdisMoveMemory(table + 2 * sizeof(ULONG),
+                   Adapter->MulticastList,
+                   entries * IEEE_802_ADDR_LENGTH);
+
+    return NICSendControlCommand(Adapter,
+                                 VIRTIO_NET_CTRL_MAC,
+                                 VIRTIO_NET_CTRL_MAC_TABLE_SET,
+                                 table,
+                                 2 * sizeof(ULONG) + entries * IEEE_802_ADDR_LENGTH);
+}
+
+VOID
+NTAPI
+NICPostReceiveBuffer (
+    IN PVIONET_QUEUE_PAIR QueuePair,
+    IN PVIONET_BUFFER Buffer
+    )
+{
+    VIRTIO_BUFFER buffers[2];
+
+    buffers[0].Address = Buffer->PhysicalAddress;
+    buffers[0].Length = sizeof(VIRTIO_NET_HEADER);
+    buffers[1].Address = Buffer->PhysicalAddress + VIONET_FRAME_OFFSET;
+    buffers[1].Length = MAXIMUM_FRAME_SIZE;
+
+    if (!VirtioQueueAddBuffers(&QueuePair->RxQueue, buffers, 0, 2, Buffer))
+    {
+        //
+        // Can't happen, the ring has room for all our buffers
+        //
+        NDIS_DbgPrint(MIN_TRACE, ("Receive queue %d is full\n", QueuePair->Number));
+        return;
+    }
+
+    QueuePair->RxPosted++;
+}
+
+static
+BOOLEAN
+NICTransmitPacket (
+    IN PVIONET_QUEUE_PAIR QueuePair,
+    IN PNDIS_PACKET Packet,
+    IN PVIONET_BUFFER Buffer
+    )
+{
+    VIRTIO_BUFFER buffers[2];
+    PNDIS_BUFFER ndisBuffer;
+    PUCHAR destination;
+    PVOID bufferVa;
+    UINT bufferLength, totalLength;
+
+    NdisQueryPacket(Packet, NULL, NULL, &ndisBuffer, &totalLength);
+    if (totalLength > MAXIMUM_FRAME_SIZE)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Dropping %d byte packet\n", totalLength));
+        return FALSE;
+    }
+
+    //
+    // Copy the frame, so the packet can be completed right away. The virtio
+    // header stays zeroed from allocation since we don't use any offloads.
+    //
+    destination = Buffer->VirtualAddress + VIONET_FRAME_OFFSET;
+    while (ndisBuffer != NULL)
+    {
+        NdisQueryBufferSafe(ndisBuffer, &bufferVa, &bufferLength, NormalPagePriority);
+        if (bufferVa == NULL)
+        {
+            NDIS_DbgPrint(MIN_TRACE, ("Unable to map packet buffer\n"));
+            return FALSE;
+        }
+
+        NdisMoveMemory(destination, bufferVa, bufferLength);
+        destination += bufferLength;
+
+        NdisGetNextBuffer(ndisBuffer, &ndisBuffer);
+    }
+
+    buffers[0].Address = Buffer->PhysicalAddress;
+    buffers[0].Length = sizeof(VIRTIO_NET_HEADER);
+    buffers[1].Address = Buffer->PhysicalAddress + VIONET_FRAME_OFFSET;
+    buffers[1].Length = totalLength;
+
+    return VirtioQueueAddBuffers(&QueuePair->TxQueue, buffers, 2, 0, Buffer);
+}
+
+BOOLEAN
+NTAPI
+NICServiceTransmitQueue (
+    IN PVIONET_QUEUE_PAIR QueuePair,
+    IN PLIST_ENTRY CompletedList
+    )
+{
+    PVIONET_BUFFER buffer;
+    PNDIS_PACKET packet;
+    PLIST_ENTRY entry;
+
+    for (;;)
+    {
+        //
+        // Take back the buffers the device is done with
+        //
+        while ((buffer = VirtioQueueGetBuffer(&QueuePair->TxQueue, NULL)) != NULL)
+        {
+            InsertTailList(&QueuePair->TxFreeList, &buffer->ListEntry);
+        }
+
+        //
+        // Send waiting packets in order for as long as we have buffers
+        //
+        while (!IsListEmpty(&QueuePair->TxWaitList) && !IsListEmpty(&QueuePair->TxFreeList))
+        {
+            entry = RemoveHeadList(&QueuePair->TxWaitList);
+            packet = LIST_ENTRY_PACKET(entry);
+            buffer = CONTAINING_RECORD(RemoveHeadList(&QueuePair->TxFreeList),
+                                       VIONET_BUFFER,
+                                       ListEntry);
+
+            if (NICTransmitPacket(QueuePair, packet, buffer))
+            {
+                NDIS_SET_PACKET_STATUS(packet, NDIS_STATUS_SUCCESS);
+                QueuePair->TransmitOk++;
+            }
+            else
+            {
+                InsertHeadList(&QueuePair->TxFreeList, &buffer->ListEntry);
+                NDIS_SET_PACKET_STATUS(packet, NDIS_STATUS_FAILURE);
+                QueuePair->TransmitError++;
+            }
+
+            InsertTailList(CompletedList, entry);
+        }
+
+        if (IsListEmpty(&QueuePair->TxWaitList))
+        {
+            VirtioQueueDisableInterrupt(&QueuePair->TxQueue);
+            break;
+        }
+
+        //
+        // Still out of buffers. Have the device interrupt once most of the
+        // ring is done instead of after every frame.
+        //
+        if (!VirtioQueueEnableInterrupt(&QueuePair->TxQueue, TRUE))
+        {
+            break;
+        }
+    }
+
+    return VirtioQueueKickPrepare(&QueuePair->TxQueue);
+}
+
+/* EOF */
@@ -0,0 +1,219 @@
+/*
+ * PROJECT:     ReactOS Virtio Network Driver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        drivers/network/dd/vionet/interrupt.c
+ * PURPOSE:     Interrupt handling
+ * PROGRAMMERS: ReactOS Team
+ */
+
+#include "nic.h"
+
+#define NDEBUG
+#include <debug.h>
+
+VOID
+NTAPI
+MiniportISR (
+    OUT PBOOLEAN InterruptRecognized,
+    OUT PBOOLEAN QueueMiniportHandleInterrupt,
+    IN NDIS_HANDLE MiniportAdapterContext
+    )
+{
+    PVIONET_ADAPTER adapter = (PVIONET_ADAPTER)MiniportAdapterContext;
+    UCHAR isrStatus;
+
+    //
+    // Reading the status acknowledges the interrupt
+    //
+    isrStatus = VirtioReadIsr(&adapter->Device);
+    if (isrStatus == 0)
+    {
+        //
+        // This is not ours.
+        //
+        *InterruptRecognized = FALSE;
+        *QueueMiniportHandleInterrupt = FALSE;
+        return;
+    }
+
+    //
+    // The rings tell the DPC what to do, only a config change needs noting
+    //
+    InterlockedOr(&adapter->InterruptStatus, isrStatus);
+
+    *InterruptRecognized = TRUE;
+    *QueueMiniportHandleInterrupt = TRUE;
+}
+
+static
+VOID
+NICHandleReceive (
+    IN PVIONET_ADAPTER Adapter,
+    IN PVIONET_QUEUE_PAIR QueuePair
+    )
+{
+    PNDIS_PACKET packets[VIONET_RX_BATCH];
+    PVIONET_BUFFER buffer;
+    ULONG count, length, i;
+    BOOLEAN more, notify;
+
+    do
+    {
+        count = 0;
+
+        NdisDprAcquireSpinLock(&QueuePair->RxLock);
+
+        VirtioQueueDisableInterrupt(&QueuePair->RxQueue);
+
+        while (count < VIONET_RX_BATCH &&
+               (buffer = VirtioQueueGetBuffer(&QueuePair->RxQueue, &length)) != NULL)
+        {
+            QueuePair->RxPosted--;
+
+            if (length < sizeof(VIRTIO_NET_HEADER) + sizeof(ETH_HEADER) ||
+                length > sizeof(VIRTIO_NET_HEADER) + MAXIMUM_FRAME_SIZE)
+            {
+                NDIS_DbgPrint(MIN_TRACE, ("Bad receive length %d\n", length));
+                QueuePair->ReceiveError++;
+                NICPostReceiveBuffer(QueuePair, buffer);
+                continue;
+            }
+
+            NdisAdjustBufferLength(buffer->NdisBuffer, length - sizeof(VIRTIO_NET_HEADER));
+            NdisRecalculatePacketCounts(buffer->Packet);
+
+            //
+            // When the device runs low, have the protocols copy the frame
+            // so the buffer comes right back
+            //
+            if (QueuePair->RxPosted < VIONET_RX_LOW_WATER)
+            {
+                NDIS_SET_PACKET_STATUS(buffer->Packet, NDIS_STATUS_RESOURCES);
+                QueuePair->ReceiveNoBufferSpace++;
+            }
+            else
+            {
+                NDIS_SET_PACKET_STATUS(buffer->Packet, NDIS_STATUS_SUCCESS);
+            }
+
+            QueuePair->ReceiveOk++;
+            packets[count++] = buffer->Packet;
+        }
+
+        //
+        // A full batch means there is probably more. Otherwise rearm,
+        // which also catches what came in while we were looking.
+        //
+        more = (count == VIONET_RX_BATCH) ||
+               VirtioQueueEnableInterrupt(&QueuePair->RxQueue, FALSE);
+
+        notify = VirtioQueueKickPrepare(&QueuePair->RxQueue);
+
+        NdisDprReleaseSpinLock(&QueuePair->RxLock);
+
+        if (notify)
+        {
+            VirtioQueueNotify(&QueuePair->RxQueue);
+        }
+
+        if (count != 0)
+        {
+            NdisMIndicateReceivePacket(Adapter->MiniportAdapterHandle, packets, count);
+
+            //
+            // NDIS doesn't return these, they are ours again already
+            //
+            for (i = 0; i < count; i++)
+            {
+                if (NDIS_GET_PACKET_STATUS(packets[i]) == NDIS_STATUS_RESOURCES)
+                {
+                    MiniportReturnPacket(Adapter, packets[i]);
+                }
+            }
+        }
+    } while (more);
+}
+
+static
+VOID
+NICHandleTransmit (
+    IN PVIONET_ADAPTER Adapter,
+    IN PVIONET_QUEUE_PAIR QueuePair
+    )
+{
+    LIST_ENTRY completedList;
+    BOOLEAN notify;
+
+    InitializeListHead(&completedList);
+
+    NdisDprAcquireSpinLock(&QueuePair->TxLock);
+
+    //
+    // The transmit interrupt is only armed while packets wait, the
+    // send path reaps the ring otherwise
+    //
+    if (IsListEmpty(&QueuePair->TxWaitList))
+    {
+        NdisDprReleaseSpinLock(&QueuePair->TxLock);
+        return;
+    }
+
+    notify = NICServiceTransmitQueue(QueuePair, &completedList);
+
+    NdisDprReleaseSpinLock(&QueuePair->TxLock);
+
+    if (notify)
+    {
+        VirtioQueueNotify(&QueuePair->TxQueue);
+    }
+
+    NICCompleteSends(Adapter, &completedList);
+}
+
+VOID
+NTAPI
+MiniportHandleInterrupt (
+    IN NDIS_HANDLE MiniportAdapterContext
+    )
+{
+    PVIONET_ADAPTER adapter = (PVIONET_ADAPTER)MiniportAdapterContext;
+    ULONG oldMediaState;
+    LONG isrStatus;
+    ULONG i;
+
+    isrStatus = InterlockedExchange(&adapter->InterruptStatus, 0);
+
+    NDIS_DbgPrint(MAX_TRACE, ("Interrupts pending: 0x%x\n", isrStatus));
+
+    //
+    // Handle a link change
+    //
+    if (isrStatus & VIRTIO_ISR_CONFIG)
+    {
+        NdisDprAcquireSpinLock(&adapter->Lock);
+        oldMediaState = adapter->MediaState;
+        NICUpdateLinkStatus(adapter);
+        NdisDprReleaseSpinLock(&adapter->Lock);
+
+        if (adapter->MediaState != oldMediaState)
+        {
+            NdisMIndicateStatus(adapter->MiniportAdapterHandle,
+                                adapter->MediaState == NdisMediaStateConnected ?
+                                    NDIS_STATUS_MEDIA_CONNECT : NDIS_STATUS_MEDIA_DISCONNECT,
+                                NULL,
+                                0);
+            NdisMIndicateStatusComplete(adapter->MiniportAdapterHandle);
+        }
+    }
+
+    //
+    // All queues share one line interrupt, so any of them may have work
+    //
+    for (i = 0; i < adapter->QueuePairCount; i++)
+    {
+        NICHandleReceive(adapter, &adapter->QueuePairs[i]);
+        NICHandleTransmit(adapter, &adapter->QueuePairs[i]);
+    }
+}
+
+/* EOF */
@@ -0,0 +1,465 @@
+/*
+ * PROJECT:     ReactOS Virtio Network Driver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        drivers/network/dd/vionet/ndis.c
+ * PURPOSE:     Miniport entry points
+ * PROGRAMMERS: ReactOS Team
+ */
+
+#include "nic.h"
+
+#define NDEBUG
+#include <debug.h>
+
+ULONG DebugTraceLevel = MIN_TRACE;
+
+NDIS_STATUS
+NTAPI
+MiniportReset (
+    OUT PBOOLEAN AddressingReset,
+    IN NDIS_HANDLE MiniportAdapterContext
+    )
+{
+    //
+    // There is no hardware here that could hang
+    //
+    *AddressingReset = FALSE;
+    return NDIS_STATUS_SUCCESS;
+}
+
+VOID
+NTAPI
+NICCompleteSends (
+    IN PVIONET_ADAPTER Adapter,
+    IN PLIST_ENTRY CompletedList
+    )
+{
+    PNDIS_PACKET packet;
+
+    while (!IsListEmpty(CompletedList))
+    {
+        packet = LIST_ENTRY_PACKET(RemoveHeadList(CompletedList));
+        NdisMSendComplete(Adapter->MiniportAdapterHandle,
+                          packet,
+                          NDIS_GET_PACKET_STATUS(packet));
+    }
+}
+
+VOID
+NTAPI
+MiniportSendPackets (
+    IN NDIS_HANDLE MiniportAdapterContext,
+    IN PPNDIS_PACKET PacketArray,
+    IN UINT NumberOfPackets
+    )
+{
+    PVIONET_ADAPTER adapter = (PVIONET_ADAPTER)MiniportAdapterContext;
+    PVIONET_QUEUE_PAIR pair;
+    LIST_ENTRY completedList;
+    BOOLEAN notify;
+    UINT i;
+
+    //
+    // Every processor sends on its own queue pair, so concurrent
+    // senders don't fight over one lock and one ring
+    //
+    pair = &adapter->QueuePairs[KeGetCurrentProcessorNumber() % adapter->QueuePairCount];
+
+    InitializeListHead(&completedList);
+
+    NdisAcquireSpinLock(&pair->TxLock);
+
+    for (i = 0; i < NumberOfPackets; i++)
+    {
+        InsertTailList(&pair->TxWaitList, PACKET_LIST_ENTRY(PacketArray[i]));
+    }
+
+    notify = NICServiceTransmitQueue(pair, &completedList);
+
+    NdisReleaseSpinLock(&pair->TxLock);
+
+    //
+    // One notification for the whole batch, outside the lock
+    //
+    if (notify)
+    {
+        VirtioQueueNotify(&pair->TxQueue);
+    }
+
+    NICCompleteSends(adapter, &completedList);
+}
+
+VOID
+NTAPI
+MiniportReturnPacket (
+    IN NDIS_HANDLE MiniportAdapterContext,
+    IN PNDIS_PACKET Packet
+    )
+{
+    PVIONET_BUFFER buffer = PACKET_RX_BUFFER(Packet);
+    PVIONET_QUEUE_PAIR pair = buffer->QueuePair;
+    BOOLEAN notify;
+
+    //
+    // Undo the trim from the receive path and give the buffer back
+    //
+    NdisAdjustBufferLength(buffer->NdisBuffer, MAXIMUM_FRAME_SIZE);
+
+    NdisAcquireSpinLock(&pair->RxLock);
+    NICPostReceiveBuffer(pair, buffer);
+    notify = VirtioQueueKickPrepare(&pair->RxQueue);
+    NdisReleaseSpinLock(&pair->RxLock);
+
+    if (notify)
+    {
+        VirtioQueueNotify(&pair->RxQueue);
+    }
+}
+
+VOID
+NTAPI
+MiniportHalt (
+    IN NDIS_HANDLE MiniportAdapterContext
+    )
+{
+    PVIONET_ADAPTER adapter = (PVIONET_ADAPTER)MiniportAdapterContext;
+    PVIONET_QUEUE_PAIR pair;
+    PNDIS_PACKET packet;
+    ULONG i;
+
+    ASSERT(adapter != NULL);
+
+    //
+    // Interrupts need to stop first
+    //
+    if (adapter->InterruptRegistered != FALSE)
+    {
+        NdisMDeregisterInterrupt(&adapter->Interrupt);
+    }
+
+    //
+    // If we have a mapped IO port range, we can talk to the device
+    //
+    if (adapter->IoBase != NULL)
+    {
+        //
+        // Reset the device so it lets go of the rings and buffers
+        // before we free them
+        //
+        NICStopDevice(adapter);
+
+        //
+        // Fail whatever still waits for a transmit buffer
+        //
+        for (i = 0; i < adapter->QueuePairCount; i++)
+        {
+            pair = &adapter->QueuePairs[i];
+            if (pair->Adapter == NULL)
+            {
+                break;
+            }
+
+            while (!IsListEmpty(&pair->TxWaitList))
+            {
+                packet = LIST_ENTRY_PACKET(RemoveHeadList(&pair->TxWaitList));
+                NdisMSendComplete(adapter->MiniportAdapterHandle, packet, NDIS_STATUS_FAILURE);
+            }
+        }
+
+        NICFreeQueues(adapter);
+
+        //
+        // Unregister the IO range
+        //
+        NdisMDeregisterIoPortRange(adapter->MiniportAdapterHandle,
+                                   adapter->IoRangeStart,
+                                   adapter->IoRangeLength,
+                                   adapter->IoBase);
+    }
+
+    //
+    // Destroy the adapter context
+    //
+    NdisFreeMemory(adapter, sizeof(*adapter), 0);
+}
+
+NDIS_STATUS
+NTAPI
+MiniportInitialize (
+    OUT PNDIS_STATUS OpenErrorStatus,
+    OUT PUINT SelectedMediumIndex,
+    IN PNDIS_MEDIUM MediumArray,
+    IN UINT MediumArraySize,
+    IN NDIS_HANDLE MiniportAdapterHandle,
+    IN NDIS_HANDLE WrapperConfigurationContext
+    )
+{
+    PVIONET_ADAPTER adapter;
+    NDIS_STATUS status;
+    UINT i;
+    PNDIS_RESOURCE_LIST resourceList;
+    UINT resourceListSize;
+
+    //
+    // Make sure the medium is supported
+    //
+    for (i = 0; i < MediumArraySize; i++)
+    {
+        if (MediumArray[i] == NdisMedium802_3)
+        {
+            *SelectedMediumIndex = i;
+            break;
+        }
+    }
+
+    if (i == MediumArraySize)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("802.3 medium was not found in the medium array\n"));
+        return NDIS_STATUS_UNSUPPORTED_MEDIA;
+    }
+
+    //
+    // Allocate our adapter context
+    //
+    status = NdisAllocateMemoryWithTag((PVOID*)&adapter,
+                                       sizeof(*adapter),
+                                       ADAPTER_TAG);
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Failed to allocate adapter context\n"));
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    RtlZeroMemory(adapter, sizeof(*adapter));
+    adapter->MiniportAdapterHandle = MiniportAdapterHandle;
+    NdisAllocateSpinLock(&adapter->Lock);
+
+    //
+    // We complete our own sends and take packets from several
+    // processors at once, so NDIS doesn't need to serialize us
+    //
+    NdisMSetAttributesEx(MiniportAdapterHandle,
+                         adapter,
+                         0,
+                         NDIS_ATTRIBUTE_BUS_MASTER | NDIS_ATTRIBUTE_DESERIALIZE,
+                         NdisInterfacePci);
+
+    //
+    // Get our resources for IRQ and IO base information
+    //
+    resourceList = NULL;
+    resourceListSize = 0;
+    NdisMQueryAdapterResources(&status,
+                               WrapperConfigurationContext,
+                               resourceList,
+                               &resourceListSize);
+    if (status != NDIS_STATUS_RESOURCES)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Unexpected failure of NdisMQueryAdapterResources #1\n"));
+        status = NDIS_STATUS_FAILURE;
+        goto Cleanup;
+    }
+
+    status = NdisAllocateMemoryWithTag((PVOID*)&resourceList,
+                                       resourceListSize,
+                                       RESOURCE_LIST_TAG);
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Failed to allocate resource list\n"));
+        goto Cleanup;
+    }
+
+    NdisMQueryAdapterResources(&status,
+                               WrapperConfigurationContext,
+                               resourceList,
+                               &resourceListSize);
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Unexpected failure of NdisMQueryAdapterResources #2\n"));
+        goto Cleanup;
+    }
+
+    ASSERT(resourceList->Version == 1);
+    ASSERT(resourceList->Revision == 1);
+
+    for (i = 0; i < resourceList->Count; i++)
+    {
+        switch (resourceList->PartialDescriptors[i].Type)
+        {
+            case CmResourceTypePort:
+                //
+                // The legacy register block is the only I/O BAR
+                //
+                if (adapter->IoRangeStart != 0)
+                    break;
+
+                ASSERT(resourceList->PartialDescriptors[i].u.Port.Start.HighPart == 0);
+
+                adapter->IoRangeStart = resourceList->PartialDescriptors[i].u.Port.Start.LowPart;
+                adapter->IoRangeLength = resourceList->PartialDescriptors[i].u.Port.Length;
+
+                NDIS_DbgPrint(MID_TRACE, ("I/O port range is %p to %p\n",
+                              adapter->IoRangeStart, adapter->IoRangeStart + adapter->IoRangeLength));
+                break;
+
+            case CmResourceTypeInterrupt:
+                ASSERT(adapter->InterruptVector == 0);
+                ASSERT(adapter->InterruptLevel == 0);
+
+                adapter->InterruptVector = resourceList->PartialDescriptors[i].u.Interrupt.Vector;
+                adapter->InterruptLevel = resourceList->PartialDescriptors[i].u.Interrupt.Level;
+                adapter->InterruptShared = (resourceList->PartialDescriptors[i].ShareDisposition == CmResourceShareShared);
+                adapter->InterruptFlags = resourceList->PartialDescriptors[i].Flags;
+
+                NDIS_DbgPrint(MID_TRACE, ("IRQ vector is %d\n", adapter->InterruptVector));
+                break;
+
+            default:
+                NDIS_DbgPrint(MIN_TRACE, ("Unrecognized resource type: 0x%x\n", resourceList->PartialDescriptors[i].Type));
+                break;
+        }
+    }
+
+    NdisFreeMemory(resourceList, resourceListSize, 0);
+    resourceList = NULL;
+
+    if (adapter->IoRangeStart == 0 || adapter->InterruptVector == 0)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Adapter didn't receive enough resources\n"));
+        status = NDIS_STATUS_RESOURCES;
+        goto Cleanup;
+    }
+
+    //
+    // Allocate the DMA resources. The rings and buffers can live anywhere.
+    //
+    status = NdisMInitializeScatterGatherDma(MiniportAdapterHandle,
+                                             TRUE,
+                                             MAXIMUM_FRAME_SIZE);
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Unable to configure DMA\n"));
+        goto Cleanup;
+    }
+
+    //
+    // Register the I/O port range and configure the device
+    //
+    status = NdisMRegisterIoPortRange((PVOID*)&adapter->IoBase,
+                                      MiniportAdapterHandle,
+                                      adapter->IoRangeStart,
+                                      adapter->IoRangeLength);
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Unable to register IO port range (0x%x)\n", status));
+        goto Cleanup;
+    }
+
+    status = NICInitializeDevice(adapter);
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Unable to initialize the device (0x%x)\n", status));
+        goto Cleanup;
+    }
+
+    RtlCopyMemory(adapter->CurrentMacAddress, adapter->PermanentMacAddress, IEEE_802_ADDR_LENGTH);
+
+    status = NICAllocateQueues(adapter);
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Unable to set up the queues (0x%x)\n", status));
+        goto Cleanup;
+    }
+
+    //
+    // We're ready to handle interrupts now
+    //
+    status = NdisMRegisterInterrupt(&adapter->Interrupt,
+                                    MiniportAdapterHandle,
+                                    adapter->InterruptVector,
+                                    adapter->InterruptLevel,
+                                    TRUE, // We always want ISR calls
+                                    adapter->InterruptShared,
+                                    (adapter->InterruptFlags & CM_RESOURCE_INTERRUPT_LATCHED) ?
+                                        NdisInterruptLatched : NdisInterruptLevelSensitive);
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Unable to register interrupt (0x%x)\n", status));
+        goto Cleanup;
+    }
+
+    adapter->InterruptRegistered = TRUE;
+
+    //
+    // Turn on TX and RX now
+    //
+    status = NICStartDevice(adapter);
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Unable to start the device (0x%x)\n", status));
+        goto Cleanup;
+    }
+
+    return NDIS_STATUS_SUCCESS;
+
+Cleanup:
+    if (resourceList != NULL)
+    {
+        NdisFreeMemory(resourceList, resourceListSize, 0);
+    }
+    if (adapter != NULL)
+    {
+        MiniportHalt(adapter);
+    }
+
+    return status;
+}
+
+NTSTATUS
+NTAPI
+DriverEntry (
+    IN PDRIVER_OBJECT DriverObject,
+    IN PUNICODE_STRING RegistryPath
+    )
+{
+    NDIS_HANDLE wrapperHandle;
+    NDIS_MINIPORT_CHARACTERISTICS characteristics;
+    NDIS_STATUS status;
+
+    RtlZeroMemory(&characteristics, sizeof(characteristics));
+    characteristics.MajorNdisVersion = NDIS_MINIPORT_MAJOR_VERSION;
+    characteristics.MinorNdisVersion = NDIS_MINIPORT_MINOR_VERSION;
+    characteristics.CheckForHangHandler = NULL;
+    characteristics.DisableInterruptHandler = NULL;
+    characteristics.EnableInterruptHandler = NULL;
+    characteristics.HaltHandler = MiniportHalt;
+    characteristics.HandleInterruptHandler = MiniportHandleInterrupt;
+    characteristics.InitializeHandler = MiniportInitialize;
+    characteristics.ISRHandler = MiniportISR;
+    characteristics.QueryInformationHandler = MiniportQueryInformation;
+    characteristics.ReconfigureHandler = NULL;
+    characteristics.ResetHandler = MiniportReset;
+    characteristics.SendHandler = NULL;
+    characteristics.SetInformationHandler = MiniportSetInformation;
+    characteristics.TransferDataHandler = NULL;
+    characteristics.ReturnPacketHandler = MiniportReturnPacket;
+    characteristics.SendPacketsHandler = MiniportSendPackets;
+    characteristics.AllocateCompleteHandler = NULL;
+
+    NdisMInitializeWrapper(&wrapperHandle, DriverObject, RegistryPath, NULL);
+    if (!wrapperHandle)
+    {
+        return NDIS_STATUS_FAILURE;
+    }
+
+    status = NdisMRegisterMiniport(wrapperHandle, &characteristics, sizeof(characteristics));
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        NdisTerminateWrapper(wrapperHandle, 0);
+        return NDIS_STATUS_FAILURE;
+    }
+
+    return NDIS_STATUS_SUCCESS;
+}
+
+/* EOF */
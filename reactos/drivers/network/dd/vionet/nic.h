@@ -0,0 +1,264 @@
+/*
+ * PROJECT:     ReactOS Virtio Network Driver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        drivers/network/dd/vionet/nic.h
+ * PURPOSE:     Virtio network driver definitions
+ * PROGRAMMERS: ReactOS Team
+ */
+
+#ifndef _VIONET_PCH_
+#define _VIONET_PCH_
+
+#include <ndis.h>
+#include <virtio.h>
+
+#include "vionethw.h"
+
+#define ADAPTER_TAG 'Aniv'
+#define RESOURCE_LIST_TAG 'Rniv'
+#define BUFFER_TAG 'Bniv'
+
+#define MAXIMUM_FRAME_SIZE 1514
+#define MAXIMUM_MULTICAST_ADDRESSES 32
+
+#define DRIVER_VERSION 1
+
+// We run one queue pair per processor up to this many
+#define VIONET_MAX_QUEUE_PAIRS 8
+
+// Buffers per queue, bounded by the ring size
+#define VIONET_MAX_RX_BUFFERS 256
+#define VIONET_MAX_TX_BUFFERS 256
+
+// Header and frame, both descriptors fit one indirect table
+#define VIONET_MAX_INDIRECT 2
+
+// Every buffer holds the virtio header and one frame. The frame starts
+// 2 bytes past a 16 byte boundary so the IP header ends up aligned.
+#define VIONET_BUFFER_SIZE 2048
+#define VIONET_FRAME_OFFSET 18
+
+// Shared memory for the buffers comes in chunks of this size
+#define VIONET_BLOCK_SIZE (64 * 1024)
+#define VIONET_BUFFERS_PER_BLOCK (VIONET_BLOCK_SIZE / VIONET_BUFFER_SIZE)
+#define VIONET_MAX_BLOCKS (VIONET_MAX_RX_BUFFERS / VIONET_BUFFERS_PER_BLOCK)
+
+// Indicate with NDIS_STATUS_RESOURCES once fewer receive buffers than
+// this are left with the device
+#define VIONET_RX_LOW_WATER 16
+
+// Receive packets indicated to NDIS in one call
+#define VIONET_RX_BATCH 32
+
+// Control queue page: command header, command data and the ack byte
+#define VIONET_CONTROL_DATA_OFFSET 16
+#define VIONET_CONTROL_ACK_OFFSET 512
+#define VIONET_CONTROL_SIZE PAGE_SIZE
+#define VIONET_CONTROL_TIMEOUT 100000 // 1 second in 10 us stalls
+
+// A packet waiting for a transmit buffer is queued through MiniportReserved
+#define PACKET_LIST_ENTRY(Packet) ((PLIST_ENTRY)(Packet)->MiniportReserved)
+#define LIST_ENTRY_PACKET(Entry) CONTAINING_RECORD(Entry, NDIS_PACKET, MiniportReserved)
+
+// A receive packet remembers the buffer it describes
+#define PACKET_RX_BUFFER(Packet) (*(struct _VIONET_BUFFER **)(Packet)->MiniportReserved)
+
+typedef struct _VIONET_SHARED_MEMORY {
+    PVOID VirtualAddress;
+    NDIS_PHYSICAL_ADDRESS PhysicalAddress;
+    ULONG Length;
+} VIONET_SHARED_MEMORY, *PVIONET_SHARED_MEMORY;
+
+typedef struct _VIONET_BUFFER {
+    LIST_ENTRY ListEntry;
+    PUCHAR VirtualAddress;
+    ULONGLONG PhysicalAddress;
+    struct _VIONET_QUEUE_PAIR *QueuePair;
+
+    // Receive buffers only
+    PNDIS_PACKET Packet;
+    PNDIS_BUFFER NdisBuffer;
+} VIONET_BUFFER, *PVIONET_BUFFER;
+
+typedef struct _VIONET_QUEUE_PAIR {
+    struct _VIONET_ADAPTER *Adapter;
+    ULONG Number;
+
+    NDIS_SPIN_LOCK RxLock;
+    VIRTQUEUE RxQueue;
+    VIONET_SHARED_MEMORY RxRing;
+    ULONG RxBufferCount;
+    PVIONET_BUFFER RxBuffers;
+    VIONET_SHARED_MEMORY RxBlocks[VIONET_MAX_BLOCKS];
+    ULONG RxPosted;
+    ULONG ReceiveOk;
+    ULONG ReceiveError;
+    ULONG ReceiveNoBufferSpace;
+
+    NDIS_SPIN_LOCK TxLock;
+    VIRTQUEUE TxQueue;
+    VIONET_SHARED_MEMORY TxRing;
+    ULONG TxBufferCount;
+    PVIONET_BUFFER TxBuffers;
+    VIONET_SHARED_MEMORY TxBlocks[VIONET_MAX_BLOCKS];
+    LIST_ENTRY TxFreeList;
+    LIST_ENTRY TxWaitList;
+    ULONG TransmitOk;
+    ULONG TransmitError;
+} VIONET_QUEUE_PAIR, *PVIONET_QUEUE_PAIR;
+
+typedef struct _VIONET_ADAPTER {
+    NDIS_HANDLE MiniportAdapterHandle;
+    NDIS_SPIN_LOCK Lock;
+
+    ULONG IoRangeStart;
+    ULONG IoRangeLength;
+
+    ULONG InterruptVector;
+    ULONG InterruptLevel;
+    BOOLEAN InterruptShared;
+    ULONG InterruptFlags;
+
+    PUCHAR IoBase;
+    NDIS_MINIPORT_INTERRUPT Interrupt;
+    BOOLEAN InterruptRegistered;
+
+    VIRTIO_DEVICE Device;
+    LONG InterruptStatus;
+
+    UCHAR PermanentMacAddress[IEEE_802_ADDR_LENGTH];
+    UCHAR CurrentMacAddress[IEEE_802_ADDR_LENGTH];
+    struct {
+        UCHAR MacAddress[IEEE_802_ADDR_LENGTH];
+    } MulticastList[MAXIMUM_MULTICAST_ADDRESSES];
+    ULONG MulticastCount;
+
+    ULONG MediaState;
+    ULONG PacketFilter;
+
+    ULONG MaxQueuePairs;
+    ULONG QueuePairCount;
+    VIONET_QUEUE_PAIR QueuePairs[VIONET_MAX_QUEUE_PAIRS];
+
+    BOOLEAN ControlQueueEnabled;
+    VIRTQUEUE ControlQueue;
+    VIONET_SHARED_MEMORY ControlRing;
+    VIONET_SHARED_MEMORY ControlBuffer;
+
+    NDIS_HANDLE PacketPool;
+    NDIS_HANDLE BufferPool;
+} VIONET_ADAPTER, *PVIONET_ADAPTER;
+
+NDIS_STATUS
+NTAPI
+NICInitializeDevice (
+    IN PVIONET_ADAPTER Adapter
+    );
+
+NDIS_STATUS
+NTAPI
+NICAllocateQueues (
+    IN PVIONET_ADAPTER Adapter
+    );
+
+VOID
+NTAPI
+NICFreeQueues (
+    IN PVIONET_ADAPTER Adapter
+    );
+
+NDIS_STATUS
+NTAPI
+NICStartDevice (
+    IN PVIONET_ADAPTER Adapter
+    );
+
+VOID
+NTAPI
+NICStopDevice (
+    IN PVIONET_ADAPTER Adapter
+    );
+
+VOID
+NTAPI
+NICUpdateLinkStatus (
+    IN PVIONET_ADAPTER Adapter
+    );
+
+NDIS_STATUS
+NTAPI
+NICApplyPacketFilter (
+    IN PVIONET_ADAPTER Adapter
+    );
+
+NDIS_STATUS
+NTAPI
+NICApplyMulticastList (
+    IN PVIONET_ADAPTER Adapter
+    );
+
+VOID
+NTAPI
+NICPostReceiveBuffer (
+    IN PVIONET_QUEUE_PAIR QueuePair,
+    IN PVIONET_BUFFER Buffer
+    );
+
+BOOLEAN
+NTAPI
+NICServiceTransmitQueue (
+    IN PVIONET_QUEUE_PAIR QueuePair,
+    IN PLIST_ENTRY CompletedList
+    );
+
+VOID
+NTAPI
+NICCompleteSends (
+    IN PVIONET_ADAPTER Adapter,
+    IN PLIST_ENTRY CompletedList
+    );
+
+VOID
+NTAPI
+MiniportReturnPacket (
+    IN NDIS_HANDLE MiniportAdapterContext,
+    IN PNDIS_PACKET Packet
+    );
+
+NDIS_STATUS
+NTAPI
+MiniportSetInformation (
+    IN NDIS_HANDLE MiniportAdapterContext,
+    IN NDIS_OID Oid,
+    IN PVOID InformationBuffer,
+    IN ULONG InformationBufferLength,
+    OUT PULONG BytesRead,
+    OUT PULONG BytesNeeded
+    );
+
+NDIS_STATUS
+NTAPI
+MiniportQueryInformation (
+    IN NDIS_HANDLE MiniportAdapterContext,
+    IN NDIS_OID Oid,
+    IN PVOID InformationBuffer,
+    IN ULONG InformationBufferLength,
+    OUT PULONG BytesWritten,
+    OUT PULONG BytesNeeded
+    );
+
+VOID
+NTAPI
+MiniportISR (
+    OUT PBOOLEAN InterruptRecognized,
+    OUT PBOOLEAN QueueMiniportHandleInterrupt,
+    IN NDIS_HANDLE MiniportAdapterContext
+    );
+
+VOID
+NTAPI
+MiniportHandleInterrupt (
+    IN NDIS_HANDLE MiniportAdapterContext
+    );
+
+#endif /* _VIONET_PCH_ */
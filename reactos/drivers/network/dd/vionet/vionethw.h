@@ -0,0 +1,72 @@
+/*
+ * PROJECT:     ReactOS Virtio Network Driver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        drivers/network/dd/vionet/vionethw.h
+ * PURPOSE:     Virtio network device definitions
+ * PROGRAMMERS: ReactOS Team
+ */
+
+#pragma once
+
+// Device features
+#define VIRTIO_NET_F_MAC                5
+#define VIRTIO_NET_F_STATUS             16
+#define VIRTIO_NET_F_CTRL_VQ            17
+#define VIRTIO_NET_F_CTRL_RX            18
+#define VIRTIO_NET_F_MQ                 22
+
+// Device configuration
+#define VIRTIO_NET_CONFIG_MAC           0
+#define VIRTIO_NET_CONFIG_STATUS        6
+#define VIRTIO_NET_CONFIG_MAX_PAIRS     8
+
+#define VIRTIO_NET_S_LINK_UP            1
+
+// Queue numbering, the control queue follows the last pair
+#define VIRTIO_NET_RX_QUEUE(Pair)       ((USHORT)((Pair) * 2))
+#define VIRTIO_NET_TX_QUEUE(Pair)       ((USHORT)((Pair) * 2 + 1))
+#define VIRTIO_NET_CTRL_QUEUE(Pairs)    ((USHORT)((Pairs) * 2))
+
+// Precedes every frame in both directions
+typedef struct _VIRTIO_NET_HEADER
+{
+    UCHAR Flags;
+    UCHAR GsoType;
+    USHORT HeaderLength;
+    USHORT GsoSize;
+    USHORT ChecksumStart;
+    USHORT ChecksumOffset;
+} VIRTIO_NET_HEADER, *PVIRTIO_NET_HEADER;
+
+C_ASSERT(sizeof(VIRTIO_NET_HEADER) == 10);
+
+#define IEEE_802_ADDR_LENGTH 6
+
+// Ethernet frame header
+typedef struct _ETH_HEADER {
+    UCHAR Destination[IEEE_802_ADDR_LENGTH];
+    UCHAR Source[IEEE_802_ADDR_LENGTH];
+    USHORT PayloadType;
+} ETH_HEADER, *PETH_HEADER;
+
+// Control queue commands
+#define VIRTIO_NET_CTRL_RX              0
+#define VIRTIO_NET_CTRL_RX_PROMISC      0
+#define VIRTIO_NET_CTRL_RX_ALLMULTI     1
+
+#define VIRTIO_NET_CTRL_MAC             1
+#define VIRTIO_NET_CTRL_MAC_TABLE_SET   0
+
+#define VIRTIO_NET_CTRL_MQ              4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET 0
+
+#define VIRTIO_NET_OK                   0
+#define VIRTIO_NET_ERR                  1
+
+typedef struct _VIRTIO_NET_CTRL_HEADER
+{
+    UCHAR Class;
+    UCHAR Command;
+} VIRTIO_NET_CTRL_HEADER, *PVIRTIO_NET_CTRL_HEADER;
+
+/* EOF */
@@ -996,6 +996,12 @@ VOID LANTransmit(
 
     RtlCopyMemory(Data + Adapter->HeaderSize, OldData, OldSize);
 
+    /* Keep what the IP layer asked the adapter to do with the packet */
+    NDIS_PER_PACKET_INFO_FROM_PACKET(XmitPacket, TcpIpChecksumPacketInfo) =
+        NDIS_PER_PACKET_INFO_FROM_PACKET(NdisPacket, TcpIpChecksumPacketInfo);
+    NDIS_PER_PACKET_INFO_FROM_PACKET(XmitPacket, TcpLargeSendPacketInfo) =
+        NDIS_PER_PACKET_INFO_FROM_PACKET(NdisPacket, TcpLargeSendPacketInfo);
+
     (*PC(NdisPacket)->DLComplete)(PC(NdisPacket)->Context, NdisPacket, NDIS_STATUS_SUCCESS);
 
     switch (Adapter->Media) {
@@ -1046,12 +1052,6 @@ VOID LANTransmit(
 		   ((PCHAR)LinkAddress)[5] & 0xff));
 	}
 
-    if (Adapter->MTU < Size) {
-        /* This is NOT a pointer. MSDN explicitly says so. */
-        NDIS_PER_PACKET_INFO_FROM_PACKET(NdisPacket,
-                                         TcpLargeSendPacketInfo) = (PVOID)((ULONG_PTR)Adapter->MTU);
-    }
-
     /* Update interface stats */
     Interface->Stats.OutBytes += Size;
 
@@ -1299,6 +1299,174 @@ VOID GetName( PUNICODE_STRING RegistryKey,
     AppendUnicodeString( OutName, &PartialRegistryKey, FALSE );
 }
 
+static VOID InitTaskOffloadHeader(
+    PLAN_ADAPTER Adapter,
+    PNDIS_TASK_OFFLOAD_HEADER Header)
+{
+    Header->Version = NDIS_TASK_OFFLOAD_VERSION;
+    Header->Size = sizeof(NDIS_TASK_OFFLOAD_HEADER);
+    Header->OffsetFirstTask = 0;
+    Header->EncapsulationFormat.Encapsulation = IEEE_802_3_Encapsulation;
+    Header->EncapsulationFormat.Flags.FixedHeaderSize = 1;
+    Header->EncapsulationFormat.EncapsulationHeaderSize = Adapter->HeaderSize;
+}
+
+static VOID SetTaskOffload(
+    PLAN_ADAPTER Adapter,
+    PIP_INTERFACE Interface)
+/*
+ * FUNCTION: Turns on the TCP/IP tasks the adapter can do for us
+ * ARGUMENTS:
+ *     Adapter   = Pointer to LAN_ADAPTER structure
+ *     Interface = Pointer to the interface to record the offloaded tasks in
+ * NOTES:
+ *     We use checksum offload and large send offload. Everything is done
+ *     in software if the adapter doesn't support OID_TCP_TASK_OFFLOAD
+ */
+{
+    ULONG Buffer[64];
+    PNDIS_TASK_OFFLOAD_HEADER Header = (PNDIS_TASK_OFFLOAD_HEADER)Buffer;
+    PNDIS_TASK_OFFLOAD Task;
+    PNDIS_TASK_TCP_IP_CHECKSUM Checksum;
+    PNDIS_TASK_TCP_LARGE_SEND LargeSend;
+    NDIS_TASK_TCP_IP_CHECKSUM ChecksumTask;
+    NDIS_STATUS NdisStatus;
+    ULONG Offset, OffloadFlags = 0;
+    ULONG LargeSendSize = 0, LargeSendMinSegments = 0;
+
+    Interface->OffloadFlags = 0;
+
+    RtlZeroMemory(Buffer, sizeof(Buffer));
+    InitTaskOffloadHeader(Adapter, Header);
+
+    NdisStatus = NDISCall(Adapter,
+                          NdisRequestQueryInformation,
+                          OID_TCP_TASK_OFFLOAD,
+                          Buffer,
+                          sizeof(Buffer));
+    if (NdisStatus != NDIS_STATUS_SUCCESS) {
+        TI_DbgPrint(DEBUG_DATALINK, ("No task offload (0x%X).\n", NdisStatus));
+        return;
+    }
+
+    RtlZeroMemory(&ChecksumTask, sizeof(ChecksumTask));
+
+    /* Go through the tasks the adapter offers */
+    Offset = Header->OffsetFirstTask;
+    while (Offset >= sizeof(NDIS_TASK_OFFLOAD_HEADER) &&
+           Offset + FIELD_OFFSET(NDIS_TASK_OFFLOAD, TaskBuffer) <= sizeof(Buffer))
+    {
+        Task = (PNDIS_TASK_OFFLOAD)((PUCHAR)Buffer + Offset);
+        if (Offset + FIELD_OFFSET(NDIS_TASK_OFFLOAD, TaskBuffer) + Task->TaskBufferLength > sizeof(Buffer))
+            break;
+
+        if (Task->Task == TcpIpChecksumNdisTask &&
+            Task->TaskBufferLength >= sizeof(NDIS_TASK_TCP_IP_CHECKSUM))
+        {
+            Checksum = (PNDIS_TASK_TCP_IP_CHECKSUM)Task->TaskBuffer;
+
+            /* Our segments carry TCP options (timestamps), but we never send IP options */
+            if (Checksum->V4Transmit.TcpChecksum && Checksum->V4Transmit.TcpOptionsSupported)
+            {
+                ChecksumTask.V4Transmit.TcpOptionsSupported = 1;
+                ChecksumTask.V4Transmit.TcpChecksum = 1;
+                OffloadFlags |= IP_OFFLOAD_TCP_CHECKSUM_TX;
+            }
+            if (Checksum->V4Transmit.IpChecksum)
+            {
+                ChecksumTask.V4Transmit.IpChecksum = 1;
+                OffloadFlags |= IP_OFFLOAD_IP_CHECKSUM_TX;
+            }
+
+            /* The adapter flags the packets it verified, so take whatever it offers */
+            ChecksumTask.V4Receive = Checksum->V4Receive;
+            if (Checksum->V4Receive.IpChecksum)
+                OffloadFlags |= IP_OFFLOAD_IP_CHECKSUM_RX;
+            if (Checksum->V4Receive.TcpChecksum)
+                OffloadFlags |= IP_OFFLOAD_TCP_CHECKSUM_RX;
+            if (Checksum->V4Receive.UdpChecksum)
+                OffloadFlags |= IP_OFFLOAD_UDP_CHECKSUM_RX;
+        }
+        else if (Task->Task == TcpLargeSendNdisTask &&
+                 Task->TaskBufferLength >= sizeof(NDIS_TASK_TCP_LARGE_SEND))
+        {
+            LargeSend = (PNDIS_TASK_TCP_LARGE_SEND)Task->TaskBuffer;
+
+            if (LargeSend->TcpOptions && LargeSend->MaxOffLoadSize > Adapter->MTU)
+            {
+                LargeSendSize = LargeSend->MaxOffLoadSize;
+                LargeSendMinSegments = LargeSend->MinSegmentCount;
+            }
+        }
+
+        if (Task->OffsetNextTask == 0)
+            break;
+
+        Offset += Task->OffsetNextTask;
+    }
+
+    /* The adapter fills in the checksums of the segments it cuts */
+    if (LargeSendSize != 0 && (OffloadFlags & IP_OFFLOAD_TCP_CHECKSUM_TX))
+        OffloadFlags |= IP_OFFLOAD_TCP_LARGE_SEND;
+
+    if (OffloadFlags == 0)
+        return;
+
+    /* Now turn on what we are going to use */
+    RtlZeroMemory(Buffer, sizeof(Buffer));
+    InitTaskOffloadHeader(Adapter, Header);
+
+    Offset = sizeof(NDIS_TASK_OFFLOAD_HEADER);
+    Header->OffsetFirstTask = Offset;
+
+    Task = (PNDIS_TASK_OFFLOAD)((PUCHAR)Buffer + Offset);
+    Task->Version = NDIS_TASK_OFFLOAD_VERSION;
+    Task->Size = sizeof(NDIS_TASK_OFFLOAD);
+    Task->Task = TcpIpChecksumNdisTask;
+    Task->TaskBufferLength = sizeof(NDIS_TASK_TCP_IP_CHECKSUM);
+    RtlCopyMemory(Task->TaskBuffer, &ChecksumTask, sizeof(ChecksumTask));
+    Offset += FIELD_OFFSET(NDIS_TASK_OFFLOAD, TaskBuffer) + sizeof(NDIS_TASK_TCP_IP_CHECKSUM);
+
+    if (OffloadFlags & IP_OFFLOAD_TCP_LARGE_SEND)
+    {
+        Task->OffsetNextTask = FIELD_OFFSET(NDIS_TASK_OFFLOAD, TaskBuffer) + sizeof(NDIS_TASK_TCP_IP_CHECKSUM);
+
+        Task = (PNDIS_TASK_OFFLOAD)((PUCHAR)Buffer + Offset);
+        Task->Version = NDIS_TASK_OFFLOAD_VERSION;
+        Task->Size = sizeof(NDIS_TASK_OFFLOAD);
+        Task->Task = TcpLargeSendNdisTask;
+        Task->TaskBufferLength = sizeof(NDIS_TASK_TCP_LARGE_SEND);
+
+        LargeSend = (PNDIS_TASK_TCP_LARGE_SEND)Task->TaskBuffer;
+        LargeSend->Version = NDIS_TASK_TCP_LARGE_SEND_V0;
+        LargeSend->MaxOffLoadSize = LargeSendSize;
+        LargeSend->MinSegmentCount = LargeSendMinSegments;
+        LargeSend->TcpOptions = TRUE;
+        LargeSend->IpOptions = FALSE;
+        Offset += FIELD_OFFSET(NDIS_TASK_OFFLOAD, TaskBuffer) + sizeof(NDIS_TASK_TCP_LARGE_SEND);
+    }
+
+    NdisStatus = NDISCall(Adapter,
+                          NdisRequestSetInformation,
+                          OID_TCP_TASK_OFFLOAD,
+                          Buffer,
+                          Offset);
+    if (NdisStatus != NDIS_STATUS_SUCCESS) {
+        TI_DbgPrint(MIN_TRACE, ("Could not set task offload (0x%X).\n", NdisStatus));
+        return;
+    }
+
+    TI_DbgPrint(DEBUG_DATALINK, ("Task offload 0x%X, large sends up to %d bytes.\n",
+                                 OffloadFlags, LargeSendSize));
+
+    Interface->OffloadFlags = OffloadFlags;
+    if (OffloadFlags & IP_OFFLOAD_TCP_LARGE_SEND)
+    {
+        Interface->LargeSendSize = LargeSendSize;
+        Interface->LargeSendMinSegments = LargeSendMinSegments;
+    }
+}
+
 BOOLEAN BindAdapter(
     PLAN_ADAPTER Adapter,
     PNDIS_STRING RegistryPath)
@@ -1400,6 +1568,10 @@ BOOLEAN BindAdapter(
     if (NdisStatus != NDIS_STATUS_SUCCESS)
         return FALSE;
 
+    /* Let the adapter do checksums and large sends if it can.
+     * TCP picks this up when the interface is registered. */
+    SetTaskOffload(Adapter, IF);
+
     /* Register interface with IP layer */
     IPRegisterInterface(IF);
 
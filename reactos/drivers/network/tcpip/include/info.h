@@ -62,6 +62,18 @@ typedef struct IPROUTE_ENTRY {
 
 #define TL_INSTANCE 0
 
+/* ReactOS specific: counters of the TCP connection lookup tables,
+   queried from a CO_TL_ENTITY */
+#define TCP_DEMUX_STATS_ID  0x200
+
+typedef struct TCP_DEMUX_STATS {
+    ULONG ActiveConnections;    /* Connections looked up by hash */
+    ULONG TimeWaitConnections;  /* Connections in TIME-WAIT */
+    ULONG Listeners;            /* Listening endpoints */
+    ULONG TimeWaitRecycled;     /* TIME-WAIT connections reused by a new SYN */
+    ULONG TimeWaitEvicted;      /* TIME-WAIT connections dropped over the limit */
+} TCP_DEMUX_STATS, *PTCP_DEMUX_STATS;
+
 
 typedef struct ADDRESS_INFO {
     ULONG LocalAddress;
@@ -105,6 +117,9 @@ TDI_STATUS InfoTdiQueryGetIPSnmpInfo( TDIEntityID ID,
 				      PNDIS_BUFFER Buffer,
 				      PUINT BufferSize );
 
+TDI_STATUS InfoTdiQueryGetTcpDemuxStats( PNDIS_BUFFER Buffer,
+                                         PUINT BufferSize );
+
 TDI_STATUS InfoTdiQueryGetRouteTable( PIP_INTERFACE IF,
                                       PNDIS_BUFFER Buffer,
                                       PUINT BufferSize );
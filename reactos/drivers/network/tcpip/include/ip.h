@@ -91,6 +91,7 @@ typedef struct _IP_PACKET {
 } IP_PACKET, *PIP_PACKET;
 
 #define IP_PACKET_FLAG_RAW      0x01    /* Raw IP packet */
+#define IP_PACKET_FLAG_SCATTERED 0x02   /* Only the header was copied, the data is still in NdisPacket */
 
 
 /* Packet context */
@@ -168,8 +169,18 @@ typedef struct _IP_INTERFACE {
     LL_TRANSMIT_ROUTINE Transmit; /* Pointer to transmit function */
     PVOID TCPContext;             /* TCP Content for this interface */
     SEND_RECV_STATS Stats;        /* Send/Receive statistics */
+    ULONG OffloadFlags;           /* Tasks done by the adapter (see IP_OFFLOAD_xx below) */
+    UINT  LargeSendSize;          /* Most TCP data the adapter segments in one send */
+    UINT  LargeSendMinSegments;   /* Fewest segments the adapter accepts in one large send */
 } IP_INTERFACE, *PIP_INTERFACE;
 
+#define IP_OFFLOAD_IP_CHECKSUM_TX   0x01 /* Adapter fills in IPv4 header checksums */
+#define IP_OFFLOAD_TCP_CHECKSUM_TX  0x02 /* Adapter fills in TCP checksums */
+#define IP_OFFLOAD_IP_CHECKSUM_RX   0x04 /* Adapter verifies IPv4 header checksums */
+#define IP_OFFLOAD_TCP_CHECKSUM_RX  0x08 /* Adapter verifies TCP checksums */
+#define IP_OFFLOAD_UDP_CHECKSUM_RX  0x10 /* Adapter verifies UDP checksums */
+#define IP_OFFLOAD_TCP_LARGE_SEND   0x20 /* Adapter cuts large TCP sends into segments */
+
 typedef struct _IP_SET_ADDRESS {
     ULONG NteIndex;
     IPv4_RAW_ADDRESS Address;
@@ -30,9 +30,15 @@ typedef struct TCPv4_HEADER {
 
 #define TCPOPTLEN_MAX_SEG_SIZE  0x4
 
+/* Control bits */
+#define TCP_FLAG_FIN        0x01
+#define TCP_FLAG_PSH        0x08
+
 /* Data offset; 32-bit words (leftmost 4 bits); convert to bytes */
 #define TCP_DATA_OFFSET(DataOffset)(((DataOffset) & 0xF0) >> (4-2))
 
+#define TCPv4_MAX_HEADER_SIZE   60
+
 
 /* TCPv4 pseudo header */
 typedef struct TCPv4_PSEUDO_HEADER {
@@ -158,7 +164,7 @@ NTSTATUS TCPReceiveData(
 
 NTSTATUS TCPSendData(
   PCONNECTION_ENDPOINT Connection,
-  PCHAR Buffer,
+  PNDIS_BUFFER Buffer,
   ULONG DataSize,
   PULONG DataUsed,
   ULONG Flags,
@@ -178,6 +184,11 @@ NTSTATUS TCPGetSockAddress
   PTRANSPORT_ADDRESS TransportAddress,
   BOOLEAN RemoteAddress );
 
+NTSTATUS TCPGetSockAddressLocked
+( PCONNECTION_ENDPOINT Connection,
+  PTRANSPORT_ADDRESS TransportAddress,
+  BOOLEAN RemoteAddress );
+
 NTSTATUS TCPStartup(
   VOID);
 
@@ -188,6 +199,12 @@ BOOLEAN TCPRemoveIRP( PCONNECTION_ENDPOINT Connection, PIRP Irp );
 
 NTSTATUS TCPSetNoDelay(PCONNECTION_ENDPOINT Connection, BOOLEAN Set);
 
+NTSTATUS TCPSetCork(PCONNECTION_ENDPOINT Connection, BOOLEAN Set);
+
+NTSTATUS TCPSetReceiveWindow(PCONNECTION_ENDPOINT Connection, ULONG Size);
+
+VOID TCPGetDemuxStats(PTCP_DEMUX_STATS Stats);
+
 VOID
 TCPUpdateInterfaceLinkStatus(PIP_INTERFACE IF);
 
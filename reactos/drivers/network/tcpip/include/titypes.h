@@ -282,6 +282,7 @@ typedef struct _CONNECTION_ENDPOINT {
     BOOLEAN ReceiveShutdown;
     NTSTATUS ReceiveShutdownStatus;
     BOOLEAN Closing;
+    ULONG ReceiveWindow;       /* Receive window set by the client (0 for the default) */
 
     struct _CONNECTION_ENDPOINT *Next; /* Next connection in address file list */
 } CONNECTION_ENDPOINT, *PCONNECTION_ENDPOINT;
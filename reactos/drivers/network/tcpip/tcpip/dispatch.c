@@ -978,15 +978,11 @@ NTSTATUS DispTdiSend(
   TI_DbgPrint(MID_TRACE,("TCPIP<<< Got an MDL: %x\n", Irp->MdlAddress));
   if (NT_SUCCESS(Status))
     {
-	PVOID Data;
-	UINT Len;
-
-	NdisQueryBuffer( Irp->MdlAddress, &Data, &Len );
-
+	/* The data may come in a chain of buffers */
 	TI_DbgPrint(MID_TRACE,("About to TCPSendData\n"));
 	Status = TCPSendData(
 	    TranContext->Handle.ConnectionContext,
-	    Data,
+	    Irp->MdlAddress,
 	    SendInfo->SendLength,
 	    &BytesSent,
 	    SendInfo->SendFlags,
@@ -1518,6 +1514,16 @@ NTSTATUS DispTdiSetInformationEx(
         break;
 
     case TDI_CONNECTION_FILE:
+        /* Connection options sent to a connection file apply to that connection,
+         * there is no need to find it through its address file entity */
+        if (Info->ID.toi_class == INFO_CLASS_PROTOCOL &&
+            Info->ID.toi_type == INFO_TYPE_CONNECTION)
+        {
+            return SetConnectionInfo(&Info->ID,
+                                     TranContext->Handle.ConnectionContext,
+                                     &Info->Buffer,
+                                     Info->BufferSize);
+        }
         Request.Handle.ConnectionContext = TranContext->Handle.ConnectionContext;
         break;
 
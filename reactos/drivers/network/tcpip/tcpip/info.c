@@ -288,6 +288,13 @@ TDI_STATUS InfoTdiQueryInformationEx(
                  else
                      return TDI_INVALID_PARAMETER;
 
+              case TCP_DEMUX_STATS_ID:
+                 if (ID->toi_type != INFO_TYPE_PROVIDER ||
+                     ID->toi_entity.tei_entity != CO_TL_ENTITY)
+                     return TDI_INVALID_PARAMETER;
+
+                 return InfoTdiQueryGetTcpDemuxStats(Buffer, BufferSize);
+
 #if 0
               case IP_INTFC_INFO_ID:
                  if (ID->toi_type != INFO_TYPE_PROVIDER)
@@ -177,6 +177,25 @@ TDI_STATUS InfoTdiQueryGetIPSnmpInfo( TDIEntityID ID,
     return Status;
 }
 
+TDI_STATUS InfoTdiQueryGetTcpDemuxStats( PNDIS_BUFFER Buffer,
+                                         PUINT BufferSize ) {
+    TCP_DEMUX_STATS DemuxStats;
+    TDI_STATUS Status;
+
+    TI_DbgPrint(DEBUG_INFO, ("Called.\n"));
+
+    RtlZeroMemory(&DemuxStats, sizeof(DemuxStats));
+
+    TCPGetDemuxStats(&DemuxStats);
+
+    Status = InfoCopyOut( (PCHAR)&DemuxStats, sizeof(DemuxStats),
+                          Buffer, BufferSize );
+
+    TI_DbgPrint(DEBUG_INFO, ("Returning %08x\n", Status));
+
+    return Status;
+}
+
 TDI_STATUS InfoTdiSetRoute(PIP_INTERFACE IF, PVOID Buffer, UINT BufferSize)
 {
     IP_ADDRESS Address, Netmask, Router;
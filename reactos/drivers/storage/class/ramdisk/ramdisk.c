@@ -40,6 +40,9 @@
 
 #define TOC_DATA_TRACK              (0x04)
 
+/* How much of the start of a boot disk stays mapped for inline I/O */
+#define RAMDISK_PERSISTENT_VIEW_LENGTH  0x400000
+
 typedef enum _RAMDISK_DEVICE_TYPE
 {
     RamdiskBus,
@@ -110,6 +113,14 @@ typedef struct _RAMDISK_DRIVE_EXTENSION
     ULONG NumberOfHeads;
     ULONG Cylinders;
     ULONG HiddenSectors;
+
+    /* Persistent view of the start of the disk, if it could be mapped */
+    PVOID MappedBase;
+    ULONG MappedLength;
+
+    /* I/O statistics */
+    RAMDISK_STATISTICS Statistics;
+    ULONGLONG CreationTime;
 } RAMDISK_DRIVE_EXTENSION, *PRAMDISK_DRIVE_EXTENSION;
 
 ULONG MaximumViewLength;
@@ -281,6 +292,14 @@ RamdiskMapPages(IN PRAMDISK_DRIVE_EXTENSION DeviceExtension,
     /* We only support boot disks for now */
     ASSERT(DeviceExtension->DiskType == RAMDISK_BOOT_DISK);
 
+    /* If this part of the disk is always mapped, just hand out the address */
+    if ((DeviceExtension->MappedBase) &&
+        (Offset.QuadPart + Length <= DeviceExtension->MappedLength))
+    {
+        *OutputLength = Length;
+        return (PVOID)((ULONG_PTR)DeviceExtension->MappedBase + Offset.QuadPart);
+    }
+
     /* Calculate the actual offset in the drive */
     ActualOffset.QuadPart = DeviceExtension->DiskOffset + Offset.QuadPart;
 
@@ -325,6 +344,13 @@ RamdiskUnmapPages(IN PRAMDISK_DRIVE_EXTENSION DeviceExtension,
     /* We only support boot disks for now */
     ASSERT(DeviceExtension->DiskType == RAMDISK_BOOT_DISK);
 
+    /* Nothing to do if this came from the persistent view */
+    if ((DeviceExtension->MappedBase) &&
+        (Offset.QuadPart + Length <= DeviceExtension->MappedLength))
+    {
+        return;
+    }
+
     /* Calculate the actual offset in the drive */
     ActualOffset.QuadPart = DeviceExtension->DiskOffset + Offset.QuadPart;
 
@@ -344,6 +370,77 @@ RamdiskUnmapPages(IN PRAMDISK_DRIVE_EXTENSION DeviceExtension,
     MmUnmapIoSpace(BaseAddress, ActualLength);
 }
 
+VOID
+NTAPI
+RamdiskMapDisk(IN PRAMDISK_DRIVE_EXTENSION DeviceExtension)
+{
+    PHYSICAL_ADDRESS PhysicalAddress;
+    PVOID MappedBase;
+    SIZE_T ActualLength;
+    ULONG PageOffset, ViewLength;
+
+    /* Only boot disks live in physical memory we can keep mapped */
+    if (DeviceExtension->DiskType != RAMDISK_BOOT_DISK) return;
+    if (DeviceExtension->DiskLength.QuadPart == 0) return;
+
+    /*
+     * Only keep the start of the disk mapped, where the boot sector, the
+     * partition table and the file system metadata are. A view of the
+     * whole disk would pin a system PTE per page for good. Anything
+     * beyond the view is mapped per request, as before.
+     */
+    ViewLength = min(RAMDISK_PERSISTENT_VIEW_LENGTH, MaximumPerDiskViewLength);
+    if (DeviceExtension->DiskLength.QuadPart < ViewLength)
+        ViewLength = DeviceExtension->DiskLength.LowPart;
+
+    /* Calculate the physical address of the first page of the disk */
+    PhysicalAddress.QuadPart = ((ULONGLONG)DeviceExtension->BasePage +
+                                (DeviceExtension->DiskOffset >> PAGE_SHIFT)) << PAGE_SHIFT;
+
+    /* Calculate pages spanned by the view, and convert back to bytes */
+    ActualLength = ADDRESS_AND_SIZE_TO_SPAN_PAGES(DeviceExtension->DiskOffset,
+                                                  ViewLength);
+    ActualLength <<= PAGE_SHIFT;
+
+    /* Get the offset within the page */
+    PageOffset = BYTE_OFFSET(DeviceExtension->DiskOffset);
+
+    /* Map the view once; on failure we fall back to per-request views */
+    MappedBase = MmMapIoSpace(PhysicalAddress, ActualLength, MmCached);
+    if (!MappedBase)
+    {
+        DPRINT1("Failed to map the start of the RAM disk, using per-request views\n");
+        return;
+    }
+
+    /* Boot disks are never removed, so this view is never torn down */
+    DeviceExtension->MappedBase = (PVOID)((ULONG_PTR)MappedBase + PageOffset);
+    DeviceExtension->MappedLength = ViewLength;
+}
+
+VOID
+NTAPI
+RamdiskUpdateStatistics(IN PRAMDISK_DRIVE_EXTENSION DeviceExtension,
+                        IN UCHAR MajorFunction,
+                        IN ULONG_PTR Length,
+                        IN BOOLEAN Inline)
+{
+    /* Account the request */
+    if (MajorFunction == IRP_MJ_READ)
+    {
+        ExInterlockedAddLargeStatistic(&DeviceExtension->Statistics.ReadCount, 1);
+        ExInterlockedAddLargeStatistic(&DeviceExtension->Statistics.BytesRead, (ULONG)Length);
+    }
+    else
+    {
+        ExInterlockedAddLargeStatistic(&DeviceExtension->Statistics.WriteCount, 1);
+        ExInterlockedAddLargeStatistic(&DeviceExtension->Statistics.BytesWritten, (ULONG)Length);
+    }
+
+    /* And how it got serviced */
+    if (Inline) ExInterlockedAddLargeStatistic(&DeviceExtension->Statistics.InlineCount, 1);
+}
+
 NTSTATUS
 NTAPI
 RamdiskCreateDiskDevice(IN PRAMDISK_BUS_EXTENSION DeviceExtension,
@@ -529,6 +626,13 @@ RamdiskCreateDiskDevice(IN PRAMDISK_BUS_EXTENSION DeviceExtension,
         DriveExtension->BytesPerSector = 0;
         DriveExtension->SectorsPerTrack = 0;
         DriveExtension->NumberOfHeads = 0;
+        DriveExtension->MappedBase = NULL;
+        DriveExtension->MappedLength = 0;
+        RtlZeroMemory(&DriveExtension->Statistics, sizeof(RAMDISK_STATISTICS));
+        DriveExtension->CreationTime = KeQueryInterruptTime();
+
+        /* Try to keep the start of the disk mapped, so its I/O doesn't need to map it */
+        RamdiskMapDisk(DriveExtension);
 
         /* Make sure we don't free it later */
         DeviceName.Buffer = NULL;
@@ -826,6 +930,14 @@ RamdiskWorkerThread(IN PDEVICE_OBJECT DeviceObject,
 
     /* Grab the device extension and lock it */
     DeviceExtension = DeviceObject->DeviceExtension;
+
+    /* Account the time this request spent queued */
+    if (DeviceExtension->Type == RamdiskDrive)
+    {
+        ExInterlockedAddLargeStatistic(&((PRAMDISK_DRIVE_EXTENSION)DeviceExtension)->Statistics.QueueWaitTime,
+                                       (ULONG)((ULONG_PTR)KeQueryInterruptTime() -
+                                               (ULONG_PTR)Irp->Tail.Overlay.DriverContext[1]));
+    }
     Status = IoAcquireRemoveLock(&DeviceExtension->RemoveLock, Irp);
     if (NT_SUCCESS(Status))
     {
@@ -922,6 +1034,13 @@ SendIrpToThread(IN PDEVICE_OBJECT DeviceObject,
     WorkItem = IoAllocateWorkItem(DeviceObject);
     if (WorkItem)
     {
+        /* Count it, and remember when it got queued (truncation is fine for a delta) */
+        if (((PRAMDISK_EXTENSION)DeviceObject->DeviceExtension)->Type == RamdiskDrive)
+        {
+            ExInterlockedAddLargeStatistic(&((PRAMDISK_DRIVE_EXTENSION)DeviceObject->DeviceExtension)->Statistics.QueuedCount, 1);
+        }
+        Irp->Tail.Overlay.DriverContext[1] = (PVOID)(ULONG_PTR)KeQueryInterruptTime();
+
         /* Queue it up */
         Irp->Tail.Overlay.DriverContext[0] = WorkItem;
         IoQueueWorkItem(WorkItem, RamdiskWorkerThread, DelayedWorkQueue, Irp);
@@ -1030,6 +1149,37 @@ DoCopy:
     }
 }
 
+NTSTATUS
+NTAPI
+RamdiskReadWriteDirect(IN PIRP Irp,
+                       IN PRAMDISK_DRIVE_EXTENSION DeviceExtension)
+{
+    PVOID SystemVa, DiskVa;
+    PIO_STACK_LOCATION IoStackLocation;
+
+    /* Get the buffer */
+    SystemVa = MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority);
+    if (!SystemVa) return STATUS_INSUFFICIENT_RESOURCES;
+
+    /* The caller made sure the request lies within the persistent view */
+    IoStackLocation = IoGetCurrentIrpStackLocation(Irp);
+    DiskVa = (PVOID)((ULONG_PTR)DeviceExtension->MappedBase +
+                     IoStackLocation->Parameters.Read.ByteOffset.QuadPart);
+
+    /* Copy the data */
+    if (IoStackLocation->MajorFunction == IRP_MJ_READ)
+    {
+        RtlCopyMemory(SystemVa, DiskVa, IoStackLocation->Parameters.Read.Length);
+    }
+    else
+    {
+        RtlCopyMemory(DiskVa, SystemVa, IoStackLocation->Parameters.Read.Length);
+    }
+
+    Irp->IoStatus.Information = IoStackLocation->Parameters.Read.Length;
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS
 NTAPI
 RamdiskOpenClose(IN PDEVICE_OBJECT DeviceObject,
@@ -1048,8 +1198,8 @@ RamdiskReadWrite(IN PDEVICE_OBJECT DeviceObject,
                  IN PIRP Irp)
 {
     PRAMDISK_DRIVE_EXTENSION DeviceExtension;
-    // ULONG Length;
-    // LARGE_INTEGER ByteOffset;
+    ULONG Length;
+    LARGE_INTEGER ByteOffset;
     PIO_STACK_LOCATION IoStackLocation;
     NTSTATUS Status, ReturnStatus;
 
@@ -1064,8 +1214,8 @@ RamdiskReadWrite(IN PDEVICE_OBJECT DeviceObject,
 
     /* Capture parameters */
     IoStackLocation = IoGetCurrentIrpStackLocation(Irp);
-    // Length = IoStackLocation->Parameters.Read.Length;
-    // ByteOffset = IoStackLocation->Parameters.Read.ByteOffset;
+    Length = IoStackLocation->Parameters.Read.Length;
+    ByteOffset = IoStackLocation->Parameters.Read.ByteOffset;
 
     /* FIXME: Validate offset */
 
@@ -1080,11 +1230,36 @@ RamdiskReadWrite(IN PDEVICE_OBJECT DeviceObject,
         goto Complete;
     }
 
+    /* Requests inside the persistent view are copied right here */
+    if ((DeviceExtension->MappedBase) &&
+        (Length != 0) &&
+        (ByteOffset.QuadPart >= 0) &&
+        (Length <= DeviceExtension->MappedLength) &&
+        (ByteOffset.QuadPart <= DeviceExtension->MappedLength - Length))
+    {
+        Status = RamdiskReadWriteDirect(Irp, DeviceExtension);
+        if (NT_SUCCESS(Status))
+        {
+            RamdiskUpdateStatistics(DeviceExtension,
+                                    IoStackLocation->MajorFunction,
+                                    Irp->IoStatus.Information,
+                                    TRUE);
+        }
+        goto Complete;
+    }
+
     /* See if we want to do this sync or async */
     if (DeviceExtension->DiskType > RAMDISK_MEMORY_MAPPED_DISK)
     {
         /* Do it sync */
         Status = RamdiskReadWriteReal(Irp, DeviceExtension);
+        if (NT_SUCCESS(Status))
+        {
+            RamdiskUpdateStatistics(DeviceExtension,
+                                    IoStackLocation->MajorFunction,
+                                    Irp->IoStatus.Information,
+                                    TRUE);
+        }
         goto Complete;
     }
 
@@ -1118,6 +1293,7 @@ RamdiskDeviceControl(IN PDEVICE_OBJECT DeviceObject,
     ULONG Information;
     PCDROM_TOC Toc;
     PDISK_GEOMETRY DiskGeometry;
+    PRAMDISK_STATISTICS Statistics;
 
     /* Grab the remove lock */
     Status = IoAcquireRemoveLock(&DeviceExtension->RemoveLock, Irp);
@@ -1237,6 +1413,29 @@ RamdiskDeviceControl(IN PDEVICE_OBJECT DeviceObject,
                 break;
             }
 
+            case FSCTL_QUERY_RAM_DISK_STATISTICS:
+            {
+                /* Validate the length */
+                if (IoStackLocation->Parameters.DeviceIoControl.
+                    OutputBufferLength < sizeof(RAMDISK_STATISTICS))
+                {
+                    /* Invalid length */
+                    Status = STATUS_BUFFER_TOO_SMALL;
+                    break;
+                }
+
+                /* Snapshot the counters, callers derive rates from the elapsed time */
+                Statistics = Irp->AssociatedIrp.SystemBuffer;
+                *Statistics = DriveExtension->Statistics;
+                Statistics->ElapsedTime.QuadPart = KeQueryInterruptTime() -
+                                                   DriveExtension->CreationTime;
+
+                /* We're done */
+                Status = STATUS_SUCCESS;
+                Information = sizeof(RAMDISK_STATISTICS);
+                break;
+            }
+
             case IOCTL_DISK_GET_PARTITION_INFO:
             {
                 /* Validate the length */
@@ -0,0 +1,640 @@
+/*
+ * PROJECT:     ReactOS NVMe Storport Miniport Driver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        drivers/storage/port/stornvme/io.c
+ * PURPOSE:     SCSI translation, submission and completion
+ * PROGRAMMERS: ReactOS Team
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include "stornvme.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* FUNCTIONS ******************************************************************/
+
+static
+VOID
+NvmeCompleteRequest(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _In_ UCHAR SrbStatus)
+{
+    Srb->SrbStatus = SrbStatus;
+    StorPortNotification(RequestComplete, DevExt, Srb);
+}
+
+
+static
+VOID
+NvmeCompleteWithSense(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _In_ UCHAR SenseKey,
+    _In_ UCHAR AdditionalSenseCode)
+{
+    SENSE_DATA Sense;
+    UCHAR SrbStatus = SRB_STATUS_ERROR;
+
+    Srb->ScsiStatus = SCSISTAT_CHECK_CONDITION;
+
+    if (Srb->SenseInfoBuffer != NULL && Srb->SenseInfoBufferLength != 0 &&
+        !(Srb->SrbFlags & SRB_FLAGS_DISABLE_AUTOSENSE))
+    {
+        RtlZeroMemory(&Sense, sizeof(Sense));
+        Sense.ErrorCode = 0x70;
+        Sense.SenseKey = SenseKey;
+        Sense.AdditionalSenseLength = sizeof(Sense) - 8;
+        Sense.AdditionalSenseCode = AdditionalSenseCode;
+
+        Srb->SenseInfoBufferLength = (UCHAR)min(Srb->SenseInfoBufferLength, sizeof(Sense));
+        RtlCopyMemory(Srb->SenseInfoBuffer, &Sense, Srb->SenseInfoBufferLength);
+        SrbStatus |= SRB_STATUS_AUTOSENSE_VALID;
+    }
+
+    NvmeCompleteRequest(DevExt, Srb, SrbStatus);
+}
+
+
+static
+VOID
+NvmeCopyString(
+    _Out_writes_(DestinationLength) PUCHAR Destination,
+    _In_ ULONG DestinationLength,
+    _In_reads_(SourceLength) PUCHAR Source,
+    _In_ ULONG SourceLength)
+{
+    ULONG i;
+
+    /* Identify strings are space padded ASCII, just like the inquiry ones */
+    for (i = 0; i < DestinationLength; i++)
+        Destination[i] = (i < SourceLength && Source[i] != 0) ? Source[i] : ' ';
+}
+
+
+static
+VOID
+NvmeInquiry(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    INQUIRYDATA Inquiry;
+
+    /* No vital product data pages */
+    if (Srb->Cdb[1] & 1)
+    {
+        NvmeCompleteWithSense(DevExt, Srb, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ADSENSE_INVALID_CDB);
+        return;
+    }
+
+    RtlZeroMemory(&Inquiry, sizeof(Inquiry));
+    Inquiry.DeviceType = DIRECT_ACCESS_DEVICE;
+    Inquiry.Versions = 5;
+    Inquiry.ResponseDataFormat = 2;
+    Inquiry.AdditionalLength = INQUIRYDATABUFFERSIZE - 5;
+    Inquiry.CommandQueue = 1;
+    NvmeCopyString(Inquiry.VendorId, sizeof(Inquiry.VendorId), (PUCHAR)"NVMe", 4);
+    NvmeCopyString(Inquiry.ProductId, sizeof(Inquiry.ProductId),
+                   DevExt->ModelNumber, sizeof(DevExt->ModelNumber));
+    NvmeCopyString(Inquiry.ProductRevisionLevel, sizeof(Inquiry.ProductRevisionLevel),
+                   DevExt->FirmwareRevision, sizeof(DevExt->FirmwareRevision));
+
+    Srb->DataTransferLength = min(Srb->DataTransferLength, INQUIRYDATABUFFERSIZE);
+    RtlCopyMemory(Srb->DataBuffer, &Inquiry, Srb->DataTransferLength);
+
+    NvmeCompleteRequest(DevExt, Srb, SRB_STATUS_SUCCESS);
+}
+
+
+static
+VOID
+NvmeReadCapacity(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _In_ PNVME_NAMESPACE Namespace)
+{
+    READ_CAPACITY_DATA Capacity;
+    ULONG LastBlock, BlockSize;
+
+    if (Srb->DataTransferLength < sizeof(Capacity))
+    {
+        NvmeCompleteRequest(DevExt, Srb, SRB_STATUS_DATA_OVERRUN);
+        return;
+    }
+
+    /* Too big for 32 bits, tell the class driver to use READ CAPACITY (16) */
+    LastBlock = (ULONG)min(Namespace->BlockCount - 1, 0xFFFFFFFF);
+    BlockSize = Namespace->BlockSize;
+
+    REVERSE_BYTES(&Capacity.LogicalBlockAddress, &LastBlock);
+    REVERSE_BYTES(&Capacity.BytesPerBlock, &BlockSize);
+
+    Srb->DataTransferLength = sizeof(Capacity);
+    RtlCopyMemory(Srb->DataBuffer, &Capacity, sizeof(Capacity));
+
+    NvmeCompleteRequest(DevExt, Srb, SRB_STATUS_SUCCESS);
+}
+
+
+static
+VOID
+NvmeReadCapacity16(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _In_ PNVME_NAMESPACE Namespace)
+{
+    READ_CAPACITY_DATA_EX Capacity;
+    ULONGLONG LastBlock;
+    ULONG BlockSize;
+
+    /* READ CAPACITY (16) is service action 0x10 of SERVICE ACTION IN (16) */
+    if ((Srb->Cdb[1] & 0x1F) != 0x10)
+    {
+        NvmeCompleteWithSense(DevExt, Srb, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ADSENSE_INVALID_CDB);
+        return;
+    }
+
+    if (Srb->DataTransferLength < sizeof(Capacity))
+    {
+        NvmeCompleteRequest(DevExt, Srb, SRB_STATUS_DATA_OVERRUN);
+        return;
+    }
+
+    LastBlock = Namespace->BlockCount - 1;
+    BlockSize = Namespace->BlockSize;
+
+    REVERSE_BYTES_QUAD(&Capacity.LogicalBlockAddress, &LastBlock);
+    REVERSE_BYTES(&Capacity.BytesPerBlock, &BlockSize);
+
+    Srb->DataTransferLength = sizeof(Capacity);
+    RtlCopyMemory(Srb->DataBuffer, &Capacity, sizeof(Capacity));
+
+    NvmeCompleteRequest(DevExt, Srb, SRB_STATUS_SUCCESS);
+}
+
+
+static
+VOID
+NvmeModeSense(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    PMODE_PARAMETER_HEADER Header;
+    PMODE_PARAMETER_HEADER10 Header10;
+    ULONG Length;
+
+    /* No mode pages, just a header saying the medium is writable */
+    if (Srb->Cdb[0] == SCSIOP_MODE_SENSE)
+        Length = sizeof(MODE_PARAMETER_HEADER);
+    else
+        Length = sizeof(MODE_PARAMETER_HEADER10);
+
+    if (Srb->DataTransferLength < Length)
+    {
+        NvmeCompleteRequest(DevExt, Srb, SRB_STATUS_DATA_OVERRUN);
+        return;
+    }
+
+    RtlZeroMemory(Srb->DataBuffer, Length);
+
+    if (Srb->Cdb[0] == SCSIOP_MODE_SENSE)
+    {
+        Header = Srb->DataBuffer;
+        Header->ModeDataLength = sizeof(MODE_PARAMETER_HEADER) - 1;
+    }
+    else
+    {
+        Header10 = Srb->DataBuffer;
+        Header10->ModeDataLength[1] = sizeof(MODE_PARAMETER_HEADER10) - 2;
+    }
+
+    Srb->DataTransferLength = Length;
+
+    NvmeCompleteRequest(DevExt, Srb, SRB_STATUS_SUCCESS);
+}
+
+
+static
+BOOLEAN
+NvmeBuildPageList(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _Inout_ PNVME_SRB_EXTENSION SrbExt)
+{
+    PSTOR_SCATTER_GATHER_LIST SgList;
+    ULONGLONG Address, End;
+    ULONG Remaining, Chunk, i;
+
+    SgList = StorPortGetScatterGatherList(DevExt, Srb);
+    if (SgList == NULL)
+        return FALSE;
+
+    /*
+     * A PRP entry describes a memory page, so only the first one may start
+     * at an offset, and every element but the last has to end on a page
+     * boundary. Storport builds the list from the MDL, which guarantees it.
+     */
+    SrbExt->PageCount = 0;
+    for (i = 0; i < SgList->NumberOfElements; i++)
+    {
+        Address = SgList->List[i].PhysicalAddress.QuadPart;
+        Remaining = SgList->List[i].Length;
+        End = Address + Remaining;
+
+        if (i != 0 && (Address & (NVME_PAGE_SIZE - 1)) != 0)
+            return FALSE;
+
+        if (i != SgList->NumberOfElements - 1 && (End & (NVME_PAGE_SIZE - 1)) != 0)
+            return FALSE;
+
+        while (Remaining != 0)
+        {
+            if (SrbExt->PageCount == NVME_MAX_PRP_PAGES)
+                return FALSE;
+
+            SrbExt->Pages[SrbExt->PageCount++] = Address;
+
+            Chunk = NVME_PAGE_SIZE - (ULONG)(Address & (NVME_PAGE_SIZE - 1));
+            Chunk = min(Chunk, Remaining);
+            Address += Chunk;
+            Remaining -= Chunk;
+        }
+    }
+
+    return (SrbExt->PageCount != 0);
+}
+
+
+static
+BOOLEAN
+NvmeBuildReadWrite(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _In_ PNVME_NAMESPACE Namespace,
+    _Inout_ PNVME_SRB_EXTENSION SrbExt)
+{
+    PCDB Cdb = (PCDB)Srb->Cdb;
+    PNVME_COMMAND Command = &SrbExt->Command;
+    ULONGLONG Lba;
+    ULONG Blocks;
+    BOOLEAN Write, Fua;
+
+    switch (Srb->Cdb[0])
+    {
+        case SCSIOP_READ:
+        case SCSIOP_WRITE:
+            Lba = ((ULONG)Cdb->CDB10.LogicalBlockByte0 << 24) |
+                  ((ULONG)Cdb->CDB10.LogicalBlockByte1 << 16) |
+                  ((ULONG)Cdb->CDB10.LogicalBlockByte2 << 8) |
+                  Cdb->CDB10.LogicalBlockByte3;
+            Blocks = ((ULONG)Cdb->CDB10.TransferBlocksMsb << 8) |
+                     Cdb->CDB10.TransferBlocksLsb;
+            Fua = Cdb->CDB10.ForceUnitAccess;
+            Write = (Srb->Cdb[0] == SCSIOP_WRITE);
+            break;
+
+        default:
+            REVERSE_BYTES_QUAD(&Lba, Cdb->CDB16.LogicalBlock);
+            REVERSE_BYTES(&Blocks, Cdb->CDB16.TransferLength);
+            Fua = Cdb->CDB16.ForceUnitAccess;
+            Write = (Srb->Cdb[0] == SCSIOP_WRITE16);
+            break;
+    }
+
+    if (Blocks == 0 || Blocks > 0x10000 ||
+        Lba + Blocks > Namespace->BlockCount ||
+        (ULONGLONG)Blocks * Namespace->BlockSize != Srb->DataTransferLength)
+    {
+        NvmeCompleteWithSense(DevExt, Srb, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ADSENSE_ILLEGAL_BLOCK);
+        return FALSE;
+    }
+
+    if (!NvmeBuildPageList(DevExt, Srb, SrbExt))
+    {
+        DPRINT1("Unusable scatter/gather list for SRB %p\n", Srb);
+        NvmeCompleteRequest(DevExt, Srb, SRB_STATUS_INVALID_REQUEST);
+        return FALSE;
+    }
+
+    Command->Opcode = Write ? NVME_CMD_WRITE : NVME_CMD_READ;
+    Command->NamespaceId = Srb->Lun + 1;
+    Command->Cdw10 = (ULONG)Lba;
+    Command->Cdw11 = (ULONG)(Lba >> 32);
+    Command->Cdw12 = (Blocks - 1) | (Fua ? (1UL << 30) : 0);
+
+    return TRUE;
+}
+
+
+BOOLEAN
+NTAPI
+NvmeHwBuildIo(
+    _In_ PVOID DeviceExtension,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    PNVME_DEVICE_EXTENSION DevExt = DeviceExtension;
+    PNVME_SRB_EXTENSION SrbExt = Srb->SrbExtension;
+    PNVME_NAMESPACE Namespace;
+
+    /* Runs on the submitting processor without any lock, so only look at the SRB */
+    RtlZeroMemory(&SrbExt->Command, sizeof(NVME_COMMAND));
+    SrbExt->PageCount = 0;
+
+    switch (Srb->Function)
+    {
+        case SRB_FUNCTION_EXECUTE_SCSI:
+            break;
+
+        case SRB_FUNCTION_FLUSH:
+        case SRB_FUNCTION_SHUTDOWN:
+            if (Srb->Lun >= DevExt->NamespaceCount || !DevExt->Namespaces[Srb->Lun].Present)
+                break;
+            SrbExt->Command.Opcode = NVME_CMD_FLUSH;
+            SrbExt->Command.NamespaceId = Srb->Lun + 1;
+            return TRUE;
+
+        case SRB_FUNCTION_RESET_BUS:
+        case SRB_FUNCTION_RESET_DEVICE:
+        case SRB_FUNCTION_RESET_LOGICAL_UNIT:
+            NvmeCompleteRequest(DevExt, Srb, SRB_STATUS_SUCCESS);
+            return FALSE;
+
+        default:
+            NvmeCompleteRequest(DevExt, Srb, SRB_STATUS_INVALID_REQUEST);
+            return FALSE;
+    }
+
+    if (Srb->Function != SRB_FUNCTION_EXECUTE_SCSI ||
+        Srb->PathId != 0 || Srb->TargetId != 0 ||
+        Srb->Lun >= DevExt->NamespaceCount ||
+        !DevExt->Namespaces[Srb->Lun].Present)
+    {
+        NvmeCompleteRequest(DevExt, Srb, SRB_STATUS_NO_DEVICE);
+        return FALSE;
+    }
+
+    Namespace = &DevExt->Namespaces[Srb->Lun];
+
+    switch (Srb->Cdb[0])
+    {
+        case SCSIOP_READ:
+        case SCSIOP_WRITE:
+        case SCSIOP_READ16:
+        case SCSIOP_WRITE16:
+            return NvmeBuildReadWrite(DevExt, Srb, Namespace, SrbExt);
+
+        case SCSIOP_SYNCHRONIZE_CACHE:
+            SrbExt->Command.Opcode = NVME_CMD_FLUSH;
+            SrbExt->Command.NamespaceId = Srb->Lun + 1;
+            return TRUE;
+
+        /* Everything below is answered right here */
+        case SCSIOP_INQUIRY:
+            NvmeInquiry(DevExt, Srb);
+            return FALSE;
+
+        case SCSIOP_READ_CAPACITY:
+            NvmeReadCapacity(DevExt, Srb, Namespace);
+            return FALSE;
+
+        case SCSIOP_SERVICE_ACTION_IN16:
+            NvmeReadCapacity16(DevExt, Srb, Namespace);
+            return FALSE;
+
+        case SCSIOP_MODE_SENSE:
+        case SCSIOP_MODE_SENSE10:
+            NvmeModeSense(DevExt, Srb);
+            return FALSE;
+
+        case SCSIOP_TEST_UNIT_READY:
+        case SCSIOP_START_STOP_UNIT:
+        case SCSIOP_MEDIUM_REMOVAL:
+        case SCSIOP_VERIFY:
+        case SCSIOP_RESERVE_UNIT:
+        case SCSIOP_RELEASE_UNIT:
+            Srb->DataTransferLength = 0;
+            NvmeCompleteRequest(DevExt, Srb, SRB_STATUS_SUCCESS);
+            return FALSE;
+
+        default:
+            DPRINT("Unsupported SCSI operation 0x%02x\n", Srb->Cdb[0]);
+            NvmeCompleteWithSense(DevExt, Srb, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ADSENSE_ILLEGAL_COMMAND);
+            return FALSE;
+    }
+}
+
+
+static
+PNVME_QUEUE
+NvmeSelectQueue(
+    _In_ PNVME_DEVICE_EXTENSION DevExt)
+{
+    PNVME_QUEUE Queue;
+    ULONG First, i;
+
+    /*
+     * Stay on this processor's queue, so its completion comes back here.
+     * A queue of Depth entries holds at most Depth - 1 commands, as a full
+     * queue would look empty to the controller.
+     */
+    First = KeGetCurrentProcessorNumber() % DevExt->IoQueueCount;
+
+    for (i = 0; i < DevExt->IoQueueCount; i++)
+    {
+        Queue = &DevExt->IoQueues[(First + i) % DevExt->IoQueueCount];
+        if (Queue->Outstanding < Queue->Depth - 1)
+            return Queue;
+    }
+
+    return NULL;
+}
+
+
+BOOLEAN
+NTAPI
+NvmeHwStartIo(
+    _In_ PVOID DeviceExtension,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    PNVME_DEVICE_EXTENSION DevExt = DeviceExtension;
+    PNVME_SRB_EXTENSION SrbExt = Srb->SrbExtension;
+    PNVME_COMMAND Command = &SrbExt->Command;
+    PNVME_QUEUE Queue;
+    PULONGLONG PrpList;
+    USHORT CommandId;
+    ULONG i;
+
+    Queue = NvmeSelectQueue(DevExt);
+    if (Queue == NULL)
+    {
+        /*
+         * Every queue is full. Nothing holds the adapter: the request fails
+         * as busy, Storport freezes the LUN queue and the class driver
+         * releases it and retries the request.
+         */
+        NvmeCompleteRequest(DevExt, Srb, SRB_STATUS_BUSY);
+        return TRUE;
+    }
+
+    /* A command id is a free slot in the request table */
+    CommandId = Queue->NextCommandId;
+    for (i = 0; i < Queue->Depth; i++)
+    {
+        if (Queue->Requests[CommandId] == NULL)
+            break;
+        CommandId = (CommandId + 1) % Queue->Depth;
+    }
+    ASSERT(Queue->Requests[CommandId] == NULL);
+    Queue->NextCommandId = (CommandId + 1) % Queue->Depth;
+
+    Command->CommandId = CommandId;
+
+    if (SrbExt->PageCount != 0)
+    {
+        Command->Prp1 = SrbExt->Pages[0];
+
+        if (SrbExt->PageCount == 2)
+        {
+            Command->Prp2 = SrbExt->Pages[1];
+        }
+        else if (SrbExt->PageCount > 2)
+        {
+            /* The rest goes into this command's PRP list slot */
+            PrpList = (PULONGLONG)((PUCHAR)Queue->PrpLists + CommandId * NVME_PRP_LIST_SIZE);
+            RtlCopyMemory(PrpList, &SrbExt->Pages[1], (SrbExt->PageCount - 1) * sizeof(ULONGLONG));
+            Command->Prp2 = Queue->PrpListsPhysical.QuadPart + CommandId * NVME_PRP_LIST_SIZE;
+        }
+    }
+
+    Queue->Requests[CommandId] = Srb;
+    InterlockedIncrement(&Queue->Outstanding);
+
+    RtlCopyMemory(&Queue->SubmissionQueue[Queue->SqTail], Command, sizeof(NVME_COMMAND));
+    Queue->SqTail = (Queue->SqTail + 1) % Queue->Depth;
+
+    KeMemoryBarrier();
+    StorPortWriteRegisterUlong(DevExt, Queue->SubmissionDoorbell, Queue->SqTail);
+
+    return TRUE;
+}
+
+
+static
+VOID
+NvmeTranslateStatus(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _In_ USHORT Status)
+{
+    if (NVME_STATUS_SC(Status) == 0 && NVME_STATUS_SCT(Status) == NVME_SCT_GENERIC)
+    {
+        NvmeCompleteRequest(DevExt, Srb, SRB_STATUS_SUCCESS);
+        return;
+    }
+
+    DPRINT1("Command failed for SRB %p (SCT %u SC 0x%02x)\n",
+            Srb, NVME_STATUS_SCT(Status), NVME_STATUS_SC(Status));
+
+    if (NVME_STATUS_SCT(Status) == NVME_SCT_MEDIA)
+        NvmeCompleteWithSense(DevExt, Srb, SCSI_SENSE_MEDIUM_ERROR, SCSI_ADSENSE_NO_SENSE);
+    else
+        NvmeCompleteWithSense(DevExt, Srb, SCSI_SENSE_HARDWARE_ERROR, SCSI_ADSENSE_NO_SENSE);
+}
+
+
+static
+BOOLEAN
+NvmeProcessCompletions(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _In_ PNVME_QUEUE Queue)
+{
+    PNVME_COMPLETION Completion;
+    PSCSI_REQUEST_BLOCK Srb;
+    BOOLEAN Processed = FALSE;
+
+    for (;;)
+    {
+        Completion = &Queue->CompletionQueue[Queue->CqHead];
+        if (NVME_STATUS_PHASE(Completion->Status) != Queue->Phase)
+            break;
+
+        Processed = TRUE;
+        Queue->SqHead = Completion->SqHead;
+
+        if (Completion->CommandId < Queue->Depth &&
+            (Srb = Queue->Requests[Completion->CommandId]) != NULL)
+        {
+            Queue->Requests[Completion->CommandId] = NULL;
+            InterlockedDecrement(&Queue->Outstanding);
+            NvmeTranslateStatus(DevExt, Srb, Completion->Status);
+        }
+        else
+        {
+            DPRINT1("Spurious completion for command %u on queue %u\n",
+                    Completion->CommandId, Queue->QueueId);
+        }
+
+        if (++Queue->CqHead == Queue->Depth)
+        {
+            Queue->CqHead = 0;
+            Queue->Phase ^= 1;
+        }
+    }
+
+    /* One doorbell write for the whole batch */
+    if (Processed)
+        StorPortWriteRegisterUlong(DevExt, Queue->CompletionDoorbell, Queue->CqHead);
+
+    return Processed;
+}
+
+
+BOOLEAN
+NTAPI
+NvmeHwInterrupt(
+    _In_ PVOID DeviceExtension)
+{
+    PNVME_DEVICE_EXTENSION DevExt = DeviceExtension;
+    BOOLEAN Handled = FALSE;
+    ULONG i;
+
+    /* Line interrupt, or a single message: all queues share it */
+    for (i = 0; i < DevExt->IoQueueCount; i++)
+    {
+        if (NvmeProcessCompletions(DevExt, &DevExt->IoQueues[i]))
+            Handled = TRUE;
+    }
+
+    return Handled;
+}
+
+
+BOOLEAN
+NTAPI
+NvmeHwMessageInterrupt(
+    _In_ PVOID DeviceExtension,
+    _In_ ULONG MessageId)
+{
+    PNVME_DEVICE_EXTENSION DevExt = DeviceExtension;
+    BOOLEAN Handled = FALSE;
+    ULONG i;
+
+    if (DevExt->MessageCount <= 1)
+        return NvmeHwInterrupt(DevExt);
+
+    for (i = 0; i < DevExt->IoQueueCount; i++)
+    {
+        if (DevExt->IoQueues[i].MessageId != MessageId)
+            continue;
+
+        if (NvmeProcessCompletions(DevExt, &DevExt->IoQueues[i]))
+            Handled = TRUE;
+    }
+
+    /* Message interrupts are never shared */
+    return (MessageId != 0) ? TRUE : Handled;
+}
+
+/* EOF */
@@ -0,0 +1,618 @@
+/*
+ * PROJECT:     ReactOS NVMe Storport Miniport Driver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        drivers/storage/port/stornvme/stornvme.c
+ * PURPOSE:     Driver entry and controller initialization
+ * PROGRAMMERS: ReactOS Team
+ */
+
+/*
+ * The controller gets one admin queue, used only while initializing, and up
+ * to one I/O queue pair per processor. HwStartIo submits on the queue of the
+ * processor it runs on, so requests from different processors don't share a
+ * submission queue tail or a doorbell. With message signaled interrupts each
+ * completion queue gets its own message, otherwise the line interrupt looks
+ * at all of them.
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include "stornvme.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* FUNCTIONS ******************************************************************/
+
+static
+ULONG
+NvmeReadRegister(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _In_ ULONG Offset)
+{
+    return StorPortReadRegisterUlong(DevExt, (PULONG)(DevExt->Registers + Offset));
+}
+
+
+static
+VOID
+NvmeWriteRegister(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _In_ ULONG Offset,
+    _In_ ULONG Value)
+{
+    StorPortWriteRegisterUlong(DevExt, (PULONG)(DevExt->Registers + Offset), Value);
+}
+
+
+static
+VOID
+NvmeWriteRegister64(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _In_ ULONG Offset,
+    _In_ ULONGLONG Value)
+{
+    NvmeWriteRegister(DevExt, Offset, (ULONG)Value);
+    NvmeWriteRegister(DevExt, Offset + 4, (ULONG)(Value >> 32));
+}
+
+
+static
+BOOLEAN
+NvmeWaitReady(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _In_ BOOLEAN Ready)
+{
+    ULONG Status, i;
+
+    for (i = 0; i < DevExt->TimeoutMs; i++)
+    {
+        Status = NvmeReadRegister(DevExt, NVME_REG_CSTS);
+        if (Status == 0xFFFFFFFF)
+            return FALSE;
+
+        if (!!(Status & NVME_CSTS_RDY) == Ready)
+            return TRUE;
+
+        StorPortStallExecution(1000);
+    }
+
+    DPRINT1("Controller did not become %s\n", Ready ? "ready" : "disabled");
+    return FALSE;
+}
+
+
+static
+VOID
+NvmeInitializeQueue(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _Out_ PNVME_QUEUE Queue,
+    _In_ USHORT QueueId,
+    _In_ USHORT Depth,
+    _In_ PUCHAR Memory,
+    _In_ PHYSICAL_ADDRESS Physical)
+{
+    RtlZeroMemory(Queue, sizeof(NVME_QUEUE));
+
+    Queue->QueueId = QueueId;
+    Queue->Depth = Depth;
+    Queue->Phase = 1;
+
+    /* Submission queue in the first page, completion queue in the second */
+    Queue->SubmissionQueue = (PNVME_COMMAND)Memory;
+    Queue->SubmissionQueuePhysical = Physical;
+    Queue->CompletionQueue = (PNVME_COMPLETION)(Memory + NVME_PAGE_SIZE);
+    Queue->CompletionQueuePhysical.QuadPart = Physical.QuadPart + NVME_PAGE_SIZE;
+
+    Queue->SubmissionDoorbell = (PULONG)(DevExt->Registers + NVME_REG_DOORBELL +
+                                         (2 * QueueId) * DevExt->DoorbellStride);
+    Queue->CompletionDoorbell = (PULONG)(DevExt->Registers + NVME_REG_DOORBELL +
+                                         (2 * QueueId + 1) * DevExt->DoorbellStride);
+}
+
+
+BOOLEAN
+NvmeSubmitAdminCommand(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _Inout_ PNVME_COMMAND Command,
+    _Out_opt_ PULONG Result)
+{
+    PNVME_QUEUE Queue = &DevExt->AdminQueue;
+    PNVME_COMPLETION Completion;
+    ULONG i;
+
+    /* Only used before the interrupts are connected, so we poll */
+    Command->CommandId = Queue->SqTail;
+    RtlCopyMemory(&Queue->SubmissionQueue[Queue->SqTail], Command, sizeof(NVME_COMMAND));
+    Queue->SqTail = (Queue->SqTail + 1) % Queue->Depth;
+    StorPortWriteRegisterUlong(DevExt, Queue->SubmissionDoorbell, Queue->SqTail);
+
+    Completion = &Queue->CompletionQueue[Queue->CqHead];
+    for (i = 0; i < DevExt->TimeoutMs * 10; i++)
+    {
+        if (NVME_STATUS_PHASE(Completion->Status) == Queue->Phase)
+            break;
+
+        StorPortStallExecution(100);
+    }
+
+    if (NVME_STATUS_PHASE(Completion->Status) != Queue->Phase)
+    {
+        DPRINT1("Admin command 0x%02x timed out\n", Command->Opcode);
+        return FALSE;
+    }
+
+    if (++Queue->CqHead == Queue->Depth)
+    {
+        Queue->CqHead = 0;
+        Queue->Phase ^= 1;
+    }
+    StorPortWriteRegisterUlong(DevExt, Queue->CompletionDoorbell, Queue->CqHead);
+
+    if (NVME_STATUS_SC(Completion->Status) != 0 || NVME_STATUS_SCT(Completion->Status) != 0)
+    {
+        DPRINT1("Admin command 0x%02x failed (Status 0x%04x)\n", Command->Opcode, Completion->Status);
+        return FALSE;
+    }
+
+    if (Result != NULL)
+        *Result = Completion->Result;
+
+    return TRUE;
+}
+
+
+static
+BOOLEAN
+NvmeIdentify(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _In_ ULONG Cns,
+    _In_ ULONG NamespaceId)
+{
+    NVME_COMMAND Command;
+
+    RtlZeroMemory(&Command, sizeof(Command));
+    Command.Opcode = NVME_ADMIN_IDENTIFY;
+    Command.NamespaceId = NamespaceId;
+    Command.Prp1 = DevExt->IdentifyBufferPhysical.QuadPart;
+    Command.Cdw10 = Cns;
+
+    return NvmeSubmitAdminCommand(DevExt, &Command, NULL);
+}
+
+
+static
+BOOLEAN
+NvmeSetFeature(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _In_ ULONG Feature,
+    _In_ ULONG Value,
+    _Out_opt_ PULONG Result)
+{
+    NVME_COMMAND Command;
+
+    RtlZeroMemory(&Command, sizeof(Command));
+    Command.Opcode = NVME_ADMIN_SET_FEATURES;
+    Command.Cdw10 = Feature;
+    Command.Cdw11 = Value;
+
+    return NvmeSubmitAdminCommand(DevExt, &Command, Result);
+}
+
+
+static
+BOOLEAN
+NvmeCreateIoQueue(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _In_ PNVME_QUEUE Queue)
+{
+    NVME_COMMAND Command;
+
+    /* The completion queue has to exist first */
+    RtlZeroMemory(&Command, sizeof(Command));
+    Command.Opcode = NVME_ADMIN_CREATE_CQ;
+    Command.Prp1 = Queue->CompletionQueuePhysical.QuadPart;
+    Command.Cdw10 = ((ULONG)(Queue->Depth - 1) << 16) | Queue->QueueId;
+    Command.Cdw11 = (Queue->MessageId << 16) | 0x3; /* interrupts enabled, contiguous */
+    if (!NvmeSubmitAdminCommand(DevExt, &Command, NULL))
+        return FALSE;
+
+    RtlZeroMemory(&Command, sizeof(Command));
+    Command.Opcode = NVME_ADMIN_CREATE_SQ;
+    Command.Prp1 = Queue->SubmissionQueuePhysical.QuadPart;
+    Command.Cdw10 = ((ULONG)(Queue->Depth - 1) << 16) | Queue->QueueId;
+    Command.Cdw11 = ((ULONG)Queue->QueueId << 16) | 0x1; /* contiguous */
+
+    return NvmeSubmitAdminCommand(DevExt, &Command, NULL);
+}
+
+
+static
+BOOLEAN
+NvmeEnableController(
+    _In_ PNVME_DEVICE_EXTENSION DevExt)
+{
+    PNVME_QUEUE Queue = &DevExt->AdminQueue;
+
+    /* Start from a disabled controller */
+    NvmeWriteRegister(DevExt, NVME_REG_CC, 0);
+    if (!NvmeWaitReady(DevExt, FALSE))
+        return FALSE;
+
+    NvmeWriteRegister(DevExt, NVME_REG_AQA,
+                      ((ULONG)(Queue->Depth - 1) << 16) | (Queue->Depth - 1));
+    NvmeWriteRegister64(DevExt, NVME_REG_ASQ, Queue->SubmissionQueuePhysical.QuadPart);
+    NvmeWriteRegister64(DevExt, NVME_REG_ACQ, Queue->CompletionQueuePhysical.QuadPart);
+
+    NvmeWriteRegister(DevExt, NVME_REG_CC,
+                      NVME_CC_ENABLE | NVME_CC_CSS_NVM | NVME_CC_MPS_4K |
+                      NVME_CC_AMS_RR | NVME_CC_IOSQES | NVME_CC_IOCQES);
+
+    return NvmeWaitReady(DevExt, TRUE);
+}
+
+
+static
+VOID
+NvmeIdentifyNamespaces(
+    _In_ PNVME_DEVICE_EXTENSION DevExt)
+{
+    PNVME_IDENTIFY_NAMESPACE Identify = DevExt->IdentifyBuffer;
+    PNVME_NAMESPACE Namespace;
+    ULONG i, Format;
+
+    for (i = 0; i < DevExt->NamespaceCount; i++)
+    {
+        Namespace = &DevExt->Namespaces[i];
+        Namespace->Present = FALSE;
+
+        if (!NvmeIdentify(DevExt, NVME_CNS_NAMESPACE, i + 1))
+            continue;
+
+        /* Inactive namespaces report a size of zero */
+        if (Identify->Size == 0)
+            continue;
+
+        Format = Identify->LbaFormat[Identify->FormattedLbaSize & 0xF];
+        Namespace->BlockSize = 1 << ((Format >> 16) & 0xFF);
+        Namespace->BlockCount = Identify->Size;
+        Namespace->Present = TRUE;
+
+        DPRINT("Namespace %lu: %I64u blocks of %lu bytes\n",
+               i + 1, Namespace->BlockCount, Namespace->BlockSize);
+    }
+}
+
+
+static
+BOOLEAN
+NvmeInitializeController(
+    _In_ PNVME_DEVICE_EXTENSION DevExt)
+{
+    PNVME_IDENTIFY_CONTROLLER Identify = DevExt->IdentifyBuffer;
+    PNVME_QUEUE Queue;
+    ULONG Result, Granted, MaxTransferPages, i;
+
+    if (!NvmeEnableController(DevExt))
+        return FALSE;
+
+    if (!NvmeIdentify(DevExt, NVME_CNS_CONTROLLER, 0))
+        return FALSE;
+
+    RtlCopyMemory(DevExt->SerialNumber, Identify->SerialNumber, sizeof(DevExt->SerialNumber));
+    RtlCopyMemory(DevExt->ModelNumber, Identify->ModelNumber, sizeof(DevExt->ModelNumber));
+    RtlCopyMemory(DevExt->FirmwareRevision, Identify->FirmwareRevision, sizeof(DevExt->FirmwareRevision));
+
+    DevExt->NamespaceCount = min(Identify->NumberOfNamespaces, NVME_MAX_NAMESPACES);
+
+    /* MDTS is a power of two in units of the minimum page size, 0 means no limit */
+    MaxTransferPages = NVME_MAX_TRANSFER_PAGES;
+    if (Identify->Mdts != 0 && Identify->Mdts < 16)
+    {
+        MaxTransferPages = min(MaxTransferPages,
+                               (1UL << Identify->Mdts) << NVME_CAP_MPSMIN(DevExt->Capabilities));
+    }
+    DevExt->MaxTransferPages = MaxTransferPages;
+
+    /* Ask for one queue pair per processor and take what we get */
+    if (!NvmeSetFeature(DevExt,
+                        NVME_FEAT_NUMBER_OF_QUEUES,
+                        ((DevExt->IoQueueCount - 1) << 16) | (DevExt->IoQueueCount - 1),
+                        &Result))
+    {
+        return FALSE;
+    }
+
+    Granted = min((Result & 0xFFFF), (Result >> 16)) + 1;
+    DevExt->IoQueueCount = min(DevExt->IoQueueCount, Granted);
+
+    for (i = 0; i < DevExt->IoQueueCount; i++)
+    {
+        Queue = &DevExt->IoQueues[i];
+
+        /* Message 0 belongs to the admin queue when there are enough of them */
+        if (DevExt->MessageCount > 1)
+            Queue->MessageId = 1 + (i % (DevExt->MessageCount - 1));
+        else
+            Queue->MessageId = 0;
+
+        if (!NvmeCreateIoQueue(DevExt, Queue))
+        {
+            DPRINT1("Failed to create I/O queue %u\n", Queue->QueueId);
+
+            /* Keep going with the ones we have */
+            if (i == 0)
+                return FALSE;
+            DevExt->IoQueueCount = i;
+            break;
+        }
+    }
+
+    /* Trade a little latency for a lot fewer interrupts; optional, so ignore failures */
+    NvmeSetFeature(DevExt,
+                   NVME_FEAT_INTERRUPT_COALESCING,
+                   (NVME_COALESCE_TIME << 8) | NVME_COALESCE_THRESHOLD,
+                   NULL);
+
+    NvmeIdentifyNamespaces(DevExt);
+
+    return TRUE;
+}
+
+
+static
+VOID
+NvmeShutdownController(
+    _In_ PNVME_DEVICE_EXTENSION DevExt)
+{
+    ULONG Config, i;
+
+    Config = NvmeReadRegister(DevExt, NVME_REG_CC);
+    Config = (Config & ~NVME_CC_SHN_MASK) | NVME_CC_SHN_NORMAL;
+    NvmeWriteRegister(DevExt, NVME_REG_CC, Config);
+
+    for (i = 0; i < DevExt->TimeoutMs; i++)
+    {
+        if ((NvmeReadRegister(DevExt, NVME_REG_CSTS) & NVME_CSTS_SHST_MASK) == NVME_CSTS_SHST_COMPLETE)
+            break;
+
+        StorPortStallExecution(1000);
+    }
+
+    NvmeWriteRegister(DevExt, NVME_REG_CC, 0);
+}
+
+
+static
+ULONG
+NTAPI
+NvmeHwFindAdapter(
+    _In_ PVOID DeviceExtension,
+    _In_ PVOID HwContext,
+    _In_ PVOID BusInformation,
+    _In_ PCHAR ArgumentString,
+    _Inout_ PPORT_CONFIGURATION_INFORMATION ConfigInfo,
+    _Out_ PBOOLEAN Again)
+{
+    PNVME_DEVICE_EXTENSION DevExt = DeviceExtension;
+    PSTOR_PORT_CONFIGURATION_INFORMATION StorConfig;
+    MESSAGE_INTERRUPT_INFORMATION MessageInfo;
+    PACCESS_RANGE Range;
+    ULONG UncachedSize, Length, i;
+    PUCHAR Memory;
+    PHYSICAL_ADDRESS Physical;
+
+    UNREFERENCED_PARAMETER(HwContext);
+    UNREFERENCED_PARAMETER(BusInformation);
+    UNREFERENCED_PARAMETER(ArgumentString);
+
+    *Again = FALSE;
+
+    if (ConfigInfo->NumberOfAccessRanges < 1)
+        return SP_RETURN_NOT_FOUND;
+
+    /* BAR0 holds the registers and doorbells */
+    Range = &(*ConfigInfo->AccessRanges)[0];
+    if (!Range->RangeInMemory)
+        return SP_RETURN_NOT_FOUND;
+
+    DevExt->Registers = StorPortGetDeviceBase(DevExt,
+                                              ConfigInfo->AdapterInterfaceType,
+                                              ConfigInfo->SystemIoBusNumber,
+                                              Range->RangeStart,
+                                              Range->RangeLength,
+                                              FALSE);
+    if (DevExt->Registers == NULL)
+        return SP_RETURN_ERROR;
+
+    DevExt->Capabilities = NvmeReadRegister(DevExt, NVME_REG_CAP) |
+                           ((ULONGLONG)NvmeReadRegister(DevExt, NVME_REG_CAP + 4) << 32);
+    DevExt->DoorbellStride = 4 << NVME_CAP_DSTRD(DevExt->Capabilities);
+    DevExt->TimeoutMs = max(NVME_CAP_TO(DevExt->Capabilities), 1) * 500;
+
+    if (NVME_CAP_MPSMIN(DevExt->Capabilities) != 0)
+    {
+        DPRINT1("Controller does not support 4K pages\n");
+        return SP_RETURN_NOT_FOUND;
+    }
+
+    /* Find out how many messages we've got */
+    DevExt->MessageCount = 0;
+    while (DevExt->MessageCount < NVME_MAX_IO_QUEUES + 1 &&
+           StorPortGetMSIInfo(DevExt, DevExt->MessageCount, &MessageInfo) == STOR_STATUS_SUCCESS)
+    {
+        DevExt->MessageCount++;
+    }
+
+    DevExt->IoQueueCount = min((ULONG)KeNumberProcessors, NVME_MAX_IO_QUEUES);
+
+    /*
+     * Uncached memory layout, all page aligned:
+     * admin SQ, admin CQ, identify buffer, then per I/O queue its SQ, its CQ
+     * and the PRP lists of its commands.
+     */
+    UncachedSize = 3 * NVME_PAGE_SIZE +
+                   DevExt->IoQueueCount * (2 * NVME_PAGE_SIZE +
+                                           NVME_IO_QUEUE_DEPTH * NVME_PRP_LIST_SIZE);
+
+    DevExt->Uncached = StorPortGetUncachedExtension(DevExt, ConfigInfo, UncachedSize);
+    if (DevExt->Uncached == NULL)
+        return SP_RETURN_ERROR;
+
+    DevExt->UncachedPhysical = StorPortGetPhysicalAddress(DevExt, NULL, DevExt->Uncached, &Length);
+    if (Length < UncachedSize)
+    {
+        DPRINT1("Uncached extension is not contiguous\n");
+        return SP_RETURN_ERROR;
+    }
+
+    Memory = DevExt->Uncached;
+    Physical = DevExt->UncachedPhysical;
+
+    NvmeInitializeQueue(DevExt, &DevExt->AdminQueue, 0, NVME_ADMIN_QUEUE_DEPTH, Memory, Physical);
+    Memory += 2 * NVME_PAGE_SIZE;
+    Physical.QuadPart += 2 * NVME_PAGE_SIZE;
+
+    DevExt->IdentifyBuffer = Memory;
+    DevExt->IdentifyBufferPhysical = Physical;
+    Memory += NVME_PAGE_SIZE;
+    Physical.QuadPart += NVME_PAGE_SIZE;
+
+    for (i = 0; i < DevExt->IoQueueCount; i++)
+    {
+        NvmeInitializeQueue(DevExt,
+                            &DevExt->IoQueues[i],
+                            (USHORT)(i + 1),
+                            (USHORT)min(NVME_IO_QUEUE_DEPTH, NVME_CAP_MQES(DevExt->Capabilities) + 1),
+                            Memory,
+                            Physical);
+        Memory += 2 * NVME_PAGE_SIZE;
+        Physical.QuadPart += 2 * NVME_PAGE_SIZE;
+
+        DevExt->IoQueues[i].PrpLists = (PULONGLONG)Memory;
+        DevExt->IoQueues[i].PrpListsPhysical = Physical;
+        Memory += NVME_IO_QUEUE_DEPTH * NVME_PRP_LIST_SIZE;
+        Physical.QuadPart += NVME_IO_QUEUE_DEPTH * NVME_PRP_LIST_SIZE;
+    }
+
+    if (!NvmeInitializeController(DevExt))
+        return SP_RETURN_ERROR;
+
+    ConfigInfo->MaximumTransferLength = DevExt->MaxTransferPages * NVME_PAGE_SIZE;
+    ConfigInfo->NumberOfPhysicalBreaks = DevExt->MaxTransferPages;
+    ConfigInfo->AlignmentMask = 0x3;
+    ConfigInfo->NumberOfBuses = 1;
+    ConfigInfo->InitiatorBusId[0] = 1;
+    ConfigInfo->MaximumNumberOfTargets = 1;
+    ConfigInfo->MaximumNumberOfLogicalUnits = (UCHAR)max(DevExt->NamespaceCount, 1);
+    ConfigInfo->ScatterGather = TRUE;
+    ConfigInfo->Master = TRUE;
+    ConfigInfo->CachesData = FALSE;
+    ConfigInfo->Dma32BitAddresses = TRUE;
+    ConfigInfo->Dma64BitAddresses = SCSI_DMA64_MINIPORT_SUPPORTED;
+    ConfigInfo->TaggedQueuing = TRUE;
+    ConfigInfo->MultipleRequestPerLu = TRUE;
+    ConfigInfo->MapBuffers = STOR_MAP_NON_READ_WRITE_BUFFERS;
+
+    /* Both queues ends are independent, so we don't need HwStartIo at DIRQL */
+    StorConfig = CONTAINING_RECORD(ConfigInfo, STOR_PORT_CONFIGURATION_INFORMATION, PortConfiguration);
+    StorConfig->SynchronizationModel = StorSynchronizeFullDuplex;
+    StorConfig->HwMSInterruptRoutine = NvmeHwMessageInterrupt;
+    StorConfig->InterruptSynchronizationMode = InterruptSynchronizeAll;
+
+    return SP_RETURN_FOUND;
+}
+
+
+static
+BOOLEAN
+NTAPI
+NvmeHwInitialize(
+    _In_ PVOID DeviceExtension)
+{
+    /* Everything was set up by HwFindAdapter */
+    UNREFERENCED_PARAMETER(DeviceExtension);
+    return TRUE;
+}
+
+
+static
+BOOLEAN
+NTAPI
+NvmeHwResetBus(
+    _In_ PVOID DeviceExtension,
+    _In_ ULONG PathId)
+{
+    /* Commands stay owned by the controller until they complete */
+    UNREFERENCED_PARAMETER(DeviceExtension);
+    UNREFERENCED_PARAMETER(PathId);
+    return TRUE;
+}
+
+
+static
+SCSI_ADAPTER_CONTROL_STATUS
+NTAPI
+NvmeHwAdapterControl(
+    _In_ PVOID DeviceExtension,
+    _In_ SCSI_ADAPTER_CONTROL_TYPE ControlType,
+    _In_ PVOID Parameters)
+{
+    PSCSI_SUPPORTED_CONTROL_TYPE_LIST ControlTypeList;
+
+    switch (ControlType)
+    {
+        case ScsiQuerySupportedControlTypes:
+            ControlTypeList = Parameters;
+            if (ControlTypeList->MaxControlType > ScsiStopAdapter)
+                ControlTypeList->SupportedTypeList[ScsiStopAdapter] = TRUE;
+            ControlTypeList->SupportedTypeList[ScsiQuerySupportedControlTypes] = TRUE;
+            return ScsiAdapterControlSuccess;
+
+        case ScsiStopAdapter:
+            NvmeShutdownController(DeviceExtension);
+            return ScsiAdapterControlSuccess;
+
+        default:
+            return ScsiAdapterControlUnsuccessful;
+    }
+}
+
+
+NTSTATUS
+NTAPI
+DriverEntry(
+    _In_ PDRIVER_OBJECT DriverObject,
+    _In_ PUNICODE_STRING RegistryPath)
+{
+    STOR_HW_INITIALIZATION_DATA InitData;
+
+    DPRINT("NVMe DriverEntry(%p %p)\n", DriverObject, RegistryPath);
+
+    RtlZeroMemory(&InitData, sizeof(InitData));
+
+    InitData.HwInitializationData.HwInitializationDataSize = sizeof(STOR_HW_INITIALIZATION_DATA);
+    InitData.HwInitializationData.AdapterInterfaceType = PCIBus;
+    InitData.HwInitializationData.HwInitialize = NvmeHwInitialize;
+    InitData.HwInitializationData.HwStartIo = NvmeHwStartIo;
+    InitData.HwInitializationData.HwInterrupt = NvmeHwInterrupt;
+    InitData.HwInitializationData.HwFindAdapter = NvmeHwFindAdapter;
+    InitData.HwInitializationData.HwResetBus = NvmeHwResetBus;
+    InitData.HwInitializationData.HwAdapterControl = NvmeHwAdapterControl;
+    InitData.HwInitializationData.DeviceExtensionSize = sizeof(NVME_DEVICE_EXTENSION);
+    InitData.HwInitializationData.SrbExtensionSize = sizeof(NVME_SRB_EXTENSION);
+    InitData.HwInitializationData.NumberOfAccessRanges = 1;
+    InitData.HwInitializationData.MapBuffers = STOR_MAP_NON_READ_WRITE_BUFFERS;
+    InitData.HwInitializationData.NeedPhysicalAddresses = TRUE;
+    InitData.HwInitializationData.TaggedQueuing = TRUE;
+    InitData.HwInitializationData.AutoRequestSense = TRUE;
+    InitData.HwInitializationData.MultipleRequestPerLu = TRUE;
+    InitData.HwBuildIo = NvmeHwBuildIo;
+
+    return StorPortInitialize(DriverObject,
+                              RegistryPath,
+                              &InitData.HwInitializationData,
+                              NULL);
+}
+
+/* EOF */
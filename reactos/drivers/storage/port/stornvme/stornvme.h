@@ -0,0 +1,256 @@
+/*
+ * PROJECT:     ReactOS NVMe Storport Miniport Driver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        drivers/storage/port/stornvme/stornvme.h
+ * PURPOSE:     NVMe definitions and driver structures
+ * PROGRAMMERS: ReactOS Team
+ */
+
+#ifndef _STORNVME_PCH_
+#define _STORNVME_PCH_
+
+#include <ntddk.h>
+#include <scsi.h>
+#include <storport.h>
+
+/* Controller registers */
+#define NVME_REG_CAP        0x00
+#define NVME_REG_VS         0x08
+#define NVME_REG_INTMS      0x0C
+#define NVME_REG_INTMC      0x10
+#define NVME_REG_CC         0x14
+#define NVME_REG_CSTS       0x1C
+#define NVME_REG_AQA        0x24
+#define NVME_REG_ASQ        0x28
+#define NVME_REG_ACQ        0x30
+#define NVME_REG_DOORBELL   0x1000
+
+/* Controller capabilities */
+#define NVME_CAP_MQES(Cap)      ((ULONG)((Cap) & 0xFFFF))
+#define NVME_CAP_TO(Cap)        ((ULONG)(((Cap) >> 24) & 0xFF))
+#define NVME_CAP_DSTRD(Cap)     ((ULONG)(((Cap) >> 32) & 0xF))
+#define NVME_CAP_MPSMIN(Cap)    ((ULONG)(((Cap) >> 48) & 0xF))
+
+/* Controller configuration */
+#define NVME_CC_ENABLE          0x00000001
+#define NVME_CC_CSS_NVM         0x00000000
+#define NVME_CC_MPS_4K          0x00000000
+#define NVME_CC_AMS_RR          0x00000000
+#define NVME_CC_SHN_NORMAL      0x00004000
+#define NVME_CC_SHN_MASK        0x0000C000
+#define NVME_CC_IOSQES          (6 << 16)
+#define NVME_CC_IOCQES          (4 << 20)
+
+/* Controller status */
+#define NVME_CSTS_RDY           0x00000001
+#define NVME_CSTS_CFS           0x00000002
+#define NVME_CSTS_SHST_MASK     0x0000000C
+#define NVME_CSTS_SHST_COMPLETE 0x00000008
+
+/* Admin commands */
+#define NVME_ADMIN_CREATE_SQ    0x01
+#define NVME_ADMIN_CREATE_CQ    0x05
+#define NVME_ADMIN_IDENTIFY     0x06
+#define NVME_ADMIN_SET_FEATURES 0x09
+
+/* NVM commands */
+#define NVME_CMD_FLUSH          0x00
+#define NVME_CMD_WRITE          0x01
+#define NVME_CMD_READ           0x02
+
+/* Identify structures */
+#define NVME_CNS_NAMESPACE      0x00
+#define NVME_CNS_CONTROLLER     0x01
+
+/* Features */
+#define NVME_FEAT_NUMBER_OF_QUEUES      0x07
+#define NVME_FEAT_INTERRUPT_COALESCING  0x08
+
+/* Status code types */
+#define NVME_SCT_GENERIC        0x0
+#define NVME_SCT_MEDIA          0x2
+
+#include <pshpack1.h>
+
+typedef struct _NVME_COMMAND
+{
+    UCHAR Opcode;
+    UCHAR Flags;
+    USHORT CommandId;
+    ULONG NamespaceId;
+    ULONG Reserved[2];
+    ULONGLONG Metadata;
+    ULONGLONG Prp1;
+    ULONGLONG Prp2;
+    ULONG Cdw10;
+    ULONG Cdw11;
+    ULONG Cdw12;
+    ULONG Cdw13;
+    ULONG Cdw14;
+    ULONG Cdw15;
+} NVME_COMMAND, *PNVME_COMMAND;
+
+typedef struct _NVME_COMPLETION
+{
+    ULONG Result;
+    ULONG Reserved;
+    USHORT SqHead;
+    USHORT SqId;
+    USHORT CommandId;
+    USHORT Status;  /* phase tag in bit 0 */
+} NVME_COMPLETION, *PNVME_COMPLETION;
+
+typedef struct _NVME_IDENTIFY_CONTROLLER
+{
+    USHORT VendorId;
+    USHORT SubsystemVendorId;
+    UCHAR SerialNumber[20];
+    UCHAR ModelNumber[40];
+    UCHAR FirmwareRevision[8];
+    UCHAR Rab;
+    UCHAR Ieee[3];
+    UCHAR Cmic;
+    UCHAR Mdts;
+    UCHAR Reserved1[438];
+    ULONG NumberOfNamespaces;
+    UCHAR Reserved2[3576];
+} NVME_IDENTIFY_CONTROLLER, *PNVME_IDENTIFY_CONTROLLER;
+
+typedef struct _NVME_IDENTIFY_NAMESPACE
+{
+    ULONGLONG Size;
+    ULONGLONG Capacity;
+    ULONGLONG Utilization;
+    UCHAR Features;
+    UCHAR NumberOfLbaFormats;
+    UCHAR FormattedLbaSize;
+    UCHAR Reserved1[101];
+    ULONG LbaFormat[16];
+    UCHAR Reserved2[3904];
+} NVME_IDENTIFY_NAMESPACE, *PNVME_IDENTIFY_NAMESPACE;
+
+#include <poppack.h>
+
+C_ASSERT(sizeof(NVME_COMMAND) == 64);
+C_ASSERT(sizeof(NVME_COMPLETION) == 16);
+C_ASSERT(sizeof(NVME_IDENTIFY_CONTROLLER) == 4096);
+C_ASSERT(sizeof(NVME_IDENTIFY_NAMESPACE) == 4096);
+
+#define NVME_STATUS_PHASE(Status)   ((Status) & 1)
+#define NVME_STATUS_SC(Status)      (((Status) >> 1) & 0xFF)
+#define NVME_STATUS_SCT(Status)     (((Status) >> 9) & 0x7)
+
+/* Driver limits */
+#define NVME_PAGE_SIZE          0x1000
+#define NVME_ADMIN_QUEUE_DEPTH  32
+#define NVME_IO_QUEUE_DEPTH     64
+#define NVME_MAX_IO_QUEUES      8
+#define NVME_MAX_NAMESPACES     8
+
+/* Largest transfer we take, and the pages it can touch when it isn't aligned */
+#define NVME_MAX_TRANSFER_PAGES 32
+#define NVME_MAX_PRP_PAGES      (NVME_MAX_TRANSFER_PAGES + 1)
+
+/* One PRP list slot per command, never crossing a page */
+#define NVME_PRP_LIST_SIZE      256
+
+C_ASSERT(NVME_MAX_TRANSFER_PAGES * sizeof(ULONGLONG) <= NVME_PRP_LIST_SIZE);
+
+/* Interrupt coalescing: 8 completions or 100 microseconds, whichever comes first */
+#define NVME_COALESCE_THRESHOLD 7
+#define NVME_COALESCE_TIME      1
+
+typedef struct _NVME_QUEUE
+{
+    USHORT QueueId;
+    USHORT Depth;
+    ULONG MessageId;
+
+    /* Submission side, owned by HwStartIo */
+    PNVME_COMMAND SubmissionQueue;
+    PHYSICAL_ADDRESS SubmissionQueuePhysical;
+    PULONG SubmissionDoorbell;
+    USHORT SqTail;
+    volatile USHORT SqHead;
+    volatile LONG Outstanding;
+    USHORT NextCommandId;
+
+    /* Completion side, owned by the interrupt */
+    PNVME_COMPLETION CompletionQueue;
+    PHYSICAL_ADDRESS CompletionQueuePhysical;
+    PULONG CompletionDoorbell;
+    USHORT CqHead;
+    USHORT Phase;
+
+    /* PRP lists, one per command id */
+    PULONGLONG PrpLists;
+    PHYSICAL_ADDRESS PrpListsPhysical;
+
+    PSCSI_REQUEST_BLOCK Requests[NVME_IO_QUEUE_DEPTH];
+} NVME_QUEUE, *PNVME_QUEUE;
+
+typedef struct _NVME_NAMESPACE
+{
+    BOOLEAN Present;
+    ULONG BlockSize;
+    ULONGLONG BlockCount;
+} NVME_NAMESPACE, *PNVME_NAMESPACE;
+
+typedef struct _NVME_SRB_EXTENSION
+{
+    NVME_COMMAND Command;
+    ULONG PageCount;
+    ULONGLONG Pages[NVME_MAX_PRP_PAGES];
+} NVME_SRB_EXTENSION, *PNVME_SRB_EXTENSION;
+
+typedef struct _NVME_DEVICE_EXTENSION
+{
+    PUCHAR Registers;
+    ULONGLONG Capabilities;
+    ULONG DoorbellStride;
+    ULONG TimeoutMs;
+    ULONG MaxTransferPages;
+
+    /* Uncached memory for the queues and the identify buffer */
+    PUCHAR Uncached;
+    PHYSICAL_ADDRESS UncachedPhysical;
+    PVOID IdentifyBuffer;
+    PHYSICAL_ADDRESS IdentifyBufferPhysical;
+
+    NVME_QUEUE AdminQueue;
+    ULONG IoQueueCount;
+    NVME_QUEUE IoQueues[NVME_MAX_IO_QUEUES];
+    ULONG MessageCount;
+
+    UCHAR SerialNumber[20];
+    UCHAR ModelNumber[40];
+    UCHAR FirmwareRevision[8];
+    ULONG NamespaceCount;
+    NVME_NAMESPACE Namespaces[NVME_MAX_NAMESPACES];
+} NVME_DEVICE_EXTENSION, *PNVME_DEVICE_EXTENSION;
+
+/* stornvme.c */
+
+BOOLEAN
+NvmeSubmitAdminCommand(
+    _In_ PNVME_DEVICE_EXTENSION DevExt,
+    _Inout_ PNVME_COMMAND Command,
+    _Out_opt_ PULONG Result);
+
+/* io.c */
+
+HW_BUILDIO NvmeHwBuildIo;
+HW_MESSAGE_SIGNALED_INTERRUPT_ROUTINE NvmeHwMessageInterrupt;
+
+BOOLEAN
+NTAPI
+NvmeHwStartIo(
+    _In_ PVOID DeviceExtension,
+    _In_ PSCSI_REQUEST_BLOCK Srb);
+
+BOOLEAN
+NTAPI
+NvmeHwInterrupt(
+    _In_ PVOID DeviceExtension);
+
+#endif /* _STORNVME_PCH_ */
@@ -0,0 +1,1044 @@
+/*
+ * PROJECT:     ReactOS Storport Driver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        drivers/storage/port/storport/fdo.c
+ * PURPOSE:     Adapter functional device object
+ * PROGRAMMERS: ReactOS Team
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include "precomp.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* FUNCTIONS ******************************************************************/
+
+static
+BOOLEAN
+NTAPI
+StorpIsr(
+    _In_ PKINTERRUPT Interrupt,
+    _In_ PVOID ServiceContext)
+{
+    PSTOR_ADAPTER Adapter = ServiceContext;
+
+    UNREFERENCED_PARAMETER(Interrupt);
+
+    return Adapter->HwInterrupt(Adapter->MiniportDeviceExtension);
+}
+
+
+static
+BOOLEAN
+NTAPI
+StorpMessageIsr(
+    _In_ PKINTERRUPT Interrupt,
+    _In_ PVOID ServiceContext)
+{
+    PSTOR_MESSAGE Message = ServiceContext;
+    PSTOR_ADAPTER Adapter = Message->Adapter;
+
+    UNREFERENCED_PARAMETER(Interrupt);
+
+    /* Tell the miniport which queue this message belongs to */
+    if (Adapter->HwMSInterruptRoutine != NULL)
+        return Adapter->HwMSInterruptRoutine(Adapter->MiniportDeviceExtension, Message->MessageId);
+
+    return Adapter->HwInterrupt(Adapter->MiniportDeviceExtension);
+}
+
+
+static
+BOOLEAN
+NTAPI
+StorpSynchronizedInitialize(
+    _In_ PVOID Context)
+{
+    PSTOR_ADAPTER Adapter = Context;
+
+    return Adapter->HwInitialize(Adapter->MiniportDeviceExtension);
+}
+
+
+static
+NTSTATUS
+StorpParseResources(
+    _In_ PSTOR_ADAPTER Adapter)
+{
+    PPORT_CONFIGURATION_INFORMATION PortConfig = &Adapter->PortConfig.PortConfiguration;
+    PCM_PARTIAL_RESOURCE_DESCRIPTOR Raw;
+    PCM_FULL_RESOURCE_DESCRIPTOR FullRaw;
+    ULONG i, RangeCount = 0;
+    BOOLEAN InterruptFound = FALSE;
+
+    /* The miniport gets bus relative addresses, like with scsiport */
+    if (Adapter->AllocatedResources == NULL)
+        return STATUS_SUCCESS;
+
+    FullRaw = &Adapter->AllocatedResources->List[0];
+
+    PortConfig->AdapterInterfaceType = FullRaw->InterfaceType;
+    PortConfig->SystemIoBusNumber = FullRaw->BusNumber;
+
+    for (i = 0; i < FullRaw->PartialResourceList.Count; i++)
+    {
+        Raw = &FullRaw->PartialResourceList.PartialDescriptors[i];
+
+        switch (Raw->Type)
+        {
+            case CmResourceTypePort:
+                if (RangeCount >= RTL_NUMBER_OF(Adapter->AccessRanges))
+                    break;
+
+                Adapter->AccessRanges[RangeCount].RangeStart = Raw->u.Port.Start;
+                Adapter->AccessRanges[RangeCount].RangeLength = Raw->u.Port.Length;
+                Adapter->AccessRanges[RangeCount].RangeInMemory = FALSE;
+                RangeCount++;
+                break;
+
+            case CmResourceTypeMemory:
+                if (RangeCount >= RTL_NUMBER_OF(Adapter->AccessRanges))
+                    break;
+
+                Adapter->AccessRanges[RangeCount].RangeStart = Raw->u.Memory.Start;
+                Adapter->AccessRanges[RangeCount].RangeLength = Raw->u.Memory.Length;
+                Adapter->AccessRanges[RangeCount].RangeInMemory = TRUE;
+                RangeCount++;
+                break;
+
+            case CmResourceTypeInterrupt:
+                /* Each message signaled interrupt gets its own descriptor */
+                if (Raw->Flags & CM_RESOURCE_INTERRUPT_MESSAGE)
+                {
+                    if (Adapter->MessageCount < STOR_MAXIMUM_MESSAGES)
+                        Adapter->MessageCount++;
+                    break;
+                }
+
+                if (InterruptFound)
+                    break;
+
+                PortConfig->BusInterruptLevel = Raw->u.Interrupt.Level;
+                PortConfig->BusInterruptVector = Raw->u.Interrupt.Vector;
+                PortConfig->InterruptMode = (Raw->Flags & CM_RESOURCE_INTERRUPT_LATCHED) ?
+                                            Latched : LevelSensitive;
+                InterruptFound = TRUE;
+                break;
+
+            case CmResourceTypeDma:
+                PortConfig->DmaChannel = Raw->u.Dma.Channel;
+                PortConfig->DmaPort = Raw->u.Dma.Port;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    PortConfig->NumberOfAccessRanges = RangeCount;
+
+    return STATUS_SUCCESS;
+}
+
+
+static
+VOID
+StorpInitializePortConfig(
+    _In_ PSTOR_ADAPTER Adapter)
+{
+    PHW_INITIALIZATION_DATA HwInitData = &Adapter->DriverExtension->HwInitData.HwInitializationData;
+    PPORT_CONFIGURATION_INFORMATION PortConfig = &Adapter->PortConfig.PortConfiguration;
+    ULONG BusNumber, Address, Length;
+    NTSTATUS Status;
+
+    RtlZeroMemory(&Adapter->PortConfig, sizeof(Adapter->PortConfig));
+
+    PortConfig->Length = sizeof(PORT_CONFIGURATION_INFORMATION);
+    PortConfig->AdapterInterfaceType = HwInitData->AdapterInterfaceType;
+    PortConfig->InterruptMode = LevelSensitive;
+    PortConfig->MaximumTransferLength = SP_UNINITIALIZED_VALUE;
+    PortConfig->NumberOfPhysicalBreaks = SP_UNINITIALIZED_VALUE;
+    PortConfig->DmaChannel = SP_UNINITIALIZED_VALUE;
+    PortConfig->DmaPort = SP_UNINITIALIZED_VALUE;
+    PortConfig->NumberOfAccessRanges = HwInitData->NumberOfAccessRanges;
+    PortConfig->AccessRanges = (ACCESS_RANGE(*)[])&Adapter->AccessRanges;
+    PortConfig->NumberOfBuses = 1;
+    PortConfig->InitiatorBusId[0] = (UCHAR)SP_UNINITIALIZED_VALUE;
+    PortConfig->ScatterGather = TRUE;
+    PortConfig->Master = TRUE;
+    PortConfig->Dma32BitAddresses = TRUE;
+    PortConfig->MapBuffers = HwInitData->MapBuffers;
+    PortConfig->NeedPhysicalAddresses = HwInitData->NeedPhysicalAddresses;
+    PortConfig->TaggedQueuing = HwInitData->TaggedQueuing;
+    PortConfig->AutoRequestSense = HwInitData->AutoRequestSense;
+    PortConfig->MultipleRequestPerLu = HwInitData->MultipleRequestPerLu;
+    PortConfig->ReceiveEvent = HwInitData->ReceiveEvent;
+    PortConfig->MaximumNumberOfTargets = SCSI_MAXIMUM_TARGETS_PER_BUS;
+    PortConfig->MaximumNumberOfLogicalUnits = SCSI_MAXIMUM_LOGICAL_UNITS;
+    PortConfig->DeviceExtensionSize = HwInitData->DeviceExtensionSize;
+    PortConfig->SpecificLuExtensionSize = HwInitData->SpecificLuExtensionSize;
+    PortConfig->SrbExtensionSize = HwInitData->SrbExtensionSize;
+
+    /* Storport miniports are full duplex unless they say otherwise */
+    Adapter->PortConfig.SynchronizationModel = StorSynchronizeFullDuplex;
+    Adapter->PortConfig.InterruptSynchronizationMode = InterruptSynchronizeAll;
+
+    /* Find out where the adapter lives */
+    Status = IoGetDeviceProperty(Adapter->PhysicalDeviceObject,
+                                 DevicePropertyBusNumber,
+                                 sizeof(ULONG),
+                                 &BusNumber,
+                                 &Length);
+    if (NT_SUCCESS(Status))
+        PortConfig->SystemIoBusNumber = BusNumber;
+
+    Status = IoGetDeviceProperty(Adapter->PhysicalDeviceObject,
+                                 DevicePropertyAddress,
+                                 sizeof(ULONG),
+                                 &Address,
+                                 &Length);
+    if (NT_SUCCESS(Status))
+    {
+        PCI_SLOT_NUMBER SlotNumber;
+
+        /* The PCI bus driver reports the device number in the high word */
+        SlotNumber.u.AsULONG = 0;
+        SlotNumber.u.bits.DeviceNumber = (Address >> 16) & 0xFFFF;
+        SlotNumber.u.bits.FunctionNumber = Address & 0xFFFF;
+        PortConfig->SlotNumber = SlotNumber.u.AsULONG;
+    }
+}
+
+
+static
+NTSTATUS
+StorpConnectInterrupts(
+    _In_ PSTOR_ADAPTER Adapter)
+{
+    PCM_FULL_RESOURCE_DESCRIPTOR FullTranslated;
+    PCM_PARTIAL_RESOURCE_DESCRIPTOR Translated;
+    PSTOR_MESSAGE Message;
+    KIRQL SynchronizeIrql = 0;
+    ULONG i, MessageId;
+    NTSTATUS Status;
+
+    if (Adapter->TranslatedResources == NULL)
+        return STATUS_SUCCESS;
+
+    FullTranslated = &Adapter->TranslatedResources->List[0];
+
+    /* All interrupts share one lock, so they have to use the highest DIRQL */
+    for (i = 0; i < FullTranslated->PartialResourceList.Count; i++)
+    {
+        Translated = &FullTranslated->PartialResourceList.PartialDescriptors[i];
+        if (Translated->Type == CmResourceTypeInterrupt &&
+            (KIRQL)Translated->u.Interrupt.Level > SynchronizeIrql)
+        {
+            SynchronizeIrql = (KIRQL)Translated->u.Interrupt.Level;
+        }
+    }
+
+    MessageId = 0;
+    for (i = 0; i < FullTranslated->PartialResourceList.Count; i++)
+    {
+        Translated = &FullTranslated->PartialResourceList.PartialDescriptors[i];
+        if (Translated->Type != CmResourceTypeInterrupt)
+            continue;
+
+        if (Translated->Flags & CM_RESOURCE_INTERRUPT_MESSAGE)
+        {
+            if (MessageId >= Adapter->MessageCount)
+                continue;
+
+            /*
+             * IoConnectInterruptEx is not available, but every translated
+             * message is an ordinary vector we can connect on its own.
+             */
+            Message = &Adapter->Messages[MessageId];
+            Message->Adapter = Adapter;
+            Message->MessageId = MessageId;
+
+            Status = IoConnectInterrupt(&Message->Interrupt,
+                                        StorpMessageIsr,
+                                        Message,
+                                        &Adapter->InterruptSpinLock,
+                                        Translated->u.Interrupt.Vector,
+                                        (KIRQL)Translated->u.Interrupt.Level,
+                                        SynchronizeIrql,
+                                        Latched,
+                                        FALSE,
+                                        Translated->u.Interrupt.Affinity,
+                                        FALSE);
+            if (!NT_SUCCESS(Status))
+            {
+                DPRINT1("Could not connect message %lu (Status 0x%08lx)\n", MessageId, Status);
+                return Status;
+            }
+
+            if (Adapter->Interrupt == NULL)
+                Adapter->Interrupt = Message->Interrupt;
+
+            MessageId++;
+            continue;
+        }
+
+        /* Line based interrupts are only used if there are no messages */
+        if (Adapter->MessageCount != 0 || Adapter->Interrupt != NULL)
+            continue;
+
+        Status = IoConnectInterrupt(&Adapter->Interrupt,
+                                    StorpIsr,
+                                    Adapter,
+                                    &Adapter->InterruptSpinLock,
+                                    Translated->u.Interrupt.Vector,
+                                    (KIRQL)Translated->u.Interrupt.Level,
+                                    SynchronizeIrql,
+                                    (Translated->Flags & CM_RESOURCE_INTERRUPT_LATCHED) ?
+                                        Latched : LevelSensitive,
+                                    Translated->ShareDisposition == CmResourceShareShared,
+                                    Translated->u.Interrupt.Affinity,
+                                    FALSE);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Could not connect interrupt (Status 0x%08lx)\n", Status);
+            return Status;
+        }
+    }
+
+    Adapter->MessageCount = MessageId;
+    Adapter->Flags |= ADAPTER_INTERRUPTS;
+
+    return STATUS_SUCCESS;
+}
+
+
+static
+VOID
+StorpDisconnectInterrupts(
+    _In_ PSTOR_ADAPTER Adapter)
+{
+    ULONG i;
+
+    if (Adapter->MessageCount != 0)
+    {
+        for (i = 0; i < Adapter->MessageCount; i++)
+        {
+            if (Adapter->Messages[i].Interrupt != NULL)
+                IoDisconnectInterrupt(Adapter->Messages[i].Interrupt);
+            Adapter->Messages[i].Interrupt = NULL;
+        }
+    }
+    else if (Adapter->Interrupt != NULL)
+    {
+        IoDisconnectInterrupt(Adapter->Interrupt);
+    }
+
+    Adapter->Interrupt = NULL;
+    Adapter->MessageCount = 0;
+    Adapter->Flags &= ~ADAPTER_INTERRUPTS;
+}
+
+
+static
+NTSTATUS
+StorpSendInquiry(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PSTOR_UNIT Unit)
+{
+    IO_STATUS_BLOCK IoStatusBlock;
+    PIO_STACK_LOCATION IrpStack;
+    SCSI_REQUEST_BLOCK Srb;
+    PINQUIRYDATA InquiryBuffer;
+    PSENSE_DATA SenseBuffer;
+    KEVENT Event;
+    PCDB Cdb;
+    PIRP Irp;
+    NTSTATUS Status;
+
+    InquiryBuffer = ExAllocatePoolWithTag(NonPagedPool, INQUIRYDATABUFFERSIZE, TAG_STORPORT);
+    if (InquiryBuffer == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    SenseBuffer = ExAllocatePoolWithTag(NonPagedPool, SENSE_BUFFER_SIZE, TAG_STORPORT);
+    if (SenseBuffer == NULL)
+    {
+        ExFreePoolWithTag(InquiryBuffer, TAG_STORPORT);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeInitializeEvent(&Event, NotificationEvent, FALSE);
+
+    Irp = IoBuildDeviceIoControlRequest(IOCTL_SCSI_EXECUTE_IN,
+                                        Adapter->DeviceObject,
+                                        NULL,
+                                        0,
+                                        InquiryBuffer,
+                                        INQUIRYDATABUFFERSIZE,
+                                        TRUE,
+                                        &Event,
+                                        &IoStatusBlock);
+    if (Irp == NULL)
+    {
+        ExFreePoolWithTag(SenseBuffer, TAG_STORPORT);
+        ExFreePoolWithTag(InquiryBuffer, TAG_STORPORT);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(&Srb, sizeof(SCSI_REQUEST_BLOCK));
+
+    Srb.Length = sizeof(SCSI_REQUEST_BLOCK);
+    Srb.OriginalRequest = Irp;
+    Srb.PathId = Unit->PathId;
+    Srb.TargetId = Unit->TargetId;
+    Srb.Lun = Unit->Lun;
+    Srb.Function = SRB_FUNCTION_EXECUTE_SCSI;
+    Srb.SrbFlags = SRB_FLAGS_DATA_IN | SRB_FLAGS_DISABLE_SYNCH_TRANSFER | SRB_FLAGS_NO_QUEUE_FREEZE;
+    Srb.TimeOutValue = 4;
+    Srb.CdbLength = 6;
+
+    Srb.SenseInfoBuffer = SenseBuffer;
+    Srb.SenseInfoBufferLength = SENSE_BUFFER_SIZE;
+
+    Srb.DataBuffer = InquiryBuffer;
+    Srb.DataTransferLength = INQUIRYDATABUFFERSIZE;
+
+    IrpStack = IoGetNextIrpStackLocation(Irp);
+    IrpStack->Parameters.Scsi.Srb = &Srb;
+
+    Cdb = (PCDB)Srb.Cdb;
+    Cdb->CDB6INQUIRY.OperationCode = SCSIOP_INQUIRY;
+    Cdb->CDB6INQUIRY.LogicalUnitNumber = Unit->Lun;
+    Cdb->CDB6INQUIRY.AllocationLength = INQUIRYDATABUFFERSIZE;
+
+    /* This goes through the same path as any other request */
+    Status = IoCallDriver(Adapter->DeviceObject, Irp);
+    if (Status == STATUS_PENDING)
+    {
+        KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
+        Status = IoStatusBlock.Status;
+    }
+
+    if (SRB_STATUS(Srb.SrbStatus) == SRB_STATUS_SUCCESS ||
+        SRB_STATUS(Srb.SrbStatus) == SRB_STATUS_DATA_OVERRUN)
+    {
+        RtlCopyMemory(Unit->InquiryData,
+                      InquiryBuffer,
+                      min(Srb.DataTransferLength, INQUIRYDATABUFFERSIZE));
+        Status = STATUS_SUCCESS;
+    }
+    else if (NT_SUCCESS(Status))
+    {
+        Status = STATUS_NO_SUCH_DEVICE;
+    }
+
+    ExFreePoolWithTag(SenseBuffer, TAG_STORPORT);
+    ExFreePoolWithTag(InquiryBuffer, TAG_STORPORT);
+
+    return Status;
+}
+
+
+static
+VOID
+StorpScanAdapter(
+    _In_ PSTOR_ADAPTER Adapter)
+{
+    PPORT_CONFIGURATION_INFORMATION PortConfig = &Adapter->PortConfig.PortConfiguration;
+    PSTOR_UNIT Unit = NULL;
+    PINQUIRYDATA InquiryData;
+    UCHAR Bus, Target, Lun;
+    NTSTATUS Status;
+
+    for (Bus = 0; Bus < PortConfig->NumberOfBuses; Bus++)
+    {
+        for (Target = 0; Target < PortConfig->MaximumNumberOfTargets; Target++)
+        {
+            /* Skip the initiator itself */
+            if (Target == PortConfig->InitiatorBusId[Bus])
+                continue;
+
+            for (Lun = 0; Lun < PortConfig->MaximumNumberOfLogicalUnits; Lun++)
+            {
+                if (Unit == NULL)
+                {
+                    Unit = StorpCreateUnit(Adapter, Bus, Target, Lun);
+                    if (Unit == NULL)
+                        return;
+                }
+                else
+                {
+                    /* Reuse the last probe unit */
+                    Unit->PathId = Bus;
+                    Unit->TargetId = Target;
+                    Unit->Lun = Lun;
+                    Unit->Flags = 0;
+                    RtlZeroMemory(Unit->MiniportLunExtension, Adapter->UnitExtensionSize);
+                }
+
+                Adapter->ProbeUnit = Unit;
+                Status = StorpSendInquiry(Adapter, Unit);
+                Adapter->ProbeUnit = NULL;
+
+                if (!NT_SUCCESS(Status))
+                {
+                    /* No need to look at more LUNs if LUN 0 isn't there */
+                    if (Lun == 0)
+                        break;
+                    continue;
+                }
+
+                InquiryData = (PINQUIRYDATA)Unit->InquiryData;
+                if (InquiryData->DeviceTypeQualifier == DEVICE_QUALIFIER_NOT_SUPPORTED)
+                    continue;
+
+                DPRINT("Found unit (Bus %u Target %u Lun %u) type %u\n",
+                       Bus, Target, Lun, InquiryData->DeviceType);
+
+                StorpInsertUnit(Adapter, Unit);
+                Unit = NULL;
+            }
+        }
+    }
+
+    if (Unit != NULL)
+        ExFreePoolWithTag(Unit, TAG_STORPORT);
+}
+
+
+static
+VOID
+StorpInitializeCapabilities(
+    _In_ PSTOR_ADAPTER Adapter)
+{
+    PPORT_CONFIGURATION_INFORMATION PortConfig = &Adapter->PortConfig.PortConfiguration;
+    PIO_SCSI_CAPABILITIES PortCapabilities = &Adapter->PortCapabilities;
+    ULONG MaximumTransferLength;
+
+    if (PortConfig->MaximumTransferLength == SP_UNINITIALIZED_VALUE)
+        PortConfig->MaximumTransferLength = STOR_DEFAULT_MAXIMUM_TRANSFER_LENGTH;
+
+    /* A transfer that isn't page aligned needs one map register more than its pages */
+    if (Adapter->DmaAdapter != NULL && Adapter->MapRegisterCount > 1)
+    {
+        MaximumTransferLength = (Adapter->MapRegisterCount - 1) * PAGE_SIZE;
+        if (PortConfig->MaximumTransferLength > MaximumTransferLength)
+            PortConfig->MaximumTransferLength = MaximumTransferLength;
+    }
+
+    PortCapabilities->Length = sizeof(IO_SCSI_CAPABILITIES);
+    PortCapabilities->MaximumTransferLength = PortConfig->MaximumTransferLength;
+    PortCapabilities->MaximumPhysicalPages = BYTES_TO_PAGES(PortConfig->MaximumTransferLength) + 1;
+    if (PortConfig->NumberOfPhysicalBreaks != SP_UNINITIALIZED_VALUE &&
+        PortConfig->NumberOfPhysicalBreaks < PortCapabilities->MaximumPhysicalPages)
+    {
+        PortCapabilities->MaximumPhysicalPages = PortConfig->NumberOfPhysicalBreaks;
+    }
+
+    PortCapabilities->SupportedAsynchronousEvents = 0;
+    PortCapabilities->AlignmentMask = PortConfig->AlignmentMask;
+    PortCapabilities->TaggedQueuing = PortConfig->TaggedQueuing;
+    PortCapabilities->AdapterScansDown = PortConfig->AdapterScansDown;
+    PortCapabilities->AdapterUsesPio = (PortConfig->MapBuffers == STOR_MAP_ALL_BUFFERS);
+
+    Adapter->DeviceObject->AlignmentRequirement = PortConfig->AlignmentMask;
+}
+
+
+static
+NTSTATUS
+StorpStartAdapter(
+    _In_ PSTOR_ADAPTER Adapter)
+{
+    PSTOR_HW_INITIALIZATION_DATA HwInitData = &Adapter->DriverExtension->HwInitData;
+    BOOLEAN Again = FALSE;
+    ULONG Result;
+    KIRQL OldIrql;
+    BOOLEAN Success;
+    NTSTATUS Status;
+
+    StorpInitializePortConfig(Adapter);
+
+    Status = StorpParseResources(Adapter);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    Adapter->HwInitialize = HwInitData->HwInitializationData.HwInitialize;
+    Adapter->HwStartIo = HwInitData->HwInitializationData.HwStartIo;
+    Adapter->HwInterrupt = HwInitData->HwInitializationData.HwInterrupt;
+    Adapter->HwResetBus = HwInitData->HwInitializationData.HwResetBus;
+    Adapter->HwAdapterControl = HwInitData->HwInitializationData.HwAdapterControl;
+    if (HwInitData->HwInitializationData.HwInitializationDataSize >= sizeof(STOR_HW_INITIALIZATION_DATA))
+        Adapter->HwBuildIo = HwInitData->HwBuildIo;
+
+    Result = HwInitData->HwInitializationData.HwFindAdapter(Adapter->MiniportDeviceExtension,
+                                                             NULL,
+                                                             NULL,
+                                                             NULL,
+                                                             &Adapter->PortConfig.PortConfiguration,
+                                                             &Again);
+    if (Result != SP_RETURN_FOUND)
+    {
+        DPRINT1("HwFindAdapter() failed (Result %lu)\n", Result);
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+    }
+
+    /* The miniport may have changed its mind about these */
+    Adapter->HwMSInterruptRoutine = Adapter->PortConfig.HwMSInterruptRoutine;
+    Adapter->SrbExtensionSize = Adapter->PortConfig.PortConfiguration.SrbExtensionSize;
+    Adapter->UnitExtensionSize = Adapter->PortConfig.PortConfiguration.SpecificLuExtensionSize;
+
+    /* Data buffers get mapped through the DMA adapter, it may already exist for the uncached extension */
+    if (!NT_SUCCESS(StorpCreateDmaAdapter(Adapter)))
+        DPRINT1("No DMA adapter, requests won't get a scatter/gather list\n");
+
+    Status = StorpInitializeQueues(Adapter);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    if (Adapter->HwInterrupt != NULL || Adapter->HwMSInterruptRoutine != NULL)
+    {
+        Status = StorpConnectInterrupts(Adapter);
+        if (!NT_SUCCESS(Status))
+            return Status;
+    }
+
+    /* HwInitialize is always synchronized with the interrupt */
+    if (Adapter->Interrupt != NULL)
+    {
+        Success = KeSynchronizeExecution(Adapter->Interrupt,
+                                         StorpSynchronizedInitialize,
+                                         Adapter);
+    }
+    else
+    {
+        OldIrql = StorpAcquireInterruptLock(Adapter);
+        Success = Adapter->HwInitialize(Adapter->MiniportDeviceExtension);
+        StorpReleaseInterruptLock(Adapter, OldIrql);
+    }
+
+    if (!Success)
+    {
+        DPRINT1("HwInitialize() failed\n");
+        return STATUS_ADAPTER_HARDWARE_ERROR;
+    }
+
+    if (Adapter->HwPassiveInitialize != NULL &&
+        !Adapter->HwPassiveInitialize(Adapter->MiniportDeviceExtension))
+    {
+        DPRINT1("HwPassiveInitializeRoutine() failed\n");
+        return STATUS_ADAPTER_HARDWARE_ERROR;
+    }
+
+    Adapter->Flags |= ADAPTER_STARTED;
+
+    StorpInitializeCapabilities(Adapter);
+    StorpScanAdapter(Adapter);
+
+    return STATUS_SUCCESS;
+}
+
+
+static
+VOID
+StorpStopAdapter(
+    _In_ PSTOR_ADAPTER Adapter)
+{
+    PSTOR_MAPPED_ADDRESS MappedAddress;
+
+    if (Adapter->Flags & ADAPTER_STARTED)
+    {
+        if (Adapter->HwAdapterControl != NULL)
+            Adapter->HwAdapterControl(Adapter->MiniportDeviceExtension, ScsiStopAdapter, NULL);
+
+        Adapter->Flags &= ~ADAPTER_STARTED;
+    }
+
+    KeCancelTimer(&Adapter->MiniportTimer);
+    KeCancelTimer(&Adapter->PauseTimer);
+
+    StorpDisconnectInterrupts(Adapter);
+    StorpDeleteQueues(Adapter);
+
+    while (Adapter->MappedAddressList != NULL)
+    {
+        MappedAddress = Adapter->MappedAddressList;
+        Adapter->MappedAddressList = MappedAddress->Next;
+
+        MmUnmapIoSpace(MappedAddress->MappedAddress, MappedAddress->NumberOfBytes);
+        ExFreePoolWithTag(MappedAddress, TAG_STORPORT);
+    }
+
+    if (Adapter->UncachedExtension != NULL)
+    {
+        Adapter->DmaAdapter->DmaOperations->FreeCommonBuffer(Adapter->DmaAdapter,
+                                                             Adapter->UncachedExtensionLength,
+                                                             Adapter->UncachedExtensionPhysical,
+                                                             Adapter->UncachedExtension,
+                                                             FALSE);
+        Adapter->UncachedExtension = NULL;
+    }
+
+    if (Adapter->DmaAdapter != NULL)
+    {
+        Adapter->DmaAdapter->DmaOperations->PutDmaAdapter(Adapter->DmaAdapter);
+        Adapter->DmaAdapter = NULL;
+    }
+
+    if (Adapter->AllocatedResources != NULL)
+    {
+        ExFreePoolWithTag(Adapter->AllocatedResources, TAG_STORPORT);
+        Adapter->AllocatedResources = NULL;
+    }
+
+    if (Adapter->TranslatedResources != NULL)
+    {
+        ExFreePoolWithTag(Adapter->TranslatedResources, TAG_STORPORT);
+        Adapter->TranslatedResources = NULL;
+    }
+}
+
+
+static
+PCM_RESOURCE_LIST
+StorpCopyResourceList(
+    _In_opt_ PCM_RESOURCE_LIST ResourceList)
+{
+    PCM_RESOURCE_LIST Copy;
+    ULONG Size;
+
+    if (ResourceList == NULL || ResourceList->Count == 0)
+        return NULL;
+
+    /* We only ever look at the first full descriptor */
+    Size = FIELD_OFFSET(CM_RESOURCE_LIST, List[0].PartialResourceList.PartialDescriptors) +
+           ResourceList->List[0].PartialResourceList.Count * sizeof(CM_PARTIAL_RESOURCE_DESCRIPTOR);
+
+    Copy = ExAllocatePoolWithTag(NonPagedPool, Size, TAG_STORPORT);
+    if (Copy == NULL)
+        return NULL;
+
+    RtlCopyMemory(Copy, ResourceList, Size);
+    Copy->Count = 1;
+
+    return Copy;
+}
+
+
+static
+NTSTATUS
+StorpFdoStartDevice(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PIRP Irp)
+{
+    PIO_STACK_LOCATION Stack = IoGetCurrentIrpStackLocation(Irp);
+    NTSTATUS Status;
+
+    /* The bus driver has to start first */
+    Status = IoForwardIrpSynchronously(Adapter->LowerDevice, Irp) ? Irp->IoStatus.Status : STATUS_UNSUCCESSFUL;
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    Adapter->AllocatedResources = StorpCopyResourceList(Stack->Parameters.StartDevice.AllocatedResources);
+    Adapter->TranslatedResources = StorpCopyResourceList(Stack->Parameters.StartDevice.AllocatedResourcesTranslated);
+
+    Status = StorpStartAdapter(Adapter);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("StorpStartAdapter() failed (Status 0x%08lx)\n", Status);
+        StorpStopAdapter(Adapter);
+    }
+
+    return Status;
+}
+
+
+NTSTATUS
+NTAPI
+StorpFdoPnp(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp)
+{
+    PSTOR_ADAPTER Adapter = DeviceObject->DeviceExtension;
+    PIO_STACK_LOCATION Stack;
+    UNICODE_STRING DosName;
+    WCHAR DosNameBuffer[20];
+    NTSTATUS Status;
+
+    Stack = IoGetCurrentIrpStackLocation(Irp);
+
+    DPRINT("StorpFdoPnp(%p %p) minor 0x%x\n", DeviceObject, Irp, Stack->MinorFunction);
+
+    switch (Stack->MinorFunction)
+    {
+        case IRP_MN_START_DEVICE:
+            Status = StorpFdoStartDevice(Adapter, Irp);
+            Irp->IoStatus.Status = Status;
+            IoCompleteRequest(Irp, IO_NO_INCREMENT);
+            return Status;
+
+        case IRP_MN_REMOVE_DEVICE:
+            StorpStopAdapter(Adapter);
+
+            swprintf(DosNameBuffer, L"\\??\\Scsi%lu:", Adapter->PortNumber);
+            RtlInitUnicodeString(&DosName, DosNameBuffer);
+            IoDeleteSymbolicLink(&DosName);
+            IoGetConfigurationInformation()->ScsiPortCount--;
+
+            Irp->IoStatus.Status = STATUS_SUCCESS;
+            IoSkipCurrentIrpStackLocation(Irp);
+            Status = IoCallDriver(Adapter->LowerDevice, Irp);
+
+            IoDetachDevice(Adapter->LowerDevice);
+            IoDeleteDevice(DeviceObject);
+            return Status;
+
+        case IRP_MN_QUERY_REMOVE_DEVICE:
+        case IRP_MN_QUERY_STOP_DEVICE:
+            /* We can't hand the units over to anyone while running */
+            Irp->IoStatus.Status = STATUS_UNSUCCESSFUL;
+            IoCompleteRequest(Irp, IO_NO_INCREMENT);
+            return STATUS_UNSUCCESSFUL;
+
+        default:
+            IoSkipCurrentIrpStackLocation(Irp);
+            return IoCallDriver(Adapter->LowerDevice, Irp);
+    }
+}
+
+
+static
+NTSTATUS
+StorpGetInquiryData(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PIRP Irp)
+{
+    PIO_STACK_LOCATION IrpStack = IoGetCurrentIrpStackLocation(Irp);
+    PSCSI_ADAPTER_BUS_INFO AdapterBusInfo;
+    PSCSI_INQUIRY_DATA InquiryData, LastInquiryData;
+    PSCSI_BUS_DATA BusData;
+    PSTOR_UNIT Unit;
+    ULONG InquiryDataSize, BusCount, Length, Bus;
+    PUCHAR Buffer;
+
+    Buffer = Irp->AssociatedIrp.SystemBuffer;
+    BusCount = Adapter->PortConfig.PortConfiguration.NumberOfBuses;
+
+    /* Calculate size of inquiry data, rounding up to sizeof(ULONG) */
+    InquiryDataSize = ALIGN_UP_BY(sizeof(SCSI_INQUIRY_DATA) - 1 + INQUIRYDATABUFFERSIZE, sizeof(ULONG));
+
+    Length = sizeof(SCSI_ADAPTER_BUS_INFO) + (BusCount - 1) * sizeof(SCSI_BUS_DATA);
+    Length += InquiryDataSize * Adapter->UnitCount;
+
+    if (IrpStack->Parameters.DeviceIoControl.OutputBufferLength < Length)
+        return STATUS_BUFFER_TOO_SMALL;
+
+    Irp->IoStatus.Information = Length;
+
+    AdapterBusInfo = (PSCSI_ADAPTER_BUS_INFO)Buffer;
+    AdapterBusInfo->NumberOfBuses = (UCHAR)BusCount;
+
+    InquiryData = (PSCSI_INQUIRY_DATA)(Buffer + sizeof(SCSI_ADAPTER_BUS_INFO) +
+                                       (BusCount - 1) * sizeof(SCSI_BUS_DATA));
+
+    for (Bus = 0; Bus < BusCount; Bus++)
+    {
+        BusData = &AdapterBusInfo->BusData[Bus];
+        BusData->InquiryDataOffset = (ULONG)((PUCHAR)InquiryData - Buffer);
+        BusData->InitiatorBusId = Adapter->PortConfig.PortConfiguration.InitiatorBusId[Bus];
+        BusData->NumberOfLogicalUnits = 0;
+
+        LastInquiryData = NULL;
+        for (Unit = Adapter->UnitList; Unit != NULL; Unit = Unit->Next)
+        {
+            if (Unit->PathId != Bus)
+                continue;
+
+            InquiryData->PathId = Unit->PathId;
+            InquiryData->TargetId = Unit->TargetId;
+            InquiryData->Lun = Unit->Lun;
+            InquiryData->InquiryDataLength = INQUIRYDATABUFFERSIZE;
+            InquiryData->DeviceClaimed = Unit->DeviceClaimed;
+            InquiryData->NextInquiryDataOffset =
+                (ULONG)((PUCHAR)InquiryData + InquiryDataSize - Buffer);
+
+            RtlCopyMemory(InquiryData->InquiryData, Unit->InquiryData, INQUIRYDATABUFFERSIZE);
+
+            BusData->NumberOfLogicalUnits++;
+            LastInquiryData = InquiryData;
+            InquiryData = (PSCSI_INQUIRY_DATA)((PUCHAR)InquiryData + InquiryDataSize);
+        }
+
+        /* Either mark the end, or set offset to 0 */
+        if (LastInquiryData != NULL)
+            LastInquiryData->NextInquiryDataOffset = 0;
+        else
+            BusData->InquiryDataOffset = 0;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+NTAPI
+StorpFdoDeviceControl(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp)
+{
+    PSTOR_ADAPTER Adapter = DeviceObject->DeviceExtension;
+    PIO_STACK_LOCATION Stack;
+    PDUMP_POINTERS DumpPointers;
+    NTSTATUS Status;
+
+    Stack = IoGetCurrentIrpStackLocation(Irp);
+    Irp->IoStatus.Information = 0;
+
+    switch (Stack->Parameters.DeviceIoControl.IoControlCode)
+    {
+        case IOCTL_SCSI_GET_DUMP_POINTERS:
+            if (Stack->Parameters.DeviceIoControl.OutputBufferLength < sizeof(DUMP_POINTERS))
+            {
+                Status = STATUS_BUFFER_OVERFLOW;
+                Irp->IoStatus.Information = sizeof(DUMP_POINTERS);
+                break;
+            }
+
+            DumpPointers = Irp->AssociatedIrp.SystemBuffer;
+            DumpPointers->DeviceObject = DeviceObject;
+
+            Status = STATUS_SUCCESS;
+            Irp->IoStatus.Information = sizeof(DUMP_POINTERS);
+            break;
+
+        case IOCTL_SCSI_GET_CAPABILITIES:
+            if (Stack->Parameters.DeviceIoControl.OutputBufferLength == sizeof(PVOID))
+            {
+                *((PVOID *)Irp->AssociatedIrp.SystemBuffer) = &Adapter->PortCapabilities;
+
+                Irp->IoStatus.Information = sizeof(PVOID);
+                Status = STATUS_SUCCESS;
+                break;
+            }
+
+            if (Stack->Parameters.DeviceIoControl.OutputBufferLength < sizeof(IO_SCSI_CAPABILITIES))
+            {
+                Status = STATUS_BUFFER_TOO_SMALL;
+                break;
+            }
+
+            RtlCopyMemory(Irp->AssociatedIrp.SystemBuffer,
+                          &Adapter->PortCapabilities,
+                          sizeof(IO_SCSI_CAPABILITIES));
+
+            Irp->IoStatus.Information = sizeof(IO_SCSI_CAPABILITIES);
+            Status = STATUS_SUCCESS;
+            break;
+
+        case IOCTL_SCSI_GET_INQUIRY_DATA:
+            Status = StorpGetInquiryData(Adapter, Irp);
+            break;
+
+        default:
+            DPRINT1("Unknown ioctl code: 0x%lX\n", Stack->Parameters.DeviceIoControl.IoControlCode);
+            Status = STATUS_NOT_IMPLEMENTED;
+            break;
+    }
+
+    Irp->IoStatus.Status = Status;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+    return Status;
+}
+
+
+NTSTATUS
+NTAPI
+StorPortAddDevice(
+    _In_ PDRIVER_OBJECT DriverObject,
+    _In_ PDEVICE_OBJECT PhysicalDeviceObject)
+{
+    PSTOR_DRIVER_EXTENSION DriverExtension;
+    PCONFIGURATION_INFORMATION SystemConfig;
+    PDEVICE_OBJECT DeviceObject = NULL;
+    PSTOR_ADAPTER Adapter;
+    UNICODE_STRING DeviceName, DosName;
+    WCHAR NameBuffer[80], DosNameBuffer[20];
+    ULONG PortNumber, ExtensionSize;
+    NTSTATUS Status;
+
+    DPRINT("StorPortAddDevice(%p %p)\n", DriverObject, PhysicalDeviceObject);
+
+    DriverExtension = IoGetDriverObjectExtension(DriverObject, (PVOID)StorPortInitialize);
+    if (DriverExtension == NULL)
+        return STATUS_UNSUCCESSFUL;
+
+    ExtensionSize = FIELD_OFFSET(STOR_ADAPTER, MiniportDeviceExtension) +
+                    DriverExtension->HwInitData.HwInitializationData.DeviceExtensionSize;
+
+    /* Class drivers find us by the usual scsiport name */
+    SystemConfig = IoGetConfigurationInformation();
+    PortNumber = SystemConfig->ScsiPortCount;
+
+    do
+    {
+        swprintf(NameBuffer, L"\\Device\\ScsiPort%lu", PortNumber);
+        RtlInitUnicodeString(&DeviceName, NameBuffer);
+
+        Status = IoCreateDevice(DriverObject,
+                                ExtensionSize,
+                                &DeviceName,
+                                FILE_DEVICE_CONTROLLER,
+                                FILE_DEVICE_SECURE_OPEN,
+                                FALSE,
+                                &DeviceObject);
+        if (Status == STATUS_OBJECT_NAME_COLLISION)
+            PortNumber++;
+    } while (Status == STATUS_OBJECT_NAME_COLLISION);
+
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("IoCreateDevice() failed (Status 0x%08lx)\n", Status);
+        return Status;
+    }
+
+    Adapter = DeviceObject->DeviceExtension;
+    RtlZeroMemory(Adapter, ExtensionSize);
+
+    Adapter->DeviceObject = DeviceObject;
+    Adapter->PhysicalDeviceObject = PhysicalDeviceObject;
+    Adapter->DriverExtension = DriverExtension;
+    Adapter->PortNumber = PortNumber;
+
+    KeInitializeSpinLock(&Adapter->InterruptSpinLock);
+    KeInitializeSpinLock(&Adapter->StartIoLock);
+
+    KeInitializeTimer(&Adapter->MiniportTimer);
+    KeInitializeDpc(&Adapter->MiniportTimerDpc, StorpMiniportTimerDpc, Adapter);
+    KeInitializeTimer(&Adapter->PauseTimer);
+    KeInitializeDpc(&Adapter->PauseTimerDpc, StorpPauseTimerDpc, Adapter);
+    KeInitializeDpc(&Adapter->RestartDpc, StorpRestartDpc, Adapter);
+
+    Adapter->LowerDevice = IoAttachDeviceToDeviceStack(DeviceObject, PhysicalDeviceObject);
+    if (Adapter->LowerDevice == NULL)
+    {
+        IoDeleteDevice(DeviceObject);
+        return STATUS_NO_SUCH_DEVICE;
+    }
+
+    swprintf(DosNameBuffer, L"\\??\\Scsi%lu:", PortNumber);
+    RtlInitUnicodeString(&DosName, DosNameBuffer);
+    Status = IoCreateSymbolicLink(&DosName, &DeviceName);
+    if (!NT_SUCCESS(Status))
+        DPRINT1("IoCreateSymbolicLink() failed (Status 0x%08lx)\n", Status);
+
+    SystemConfig->ScsiPortCount++;
+
+    DeviceObject->Flags |= DO_DIRECT_IO;
+    DeviceObject->Flags &= ~DO_DEVICE_INITIALIZING;
+
+    return STATUS_SUCCESS;
+}
+
+/* EOF */
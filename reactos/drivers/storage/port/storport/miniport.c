@@ -0,0 +1,1173 @@
+/*
+ * PROJECT:     ReactOS Storport Driver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        drivers/storage/port/storport/miniport.c
+ * PURPOSE:     Miniport support routines
+ * PROGRAMMERS: ReactOS Team
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include "precomp.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* FUNCTIONS ******************************************************************/
+
+PSTOR_ADAPTER
+StorpGetAdapter(
+    _In_ PVOID HwDeviceExtension)
+{
+    return CONTAINING_RECORD(HwDeviceExtension, STOR_ADAPTER, MiniportDeviceExtension);
+}
+
+
+static
+BOOLEAN
+StorpTranslateAddress(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ SCSI_PHYSICAL_ADDRESS IoAddress,
+    _In_ ULONG NumberOfBytes,
+    _In_ BOOLEAN InIoSpace,
+    _Out_ PPHYSICAL_ADDRESS TranslatedAddress,
+    _Out_ PBOOLEAN TranslatedInIoSpace)
+{
+    PCM_PARTIAL_RESOURCE_DESCRIPTOR Raw, Translated;
+    PCM_FULL_RESOURCE_DESCRIPTOR FullRaw, FullTranslated;
+    ULONGLONG Offset;
+    ULONG i;
+
+    if (Adapter->AllocatedResources == NULL || Adapter->TranslatedResources == NULL)
+        return FALSE;
+
+    FullRaw = &Adapter->AllocatedResources->List[0];
+    FullTranslated = &Adapter->TranslatedResources->List[0];
+
+    /* Find the range we were given and use its translated twin */
+    for (i = 0; i < FullRaw->PartialResourceList.Count; i++)
+    {
+        Raw = &FullRaw->PartialResourceList.PartialDescriptors[i];
+        Translated = &FullTranslated->PartialResourceList.PartialDescriptors[i];
+
+        if (!((Raw->Type == CmResourceTypePort && InIoSpace) ||
+              (Raw->Type == CmResourceTypeMemory && !InIoSpace)))
+        {
+            continue;
+        }
+
+        /* Port and memory descriptors share the same layout */
+        if (IoAddress.QuadPart < Raw->u.Memory.Start.QuadPart ||
+            IoAddress.QuadPart + NumberOfBytes >
+            Raw->u.Memory.Start.QuadPart + Raw->u.Memory.Length)
+        {
+            continue;
+        }
+
+        Offset = IoAddress.QuadPart - Raw->u.Memory.Start.QuadPart;
+        TranslatedAddress->QuadPart = Translated->u.Memory.Start.QuadPart + Offset;
+        *TranslatedInIoSpace = (Translated->Type == CmResourceTypePort);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+/* PUBLIC FUNCTIONS ***********************************************************/
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+VOID
+NTAPI
+StorPortFreeDeviceBase(
+    _In_ PVOID HwDeviceExtension,
+    _In_ PVOID MappedAddress)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+    PSTOR_MAPPED_ADDRESS *Link, Entry;
+
+    for (Link = &Adapter->MappedAddressList; *Link != NULL; Link = &(*Link)->Next)
+    {
+        Entry = *Link;
+        if (Entry->MappedAddress == MappedAddress)
+        {
+            *Link = Entry->Next;
+            MmUnmapIoSpace(Entry->MappedAddress, Entry->NumberOfBytes);
+            ExFreePoolWithTag(Entry, TAG_STORPORT);
+            return;
+        }
+    }
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+ULONG
+NTAPI
+StorPortGetBusData(
+    _In_ PVOID DeviceExtension,
+    _In_ ULONG BusDataType,
+    _In_ ULONG SystemIoBusNumber,
+    _In_ ULONG SlotNumber,
+    _Out_ _When_(Length != 0, _Out_writes_bytes_(Length)) PVOID Buffer,
+    _In_ ULONG Length)
+{
+    DPRINT("StorPortGetBusData(%p %lu %lu %lu %p %lu)\n",
+           DeviceExtension, BusDataType, SystemIoBusNumber, SlotNumber, Buffer, Length);
+
+    return HalGetBusDataByOffset(BusDataType,
+                                 SystemIoBusNumber,
+                                 SlotNumber,
+                                 Buffer,
+                                 0,
+                                 Length);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+ULONG
+NTAPI
+StorPortSetBusDataByOffset(
+    _In_ PVOID DeviceExtension,
+    _In_ ULONG BusDataType,
+    _In_ ULONG SystemIoBusNumber,
+    _In_ ULONG SlotNumber,
+    _In_reads_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Offset,
+    _In_ ULONG Length)
+{
+    DPRINT("StorPortSetBusDataByOffset(%p %lu %lu %lu %p %lu %lu)\n",
+           DeviceExtension, BusDataType, SystemIoBusNumber, SlotNumber, Buffer, Offset, Length);
+
+    return HalSetBusDataByOffset(BusDataType,
+                                 SystemIoBusNumber,
+                                 SlotNumber,
+                                 Buffer,
+                                 Offset,
+                                 Length);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+PVOID
+NTAPI
+StorPortGetDeviceBase(
+    _In_ PVOID HwDeviceExtension,
+    _In_ INTERFACE_TYPE BusType,
+    _In_ ULONG SystemIoBusNumber,
+    _In_ SCSI_PHYSICAL_ADDRESS IoAddress,
+    _In_ ULONG NumberOfBytes,
+    _In_ BOOLEAN InIoSpace)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+    PSTOR_MAPPED_ADDRESS Entry;
+    PHYSICAL_ADDRESS TranslatedAddress;
+    BOOLEAN TranslatedInIoSpace;
+    PVOID MappedAddress;
+
+    DPRINT("StorPortGetDeviceBase(%p %lu %lu 0x%I64x %lu %u)\n",
+           HwDeviceExtension, BusType, SystemIoBusNumber, IoAddress.QuadPart, NumberOfBytes, InIoSpace);
+
+    /* We only hand out ranges the PnP manager gave us */
+    if (!StorpTranslateAddress(Adapter,
+                               IoAddress,
+                               NumberOfBytes,
+                               InIoSpace,
+                               &TranslatedAddress,
+                               &TranslatedInIoSpace))
+    {
+        DPRINT1("Address 0x%I64x is not assigned to the adapter\n", IoAddress.QuadPart);
+        return NULL;
+    }
+
+    /* I/O space is used as is */
+    if (TranslatedInIoSpace)
+        return (PVOID)(ULONG_PTR)TranslatedAddress.QuadPart;
+
+    MappedAddress = MmMapIoSpace(TranslatedAddress, NumberOfBytes, MmNonCached);
+    if (MappedAddress == NULL)
+        return NULL;
+
+    /* Remember it, so we can unmap it when the adapter goes away */
+    Entry = ExAllocatePoolWithTag(NonPagedPool, sizeof(STOR_MAPPED_ADDRESS), TAG_STORPORT);
+    if (Entry == NULL)
+    {
+        MmUnmapIoSpace(MappedAddress, NumberOfBytes);
+        return NULL;
+    }
+
+    Entry->MappedAddress = MappedAddress;
+    Entry->NumberOfBytes = NumberOfBytes;
+    Entry->Next = Adapter->MappedAddressList;
+    Adapter->MappedAddressList = Entry;
+
+    return MappedAddress;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+PVOID
+NTAPI
+StorPortGetLogicalUnit(
+    _In_ PVOID HwDeviceExtension,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+    PSTOR_UNIT Unit;
+
+    Unit = StorpGetUnit(Adapter, PathId, TargetId, Lun);
+    if (Unit == NULL || Adapter->UnitExtensionSize == 0)
+        return NULL;
+
+    return Unit->MiniportLunExtension;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+PSCSI_REQUEST_BLOCK
+NTAPI
+StorPortGetSrb(
+    _In_ PVOID DeviceExtension,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun,
+    _In_ LONG QueueTag)
+{
+    DPRINT("StorPortGetSrb(%p %u %u %u %ld)\n", DeviceExtension, PathId, TargetId, Lun, QueueTag);
+
+    /* Storport miniports have to keep track of their own requests */
+    return NULL;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+STOR_PHYSICAL_ADDRESS
+NTAPI
+StorPortGetPhysicalAddress(
+    _In_ PVOID HwDeviceExtension,
+    _In_opt_ PSCSI_REQUEST_BLOCK Srb,
+    _In_ PVOID VirtualAddress,
+    _Out_ ULONG *Length)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+    STOR_PHYSICAL_ADDRESS PhysicalAddress;
+    ULONG_PTR Offset;
+
+    /* Addresses inside the uncached extension are easy */
+    if (Adapter->UncachedExtension != NULL &&
+        (ULONG_PTR)VirtualAddress >= (ULONG_PTR)Adapter->UncachedExtension &&
+        (ULONG_PTR)VirtualAddress < (ULONG_PTR)Adapter->UncachedExtension + Adapter->UncachedExtensionLength)
+    {
+        Offset = (ULONG_PTR)VirtualAddress - (ULONG_PTR)Adapter->UncachedExtension;
+        PhysicalAddress.QuadPart = Adapter->UncachedExtensionPhysical.QuadPart + Offset;
+        *Length = Adapter->UncachedExtensionLength - (ULONG)Offset;
+        return PhysicalAddress;
+    }
+
+    /* Everything else is nonpaged memory */
+    PhysicalAddress = MmGetPhysicalAddress(VirtualAddress);
+    *Length = PAGE_SIZE - BYTE_OFFSET(VirtualAddress);
+
+    UNREFERENCED_PARAMETER(Srb);
+    return PhysicalAddress;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+PVOID
+NTAPI
+StorPortGetVirtualAddress(
+    _In_ PVOID HwDeviceExtension,
+    _In_ STOR_PHYSICAL_ADDRESS PhysicalAddress)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+    ULONGLONG Offset;
+
+    if (Adapter->UncachedExtension == NULL)
+        return NULL;
+
+    Offset = PhysicalAddress.QuadPart - Adapter->UncachedExtensionPhysical.QuadPart;
+    if (Offset >= Adapter->UncachedExtensionLength)
+        return NULL;
+
+    return (PUCHAR)Adapter->UncachedExtension + Offset;
+}
+
+
+NTSTATUS
+StorpCreateDmaAdapter(
+    _In_ PSTOR_ADAPTER Adapter)
+{
+    PPORT_CONFIGURATION_INFORMATION PortConfig = &Adapter->PortConfig.PortConfiguration;
+    DEVICE_DESCRIPTION DeviceDescription;
+
+    if (Adapter->DmaAdapter != NULL)
+        return STATUS_SUCCESS;
+
+    RtlZeroMemory(&DeviceDescription, sizeof(DeviceDescription));
+    DeviceDescription.Version = DEVICE_DESCRIPTION_VERSION;
+    DeviceDescription.Master = TRUE;
+    DeviceDescription.ScatterGather = TRUE;
+    DeviceDescription.Dma32BitAddresses = PortConfig->Dma32BitAddresses;
+    DeviceDescription.Dma64BitAddresses = (PortConfig->Dma64BitAddresses != 0);
+    DeviceDescription.InterfaceType = PortConfig->AdapterInterfaceType;
+    DeviceDescription.BusNumber = PortConfig->SystemIoBusNumber;
+    DeviceDescription.MaximumLength = (PortConfig->MaximumTransferLength == SP_UNINITIALIZED_VALUE) ?
+                                      MAXULONG : PortConfig->MaximumTransferLength;
+
+    Adapter->DmaAdapter = IoGetDmaAdapter(Adapter->PhysicalDeviceObject,
+                                          &DeviceDescription,
+                                          &Adapter->MapRegisterCount);
+    if (Adapter->DmaAdapter == NULL)
+    {
+        DPRINT1("IoGetDmaAdapter() failed\n");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+PVOID
+NTAPI
+StorPortGetUncachedExtension(
+    _In_ PVOID HwDeviceExtension,
+    _In_ PPORT_CONFIGURATION_INFORMATION ConfigInfo,
+    _In_ ULONG NumberOfBytes)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+
+    DPRINT("StorPortGetUncachedExtension(%p %p %lu)\n", HwDeviceExtension, ConfigInfo, NumberOfBytes);
+
+    /* There is only one per adapter */
+    if (Adapter->UncachedExtension != NULL)
+        return (Adapter->UncachedExtensionLength >= NumberOfBytes) ? Adapter->UncachedExtension : NULL;
+
+    /* The DMA adapter is described by our copy of the port configuration */
+    UNREFERENCED_PARAMETER(ConfigInfo);
+    if (!NT_SUCCESS(StorpCreateDmaAdapter(Adapter)))
+        return NULL;
+
+    Adapter->UncachedExtension =
+        Adapter->DmaAdapter->DmaOperations->AllocateCommonBuffer(Adapter->DmaAdapter,
+                                                                 NumberOfBytes,
+                                                                 &Adapter->UncachedExtensionPhysical,
+                                                                 FALSE);
+    if (Adapter->UncachedExtension == NULL)
+        return NULL;
+
+    Adapter->UncachedExtensionLength = NumberOfBytes;
+    RtlZeroMemory(Adapter->UncachedExtension, NumberOfBytes);
+
+    return Adapter->UncachedExtension;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+VOID
+__cdecl
+StorPortNotification(
+    _In_ SCSI_NOTIFICATION_TYPE NotificationType,
+    _In_ PVOID HwDeviceExtension,
+    ...)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+    PSCSI_REQUEST_BLOCK Srb;
+    PHW_TIMER HwTimer;
+    ULONG MiniportTimerValue;
+    PHW_PASSIVE_INITIALIZE_ROUTINE PassiveRoutine;
+    PBOOLEAN Result;
+    PSTOR_DPC StorDpc;
+    PHW_DPC_ROUTINE DpcRoutine;
+    PVOID SystemArgument1, SystemArgument2;
+    STOR_SPINLOCK Lock;
+    PVOID LockContext;
+    PSTOR_LOCK_HANDLE LockHandle;
+    va_list ap;
+
+    DPRINT("StorPortNotification(%x %p)\n", NotificationType, HwDeviceExtension);
+
+    va_start(ap, HwDeviceExtension);
+
+    switch (NotificationType)
+    {
+        case RequestComplete:
+            Srb = (PSCSI_REQUEST_BLOCK)va_arg(ap, PSCSI_REQUEST_BLOCK);
+            StorpCompleteSrb(Adapter, Srb);
+            break;
+
+        case NextRequest:
+        case NextLuRequest:
+            /* Storport miniports always take the next request */
+            break;
+
+        case ResetDetected:
+            /* Nothing to do, the miniport completes what it lost */
+            break;
+
+        case BusChangeDetected:
+            DPRINT1("Bus change detected, rescanning is not supported\n");
+            break;
+
+        case RequestTimerCall:
+            HwTimer = (PHW_TIMER)va_arg(ap, PHW_TIMER);
+            MiniportTimerValue = (ULONG)va_arg(ap, ULONG);
+
+            /* This usually comes from the interrupt routine, arm the timer from the DPC */
+            InterlockedExchangePointer((PVOID *)&Adapter->PendingHwTimer, (PVOID)HwTimer);
+            InterlockedExchange(&Adapter->PendingTimerValue, (LONG)MiniportTimerValue);
+            StorpPostNotification(Adapter, &Adapter->PendingNotifications, ADAPTER_NOTIFY_TIMER, 0);
+            break;
+
+        case EnablePassiveInitialization:
+            PassiveRoutine = (PHW_PASSIVE_INITIALIZE_ROUTINE)va_arg(ap, PHW_PASSIVE_INITIALIZE_ROUTINE);
+            Result = (PBOOLEAN)va_arg(ap, PBOOLEAN);
+
+            /* Only allowed from HwInitialize */
+            Adapter->HwPassiveInitialize = PassiveRoutine;
+            *Result = TRUE;
+            break;
+
+        case InitializeDpc:
+            StorDpc = (PSTOR_DPC)va_arg(ap, PSTOR_DPC);
+            DpcRoutine = (PHW_DPC_ROUTINE)va_arg(ap, PHW_DPC_ROUTINE);
+
+            /* The miniport routine gets the STOR_DPC as its DPC and the extension as context */
+            KeInitializeDpc(&StorDpc->Dpc, (PKDEFERRED_ROUTINE)DpcRoutine, HwDeviceExtension);
+            KeInitializeSpinLock(&StorDpc->Lock);
+            break;
+
+        case IssueDpc:
+            StorDpc = (PSTOR_DPC)va_arg(ap, PSTOR_DPC);
+            SystemArgument1 = (PVOID)va_arg(ap, PVOID);
+            SystemArgument2 = (PVOID)va_arg(ap, PVOID);
+            Result = (PBOOLEAN)va_arg(ap, PBOOLEAN);
+
+            *Result = KeInsertQueueDpc(&StorDpc->Dpc, SystemArgument1, SystemArgument2);
+            break;
+
+        case AcquireSpinLock:
+            Lock = (STOR_SPINLOCK)va_arg(ap, STOR_SPINLOCK);
+            LockContext = (PVOID)va_arg(ap, PVOID);
+            LockHandle = (PSTOR_LOCK_HANDLE)va_arg(ap, PSTOR_LOCK_HANDLE);
+
+            LockHandle->Lock = Lock;
+            LockHandle->Context.Context = LockContext;
+
+            switch (Lock)
+            {
+                case DpcLock:
+                    KeAcquireSpinLock(&((PSTOR_DPC)LockContext)->Lock, &LockHandle->Context.OldIrql);
+                    break;
+
+                case StartIoLock:
+                    KeAcquireSpinLock(&Adapter->StartIoLock, &LockHandle->Context.OldIrql);
+                    break;
+
+                case InterruptLock:
+                    LockHandle->Context.OldIrql = StorpAcquireInterruptLock(Adapter);
+                    break;
+            }
+            break;
+
+        case ReleaseSpinLock:
+            LockHandle = (PSTOR_LOCK_HANDLE)va_arg(ap, PSTOR_LOCK_HANDLE);
+
+            switch (LockHandle->Lock)
+            {
+                case DpcLock:
+                    KeReleaseSpinLock(&((PSTOR_DPC)LockHandle->Context.Context)->Lock,
+                                      LockHandle->Context.OldIrql);
+                    break;
+
+                case StartIoLock:
+                    KeReleaseSpinLock(&Adapter->StartIoLock, LockHandle->Context.OldIrql);
+                    break;
+
+                case InterruptLock:
+                    StorpReleaseInterruptLock(Adapter, LockHandle->Context.OldIrql);
+                    break;
+            }
+            break;
+
+        default:
+            DPRINT1("Unsupported notification %lu\n", NotificationType);
+            break;
+    }
+
+    va_end(ap);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+VOID
+NTAPI
+StorPortLogError(
+    _In_ PVOID HwDeviceExtension,
+    _In_opt_ PSCSI_REQUEST_BLOCK Srb,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun,
+    _In_ ULONG ErrorCode,
+    _In_ ULONG UniqueId)
+{
+    DPRINT1("StorPortLogError(%p %p %u %u %u 0x%08lx 0x%08lx)\n",
+            HwDeviceExtension, Srb, PathId, TargetId, Lun, ErrorCode, UniqueId);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+VOID
+NTAPI
+StorPortCompleteRequest(
+    _In_ PVOID HwDeviceExtension,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun,
+    _In_ UCHAR SrbStatus)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+
+    DPRINT("StorPortCompleteRequest(%p %u %u %u 0x%x)\n",
+           HwDeviceExtension, PathId, TargetId, Lun, SrbStatus);
+
+    StorpCompleteOutstanding(Adapter, PathId, TargetId, Lun, SrbStatus);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+VOID
+NTAPI
+StorPortMoveMemory(
+    _Out_writes_bytes_(Length) PVOID WriteBuffer,
+    _In_reads_bytes_(Length) PVOID ReadBuffer,
+    _In_ ULONG Length)
+{
+    RtlMoveMemory(WriteBuffer, ReadBuffer, Length);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+VOID
+NTAPI
+StorPortStallExecution(
+    _In_ ULONG Delay)
+{
+    KeStallExecutionProcessor(Delay);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+STOR_PHYSICAL_ADDRESS
+NTAPI
+StorPortConvertUlong64ToPhysicalAddress(
+    _In_ ULONG64 UlongAddress)
+{
+    STOR_PHYSICAL_ADDRESS Address;
+
+    Address.QuadPart = UlongAddress;
+    return Address;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+ULONG64
+NTAPI
+StorPortConvertPhysicalAddressToUlong64(
+    _In_ STOR_PHYSICAL_ADDRESS Address)
+{
+    return Address.QuadPart;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+BOOLEAN
+NTAPI
+StorPortValidateRange(
+    _In_ PVOID HwDeviceExtension,
+    _In_ INTERFACE_TYPE BusType,
+    _In_ ULONG SystemIoBusNumber,
+    _In_ STOR_PHYSICAL_ADDRESS IoAddress,
+    _In_ ULONG NumberOfBytes,
+    _In_ BOOLEAN InIoSpace)
+{
+    PHYSICAL_ADDRESS TranslatedAddress;
+    BOOLEAN TranslatedInIoSpace;
+
+    UNREFERENCED_PARAMETER(BusType);
+    UNREFERENCED_PARAMETER(SystemIoBusNumber);
+
+    return StorpTranslateAddress(StorpGetAdapter(HwDeviceExtension),
+                                 IoAddress,
+                                 NumberOfBytes,
+                                 InIoSpace,
+                                 &TranslatedAddress,
+                                 &TranslatedInIoSpace);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+VOID
+__cdecl
+StorPortDebugPrint(
+    _In_ ULONG DebugPrintLevel,
+    _In_ PCCHAR DebugMessage,
+    ...)
+{
+    va_list ap;
+
+    va_start(ap, DebugMessage);
+    vDbgPrintExWithPrefix("STORMINI: ", 0x58, DebugPrintLevel, DebugMessage, ap);
+    va_end(ap);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+UCHAR
+NTAPI
+StorPortReadPortUchar(
+    _In_ PVOID HwDeviceExtension,
+    _In_ PUCHAR Port)
+{
+    return READ_PORT_UCHAR(Port);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+ULONG
+NTAPI
+StorPortReadPortUlong(
+    _In_ PVOID HwDeviceExtension,
+    _In_ PULONG Port)
+{
+    return READ_PORT_ULONG(Port);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+USHORT
+NTAPI
+StorPortReadPortUshort(
+    _In_ PVOID HwDeviceExtension,
+    _In_ PUSHORT Port)
+{
+    return READ_PORT_USHORT(Port);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+UCHAR
+NTAPI
+StorPortReadRegisterUchar(
+    _In_ PVOID HwDeviceExtension,
+    _In_ PUCHAR Register)
+{
+    return READ_REGISTER_UCHAR(Register);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+ULONG
+NTAPI
+StorPortReadRegisterUlong(
+    _In_ PVOID HwDeviceExtension,
+    _In_ PULONG Register)
+{
+    return READ_REGISTER_ULONG(Register);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+USHORT
+NTAPI
+StorPortReadRegisterUshort(
+    _In_ PVOID HwDeviceExtension,
+    _In_ PUSHORT Register)
+{
+    return READ_REGISTER_USHORT(Register);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+VOID
+NTAPI
+StorPortWritePortUchar(
+    _In_ PVOID HwDeviceExtension,
+    _In_ PUCHAR Port,
+    _In_ UCHAR Value)
+{
+    WRITE_PORT_UCHAR(Port, Value);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+VOID
+NTAPI
+StorPortWritePortUlong(
+    _In_ PVOID HwDeviceExtension,
+    _In_ PULONG Port,
+    _In_ ULONG Value)
+{
+    WRITE_PORT_ULONG(Port, Value);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+VOID
+NTAPI
+StorPortWritePortUshort(
+    _In_ PVOID HwDeviceExtension,
+    _In_ PUSHORT Port,
+    _In_ USHORT Value)
+{
+    WRITE_PORT_USHORT(Port, Value);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+VOID
+NTAPI
+StorPortWriteRegisterUchar(
+    _In_ PVOID HwDeviceExtension,
+    _In_ PUCHAR Register,
+    _In_ UCHAR Value)
+{
+    WRITE_REGISTER_UCHAR(Register, Value);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+VOID
+NTAPI
+StorPortWriteRegisterUlong(
+    _In_ PVOID HwDeviceExtension,
+    _In_ PULONG Register,
+    _In_ ULONG Value)
+{
+    WRITE_REGISTER_ULONG(Register, Value);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+VOID
+NTAPI
+StorPortWriteRegisterUshort(
+    _In_ PVOID HwDeviceExtension,
+    _In_ PUSHORT Register,
+    _In_ USHORT Value)
+{
+    WRITE_REGISTER_USHORT(Register, Value);
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+BOOLEAN
+NTAPI
+StorPortPauseDevice(
+    _In_ PVOID HwDeviceExtension,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun,
+    _In_ ULONG TimeOut)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+    PSTOR_UNIT Unit;
+
+    Unit = StorpGetUnit(Adapter, PathId, TargetId, Lun);
+    if (Unit == NULL)
+        return FALSE;
+
+    /* The time out is in seconds, the DPC arms the timer */
+    InterlockedExchange(&Unit->PendingPauseTimeOut, (LONG)TimeOut);
+    StorpPostNotification(Adapter, &Unit->PendingNotifications, UNIT_NOTIFY_PAUSE, UNIT_NOTIFY_RESUME);
+    StorpPostNotification(Adapter, &Adapter->PendingNotifications, ADAPTER_NOTIFY_UNITS, 0);
+
+    return TRUE;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+BOOLEAN
+NTAPI
+StorPortResumeDevice(
+    _In_ PVOID HwDeviceExtension,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+    PSTOR_UNIT Unit;
+
+    Unit = StorpGetUnit(Adapter, PathId, TargetId, Lun);
+    if (Unit == NULL)
+        return FALSE;
+
+    StorpPostNotification(Adapter, &Unit->PendingNotifications, UNIT_NOTIFY_RESUME, UNIT_NOTIFY_PAUSE);
+    StorpPostNotification(Adapter, &Adapter->PendingNotifications, ADAPTER_NOTIFY_UNITS, 0);
+
+    return TRUE;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+BOOLEAN
+NTAPI
+StorPortPause(
+    _In_ PVOID HwDeviceExtension,
+    _In_ ULONG TimeOut)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+
+    InterlockedExchange(&Adapter->Paused, 1);
+
+    /* The time out is in seconds, the DPC arms the timer */
+    InterlockedExchange(&Adapter->PendingPauseTimeOut, (LONG)TimeOut);
+    StorpPostNotification(Adapter,
+                          &Adapter->PendingNotifications,
+                          ADAPTER_NOTIFY_PAUSE_TIMER,
+                          ADAPTER_NOTIFY_CANCEL_PAUSE);
+
+    return TRUE;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+BOOLEAN
+NTAPI
+StorPortResume(
+    _In_ PVOID HwDeviceExtension)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+
+    InterlockedExchange(&Adapter->Paused, 0);
+
+    StorpPostNotification(Adapter,
+                          &Adapter->PendingNotifications,
+                          ADAPTER_NOTIFY_CANCEL_PAUSE,
+                          ADAPTER_NOTIFY_PAUSE_TIMER);
+
+    return TRUE;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+BOOLEAN
+NTAPI
+StorPortDeviceBusy(
+    _In_ PVOID HwDeviceExtension,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun,
+    _In_ ULONG RequestsToComplete)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+    PSTOR_UNIT Unit;
+
+    Unit = StorpGetUnit(Adapter, PathId, TargetId, Lun);
+    if (Unit == NULL)
+        return FALSE;
+
+    /* Hold back new requests until this many have completed */
+    InterlockedExchange(&Unit->PendingBusyCount, (LONG)max(RequestsToComplete, 1));
+    StorpPostNotification(Adapter, &Unit->PendingNotifications, UNIT_NOTIFY_BUSY, UNIT_NOTIFY_READY);
+    StorpPostNotification(Adapter, &Adapter->PendingNotifications, ADAPTER_NOTIFY_UNITS, 0);
+
+    return TRUE;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+BOOLEAN
+NTAPI
+StorPortDeviceReady(
+    _In_ PVOID HwDeviceExtension,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+    PSTOR_UNIT Unit;
+
+    Unit = StorpGetUnit(Adapter, PathId, TargetId, Lun);
+    if (Unit == NULL)
+        return FALSE;
+
+    StorpPostNotification(Adapter, &Unit->PendingNotifications, UNIT_NOTIFY_READY, UNIT_NOTIFY_BUSY);
+    StorpPostNotification(Adapter, &Adapter->PendingNotifications, ADAPTER_NOTIFY_UNITS, 0);
+
+    return TRUE;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+BOOLEAN
+NTAPI
+StorPortBusy(
+    _In_ PVOID HwDeviceExtension,
+    _In_ ULONG RequestsToComplete)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+
+    InterlockedExchange(&Adapter->BusyCount, (LONG)max(RequestsToComplete, 1));
+
+    return TRUE;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+BOOLEAN
+NTAPI
+StorPortReady(
+    _In_ PVOID HwDeviceExtension)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+
+    InterlockedExchange(&Adapter->BusyCount, 0);
+    StorpQueueRestart(Adapter);
+
+    return TRUE;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+PSTOR_SCATTER_GATHER_LIST
+NTAPI
+StorPortGetScatterGatherList(
+    _In_ PVOID DeviceExtension,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    PSTOR_REQUEST Request;
+    PIRP Irp;
+
+    UNREFERENCED_PARAMETER(DeviceExtension);
+
+    Irp = Srb->OriginalRequest;
+    if (Irp == NULL)
+        return NULL;
+
+    /* The DMA adapter built the list before the request was started, the layouts match */
+    Request = Irp->Tail.Overlay.DriverContext[0];
+    if (Request == NULL)
+        return NULL;
+
+    return (PSTOR_SCATTER_GATHER_LIST)Request->SgList;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+BOOLEAN
+NTAPI
+StorPortSetDeviceQueueDepth(
+    _In_ PVOID HwDeviceExtension,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun,
+    _In_ ULONG Depth)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+    PSTOR_UNIT Unit;
+
+    if (Depth == 0 || Depth > STOR_MAXIMUM_QUEUE_DEPTH)
+        return FALSE;
+
+    Unit = StorpGetUnit(Adapter, PathId, TargetId, Lun);
+    if (Unit == NULL)
+        return FALSE;
+
+    /* The queue might have room once the DPC applied it */
+    InterlockedExchange(&Unit->PendingQueueDepth, (LONG)Depth);
+    StorpPostNotification(Adapter, &Unit->PendingNotifications, UNIT_NOTIFY_DEPTH, 0);
+    StorpPostNotification(Adapter, &Adapter->PendingNotifications, ADAPTER_NOTIFY_UNITS, 0);
+
+    return TRUE;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+ULONG
+NTAPI
+StorPortGetMSIInfo(
+    _In_ PVOID HwDeviceExtension,
+    _In_ ULONG MessageId,
+    _Out_ PMESSAGE_INTERRUPT_INFORMATION InterruptInfo)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+    PCM_FULL_RESOURCE_DESCRIPTOR FullTranslated;
+    PCM_PARTIAL_RESOURCE_DESCRIPTOR Translated;
+    ULONG i, Index = 0;
+
+    if (Adapter->TranslatedResources == NULL || MessageId >= Adapter->MessageCount)
+        return STOR_STATUS_INVALID_PARAMETER;
+
+    /* Messages are numbered in the order of their descriptors */
+    FullTranslated = &Adapter->TranslatedResources->List[0];
+    for (i = 0; i < FullTranslated->PartialResourceList.Count; i++)
+    {
+        Translated = &FullTranslated->PartialResourceList.PartialDescriptors[i];
+        if (Translated->Type != CmResourceTypeInterrupt ||
+            !(Translated->Flags & CM_RESOURCE_INTERRUPT_MESSAGE))
+        {
+            continue;
+        }
+
+        if (Index++ != MessageId)
+            continue;
+
+        RtlZeroMemory(InterruptInfo, sizeof(MESSAGE_INTERRUPT_INFORMATION));
+        InterruptInfo->MessageId = MessageId;
+        InterruptInfo->InterruptVector = Translated->u.Interrupt.Vector;
+        InterruptInfo->InterruptLevel = Translated->u.Interrupt.Level;
+        InterruptInfo->InterruptMode = Latched;
+        return STOR_STATUS_SUCCESS;
+    }
+
+    return STOR_STATUS_INVALID_PARAMETER;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+VOID
+NTAPI
+StorPortSynchronizeAccess(
+    _In_ PVOID HwDeviceExtension,
+    _In_ PSTOR_SYNCHRONIZED_ACCESS SynchronizedAccessRoutine,
+    _In_opt_ PVOID Context)
+{
+    PSTOR_ADAPTER Adapter = StorpGetAdapter(HwDeviceExtension);
+    KIRQL OldIrql;
+
+    /* Run the routine with the interrupt held off */
+    OldIrql = StorpAcquireInterruptLock(Adapter);
+    SynchronizedAccessRoutine(HwDeviceExtension, Context);
+    StorpReleaseInterruptLock(Adapter, OldIrql);
+}
+
+/* EOF */
@@ -0,0 +1,340 @@
+/*
+ * PROJECT:     ReactOS Storport Driver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        drivers/storage/port/storport/precomp.h
+ * PURPOSE:     Storport driver common header
+ * PROGRAMMERS: ReactOS Team
+ */
+
+#ifndef _STORPORT_PCH_
+#define _STORPORT_PCH_
+
+#include <wdm.h>
+#include <ntddk.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <scsi.h>
+#include <ntddscsi.h>
+#include <ntdddisk.h>
+#include <mountdev.h>
+
+#define _STORPORT_
+#include <storport.h>
+
+#define TAG_STORPORT 'troP'
+
+/* Number of hash buckets used to look up logical units */
+#define STOR_LUN_HASH_SIZE 32
+
+/* Default and maximum number of outstanding requests per logical unit */
+#define STOR_DEFAULT_QUEUE_DEPTH 32
+#define STOR_MAXIMUM_QUEUE_DEPTH 254
+
+/* Maximum transfer length if the miniport does not set one */
+#define STOR_DEFAULT_MAXIMUM_TRANSFER_LENGTH 0x20000
+
+/* Maximum number of message signaled interrupts we connect */
+#define STOR_MAXIMUM_MESSAGES 32
+
+/* Logical unit flags, protected by the unit lock */
+#define LUN_FROZEN      0x0001
+#define LUN_PAUSED      0x0002
+#define LUN_BUSY        0x0004
+
+/* Unit notifications waiting for the restart DPC */
+#define UNIT_NOTIFY_PAUSE   0x0001
+#define UNIT_NOTIFY_RESUME  0x0002
+#define UNIT_NOTIFY_BUSY    0x0004
+#define UNIT_NOTIFY_READY   0x0008
+#define UNIT_NOTIFY_DEPTH   0x0010
+
+/* Adapter notifications waiting for the restart DPC */
+#define ADAPTER_NOTIFY_TIMER        0x0001
+#define ADAPTER_NOTIFY_PAUSE_TIMER  0x0002
+#define ADAPTER_NOTIFY_CANCEL_PAUSE 0x0004
+#define ADAPTER_NOTIFY_UNITS        0x0008
+
+/* Adapter flags */
+#define ADAPTER_STARTED     0x0001
+#define ADAPTER_INTERRUPTS  0x0002
+
+typedef struct _STOR_DRIVER_EXTENSION
+{
+    STOR_HW_INITIALIZATION_DATA HwInitData;
+    UNICODE_STRING RegistryPath;
+} STOR_DRIVER_EXTENSION, *PSTOR_DRIVER_EXTENSION;
+
+typedef struct _STOR_UNIT
+{
+    /* Hash chain and adapter-wide list, both only ever grow */
+    struct _STOR_UNIT *HashNext;
+    struct _STOR_UNIT *Next;
+    struct _STOR_ADAPTER *Adapter;
+
+    UCHAR PathId;
+    UCHAR TargetId;
+    UCHAR Lun;
+    BOOLEAN DeviceClaimed;
+    PDEVICE_OBJECT ClassDevice;
+
+    /* Requests waiting for a queue slot, and the ones handed to the miniport */
+    KSPIN_LOCK Lock;
+    LIST_ENTRY PendingList;
+    LIST_ENTRY ActiveList;
+    ULONG Flags;
+    ULONG QueueDepth;
+    ULONG Outstanding;
+    LONG BusyCount;
+
+    /* Changes the miniport asked for, possibly from its interrupt routine */
+    LONG PendingNotifications;
+    LONG PendingBusyCount;
+    LONG PendingQueueDepth;
+    LONG PendingPauseTimeOut;
+
+    /* Resumes the unit when a StorPortPauseDevice time out expires */
+    KTIMER PauseTimer;
+    KDPC PauseTimerDpc;
+
+    UCHAR InquiryData[INQUIRYDATABUFFERSIZE];
+
+    UCHAR MiniportLunExtension[1]; /* must be the last entry */
+} STOR_UNIT, *PSTOR_UNIT;
+
+typedef struct _STOR_REQUEST
+{
+    /* Linked into the unit pending or active list */
+    LIST_ENTRY ListEntry;
+
+    /* Linked into the per-processor completion list */
+    SLIST_ENTRY CompletionEntry;
+
+    PIRP Irp;
+    PSCSI_REQUEST_BLOCK Srb;
+    PSTOR_UNIT Unit;
+    PVOID OriginalDataBuffer;
+    ULONG Processor;
+    BOOLEAN Active;
+    LONG Completed;
+
+    /* Built by the DMA adapter, so it holds bus addresses */
+    PSCATTER_GATHER_LIST SgList;
+} STOR_REQUEST, *PSTOR_REQUEST;
+
+typedef struct _STOR_PROCESSOR
+{
+    /* Requests completed on behalf of this processor */
+    SLIST_HEADER CompletedList;
+    KDPC CompletionDpc;
+} STOR_PROCESSOR, *PSTOR_PROCESSOR;
+
+typedef struct _STOR_MESSAGE
+{
+    struct _STOR_ADAPTER *Adapter;
+    ULONG MessageId;
+    PKINTERRUPT Interrupt;
+} STOR_MESSAGE, *PSTOR_MESSAGE;
+
+typedef struct _STOR_MAPPED_ADDRESS
+{
+    struct _STOR_MAPPED_ADDRESS *Next;
+    PVOID MappedAddress;
+    ULONG NumberOfBytes;
+} STOR_MAPPED_ADDRESS, *PSTOR_MAPPED_ADDRESS;
+
+typedef struct _STOR_ADAPTER
+{
+    PDEVICE_OBJECT DeviceObject;
+    PDEVICE_OBJECT PhysicalDeviceObject;
+    PDEVICE_OBJECT LowerDevice;
+    PSTOR_DRIVER_EXTENSION DriverExtension;
+    ULONG PortNumber;
+    ULONG Flags;
+
+    /* Resources we got from the PnP manager */
+    PCM_RESOURCE_LIST AllocatedResources;
+    PCM_RESOURCE_LIST TranslatedResources;
+    STOR_PORT_CONFIGURATION_INFORMATION PortConfig;
+    ACCESS_RANGE AccessRanges[8];
+    PSTOR_MAPPED_ADDRESS MappedAddressList;
+
+    /* Interrupts, all sharing one lock */
+    KSPIN_LOCK InterruptSpinLock;
+    PKINTERRUPT Interrupt;
+    ULONG MessageCount;
+    STOR_MESSAGE Messages[STOR_MAXIMUM_MESSAGES];
+
+    /* Serializes HwStartIo and HwTimer in full duplex mode */
+    KSPIN_LOCK StartIoLock;
+
+    /* DMA and the uncached extension */
+    PDMA_ADAPTER DmaAdapter;
+    ULONG MapRegisterCount;
+    PVOID UncachedExtension;
+    PHYSICAL_ADDRESS UncachedExtensionPhysical;
+    ULONG UncachedExtensionLength;
+
+    /* Logical units */
+    PSTOR_UNIT UnitHash[STOR_LUN_HASH_SIZE];
+    PSTOR_UNIT UnitList;
+    ULONG UnitCount;
+    ULONG UnitExtensionSize;
+    PSTOR_UNIT ProbeUnit;
+
+    /* Requests */
+    NPAGED_LOOKASIDE_LIST RequestLookaside;
+    NPAGED_LOOKASIDE_LIST SrbExtensionLookaside;
+    ULONG SrbExtensionSize;
+    LONG BusyCount;
+    LONG Paused;
+
+    /* Per-processor completion lists */
+    ULONG ProcessorCount;
+    PSTOR_PROCESSOR Processors;
+
+    /* Miniport timer and pause timer */
+    PHW_TIMER HwTimer;
+    KTIMER MiniportTimer;
+    KDPC MiniportTimerDpc;
+    KTIMER PauseTimer;
+    KDPC PauseTimerDpc;
+
+    /* Restarts the queues outside of any miniport callback */
+    KDPC RestartDpc;
+
+    /* Notifications the restart DPC applies, the miniport may send them at DIRQL */
+    LONG PendingNotifications;
+    PHW_TIMER PendingHwTimer;
+    LONG PendingTimerValue;
+    LONG PendingPauseTimeOut;
+
+    /* Miniport entry points */
+    PHW_INITIALIZE HwInitialize;
+    PHW_BUILDIO HwBuildIo;
+    PHW_STARTIO HwStartIo;
+    PHW_INTERRUPT HwInterrupt;
+    PHW_MESSAGE_SIGNALED_INTERRUPT_ROUTINE HwMSInterruptRoutine;
+    PHW_RESET_BUS HwResetBus;
+    PHW_ADAPTER_CONTROL HwAdapterControl;
+    PHW_PASSIVE_INITIALIZE_ROUTINE HwPassiveInitialize;
+
+    IO_SCSI_CAPABILITIES PortCapabilities;
+
+    UCHAR MiniportDeviceExtension[1]; /* must be the last entry */
+} STOR_ADAPTER, *PSTOR_ADAPTER;
+
+/* fdo.c */
+
+DRIVER_ADD_DEVICE StorPortAddDevice;
+
+NTSTATUS
+NTAPI
+StorpFdoPnp(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp);
+
+NTSTATUS
+NTAPI
+StorpFdoDeviceControl(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp);
+
+/* miniport.c */
+
+PSTOR_ADAPTER
+StorpGetAdapter(
+    _In_ PVOID HwDeviceExtension);
+
+NTSTATUS
+StorpCreateDmaAdapter(
+    _In_ PSTOR_ADAPTER Adapter);
+
+/* queue.c */
+
+NTSTATUS
+StorpInitializeQueues(
+    _In_ PSTOR_ADAPTER Adapter);
+
+VOID
+StorpDeleteQueues(
+    _In_ PSTOR_ADAPTER Adapter);
+
+PSTOR_UNIT
+StorpGetUnit(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun);
+
+PSTOR_UNIT
+StorpCreateUnit(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun);
+
+VOID
+StorpInsertUnit(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PSTOR_UNIT Unit);
+
+NTSTATUS
+StorpQueueRequest(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PSTOR_UNIT Unit,
+    _In_ PIRP Irp,
+    _In_ PSCSI_REQUEST_BLOCK Srb);
+
+VOID
+StorpFreeRequest(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PSTOR_REQUEST Request);
+
+VOID
+StorpCompleteSrb(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PSCSI_REQUEST_BLOCK Srb);
+
+VOID
+StorpCompleteOutstanding(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun,
+    _In_ UCHAR SrbStatus);
+
+VOID
+StorpRestartUnits(
+    _In_ PSTOR_ADAPTER Adapter);
+
+VOID
+StorpPostNotification(
+    _In_ PSTOR_ADAPTER Adapter,
+    _Inout_ PLONG Pending,
+    _In_ LONG Set,
+    _In_ LONG Clear);
+
+VOID
+StorpQueueRestart(
+    _In_ PSTOR_ADAPTER Adapter);
+
+VOID
+StorpStartNextRequests(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PSTOR_UNIT Unit);
+
+KIRQL
+StorpAcquireInterruptLock(
+    _In_ PSTOR_ADAPTER Adapter);
+
+VOID
+StorpReleaseInterruptLock(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ KIRQL OldIrql);
+
+KDEFERRED_ROUTINE StorpMiniportTimerDpc;
+KDEFERRED_ROUTINE StorpPauseTimerDpc;
+KDEFERRED_ROUTINE StorpUnitPauseTimerDpc;
+KDEFERRED_ROUTINE StorpRestartDpc;
+
+#endif /* _STORPORT_PCH_ */
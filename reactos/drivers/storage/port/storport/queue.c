@@ -0,0 +1,1062 @@
+/*
+ * PROJECT:     ReactOS Storport Driver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        drivers/storage/port/storport/queue.c
+ * PURPOSE:     Request queueing and completion
+ * PROGRAMMERS: ReactOS Team
+ */
+
+/*
+ * Requests are prepared on the submitting processor without taking any
+ * adapter-wide lock: the SRB extension and scatter/gather list are built and
+ * HwBuildIo is called right there. Each logical unit then has its own queue,
+ * bounded by its queue depth, and only the call into HwStartIo itself is
+ * serialized. Completions are handed back to the processor that issued the
+ * request through a per-processor list and a DPC targeted at it, so the IRP
+ * is completed where its data is still cache hot.
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include "precomp.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* The miniport gets the list the DMA adapter built */
+C_ASSERT(sizeof(STOR_SCATTER_GATHER_ELEMENT) == sizeof(SCATTER_GATHER_ELEMENT));
+C_ASSERT(FIELD_OFFSET(STOR_SCATTER_GATHER_LIST, List) == FIELD_OFFSET(SCATTER_GATHER_LIST, Elements));
+
+/* FUNCTIONS ******************************************************************/
+
+static
+NTSTATUS
+StorpSrbStatusToNt(
+    _In_ UCHAR SrbStatus)
+{
+    switch (SRB_STATUS(SrbStatus))
+    {
+        case SRB_STATUS_SUCCESS:
+            return STATUS_SUCCESS;
+
+        case SRB_STATUS_TIMEOUT:
+        case SRB_STATUS_COMMAND_TIMEOUT:
+            return STATUS_IO_TIMEOUT;
+
+        case SRB_STATUS_BAD_SRB_BLOCK_LENGTH:
+        case SRB_STATUS_BAD_FUNCTION:
+            return STATUS_INVALID_DEVICE_REQUEST;
+
+        case SRB_STATUS_NO_DEVICE:
+        case SRB_STATUS_INVALID_LUN:
+        case SRB_STATUS_INVALID_TARGET_ID:
+        case SRB_STATUS_NO_HBA:
+            return STATUS_DEVICE_DOES_NOT_EXIST;
+
+        case SRB_STATUS_DATA_OVERRUN:
+            return STATUS_BUFFER_OVERFLOW;
+
+        case SRB_STATUS_SELECTION_TIMEOUT:
+            return STATUS_DEVICE_NOT_CONNECTED;
+
+        case SRB_STATUS_BUSY:
+            return STATUS_DEVICE_BUSY;
+
+        default:
+            return STATUS_IO_DEVICE_ERROR;
+    }
+}
+
+
+static
+ULONG
+StorpUnitHash(
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun)
+{
+    return ((PathId << 6) ^ (TargetId << 3) ^ Lun) % STOR_LUN_HASH_SIZE;
+}
+
+
+PSTOR_UNIT
+StorpGetUnit(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun)
+{
+    PSTOR_UNIT Unit;
+
+    /* Units are never removed while the adapter is running, so no lock is needed */
+    for (Unit = Adapter->UnitHash[StorpUnitHash(PathId, TargetId, Lun)];
+         Unit != NULL;
+         Unit = Unit->HashNext)
+    {
+        if (Unit->PathId == PathId &&
+            Unit->TargetId == TargetId &&
+            Unit->Lun == Lun)
+        {
+            return Unit;
+        }
+    }
+
+    /* It might be the unit that is being probed right now */
+    Unit = Adapter->ProbeUnit;
+    if (Unit != NULL &&
+        Unit->PathId == PathId &&
+        Unit->TargetId == TargetId &&
+        Unit->Lun == Lun)
+    {
+        return Unit;
+    }
+
+    return NULL;
+}
+
+
+PSTOR_UNIT
+StorpCreateUnit(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun)
+{
+    PSTOR_UNIT Unit;
+    ULONG Size;
+
+    Size = FIELD_OFFSET(STOR_UNIT, MiniportLunExtension) + Adapter->UnitExtensionSize;
+    Unit = ExAllocatePoolWithTag(NonPagedPool, Size, TAG_STORPORT);
+    if (Unit == NULL)
+        return NULL;
+
+    RtlZeroMemory(Unit, Size);
+
+    Unit->Adapter = Adapter;
+    Unit->PathId = PathId;
+    Unit->TargetId = TargetId;
+    Unit->Lun = Lun;
+
+    KeInitializeSpinLock(&Unit->Lock);
+    InitializeListHead(&Unit->PendingList);
+    InitializeListHead(&Unit->ActiveList);
+    KeInitializeTimer(&Unit->PauseTimer);
+    KeInitializeDpc(&Unit->PauseTimerDpc, StorpUnitPauseTimerDpc, Unit);
+
+    /* Only queue more than one request if the miniport can take them */
+    if (Adapter->PortConfig.PortConfiguration.TaggedQueuing &&
+        Adapter->PortConfig.PortConfiguration.MultipleRequestPerLu)
+    {
+        Unit->QueueDepth = STOR_DEFAULT_QUEUE_DEPTH;
+    }
+    else
+    {
+        Unit->QueueDepth = 1;
+    }
+
+    return Unit;
+}
+
+
+VOID
+StorpInsertUnit(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PSTOR_UNIT Unit)
+{
+    PSTOR_UNIT *Link;
+    ULONG Hash;
+
+    /* Units are only inserted from the bus scan, which is serialized */
+    for (Link = &Adapter->UnitList; *Link != NULL; Link = &(*Link)->Next)
+        ;
+    *Link = Unit;
+    Adapter->UnitCount++;
+
+    /* Publish the unit to lock-free lookups last */
+    Hash = StorpUnitHash(Unit->PathId, Unit->TargetId, Unit->Lun);
+    Unit->HashNext = Adapter->UnitHash[Hash];
+    InterlockedExchangePointer((PVOID *)&Adapter->UnitHash[Hash], Unit);
+}
+
+
+static
+VOID
+NTAPI
+StorpCompletionDpc(
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2);
+
+
+NTSTATUS
+StorpInitializeQueues(
+    _In_ PSTOR_ADAPTER Adapter)
+{
+    PSTOR_PROCESSOR Processor;
+    ULONG i;
+
+    Adapter->ProcessorCount = KeNumberProcessors;
+    Adapter->Processors = ExAllocatePoolWithTag(NonPagedPool,
+                                                 Adapter->ProcessorCount * sizeof(STOR_PROCESSOR),
+                                                 TAG_STORPORT);
+    if (Adapter->Processors == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    /* One completion list per processor, drained by a DPC running on it */
+    for (i = 0; i < Adapter->ProcessorCount; i++)
+    {
+        Processor = &Adapter->Processors[i];
+
+        InitializeSListHead(&Processor->CompletedList);
+        KeInitializeDpc(&Processor->CompletionDpc, StorpCompletionDpc, Adapter);
+        KeSetTargetProcessorDpc(&Processor->CompletionDpc, (CCHAR)i);
+    }
+
+    ExInitializeNPagedLookasideList(&Adapter->RequestLookaside,
+                                    NULL,
+                                    NULL,
+                                    0,
+                                    sizeof(STOR_REQUEST),
+                                    TAG_STORPORT,
+                                    0);
+
+    if (Adapter->SrbExtensionSize != 0)
+    {
+        ExInitializeNPagedLookasideList(&Adapter->SrbExtensionLookaside,
+                                        NULL,
+                                        NULL,
+                                        0,
+                                        ALIGN_UP_BY(Adapter->SrbExtensionSize, 8),
+                                        TAG_STORPORT,
+                                        0);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+StorpDeleteQueues(
+    _In_ PSTOR_ADAPTER Adapter)
+{
+    PSTOR_UNIT Unit, NextUnit;
+    ULONG i;
+
+    if (Adapter->Processors == NULL)
+        return;
+
+    for (Unit = Adapter->UnitList; Unit != NULL; Unit = Unit->Next)
+        KeCancelTimer(&Unit->PauseTimer);
+
+    /* Make sure no completion or pause timer DPC is still running */
+    KeFlushQueuedDpcs();
+
+    ExDeleteNPagedLookasideList(&Adapter->RequestLookaside);
+    if (Adapter->SrbExtensionSize != 0)
+        ExDeleteNPagedLookasideList(&Adapter->SrbExtensionLookaside);
+
+    ExFreePoolWithTag(Adapter->Processors, TAG_STORPORT);
+    Adapter->Processors = NULL;
+
+    for (Unit = Adapter->UnitList; Unit != NULL; Unit = NextUnit)
+    {
+        NextUnit = Unit->Next;
+        ExFreePoolWithTag(Unit, TAG_STORPORT);
+    }
+
+    Adapter->UnitList = NULL;
+    Adapter->UnitCount = 0;
+    for (i = 0; i < STOR_LUN_HASH_SIZE; i++)
+        Adapter->UnitHash[i] = NULL;
+}
+
+
+KIRQL
+StorpAcquireInterruptLock(
+    _In_ PSTOR_ADAPTER Adapter)
+{
+    KIRQL OldIrql;
+
+    if (Adapter->Interrupt != NULL)
+        return KeAcquireInterruptSpinLock(Adapter->Interrupt);
+
+    KeAcquireSpinLock(&Adapter->InterruptSpinLock, &OldIrql);
+    return OldIrql;
+}
+
+
+VOID
+StorpReleaseInterruptLock(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ KIRQL OldIrql)
+{
+    if (Adapter->Interrupt != NULL)
+        KeReleaseInterruptSpinLock(Adapter->Interrupt, OldIrql);
+    else
+        KeReleaseSpinLock(&Adapter->InterruptSpinLock, OldIrql);
+}
+
+
+static
+BOOLEAN
+StorpNeedsMapping(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    switch (Adapter->PortConfig.PortConfiguration.MapBuffers)
+    {
+        case STOR_MAP_NO_BUFFERS:
+            return FALSE;
+
+        case STOR_MAP_NON_READ_WRITE_BUFFERS:
+            /* The miniport only emulates the other commands */
+            if (Srb->Function != SRB_FUNCTION_EXECUTE_SCSI)
+                return TRUE;
+
+            switch (Srb->Cdb[0])
+            {
+                case SCSIOP_READ:
+                case SCSIOP_WRITE:
+                case SCSIOP_READ16:
+                case SCSIOP_WRITE16:
+                    return FALSE;
+            }
+            return TRUE;
+
+        default:
+            return TRUE;
+    }
+}
+
+
+static
+BOOLEAN
+StorpHasDataBuffer(
+    _In_ PSTOR_REQUEST Request)
+{
+    PSCSI_REQUEST_BLOCK Srb = Request->Srb;
+
+    return ((Srb->SrbFlags & (SRB_FLAGS_DATA_IN | SRB_FLAGS_DATA_OUT)) &&
+            (Srb->DataTransferLength != 0) &&
+            (Request->Irp->MdlAddress != NULL));
+}
+
+
+static
+NTSTATUS
+StorpPrepareDataBuffer(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PSTOR_REQUEST Request)
+{
+    PSCSI_REQUEST_BLOCK Srb = Request->Srb;
+    PMDL Mdl = Request->Irp->MdlAddress;
+    ULONG_PTR Offset;
+    PVOID SystemVa;
+
+    Request->OriginalDataBuffer = NULL;
+
+    if (!StorpHasDataBuffer(Request))
+        return STATUS_SUCCESS;
+
+    /* Give the miniport a system address if it wants to touch the data */
+    if (StorpNeedsMapping(Adapter, Srb))
+    {
+        SystemVa = MmGetSystemAddressForMdlSafe(Mdl, HighPagePriority);
+        if (SystemVa == NULL)
+            return STATUS_INSUFFICIENT_RESOURCES;
+
+        /* Where does the transfer start inside the MDL */
+        Offset = (ULONG_PTR)Srb->DataBuffer - (ULONG_PTR)MmGetMdlVirtualAddress(Mdl);
+
+        Request->OriginalDataBuffer = Srb->DataBuffer;
+        Srb->DataBuffer = (PVOID)((ULONG_PTR)SystemVa + Offset);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+StorpFreeRequest(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PSTOR_REQUEST Request)
+{
+    PSCSI_REQUEST_BLOCK Srb = Request->Srb;
+    KIRQL OldIrql;
+
+    /* Release the map registers, this also flushes the adapter buffers */
+    if (Request->SgList != NULL)
+    {
+        KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+        Adapter->DmaAdapter->DmaOperations->PutScatterGatherList(Adapter->DmaAdapter,
+                                                                 Request->SgList,
+                                                                 (Srb->SrbFlags & SRB_FLAGS_DATA_OUT) != 0);
+        KeLowerIrql(OldIrql);
+        Request->SgList = NULL;
+    }
+
+    /* Give the class driver its buffer address back */
+    if (Request->OriginalDataBuffer != NULL)
+        Srb->DataBuffer = Request->OriginalDataBuffer;
+
+    if (Srb->SrbExtension != NULL)
+    {
+        ExFreeToNPagedLookasideList(&Adapter->SrbExtensionLookaside, Srb->SrbExtension);
+        Srb->SrbExtension = NULL;
+    }
+
+    Request->Irp->Tail.Overlay.DriverContext[0] = NULL;
+    ExFreeToNPagedLookasideList(&Adapter->RequestLookaside, Request);
+}
+
+
+static
+BOOLEAN
+NTAPI
+StorpSynchronizedStartIo(
+    _In_ PVOID Context)
+{
+    PSTOR_REQUEST Request = Context;
+    PSTOR_ADAPTER Adapter = Request->Unit->Adapter;
+
+    return Adapter->HwStartIo(Adapter->MiniportDeviceExtension, Request->Srb);
+}
+
+
+static
+VOID
+StorpStartIo(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PSTOR_REQUEST Request)
+{
+    BOOLEAN Result;
+
+    ASSERT(KeGetCurrentIrql() == DISPATCH_LEVEL);
+
+    if (Adapter->PortConfig.SynchronizationModel == StorSynchronizeFullDuplex ||
+        Adapter->Interrupt == NULL)
+    {
+        /* The interrupt can keep running while we start the request */
+        KeAcquireSpinLockAtDpcLevel(&Adapter->StartIoLock);
+        Result = Adapter->HwStartIo(Adapter->MiniportDeviceExtension, Request->Srb);
+        KeReleaseSpinLockFromDpcLevel(&Adapter->StartIoLock);
+    }
+    else
+    {
+        /* Half duplex, HwStartIo runs at DIRQL with the interrupt lock held */
+        Result = KeSynchronizeExecution(Adapter->Interrupt,
+                                        StorpSynchronizedStartIo,
+                                        Request);
+    }
+
+    if (!Result)
+    {
+        /* The miniport refused the request */
+        if (Request->Srb->SrbStatus == SRB_STATUS_PENDING)
+            Request->Srb->SrbStatus = SRB_STATUS_ERROR;
+
+        StorpCompleteSrb(Adapter, Request->Srb);
+    }
+}
+
+
+VOID
+StorpStartNextRequests(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PSTOR_UNIT Unit)
+{
+    PSTOR_REQUEST Request;
+    PLIST_ENTRY Entry;
+    KIRQL OldIrql;
+
+    KeAcquireSpinLock(&Unit->Lock, &OldIrql);
+
+    /* Hand out requests as long as the unit has room for them */
+    while (!IsListEmpty(&Unit->PendingList) &&
+           Unit->Outstanding < Unit->QueueDepth &&
+           !(Unit->Flags & (LUN_PAUSED | LUN_BUSY)) &&
+           Adapter->Paused == 0 &&
+           Adapter->BusyCount == 0)
+    {
+        Entry = Unit->PendingList.Flink;
+        Request = CONTAINING_RECORD(Entry, STOR_REQUEST, ListEntry);
+
+        /* A frozen queue only lets through requests meant to bypass it */
+        if ((Unit->Flags & LUN_FROZEN) &&
+            !(Request->Srb->SrbFlags & SRB_FLAGS_BYPASS_FROZEN_QUEUE))
+        {
+            break;
+        }
+
+        RemoveEntryList(Entry);
+        InsertTailList(&Unit->ActiveList, Entry);
+        Request->Active = TRUE;
+        Unit->Outstanding++;
+
+        KeReleaseSpinLockFromDpcLevel(&Unit->Lock);
+        StorpStartIo(Adapter, Request);
+        KeAcquireSpinLockAtDpcLevel(&Unit->Lock);
+    }
+
+    KeReleaseSpinLock(&Unit->Lock, OldIrql);
+}
+
+
+VOID
+StorpRestartUnits(
+    _In_ PSTOR_ADAPTER Adapter)
+{
+    PSTOR_UNIT Unit;
+
+    for (Unit = Adapter->UnitList; Unit != NULL; Unit = Unit->Next)
+        StorpStartNextRequests(Adapter, Unit);
+}
+
+
+VOID
+StorpQueueRestart(
+    _In_ PSTOR_ADAPTER Adapter)
+{
+    /* The miniport may call us with the StartIo lock held, so don't restart inline */
+    KeInsertQueueDpc(&Adapter->RestartDpc, NULL, NULL);
+}
+
+
+VOID
+StorpPostNotification(
+    _In_ PSTOR_ADAPTER Adapter,
+    _Inout_ PLONG Pending,
+    _In_ LONG Set,
+    _In_ LONG Clear)
+{
+    LONG Old, New;
+
+    /* This may be called at any IRQL up to DIRQL, the latest request wins */
+    do
+    {
+        Old = *(volatile LONG *)Pending;
+        New = (Old & ~Clear) | Set;
+    } while (InterlockedCompareExchange(Pending, New, Old) != Old);
+
+    StorpQueueRestart(Adapter);
+}
+
+
+static
+VOID
+StorpStartRequest(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PSTOR_REQUEST Request)
+{
+    PSTOR_UNIT Unit = Request->Unit;
+    PSCSI_REQUEST_BLOCK Srb = Request->Srb;
+    KIRQL OldIrql;
+
+    /* Let the miniport build its command without any lock held */
+    if (Adapter->HwBuildIo != NULL &&
+        !Adapter->HwBuildIo(Adapter->MiniportDeviceExtension, Srb))
+    {
+        /* The miniport already completed the request */
+        return;
+    }
+
+    KeAcquireSpinLock(&Unit->Lock, &OldIrql);
+    if (Srb->SrbFlags & SRB_FLAGS_BYPASS_FROZEN_QUEUE)
+        InsertHeadList(&Unit->PendingList, &Request->ListEntry);
+    else
+        InsertTailList(&Unit->PendingList, &Request->ListEntry);
+    KeReleaseSpinLock(&Unit->Lock, OldIrql);
+
+    StorpStartNextRequests(Adapter, Unit);
+}
+
+
+static
+VOID
+NTAPI
+StorpScatterGatherReady(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp,
+    _In_ PSCATTER_GATHER_LIST ScatterGather,
+    _In_ PVOID Context)
+{
+    PSTOR_REQUEST Request = Context;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+    UNREFERENCED_PARAMETER(Irp);
+
+    /* Called at DISPATCH_LEVEL, the list stays ours until StorpFreeRequest */
+    Request->SgList = ScatterGather;
+    StorpStartRequest(Request->Unit->Adapter, Request);
+}
+
+
+NTSTATUS
+StorpQueueRequest(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PSTOR_UNIT Unit,
+    _In_ PIRP Irp,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    PSTOR_REQUEST Request;
+    PVOID DataBuffer;
+    BOOLEAN WriteToDevice;
+    KIRQL OldIrql;
+    NTSTATUS Status;
+
+    Request = ExAllocateFromNPagedLookasideList(&Adapter->RequestLookaside);
+    if (Request == NULL)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto fail;
+    }
+
+    Request->Irp = Irp;
+    Request->Srb = Srb;
+    Request->Unit = Unit;
+    Request->Processor = KeGetCurrentProcessorNumber();
+    Request->Active = FALSE;
+    Request->Completed = 0;
+    Request->SgList = NULL;
+
+    /* The SRB leads back to us through its IRP */
+    Srb->OriginalRequest = Irp;
+    Irp->Tail.Overlay.DriverContext[0] = Request;
+
+    Srb->SrbExtension = NULL;
+    if (Adapter->SrbExtensionSize != 0)
+    {
+        Srb->SrbExtension = ExAllocateFromNPagedLookasideList(&Adapter->SrbExtensionLookaside);
+        if (Srb->SrbExtension == NULL)
+        {
+            Irp->Tail.Overlay.DriverContext[0] = NULL;
+            ExFreeToNPagedLookasideList(&Adapter->RequestLookaside, Request);
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto fail;
+        }
+
+        RtlZeroMemory(Srb->SrbExtension, Adapter->SrbExtensionSize);
+    }
+
+    Status = StorpPrepareDataBuffer(Adapter, Request);
+    if (!NT_SUCCESS(Status))
+    {
+        StorpFreeRequest(Adapter, Request);
+        goto fail;
+    }
+
+    Srb->SrbStatus = SRB_STATUS_PENDING;
+    IoMarkIrpPending(Irp);
+
+    if (Adapter->DmaAdapter == NULL || !StorpHasDataBuffer(Request))
+    {
+        StorpStartRequest(Adapter, Request);
+        return STATUS_PENDING;
+    }
+
+    /* Have the DMA adapter map the buffer, it may only call back once map registers are free */
+    DataBuffer = (Request->OriginalDataBuffer != NULL) ? Request->OriginalDataBuffer : Srb->DataBuffer;
+    WriteToDevice = (Srb->SrbFlags & SRB_FLAGS_DATA_OUT) != 0;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+    KeFlushIoBuffers(Irp->MdlAddress, !WriteToDevice, TRUE);
+    Status = Adapter->DmaAdapter->DmaOperations->GetScatterGatherList(Adapter->DmaAdapter,
+                                                                      Adapter->DeviceObject,
+                                                                      Irp->MdlAddress,
+                                                                      DataBuffer,
+                                                                      Srb->DataTransferLength,
+                                                                      StorpScatterGatherReady,
+                                                                      Request,
+                                                                      WriteToDevice);
+    KeLowerIrql(OldIrql);
+
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("GetScatterGatherList() failed (Status 0x%08lx)\n", Status);
+        StorpFreeRequest(Adapter, Request);
+
+        /* The IRP is already marked pending */
+        Srb->SrbStatus = SRB_STATUS_INTERNAL_ERROR;
+        Irp->IoStatus.Status = Status;
+        Irp->IoStatus.Information = 0;
+        IoCompleteRequest(Irp, IO_NO_INCREMENT);
+    }
+
+    return STATUS_PENDING;
+
+fail:
+    Srb->SrbStatus = SRB_STATUS_INTERNAL_ERROR;
+    Irp->IoStatus.Status = Status;
+    Irp->IoStatus.Information = 0;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+    return Status;
+}
+
+
+VOID
+StorpCompleteSrb(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    PSTOR_REQUEST Request;
+    PSTOR_PROCESSOR Processor;
+    PIRP Irp;
+
+    /* This may be called at any IRQL up to DIRQL */
+    Irp = Srb->OriginalRequest;
+    Request = Irp->Tail.Overlay.DriverContext[0];
+    ASSERT(Request != NULL && Request->Srb == Srb);
+
+    /* Ignore a second completion of the same request */
+    if (InterlockedExchange(&Request->Completed, 1) != 0)
+        return;
+
+    /* Hand it back to the processor that issued it */
+    Processor = &Adapter->Processors[Request->Processor];
+    InterlockedPushEntrySList(&Processor->CompletedList, &Request->CompletionEntry);
+    KeInsertQueueDpc(&Processor->CompletionDpc, NULL, NULL);
+}
+
+
+static
+BOOLEAN
+StorpDecrementBusyCount(
+    _Inout_ PLONG BusyCount)
+{
+    LONG Count;
+
+    /* StorPortBusy and StorPortReady may reset the count under us at any time */
+    do
+    {
+        Count = *(volatile LONG *)BusyCount;
+        if (Count <= 0)
+            return FALSE;
+    } while (InterlockedCompareExchange(BusyCount, Count - 1, Count) != Count);
+
+    return (Count == 1);
+}
+
+
+static
+VOID
+StorpFinishRequest(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PSTOR_REQUEST Request)
+{
+    PSTOR_UNIT Unit = Request->Unit;
+    PSCSI_REQUEST_BLOCK Srb = Request->Srb;
+    PIRP Irp = Request->Irp;
+    BOOLEAN Restart = FALSE;
+
+    KeAcquireSpinLockAtDpcLevel(&Unit->Lock);
+
+    if (Request->Active)
+    {
+        RemoveEntryList(&Request->ListEntry);
+        Unit->Outstanding--;
+    }
+
+    /* Freeze the queue on errors, so the class driver can look at the sense data */
+    if (SRB_STATUS(Srb->SrbStatus) != SRB_STATUS_SUCCESS &&
+        !(Srb->SrbFlags & SRB_FLAGS_NO_QUEUE_FREEZE))
+    {
+        Unit->Flags |= LUN_FROZEN;
+        Srb->SrbStatus |= SRB_STATUS_QUEUE_FROZEN;
+    }
+
+    /* The miniport may have asked to wait for a number of completions */
+    if (StorpDecrementBusyCount(&Unit->BusyCount))
+        Unit->Flags &= ~LUN_BUSY;
+
+    KeReleaseSpinLockFromDpcLevel(&Unit->Lock);
+
+    if (StorpDecrementBusyCount(&Adapter->BusyCount))
+        Restart = TRUE;
+
+    if (SRB_STATUS(Srb->SrbStatus) == SRB_STATUS_SUCCESS)
+    {
+        Irp->IoStatus.Status = STATUS_SUCCESS;
+        Irp->IoStatus.Information = Srb->DataTransferLength;
+    }
+    else
+    {
+        Irp->IoStatus.Status = StorpSrbStatusToNt(Srb->SrbStatus);
+        Irp->IoStatus.Information = 0;
+    }
+
+    StorpFreeRequest(Adapter, Request);
+    IoCompleteRequest(Irp, IO_DISK_INCREMENT);
+
+    /* A slot got free, fill it */
+    if (Restart)
+        StorpRestartUnits(Adapter);
+    else
+        StorpStartNextRequests(Adapter, Unit);
+}
+
+
+static
+VOID
+NTAPI
+StorpCompletionDpc(
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2)
+{
+    PSTOR_ADAPTER Adapter = DeferredContext;
+    PSTOR_PROCESSOR Processor;
+    PSLIST_ENTRY Entry, Next, Ordered;
+    PSTOR_REQUEST Request;
+
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    Processor = CONTAINING_RECORD(Dpc, STOR_PROCESSOR, CompletionDpc);
+
+    /* Take everything at once, it comes out newest first */
+    Entry = InterlockedFlushSList(&Processor->CompletedList);
+
+    Ordered = NULL;
+    while (Entry != NULL)
+    {
+        Next = Entry->Next;
+        Entry->Next = Ordered;
+        Ordered = Entry;
+        Entry = Next;
+    }
+
+    while (Ordered != NULL)
+    {
+        Request = CONTAINING_RECORD(Ordered, STOR_REQUEST, CompletionEntry);
+        Ordered = Ordered->Next;
+
+        StorpFinishRequest(Adapter, Request);
+    }
+}
+
+
+VOID
+StorpCompleteOutstanding(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun,
+    _In_ UCHAR SrbStatus)
+{
+    PSTOR_UNIT Unit;
+    PSTOR_REQUEST Request;
+    PLIST_ENTRY Entry;
+    KIRQL OldIrql;
+
+    ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
+
+    for (Unit = Adapter->UnitList; Unit != NULL; Unit = Unit->Next)
+    {
+        if ((PathId != SP_UNTAGGED && Unit->PathId != PathId) ||
+            (TargetId != SP_UNTAGGED && Unit->TargetId != TargetId) ||
+            (Lun != SP_UNTAGGED && Unit->Lun != Lun))
+        {
+            continue;
+        }
+
+        /* Completion only queues the requests, they stay on the list until the DPC */
+        KeAcquireSpinLock(&Unit->Lock, &OldIrql);
+        for (Entry = Unit->ActiveList.Flink;
+             Entry != &Unit->ActiveList;
+             Entry = Entry->Flink)
+        {
+            Request = CONTAINING_RECORD(Entry, STOR_REQUEST, ListEntry);
+            if (Request->Completed == 0)
+            {
+                Request->Srb->SrbStatus = SrbStatus;
+                StorpCompleteSrb(Adapter, Request->Srb);
+            }
+        }
+        KeReleaseSpinLock(&Unit->Lock, OldIrql);
+    }
+}
+
+
+VOID
+NTAPI
+StorpMiniportTimerDpc(
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2)
+{
+    PSTOR_ADAPTER Adapter = DeferredContext;
+    PHW_TIMER HwTimer;
+    KIRQL OldIrql;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    HwTimer = Adapter->HwTimer;
+    if (HwTimer == NULL)
+        return;
+
+    /* The timer routine is synchronized like HwStartIo */
+    if (Adapter->PortConfig.SynchronizationModel == StorSynchronizeFullDuplex ||
+        Adapter->Interrupt == NULL)
+    {
+        KeAcquireSpinLockAtDpcLevel(&Adapter->StartIoLock);
+        HwTimer(Adapter->MiniportDeviceExtension);
+        KeReleaseSpinLockFromDpcLevel(&Adapter->StartIoLock);
+    }
+    else
+    {
+        OldIrql = StorpAcquireInterruptLock(Adapter);
+        HwTimer(Adapter->MiniportDeviceExtension);
+        StorpReleaseInterruptLock(Adapter, OldIrql);
+    }
+}
+
+
+VOID
+NTAPI
+StorpPauseTimerDpc(
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2)
+{
+    PSTOR_ADAPTER Adapter = DeferredContext;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    /* The pause timed out, resume */
+    InterlockedExchange(&Adapter->Paused, 0);
+    StorpRestartUnits(Adapter);
+}
+
+
+VOID
+NTAPI
+StorpUnitPauseTimerDpc(
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2)
+{
+    PSTOR_UNIT Unit = DeferredContext;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    /* The device pause timed out, resume the unit */
+    KeAcquireSpinLockAtDpcLevel(&Unit->Lock);
+    Unit->Flags &= ~LUN_PAUSED;
+    KeReleaseSpinLockFromDpcLevel(&Unit->Lock);
+
+    StorpStartNextRequests(Unit->Adapter, Unit);
+}
+
+
+static
+VOID
+StorpProcessNotifications(
+    _In_ PSTOR_ADAPTER Adapter)
+{
+    PSTOR_UNIT Unit;
+    LARGE_INTEGER DueTime;
+    LONG Pending;
+
+    Pending = InterlockedExchange(&Adapter->PendingNotifications, 0);
+    if (Pending == 0)
+        return;
+
+    if (Pending & ADAPTER_NOTIFY_TIMER)
+    {
+        Adapter->HwTimer = Adapter->PendingHwTimer;
+        if (Adapter->PendingTimerValue == 0)
+        {
+            KeCancelTimer(&Adapter->MiniportTimer);
+        }
+        else
+        {
+            DueTime.QuadPart = (LONGLONG)Adapter->PendingTimerValue * -10;
+            KeSetTimer(&Adapter->MiniportTimer, DueTime, &Adapter->MiniportTimerDpc);
+        }
+    }
+
+    if (Pending & ADAPTER_NOTIFY_PAUSE_TIMER)
+    {
+        /* The time out is in seconds */
+        DueTime.QuadPart = (LONGLONG)Adapter->PendingPauseTimeOut * -10000000;
+        KeSetTimer(&Adapter->PauseTimer, DueTime, &Adapter->PauseTimerDpc);
+    }
+    else if (Pending & ADAPTER_NOTIFY_CANCEL_PAUSE)
+    {
+        KeCancelTimer(&Adapter->PauseTimer);
+    }
+
+    if (!(Pending & ADAPTER_NOTIFY_UNITS))
+        return;
+
+    for (Unit = Adapter->UnitList; Unit != NULL; Unit = Unit->Next)
+    {
+        Pending = InterlockedExchange(&Unit->PendingNotifications, 0);
+        if (Pending == 0)
+            continue;
+
+        KeAcquireSpinLockAtDpcLevel(&Unit->Lock);
+
+        if (Pending & UNIT_NOTIFY_PAUSE)
+        {
+            /* The time out is in seconds */
+            Unit->Flags |= LUN_PAUSED;
+            DueTime.QuadPart = (LONGLONG)Unit->PendingPauseTimeOut * -10000000;
+            KeSetTimer(&Unit->PauseTimer, DueTime, &Unit->PauseTimerDpc);
+        }
+        else if (Pending & UNIT_NOTIFY_RESUME)
+        {
+            Unit->Flags &= ~LUN_PAUSED;
+            KeCancelTimer(&Unit->PauseTimer);
+        }
+
+        if (Pending & UNIT_NOTIFY_BUSY)
+        {
+            Unit->Flags |= LUN_BUSY;
+            InterlockedExchange(&Unit->BusyCount, Unit->PendingBusyCount);
+        }
+        else if (Pending & UNIT_NOTIFY_READY)
+        {
+            Unit->Flags &= ~LUN_BUSY;
+            InterlockedExchange(&Unit->BusyCount, 0);
+        }
+
+        if (Pending & UNIT_NOTIFY_DEPTH)
+            Unit->QueueDepth = Unit->PendingQueueDepth;
+
+        KeReleaseSpinLockFromDpcLevel(&Unit->Lock);
+    }
+}
+
+
+VOID
+NTAPI
+StorpRestartDpc(
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2)
+{
+    PSTOR_ADAPTER Adapter = DeferredContext;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    StorpProcessNotifications(Adapter);
+    StorpRestartUnits(Adapter);
+}
+
+/* EOF */
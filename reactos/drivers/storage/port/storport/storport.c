@@ -0,0 +1,344 @@
+/*
+ * PROJECT:     ReactOS Storport Driver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        drivers/storage/port/storport/storport.c
+ * PURPOSE:     Storport driver entry point and dispatch routines
+ * PROGRAMMERS: ReactOS Team
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include "precomp.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* FUNCTIONS ******************************************************************/
+
+static
+NTSTATUS
+NTAPI
+StorpCreateClose(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp)
+{
+    DPRINT("StorpCreateClose(%p %p)\n", DeviceObject, Irp);
+
+    Irp->IoStatus.Status = STATUS_SUCCESS;
+    Irp->IoStatus.Information = FILE_OPENED;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+    return STATUS_SUCCESS;
+}
+
+
+static
+NTSTATUS
+StorpHandleClaimRelease(
+    _In_ PSTOR_ADAPTER Adapter,
+    _In_ PSTOR_UNIT Unit,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    PDEVICE_OBJECT ClassDevice;
+    KIRQL OldIrql;
+
+    KeAcquireSpinLock(&Unit->Lock, &OldIrql);
+
+    /* Release, if asked */
+    if (Srb->Function == SRB_FUNCTION_RELEASE_DEVICE)
+    {
+        Unit->DeviceClaimed = FALSE;
+        KeReleaseSpinLock(&Unit->Lock, OldIrql);
+        Srb->SrbStatus = SRB_STATUS_SUCCESS;
+        return STATUS_SUCCESS;
+    }
+
+    /* Attach, if not already claimed */
+    if (Unit->DeviceClaimed)
+    {
+        KeReleaseSpinLock(&Unit->Lock, OldIrql);
+        Srb->SrbStatus = SRB_STATUS_BUSY;
+        return STATUS_DEVICE_BUSY;
+    }
+
+    ClassDevice = Unit->ClassDevice;
+
+    if (Srb->Function == SRB_FUNCTION_CLAIM_DEVICE)
+        Unit->DeviceClaimed = TRUE;
+
+    if (Srb->Function == SRB_FUNCTION_ATTACH_DEVICE)
+        Unit->ClassDevice = Srb->DataBuffer;
+
+    /* The class driver gets our FDO if nobody attached before */
+    Srb->DataBuffer = ClassDevice ? ClassDevice : Adapter->DeviceObject;
+
+    KeReleaseSpinLock(&Unit->Lock, OldIrql);
+    Srb->SrbStatus = SRB_STATUS_SUCCESS;
+
+    return STATUS_SUCCESS;
+}
+
+
+static
+NTSTATUS
+NTAPI
+StorpDispatchScsi(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp)
+{
+    PSTOR_ADAPTER Adapter;
+    PSTOR_UNIT Unit;
+    PIO_STACK_LOCATION Stack;
+    PSCSI_REQUEST_BLOCK Srb;
+    PIRP NextIrp;
+    PSTOR_REQUEST Request;
+    LIST_ENTRY FlushList;
+    PLIST_ENTRY Entry;
+    KIRQL OldIrql;
+    NTSTATUS Status;
+
+    Adapter = DeviceObject->DeviceExtension;
+    Stack = IoGetCurrentIrpStackLocation(Irp);
+    Srb = Stack->Parameters.Scsi.Srb;
+
+    if (Srb == NULL)
+    {
+        DPRINT1("StorpDispatchScsi() called with Srb = NULL!\n");
+        Status = STATUS_UNSUCCESSFUL;
+        goto done;
+    }
+
+    Unit = StorpGetUnit(Adapter, Srb->PathId, Srb->TargetId, Srb->Lun);
+    if (Unit == NULL)
+    {
+        DPRINT("StorpDispatchScsi() called with an invalid LUN\n");
+        Srb->SrbStatus = SRB_STATUS_NO_DEVICE;
+        Status = STATUS_NO_SUCH_DEVICE;
+        goto done;
+    }
+
+    switch (Srb->Function)
+    {
+        case SRB_FUNCTION_SHUTDOWN:
+        case SRB_FUNCTION_FLUSH:
+            if (Adapter->PortConfig.PortConfiguration.CachesData == FALSE)
+            {
+                Srb->SrbStatus = SRB_STATUS_SUCCESS;
+                Status = STATUS_SUCCESS;
+                break;
+            }
+            /* Fall through to a usual execute operation */
+
+        case SRB_FUNCTION_EXECUTE_SCSI:
+        case SRB_FUNCTION_IO_CONTROL:
+            /* This is the I/O path, and it doesn't take any adapter-wide lock */
+            return StorpQueueRequest(Adapter, Unit, Irp, Srb);
+
+        case SRB_FUNCTION_CLAIM_DEVICE:
+        case SRB_FUNCTION_ATTACH_DEVICE:
+        case SRB_FUNCTION_RELEASE_DEVICE:
+            Status = StorpHandleClaimRelease(Adapter, Unit, Srb);
+            break;
+
+        case SRB_FUNCTION_RELEASE_QUEUE:
+            /* Unfreeze the queue and get it going again */
+            KeAcquireSpinLock(&Unit->Lock, &OldIrql);
+            Unit->Flags &= ~LUN_FROZEN;
+            KeReleaseSpinLock(&Unit->Lock, OldIrql);
+
+            StorpStartNextRequests(Adapter, Unit);
+
+            Srb->SrbStatus = SRB_STATUS_SUCCESS;
+            Status = STATUS_SUCCESS;
+            break;
+
+        case SRB_FUNCTION_FLUSH_QUEUE:
+            InitializeListHead(&FlushList);
+
+            /* Take every waiting request off the queue, then unfreeze it */
+            KeAcquireSpinLock(&Unit->Lock, &OldIrql);
+            while (!IsListEmpty(&Unit->PendingList))
+            {
+                Entry = RemoveHeadList(&Unit->PendingList);
+                InsertTailList(&FlushList, Entry);
+            }
+            Unit->Flags &= ~LUN_FROZEN;
+            KeReleaseSpinLock(&Unit->Lock, OldIrql);
+
+            /* Complete those requests */
+            while (!IsListEmpty(&FlushList))
+            {
+                Entry = RemoveHeadList(&FlushList);
+                Request = CONTAINING_RECORD(Entry, STOR_REQUEST, ListEntry);
+                NextIrp = Request->Irp;
+
+                Request->Srb->SrbStatus = SRB_STATUS_REQUEST_FLUSHED;
+                StorpFreeRequest(Adapter, Request);
+
+                NextIrp->IoStatus.Status = STATUS_UNSUCCESSFUL;
+                IoCompleteRequest(NextIrp, IO_NO_INCREMENT);
+            }
+
+            Srb->SrbStatus = SRB_STATUS_SUCCESS;
+            Status = STATUS_SUCCESS;
+            break;
+
+        default:
+            DPRINT1("SRB function not implemented (Function %lu)\n", Srb->Function);
+            Status = STATUS_NOT_IMPLEMENTED;
+            break;
+    }
+
+done:
+    Irp->IoStatus.Status = Status;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+    return Status;
+}
+
+
+static
+NTSTATUS
+NTAPI
+StorpDispatchPower(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp)
+{
+    PSTOR_ADAPTER Adapter = DeviceObject->DeviceExtension;
+
+    PoStartNextPowerIrp(Irp);
+    IoSkipCurrentIrpStackLocation(Irp);
+    return PoCallDriver(Adapter->LowerDevice, Irp);
+}
+
+
+static
+NTSTATUS
+NTAPI
+StorpDispatchSystemControl(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp)
+{
+    PSTOR_ADAPTER Adapter = DeviceObject->DeviceExtension;
+
+    IoSkipCurrentIrpStackLocation(Irp);
+    return IoCallDriver(Adapter->LowerDevice, Irp);
+}
+
+
+static
+VOID
+NTAPI
+StorpUnload(
+    _In_ PDRIVER_OBJECT DriverObject)
+{
+    PSTOR_DRIVER_EXTENSION DriverExtension;
+
+    DPRINT("StorpUnload(%p)\n", DriverObject);
+
+    DriverExtension = IoGetDriverObjectExtension(DriverObject, (PVOID)StorPortInitialize);
+    if (DriverExtension && DriverExtension->RegistryPath.Buffer)
+        ExFreePoolWithTag(DriverExtension->RegistryPath.Buffer, TAG_STORPORT);
+}
+
+
+/* PUBLIC FUNCTIONS ***********************************************************/
+
+NTSTATUS
+NTAPI
+DriverEntry(
+    _In_ PDRIVER_OBJECT DriverObject,
+    _In_ PUNICODE_STRING RegistryPath)
+{
+    DPRINT("DriverEntry(%p %p)\n", DriverObject, RegistryPath);
+    return STATUS_SUCCESS;
+}
+
+
+/*
+ * @implemented
+ */
+STORPORTAPI
+ULONG
+NTAPI
+StorPortInitialize(
+    _In_ PVOID Argument1,
+    _In_ PVOID Argument2,
+    _In_ PHW_INITIALIZATION_DATA HwInitializationData,
+    _In_opt_ PVOID HwContext)
+{
+    PDRIVER_OBJECT DriverObject = (PDRIVER_OBJECT)Argument1;
+    PUNICODE_STRING RegistryPath = (PUNICODE_STRING)Argument2;
+    PSTOR_DRIVER_EXTENSION DriverExtension;
+    NTSTATUS Status;
+
+    DPRINT("StorPortInitialize(%p %p %p %p)\n",
+           Argument1, Argument2, HwInitializationData, HwContext);
+
+    /* Check the parameters */
+    if ((DriverObject == NULL) ||
+        (RegistryPath == NULL) ||
+        (HwInitializationData == NULL))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (HwInitializationData->HwInitializationDataSize < sizeof(HW_INITIALIZATION_DATA))
+        return STATUS_REVISION_MISMATCH;
+
+    /* Storport miniports have to handle these themselves */
+    if ((HwInitializationData->HwInitialize == NULL) ||
+        (HwInitializationData->HwStartIo == NULL) ||
+        (HwInitializationData->HwFindAdapter == NULL) ||
+        (HwInitializationData->HwResetBus == NULL))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    /* Storport is PnP only, so we only need to remember the miniport once */
+    DriverExtension = IoGetDriverObjectExtension(DriverObject, (PVOID)StorPortInitialize);
+    if (DriverExtension == NULL)
+    {
+        Status = IoAllocateDriverObjectExtension(DriverObject,
+                                                 (PVOID)StorPortInitialize,
+                                                 sizeof(STOR_DRIVER_EXTENSION),
+                                                 (PVOID *)&DriverExtension);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("IoAllocateDriverObjectExtension() failed (Status 0x%08lx)\n", Status);
+            return Status;
+        }
+
+        RtlZeroMemory(DriverExtension, sizeof(STOR_DRIVER_EXTENSION));
+
+        /* Keep the registry path for the miniport parameters */
+        DriverExtension->RegistryPath.Length = 0;
+        DriverExtension->RegistryPath.MaximumLength = RegistryPath->Length + sizeof(UNICODE_NULL);
+        DriverExtension->RegistryPath.Buffer = ExAllocatePoolWithTag(PagedPool,
+                                                                     DriverExtension->RegistryPath.MaximumLength,
+                                                                     TAG_STORPORT);
+        if (DriverExtension->RegistryPath.Buffer)
+            RtlCopyUnicodeString(&DriverExtension->RegistryPath, RegistryPath);
+    }
+
+    /* Copy what the miniport gave us, including HwBuildIo if it knows about it */
+    RtlCopyMemory(&DriverExtension->HwInitData,
+                  HwInitializationData,
+                  min(HwInitializationData->HwInitializationDataSize,
+                      sizeof(STOR_HW_INITIALIZATION_DATA)));
+
+    /* Set the dispatch routines */
+    DriverObject->DriverExtension->AddDevice = StorPortAddDevice;
+    DriverObject->DriverUnload = StorpUnload;
+    DriverObject->MajorFunction[IRP_MJ_CREATE] = StorpCreateClose;
+    DriverObject->MajorFunction[IRP_MJ_CLOSE] = StorpCreateClose;
+    DriverObject->MajorFunction[IRP_MJ_DEVICE_CONTROL] = StorpFdoDeviceControl;
+    DriverObject->MajorFunction[IRP_MJ_SCSI] = StorpDispatchScsi;
+    DriverObject->MajorFunction[IRP_MJ_POWER] = StorpDispatchPower;
+    DriverObject->MajorFunction[IRP_MJ_SYSTEM_CONTROL] = StorpDispatchSystemControl;
+    DriverObject->MajorFunction[IRP_MJ_PNP] = StorpFdoPnp;
+
+    return STATUS_SUCCESS;
+}
+
+/* EOF */
@@ -0,0 +1,43 @@
+@ stdcall StorPortBusy(ptr long)
+@ stdcall StorPortCompleteRequest(ptr long long long long)
+@ stdcall StorPortConvertPhysicalAddressToUlong64(long long)
+@ stdcall StorPortConvertUlong64ToPhysicalAddress(long long)
+@ cdecl StorPortDebugPrint()
+@ stdcall StorPortDeviceBusy(ptr long long long long)
+@ stdcall StorPortDeviceReady(ptr long long long)
+@ stdcall StorPortFreeDeviceBase(ptr ptr)
+@ stdcall StorPortGetBusData(ptr long long long ptr long)
+@ stdcall StorPortGetDeviceBase(ptr long long long long long long)
+@ stdcall StorPortGetLogicalUnit(ptr long long long)
+@ stdcall StorPortGetMSIInfo(ptr long ptr)
+@ stdcall StorPortGetPhysicalAddress(ptr ptr ptr ptr)
+@ stdcall StorPortGetScatterGatherList(ptr ptr)
+@ stdcall StorPortGetSrb(ptr long long long long)
+@ stdcall StorPortGetUncachedExtension(ptr ptr long)
+@ stdcall StorPortGetVirtualAddress(ptr long long)
+@ stdcall StorPortInitialize(ptr ptr ptr ptr)
+@ stdcall StorPortLogError(ptr ptr long long long long long)
+@ stdcall StorPortMoveMemory(ptr ptr long)
+@ cdecl StorPortNotification()
+@ stdcall StorPortPause(ptr long)
+@ stdcall StorPortPauseDevice(ptr long long long long)
+@ stdcall StorPortReadPortUchar(ptr ptr)
+@ stdcall StorPortReadPortUlong(ptr ptr)
+@ stdcall StorPortReadPortUshort(ptr ptr)
+@ stdcall StorPortReadRegisterUchar(ptr ptr)
+@ stdcall StorPortReadRegisterUlong(ptr ptr)
+@ stdcall StorPortReadRegisterUshort(ptr ptr)
+@ stdcall StorPortReady(ptr)
+@ stdcall StorPortResume(ptr)
+@ stdcall StorPortResumeDevice(ptr long long long)
+@ stdcall StorPortSetBusDataByOffset(ptr long long long ptr long long)
+@ stdcall StorPortSetDeviceQueueDepth(ptr long long long long)
+@ stdcall StorPortStallExecution(long)
+@ stdcall StorPortSynchronizeAccess(ptr ptr ptr)
+@ stdcall StorPortValidateRange(ptr long long long long long long)
+@ stdcall StorPortWritePortUchar(ptr ptr long)
+@ stdcall StorPortWritePortUlong(ptr ptr long)
+@ stdcall StorPortWritePortUshort(ptr ptr long)
+@ stdcall StorPortWriteRegisterUchar(ptr ptr long)
+@ stdcall StorPortWriteRegisterUlong(ptr ptr long)
+@ stdcall StorPortWriteRegisterUshort(ptr ptr long)
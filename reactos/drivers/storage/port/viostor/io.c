@@ -0,0 +1,524 @@
+/*
+ * PROJECT:     ReactOS Virtio Block Storport Miniport Driver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        drivers/storage/port/viostor/io.c
+ * PURPOSE:     SCSI translation, submission and completion
+ * PROGRAMMERS: ReactOS Team
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include "viostor.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* FUNCTIONS ******************************************************************/
+
+static
+VOID
+ViostorCompleteRequest(
+    _In_ PVIOSTOR_DEVICE_EXTENSION DevExt,
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _In_ UCHAR SrbStatus)
+{
+    Srb->SrbStatus = SrbStatus;
+    StorPortNotification(RequestComplete, DevExt, Srb);
+}
+
+
+static
+VOID
+ViostorCompleteWithSense(
+    _In_ PVIOSTOR_DEVICE_EXTENSION DevExt,
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _In_ UCHAR SenseKey,
+    _In_ UCHAR AdditionalSenseCode)
+{
+    SENSE_DATA Sense;
+    UCHAR SrbStatus = SRB_STATUS_ERROR;
+
+    Srb->ScsiStatus = SCSISTAT_CHECK_CONDITION;
+
+    if (Srb->SenseInfoBuffer != NULL && Srb->SenseInfoBufferLength != 0 &&
+        !(Srb->SrbFlags & SRB_FLAGS_DISABLE_AUTOSENSE))
+    {
+        RtlZeroMemory(&Sense, sizeof(Sense));
+        Sense.ErrorCode = 0x70;
+        Sense.SenseKey = SenseKey;
+        Sense.AdditionalSenseLength = sizeof(Sense) - 8;
+        Sense.AdditionalSenseCode = AdditionalSenseCode;
+
+        Srb->SenseInfoBufferLength = (UCHAR)min(Srb->SenseInfoBufferLength, sizeof(Sense));
+        RtlCopyMemory(Srb->SenseInfoBuffer, &Sense, Srb->SenseInfoBufferLength);
+        SrbStatus |= SRB_STATUS_AUTOSENSE_VALID;
+    }
+
+    ViostorCompleteRequest(DevExt, Srb, SrbStatus);
+}
+
+
+static
+VOID
+ViostorInquiry(
+    _In_ PVIOSTOR_DEVICE_EXTENSION DevExt,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    INQUIRYDATA Inquiry;
+
+    if (Srb->Cdb[1] & 1)
+    {
+        ViostorCompleteWithSense(DevExt, Srb, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ADSENSE_INVALID_CDB);
+        return;
+    }
+
+    RtlZeroMemory(&Inquiry, sizeof(Inquiry));
+    Inquiry.DeviceType = DIRECT_ACCESS_DEVICE;
+    Inquiry.Versions = 5;
+    Inquiry.ResponseDataFormat = 2;
+    Inquiry.AdditionalLength = INQUIRYDATABUFFERSIZE - 5;
+    Inquiry.CommandQueue = 1;
+    RtlCopyMemory(Inquiry.VendorId, "Virtio  ", sizeof(Inquiry.VendorId));
+    RtlCopyMemory(Inquiry.ProductId, "Block Device    ", sizeof(Inquiry.ProductId));
+    RtlCopyMemory(Inquiry.ProductRevisionLevel, "1.0 ", sizeof(Inquiry.ProductRevisionLevel));
+
+    Srb->DataTransferLength = min(Srb->DataTransferLength, INQUIRYDATABUFFERSIZE);
+    RtlCopyMemory(Srb->DataBuffer, &Inquiry, Srb->DataTransferLength);
+
+    ViostorCompleteRequest(DevExt, Srb, SRB_STATUS_SUCCESS);
+}
+
+
+static
+VOID
+ViostorReadCapacity(
+    _In_ PVIOSTOR_DEVICE_EXTENSION DevExt,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    READ_CAPACITY_DATA Capacity;
+    READ_CAPACITY_DATA_EX CapacityEx;
+    ULONGLONG LastBlock;
+    ULONG LastBlock32, BlockSize;
+
+    LastBlock = DevExt->Capacity / (DevExt->BlockSize / VIRTIO_BLK_SECTOR_SIZE) - 1;
+    BlockSize = DevExt->BlockSize;
+
+    if (Srb->Cdb[0] == SCSIOP_READ_CAPACITY)
+    {
+        if (Srb->DataTransferLength < sizeof(Capacity))
+        {
+            ViostorCompleteRequest(DevExt, Srb, SRB_STATUS_DATA_OVERRUN);
+            return;
+        }
+
+        /* Too big for 32 bits, tell the class driver to use READ CAPACITY (16) */
+        LastBlock32 = (ULONG)min(LastBlock, 0xFFFFFFFF);
+        REVERSE_BYTES(&Capacity.LogicalBlockAddress, &LastBlock32);
+        REVERSE_BYTES(&Capacity.BytesPerBlock, &BlockSize);
+
+        Srb->DataTransferLength = sizeof(Capacity);
+        RtlCopyMemory(Srb->DataBuffer, &Capacity, sizeof(Capacity));
+    }
+    else
+    {
+        /* READ CAPACITY (16) is service action 0x10 of SERVICE ACTION IN (16) */
+        if ((Srb->Cdb[1] & 0x1F) != 0x10)
+        {
+            ViostorCompleteWithSense(DevExt, Srb, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ADSENSE_INVALID_CDB);
+            return;
+        }
+
+        if (Srb->DataTransferLength < sizeof(CapacityEx))
+        {
+            ViostorCompleteRequest(DevExt, Srb, SRB_STATUS_DATA_OVERRUN);
+            return;
+        }
+
+        REVERSE_BYTES_QUAD(&CapacityEx.LogicalBlockAddress, &LastBlock);
+        REVERSE_BYTES(&CapacityEx.BytesPerBlock, &BlockSize);
+
+        Srb->DataTransferLength = sizeof(CapacityEx);
+        RtlCopyMemory(Srb->DataBuffer, &CapacityEx, sizeof(CapacityEx));
+    }
+
+    ViostorCompleteRequest(DevExt, Srb, SRB_STATUS_SUCCESS);
+}
+
+
+static
+VOID
+ViostorModeSense(
+    _In_ PVIOSTOR_DEVICE_EXTENSION DevExt,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    PMODE_PARAMETER_HEADER Header;
+    PMODE_PARAMETER_HEADER10 Header10;
+    ULONG Length;
+
+    /* No mode pages, just a header carrying the write protect bit */
+    if (Srb->Cdb[0] == SCSIOP_MODE_SENSE)
+        Length = sizeof(MODE_PARAMETER_HEADER);
+    else
+        Length = sizeof(MODE_PARAMETER_HEADER10);
+
+    if (Srb->DataTransferLength < Length)
+    {
+        ViostorCompleteRequest(DevExt, Srb, SRB_STATUS_DATA_OVERRUN);
+        return;
+    }
+
+    RtlZeroMemory(Srb->DataBuffer, Length);
+
+    if (Srb->Cdb[0] == SCSIOP_MODE_SENSE)
+    {
+        Header = Srb->DataBuffer;
+        Header->ModeDataLength = sizeof(MODE_PARAMETER_HEADER) - 1;
+        if (DevExt->ReadOnly)
+            Header->DeviceSpecificParameter = MODE_DSP_WRITE_PROTECT;
+    }
+    else
+    {
+        Header10 = Srb->DataBuffer;
+        Header10->ModeDataLength[1] = sizeof(MODE_PARAMETER_HEADER10) - 2;
+        if (DevExt->ReadOnly)
+            Header10->DeviceSpecificParameter = MODE_DSP_WRITE_PROTECT;
+    }
+
+    Srb->DataTransferLength = Length;
+
+    ViostorCompleteRequest(DevExt, Srb, SRB_STATUS_SUCCESS);
+}
+
+
+static
+BOOLEAN
+ViostorBuildReadWrite(
+    _In_ PVIOSTOR_DEVICE_EXTENSION DevExt,
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _Inout_ PVIOSTOR_SRB_EXTENSION SrbExt)
+{
+    PCDB Cdb = (PCDB)Srb->Cdb;
+    PSTOR_SCATTER_GATHER_LIST SgList;
+    ULONGLONG Lba, BlockCount;
+    ULONG Blocks, SectorsPerBlock, i;
+
+    switch (Srb->Cdb[0])
+    {
+        case SCSIOP_READ:
+        case SCSIOP_WRITE:
+            Lba = ((ULONG)Cdb->CDB10.LogicalBlockByte0 << 24) |
+                  ((ULONG)Cdb->CDB10.LogicalBlockByte1 << 16) |
+                  ((ULONG)Cdb->CDB10.LogicalBlockByte2 << 8) |
+                  Cdb->CDB10.LogicalBlockByte3;
+            Blocks = ((ULONG)Cdb->CDB10.TransferBlocksMsb << 8) |
+                     Cdb->CDB10.TransferBlocksLsb;
+            SrbExt->Write = (Srb->Cdb[0] == SCSIOP_WRITE);
+            break;
+
+        default:
+            REVERSE_BYTES_QUAD(&Lba, Cdb->CDB16.LogicalBlock);
+            REVERSE_BYTES(&Blocks, Cdb->CDB16.TransferLength);
+            SrbExt->Write = (Srb->Cdb[0] == SCSIOP_WRITE16);
+            break;
+    }
+
+    SectorsPerBlock = DevExt->BlockSize / VIRTIO_BLK_SECTOR_SIZE;
+    BlockCount = DevExt->Capacity / SectorsPerBlock;
+
+    if (Blocks == 0 || Lba + Blocks > BlockCount ||
+        (ULONGLONG)Blocks * DevExt->BlockSize != Srb->DataTransferLength)
+    {
+        ViostorCompleteWithSense(DevExt, Srb, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ADSENSE_ILLEGAL_BLOCK);
+        return FALSE;
+    }
+
+    if (SrbExt->Write && DevExt->ReadOnly)
+    {
+        ViostorCompleteWithSense(DevExt, Srb, SCSI_SENSE_DATA_PROTECT, SCSI_ADSENSE_WRITE_PROTECT);
+        return FALSE;
+    }
+
+    SgList = StorPortGetScatterGatherList(DevExt, Srb);
+    if (SgList == NULL || SgList->NumberOfElements == 0 ||
+        SgList->NumberOfElements > DevExt->MaxSegments)
+    {
+        DPRINT1("Unusable scatter/gather list for SRB %p\n", Srb);
+        ViostorCompleteRequest(DevExt, Srb, SRB_STATUS_INVALID_REQUEST);
+        return FALSE;
+    }
+
+    /* The header and status buffers are filled in by HwStartIo */
+    for (i = 0; i < SgList->NumberOfElements; i++)
+    {
+        SrbExt->Buffers[i + 1].Address = SgList->List[i].PhysicalAddress.QuadPart;
+        SrbExt->Buffers[i + 1].Length = SgList->List[i].Length;
+    }
+    SrbExt->DataCount = SgList->NumberOfElements;
+
+    SrbExt->Type = SrbExt->Write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    SrbExt->Sector = Lba * SectorsPerBlock;
+
+    return TRUE;
+}
+
+
+static
+BOOLEAN
+ViostorBuildFlush(
+    _In_ PVIOSTOR_DEVICE_EXTENSION DevExt,
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _Inout_ PVIOSTOR_SRB_EXTENSION SrbExt)
+{
+    /* Without a cache to flush, there's nothing to do */
+    if (!DevExt->CanFlush)
+    {
+        ViostorCompleteRequest(DevExt, Srb, SRB_STATUS_SUCCESS);
+        return FALSE;
+    }
+
+    SrbExt->Type = VIRTIO_BLK_T_FLUSH;
+    SrbExt->Sector = 0;
+    SrbExt->DataCount = 0;
+    SrbExt->Write = FALSE;
+
+    return TRUE;
+}
+
+
+BOOLEAN
+NTAPI
+ViostorHwBuildIo(
+    _In_ PVOID DeviceExtension,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    PVIOSTOR_DEVICE_EXTENSION DevExt = DeviceExtension;
+    PVIOSTOR_SRB_EXTENSION SrbExt = Srb->SrbExtension;
+
+    /* Runs on the submitting processor without any lock, so only look at the SRB */
+    SrbExt->DataCount = 0;
+
+    if (Srb->PathId != 0 || Srb->TargetId != 0 || Srb->Lun != 0)
+    {
+        ViostorCompleteRequest(DevExt, Srb, SRB_STATUS_NO_DEVICE);
+        return FALSE;
+    }
+
+    switch (Srb->Function)
+    {
+        case SRB_FUNCTION_EXECUTE_SCSI:
+            break;
+
+        case SRB_FUNCTION_FLUSH:
+        case SRB_FUNCTION_SHUTDOWN:
+            return ViostorBuildFlush(DevExt, Srb, SrbExt);
+
+        case SRB_FUNCTION_RESET_BUS:
+        case SRB_FUNCTION_RESET_DEVICE:
+        case SRB_FUNCTION_RESET_LOGICAL_UNIT:
+            ViostorCompleteRequest(DevExt, Srb, SRB_STATUS_SUCCESS);
+            return FALSE;
+
+        default:
+            ViostorCompleteRequest(DevExt, Srb, SRB_STATUS_INVALID_REQUEST);
+            return FALSE;
+    }
+
+    switch (Srb->Cdb[0])
+    {
+        case SCSIOP_READ:
+        case SCSIOP_WRITE:
+        case SCSIOP_READ16:
+        case SCSIOP_WRITE16:
+            return ViostorBuildReadWrite(DevExt, Srb, SrbExt);
+
+        case SCSIOP_SYNCHRONIZE_CACHE:
+            return ViostorBuildFlush(DevExt, Srb, SrbExt);
+
+        /* Everything below is answered right here */
+        case SCSIOP_INQUIRY:
+            ViostorInquiry(DevExt, Srb);
+            return FALSE;
+
+        case SCSIOP_READ_CAPACITY:
+        case SCSIOP_SERVICE_ACTION_IN16:
+            ViostorReadCapacity(DevExt, Srb);
+            return FALSE;
+
+        case SCSIOP_MODE_SENSE:
+        case SCSIOP_MODE_SENSE10:
+            ViostorModeSense(DevExt, Srb);
+            return FALSE;
+
+        case SCSIOP_TEST_UNIT_READY:
+        case SCSIOP_START_STOP_UNIT:
+        case SCSIOP_MEDIUM_REMOVAL:
+        case SCSIOP_VERIFY:
+        case SCSIOP_RESERVE_UNIT:
+        case SCSIOP_RELEASE_UNIT:
+            Srb->DataTransferLength = 0;
+            ViostorCompleteRequest(DevExt, Srb, SRB_STATUS_SUCCESS);
+            return FALSE;
+
+        default:
+            DPRINT("Unsupported SCSI operation 0x%02x\n", Srb->Cdb[0]);
+            ViostorCompleteWithSense(DevExt, Srb, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ADSENSE_ILLEGAL_COMMAND);
+            return FALSE;
+    }
+}
+
+
+static
+PVIOSTOR_REQUEST
+ViostorAllocateRequest(
+    _In_ PVIOSTOR_QUEUE Queue)
+{
+    USHORT Index, i;
+
+    Index = Queue->NextRequest;
+    for (i = 0; i < Queue->Queue.Size; i++)
+    {
+        if (Queue->Requests[Index].Srb == NULL)
+        {
+            Queue->NextRequest = (Index + 1) % Queue->Queue.Size;
+            return &Queue->Requests[Index];
+        }
+        Index = (Index + 1) % Queue->Queue.Size;
+    }
+
+    return NULL;
+}
+
+
+BOOLEAN
+NTAPI
+ViostorHwStartIo(
+    _In_ PVOID DeviceExtension,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    PVIOSTOR_DEVICE_EXTENSION DevExt = DeviceExtension;
+    PVIOSTOR_SRB_EXTENSION SrbExt = Srb->SrbExtension;
+    PVIOSTOR_QUEUE Queue;
+    PVIOSTOR_REQUEST Request;
+    STOR_LOCK_HANDLE LockHandle;
+    ULONGLONG Physical;
+    ULONG OutCount, InCount;
+    BOOLEAN Added = FALSE, Notify = FALSE;
+
+    /* Stay on this processor's queue */
+    Queue = &DevExt->Queues[KeGetCurrentProcessorNumber() % DevExt->QueueCount];
+
+    /* The interrupt frees descriptors and requests, so add under its lock */
+    StorPortNotification(AcquireSpinLock, DevExt, InterruptLock, NULL, &LockHandle);
+
+    Request = ViostorAllocateRequest(Queue);
+    if (Request != NULL)
+    {
+        Request->Header.Type = SrbExt->Type;
+        Request->Header.Priority = 0;
+        Request->Header.Sector = SrbExt->Sector;
+        Request->Status = 0xFF;
+
+        Physical = Queue->RequestsPhysical + (Request - Queue->Requests) * sizeof(VIOSTOR_REQUEST);
+        SrbExt->Buffers[0].Address = Physical + FIELD_OFFSET(VIOSTOR_REQUEST, Header);
+        SrbExt->Buffers[0].Length = sizeof(VIRTIO_BLK_HEADER);
+        SrbExt->Buffers[SrbExt->DataCount + 1].Address = Physical + FIELD_OFFSET(VIOSTOR_REQUEST, Status);
+        SrbExt->Buffers[SrbExt->DataCount + 1].Length = sizeof(UCHAR);
+
+        /* The device reads the header and written data, and writes the rest */
+        if (SrbExt->Write)
+        {
+            OutCount = 1 + SrbExt->DataCount;
+            InCount = 1;
+        }
+        else
+        {
+            OutCount = 1;
+            InCount = SrbExt->DataCount + 1;
+        }
+
+        Added = VirtioQueueAddBuffers(&Queue->Queue, SrbExt->Buffers, OutCount, InCount, Request);
+        if (Added)
+        {
+            Request->Srb = Srb;
+            Notify = VirtioQueueKickPrepare(&Queue->Queue);
+        }
+    }
+
+    StorPortNotification(ReleaseSpinLock, DevExt, &LockHandle);
+
+    if (!Added)
+    {
+        /* The ring is full, the class driver retries busy requests */
+        ViostorCompleteRequest(DevExt, Srb, SRB_STATUS_BUSY);
+        return TRUE;
+    }
+
+    /* The notification traps to the host, keep it out of the lock */
+    if (Notify)
+        VirtioQueueNotify(&Queue->Queue);
+
+    return TRUE;
+}
+
+
+static
+VOID
+ViostorProcessQueue(
+    _In_ PVIOSTOR_DEVICE_EXTENSION DevExt,
+    _In_ PVIOSTOR_QUEUE Queue)
+{
+    PVIOSTOR_REQUEST Request;
+    PSCSI_REQUEST_BLOCK Srb;
+
+    do
+    {
+        while ((Request = VirtioQueueGetBuffer(&Queue->Queue, NULL)) != NULL)
+        {
+            Srb = Request->Srb;
+            Request->Srb = NULL;
+
+            switch (Request->Status)
+            {
+                case VIRTIO_BLK_S_OK:
+                    ViostorCompleteRequest(DevExt, Srb, SRB_STATUS_SUCCESS);
+                    break;
+
+                case VIRTIO_BLK_S_UNSUPP:
+                    ViostorCompleteWithSense(DevExt, Srb, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ADSENSE_ILLEGAL_COMMAND);
+                    break;
+
+                default:
+                    DPRINT1("Request for SRB %p failed (Status %u)\n", Srb, Request->Status);
+                    ViostorCompleteWithSense(DevExt, Srb, SCSI_SENSE_MEDIUM_ERROR, SCSI_ADSENSE_NO_SENSE);
+                    break;
+            }
+        }
+
+        /* Re-arm, and go around again if more came in meanwhile */
+    } while (VirtioQueueEnableInterrupt(&Queue->Queue, FALSE));
+}
+
+
+BOOLEAN
+NTAPI
+ViostorHwInterrupt(
+    _In_ PVOID DeviceExtension)
+{
+    PVIOSTOR_DEVICE_EXTENSION DevExt = DeviceExtension;
+    UCHAR Isr;
+    ULONG i;
+
+    Isr = VirtioReadIsr(&DevExt->Device);
+    if (Isr == 0)
+        return FALSE;
+
+    if (Isr & VIRTIO_ISR_CONFIG)
+        DPRINT1("Configuration change, capacity may have changed\n");
+
+    for (i = 0; i < DevExt->QueueCount; i++)
+        ViostorProcessQueue(DevExt, &DevExt->Queues[i]);
+
+    return TRUE;
+}
+
+/* EOF */
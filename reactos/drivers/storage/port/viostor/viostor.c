@@ -0,0 +1,286 @@
+/*
+ * PROJECT:     ReactOS Virtio Block Storport Miniport Driver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        drivers/storage/port/viostor/viostor.c
+ * PURPOSE:     Driver entry and device initialization
+ * PROGRAMMERS: ReactOS Team
+ */
+
+/*
+ * With VIRTIO_BLK_F_MQ the device gets one request queue per processor (up
+ * to eight) and HwStartIo submits on the queue of the processor it runs on,
+ * so the host can service them with separate I/O threads. Every request
+ * takes a single ring descriptor when indirect descriptors are available.
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include "viostor.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* FUNCTIONS ******************************************************************/
+
+static
+ULONG
+NTAPI
+ViostorHwFindAdapter(
+    _In_ PVOID DeviceExtension,
+    _In_ PVOID HwContext,
+    _In_ PVOID BusInformation,
+    _In_ PCHAR ArgumentString,
+    _Inout_ PPORT_CONFIGURATION_INFORMATION ConfigInfo,
+    _Out_ PBOOLEAN Again)
+{
+    PVIOSTOR_DEVICE_EXTENSION DevExt = DeviceExtension;
+    PSTOR_PORT_CONFIGURATION_INFORMATION StorConfig;
+    VIRTIO_BLK_CONFIG Config;
+    PACCESS_RANGE Range;
+    PUCHAR IoBase, Memory;
+    PHYSICAL_ADDRESS Physical;
+    ULONG Wanted, QueueMemory, UncachedSize, Length, i;
+    USHORT QueueSizes[VIOSTOR_MAX_QUEUES];
+
+    UNREFERENCED_PARAMETER(HwContext);
+    UNREFERENCED_PARAMETER(BusInformation);
+    UNREFERENCED_PARAMETER(ArgumentString);
+
+    *Again = FALSE;
+
+    /* The legacy register block is BAR0, in I/O space */
+    if (ConfigInfo->NumberOfAccessRanges < 1)
+        return SP_RETURN_NOT_FOUND;
+
+    Range = &(*ConfigInfo->AccessRanges)[0];
+    if (Range->RangeInMemory)
+        return SP_RETURN_NOT_FOUND;
+
+    IoBase = StorPortGetDeviceBase(DevExt,
+                                   ConfigInfo->AdapterInterfaceType,
+                                   ConfigInfo->SystemIoBusNumber,
+                                   Range->RangeStart,
+                                   Range->RangeLength,
+                                   TRUE);
+    if (IoBase == NULL)
+        return SP_RETURN_ERROR;
+
+    VirtioInitialize(&DevExt->Device, IoBase);
+
+    Wanted = VIRTIO_FEATURE(VIRTIO_BLK_F_SEG_MAX) |
+             VIRTIO_FEATURE(VIRTIO_BLK_F_RO) |
+             VIRTIO_FEATURE(VIRTIO_BLK_F_BLK_SIZE) |
+             VIRTIO_FEATURE(VIRTIO_BLK_F_FLUSH) |
+             VIRTIO_FEATURE(VIRTIO_BLK_F_MQ) |
+             VIRTIO_FEATURE(VIRTIO_RING_F_INDIRECT_DESC) |
+             VIRTIO_FEATURE(VIRTIO_RING_F_EVENT_IDX);
+    VirtioNegotiateFeatures(&DevExt->Device, Wanted);
+
+    RtlZeroMemory(&Config, sizeof(Config));
+    VirtioReadConfig(&DevExt->Device, 0, &Config, sizeof(Config));
+
+    DevExt->Capacity = Config.Capacity;
+    DevExt->ReadOnly = VirtioHasFeature(&DevExt->Device, VIRTIO_BLK_F_RO);
+    DevExt->CanFlush = VirtioHasFeature(&DevExt->Device, VIRTIO_BLK_F_FLUSH);
+
+    DevExt->BlockSize = VIRTIO_BLK_SECTOR_SIZE;
+    if (VirtioHasFeature(&DevExt->Device, VIRTIO_BLK_F_BLK_SIZE) &&
+        Config.BlockSize >= VIRTIO_BLK_SECTOR_SIZE &&
+        (Config.BlockSize & (Config.BlockSize - 1)) == 0)
+    {
+        DevExt->BlockSize = Config.BlockSize;
+    }
+
+    /* Without SEG_MAX the device may only take one data segment */
+    DevExt->MaxSegments = 1;
+    if (VirtioHasFeature(&DevExt->Device, VIRTIO_BLK_F_SEG_MAX) && Config.SegMax != 0)
+        DevExt->MaxSegments = min(Config.SegMax, VIOSTOR_MAX_SG);
+
+    DevExt->QueueCount = 1;
+    if (VirtioHasFeature(&DevExt->Device, VIRTIO_BLK_F_MQ) && Config.NumberOfQueues > 1)
+    {
+        DevExt->QueueCount = min(Config.NumberOfQueues, (ULONG)KeNumberProcessors);
+        DevExt->QueueCount = min(DevExt->QueueCount, VIOSTOR_MAX_QUEUES);
+    }
+
+    /* One uncached block for all rings and request headers, every ring page aligned */
+    UncachedSize = 0;
+    for (i = 0; i < DevExt->QueueCount; i++)
+    {
+        QueueSizes[i] = VirtioGetQueueSize(&DevExt->Device, (USHORT)i);
+        if (QueueSizes[i] == 0 || QueueSizes[i] > VIOSTOR_MAX_QUEUE_SIZE)
+        {
+            DPRINT1("Queue %lu has an unusable size %u\n", i, QueueSizes[i]);
+            if (i == 0)
+                goto Fail;
+            DevExt->QueueCount = i;
+            break;
+        }
+
+        QueueMemory = VirtioQueueMemorySize(QueueSizes[i], VIOSTOR_MAX_BUFFERS);
+        UncachedSize += ROUND_TO_PAGES(QueueMemory) +
+                        ROUND_TO_PAGES(QueueSizes[i] * sizeof(VIOSTOR_REQUEST));
+    }
+
+    Memory = StorPortGetUncachedExtension(DevExt, ConfigInfo, UncachedSize);
+    if (Memory == NULL)
+        goto Fail;
+
+    Physical = StorPortGetPhysicalAddress(DevExt, NULL, Memory, &Length);
+    if (Length < UncachedSize || (Physical.QuadPart & (PAGE_SIZE - 1)) != 0)
+    {
+        DPRINT1("Uncached extension is unusable\n");
+        goto Fail;
+    }
+
+    for (i = 0; i < DevExt->QueueCount; i++)
+    {
+        QueueMemory = ROUND_TO_PAGES(VirtioQueueMemorySize(QueueSizes[i], VIOSTOR_MAX_BUFFERS));
+
+        VirtioQueueInitialize(&DevExt->Queues[i].Queue,
+                              &DevExt->Device,
+                              (USHORT)i,
+                              QueueSizes[i],
+                              VIOSTOR_MAX_BUFFERS,
+                              Memory,
+                              Physical);
+        Memory += QueueMemory;
+        Physical.QuadPart += QueueMemory;
+
+        DevExt->Queues[i].Requests = (PVIOSTOR_REQUEST)Memory;
+        DevExt->Queues[i].RequestsPhysical = Physical.QuadPart;
+        DevExt->Queues[i].NextRequest = 0;
+        RtlZeroMemory(Memory, QueueSizes[i] * sizeof(VIOSTOR_REQUEST));
+
+        QueueMemory = ROUND_TO_PAGES(QueueSizes[i] * sizeof(VIOSTOR_REQUEST));
+        Memory += QueueMemory;
+        Physical.QuadPart += QueueMemory;
+    }
+
+    DPRINT("Virtio block: %I64u sectors, block size %lu, %lu queues, %lu segments\n",
+           DevExt->Capacity, DevExt->BlockSize, DevExt->QueueCount, DevExt->MaxSegments);
+
+    ConfigInfo->MaximumTransferLength = max(DevExt->MaxSegments - 1, 1) * PAGE_SIZE;
+    ConfigInfo->NumberOfPhysicalBreaks = DevExt->MaxSegments;
+    ConfigInfo->AlignmentMask = 0x3;
+    ConfigInfo->NumberOfBuses = 1;
+    ConfigInfo->InitiatorBusId[0] = 1;
+    ConfigInfo->MaximumNumberOfTargets = 1;
+    ConfigInfo->MaximumNumberOfLogicalUnits = 1;
+    ConfigInfo->ScatterGather = TRUE;
+    ConfigInfo->Master = TRUE;
+    ConfigInfo->CachesData = DevExt->CanFlush;
+    ConfigInfo->Dma32BitAddresses = TRUE;
+    ConfigInfo->Dma64BitAddresses = SCSI_DMA64_MINIPORT_SUPPORTED;
+    ConfigInfo->TaggedQueuing = TRUE;
+    ConfigInfo->MultipleRequestPerLu = TRUE;
+    ConfigInfo->MapBuffers = STOR_MAP_NON_READ_WRITE_BUFFERS;
+
+    StorConfig = CONTAINING_RECORD(ConfigInfo, STOR_PORT_CONFIGURATION_INFORMATION, PortConfiguration);
+    StorConfig->SynchronizationModel = StorSynchronizeFullDuplex;
+
+    VirtioSetDriverOk(&DevExt->Device);
+
+    return SP_RETURN_FOUND;
+
+Fail:
+    VirtioSetFailed(&DevExt->Device);
+    return SP_RETURN_ERROR;
+}
+
+
+static
+BOOLEAN
+NTAPI
+ViostorHwInitialize(
+    _In_ PVOID DeviceExtension)
+{
+    UNREFERENCED_PARAMETER(DeviceExtension);
+    return TRUE;
+}
+
+
+static
+BOOLEAN
+NTAPI
+ViostorHwResetBus(
+    _In_ PVOID DeviceExtension,
+    _In_ ULONG PathId)
+{
+    /* Requests stay owned by the device until they complete */
+    UNREFERENCED_PARAMETER(DeviceExtension);
+    UNREFERENCED_PARAMETER(PathId);
+    return TRUE;
+}
+
+
+static
+SCSI_ADAPTER_CONTROL_STATUS
+NTAPI
+ViostorHwAdapterControl(
+    _In_ PVOID DeviceExtension,
+    _In_ SCSI_ADAPTER_CONTROL_TYPE ControlType,
+    _In_ PVOID Parameters)
+{
+    PVIOSTOR_DEVICE_EXTENSION DevExt = DeviceExtension;
+    PSCSI_SUPPORTED_CONTROL_TYPE_LIST ControlTypeList;
+    ULONG i;
+
+    switch (ControlType)
+    {
+        case ScsiQuerySupportedControlTypes:
+            ControlTypeList = Parameters;
+            if (ControlTypeList->MaxControlType > ScsiStopAdapter)
+                ControlTypeList->SupportedTypeList[ScsiStopAdapter] = TRUE;
+            ControlTypeList->SupportedTypeList[ScsiQuerySupportedControlTypes] = TRUE;
+            return ScsiAdapterControlSuccess;
+
+        case ScsiStopAdapter:
+            VirtioReset(&DevExt->Device);
+            for (i = 0; i < DevExt->QueueCount; i++)
+                VirtioQueueDelete(&DevExt->Queues[i].Queue);
+            return ScsiAdapterControlSuccess;
+
+        default:
+            return ScsiAdapterControlUnsuccessful;
+    }
+}
+
+
+NTSTATUS
+NTAPI
+DriverEntry(
+    _In_ PDRIVER_OBJECT DriverObject,
+    _In_ PUNICODE_STRING RegistryPath)
+{
+    STOR_HW_INITIALIZATION_DATA InitData;
+
+    DPRINT("Virtio block DriverEntry(%p %p)\n", DriverObject, RegistryPath);
+
+    RtlZeroMemory(&InitData, sizeof(InitData));
+
+    InitData.HwInitializationData.HwInitializationDataSize = sizeof(STOR_HW_INITIALIZATION_DATA);
+    InitData.HwInitializationData.AdapterInterfaceType = PCIBus;
+    InitData.HwInitializationData.HwInitialize = ViostorHwInitialize;
+    InitData.HwInitializationData.HwStartIo = ViostorHwStartIo;
+    InitData.HwInitializationData.HwInterrupt = ViostorHwInterrupt;
+    InitData.HwInitializationData.HwFindAdapter = ViostorHwFindAdapter;
+    InitData.HwInitializationData.HwResetBus = ViostorHwResetBus;
+    InitData.HwInitializationData.HwAdapterControl = ViostorHwAdapterControl;
+    InitData.HwInitializationData.DeviceExtensionSize = sizeof(VIOSTOR_DEVICE_EXTENSION);
+    InitData.HwInitializationData.SrbExtensionSize = sizeof(VIOSTOR_SRB_EXTENSION);
+    InitData.HwInitializationData.NumberOfAccessRanges = 1;
+    InitData.HwInitializationData.MapBuffers = STOR_MAP_NON_READ_WRITE_BUFFERS;
+    InitData.HwInitializationData.NeedPhysicalAddresses = TRUE;
+    InitData.HwInitializationData.TaggedQueuing = TRUE;
+    InitData.HwInitializationData.AutoRequestSense = TRUE;
+    InitData.HwInitializationData.MultipleRequestPerLu = TRUE;
+    InitData.HwBuildIo = ViostorHwBuildIo;
+
+    return StorPortInitialize(DriverObject,
+                              RegistryPath,
+                              &InitData.HwInitializationData,
+                              NULL);
+}
+
+/* EOF */
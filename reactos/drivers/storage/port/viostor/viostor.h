@@ -0,0 +1,129 @@
+/*
+ * PROJECT:     ReactOS Virtio Block Storport Miniport Driver
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        drivers/storage/port/viostor/viostor.h
+ * PURPOSE:     Virtio block definitions and driver structures
+ * PROGRAMMERS: ReactOS Team
+ */
+
+#ifndef _VIOSTOR_PCH_
+#define _VIOSTOR_PCH_
+
+#include <ntddk.h>
+#include <scsi.h>
+#include <storport.h>
+#include <virtio.h>
+
+/* Device features */
+#define VIRTIO_BLK_F_SIZE_MAX       1
+#define VIRTIO_BLK_F_SEG_MAX        2
+#define VIRTIO_BLK_F_RO             5
+#define VIRTIO_BLK_F_BLK_SIZE       6
+#define VIRTIO_BLK_F_FLUSH          9
+#define VIRTIO_BLK_F_MQ             12
+
+/* Device configuration */
+#include <pshpack1.h>
+typedef struct _VIRTIO_BLK_CONFIG
+{
+    ULONGLONG Capacity;     /* in 512 byte sectors */
+    ULONG SizeMax;
+    ULONG SegMax;
+    USHORT Cylinders;
+    UCHAR Heads;
+    UCHAR Sectors;
+    ULONG BlockSize;
+    UCHAR PhysicalBlockExponent;
+    UCHAR AlignmentOffset;
+    USHORT MinIoSize;
+    ULONG OptIoSize;
+    UCHAR Writeback;
+    UCHAR Unused;
+    USHORT NumberOfQueues;
+} VIRTIO_BLK_CONFIG, *PVIRTIO_BLK_CONFIG;
+#include <poppack.h>
+
+C_ASSERT(FIELD_OFFSET(VIRTIO_BLK_CONFIG, NumberOfQueues) == 34);
+
+/* Requests */
+#define VIRTIO_BLK_T_IN             0
+#define VIRTIO_BLK_T_OUT            1
+#define VIRTIO_BLK_T_FLUSH          4
+
+#define VIRTIO_BLK_S_OK             0
+#define VIRTIO_BLK_S_IOERR          1
+#define VIRTIO_BLK_S_UNSUPP         2
+
+#define VIRTIO_BLK_SECTOR_SIZE      512
+
+typedef struct _VIRTIO_BLK_HEADER
+{
+    ULONG Type;
+    ULONG Priority;
+    ULONGLONG Sector;
+} VIRTIO_BLK_HEADER, *PVIRTIO_BLK_HEADER;
+
+/* Driver limits */
+#define VIOSTOR_MAX_QUEUES          8
+#define VIOSTOR_MAX_QUEUE_SIZE      1024
+#define VIOSTOR_MAX_SG              33
+
+/* Header and status around the data */
+#define VIOSTOR_MAX_BUFFERS         (VIOSTOR_MAX_SG + 2)
+
+/* Header and status of a request in flight, in uncached memory */
+typedef struct _VIOSTOR_REQUEST
+{
+    VIRTIO_BLK_HEADER Header;
+    UCHAR Status;
+    UCHAR Reserved[7];
+    PSCSI_REQUEST_BLOCK Srb;
+} VIOSTOR_REQUEST, *PVIOSTOR_REQUEST;
+
+typedef struct _VIOSTOR_QUEUE
+{
+    VIRTQUEUE Queue;
+    PVIOSTOR_REQUEST Requests;
+    ULONGLONG RequestsPhysical;
+    USHORT NextRequest;
+} VIOSTOR_QUEUE, *PVIOSTOR_QUEUE;
+
+typedef struct _VIOSTOR_SRB_EXTENSION
+{
+    ULONG Type;
+    ULONGLONG Sector;
+    ULONG DataCount;
+    BOOLEAN Write;
+    VIRTIO_BUFFER Buffers[VIOSTOR_MAX_BUFFERS];
+} VIOSTOR_SRB_EXTENSION, *PVIOSTOR_SRB_EXTENSION;
+
+typedef struct _VIOSTOR_DEVICE_EXTENSION
+{
+    VIRTIO_DEVICE Device;
+
+    ULONGLONG Capacity;
+    ULONG BlockSize;
+    ULONG MaxSegments;
+    BOOLEAN ReadOnly;
+    BOOLEAN CanFlush;
+
+    ULONG QueueCount;
+    VIOSTOR_QUEUE Queues[VIOSTOR_MAX_QUEUES];
+} VIOSTOR_DEVICE_EXTENSION, *PVIOSTOR_DEVICE_EXTENSION;
+
+/* io.c */
+
+HW_BUILDIO ViostorHwBuildIo;
+
+BOOLEAN
+NTAPI
+ViostorHwStartIo(
+    _In_ PVOID DeviceExtension,
+    _In_ PSCSI_REQUEST_BLOCK Srb);
+
+BOOLEAN
+NTAPI
+ViostorHwInterrupt(
+    _In_ PVOID DeviceExtension);
+
+#endif /* _VIOSTOR_PCH_ */
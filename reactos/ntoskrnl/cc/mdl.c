@@ -28,10 +28,105 @@ CcMdlRead (
     OUT PIO_STATUS_BLOCK IoStatus
     )
 {
+    NTSTATUS Status = STATUS_SUCCESS;
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+    LONGLONG CurrentOffset;
+    ULONG BytesRead = 0;
+    ULONG VacbOffset;
+    ULONG PartialLength;
+    PVOID BaseAddress;
+    BOOLEAN Valid;
+    PROS_VACB Vacb;
+    PMDL Mdl, *NextMdl;
+
     CCTRACE(CC_API_DEBUG, "FileObject=%p FileOffset=%I64d Length=%lu\n",
         FileObject, FileOffset->QuadPart, Length);
 
-    UNIMPLEMENTED;
+    *MdlChain = NULL;
+
+    /* Caching was never initiated on this file, so there is no view to hand out */
+    SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+    if (SharedCacheMap == NULL)
+    {
+        ExRaiseStatus(STATUS_INVALID_PARAMETER);
+    }
+
+    CurrentOffset = FileOffset->QuadPart;
+    NextMdl = MdlChain;
+
+    /* Hand out the pages of one view per MDL */
+    while (Length > 0)
+    {
+        VacbOffset = CurrentOffset % VACB_MAPPING_GRANULARITY;
+        PartialLength = min(Length, VACB_MAPPING_GRANULARITY - VacbOffset);
+
+        Status = CcRosRequestVacb(SharedCacheMap,
+                                  ROUND_DOWN(CurrentOffset,
+                                             VACB_MAPPING_GRANULARITY),
+                                  &BaseAddress,
+                                  &Valid,
+                                  &Vacb);
+        if (!NT_SUCCESS(Status))
+            break;
+
+        if (!Valid)
+        {
+            Status = CcReadVirtualAddress(Vacb);
+            if (!NT_SUCCESS(Status))
+            {
+                CcRosReleaseVacb(SharedCacheMap, Vacb, FALSE, FALSE, FALSE);
+                break;
+            }
+        }
+
+        Mdl = IoAllocateMdl((PUCHAR)BaseAddress + VacbOffset,
+                            PartialLength,
+                            FALSE,
+                            FALSE,
+                            NULL);
+        if (!Mdl)
+        {
+            CcRosReleaseVacb(SharedCacheMap, Vacb, TRUE, FALSE, FALSE);
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        /* The locked pages stay around once the view is let go */
+        _SEH2_TRY
+        {
+            MmProbeAndLockPages(Mdl, KernelMode, IoReadAccess);
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            Status = _SEH2_GetExceptionCode();
+        }
+        _SEH2_END;
+
+        CcRosReleaseVacb(SharedCacheMap, Vacb, TRUE, FALSE, FALSE);
+
+        if (!NT_SUCCESS(Status))
+        {
+            IoFreeMdl(Mdl);
+            break;
+        }
+
+        *NextMdl = Mdl;
+        NextMdl = &Mdl->Next;
+
+        Length -= PartialLength;
+        CurrentOffset += PartialLength;
+        BytesRead += PartialLength;
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        CcMdlReadComplete2(FileObject, *MdlChain);
+        *MdlChain = NULL;
+        ExRaiseStatus(Status);
+    }
+
+    IoStatus->Status = STATUS_SUCCESS;
+    IoStatus->Information = BytesRead;
 }
 
 /*
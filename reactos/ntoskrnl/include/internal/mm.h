@@ -183,8 +183,27 @@ typedef struct _MM_IMAGE_SECTION_OBJECT
     PVOID BasedAddress;
     ULONG NrSegments;
     PMM_SECTION_SEGMENT Segments;
+    PVOID RelocatedBase;            /* base the shared pages are relocated for */
+    PIMAGE_BASE_RELOCATION Relocations;
+    ULONG RelocationRva;
+    ULONG RelocationSize;
+    ULONG ImageBaseOffset;          /* offset of OptionalHeader.ImageBase */
+    ULONG RelocatedPageCount;
 } MM_IMAGE_SECTION_OBJECT, *PMM_IMAGE_SECTION_OBJECT;
 
+/* RelocatedBase value once pages were read unrelocated */
+#define MI_IMAGE_BASE_FROZEN ((PVOID)1)
+
+typedef struct _MM_RELOCATED_IMAGE_STATISTICS
+{
+    ULONG ImagesRelocated;          /* images relocated once in the kernel */
+    ULONG RelocationsAvoided;       /* later mappings that reused the relocated base */
+    ULONG PagesRelocated;           /* shared pages fixed up while being read */
+    ULONG PagesSaved;               /* private copy-on-write pages not needed */
+} MM_RELOCATED_IMAGE_STATISTICS, *PMM_RELOCATED_IMAGE_STATISTICS;
+
+extern MM_RELOCATED_IMAGE_STATISTICS MmRelocatedImageStatistics;
+
 typedef struct _ROS_SECTION_OBJECT
 {
     CSHORT Type;
@@ -66,6 +66,38 @@
 
 extern MMSESSION MmSession;
 
+MM_RELOCATED_IMAGE_STATISTICS MmRelocatedImageStatistics;
+
+/* Relocation tables larger than this are left to the user-mode loader */
+#define MI_MAX_IMAGE_RELOCATION_SIZE (256 * 1024)
+
+#define TAG_MM_RELOCATIONS 'lRmM'
+
+static
+VOID
+NTAPI
+MiFreeImageRelocations(IN PMM_IMAGE_SECTION_OBJECT ImageSectionObject);
+
+static
+BOOLEAN
+NTAPI
+MiImagePageNeedsRelocation(IN PMM_IMAGE_SECTION_OBJECT ImageSectionObject,
+                           IN ULONG_PTR PageRva);
+
+static
+VOID
+NTAPI
+MiRelocateImagePage(IN PMM_IMAGE_SECTION_OBJECT ImageSectionObject,
+                    IN ULONG_PTR PageRva,
+                    IN PVOID PageAddress,
+                    IN PVOID RelocatedBase);
+
+static
+BOOLEAN
+NTAPI
+MiRelocateImageSection(IN PMM_IMAGE_SECTION_OBJECT ImageSectionObject,
+                       IN PVOID ImageBase);
+
 NTSTATUS
 NTAPI
 MiMapViewInSystemSpace(IN PVOID Section,
@@ -824,6 +856,7 @@ MmFreeSectionSegments(PFILE_OBJECT FileObject)
             MmFreePageTablesSectionSegment(&SectionSegments[i], NULL);
         }
         ExFreePool(ImageSectionObject->Segments);
+        MiFreeImageRelocations(ImageSectionObject);
         ExFreePool(ImageSectionObject);
         FileObject->SectionObjectPointer->ImageSectionObject = NULL;
     }
@@ -1086,6 +1119,9 @@ MiReadPage(PMEMORY_AREA MemoryArea,
     PROS_SHARED_CACHE_MAP SharedCacheMap;
     BOOLEAN IsImageSection;
     LONGLONG Length;
+    PMM_IMAGE_SECTION_OBJECT ImageSectionObject = NULL;
+    PVOID RelocatedBase = NULL;
+    ULONG_PTR PageRva = 0;
 
     FileObject = MemoryArea->Data.SectionData.Section->FileObject;
     SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
@@ -1095,6 +1131,27 @@ MiReadPage(PMEMORY_AREA MemoryArea,
 
     ASSERT(SharedCacheMap);
 
+    if (IsImageSection)
+    {
+        /*
+         * Once a page is read, the image can no longer be relocated in the
+         * kernel. Otherwise it already was, and this page may need fixups.
+         */
+        ImageSectionObject = MemoryArea->Data.SectionData.Section->ImageSection;
+        RelocatedBase = InterlockedCompareExchangePointer(&ImageSectionObject->RelocatedBase,
+                                                          MI_IMAGE_BASE_FROZEN,
+                                                          NULL);
+        if (RelocatedBase == MI_IMAGE_BASE_FROZEN) RelocatedBase = NULL;
+
+        if (RelocatedBase)
+        {
+            PageRva = MemoryArea->Data.SectionData.Segment->Image.VirtualAddress +
+                      (ULONG_PTR)SegOffset;
+            if (!MiImagePageNeedsRelocation(ImageSectionObject, PageRva))
+                RelocatedBase = NULL;
+        }
+    }
+
     DPRINT("%S %I64x\n", FileObject->FileName.Buffer, FileOffset);
 
     /*
@@ -1104,7 +1161,8 @@ MiReadPage(PMEMORY_AREA MemoryArea,
      */
     if (((FileOffset % PAGE_SIZE) == 0) &&
             ((SegOffset + PAGE_SIZE <= RawLength) || !IsImageSection) &&
-            !(MemoryArea->Data.SectionData.Segment->Image.Characteristics & IMAGE_SCN_MEM_SHARED))
+            !(MemoryArea->Data.SectionData.Segment->Image.Characteristics & IMAGE_SCN_MEM_SHARED) &&
+            !(RelocatedBase))
     {
 
         /*
@@ -1239,6 +1297,13 @@ MiReadPage(PMEMORY_AREA MemoryArea,
                 memcpy((char*)PageAddr + VacbOffset, BaseAddress, PAGE_SIZE - VacbOffset);
             }
         }
+
+        /* Fix the page up for the base this image is shared at */
+        if (RelocatedBase)
+        {
+            MiRelocateImagePage(ImageSectionObject, PageRva, PageAddr, RelocatedBase);
+        }
+
         MiUnmapPageInHyperSpace(Process, PageAddr, Irql);
         CcRosReleaseVacb(SharedCacheMap, Vacb, TRUE, FALSE, FALSE);
     }
@@ -3614,6 +3679,309 @@ MmspPageAlignSegments
     return TRUE;
 }
 
+static
+VOID
+NTAPI
+MiCaptureImageRelocationInfo(IN PVOID FileHeader,
+                             IN ULONG FileHeaderSize,
+                             IN OUT PMM_IMAGE_SECTION_OBJECT ImageSectionObject)
+{
+    PIMAGE_DOS_HEADER DosHeader = FileHeader;
+    PIMAGE_NT_HEADERS NtHeader;
+    PIMAGE_DATA_DIRECTORY RelocDirectory;
+    ULONG ImageBaseOffset;
+
+    /* Only DLLs get relocated by the kernel, executables load at their base */
+    if (!(ImageSectionObject->ImageInformation.ImageCharacteristics & IMAGE_FILE_DLL))
+        return;
+
+    /* The loader already validated the headers, only check what we need */
+    if ((DosHeader->e_lfanew <= 0) ||
+        (FileHeaderSize < sizeof(IMAGE_NT_HEADERS)) ||
+        ((ULONG)DosHeader->e_lfanew > FileHeaderSize - sizeof(IMAGE_NT_HEADERS)))
+    {
+        return;
+    }
+
+    /* Native images with page-sized sections only, so segments map 1:1 */
+    NtHeader = (PIMAGE_NT_HEADERS)((ULONG_PTR)FileHeader + DosHeader->e_lfanew);
+    if ((NtHeader->OptionalHeader.Magic != IMAGE_NT_OPTIONAL_HDR_MAGIC) ||
+        (NtHeader->OptionalHeader.SectionAlignment < PAGE_SIZE) ||
+        (NtHeader->FileHeader.Characteristics & IMAGE_FILE_RELOCS_STRIPPED) ||
+        (NtHeader->OptionalHeader.NumberOfRvaAndSizes <= IMAGE_DIRECTORY_ENTRY_BASERELOC))
+    {
+        return;
+    }
+
+    /* The header page gets its ImageBase patched, which must fit in it */
+    ImageBaseOffset = DosHeader->e_lfanew +
+                      FIELD_OFFSET(IMAGE_NT_HEADERS, OptionalHeader.ImageBase);
+    if (ImageBaseOffset > PAGE_SIZE - sizeof(ULONG_PTR))
+        return;
+
+    RelocDirectory = &NtHeader->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
+    if (!(RelocDirectory->VirtualAddress) ||
+        !(RelocDirectory->Size) ||
+        (RelocDirectory->Size > MI_MAX_IMAGE_RELOCATION_SIZE))
+    {
+        return;
+    }
+
+    ImageSectionObject->RelocationRva = RelocDirectory->VirtualAddress;
+    ImageSectionObject->RelocationSize = RelocDirectory->Size;
+    ImageSectionObject->ImageBaseOffset = ImageBaseOffset;
+}
+
+static
+BOOLEAN
+NTAPI
+MiValidateImageRelocations(IN PMM_IMAGE_SECTION_OBJECT ImageSectionObject)
+{
+    PIMAGE_BASE_RELOCATION Block;
+    ULONG Remaining, Count, i;
+    PUSHORT TypeOffset;
+    USHORT Offset;
+
+    /*
+     * Pages are fixed up one at a time as they are read in, so every fixup
+     * has to be of a known type and lie entirely within its page.
+     */
+    Block = ImageSectionObject->Relocations;
+    Remaining = ImageSectionObject->RelocationSize;
+    ImageSectionObject->RelocatedPageCount = 0;
+    while (Remaining >= sizeof(IMAGE_BASE_RELOCATION))
+    {
+        /* A zero-sized block terminates some tables */
+        if (!Block->SizeOfBlock) break;
+
+        if ((Block->SizeOfBlock < sizeof(IMAGE_BASE_RELOCATION)) ||
+            (Block->SizeOfBlock > Remaining) ||
+            (Block->SizeOfBlock % sizeof(USHORT)) ||
+            (Block->VirtualAddress % PAGE_SIZE))
+        {
+            return FALSE;
+        }
+
+        Count = (Block->SizeOfBlock - sizeof(IMAGE_BASE_RELOCATION)) / sizeof(USHORT);
+        TypeOffset = (PUSHORT)(Block + 1);
+        for (i = 0; i < Count; i++)
+        {
+            Offset = TypeOffset[i] & 0xFFF;
+            switch (TypeOffset[i] >> 12)
+            {
+                case IMAGE_REL_BASED_ABSOLUTE:
+                    break;
+
+                case IMAGE_REL_BASED_HIGH:
+                case IMAGE_REL_BASED_LOW:
+                    if (Offset > PAGE_SIZE - sizeof(USHORT)) return FALSE;
+                    break;
+
+                case IMAGE_REL_BASED_HIGHLOW:
+                    if (Offset > PAGE_SIZE - sizeof(ULONG)) return FALSE;
+                    break;
+
+                case IMAGE_REL_BASED_DIR64:
+                    if (Offset > PAGE_SIZE - sizeof(ULONGLONG)) return FALSE;
+                    break;
+
+                default:
+                    return FALSE;
+            }
+        }
+
+        ImageSectionObject->RelocatedPageCount++;
+        Remaining -= Block->SizeOfBlock;
+        Block = (PIMAGE_BASE_RELOCATION)((ULONG_PTR)Block + Block->SizeOfBlock);
+    }
+
+    /* The header page is always patched as well */
+    ImageSectionObject->RelocatedPageCount++;
+    return TRUE;
+}
+
+static
+VOID
+NTAPI
+MiLoadImageRelocations(IN PFILE_OBJECT FileObject,
+                       IN OUT PMM_IMAGE_SECTION_OBJECT ImageSectionObject)
+{
+#ifndef NEWCC
+    PMM_SECTION_SEGMENT Segment = NULL;
+    LARGE_INTEGER Offset;
+    PVOID Data, AllocBase;
+    ULONG ReadSize, Rva, i;
+    NTSTATUS Status;
+
+    /* Assume the image will only ever be used at its preferred base */
+    ImageSectionObject->RelocatedBase = MI_IMAGE_BASE_FROZEN;
+    Rva = ImageSectionObject->RelocationRva;
+    if (!ImageSectionObject->RelocationSize) return;
+
+    /* Find the file data backing the relocation directory */
+    for (i = 0; i < ImageSectionObject->NrSegments; i++)
+    {
+        Segment = &ImageSectionObject->Segments[i];
+        if ((Rva >= Segment->Image.VirtualAddress) &&
+            (Rva + ImageSectionObject->RelocationSize <=
+             Segment->Image.VirtualAddress + Segment->RawLength.QuadPart))
+        {
+            break;
+        }
+    }
+    if (i == ImageSectionObject->NrSegments) return;
+
+    /* Read it in */
+    Offset.QuadPart = Segment->Image.FileOffset + (Rva - Segment->Image.VirtualAddress);
+    Status = ExeFmtpReadFile(FileObject,
+                             &Offset,
+                             ImageSectionObject->RelocationSize,
+                             &Data,
+                             &AllocBase,
+                             &ReadSize);
+    if (!NT_SUCCESS(Status)) return;
+
+    /* Keep a non-paged copy, it is consulted from the page fault path */
+    if (ReadSize >= ImageSectionObject->RelocationSize)
+    {
+        ImageSectionObject->Relocations = ExAllocatePoolWithTag(NonPagedPool,
+                                                                ImageSectionObject->RelocationSize,
+                                                                TAG_MM_RELOCATIONS);
+        if (ImageSectionObject->Relocations)
+        {
+            RtlCopyMemory(ImageSectionObject->Relocations,
+                          Data,
+                          ImageSectionObject->RelocationSize);
+        }
+    }
+    ExFreePoolWithTag(AllocBase, 'rXmM');
+
+    if (!ImageSectionObject->Relocations) return;
+
+    /* Drop tables we can't apply page by page */
+    if (!MiValidateImageRelocations(ImageSectionObject))
+    {
+        MiFreeImageRelocations(ImageSectionObject);
+        return;
+    }
+
+    /* No page was read yet, so the base is still open */
+    ImageSectionObject->RelocatedBase = NULL;
+#else
+    UNREFERENCED_PARAMETER(FileObject);
+    ImageSectionObject->RelocatedBase = MI_IMAGE_BASE_FROZEN;
+#endif
+}
+
+static
+VOID
+NTAPI
+MiFreeImageRelocations(IN PMM_IMAGE_SECTION_OBJECT ImageSectionObject)
+{
+    if (ImageSectionObject->Relocations)
+    {
+        ExFreePoolWithTag(ImageSectionObject->Relocations, TAG_MM_RELOCATIONS);
+        ImageSectionObject->Relocations = NULL;
+    }
+}
+
+static
+BOOLEAN
+NTAPI
+MiImagePageNeedsRelocation(IN PMM_IMAGE_SECTION_OBJECT ImageSectionObject,
+                           IN ULONG_PTR PageRva)
+{
+    PIMAGE_BASE_RELOCATION Block;
+    ULONG Remaining;
+
+    /* The header page carries the ImageBase field */
+    if (!PageRva) return TRUE;
+
+    /* Look for a block covering this page */
+    Block = ImageSectionObject->Relocations;
+    Remaining = ImageSectionObject->RelocationSize;
+    while ((Remaining >= sizeof(IMAGE_BASE_RELOCATION)) && (Block->SizeOfBlock))
+    {
+        if (Block->VirtualAddress == PageRva) return TRUE;
+
+        Remaining -= Block->SizeOfBlock;
+        Block = (PIMAGE_BASE_RELOCATION)((ULONG_PTR)Block + Block->SizeOfBlock);
+    }
+
+    return FALSE;
+}
+
+static
+VOID
+NTAPI
+MiRelocateImagePage(IN PMM_IMAGE_SECTION_OBJECT ImageSectionObject,
+                    IN ULONG_PTR PageRva,
+                    IN PVOID PageAddress,
+                    IN PVOID RelocatedBase)
+{
+    PIMAGE_BASE_RELOCATION Block;
+    ULONG Remaining;
+    LONGLONG Delta;
+
+    Delta = (ULONG_PTR)RelocatedBase - (ULONG_PTR)ImageSectionObject->BasedAddress;
+
+    /*
+     * Make the headers describe the new base, so the user-mode loader sees
+     * a relocated image and a process that can't use this base relocates
+     * from here.
+     */
+    if (!PageRva)
+    {
+        *(PULONG_PTR)((ULONG_PTR)PageAddress + ImageSectionObject->ImageBaseOffset) =
+            (ULONG_PTR)RelocatedBase;
+    }
+
+    /* Apply the fixups of this page; they were validated to stay within it */
+    Block = ImageSectionObject->Relocations;
+    Remaining = ImageSectionObject->RelocationSize;
+    while ((Remaining >= sizeof(IMAGE_BASE_RELOCATION)) && (Block->SizeOfBlock))
+    {
+        if (Block->VirtualAddress == PageRva)
+        {
+            LdrProcessRelocationBlockLongLong((ULONG_PTR)PageAddress,
+                                              (Block->SizeOfBlock -
+                                               sizeof(IMAGE_BASE_RELOCATION)) / sizeof(USHORT),
+                                              (PUSHORT)(Block + 1),
+                                              Delta);
+        }
+
+        Remaining -= Block->SizeOfBlock;
+        Block = (PIMAGE_BASE_RELOCATION)((ULONG_PTR)Block + Block->SizeOfBlock);
+    }
+
+    InterlockedIncrementUL(&MmRelocatedImageStatistics.PagesRelocated);
+}
+
+static
+BOOLEAN
+NTAPI
+MiRelocateImageSection(IN PMM_IMAGE_SECTION_OBJECT ImageSectionObject,
+                       IN PVOID ImageBase)
+{
+    /* The first mapping away from the preferred base, before any page was read, wins */
+    if (InterlockedCompareExchangePointer(&ImageSectionObject->RelocatedBase,
+                                          ImageBase,
+                                          NULL) != NULL)
+    {
+        return FALSE;
+    }
+
+    /*
+     * TransferAddress stays relative to the preferred base: views of the
+     * section may still sit at different bases, and the loader takes the
+     * entry point from the header of its own view anyway.
+     */
+    InterlockedIncrementUL(&MmRelocatedImageStatistics.ImagesRelocated);
+    DPRINT("Image section %p relocated from %p to %p\n",
+           ImageSectionObject, ImageSectionObject->BasedAddress, ImageBase);
+    return TRUE;
+}
+
 NTSTATUS
 ExeFmtpCreateImageSection(PFILE_OBJECT FileObject,
                           PMM_IMAGE_SECTION_OBJECT ImageSectionObject)
@@ -3678,6 +4046,14 @@ ExeFmtpCreateImageSection(PFILE_OBJECT FileObject,
             break;
     }
 
+    /* Remember where the relocations are, while the headers are at hand */
+    if (NT_SUCCESS(Status))
+    {
+        MiCaptureImageRelocationInfo(FileHeader,
+                                     FileHeaderSize,
+                                     ImageSectionObject);
+    }
+
     ExFreePoolWithTag(FileHeaderBuffer, 'rXmM');
 
     /*
@@ -3757,6 +4133,9 @@ ExeFmtpCreateImageSection(PFILE_OBJECT FileObject,
         MiInitializeSectionPageTable(&ImageSectionObject->Segments[i]);
     }
 
+    /* Allow the image to be relocated once and shared at its new base */
+    MiLoadImageRelocations(FileObject, ImageSectionObject);
+
     ASSERT(NT_SUCCESS(Status));
     return Status;
 }
@@ -3861,6 +4240,7 @@ MmCreateImageSection(PROS_SECTION_OBJECT *SectionObject,
         if (!NT_SUCCESS(Status))
         {
             ExFreePool(ImageSectionObject->Segments);
+            MiFreeImageRelocations(ImageSectionObject);
             ExFreePool(ImageSectionObject);
             ObDereferenceObject(Section);
             ObDereferenceObject(FileObject);
@@ -3874,6 +4254,7 @@ MmCreateImageSection(PROS_SECTION_OBJECT *SectionObject,
              * An other thread has initialized the same image in the background
              */
             ExFreePool(ImageSectionObject->Segments);
+            MiFreeImageRelocations(ImageSectionObject);
             ExFreePool(ImageSectionObject);
             ImageSectionObject = FileObject->SectionObjectPointer->ImageSectionObject;
             Section->ImageSection = ImageSectionObject;
@@ -4592,6 +4973,8 @@ MmMapViewOfSection(IN PVOID SectionObject,
         SIZE_T ImageSize;
         PMM_IMAGE_SECTION_OBJECT ImageSectionObject;
         PMM_SECTION_SEGMENT SectionSegments;
+        PVOID RelocatedBase;
+        BOOLEAN Relocated = FALSE;
 
         ImageSectionObject = Section->ImageSection;
         SectionSegments = ImageSectionObject->Segments;
@@ -4600,7 +4983,12 @@ MmMapViewOfSection(IN PVOID SectionObject,
         ImageBase = (ULONG_PTR)*BaseAddress;
         if (ImageBase == 0)
         {
-            ImageBase = (ULONG_PTR)ImageSectionObject->BasedAddress;
+            /* Prefer the base the image was already relocated for, if any */
+            RelocatedBase = ImageSectionObject->RelocatedBase;
+            if ((RelocatedBase) && (RelocatedBase != MI_IMAGE_BASE_FROZEN))
+                ImageBase = (ULONG_PTR)RelocatedBase;
+            else
+                ImageBase = (ULONG_PTR)ImageSectionObject->BasedAddress;
         }
 
         ImageSize = 0;
@@ -4672,6 +5060,46 @@ MmMapViewOfSection(IN PVOID SectionObject,
             }
         }
 
+        if ((PVOID)ImageBase != ImageSectionObject->BasedAddress)
+        {
+            /* Relocate the shared pages for this base, if no page was read yet */
+            if (ImageSectionObject->Relocations)
+                Relocated = MiRelocateImageSection(ImageSectionObject, (PVOID)ImageBase);
+        }
+        else
+        {
+            /*
+             * This view relies on the pages as they are in the file. Freeze
+             * the section before any of them is read, so another process
+             * can no longer relocate them for its own base.
+             */
+            InterlockedCompareExchangePointer(&ImageSectionObject->RelocatedBase,
+                                              MI_IMAGE_BASE_FROZEN,
+                                              NULL);
+        }
+
+        RelocatedBase = ImageSectionObject->RelocatedBase;
+        if (((PVOID)ImageBase == RelocatedBase) && !Relocated)
+        {
+            /* A later view sharing the relocated pages, ntdll will find nothing left to fix up */
+            InterlockedIncrementUL(&MmRelocatedImageStatistics.RelocationsAvoided);
+            InterlockedExchangeAddUL(&MmRelocatedImageStatistics.PagesSaved,
+                                     ImageSectionObject->RelocatedPageCount);
+        }
+
+        /*
+         * Still report the move, so the loader knows bindings are stale. A
+         * view at the preferred base of pages relocated elsewhere has to be
+         * fixed up by the loader too, from the base named in the header.
+         */
+        if (((PVOID)ImageBase != ImageSectionObject->BasedAddress) ||
+            ((RelocatedBase != NULL) &&
+             (RelocatedBase != MI_IMAGE_BASE_FROZEN) &&
+             (RelocatedBase != (PVOID)ImageBase)))
+        {
+            NotAtBase = TRUE;
+        }
+
         *BaseAddress = (PVOID)ImageBase;
         *ViewSize = ImageSize;
     }
@@ -5166,4 +5594,23 @@ MmCreateSection (OUT PVOID  * Section,
     return Status;
 }
 
+#if DBG && defined(KDBG)
+
+BOOLEAN
+MiKdbgExtImageRelocations(
+    ULONG Argc,
+    PCHAR Argv[])
+{
+    UNREFERENCED_PARAMETER(Argc);
+    UNREFERENCED_PARAMETER(Argv);
+
+    KdbpPrint("Images relocated once:   %lu\n", MmRelocatedImageStatistics.ImagesRelocated);
+    KdbpPrint("Relocations avoided:     %lu\n", MmRelocatedImageStatistics.RelocationsAvoided);
+    KdbpPrint("Shared pages relocated:  %lu\n", MmRelocatedImageStatistics.PagesRelocated);
+    KdbpPrint("Private pages saved:     %lu\n", MmRelocatedImageStatistics.PagesSaved);
+    return TRUE;
+}
+
+#endif // DBG && KDBG
+
 /* EOF */
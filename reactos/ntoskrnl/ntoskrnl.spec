@@ -361,6 +361,7 @@
 @ stdcall IoCheckQuotaBufferValidity(ptr long ptr)
 @ stdcall IoCheckShareAccess(long long ptr ptr long)
 @ stdcall IoCompleteRequest(ptr long)
+@ extern IoCompletionObjectType IoCompletionType
 @ stdcall IoConnectInterrupt(ptr ptr ptr ptr long long long long long long long)
 @ stdcall IoCreateController(long)
 @ stdcall IoCreateDevice(ptr long ptr long long long ptr)
@@ -49,6 +49,99 @@ typedef struct _STOR_SCATTER_GATHER_LIST {
   STOR_SCATTER_GATHER_ELEMENT List[0];
 } STOR_SCATTER_GATHER_LIST, *PSTOR_SCATTER_GATHER_LIST;
 
+typedef enum _STOR_SYNCHRONIZATION_MODEL {
+  StorSynchronizeHalfDuplex,
+  StorSynchronizeFullDuplex
+} STOR_SYNCHRONIZATION_MODEL;
+
+typedef enum _INTERRUPT_SYNCHRONIZATION_MODE {
+  InterruptSupportNone,
+  InterruptSynchronizeAll,
+  InterruptSynchronizePerMessage
+} INTERRUPT_SYNCHRONIZATION_MODE;
+
+/* Values for PORT_CONFIGURATION_INFORMATION.MapBuffers */
+#define STOR_MAP_NO_BUFFERS             0
+#define STOR_MAP_ALL_BUFFERS            1
+#define STOR_MAP_NON_READ_WRITE_BUFFERS 2
+
+#define STOR_STATUS_SUCCESS             0x00000000L
+#define STOR_STATUS_UNSUCCESSFUL        0xC1000001L
+#define STOR_STATUS_INVALID_PARAMETER   0xC1000006L
+
+typedef struct _MESSAGE_INTERRUPT_INFORMATION {
+  ULONG MessageId;
+  ULONG MessageData;
+  STOR_PHYSICAL_ADDRESS MessageAddress;
+  ULONG InterruptVector;
+  ULONG InterruptLevel;
+  KINTERRUPT_MODE InterruptMode;
+} MESSAGE_INTERRUPT_INFORMATION, *PMESSAGE_INTERRUPT_INFORMATION;
+
+typedef enum _STOR_SPINLOCK {
+  DpcLock = 1,
+  StartIoLock,
+  InterruptLock
+} STOR_SPINLOCK;
+
+#define EnablePassiveInitialization   ((SCSI_NOTIFICATION_TYPE)0x1000)
+#define InitializeDpc                 ((SCSI_NOTIFICATION_TYPE)0x1001)
+#define IssueDpc                      ((SCSI_NOTIFICATION_TYPE)0x1002)
+#define AcquireSpinLock               ((SCSI_NOTIFICATION_TYPE)0x1003)
+#define ReleaseSpinLock               ((SCSI_NOTIFICATION_TYPE)0x1004)
+
+typedef struct _STOR_DPC {
+  KDPC Dpc;
+  KSPIN_LOCK Lock;
+} STOR_DPC, *PSTOR_DPC;
+
+typedef struct _STOR_LOCK_HANDLE {
+  STOR_SPINLOCK Lock;
+  struct {
+    PVOID Context;
+    KIRQL OldIrql;
+  } Context;
+} STOR_LOCK_HANDLE, *PSTOR_LOCK_HANDLE;
+
+typedef BOOLEAN
+(NTAPI HW_BUILDIO)(
+  _In_ PVOID DeviceExtension,
+  _In_ PSCSI_REQUEST_BLOCK Srb);
+typedef HW_BUILDIO *PHW_BUILDIO;
+
+typedef BOOLEAN
+(NTAPI HW_PASSIVE_INITIALIZE_ROUTINE)(
+  _In_ PVOID DeviceExtension);
+typedef HW_PASSIVE_INITIALIZE_ROUTINE *PHW_PASSIVE_INITIALIZE_ROUTINE;
+
+typedef BOOLEAN
+(NTAPI HW_MESSAGE_SIGNALED_INTERRUPT_ROUTINE)(
+  _In_ PVOID HwDeviceExtension,
+  _In_ ULONG MessageId);
+typedef HW_MESSAGE_SIGNALED_INTERRUPT_ROUTINE *PHW_MESSAGE_SIGNALED_INTERRUPT_ROUTINE;
+
+typedef VOID
+(NTAPI HW_DPC_ROUTINE)(
+  _In_ PSTOR_DPC Dpc,
+  _In_ PVOID HwDeviceExtension,
+  _In_ PVOID SystemArgument1,
+  _In_ PVOID SystemArgument2);
+typedef HW_DPC_ROUTINE *PHW_DPC_ROUTINE;
+
+/* HW_INITIALIZATION_DATA followed by the Storport-only entry points */
+typedef struct _STOR_HW_INITIALIZATION_DATA {
+  HW_INITIALIZATION_DATA HwInitializationData;
+  PHW_BUILDIO HwBuildIo;
+} STOR_HW_INITIALIZATION_DATA, *PSTOR_HW_INITIALIZATION_DATA;
+
+/* PORT_CONFIGURATION_INFORMATION followed by the Storport-only fields */
+typedef struct _STOR_PORT_CONFIGURATION_INFORMATION {
+  PORT_CONFIGURATION_INFORMATION PortConfiguration;
+  STOR_SYNCHRONIZATION_MODEL SynchronizationModel;
+  PHW_MESSAGE_SIGNALED_INTERRUPT_ROUTINE HwMSInterruptRoutine;
+  INTERRUPT_SYNCHRONIZATION_MODE InterruptSynchronizationMode;
+} STOR_PORT_CONFIGURATION_INFORMATION, *PSTOR_PORT_CONFIGURATION_INFORMATION;
+
 typedef struct _SCSI_WMI_REQUEST_BLOCK {
   USHORT Length;
   UCHAR Function;
@@ -401,6 +494,24 @@ StorPortGetScatterGatherList(
   _In_ PVOID DeviceExtension,
   _In_ PSCSI_REQUEST_BLOCK Srb);
 
+STORPORTAPI
+BOOLEAN
+NTAPI
+StorPortSetDeviceQueueDepth(
+  _In_ PVOID HwDeviceExtension,
+  _In_ UCHAR PathId,
+  _In_ UCHAR TargetId,
+  _In_ UCHAR Lun,
+  _In_ ULONG Depth);
+
+STORPORTAPI
+ULONG
+NTAPI
+StorPortGetMSIInfo(
+  _In_ PVOID HwDeviceExtension,
+  _In_ ULONG MessageId,
+  _Out_ PMESSAGE_INTERRUPT_INFORMATION InterruptInfo);
+
 typedef BOOLEAN
 (NTAPI STOR_SYNCHRONIZED_ACCESS)(
   _In_ PVOID HwDeviceExtension,
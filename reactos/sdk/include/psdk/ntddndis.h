@@ -318,6 +318,12 @@ typedef ULONG NDIS_OID, *PNDIS_OID;
 #define OID_802_11_WEP_STATUS                   0x0D01011B
 #define OID_802_11_RELOAD_DEFAULTS              0x0D01011C
 
+/* TCP/IP task offload OIDs */
+#define OID_TCP_TASK_OFFLOAD              0xFC010201
+#define OID_TCP_TASK_IPSEC_ADD_SA         0xFC010202
+#define OID_TCP_TASK_IPSEC_DELETE_SA      0xFC010203
+#define OID_TCP_SAN_SUPPORT               0xFC010204
+
 /* OID_GEN_MINIPORT_INFO constants */
 #define NDIS_MINIPORT_BUS_MASTER                      0x00000001
 #define NDIS_MINIPORT_WDM_DRIVER                      0x00000002
@@ -1014,6 +1014,44 @@ typedef struct pollfd {
   SHORT revents;
 } WSAPOLLFD, *PWSAPOLLFD, FAR *LPWSAPOLLFD;
 
+#define SOCK_NOTIFY_REGISTER_EVENT_NONE   0x00
+#define SOCK_NOTIFY_REGISTER_EVENT_IN     0x01
+#define SOCK_NOTIFY_REGISTER_EVENT_OUT    0x02
+#define SOCK_NOTIFY_REGISTER_EVENT_HANGUP 0x04
+#define SOCK_NOTIFY_REGISTER_EVENTS_ALL \
+    (SOCK_NOTIFY_REGISTER_EVENT_IN | SOCK_NOTIFY_REGISTER_EVENT_OUT | SOCK_NOTIFY_REGISTER_EVENT_HANGUP)
+
+#define SOCK_NOTIFY_EVENT_IN     SOCK_NOTIFY_REGISTER_EVENT_IN
+#define SOCK_NOTIFY_EVENT_OUT    SOCK_NOTIFY_REGISTER_EVENT_OUT
+#define SOCK_NOTIFY_EVENT_HANGUP SOCK_NOTIFY_REGISTER_EVENT_HANGUP
+#define SOCK_NOTIFY_EVENT_ERR    0x40
+#define SOCK_NOTIFY_EVENT_REMOVE 0x80
+
+#define SOCK_NOTIFY_OP_NONE    0x00
+#define SOCK_NOTIFY_OP_ENABLE  0x01
+#define SOCK_NOTIFY_OP_DISABLE 0x02
+#define SOCK_NOTIFY_OP_REMOVE  0x04
+
+#define SOCK_NOTIFY_TRIGGER_ONESHOT    0x01
+#define SOCK_NOTIFY_TRIGGER_PERSISTENT 0x02
+#define SOCK_NOTIFY_TRIGGER_LEVEL      0x04
+#define SOCK_NOTIFY_TRIGGER_EDGE       0x08
+#define SOCK_NOTIFY_TRIGGER_ALL \
+    (SOCK_NOTIFY_TRIGGER_ONESHOT | SOCK_NOTIFY_TRIGGER_PERSISTENT | \
+     SOCK_NOTIFY_TRIGGER_LEVEL | SOCK_NOTIFY_TRIGGER_EDGE)
+
+typedef struct SOCK_NOTIFY_REGISTRATION {
+  SOCKET socket;
+  PVOID completionKey;
+  UINT16 eventFilter;
+  UINT8 operation;
+  UINT8 triggerFlags;
+  DWORD registrationResult;
+} SOCK_NOTIFY_REGISTRATION;
+
+#define SocketNotificationRetrieveEvents(Notification) \
+    ((UINT32)((Notification)->dwNumberOfBytesTransferred))
+
 #endif /* (_WIN32_WINNT >= 0x0600) */
 
 #if INCL_WINSOCK_API_TYPEDEFS
@@ -2701,6 +2739,18 @@ WSAPoll(
   _In_ ULONG fds,
   _In_ INT timeout);
 
+WINSOCK_API_LINKAGE
+DWORD
+WSAAPI
+ProcessSocketNotifications(
+  _In_ HANDLE completionPort,
+  _In_ UINT32 registrationCount,
+  _Inout_updates_opt_(registrationCount) SOCK_NOTIFY_REGISTRATION *registrationInfos,
+  _In_ UINT32 timeoutMs,
+  _In_ ULONG completionCount,
+  _Out_writes_to_opt_(completionCount, *receivedEntryCount) OVERLAPPED_ENTRY *completionPortEntries,
+  _Out_opt_ UINT32 *receivedEntryCount);
+
 #endif /* (_WIN32_WINNT >= 0x0600) */
 
 #endif /* INCL_WINSOCK_API_PROTOTYPES */
@@ -147,6 +147,11 @@ extern "C" {
 #define TCP_OFFLOAD_PREFERENCE   11
 #define TCP_CONGESTION_ALGORITHM 12
 #define TCP_DELAY_FIN_ACK        13
+#ifdef __REACTOS__
+/* Hold back partial segments until cleared. ReactOS extension, kept
+   clear of the option numbers Windows uses */
+#define TCP_CORK                 0x7000
+#endif
 
 struct sockaddr_in6_old {
   SHORT sin6_family;
@@ -114,6 +114,28 @@ typedef struct _AFD_SEND_INFO_UDP {
 
 C_ASSERT(sizeof(AFD_RECV_INFO) == sizeof(AFD_SEND_INFO));
 
+/* Receives as many queued datagrams as fit in the first buffer, each one
+ * as an AFD_RECEIVED_DATAGRAM.  MaxDatagrams of 0 means no limit. */
+typedef struct _AFD_RECV_DATAGRAMS_INFO {
+    PAFD_WSABUF				BufferArray;
+    ULONG				BufferCount;
+    ULONG				AfdFlags;
+    ULONG				MaxDatagrams;
+} AFD_RECV_DATAGRAMS_INFO, *PAFD_RECV_DATAGRAMS_INFO;
+
+#define AFD_DATAGRAM_ADDRESS_LENGTH	28
+
+/* RecordLength is the offset of the next datagram, the data is cut short
+ * only for the first one and then has AFD_DATAGRAM_TRUNCATED set */
+typedef struct _AFD_RECEIVED_DATAGRAM {
+    ULONG				RecordLength;
+    ULONG				DataLength;
+    ULONG				Flags;
+    INT					AddressLength;
+    UCHAR				Address[AFD_DATAGRAM_ADDRESS_LENGTH];
+    UCHAR				Data[1];
+} AFD_RECEIVED_DATAGRAM, *PAFD_RECEIVED_DATAGRAM;
+
 typedef struct  _AFD_CONNECT_INFO {
     BOOLEAN				UseSAN;
     ULONG				Root;
@@ -126,6 +148,14 @@ typedef struct _AFD_EVENT_SELECT_INFO {
     ULONG				Events;
 } AFD_EVENT_SELECT_INFO, *PAFD_EVENT_SELECT_INFO;
 
+typedef struct _AFD_NOTIFY_INFO {
+    HANDLE				CompletionPort;
+    PVOID				CompletionKey;
+    USHORT				EventFilter;
+    UCHAR				Operation;
+    UCHAR				TriggerFlags;
+} AFD_NOTIFY_INFO, *PAFD_NOTIFY_INFO;
+
 typedef struct _AFD_ENUM_NETWORK_EVENTS_INFO {
     HANDLE Event;
     ULONG PollEvents;
@@ -149,6 +179,37 @@ typedef struct _AFD_TDI_HANDLE_DATA
     HANDLE TdiConnectionHandle;
 } AFD_TDI_HANDLE_DATA, *PAFD_TDI_HANDLE_DATA;
 
+/* Issued on the listening socket, the output buffer takes the received
+ * data followed by the local and remote address areas */
+typedef struct _AFD_SUPER_ACCEPT_INFO {
+    HANDLE				AcceptHandle;
+    ULONG				ReceiveDataLength;
+    ULONG				LocalAddressLength;
+    ULONG				RemoteAddressLength;
+} AFD_SUPER_ACCEPT_INFO, *PAFD_SUPER_ACCEPT_INFO;
+
+/* What each address area holds once the super accept is done */
+typedef struct _AFD_ACCEPT_ADDRESS {
+    INT					Length;
+    USHORT				Family;
+    UCHAR				Data[1];
+} AFD_ACCEPT_ADDRESS, *PAFD_ACCEPT_ADDRESS;
+
+typedef struct _AFD_TRANSMIT_ELEMENT {
+    ULONG				Flags;
+    ULONG				Length;
+    LARGE_INTEGER			FileOffset;
+    HANDLE				FileHandle;
+    PVOID				Buffer;
+} AFD_TRANSMIT_ELEMENT, *PAFD_TRANSMIT_ELEMENT;
+
+typedef struct _AFD_TRANSMIT_INFO {
+    PAFD_TRANSMIT_ELEMENT		ElementArray;
+    ULONG				ElementCount;
+    ULONG				SendSize;
+    ULONG				Flags;
+} AFD_TRANSMIT_INFO, *PAFD_TRANSMIT_INFO;
+
 /* AFD Packet Endpoint Flags */
 #define AFD_ENDPOINT_CONNECTIONLESS	0x1
 #define AFD_ENDPOINT_MESSAGE_ORIENTED	0x10
@@ -198,6 +259,18 @@ typedef struct _AFD_TDI_HANDLE_DATA
 #define AFD_DISCONNECT_RECV		0x02L
 #define AFD_DISCONNECT_ABORT		0x04L
 #define AFD_DISCONNECT_DATAGRAM		0x08L
+#define AFD_DISCONNECT_REUSE		0x10L
+
+/* AFD Transmit Element Flags */
+#define AFD_TP_MEMORY			0x01L
+#define AFD_TP_FILE			0x02L
+
+/* AFD Transmit Flags */
+#define AFD_TF_DISCONNECT		0x01L
+#define AFD_TF_REUSE_SOCKET		0x02L
+
+/* AFD_RECEIVED_DATAGRAM Flags */
+#define AFD_DATAGRAM_TRUNCATED		0x01L
 
 /* AFD Event Flags */
 #define AFD_EVENT_RECEIVE                   (1 << AFD_EVENT_RECEIVE_BIT)
@@ -214,6 +287,23 @@ typedef struct _AFD_TDI_HANDLE_DATA
 #define AFD_EVENT_ROUTING_INTERFACE_CHANGE  (1 << AFD_EVENT_ROUTING_INTERFACE_CHANGE_BIT)
 #define AFD_EVENT_ADDRESS_LIST_CHANGE       (1 << AFD_EVENT_ADDRESS_LIST_CHANGE_BIT)
 
+/* AFD socket notifications, the values match the SOCK_NOTIFY_* ones */
+#define AFD_NOTIFY_EVENT_IN                 0x01
+#define AFD_NOTIFY_EVENT_OUT                0x02
+#define AFD_NOTIFY_EVENT_HANGUP             0x04
+#define AFD_NOTIFY_EVENT_ERR                0x40
+#define AFD_NOTIFY_EVENT_REMOVE             0x80
+#define AFD_NOTIFY_EVENTS_ALL               (AFD_NOTIFY_EVENT_IN | AFD_NOTIFY_EVENT_OUT | AFD_NOTIFY_EVENT_HANGUP)
+
+#define AFD_NOTIFY_OP_ENABLE                0x01
+#define AFD_NOTIFY_OP_DISABLE               0x02
+#define AFD_NOTIFY_OP_REMOVE                0x04
+
+#define AFD_NOTIFY_TRIGGER_ONESHOT          0x01
+#define AFD_NOTIFY_TRIGGER_PERSISTENT       0x02
+#define AFD_NOTIFY_TRIGGER_LEVEL            0x04
+#define AFD_NOTIFY_TRIGGER_EDGE             0x08
+
 /* AFD SEND/RECV Flags */
 #define AFD_SKIP_FIO			0x1L
 #define AFD_OVERLAPPED			0x2L
@@ -256,11 +346,16 @@ typedef struct _AFD_TDI_HANDLE_DATA
 #define AFD_SET_DISCONNECT_DATA_SIZE    28
 #define AFD_SET_DISCONNECT_OPTIONS_SIZE 29
 #define AFD_GET_INFO			30
+#define AFD_TRANSMIT_PACKETS		31
+#define AFD_SUPER_ACCEPT		32
 #define AFD_EVENT_SELECT		33
 #define AFD_ENUM_NETWORK_EVENTS         34
 #define AFD_DEFER_ACCEPT		35
+#define AFD_SUPER_CONNECT		36
 #define AFD_GET_PENDING_CONNECT_DATA	41
 #define AFD_VALIDATE_GROUP		42
+#define AFD_SET_NOTIFY			43
+#define AFD_RECV_DATAGRAMS		44
 
 /* AFD IOCTLs */
 
@@ -336,6 +431,16 @@ typedef struct _AFD_TDI_HANDLE_DATA
   _AFD_CONTROL_CODE(AFD_ENUM_NETWORK_EVENTS, METHOD_NEITHER)
 #define IOCTL_AFD_VALIDATE_GROUP \
   _AFD_CONTROL_CODE(AFD_VALIDATE_GROUP, METHOD_NEITHER)
+#define IOCTL_AFD_TRANSMIT_PACKETS \
+  _AFD_CONTROL_CODE(AFD_TRANSMIT_PACKETS, METHOD_NEITHER)
+#define IOCTL_AFD_SUPER_ACCEPT \
+  _AFD_CONTROL_CODE(AFD_SUPER_ACCEPT, METHOD_NEITHER)
+#define IOCTL_AFD_SUPER_CONNECT \
+  _AFD_CONTROL_CODE(AFD_SUPER_CONNECT, METHOD_NEITHER)
+#define IOCTL_AFD_SET_NOTIFY \
+  _AFD_CONTROL_CODE(AFD_SET_NOTIFY, METHOD_NEITHER)
+#define IOCTL_AFD_RECV_DATAGRAMS \
+  _AFD_CONTROL_CODE(AFD_RECV_DATAGRAMS, METHOD_NEITHER)
 
 typedef struct _AFD_SOCKET_INFORMATION {
     BOOL CommandChannel;
@@ -40,6 +40,7 @@ DEFINE_GUID(GUID_BUS_TYPE_RAMDISK, 0x9d6d66a6, 0x0b0c, 0x4563, 0x90, 0x77, 0xa0,
 //
 #define IOCTL_RAMDISK_BASE                FILE_DEVICE_VIRTUAL_DISK
 #define FSCTL_CREATE_RAM_DISK             CTL_CODE(FILE_DEVICE_VIRTUAL_DISK, 0x0000, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_QUERY_RAM_DISK_STATISTICS   CTL_CODE(FILE_DEVICE_VIRTUAL_DISK, 0x0001, METHOD_BUFFERED, FILE_READ_ACCESS)
 
 //
 // Disk Types
@@ -90,6 +91,22 @@ typedef struct _RAMDISK_CREATE_INPUT
     };
 } RAMDISK_CREATE_INPUT, *PRAMDISK_CREATE_INPUT;
 
+//
+// This structure is returned by a FSCTL_QUERY_RAM_DISK_STATISTICS call
+// All times are in 100ns units
+//
+typedef struct _RAMDISK_STATISTICS
+{
+    LARGE_INTEGER ReadCount;
+    LARGE_INTEGER WriteCount;
+    LARGE_INTEGER BytesRead;
+    LARGE_INTEGER BytesWritten;
+    LARGE_INTEGER InlineCount;
+    LARGE_INTEGER QueuedCount;
+    LARGE_INTEGER QueueWaitTime;
+    LARGE_INTEGER ElapsedTime;
+} RAMDISK_STATISTICS, *PRAMDISK_STATISTICS;
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,5 +15,46 @@ typedef struct _NS_ROUTINE {
     DWORD        dwPriority;
 } NS_ROUTINE, *PNS_ROUTINE, * FAR LPNS_ROUTINE;
 
+/* ReactOS extension function, obtained with SIO_GET_EXTENSION_FUNCTION_POINTER.
+ * Receives the datagrams queued on a socket in one call, as RECVDATAGRAM
+ * records packed into the buffer.  A dwMaxDatagrams of 0 means no limit. */
+#define WSAID_RECVDATAGRAMS \
+    {0x6a3b0fd2,0x5c1e,0x4b8e,{0x9a,0x43,0x1f,0x7e,0x2d,0x61,0xb0,0x5c}}
+
+/* RecordLength is the offset of the next record.  Only the first datagram
+ * can be cut short, it then has RECVDATAGRAM_TRUNCATED set. */
+typedef struct _RECVDATAGRAM {
+    ULONG RecordLength;
+    ULONG DataLength;
+    ULONG Flags;
+    INT   AddressLength;
+    UCHAR Address[28];
+    UCHAR Data[1];
+} RECVDATAGRAM, *PRECVDATAGRAM, FAR *LPRECVDATAGRAM;
+
+#define RECVDATAGRAM_TRUNCATED 0x01
+
+typedef
+INT
+(PASCAL FAR *LPFN_RECVDATAGRAMS)(
+    SOCKET s,
+    LPWSABUF lpBuffer,
+    DWORD dwMaxDatagrams,
+    LPDWORD lpdwNumberOfBytesRecvd,
+    LPWSAOVERLAPPED lpOverlapped);
+
+#if (_WIN32_WINNT >= 0x0600)
+
+/* Private provider ioctl used by ws2_32 to pass a socket notification
+ * registration (see ProcessSocketNotifications) to the socket's provider */
+#define SIO_SOCK_NOTIFY _WSAIOW(IOC_VENDOR,0x7F)
+
+typedef struct _SOCK_NOTIFY_REQUEST {
+    HANDLE                   CompletionPort;
+    SOCK_NOTIFY_REGISTRATION Registration;
+} SOCK_NOTIFY_REQUEST, *PSOCK_NOTIFY_REQUEST;
+
+#endif /* (_WIN32_WINNT >= 0x0600) */
+
 #endif
 
@@ -35,25 +35,55 @@ ULONG ChecksumCompute(
  *     Count = Number of bytes in buffer
  *     Seed  = Previously calculated checksum (if any)
  * RETURNS:
- *     Checksum of buffer
+ *     Checksum of buffer, in network byte order and not yet folded
+ * NOTES:
+ *     Adding 32-bit words gives the same folded result as adding 16-bit
+ *     ones, since 2^16 is 1 modulo 0xFFFF. The words go into a 64-bit
+ *     accumulator so the carries don't have to be handled in the loop.
  */
 {
-  register ULONG Sum = Seed;
+#ifdef _M_IX86
+  return csum_partial(Data, Count, Seed);
+#else
+  ULONGLONG Sum = Seed;
+  PUCHAR Buffer = Data;
 
-  while (Count > 1)
+  while (Count >= 16)
     {
-      Sum += *(PUSHORT)Data;
+      Sum += ((ULONG UNALIGNED *)Buffer)[0];
+      Sum += ((ULONG UNALIGNED *)Buffer)[1];
+      Sum += ((ULONG UNALIGNED *)Buffer)[2];
+      Sum += ((ULONG UNALIGNED *)Buffer)[3];
+      Count -= 16;
+      Buffer += 16;
+    }
+
+  while (Count >= 4)
+    {
+      Sum += *(ULONG UNALIGNED *)Buffer;
+      Count -= 4;
+      Buffer += 4;
+    }
+
+  if (Count >= 2)
+    {
+      Sum += *(USHORT UNALIGNED *)Buffer;
       Count -= 2;
-      Data = (PVOID)((ULONG_PTR) Data + 2);
+      Buffer += 2;
     }
 
   /* Add left-over byte, if any */
   if (Count > 0)
     {
-      Sum += *(PUCHAR)Data;
+      Sum += *Buffer;
     }
 
-  return Sum;
+  /* Fold 64-bit sum to 32 bits */
+  Sum = (Sum & 0xFFFFFFFF) + (Sum >> 32);
+  Sum = (Sum & 0xFFFFFFFF) + (Sum >> 32);
+
+  return (ULONG)Sum;
+#endif
 }
 
 ULONG
@@ -62,44 +92,16 @@ UDPv4ChecksumCalculate(
   PUCHAR PacketBuffer,
   ULONG DataLength)
 {
-  ULONG Sum = 0;
-  USHORT TmpSum;
-  ULONG i;
-  BOOLEAN Pad;
-
-  /* Pad the data if needed */
-  Pad = (DataLength & 1);
-  if (Pad)
-      DataLength++;
-
-  /* Add from the UDP header and data */
-  for (i = 0; i < DataLength; i += 2)
-  {
-       TmpSum = ((PacketBuffer[i] << 8) & 0xFF00) +
-                ((Pad && i == DataLength - 2) ? 0 : (PacketBuffer[i+1] & 0x00FF));
-       Sum += TmpSum;
-  }
-
-  /* Add the source address */
-  for (i = 0; i < sizeof(IPv4_RAW_ADDRESS); i += 2)
-  {
-       TmpSum = ((((PUCHAR)&IPHeader->SrcAddr)[i] << 8) & 0xFF00) +
-                (((PUCHAR)&IPHeader->SrcAddr)[i+1] & 0x00FF);
-       Sum += TmpSum;
-  }
-
-  /* Add the destination address */
-  for (i = 0; i < sizeof(IPv4_RAW_ADDRESS); i += 2)
-  {
-       TmpSum = ((((PUCHAR)&IPHeader->DstAddr)[i] << 8) & 0xFF00) +
-                (((PUCHAR)&IPHeader->DstAddr)[i+1] & 0x00FF);
-       Sum += TmpSum;
-  }
-
-  /* Add the proto number and length */
-  Sum += IPPROTO_UDP + (DataLength - (Pad ? 1 : 0));
-
-  /* Fold the checksum and return the one's complement */
-  return ~ChecksumFold(Sum);
+  ULONG Sum;
+
+  /* Add from the UDP header and data, then the pseudo header */
+  Sum = ChecksumCompute(PacketBuffer, DataLength, 0);
+  Sum = ChecksumCompute(&IPHeader->SrcAddr, sizeof(IPv4_RAW_ADDRESS), Sum);
+  Sum = ChecksumCompute(&IPHeader->DstAddr, sizeof(IPv4_RAW_ADDRESS), Sum);
+  Sum = ChecksumFold(Sum);
+  Sum += WH2N(IPPROTO_UDP);
+  Sum += WH2N((USHORT)DataLength);
+
+  /* Fold the checksum, bring it to host order and return the one's complement */
+  return ~(ULONG)WN2H((USHORT)ChecksumFold(Sum));
 }
-
@@ -562,6 +562,7 @@ VOID IPv4Receive(PIP_INTERFACE IF, PIP_PACKET IPPacket)
 {
     UCHAR FirstByte;
     ULONG BytesCopied;
+    NDIS_TCP_IP_CHECKSUM_PACKET_INFO ChecksumInfo;
     
     TI_DbgPrint(DEBUG_IP, ("Received IPv4 datagram.\n"));
     
@@ -611,8 +612,25 @@ VOID IPv4Receive(PIP_INTERFACE IF, PIP_PACKET IPPacket)
         return;
     }
 
-    /* Checksum IPv4 header */
-    if (!IPv4CorrectChecksum(IPPacket->Header, IPPacket->HeaderSize)) {
+    /* Checksum IPv4 header, unless the adapter has already done it */
+    if (IF->OffloadFlags & IP_OFFLOAD_IP_CHECKSUM_RX)
+    {
+        ChecksumInfo.Value = PtrToUlong(NDIS_PER_PACKET_INFO_FROM_PACKET(IPPacket->NdisPacket,
+                                                                         TcpIpChecksumPacketInfo));
+        if (ChecksumInfo.Receive.NdisPacketIpChecksumFailed)
+        {
+            TI_DbgPrint(MIN_TRACE, ("Datagram received with bad checksum (checked by adapter)\n"));
+            /* Discard packet */
+            return;
+        }
+    }
+    else
+    {
+        ChecksumInfo.Value = 0;
+    }
+
+    if (!ChecksumInfo.Receive.NdisPacketIpChecksumSucceeded &&
+        !IPv4CorrectChecksum(IPPacket->Header, IPPacket->HeaderSize)) {
         TI_DbgPrint(MIN_TRACE, ("Datagram received with bad checksum. Checksum field (0x%X)\n",
 	      WN2H(((PIPv4_HEADER)IPPacket->Header)->Checksum)));
         /* Discard packet */
@@ -627,6 +645,19 @@ VOID IPv4Receive(PIP_INTERFACE IF, PIP_PACKET IPPacket)
     TI_DbgPrint(MID_TRACE,("IPPacket->Position = %d\n",
                            IPPacket->Position));
 
+    /* A TCP segment that isn't fragmented doesn't need reassembling. TCP builds
+     * its buffers on top of the NDIS packet, so leave the data where it is. */
+    if (((PIPv4_HEADER)IPPacket->Header)->Protocol == IPPROTO_TCP &&
+        !(WN2H(((PIPv4_HEADER)IPPacket->Header)->FlagsFragOfs) & (IPv4_MF_MASK | IPv4_FRAGOFS_MASK)) &&
+        IPPacket->TotalSize > IPPacket->HeaderSize)
+    {
+        IPPacket->Flags |= IP_PACKET_FLAG_SCATTERED;
+        IPPacket->Data = NULL;
+
+        IPDispatchProtocol(IF, IPPacket);
+        return;
+    }
+
     /* FIXME: Possibly forward packets with multicast addresses */
 
     /* FIXME: Should we allow packets to be received on the wrong interface? */
@@ -83,9 +83,9 @@ BOOLEAN PrepareNextFragment(
         TI_DbgPrint(MAX_TRACE, ("Preparing 1 fragment.\n"));
 
         MaxData  = IFC->PathMTU - IFC->HeaderSize;
-        /* Make fragment a multiplum of 64bit */
-        MaxData -= MaxData % 8;
         if (IFC->BytesLeft > MaxData) {
+            /* Make fragment a multiplum of 64bit */
+            MaxData -= MaxData % 8;
             DataSize      = MaxData;
             MoreFragments = TRUE;
         } else {
@@ -112,9 +112,10 @@ BOOLEAN PrepareNextFragment(
 
         /* FIXME: Handle options */
 
-        /* Calculate checksum of IP header */
+        /* Calculate checksum of IP header, unless the adapter does it */
         Header->Checksum = 0;
-        Header->Checksum = (USHORT)IPv4Checksum(Header, IFC->HeaderSize, 0);
+        if (!IFC->ChecksumOffload)
+            Header->Checksum = (USHORT)IPv4Checksum(Header, IFC->HeaderSize, 0);
 	TI_DbgPrint(MID_TRACE,("IP Check: %x\n", Header->Checksum));
 
         /* Update pointers */
@@ -150,6 +151,7 @@ NTSTATUS SendFragments(
     PVOID Data;
     UINT BufferSize = PathMTU, InSize;
     PCHAR InData;
+    NDIS_TCP_IP_CHECKSUM_PACKET_INFO ChecksumInfo;
 
     TI_DbgPrint(MAX_TRACE, ("Called. IPPacket (0x%X)  NCE (0x%X)  PathMTU (%d).\n",
         IPPacket, NCE, PathMTU));
@@ -179,6 +181,14 @@ NTSTATUS SendFragments(
 
     GetDataPtr( IFC->NdisPacket, 0, (PCHAR *)&Data, &InSize );
 
+    /* Pass on what the adapter is asked to do with the datagram */
+    ChecksumInfo.Value = PtrToUlong(NDIS_PER_PACKET_INFO_FROM_PACKET(IPPacket->NdisPacket,
+                                                                     TcpIpChecksumPacketInfo));
+    NDIS_PER_PACKET_INFO_FROM_PACKET(IFC->NdisPacket, TcpIpChecksumPacketInfo) =
+        UlongToPtr(ChecksumInfo.Value);
+    NDIS_PER_PACKET_INFO_FROM_PACKET(IFC->NdisPacket, TcpLargeSendPacketInfo) =
+        NDIS_PER_PACKET_INFO_FROM_PACKET(IPPacket->NdisPacket, TcpLargeSendPacketInfo);
+
     IFC->Header       = ((PCHAR)Data);
     IFC->Datagram     = IPPacket->NdisPacket;
     IFC->DatagramData = ((PCHAR)IPPacket->Header) + IPPacket->HeaderSize;
@@ -186,6 +196,7 @@ NTSTATUS SendFragments(
     IFC->PathMTU      = PathMTU;
     IFC->NCE          = NCE;
     IFC->Position     = 0;
+    IFC->ChecksumOffload = ChecksumInfo.Transmit.NdisPacketIpChecksum;
     IFC->BytesLeft    = IPPacket->TotalSize - IPPacket->HeaderSize;
     IFC->Data         = (PVOID)((ULONG_PTR)IFC->Header + IPPacket->HeaderSize);
     KeInitializeEvent(&IFC->Event, NotificationEvent, FALSE);
@@ -241,6 +252,10 @@ NTSTATUS IPSendDatagram(PIP_PACKET IPPacket, PNEIGHBOR_CACHE_ENTRY NCE)
     /* Fetch path MTU now, because it may change */
     TI_DbgPrint(MID_TRACE,("PathMTU: %d\n", NCE->Interface->MTU));
 
+    /* A large send is cut into segments by the adapter, not into fragments by us */
+    if (NDIS_PER_PACKET_INFO_FROM_PACKET(IPPacket->NdisPacket, TcpLargeSendPacketInfo) != NULL)
+        return SendFragments(IPPacket, NCE, IPPacket->TotalSize);
+
     return SendFragments(IPPacket, NCE, NCE->Interface->MTU);
 }
 
@@ -53,6 +53,7 @@ NTSTATUS TCPListen(PCONNECTION_ENDPOINT Connection, UINT Backlog)
 
     ASSERT(Connection);
 
+    LibTCPLockCore();
     LockObject(Connection, &OldIrql);
 
     ASSERT_KM_POINTER(Connection->AddressFile);
@@ -74,7 +75,7 @@ NTSTATUS TCPListen(PCONNECTION_ENDPOINT Connection, UINT Backlog)
         if (!Connection->AddressFile->Port)
         {
             /* We did, so we need to copy back the port */
-            Status = TCPGetSockAddress(Connection, (PTRANSPORT_ADDRESS)&LocalAddress, FALSE);
+            Status = TCPGetSockAddressLocked(Connection, (PTRANSPORT_ADDRESS)&LocalAddress, FALSE);
             if (NT_SUCCESS(Status))
             {
                 /* Allocate the port in the port bitmap */
@@ -94,6 +95,7 @@ NTSTATUS TCPListen(PCONNECTION_ENDPOINT Connection, UINT Backlog)
     }
 
     UnlockObject(Connection, OldIrql);
+    LibTCPUnlockCore();
 
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPListen] Leaving. Status = %x\n", Status));
 
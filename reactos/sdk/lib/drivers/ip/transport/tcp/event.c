@@ -332,13 +332,17 @@ TCPAcceptEventHandler(void *arg, PTCP_PCB newpcb)
             ASSERT( ((PTCP_PCB)Bucket->AssociatedEndpoint->SocketContext)->state == CLOSED );
             
             /*  free socket context created in FileOpenConnection, as we're using a new one */
-            LibTCPClose(Bucket->AssociatedEndpoint, TRUE, FALSE);
+            LibTCPClose(Bucket->AssociatedEndpoint, FALSE);
 
             /* free previously created socket context (we don't use it, we use newpcb) */
             Bucket->AssociatedEndpoint->SocketContext = newpcb;
             
             LibTCPAccept(newpcb, (PTCP_PCB)Connection->SocketContext, Bucket->AssociatedEndpoint);
 
+            /* The new PCB starts out with the listener's window */
+            if (Bucket->AssociatedEndpoint->ReceiveWindow)
+                LibTCPSetReceiveWindow(newpcb, Bucket->AssociatedEndpoint->ReceiveWindow);
+
             UnlockObject(Bucket->AssociatedEndpoint, OldIrql);
         }
         
@@ -370,21 +374,16 @@ TCPSendEventHandler(void *arg, const u16_t space)
 
     while ((Entry = ExInterlockedRemoveHeadList(&Connection->SendRequest, &Connection->Lock)))
     {
-        UINT SendLen = 0;
-        PVOID SendBuffer = 0;
+        PTDI_REQUEST_KERNEL_SEND SendInfo;
         
         Bucket = CONTAINING_RECORD( Entry, TDI_BUCKET, Entry );
         
         Irp = Bucket->Request.RequestContext;
         Mdl = Irp->MdlAddress;
+        SendInfo = (PTDI_REQUEST_KERNEL_SEND)&IoGetCurrentIrpStackLocation(Irp)->Parameters;
         
         TI_DbgPrint(DEBUG_TCP,
-                    ("Getting the user buffer from %x\n", Mdl));
-        
-        NdisQueryBuffer( Mdl, &SendBuffer, &SendLen );
-        
-        TI_DbgPrint(DEBUG_TCP,
-                    ("Writing %d bytes to %x\n", SendLen, SendBuffer));
+                    ("Writing %d bytes from %x\n", SendInfo->SendLength, Mdl));
         
         TI_DbgPrint(DEBUG_TCP, ("Connection: %x\n", Connection));
         TI_DbgPrint
@@ -393,8 +392,8 @@ TCPSendEventHandler(void *arg, const u16_t space)
           Connection->SocketContext));
         
         Status = TCPTranslateError(LibTCPSend(Connection,
-                                              SendBuffer,
-                                              SendLen, &BytesSent, TRUE));
+                                              Mdl,
+                                              SendInfo->SendLength, &BytesSent));
         
         TI_DbgPrint(DEBUG_TCP,("TCP Bytes: %d\n", BytesSent));
         
@@ -440,10 +439,7 @@ TCPRecvEventHandler(void *arg)
     PTDI_BUCKET Bucket;
     PLIST_ENTRY Entry;
     PIRP Irp;
-    PMDL Mdl;
     UINT Received;
-    UINT RecvLen;
-    PUCHAR RecvBuffer;
     NTSTATUS Status;
 
     ReferenceObject(Connection);
@@ -453,11 +449,8 @@ TCPRecvEventHandler(void *arg)
         Bucket = CONTAINING_RECORD( Entry, TDI_BUCKET, Entry );
         
         Irp = Bucket->Request.RequestContext;
-        Mdl = Irp->MdlAddress;
-
-        NdisQueryBuffer( Mdl, &RecvBuffer, &RecvLen );
 
-        Status = LibTCPGetDataFromConnectionQueue(Connection, RecvBuffer, RecvLen, &Received);
+        Status = LibTCPGetDataFromConnectionQueue(Connection, Irp->MdlAddress, &Received);
         if (Status == STATUS_PENDING)
         {
             ExInterlockedInsertHeadList(&Connection->ReceiveRequest,
@@ -7,63 +7,217 @@
 #include "lwip/api.h"
 #include "lwip/tcpip.h"
 
+static
+USHORT
+TCPPseudoHeaderSum(PIPv4_HEADER Header, USHORT TcpLength)
+{
+    ULONG Sum;
+
+    /* Folded but not complemented, which is how the adapter wants it as a seed */
+    Sum = ChecksumCompute(&Header->SrcAddr, sizeof(IPv4_RAW_ADDRESS), 0);
+    Sum = ChecksumCompute(&Header->DstAddr, sizeof(IPv4_RAW_ADDRESS), Sum);
+    Sum += WH2N(IPPROTO_TCP);
+    Sum += WH2N(TcpLength);
+
+    return (USHORT)ChecksumFold(Sum);
+}
+
+static
+VOID
+TCPChecksumSegment(PIP_PACKET Packet, PNEIGHBOR_CACHE_ENTRY NCE, ULONG Mss)
+{
+    PIPv4_HEADER Header = Packet->Header;
+    PTCPv4_HEADER TcpHeader = (PTCPv4_HEADER)((PCHAR)Header + Packet->HeaderSize);
+    USHORT TcpLength = (USHORT)(Packet->TotalSize - Packet->HeaderSize);
+    NDIS_TCP_IP_CHECKSUM_PACKET_INFO ChecksumInfo;
+
+    if (Mss != 0)
+    {
+        /* The adapter cuts the segment up and fills in the length of each piece */
+        TcpHeader->Checksum = TCPPseudoHeaderSum(Header, 0);
+        NDIS_PER_PACKET_INFO_FROM_PACKET(Packet->NdisPacket, TcpLargeSendPacketInfo) = UlongToPtr(Mss);
+    }
+    else if (NCE->Interface->OffloadFlags & IP_OFFLOAD_TCP_CHECKSUM_TX)
+    {
+        TcpHeader->Checksum = TCPPseudoHeaderSum(Header, TcpLength);
+
+        ChecksumInfo.Value = 0;
+        ChecksumInfo.Transmit.NdisPacketChecksumV4 = 1;
+        ChecksumInfo.Transmit.NdisPacketTcpChecksum = 1;
+        if (NCE->Interface->OffloadFlags & IP_OFFLOAD_IP_CHECKSUM_TX)
+            ChecksumInfo.Transmit.NdisPacketIpChecksum = 1;
+        NDIS_PER_PACKET_INFO_FROM_PACKET(Packet->NdisPacket, TcpIpChecksumPacketInfo) =
+            UlongToPtr(ChecksumInfo.Value);
+    }
+    else
+    {
+        TcpHeader->Checksum = 0;
+        TcpHeader->Checksum = (USHORT)~ChecksumFold(ChecksumCompute(TcpHeader,
+                                                                    TcpLength,
+                                                                    TCPPseudoHeaderSum(Header, TcpLength)));
+    }
+}
+
+static
 err_t
-TCPSendDataCallback(struct netif *netif, struct pbuf *p, struct ip_addr *dest)
+TCPSendPacket(PNEIGHBOR_CACHE_ENTRY NCE,
+              PIP_ADDRESS LocalAddress,
+              PIP_ADDRESS RemoteAddress,
+              PUCHAR Headers,
+              UINT HeaderSize,
+              struct pbuf *p,
+              UINT DataOffset,
+              UINT DataSize,
+              BOOLEAN Checksum,
+              ULONG Mss)
 {
     NDIS_STATUS NdisStatus;
-    PNEIGHBOR_CACHE_ENTRY NCE;
     IP_PACKET Packet;
+
+    IPInitializePacket(&Packet, LocalAddress->Type);
+
+    NdisStatus = AllocatePacketWithBuffer(&Packet.NdisPacket, NULL, HeaderSize + DataSize);
+    if (NdisStatus != NDIS_STATUS_SUCCESS)
+    {
+        return ERR_MEM;
+    }
+
+    GetDataPtr(Packet.NdisPacket, 0, (PCHAR*)&Packet.Header, &Packet.TotalSize);
+    Packet.MappedHeader = TRUE;
+
+    ASSERT(Packet.TotalSize == HeaderSize + DataSize);
+
+    RtlCopyMemory(Packet.Header, Headers, HeaderSize);
+    if (pbuf_copy_partial(p, (PCHAR)Packet.Header + HeaderSize, DataSize, DataOffset) != DataSize)
+    {
+        Packet.Free(&Packet);
+        return ERR_BUF;
+    }
+
+    Packet.HeaderSize = (((PIPv4_HEADER)Packet.Header)->VerIHL & 0x0F) << 2;
+    Packet.TotalSize = HeaderSize + DataSize;
+    Packet.SrcAddr = *LocalAddress;
+    Packet.DstAddr = *RemoteAddress;
+
+    if (Checksum)
+        TCPChecksumSegment(&Packet, NCE, Mss);
+
+    /* This frees the packet */
+    NdisStatus = IPSendDatagram(&Packet, NCE);
+    if (!NT_SUCCESS(NdisStatus))
+        return ERR_RTE;
+
+    return ERR_OK;
+}
+
+err_t
+TCPSendDataCallback(struct netif *netif, struct pbuf *p, struct ip_addr *dest)
+{
+    PNEIGHBOR_CACHE_ENTRY NCE;
     IP_ADDRESS RemoteAddress, LocalAddress;
-    PIPv4_HEADER Header;
+    UCHAR Headers[IPv4_MAX_HEADER_SIZE + TCPv4_MAX_HEADER_SIZE];
+    PIPv4_HEADER Header = (PIPv4_HEADER)Headers;
+    PTCPv4_HEADER TcpHeader;
+    UINT IpHeaderSize, HeaderSize, DataSize, ChunkSize, Offset, MaxData;
+    ULONG Mss = 0, Sequence;
+    USHORT Id;
+    UCHAR Flags;
+    BOOLEAN Checksum;
+    err_t Error;
 
     /* The caller frees the pbuf struct */
 
-    if (((*(u8_t*)p->payload) & 0xF0) == 0x40)
+    if (((*(u8_t*)p->payload) & 0xF0) != 0x40)
     {
-        Header = p->payload;
-        
-        LocalAddress.Type = IP_ADDRESS_V4;
-        LocalAddress.Address.IPv4Address = Header->SrcAddr;
-        
-        RemoteAddress.Type = IP_ADDRESS_V4;
-        RemoteAddress.Address.IPv4Address = Header->DstAddr;
+        return ERR_IF;
     }
-    else 
+
+    IpHeaderSize = ((*(u8_t*)p->payload) & 0x0F) << 2;
+    HeaderSize = MIN(p->tot_len, sizeof(Headers));
+    if (pbuf_copy_partial(p, Headers, HeaderSize, 0) != HeaderSize)
     {
-        return ERR_IF;
+        return ERR_BUF;
     }
 
-    IPInitializePacket(&Packet, LocalAddress.Type);
+    LocalAddress.Type = IP_ADDRESS_V4;
+    LocalAddress.Address.IPv4Address = Header->SrcAddr;
+
+    RemoteAddress.Type = IP_ADDRESS_V4;
+    RemoteAddress.Address.IPv4Address = Header->DstAddr;
 
     if (!(NCE = RouteGetRouteToDestination(&RemoteAddress)))
     {
         return ERR_RTE;
     }
-    
-    NdisStatus = AllocatePacketWithBuffer(&Packet.NdisPacket, NULL, p->tot_len);
-    if (NdisStatus != NDIS_STATUS_SUCCESS)
+
+    if (Header->Protocol != IPPROTO_TCP || HeaderSize < IpHeaderSize + sizeof(TCPv4_HEADER))
     {
-        return ERR_MEM;
+        return TCPSendPacket(NCE, &LocalAddress, &RemoteAddress,
+                             Headers, 0, p, 0, p->tot_len, FALSE, 0);
     }
 
-    GetDataPtr(Packet.NdisPacket, 0, (PCHAR*)&Packet.Header, &Packet.TotalSize);
-    Packet.MappedHeader = TRUE;
+    TcpHeader = (PTCPv4_HEADER)(Headers + IpHeaderSize);
+    HeaderSize = IpHeaderSize + TCP_DATA_OFFSET(TcpHeader->DataOffset);
+    if (HeaderSize > p->tot_len)
+    {
+        return ERR_BUF;
+    }
+    DataSize = p->tot_len - HeaderSize;
 
-    ASSERT(p->tot_len == p->len);
-    ASSERT(Packet.TotalSize == p->len);
+    /* lwIP leaves the checksum to us if this netif offloads it, but the
+     * datagram may be routed out of another interface that doesn't */
+#if LWIP_CHECKSUM_CTRL_PER_NETIF
+    Checksum = !(netif->chksum_flags & NETIF_CHECKSUM_GEN_TCP);
+#else
+    Checksum = !CHECKSUM_GEN_TCP;
+#endif
+#if TCP_LSO
+    Mss = p->lso_mss;
+#endif
 
-    RtlCopyMemory(Packet.Header, p->payload, p->len);
+    if (Mss == 0 || DataSize <= Mss)
+    {
+        return TCPSendPacket(NCE, &LocalAddress, &RemoteAddress,
+                             Headers, HeaderSize, p, HeaderSize, DataSize, Checksum, 0);
+    }
 
-    Packet.HeaderSize = sizeof(IPv4_HEADER);
-    Packet.TotalSize = p->tot_len;
-    Packet.SrcAddr = LocalAddress;
-    Packet.DstAddr = RemoteAddress;
+    if ((NCE->Interface->OffloadFlags & IP_OFFLOAD_TCP_LARGE_SEND) &&
+        HeaderSize + DataSize <= NCE->Interface->LargeSendSize &&
+        (DataSize + Mss - 1) / Mss >= NCE->Interface->LargeSendMinSegments)
+    {
+        return TCPSendPacket(NCE, &LocalAddress, &RemoteAddress,
+                             Headers, HeaderSize, p, HeaderSize, DataSize, TRUE, Mss);
+    }
 
-    NdisStatus = IPSendDatagram(&Packet, NCE);
-    if (!NT_SUCCESS(NdisStatus))
-        return ERR_RTE;
+    /* The adapter can't take it, so cut the segment up here. Only the last
+     * piece keeps FIN and PSH. */
+    MaxData = Mss;
+    if (NCE->Interface->MTU > HeaderSize)
+        MaxData = MIN(MaxData, NCE->Interface->MTU - HeaderSize);
 
-    return 0;
+    Id = WN2H(Header->Id);
+    Sequence = DN2H(TcpHeader->SequenceNumber);
+    Flags = TcpHeader->Flags;
+
+    for (Offset = 0; Offset < DataSize; Offset += ChunkSize)
+    {
+        ChunkSize = MIN(MaxData, DataSize - Offset);
+
+        Header->TotalLength = WH2N((USHORT)(HeaderSize + ChunkSize));
+        Header->Id = WH2N(Id++);
+        TcpHeader->SequenceNumber = DH2N(Sequence + Offset);
+        if (Offset + ChunkSize < DataSize)
+            TcpHeader->Flags = Flags & ~(TCP_FLAG_FIN | TCP_FLAG_PSH);
+        else
+            TcpHeader->Flags = Flags;
+
+        Error = TCPSendPacket(NCE, &LocalAddress, &RemoteAddress,
+                              Headers, HeaderSize, p, HeaderSize + Offset, ChunkSize, TRUE, 0);
+        if (Error != ERR_OK)
+            return Error;
+    }
+
+    return ERR_OK;
 }
 
 VOID
@@ -81,6 +235,37 @@ TCPUpdateInterfaceLinkStatus(PIP_INTERFACE IF)
 #endif
 }
 
+static
+VOID
+TCPUpdateInterfaceIPInformationLocked(PIP_INTERFACE IF)
+{
+    struct ip_addr ipaddr;
+    struct ip_addr netmask;
+    struct ip_addr gw;
+    
+    gw.addr = 0;
+    
+    GetInterfaceIPv4Address(IF,
+                            ADE_UNICAST,
+                            (PULONG)&ipaddr.addr);
+    
+    GetInterfaceIPv4Address(IF,
+                            ADE_ADDRMASK,
+                            (PULONG)&netmask.addr);
+    
+    netif_set_addr(IF->TCPContext, &ipaddr, &netmask, &gw);
+    
+    if (ipaddr.addr != 0)
+    {
+        netif_set_up(IF->TCPContext);
+        netif_set_default(IF->TCPContext);
+    }
+    else
+    {
+        netif_set_down(IF->TCPContext);
+    }
+}
+
 err_t
 TCPInterfaceInit(struct netif *netif)
 {
@@ -96,10 +281,22 @@ TCPInterfaceInit(struct netif *netif)
     netif->name[1] = 'n';
     
     netif->flags |= NETIF_FLAG_BROADCAST;
+
+    /* Leave the TCP checksum to the adapter, we fill in the pseudo header sum
+     * for it in TCPSendDataCallback. Received segments it has verified are
+     * flagged as such by TCPReceive. */
+    if (IF->OffloadFlags & IP_OFFLOAD_TCP_CHECKSUM_TX)
+        NETIF_SET_CHECKSUM_CTRL(netif, NETIF_CHECKSUM_ENABLE_ALL & ~NETIF_CHECKSUM_GEN_TCP);
+
+#if TCP_LSO
+    if (IF->OffloadFlags & IP_OFFLOAD_TCP_LARGE_SEND)
+        netif->lso_max = (u16_t)MIN(IF->LargeSendSize, 0xFFFF - IPv4_MAX_HEADER_SIZE - TCPv4_MAX_HEADER_SIZE);
+#endif
     
     TCPUpdateInterfaceLinkStatus(IF);
     
-    TCPUpdateInterfaceIPInformation(IF);
+    /* netif_add calls us with the core lock held */
+    TCPUpdateInterfaceIPInformationLocked(IF);
 
     return 0;
 }
@@ -115,6 +312,7 @@ TCPRegisterInterface(PIP_INTERFACE IF)
     ipaddr.addr = 0;
     netmask.addr = 0;
     
+    LOCK_TCPIP_CORE();
     IF->TCPContext = netif_add(IF->TCPContext, 
                                &ipaddr,
                                &netmask,
@@ -122,40 +320,21 @@ TCPRegisterInterface(PIP_INTERFACE IF)
                                IF,
                                TCPInterfaceInit,
                                tcpip_input);
+    UNLOCK_TCPIP_CORE();
 }
 
 VOID
 TCPUnregisterInterface(PIP_INTERFACE IF)
 {
+    LOCK_TCPIP_CORE();
     netif_remove(IF->TCPContext);
+    UNLOCK_TCPIP_CORE();
 }
 
 VOID
 TCPUpdateInterfaceIPInformation(PIP_INTERFACE IF)
 {
-    struct ip_addr ipaddr;
-    struct ip_addr netmask;
-    struct ip_addr gw;
-    
-    gw.addr = 0;
-    
-    GetInterfaceIPv4Address(IF,
-                            ADE_UNICAST,
-                            (PULONG)&ipaddr.addr);
-    
-    GetInterfaceIPv4Address(IF,
-                            ADE_ADDRMASK,
-                            (PULONG)&netmask.addr);
-    
-    netif_set_addr(IF->TCPContext, &ipaddr, &netmask, &gw);
-    
-    if (ipaddr.addr != 0)
-    {
-        netif_set_up(IF->TCPContext);
-        netif_set_default(IF->TCPContext);
-    }
-    else
-    {
-        netif_set_down(IF->TCPContext);
-    }
-}    
+    LOCK_TCPIP_CORE();
+    TCPUpdateInterfaceIPInformationLocked(IF);
+    UNLOCK_TCPIP_CORE();
+}
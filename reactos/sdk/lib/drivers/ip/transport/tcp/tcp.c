@@ -35,6 +35,7 @@ DisconnectTimeoutDpc(PKDPC Dpc,
     PLIST_ENTRY Entry;
     PTDI_BUCKET Bucket;
 
+    LibTCPLockCore();
     LockObjectAtDpcLevel(Connection);
 
     /* We timed out waiting for pending sends so force it to shutdown */
@@ -65,6 +66,7 @@ DisconnectTimeoutDpc(PKDPC Dpc,
     }
     
     UnlockObjectFromDpcLevel(Connection);
+    LibTCPUnlockCore();
     
     DereferenceObject(Connection);
 }
@@ -128,6 +130,7 @@ NTSTATUS TCPSocket( PCONNECTION_ENDPOINT Connection,
     NTSTATUS Status;
     KIRQL OldIrql;
 
+    LibTCPLockCore();
     LockObject(Connection, &OldIrql);
 
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPSocket] Called: Connection %x, Family %d, Type %d, "
@@ -141,6 +144,7 @@ NTSTATUS TCPSocket( PCONNECTION_ENDPOINT Connection,
         Status = STATUS_INSUFFICIENT_RESOURCES;
 
     UnlockObject(Connection, OldIrql);
+    LibTCPUnlockCore();
 
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPSocket] Leaving. Status = 0x%x\n", Status));
 
@@ -151,13 +155,15 @@ NTSTATUS TCPClose( PCONNECTION_ENDPOINT Connection )
 {
     KIRQL OldIrql;
 
+    LibTCPLockCore();
     LockObject(Connection, &OldIrql);
 
     FlushAllQueues(Connection, STATUS_CANCELLED);
 
-    LibTCPClose(Connection, FALSE, TRUE);
+    LibTCPClose(Connection, TRUE);
 
     UnlockObject(Connection, OldIrql);
+    LibTCPUnlockCore();
 
     DereferenceObject(Connection);
 
@@ -173,11 +179,63 @@ VOID TCPReceive(PIP_INTERFACE Interface, PIP_PACKET IPPacket)
  *     This is the low level interface for receiving TCP data
  */
 {
+    UCHAR Headers[IPv4_MAX_HEADER_SIZE + TCPv4_MAX_HEADER_SIZE];
+    PNDIS_BUFFER FirstBuffer;
+    PVOID FirstAddress;
+    UINT FirstLength, PacketLength, DataSize, HeadSize;
+    NDIS_TCP_IP_CHECKSUM_PACKET_INFO ChecksumInfo;
+
     TI_DbgPrint(DEBUG_TCP,("Sending packet %d (%d) to lwIP\n",
                            IPPacket->TotalSize,
                            IPPacket->HeaderSize));
-    
-    LibIPInsertPacket(Interface->TCPContext, IPPacket->Header, IPPacket->TotalSize);
+
+    /* Find out whether the adapter already checked the TCP checksum */
+    ChecksumInfo.Value = 0;
+    if ((Interface->OffloadFlags & IP_OFFLOAD_TCP_CHECKSUM_RX) && IPPacket->NdisPacket)
+    {
+        ChecksumInfo.Value = PtrToUlong(NDIS_PER_PACKET_INFO_FROM_PACKET(IPPacket->NdisPacket,
+                                                                         TcpIpChecksumPacketInfo));
+        if (ChecksumInfo.Receive.NdisPacketTcpChecksumFailed)
+        {
+            TI_DbgPrint(MIN_TRACE, ("TCP segment received with bad checksum\n"));
+            return;
+        }
+    }
+
+    if (!(IPPacket->Flags & IP_PACKET_FLAG_SCATTERED))
+    {
+        LibIPInsertPacket(Interface->TCPContext, IPPacket->Header, IPPacket->TotalSize);
+        return;
+    }
+
+    /* lwIP wants the IP and TCP headers in one piece, so copy those along with
+     * the IP header we already have. The rest is referenced in place. */
+    DataSize = IPPacket->TotalSize - IPPacket->HeaderSize;
+    HeadSize = MIN(DataSize, TCPv4_MAX_HEADER_SIZE);
+
+    RtlCopyMemory(Headers, IPPacket->Header, IPPacket->HeaderSize);
+    if (CopyPacketToBuffer((PCHAR)Headers + IPPacket->HeaderSize,
+                           IPPacket->NdisPacket,
+                           IPPacket->Position + IPPacket->HeaderSize,
+                           HeadSize) != HeadSize)
+    {
+        TI_DbgPrint(MIN_TRACE, ("Truncated TCP segment\n"));
+        return;
+    }
+
+    NdisGetFirstBufferFromPacket(IPPacket->NdisPacket,
+                                 &FirstBuffer,
+                                 &FirstAddress,
+                                 &FirstLength,
+                                 &PacketLength);
+
+    LibIPInsertPacketChain(Interface->TCPContext,
+                           Headers,
+                           IPPacket->HeaderSize + HeadSize,
+                           FirstBuffer,
+                           IPPacket->Position + IPPacket->HeaderSize + HeadSize,
+                           DataSize - HeadSize,
+                           ChecksumInfo.Receive.NdisPacketTcpChecksumSucceeded);
 }
 
 NTSTATUS TCPStartup(VOID)
@@ -308,11 +366,13 @@ NTSTATUS TCPConnect
                  RemoteAddress.Address.IPv4Address,
                  RemotePort));
 
+    LibTCPLockCore();
     LockObject(Connection, &OldIrql);
 
     if (!Connection->AddressFile)
     {
         UnlockObject(Connection, OldIrql);
+        LibTCPUnlockCore();
         return STATUS_INVALID_PARAMETER;
     }
 
@@ -321,6 +381,7 @@ NTSTATUS TCPConnect
         if (!(NCE = RouteGetRouteToDestination(&RemoteAddress)))
         {
             UnlockObject(Connection, OldIrql);
+            LibTCPUnlockCore();
             return STATUS_NETWORK_UNREACHABLE;
         }
 
@@ -341,7 +402,7 @@ NTSTATUS TCPConnect
         if (!Connection->AddressFile->Port)
         {
             /* We did, so we need to copy back the port */
-            Status = TCPGetSockAddress(Connection, (PTRANSPORT_ADDRESS)&LocalAddress, FALSE);
+            Status = TCPGetSockAddressLocked(Connection, (PTRANSPORT_ADDRESS)&LocalAddress, FALSE);
             if (NT_SUCCESS(Status))
             {
                 /* Allocate the port in the port bitmap */
@@ -360,6 +421,7 @@ NTSTATUS TCPConnect
             if (!Bucket)
             {
                 UnlockObject(Connection, OldIrql);
+                LibTCPUnlockCore();
                 return STATUS_NO_MEMORY;
             }
             
@@ -375,6 +437,7 @@ NTSTATUS TCPConnect
     }
 
     UnlockObject(Connection, OldIrql);
+    LibTCPUnlockCore();
 
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPConnect] Leaving. Status = 0x%x\n", Status));
 
@@ -397,6 +460,7 @@ NTSTATUS TCPDisconnect
 
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPDisconnect] Called\n"));
 
+    LibTCPLockCore();
     LockObject(Connection, &OldIrql);
 
     if (Connection->SocketContext)
@@ -430,6 +494,7 @@ NTSTATUS TCPDisconnect
                 if (!Bucket)
                 {
                     UnlockObject(Connection, OldIrql);
+                    LibTCPUnlockCore();
                     return STATUS_NO_MEMORY;
                 }
 
@@ -464,6 +529,7 @@ NTSTATUS TCPDisconnect
     }
 
     UnlockObject(Connection, OldIrql);
+    LibTCPUnlockCore();
 
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPDisconnect] Leaving. Status = 0x%x\n", Status));
 
@@ -480,22 +546,24 @@ NTSTATUS TCPReceiveData
   PVOID Context )
 {
     PTDI_BUCKET Bucket;
-    PUCHAR DataBuffer;
-    UINT DataLen, Received;
+    UINT Received;
     NTSTATUS Status;
 
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPReceiveData] Called for %d bytes (on socket %x)\n",
                            ReceiveLength, Connection->SocketContext));
 
-    NdisQueryBuffer(Buffer, &DataBuffer, &DataLen);
+    /* Reading reopens the receive window, which needs the core lock. Holding it
+     * until the request is queued also keeps data from slipping in between. */
+    LibTCPLockCore();
 
-    Status = LibTCPGetDataFromConnectionQueue(Connection, DataBuffer, DataLen, &Received);
+    Status = LibTCPGetDataFromConnectionQueue(Connection, Buffer, &Received);
 
     if (Status == STATUS_PENDING)
     {
         Bucket = ExAllocateFromNPagedLookasideList(&TdiBucketLookasideList);
         if (!Bucket)
         {
+            LibTCPUnlockCore();
             TI_DbgPrint(DEBUG_TCP,("[IP, TCPReceiveData] Failed to allocate bucket\n"));
 
             return STATUS_NO_MEMORY;
@@ -516,12 +584,14 @@ NTSTATUS TCPReceiveData
         (*BytesReceived) = Received;
     }
 
+    LibTCPUnlockCore();
+
     return Status;
 }
 
 NTSTATUS TCPSendData
 ( PCONNECTION_ENDPOINT Connection,
-  PCHAR BufferData,
+  PNDIS_BUFFER Buffer,
   ULONG SendLength,
   PULONG BytesSent,
   ULONG Flags,
@@ -532,6 +602,7 @@ NTSTATUS TCPSendData
     PTDI_BUCKET Bucket;
     KIRQL OldIrql;
 
+    LibTCPLockCore();
     LockObject(Connection, &OldIrql);
 
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPSendData] Called for %d bytes (on socket %x)\n",
@@ -542,10 +613,9 @@ NTSTATUS TCPSendData
                            Connection->SocketContext));
 
     Status = TCPTranslateError(LibTCPSend(Connection,
-                                          BufferData,
+                                          Buffer,
                                           SendLength,
-                                          BytesSent,
-                                          FALSE));
+                                          BytesSent));
     
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPSendData] Send: %x, %d\n", Status, SendLength));
 
@@ -557,6 +627,7 @@ NTSTATUS TCPSendData
         if (!Bucket)
         {
             UnlockObject(Connection, OldIrql);
+            LibTCPUnlockCore();
             TI_DbgPrint(DEBUG_TCP,("[IP, TCPSendData] Failed to allocate bucket\n"));
             return STATUS_NO_MEMORY;
         }
@@ -569,6 +640,7 @@ NTSTATUS TCPSendData
     }
 
     UnlockObject(Connection, OldIrql);
+    LibTCPUnlockCore();
 
     TI_DbgPrint(DEBUG_TCP, ("[IP, TCPSendData] Leaving. Status = %x\n", Status));
 
@@ -596,7 +668,8 @@ VOID TCPFreePort(const UINT Port)
     DeallocatePort(&TCPPorts, Port);
 }
 
-NTSTATUS TCPGetSockAddress
+/* The caller holds the core lock */
+NTSTATUS TCPGetSockAddressLocked
 ( PCONNECTION_ENDPOINT Connection,
   PTRANSPORT_ADDRESS Address,
   BOOLEAN GetRemote )
@@ -635,6 +708,21 @@ NTSTATUS TCPGetSockAddress
     return Status;
 }
 
+NTSTATUS TCPGetSockAddress
+( PCONNECTION_ENDPOINT Connection,
+  PTRANSPORT_ADDRESS Address,
+  BOOLEAN GetRemote )
+{
+    NTSTATUS Status;
+
+    /* The pcb addresses change under the core lock */
+    LibTCPLockCore();
+    Status = TCPGetSockAddressLocked(Connection, Address, GetRemote);
+    LibTCPUnlockCore();
+
+    return Status;
+}
+
 BOOLEAN TCPRemoveIRP( PCONNECTION_ENDPOINT Endpoint, PIRP Irp )
 {
     PLIST_ENTRY Entry;
@@ -682,12 +770,78 @@ TCPSetNoDelay(
     if (!Connection)
         return STATUS_UNSUCCESSFUL;
 
+    LibTCPLockCore();
+
     if (Connection->SocketContext == NULL)
+    {
+        LibTCPUnlockCore();
         return STATUS_UNSUCCESSFUL;
+    }
 
     LibTCPSetNoDelay(Connection->SocketContext, Set);
+
+    LibTCPUnlockCore();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+TCPSetCork(
+    PCONNECTION_ENDPOINT Connection,
+    BOOLEAN Set)
+{
+    if (!Connection)
+        return STATUS_UNSUCCESSFUL;
+
+    LibTCPLockCore();
+
+    if (Connection->SocketContext == NULL)
+    {
+        LibTCPUnlockCore();
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    LibTCPSetCork(Connection->SocketContext, Set);
+
+    LibTCPUnlockCore();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+TCPSetReceiveWindow(
+    PCONNECTION_ENDPOINT Connection,
+    ULONG Size)
+{
+    if (!Connection)
+        return STATUS_UNSUCCESSFUL;
+
+    LibTCPLockCore();
+
+    /* Remembered for the PCB that replaces ours when a connection is accepted */
+    Connection->ReceiveWindow = Size;
+
+    if (Connection->SocketContext)
+        LibTCPSetReceiveWindow(Connection->SocketContext, Size);
+
+    LibTCPUnlockCore();
     return STATUS_SUCCESS;
 }
 
+VOID
+TCPGetDemuxStats(
+    PTCP_DEMUX_STATS Stats)
+{
+    struct tcp_demux_stats DemuxStats;
+
+    LibTCPLockCore();
+    LibTCPGetDemuxStats(&DemuxStats);
+    LibTCPUnlockCore();
+
+    Stats->ActiveConnections = DemuxStats.active;
+    Stats->TimeWaitConnections = DemuxStats.time_wait;
+    Stats->Listeners = DemuxStats.listen;
+    Stats->TimeWaitRecycled = DemuxStats.tw_recycled;
+    Stats->TimeWaitEvicted = DemuxStats.tw_evicted;
+}
+
 
 /* EOF */
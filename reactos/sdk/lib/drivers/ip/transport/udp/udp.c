@@ -255,6 +255,7 @@ VOID UDPReceive(PIP_INTERFACE Interface, PIP_PACKET IPPacket)
   PUDP_HEADER UDPHeader;
   PIP_ADDRESS DstAddress, SrcAddress;
   UINT DataSize, i;
+  NDIS_TCP_IP_CHECKSUM_PACKET_INFO ChecksumInfo;
 
   TI_DbgPrint(MAX_TRACE, ("Called.\n"));
 
@@ -279,14 +280,30 @@ VOID UDPReceive(PIP_INTERFACE Interface, PIP_PACKET IPPacket)
 
   UDPHeader = (PUDP_HEADER)IPPacket->Data;
 
+  /* Find out whether the adapter already checked the UDP checksum */
+  ChecksumInfo.Value = 0;
+  if ((Interface->OffloadFlags & IP_OFFLOAD_UDP_CHECKSUM_RX) && IPPacket->NdisPacket)
+  {
+      ChecksumInfo.Value = PtrToUlong(NDIS_PER_PACKET_INFO_FROM_PACKET(IPPacket->NdisPacket,
+                                                                       TcpIpChecksumPacketInfo));
+      if (ChecksumInfo.Receive.NdisPacketUdpChecksumFailed && UDPHeader->Checksum != 0)
+      {
+          TI_DbgPrint(MIN_TRACE, ("Bad checksum on packet received (checked by adapter).\n"));
+          return;
+      }
+  }
+
   /* Calculate and validate UDP checksum */
-  i = UDPv4ChecksumCalculate(IPv4Header,
-                             (PUCHAR)UDPHeader,
-                             WH2N(UDPHeader->Length));
-  if (i != DH2N(0x0000FFFF) && UDPHeader->Checksum != 0)
+  if (!ChecksumInfo.Receive.NdisPacketUdpChecksumSucceeded)
   {
-      TI_DbgPrint(MIN_TRACE, ("Bad checksum on packet received.\n"));
-      return;
+      i = UDPv4ChecksumCalculate(IPv4Header,
+                                 (PUCHAR)UDPHeader,
+                                 WH2N(UDPHeader->Length));
+      if (i != DH2N(0x0000FFFF) && UDPHeader->Checksum != 0)
+      {
+          TI_DbgPrint(MIN_TRACE, ("Bad checksum on packet received.\n"));
+          return;
+      }
   }
 
   /* Sanity checks */
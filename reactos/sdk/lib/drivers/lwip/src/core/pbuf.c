@@ -279,6 +279,9 @@ pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type)
       }
       q->type = type;
       q->flags = 0;
+#if TCP_LSO
+      q->lso_mss = 0;
+#endif /* TCP_LSO */
       q->next = NULL;
       /* make previous pbuf point to this pbuf */
       r->next = q;
@@ -344,6 +347,9 @@ pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type)
   p->ref = 1;
   /* set flags */
   p->flags = 0;
+#if TCP_LSO
+  p->lso_mss = 0;
+#endif /* TCP_LSO */
   LWIP_DEBUGF(PBUF_DEBUG | LWIP_DBG_TRACE, ("pbuf_alloc(length=%"U16_F") == %p\n", length, (void *)p));
   return p;
 }
@@ -404,6 +410,9 @@ pbuf_alloced_custom(pbuf_layer l, u16_t length, pbuf_type type, struct pbuf_cust
     p->pbuf.payload = NULL;
   }
   p->pbuf.flags = PBUF_FLAG_IS_CUSTOM;
+#if TCP_LSO
+  p->pbuf.lso_mss = 0;
+#endif /* TCP_LSO */
   p->pbuf.len = p->pbuf.tot_len = length;
   p->pbuf.type = type;
   p->pbuf.ref = 1;
@@ -116,6 +116,19 @@ struct tcp_pcb ** const tcp_pcb_lists[] = {&tcp_listen_pcbs.pcbs, &tcp_bound_pcb
 /** Only used for temporary storage. */
 struct tcp_pcb *tcp_tmp_pcb;
 
+/** Hash chains of the active and TIME-WAIT pcbs, by address/port 4-tuple */
+static struct tcp_pcb *tcp_conn_hash[TCP_CONN_HASH_SIZE];
+/** Hash chains of the listening pcbs, by local port */
+static struct tcp_pcb_listen *tcp_listen_hash[TCP_LISTEN_HASH_SIZE];
+/** Mixed into the 4-tuple hash so that remote hosts can't easily pick
+ * tuples that all land in the same chain */
+static u32_t tcp_hash_seed;
+
+/** Counters of the hash tables above */
+struct tcp_demux_stats tcp_demux_stats;
+
+#define TCP_LISTEN_HASH_INDEX(port) (((port) ^ ((port) >> 8)) & (TCP_LISTEN_HASH_SIZE - 1))
+
 u8_t tcp_active_pcbs_changed;
 
 /** Timer counter to handle calling slow-timer from tcp_tmr() */ 
@@ -132,6 +145,169 @@ tcp_init(void)
 #if LWIP_RANDOMIZE_INITIAL_LOCAL_PORTS && defined(LWIP_RAND)
   tcp_port = TCP_ENSURE_LOCAL_PORT_RANGE(LWIP_RAND());
 #endif /* LWIP_RANDOMIZE_INITIAL_LOCAL_PORTS && defined(LWIP_RAND) */
+#ifdef LWIP_RAND
+  tcp_hash_seed = LWIP_RAND();
+#endif /* LWIP_RAND */
+}
+
+/**
+ * Calculates the chain in tcp_conn_hash of a connection.
+ */
+static u32_t
+tcp_conn_hash_index(ip_addr_t *local_ip, u16_t local_port,
+                    ip_addr_t *remote_ip, u16_t remote_port)
+{
+  u32_t h;
+
+  h = ip4_addr_get_u32(remote_ip) ^ tcp_hash_seed;
+  h ^= ip4_addr_get_u32(local_ip) * 0x9e3779b1UL;
+  h ^= ((u32_t)remote_port << 16) | local_port;
+  /* let every bit of the tuple affect the low bits used as index */
+  h ^= h >> 16;
+  h *= 0x85ebca6bUL;
+  h ^= h >> 13;
+  return h & (TCP_CONN_HASH_SIZE - 1);
+}
+
+/**
+ * Adds a pcb to the lookup hash of the list it was just put on.
+ * Called from TCP_REG, other lists than the active, TIME-WAIT and
+ * listen ones are ignored.
+ *
+ * @param pcbs the PCB list the pcb was added to
+ * @param pcb the tcp_pcb to add
+ */
+void
+tcp_hash_reg(struct tcp_pcb **pcbs, struct tcp_pcb *pcb)
+{
+  if (pcbs == &tcp_listen_pcbs.pcbs) {
+    struct tcp_pcb_listen *lpcb = (struct tcp_pcb_listen *)pcb;
+    u16_t idx = TCP_LISTEN_HASH_INDEX(lpcb->local_port);
+
+    lpcb->hash_next = tcp_listen_hash[idx];
+    tcp_listen_hash[idx] = lpcb;
+    ++tcp_demux_stats.listen;
+  } else if (pcbs == &tcp_active_pcbs || pcbs == &tcp_tw_pcbs) {
+    u32_t idx = tcp_conn_hash_index(&pcb->local_ip, pcb->local_port,
+                                    &pcb->remote_ip, pcb->remote_port);
+
+    pcb->hash_next = tcp_conn_hash[idx];
+    tcp_conn_hash[idx] = pcb;
+    if (pcbs == &tcp_tw_pcbs) {
+      ++tcp_demux_stats.time_wait;
+    } else {
+      ++tcp_demux_stats.active;
+    }
+  }
+}
+
+/**
+ * Removes a pcb from the lookup hash of the list it is taken off.
+ * Called from TCP_RMV, a pcb which isn't hashed is ignored.
+ *
+ * @param pcbs the PCB list the pcb is removed from
+ * @param pcb the tcp_pcb to remove
+ */
+void
+tcp_hash_rmv(struct tcp_pcb **pcbs, struct tcp_pcb *pcb)
+{
+  if (pcbs == &tcp_listen_pcbs.pcbs) {
+    struct tcp_pcb_listen *lpcb = (struct tcp_pcb_listen *)pcb;
+    struct tcp_pcb_listen **link;
+
+    for (link = &tcp_listen_hash[TCP_LISTEN_HASH_INDEX(lpcb->local_port)];
+         *link != NULL; link = &(*link)->hash_next) {
+      if (*link == lpcb) {
+        *link = lpcb->hash_next;
+        lpcb->hash_next = NULL;
+        --tcp_demux_stats.listen;
+        return;
+      }
+    }
+  } else if (pcbs == &tcp_active_pcbs || pcbs == &tcp_tw_pcbs) {
+    struct tcp_pcb **link;
+    u32_t idx = tcp_conn_hash_index(&pcb->local_ip, pcb->local_port,
+                                    &pcb->remote_ip, pcb->remote_port);
+
+    for (link = &tcp_conn_hash[idx]; *link != NULL; link = &(*link)->hash_next) {
+      if (*link == pcb) {
+        *link = pcb->hash_next;
+        pcb->hash_next = NULL;
+        if (pcbs == &tcp_tw_pcbs) {
+          --tcp_demux_stats.time_wait;
+        } else {
+          --tcp_demux_stats.active;
+        }
+        return;
+      }
+    }
+  }
+}
+
+/**
+ * Finds the active or TIME-WAIT pcb of a connection. An active pcb is
+ * preferred over a TIME-WAIT one for the same connection.
+ *
+ * @return the pcb or NULL if there is no such connection
+ */
+struct tcp_pcb *
+tcp_hash_lookup(ip_addr_t *local_ip, u16_t local_port,
+                ip_addr_t *remote_ip, u16_t remote_port)
+{
+  struct tcp_pcb *pcb, *tw_pcb = NULL;
+  u32_t idx = tcp_conn_hash_index(local_ip, local_port, remote_ip, remote_port);
+
+  for (pcb = tcp_conn_hash[idx]; pcb != NULL; pcb = pcb->hash_next) {
+    LWIP_ASSERT("tcp_hash_lookup: pcb->state != CLOSED", pcb->state != CLOSED);
+    LWIP_ASSERT("tcp_hash_lookup: pcb->state != LISTEN", pcb->state != LISTEN);
+    if (pcb->remote_port == remote_port &&
+        pcb->local_port == local_port &&
+        ip_addr_cmp(&pcb->remote_ip, remote_ip) &&
+        ip_addr_cmp(&pcb->local_ip, local_ip)) {
+      if (pcb->state != TIME_WAIT) {
+        return pcb;
+      }
+      tw_pcb = pcb;
+    }
+  }
+  return tw_pcb;
+}
+
+/**
+ * Finds the listening pcb for a connection request. A pcb listening on the
+ * local address is preferred over one listening on any address.
+ *
+ * @return the pcb or NULL if nobody listens on the port
+ */
+struct tcp_pcb_listen *
+tcp_hash_lookup_listen(ip_addr_t *local_ip, u16_t local_port)
+{
+  struct tcp_pcb_listen *lpcb, *lpcb_any = NULL;
+
+  for (lpcb = tcp_listen_hash[TCP_LISTEN_HASH_INDEX(local_port)];
+       lpcb != NULL; lpcb = lpcb->hash_next) {
+    if (lpcb->local_port == local_port) {
+      if (ip_addr_cmp(&lpcb->local_ip, local_ip)) {
+        /* found an exact match */
+        return lpcb;
+      } else if (lpcb_any == NULL && ip_addr_isany(&lpcb->local_ip)) {
+        /* found an ANY-match, keep looking for an exact one */
+        lpcb_any = lpcb;
+      }
+    }
+  }
+  return lpcb_any;
+}
+
+/**
+ * Copies the counters of the pcb lookup tables.
+ *
+ * @param stats receives the counters
+ */
+void
+tcp_get_demux_stats(struct tcp_demux_stats *stats)
+{
+  *stats = tcp_demux_stats;
 }
 
 /**
@@ -172,7 +348,7 @@ tcp_close_shutdown(struct tcp_pcb *pcb, u8_t rst_on_unacked_data)
   err_t err;
 
   if (rst_on_unacked_data && ((pcb->state == ESTABLISHED) || (pcb->state == CLOSE_WAIT))) {
-    if ((pcb->refused_data != NULL) || (pcb->rcv_wnd != TCP_WND)) {
+    if ((pcb->refused_data != NULL) || (pcb->rcv_wnd != TCP_WND_MAX(pcb))) {
       /* Not all data received by application, send RST to tell the remote
          side about this. */
       LWIP_ASSERT("pcb->flags & TF_RXCLOSED", pcb->flags & TF_RXCLOSED);
@@ -550,6 +726,7 @@ tcp_listen_with_backlog(struct tcp_pcb *pcb, u8_t backlog)
   lpcb->local_port = pcb->local_port;
   lpcb->state = LISTEN;
   lpcb->prio = pcb->prio;
+  lpcb->rcv_wnd_max = pcb->rcv_wnd_max;
   lpcb->so_options = pcb->so_options;
   ip_set_option(lpcb, SOF_ACCEPTCONN);
   lpcb->ttl = pcb->ttl;
@@ -580,7 +757,7 @@ u32_t tcp_update_rcv_ann_wnd(struct tcp_pcb *pcb)
 {
   u32_t new_right_edge = pcb->rcv_nxt + pcb->rcv_wnd;
 
-  if (TCP_SEQ_GEQ(new_right_edge, pcb->rcv_ann_right_edge + LWIP_MIN((TCP_WND / 2), pcb->mss))) {
+  if (TCP_SEQ_GEQ(new_right_edge, pcb->rcv_ann_right_edge + LWIP_MIN((TCP_WND_MAX(pcb) / 2), pcb->mss))) {
     /* we can advertise more window */
     pcb->rcv_ann_wnd = pcb->rcv_wnd;
     return new_right_edge - pcb->rcv_ann_right_edge;
@@ -592,8 +769,10 @@ u32_t tcp_update_rcv_ann_wnd(struct tcp_pcb *pcb)
     } else {
       /* keep the right edge of window constant */
       u32_t new_rcv_ann_wnd = pcb->rcv_ann_right_edge - pcb->rcv_nxt;
+#if !LWIP_WND_SCALE
       LWIP_ASSERT("new_rcv_ann_wnd <= 0xffff", new_rcv_ann_wnd <= 0xffff);
-      pcb->rcv_ann_wnd = (u16_t)new_rcv_ann_wnd;
+#endif
+      pcb->rcv_ann_wnd = (tcpwnd_size_t)new_rcv_ann_wnd;
     }
     return 0;
   }
@@ -608,34 +787,84 @@ u32_t tcp_update_rcv_ann_wnd(struct tcp_pcb *pcb)
  * @param len the amount of bytes that have been read by the application
  */
 void
-tcp_recved(struct tcp_pcb *pcb, u16_t len)
+tcp_recved(struct tcp_pcb *pcb, tcpwnd_size_t len)
 {
-  int wnd_inflation;
+  u32_t wnd_inflation;
+  tcpwnd_size_t rcv_wnd;
 
   /* pcb->state LISTEN not allowed here */
   LWIP_ASSERT("don't call tcp_recved for listen-pcbs",
     pcb->state != LISTEN);
-  LWIP_ASSERT("tcp_recved: len would wrap rcv_wnd\n",
-              len <= 0xffff - pcb->rcv_wnd );
 
-  pcb->rcv_wnd += len;
-  if (pcb->rcv_wnd > TCP_WND) {
-    pcb->rcv_wnd = TCP_WND;
+  rcv_wnd = (tcpwnd_size_t)(pcb->rcv_wnd + len);
+  if ((rcv_wnd > TCP_WND_MAX(pcb)) || (rcv_wnd < pcb->rcv_wnd)) {
+    /* window got too big or tcpwnd_size_t overflow */
+    pcb->rcv_wnd = TCP_WND_MAX(pcb);
+  } else {
+    pcb->rcv_wnd = rcv_wnd;
   }
 
   wnd_inflation = tcp_update_rcv_ann_wnd(pcb);
 
   /* If the change in the right edge of window is significant (default
-   * watermark is TCP_WND/4), then send an explicit update now.
+   * watermark is TCP_WND/4, or a quarter of a smaller receive buffer),
+   * then send an explicit update now.
    * Otherwise wait for a packet to be sent in the normal course of
    * events (or more window to be available later) */
-  if (wnd_inflation >= TCP_WND_UPDATE_THRESHOLD) {
+  if (wnd_inflation >= LWIP_MIN(TCP_WND_UPDATE_THRESHOLD, TCP_WND_MAX(pcb) / 4)) {
     tcp_ack_now(pcb);
     tcp_output(pcb);
   }
 
-  LWIP_DEBUGF(TCP_DEBUG, ("tcp_recved: recveived %"U16_F" bytes, wnd %"U16_F" (%"U16_F").\n",
-         len, pcb->rcv_wnd, TCP_WND - pcb->rcv_wnd));
+  LWIP_DEBUGF(TCP_DEBUG, ("tcp_recved: recveived %"TCPWNDSIZE_F" bytes, wnd %"TCPWNDSIZE_F" (%"TCPWNDSIZE_F").\n",
+         len, pcb->rcv_wnd, TCP_WND_MAX(pcb) - pcb->rcv_wnd));
+}
+
+/**
+ * Set the receive buffer size of a pcb, which is the largest window
+ * that is advertised to the remote host. Connections accepted on a
+ * listening pcb start out with the listener's size.
+ *
+ * Growing the buffer of a connected pcb opens the window right away,
+ * shrinking it only limits how far the window is reopened, the right
+ * edge that was already announced is never retracted.
+ *
+ * @param pcb the tcp_pcb (listening or not) to change
+ * @param size the new receive buffer size in bytes
+ */
+void
+tcp_setrcvbuf(struct tcp_pcb *pcb, tcpwnd_size_t size)
+{
+  tcpwnd_size_t old_max;
+
+  if (size < TCP_MSS) {
+    size = TCP_MSS;
+  } else if (size > TCP_WND_LIMIT) {
+    size = TCP_WND_LIMIT;
+  }
+
+  old_max = TCP_WND_MAX(pcb);
+  pcb->rcv_wnd_max = size;
+
+  switch (pcb->state) {
+  case LISTEN:
+    break;
+  case CLOSED:
+    /* Until window scaling is negotiated the window must fit in 16 bits */
+    pcb->rcv_wnd = pcb->rcv_ann_wnd = TCPWND16(size);
+    break;
+  case SYN_SENT:
+  case SYN_RCVD:
+    pcb->rcv_wnd = LWIP_MIN(pcb->rcv_wnd, TCP_WND_MAX(pcb));
+    break;
+  default:
+    if (TCP_WND_MAX(pcb) > old_max) {
+      tcp_recved(pcb, TCP_WND_MAX(pcb) - old_max);
+    } else if (pcb->rcv_wnd > TCP_WND_MAX(pcb)) {
+      pcb->rcv_wnd = TCP_WND_MAX(pcb);
+    }
+    break;
+  }
 }
 
 /**
@@ -743,8 +972,9 @@ tcp_connect(struct tcp_pcb *pcb, ip_addr_t *ipaddr, u16_t port,
   pcb->snd_nxt = iss;
   pcb->lastack = iss - 1;
   pcb->snd_lbb = iss - 1;
-  pcb->rcv_wnd = TCP_WND;
-  pcb->rcv_ann_wnd = TCP_WND;
+  /* Start with a window that does not need scaling. When window scaling is
+     enabled and used, the window is enlarged when both sides agree on scaling. */
+  pcb->rcv_wnd = pcb->rcv_ann_wnd = TCPWND16(pcb->rcv_wnd_max);
   pcb->rcv_ann_right_edge = pcb->rcv_nxt;
   pcb->snd_wnd = TCP_WND;
   /* As initial send MSS, we use TCP_MSS but limit it to 536.
@@ -788,10 +1018,13 @@ void
 tcp_slowtmr(void)
 {
   struct tcp_pcb *pcb, *prev;
-  u16_t eff_wnd;
+  tcpwnd_size_t eff_wnd;
   u8_t pcb_remove;      /* flag if a PCB should be removed */
   u8_t pcb_reset;       /* flag if a RST should be sent when removing */
   err_t err;
+#if TCP_TW_MAX
+  u32_t tw_count = 0;   /* TIME-WAIT PCBs kept so far */
+#endif /* TCP_TW_MAX */
 
   err = ERR_OK;
 
@@ -867,8 +1100,8 @@ tcp_slowtmr_start:
             pcb->ssthresh = (pcb->mss << 1);
           }
           pcb->cwnd = pcb->mss;
-          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: cwnd %"U16_F
-                                       " ssthresh %"U16_F"\n",
+          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: cwnd %"TCPWNDSIZE_F
+                                       " ssthresh %"TCPWNDSIZE_F"\n",
                                        pcb->cwnd, pcb->ssthresh));
  
           /* The following needs to be called AFTER cwnd is set to one
@@ -950,6 +1183,7 @@ tcp_slowtmr_start:
       void *err_arg;
       tcp_pcb_purge(pcb);
       /* Remove PCB from tcp_active_pcbs list. */
+      tcp_hash_rmv(&tcp_active_pcbs, pcb);
       if (prev != NULL) {
         LWIP_ASSERT("tcp_slowtmr: middle tcp != tcp_active_pcbs", pcb != tcp_active_pcbs);
         prev->next = pcb->next;
@@ -1010,14 +1244,20 @@ tcp_slowtmr_start:
     if ((u32_t)(tcp_ticks - pcb->tmr) > 2 * TCP_MSL / TCP_SLOW_INTERVAL) {
       ++pcb_remove;
     }
-    
-
+#if TCP_TW_MAX
+    /* New PCBs are put in front, so the ones past the limit are the oldest */
+    else if (++tw_count > TCP_TW_MAX) {
+      ++pcb_remove;
+      ++tcp_demux_stats.tw_evicted;
+    }
+#endif /* TCP_TW_MAX */
 
     /* If the PCB should be removed, do it. */
     if (pcb_remove) {
       struct tcp_pcb *pcb2;
       tcp_pcb_purge(pcb);
       /* Remove PCB from tcp_tw_pcbs list. */
+      tcp_hash_rmv(&tcp_tw_pcbs, pcb);
       if (prev != NULL) {
         LWIP_ASSERT("tcp_slowtmr: middle tcp != tcp_tw_pcbs", pcb != tcp_tw_pcbs);
         prev->next = pcb->next;
@@ -1098,7 +1338,7 @@ tcp_process_refused_data(struct tcp_pcb *pcb)
     if (refused_flags & PBUF_FLAG_TCP_FIN) {
       /* correct rcv_wnd as the application won't call tcp_recved()
          for the FIN's seqno */
-      if (pcb->rcv_wnd != TCP_WND) {
+      if (pcb->rcv_wnd != TCP_WND_MAX(pcb)) {
         pcb->rcv_wnd++;
       }
       TCP_EVENT_CLOSED(pcb, err);
@@ -1168,7 +1408,10 @@ tcp_setprio(struct tcp_pcb *pcb, u8_t prio)
 #if TCP_QUEUE_OOSEQ
 /**
  * Returns a copy of the given TCP segment.
- * The pbuf and data are not copied, only the pointers
+ * The pbuf and data are not copied, only the pointers, unless the pbuf
+ * chain references memory owned by the driver (PBUF_REF). Those are only
+ * valid while the packet is input, so the data is copied along with the
+ * TCP header.
  *
  * @param seg the old tcp_seg
  * @return a copy of seg
@@ -1177,13 +1420,35 @@ struct tcp_seg *
 tcp_seg_copy(struct tcp_seg *seg)
 {
   struct tcp_seg *cseg;
+  struct pbuf *q;
 
   cseg = (struct tcp_seg *)memp_malloc(MEMP_TCP_SEG);
   if (cseg == NULL) {
     return NULL;
   }
   SMEMCPY((u8_t *)cseg, (const u8_t *)seg, sizeof(struct tcp_seg)); 
-  pbuf_ref(cseg->p);
+
+  for (q = seg->p; q != NULL; q = q->next) {
+    if (q->type == PBUF_REF) {
+      break;
+    }
+  }
+  if (q == NULL) {
+    pbuf_ref(cseg->p);
+    return cseg;
+  }
+
+  cseg->p = pbuf_alloc(PBUF_TRANSPORT, seg->p->tot_len, PBUF_RAM);
+  if (cseg->p == NULL) {
+    memp_free(MEMP_TCP_SEG, cseg);
+    return NULL;
+  }
+  pbuf_copy_partial(seg->p, cseg->p->payload, seg->p->tot_len, 0);
+  /* keep the header in front of the data, like in the original pbuf */
+  pbuf_header(cseg->p, TCP_HLEN);
+  SMEMCPY(cseg->p->payload, seg->tcphdr, TCP_HLEN);
+  cseg->tcphdr = (struct tcp_hdr *)cseg->p->payload;
+  pbuf_header(cseg->p, -TCP_HLEN);
   return cseg;
 }
 #endif /* TCP_QUEUE_OOSEQ */
@@ -1308,8 +1573,10 @@ tcp_alloc(u8_t prio)
     pcb->prio = prio;
     pcb->snd_buf = TCP_SND_BUF;
     pcb->snd_queuelen = 0;
-    pcb->rcv_wnd = TCP_WND;
-    pcb->rcv_ann_wnd = TCP_WND;
+    /* Start with a window that does not need scaling. When window scaling is
+       enabled and used, the window is enlarged when both sides agree on scaling. */
+    pcb->rcv_wnd_max = TCP_WND;
+    pcb->rcv_wnd = pcb->rcv_ann_wnd = TCPWND16(TCP_WND);
     pcb->tos = 0;
     pcb->ttl = TCP_TTL;
     /* As initial send MSS, we use TCP_MSS but limit it to 536.
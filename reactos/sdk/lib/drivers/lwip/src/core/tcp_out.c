@@ -105,7 +105,7 @@ tcp_output_alloc_header(struct tcp_pcb *pcb, u16_t optlen, u16_t datalen,
     tcphdr->seqno = seqno_be;
     tcphdr->ackno = htonl(pcb->rcv_nxt);
     TCPH_HDRLEN_FLAGS_SET(tcphdr, (5 + optlen / 4), TCP_ACK);
-    tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+    tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
     tcphdr->chksum = 0;
     tcphdr->urgp = 0;
 
@@ -306,7 +306,7 @@ tcp_write_checks(struct tcp_pcb *pcb, u16_t len)
 
   /* fail on too much data */
   if (len > pcb->snd_buf) {
-    LWIP_DEBUGF(TCP_OUTPUT_DEBUG | 3, ("tcp_write: too much data (len=%"U16_F" > snd_buf=%"U16_F")\n",
+    LWIP_DEBUGF(TCP_OUTPUT_DEBUG | 3, ("tcp_write: too much data (len=%"U16_F" > snd_buf=%"TCPWNDSIZE_F")\n",
       len, pcb->snd_buf));
     pcb->flags |= TF_NAGLEMEMERR;
     return ERR_MEM;
@@ -334,6 +334,37 @@ tcp_write_checks(struct tcp_pcb *pcb, u16_t len)
   return ERR_OK;
 }
 
+#if TCP_LSO
+/**
+ * Size of the segments tcp_write builds. Interfaces doing large send offload
+ * get as many full frames in one segment as fit in netif->lso_max.
+ *
+ * @param pcb the tcp_pcb to build segments for
+ * @param mss_local size of a normal segment (data and options)
+ * @param optlen length of the options in each segment
+ * @return the size of a segment (data and options)
+ */
+static u16_t
+tcp_lso_seg_size(struct tcp_pcb *pcb, u16_t mss_local, u8_t optlen)
+{
+  struct netif *netif;
+  u16_t frame_data = pcb->mss - optlen;
+  u32_t frames;
+
+  netif = ip_route(&(pcb->remote_ip));
+  if ((netif == NULL) || (netif->lso_max == 0)) {
+    return mss_local;
+  }
+
+  /* don't allocate segments bigger than half the maximum window we ever received */
+  frames = LWIP_MIN(netif->lso_max, pcb->snd_wnd_max / 2) / frame_data;
+  if (frames < 2) {
+    return mss_local;
+  }
+  return (u16_t)(frames * frame_data + optlen);
+}
+#endif /* TCP_LSO */
+
 /**
  * Write data for sending (but does not send it immediately).
  *
@@ -370,7 +401,7 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
 #endif /* TCP_CHECKSUM_ON_COPY */
   err_t err;
   /* don't allocate segments bigger than half the maximum window we ever received */
-  u16_t mss_local = LWIP_MIN(pcb->mss, pcb->snd_wnd_max/2);
+  u16_t mss_local = (u16_t)LWIP_MIN(pcb->mss, pcb->snd_wnd_max/2);
 
 #if LWIP_NETIF_TX_SINGLE_PBUF
   /* Always copy to try to create single pbufs for TX */
@@ -395,6 +426,9 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
   }
 #endif /* LWIP_TCP_TIMESTAMPS */
 
+#if TCP_LSO
+  mss_local = tcp_lso_seg_size(pcb, mss_local, optlen);
+#endif /* TCP_LSO */
 
   /*
    * TCP segmentation is done in three phases with increasing complexity:
@@ -742,6 +776,18 @@ tcp_enqueue_flags(struct tcp_pcb *pcb, u8_t flags)
 
   if (flags & TCP_SYN) {
     optflags = TF_SEG_OPTS_MSS;
+#if LWIP_WND_SCALE
+    /* Always offer window scaling in a SYN, only answer with it when
+       the remote host offered it */
+    if (!(flags & TCP_ACK) || (pcb->flags & TF_WND_SCALE)) {
+      optflags |= TF_SEG_OPTS_WND_SCALE;
+    }
+#endif /* LWIP_WND_SCALE */
+#if LWIP_TCP_SACK_OUT
+    if (!(flags & TCP_ACK) || (pcb->flags & TF_SACK)) {
+      optflags |= TF_SEG_OPTS_SACK_PERM;
+    }
+#endif /* LWIP_TCP_SACK_OUT */
   }
 #if LWIP_TCP_TIMESTAMPS
   if ((pcb->flags & TF_TIMESTAMP)) {
@@ -834,6 +880,78 @@ tcp_build_timestamp_option(struct tcp_pcb *pcb, u32_t *opts)
 }
 #endif
 
+#if LWIP_WND_SCALE
+/** Build a window scale option (3 bytes long) at the specified options pointer
+ *
+ * @param opts option pointer where to store the window scale option
+ */
+static void
+tcp_build_wnd_scale_option(u32_t *opts)
+{
+  /* Pad with one NOP option to make everything nicely aligned */
+  opts[0] = PP_HTONL(0x01030300 | TCP_RCV_SCALE);
+}
+#endif
+
+#if LWIP_TCP_SACK_OUT
+/** Collect the out-of-sequence data we hold as SACK blocks (RFC 2018).
+ * Adjacent segments on the ooseq queue are reported as one block. The block
+ * holding the most recently received segment comes first, the others follow
+ * in sequence order.
+ *
+ * @param pcb tcp_pcb
+ * @param blocks where to store the left and right edges (host byte order)
+ * @param max_blocks maximum number of blocks to collect
+ * @return the number of blocks collected
+ */
+static u8_t
+tcp_get_sack_blocks(struct tcp_pcb *pcb, u32_t *blocks, u8_t max_blocks)
+{
+  struct tcp_seg *seg;
+  u32_t left, right;
+  u8_t num = 0;
+  u8_t recent, pass;
+
+  /* The first pass only picks the block of the latest segment */
+  for (pass = 0; pass < 2; pass++) {
+    seg = pcb->ooseq;
+    while ((seg != NULL) && (num < max_blocks)) {
+      /* ooseq segments keep their seqno in host byte order */
+      left = seg->tcphdr->seqno;
+      right = left + TCP_TCPLEN(seg);
+      for (seg = seg->next; (seg != NULL) && (seg->tcphdr->seqno == right); seg = seg->next) {
+        right += TCP_TCPLEN(seg);
+      }
+      recent = TCP_SEQ_BETWEEN(pcb->ooseq_recent, left, right - 1);
+      if ((pass == 0) == (recent != 0)) {
+        blocks[2 * num] = left;
+        blocks[2 * num + 1] = right;
+        num++;
+      }
+    }
+  }
+  return num;
+}
+
+/* Build a SACK option (2 + 8 * num bytes long) at the specified options pointer
+ *
+ * @param opts option pointer where to store the SACK option
+ * @param blocks the blocks from tcp_get_sack_blocks()
+ * @param num the number of blocks
+ */
+static void
+tcp_build_sack_option(u32_t *opts, u32_t *blocks, u8_t num)
+{
+  u8_t i;
+
+  /* Pad with two NOP options to make everything nicely aligned */
+  opts[0] = htonl(0x01010500 | (2 + 8 * num));
+  for (i = 0; i < 2 * num; i++) {
+    opts[1 + i] = htonl(blocks[i]);
+  }
+}
+#endif /* LWIP_TCP_SACK_OUT */
+
 /** Send an ACK without data.
  *
  * @param pcb Protocol control block for the TCP connection to send the ACK
@@ -844,12 +962,26 @@ tcp_send_empty_ack(struct tcp_pcb *pcb)
   struct pbuf *p;
   struct tcp_hdr *tcphdr;
   u8_t optlen = 0;
+#if LWIP_TCP_SACK_OUT
+  u32_t sack_blocks[2 * LWIP_TCP_MAX_SACK_NUM];
+  u8_t sack_num = 0;
+#endif
 
 #if LWIP_TCP_TIMESTAMPS
   if (pcb->flags & TF_TIMESTAMP) {
     optlen = LWIP_TCP_OPT_LENGTH(TF_SEG_OPTS_TS);
   }
 #endif
+#if LWIP_TCP_SACK_OUT
+  if ((pcb->flags & TF_SACK) && (pcb->ooseq != NULL)) {
+    /* As many blocks as fit in the 40 bytes of option space */
+    sack_num = tcp_get_sack_blocks(pcb, sack_blocks,
+                                   LWIP_MIN(LWIP_TCP_MAX_SACK_NUM, (40 - optlen - 4) / 8));
+    if (sack_num > 0) {
+      optlen += 4 + 8 * sack_num;
+    }
+  }
+#endif
 
   p = tcp_output_alloc_header(pcb, optlen, 0, htonl(pcb->snd_nxt));
   if (p == NULL) {
@@ -870,6 +1002,17 @@ tcp_send_empty_ack(struct tcp_pcb *pcb)
     tcp_build_timestamp_option(pcb, (u32_t *)(tcphdr + 1));
   }
 #endif 
+#if LWIP_TCP_SACK_OUT
+  if (sack_num > 0) {
+    u32_t *opts = (u32_t *)(void *)(tcphdr + 1);
+#if LWIP_TCP_TIMESTAMPS
+    if (pcb->flags & TF_TIMESTAMP) {
+      opts += 3;
+    }
+#endif
+    tcp_build_sack_option(opts, sack_blocks, sack_num);
+  }
+#endif
 
 #if CHECKSUM_GEN_TCP
   tcphdr->chksum = inet_chksum_pseudo(p, &(pcb->local_ip), &(pcb->remote_ip),
@@ -887,6 +1030,103 @@ tcp_send_empty_ack(struct tcp_pcb *pcb)
   return ERR_OK;
 }
 
+#if TCP_LSO
+/**
+ * Split an unsent segment in two, so that the first part can go out.
+ * The second part is queued after the first.
+ *
+ * @param pcb the tcp_pcb the segment belongs to
+ * @param seg the segment to split
+ * @param split amount of data to keep in seg
+ * @return ERR_OK if seg was split, another err_t if it was left alone
+ */
+static err_t
+tcp_split_unsent_seg(struct tcp_pcb *pcb, struct tcp_seg *seg, u16_t split)
+{
+  struct tcp_seg *rest;
+  struct pbuf *p;
+  u8_t optflags = 0;
+  u8_t optlen;
+  u16_t remainder = seg->len - split;
+  u16_t offset;
+
+#if LWIP_TCP_TIMESTAMPS
+  optflags = seg->flags & TF_SEG_OPTS_TS;
+#endif /* LWIP_TCP_TIMESTAMPS */
+  optlen = LWIP_TCP_OPT_LENGTH(optflags);
+
+  if ((split == 0) || (remainder == 0)) {
+    return ERR_VAL;
+  }
+
+  p = pbuf_alloc(PBUF_TRANSPORT, remainder + optlen, PBUF_RAM);
+  if (p == NULL) {
+    return ERR_MEM;
+  }
+
+  /* seg->p->payload points to the IP header if the segment was sent before */
+  offset = (u16_t)((u8_t *)seg->tcphdr - (u8_t *)seg->p->payload) + TCP_HLEN + optlen + split;
+  if (pbuf_copy_partial(seg->p, (u8_t *)p->payload + optlen, remainder, offset) != remainder) {
+    pbuf_free(p);
+    return ERR_BUF;
+  }
+
+  /* the rest takes over PSH and FIN */
+  rest = tcp_create_segment(pcb, p, TCPH_FLAGS(seg->tcphdr) & (TCP_PSH | TCP_FIN),
+                            ntohl(seg->tcphdr->seqno) + split, optflags);
+  if (rest == NULL) {
+    return ERR_MEM;
+  }
+  TCPH_HDRLEN_FLAGS_SET(seg->tcphdr, TCPH_HDRLEN(seg->tcphdr),
+                        TCPH_FLAGS(seg->tcphdr) & ~(TCP_PSH | TCP_FIN));
+
+  pcb->snd_queuelen -= pbuf_clen(seg->p);
+  pbuf_realloc(seg->p, seg->p->tot_len - remainder);
+  seg->len = split;
+  pcb->snd_queuelen += pbuf_clen(seg->p) + pbuf_clen(rest->p);
+
+  rest->next = seg->next;
+  seg->next = rest;
+#if TCP_OVERSIZE
+  /* the rest is sized to fit exactly */
+  if (rest->next == NULL) {
+    pcb->unsent_oversize = 0;
+  }
+#if TCP_OVERSIZE_DBGCHECK
+  seg->oversize_left = 0;
+#endif /* TCP_OVERSIZE_DBGCHECK */
+#endif /* TCP_OVERSIZE */
+
+  return ERR_OK;
+}
+
+/**
+ * Check whether the first unsent segment fits in the send window. Segments
+ * built for large send offload are cut down to the frames that fit, so they
+ * go out as the congestion window allows instead of all at once.
+ *
+ * @param pcb the tcp_pcb to send for
+ * @param seg the first unsent segment
+ * @param wnd the send window
+ * @return 1 if seg can be sent now, 0 if not
+ */
+static u8_t
+tcp_lso_seg_fits(struct tcp_pcb *pcb, struct tcp_seg *seg, u32_t wnd)
+{
+  u32_t used = ntohl(seg->tcphdr->seqno) - pcb->lastack;
+  u8_t optlen = LWIP_TCP_OPT_LENGTH(seg->flags);
+  u16_t frame_data = pcb->mss - optlen;
+
+  if (used + seg->len <= wnd) {
+    return 1;
+  }
+  if ((seg->len <= frame_data) || (used + frame_data > wnd)) {
+    return 0;
+  }
+  return tcp_split_unsent_seg(pcb, seg, (u16_t)(((wnd - used) / frame_data) * frame_data)) == ERR_OK;
+}
+#endif /* TCP_LSO */
+
 /**
  * Find out what we can send and send it
  *
@@ -945,13 +1185,13 @@ tcp_output(struct tcp_pcb *pcb)
 #endif /* TCP_OUTPUT_DEBUG */
 #if TCP_CWND_DEBUG
   if (seg == NULL) {
-    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_output: snd_wnd %"U16_F
-                                 ", cwnd %"U16_F", wnd %"U32_F
+    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_output: snd_wnd %"TCPWNDSIZE_F
+                                 ", cwnd %"TCPWNDSIZE_F", wnd %"U32_F
                                  ", seg == NULL, ack %"U32_F"\n",
                                  pcb->snd_wnd, pcb->cwnd, wnd, pcb->lastack));
   } else {
     LWIP_DEBUGF(TCP_CWND_DEBUG, 
-                ("tcp_output: snd_wnd %"U16_F", cwnd %"U16_F", wnd %"U32_F
+                ("tcp_output: snd_wnd %"TCPWNDSIZE_F", cwnd %"TCPWNDSIZE_F", wnd %"U32_F
                  ", effwnd %"U32_F", seq %"U32_F", ack %"U32_F"\n",
                  pcb->snd_wnd, pcb->cwnd, wnd,
                  ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len,
@@ -960,7 +1200,11 @@ tcp_output(struct tcp_pcb *pcb)
 #endif /* TCP_CWND_DEBUG */
   /* data available and window allows it to be sent? */
   while (seg != NULL &&
+#if TCP_LSO
+         tcp_lso_seg_fits(pcb, seg, wnd)) {
+#else /* TCP_LSO */
          ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len <= wnd) {
+#endif /* TCP_LSO */
     LWIP_ASSERT("RST not expected here!", 
                 (TCPH_FLAGS(seg->tcphdr) & TCP_RST) == 0);
     /* Stop sending if the nagle algorithm would prevent it
@@ -974,8 +1218,16 @@ tcp_output(struct tcp_pcb *pcb)
       ((pcb->flags & (TF_NAGLEMEMERR | TF_FIN)) == 0)){
       break;
     }
+#if LWIP_TCP_CORK
+    /* A corked pcb keeps the last segment until it is full, unless a
+       FIN follows it */
+    if ((pcb->flags & TF_CORK) && (seg->next == NULL) && (seg->len < pcb->mss) &&
+        ((pcb->flags & TF_FIN) == 0)) {
+      break;
+    }
+#endif /* LWIP_TCP_CORK */
 #if TCP_CWND_DEBUG
-    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_output: snd_wnd %"U16_F", cwnd %"U16_F", wnd %"U32_F", effwnd %"U32_F", seq %"U32_F", ack %"U32_F", i %"S16_F"\n",
+    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_output: snd_wnd %"TCPWNDSIZE_F", cwnd %"TCPWNDSIZE_F", wnd %"U32_F", effwnd %"U32_F", seq %"U32_F", ack %"U32_F", i %"S16_F"\n",
                             pcb->snd_wnd, pcb->cwnd, wnd,
                             ntohl(seg->tcphdr->seqno) + seg->len -
                             pcb->lastack,
@@ -1059,8 +1311,14 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
    wnd fields remain. */
   seg->tcphdr->ackno = htonl(pcb->rcv_nxt);
 
-  /* advertise our receive window size in this TCP segment */
-  seg->tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+  if (TCPH_FLAGS(seg->tcphdr) & TCP_SYN) {
+    /* The Window field in a SYN segment itself (the only type where we send
+       the window scale option) is never scaled. */
+    seg->tcphdr->wnd = htons(TCPWND16(pcb->rcv_ann_wnd));
+  } else {
+    /* advertise our receive window size in this TCP segment */
+    seg->tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
+  }
 
   pcb->rcv_ann_right_edge = pcb->rcv_nxt + pcb->rcv_ann_wnd;
 
@@ -1085,6 +1343,19 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
     opts += 3;
   }
 #endif
+#if LWIP_WND_SCALE
+  if (seg->flags & TF_SEG_OPTS_WND_SCALE) {
+    tcp_build_wnd_scale_option(opts);
+    opts += 1;
+  }
+#endif
+#if LWIP_TCP_SACK_OUT
+  if (seg->flags & TF_SEG_OPTS_SACK_PERM) {
+    /* Pad with two NOP options to make everything nicely aligned */
+    *opts = PP_HTONL(0x01010402);
+    opts += 1;
+  }
+#endif
 
   /* Set retransmission timer running if it is not currently enabled 
      This must be set before checking the route. */
@@ -1092,13 +1363,13 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
     pcb->rtime = 0;
   }
 
-  /* If we don't have a local IP address, we get one by
-     calling ip_route(). */
+  /* The interface decides which checksums we do, and if we don't have
+     a local IP address, we use its one. */
+  netif = ip_route(&(pcb->remote_ip));
+  if (netif == NULL) {
+    return;
+  }
   if (ip_addr_isany(&(pcb->local_ip))) {
-    netif = ip_route(&(pcb->remote_ip));
-    if (netif == NULL) {
-      return;
-    }
     ip_addr_copy(pcb->local_ip, netif->ip_addr);
   }
 
@@ -1121,6 +1392,7 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
 
   seg->tcphdr->chksum = 0;
 #if CHECKSUM_GEN_TCP
+  IF__NETIF_CHECKSUM_ENABLED(netif, NETIF_CHECKSUM_GEN_TCP) {
 #if TCP_CHECKSUM_ON_COPY
   {
     u32_t acc;
@@ -1159,7 +1431,15 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
          &(pcb->remote_ip),
          IP_PROTO_TCP, seg->p->tot_len);
 #endif /* TCP_CHECKSUM_ON_COPY */
+  }
 #endif /* CHECKSUM_GEN_TCP */
+#if TCP_LSO
+  /* Segments built for large send offload are cut into frames of this much data */
+  seg->p->lso_mss = 0;
+  if (seg->len > pcb->mss - (LWIP_TCP_OPT_LENGTH(seg->flags))) {
+    seg->p->lso_mss = pcb->mss - (LWIP_TCP_OPT_LENGTH(seg->flags));
+  }
+#endif /* TCP_LSO */
   TCP_STATS_INC(tcp.xmit);
 
 #if LWIP_NETIF_HWADDRHINT
@@ -1212,7 +1492,7 @@ tcp_rst(u32_t seqno, u32_t ackno,
   tcphdr->seqno = htonl(seqno);
   tcphdr->ackno = htonl(ackno);
   TCPH_HDRLEN_FLAGS_SET(tcphdr, TCP_HLEN/4, TCP_RST | TCP_ACK);
-  tcphdr->wnd = PP_HTONS(TCP_WND);
+  tcphdr->wnd = PP_HTONS(TCPWND16(TCP_WND >> TCP_RCV_SCALE));
   tcphdr->chksum = 0;
   tcphdr->urgp = 0;
 
@@ -1340,7 +1620,7 @@ tcp_rexmit_fast(struct tcp_pcb *pcb)
     /* The minimum value for ssthresh should be 2 MSS */
     if (pcb->ssthresh < 2*pcb->mss) {
       LWIP_DEBUGF(TCP_FR_DEBUG, 
-                  ("tcp_receive: The minimum value for ssthresh %"U16_F
+                  ("tcp_receive: The minimum value for ssthresh %"TCPWNDSIZE_F
                    " should be min 2 mss %"U16_F"...\n",
                    pcb->ssthresh, 2*pcb->mss));
       pcb->ssthresh = 2*pcb->mss;
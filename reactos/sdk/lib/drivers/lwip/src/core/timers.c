@@ -62,9 +62,11 @@
 
 /** The one and only timeout list */
 static struct sys_timeo *next_timeout;
-#if NO_SYS
 static u32_t timeouts_last_time;
-#endif /* NO_SYS */
+#if !NO_SYS
+/** The mbox sys_timeouts_mbox_fetch() waits on, woken when the first timeout changes */
+static sys_mbox_t *timeouts_mbox;
+#endif /* !NO_SYS */
 
 #if LWIP_TCP
 /** global variable that shows if the tcp timer is currently scheduled or not */
@@ -222,6 +224,9 @@ dns_timer(void *arg)
 /** Initialize this module */
 void sys_timeouts_init(void)
 {
+  /* Initialise timestamp for sys_check_timeouts and sys_timeouts_mbox_fetch */
+  timeouts_last_time = sys_now();
+
 #if IP_REASSEMBLY
   sys_timeout(IP_TMR_INTERVAL, ip_reass_timer, NULL);
 #endif /* IP_REASSEMBLY */
@@ -241,11 +246,6 @@ void sys_timeouts_init(void)
 #if LWIP_DNS
   sys_timeout(DNS_TMR_INTERVAL, dns_timer, NULL);
 #endif /* LWIP_DNS */
-
-#if NO_SYS
-  /* Initialise timestamp for sys_check_timeouts */
-  timeouts_last_time = sys_now();
-#endif
 }
 
 /**
@@ -254,6 +254,9 @@ void sys_timeouts_init(void)
  * - while waiting for a message using sys_timeouts_mbox_fetch()
  * - by calling sys_check_timeouts() (NO_SYS==1 only)
  *
+ * With LWIP_TCPIP_CORE_LOCKING, this may be called from any thread as long
+ * as the core lock is held.
+ *
  * @param msecs time in milliseconds after that the timer should expire
  * @param handler callback function to call when msecs have elapsed
  * @param arg argument to pass to the callback function
@@ -273,6 +276,10 @@ sys_timeout(u32_t msecs, sys_timeout_handler handler, void *arg)
     LWIP_ASSERT("sys_timeout: timeout != NULL, pool MEMP_SYS_TIMEOUT is empty", timeout != NULL);
     return;
   }
+#if !NO_SYS
+  /* The list counts from the last time sys_timeouts_mbox_fetch() aged it */
+  msecs += sys_now() - timeouts_last_time;
+#endif /* !NO_SYS */
   timeout->next = NULL;
   timeout->h = handler;
   timeout->arg = arg;
@@ -285,6 +292,12 @@ sys_timeout(u32_t msecs, sys_timeout_handler handler, void *arg)
 
   if (next_timeout == NULL) {
     next_timeout = timeout;
+#if !NO_SYS
+    /* The tcpip thread may be sleeping without a timeout */
+    if (timeouts_mbox != NULL) {
+      sys_mbox_wake(timeouts_mbox);
+    }
+#endif /* !NO_SYS */
     return;
   }
 
@@ -292,6 +305,12 @@ sys_timeout(u32_t msecs, sys_timeout_handler handler, void *arg)
     next_timeout->time -= msecs;
     timeout->next = next_timeout;
     next_timeout = timeout;
+#if !NO_SYS
+    /* The tcpip thread may be sleeping for longer than this */
+    if (timeouts_mbox != NULL) {
+      sys_mbox_wake(timeouts_mbox);
+    }
+#endif /* !NO_SYS */
   } else {
     for(t = next_timeout; t != NULL; t = t->next) {
       timeout->time -= t->time;
@@ -416,6 +435,10 @@ sys_restart_timeouts(void)
  * Wait (forever) for a message to arrive in an mbox.
  * While waiting, timeouts are processed.
  *
+ * Other threads add timeouts with the core lock held, so the timeout list
+ * is only touched with it held here as well. It is dropped while waiting,
+ * sys_timeout() wakes the mbox if the first timeout changes meanwhile.
+ *
  * @param mbox the mbox to fetch the message from
  * @param msg the place to store the message
  */
@@ -423,56 +446,62 @@ void
 sys_timeouts_mbox_fetch(sys_mbox_t *mbox, void **msg)
 {
   u32_t time_needed;
+  u32_t sleeptime;
+  u32_t now, diff;
   struct sys_timeo *tmptimeout;
   sys_timeout_handler handler;
   void *arg;
 
  again:
-  if (!next_timeout) {
-    time_needed = sys_arch_mbox_fetch(mbox, msg, 0);
-  } else {
-    if (next_timeout->time > 0) {
-      time_needed = sys_arch_mbox_fetch(mbox, msg, next_timeout->time);
+  LOCK_TCPIP_CORE();
+  timeouts_mbox = mbox;
+
+  /* Age the list by the time that passed since we last looked at it */
+  now = sys_now();
+  diff = now - timeouts_last_time;
+  timeouts_last_time = now;
+  for (tmptimeout = next_timeout; tmptimeout != NULL && diff != 0; tmptimeout = tmptimeout->next) {
+    if (tmptimeout->time > diff) {
+      tmptimeout->time -= diff;
+      diff = 0;
     } else {
-      time_needed = SYS_ARCH_TIMEOUT;
+      diff -= tmptimeout->time;
+      tmptimeout->time = 0;
     }
+  }
 
-    if (time_needed == SYS_ARCH_TIMEOUT) {
-      /* If time == SYS_ARCH_TIMEOUT, a timeout occured before a message
-         could be fetched. We should now call the timeout handler and
-         deallocate the memory allocated for the timeout. */
-      tmptimeout = next_timeout;
-      next_timeout = tmptimeout->next;
-      handler = tmptimeout->h;
-      arg = tmptimeout->arg;
+  if (next_timeout != NULL && next_timeout->time == 0) {
+    /* The first timeout expired, call its handler and deallocate it */
+    tmptimeout = next_timeout;
+    next_timeout = tmptimeout->next;
+    handler = tmptimeout->h;
+    arg = tmptimeout->arg;
 #if LWIP_DEBUG_TIMERNAMES
-      if (handler != NULL) {
-        LWIP_DEBUGF(TIMERS_DEBUG, ("stmf calling h=%s arg=%p\n",
-          tmptimeout->handler_name, arg));
-      }
+    if (handler != NULL) {
+      LWIP_DEBUGF(TIMERS_DEBUG, ("stmf calling h=%s arg=%p\n",
+        tmptimeout->handler_name, arg));
+    }
 #endif /* LWIP_DEBUG_TIMERNAMES */
-      memp_free(MEMP_SYS_TIMEOUT, tmptimeout);
-      if (handler != NULL) {
-        /* For LWIP_TCPIP_CORE_LOCKING, lock the core before calling the
-           timeout handler function. */
-        LOCK_TCPIP_CORE();
-        handler(arg);
-        UNLOCK_TCPIP_CORE();
-      }
-      LWIP_TCPIP_THREAD_ALIVE();
-
-      /* We try again to fetch a message from the mbox. */
-      goto again;
-    } else {
-      /* If time != SYS_ARCH_TIMEOUT, a message was received before the timeout
-         occured. The time variable is set to the number of
-         milliseconds we waited for the message. */
-      if (time_needed < next_timeout->time) {
-        next_timeout->time -= time_needed;
-      } else {
-        next_timeout->time = 0;
-      }
+    memp_free(MEMP_SYS_TIMEOUT, tmptimeout);
+    if (handler != NULL) {
+      handler(arg);
     }
+    UNLOCK_TCPIP_CORE();
+    LWIP_TCPIP_THREAD_ALIVE();
+
+    /* Look for more expired timeouts before fetching a message */
+    goto again;
+  }
+
+  /* 0 waits forever */
+  sleeptime = (next_timeout != NULL) ? next_timeout->time : 0;
+  UNLOCK_TCPIP_CORE();
+
+  time_needed = sys_arch_mbox_fetch(mbox, msg, sleeptime);
+
+  /* Either a timeout expired or sys_timeout() woke us up without a message */
+  if (time_needed == SYS_ARCH_TIMEOUT || *msg == NULL) {
+    goto again;
   }
 }
 
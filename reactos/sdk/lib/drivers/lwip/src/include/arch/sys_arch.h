@@ -15,6 +15,17 @@ typedef struct _sys_mbox_t
     int Valid;
 } sys_mbox_t;
 
+/* The core lock is taken from DPCs and under connection spin locks */
+typedef struct _sys_mutex_t
+{
+    KSPIN_LOCK Lock;
+    KIRQL OldIrql;
+    int Valid;
+} sys_mutex_t;
+
+/* Wakes up a sys_arch_mbox_fetch() without posting a message, it returns a NULL message */
+void sys_mbox_wake(sys_mbox_t *mbox);
+
 typedef KIRQL sys_prot_t;
 
 typedef u32_t sys_thread_t;
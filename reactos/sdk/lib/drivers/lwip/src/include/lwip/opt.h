@@ -1026,6 +1026,31 @@
 #define TCP_LISTEN_BACKLOG              0
 #endif
 
+/**
+ * TCP_CONN_HASH_SIZE: Number of hash buckets used to look up the pcb of
+ * an incoming segment among the connected and TIME-WAIT pcbs.
+ * Must be a power of two.
+ */
+#ifndef TCP_CONN_HASH_SIZE
+#define TCP_CONN_HASH_SIZE              64
+#endif
+
+/**
+ * TCP_LISTEN_HASH_SIZE: Number of hash buckets used to look up listening
+ * pcbs by local port. Must be a power of two.
+ */
+#ifndef TCP_LISTEN_HASH_SIZE
+#define TCP_LISTEN_HASH_SIZE            16
+#endif
+
+/**
+ * TCP_TW_MAX: The maximum number of pcbs kept in TIME-WAIT. The oldest ones
+ * are freed early when there are more. Default is 0 (no limit).
+ */
+#ifndef TCP_TW_MAX
+#define TCP_TW_MAX                      0
+#endif
+
 /**
  * The maximum allowed backlog for TCP listen netconns.
  * This backlog is used unless another is explicitly specified.
@@ -1060,6 +1085,55 @@
 #define LWIP_TCP_TIMESTAMPS             0
 #endif
 
+/**
+ * LWIP_WND_SCALE and TCP_RCV_SCALE:
+ * Set LWIP_WND_SCALE to 1 to enable window scaling (RFC 7323).
+ * Set TCP_RCV_SCALE to the desired scaling factor (shift count in the
+ * range of [0..14]).
+ * When LWIP_WND_SCALE is enabled but TCP_RCV_SCALE is 0, we can use a large
+ * send window while having a small receive window only.
+ */
+#ifndef LWIP_WND_SCALE
+#define LWIP_WND_SCALE                  0
+#define TCP_RCV_SCALE                   0
+#endif
+
+/**
+ * LWIP_TCP_SACK_OUT==1: offer selective acknowledgements (RFC 2018) and
+ * report out-of-sequence data to the remote host with SACK blocks.
+ * Requires TCP_QUEUE_OOSEQ. Received SACK blocks are ignored.
+ */
+#ifndef LWIP_TCP_SACK_OUT
+#define LWIP_TCP_SACK_OUT               0
+#endif
+
+/**
+ * LWIP_TCP_MAX_SACK_NUM: The maximum number of SACK blocks sent in one
+ * segment. No more than 4 fit in the option space, 3 when timestamps are
+ * in use as well.
+ */
+#ifndef LWIP_TCP_MAX_SACK_NUM
+#define LWIP_TCP_MAX_SACK_NUM           4
+#endif
+
+/**
+ * LWIP_TCP_CORK==1: support corking a pcb (TF_CORK). A corked pcb only
+ * sends full segments and holds back the last partial one until it is
+ * uncorked or the connection is closed.
+ */
+#ifndef LWIP_TCP_CORK
+#define LWIP_TCP_CORK                   0
+#endif
+
+/**
+ * TCP_LSO==1: build segments of up to netif->lso_max bytes of data for
+ * interfaces that cut them into MSS sized frames themselves (large send
+ * offload). Such segments carry the size to cut them at in pbuf->lso_mss.
+ */
+#ifndef TCP_LSO
+#define TCP_LSO                         0
+#endif
+
 /**
  * TCP_WND_UPDATE_THRESHOLD: difference in window to trigger an
  * explicit window update
@@ -1784,6 +1858,15 @@
    ---------- Checksum options ----------
    --------------------------------------
 */
+/**
+ * LWIP_CHECKSUM_CTRL_PER_NETIF==1: Checksum generation/check can be enabled/disabled
+ * per netif (netif->chksum_flags), for interfaces that do it in hardware.
+ * ATTENTION: if enabled, the CHECKSUM_GEN_* and CHECKSUM_CHECK_* defines must be enabled!
+ */
+#ifndef LWIP_CHECKSUM_CTRL_PER_NETIF
+#define LWIP_CHECKSUM_CTRL_PER_NETIF    0
+#endif
+
 /**
  * CHECKSUM_GEN_IP==1: Generate checksums in software for outgoing IP packets.
  */
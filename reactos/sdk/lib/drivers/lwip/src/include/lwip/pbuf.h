@@ -75,6 +75,8 @@ typedef enum {
 #define PBUF_FLAG_LLMCAST   0x10U
 /** indicates this pbuf includes a TCP FIN flag */
 #define PBUF_FLAG_TCP_FIN   0x20U
+/** indicates the interface already verified the transport checksum of this packet */
+#define PBUF_FLAG_CHKSUM_VALID 0x40U
 
 struct pbuf {
   /** next pbuf in singly linked pbuf chain */
@@ -107,6 +109,11 @@ struct pbuf {
    * the stack itself, or pbuf->next pointers from a chain.
    */
   u16_t ref;
+
+#if TCP_LSO
+  /** if not 0, the interface cuts this TCP segment into frames of this much data */
+  u16_t lso_mss;
+#endif /* TCP_LSO */
 };
 
 #if LWIP_SUPPORT_CUSTOM_PBUF
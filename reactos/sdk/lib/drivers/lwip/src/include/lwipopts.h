@@ -10,7 +10,7 @@
 
 /* Define LWIP_COMPAT_MUTEX if the port has no mutexes and binary semaphores
  should be used instead */
-#define LWIP_COMPAT_MUTEX               1
+#define LWIP_COMPAT_MUTEX               0
 
 #define MEM_ALIGNMENT                   4
 
@@ -64,9 +64,35 @@
  * add support for other transport mediums */
 #define TCP_MSS                         1460
 
-#define TCP_WND                         0xFFFF
+/* Windows past 64k are announced with window scaling (RFC 7323). The scale
+ * factor is fixed, which lets a socket's receive buffer (SO_RCVBUF) grow up
+ * to 0xFFFF << TCP_RCV_SCALE bytes */
+#define LWIP_WND_SCALE                  1
 
-#define TCP_SND_BUF                     TCP_WND
+#define TCP_RCV_SCALE                   6
+
+#define TCP_WND                         (256 * 1024)
+
+#define TCP_SND_BUF                     (256 * 1024)
+
+/* Don't wait for a quarter of a 256k window to be read before telling the
+ * remote host about it */
+#define TCP_WND_UPDATE_THRESHOLD        LWIP_MIN((TCP_WND / 4), (TCP_MSS * 4))
+
+#define LWIP_TCP_SACK_OUT               1
+
+/* Sockets can hold back partial segments while they build a message
+ * with several sends (TCP_CORK) */
+#define LWIP_TCP_CORK                   1
+
+/* Adapters that do TCP checksums or large sends themselves have them
+ * switched off or on per interface (see TCPInterfaceInit) */
+#define LWIP_CHECKSUM_CTRL_PER_NETIF    1
+#define TCP_LSO                         1
+
+/* The IP layer below us checks and fills in IP header checksums */
+#define CHECKSUM_GEN_IP                 0
+#define CHECKSUM_CHECK_IP               0
 
 #define TCP_MAXRTX                      8
 
@@ -74,12 +100,27 @@
 
 #define TCP_LISTEN_BACKLOG              1
 
+/* Servers see thousands of connections and as many in TIME-WAIT, so look
+ * them up by hash and don't let TIME-WAIT grow without bounds */
+#define TCP_CONN_HASH_SIZE              1024
+
+#define TCP_LISTEN_HASH_SIZE            64
+
+#define TCP_TW_MAX                      4096
+
 #define LWIP_TCP_TIMESTAMPS             1
 
 #define LWIP_CALLBACK_API               1
 
 #define LWIP_NETIF_API                  1
 
+/* Callers take the core lock and call into lwIP directly instead of queuing
+ * to the tcpip thread, and received packets are processed in the context
+ * they are indicated in */
+#define LWIP_TCPIP_CORE_LOCKING         1
+
+#define LWIP_TCPIP_CORE_LOCKING_INPUT   1
+
 #define LWIP_SOCKET                     0
 
 #define LWIP_NETCONN                    0
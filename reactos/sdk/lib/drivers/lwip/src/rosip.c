@@ -31,6 +31,77 @@ LibIPInsertPacket(void *ifarg,
     }
 }
 
+/* Only the headers are copied, the data is chained on as PBUF_REF pbufs pointing
+ * into the NDIS buffers. Those are only valid until we return, so anything lwIP
+ * or rostcp.c keeps after that has to be copied first (see tcp_seg_copy and
+ * InternalRecvEventHandler). If the adapter has already verified the TCP
+ * checksum, lwIP doesn't do it again. */
+void
+LibIPInsertPacketChain(void *ifarg,
+                       const void *const header,
+                       const u32_t header_size,
+                       PNDIS_BUFFER Buffer,
+                       UINT Offset,
+                       const u32_t size,
+                       const int checksum_valid)
+{
+    struct pbuf *p, *q;
+    PUCHAR Data;
+    UINT Length;
+    u32_t Remaining = size;
+
+    ASSERT(ifarg);
+    ASSERT(header);
+    ASSERT(header_size > 0);
+
+    p = pbuf_alloc(PBUF_RAW, header_size, PBUF_RAM);
+    if (!p)
+        return;
+
+    RtlCopyMemory(p->payload, header, header_size);
+
+    if (checksum_valid)
+        p->flags |= PBUF_FLAG_CHKSUM_VALID;
+
+    while (Remaining != 0 && Buffer != NULL)
+    {
+        NdisQueryBuffer(Buffer, (PVOID)&Data, &Length);
+
+        if (Offset >= Length)
+        {
+            /* Still skipping to the start of the data */
+            Offset -= Length;
+            NdisGetNextBuffer(Buffer, &Buffer);
+            continue;
+        }
+
+        Length = MIN(Length - Offset, Remaining);
+        Length = MIN(Length, 0xFFFF);
+
+        q = pbuf_alloc(PBUF_RAW, (u16_t)Length, PBUF_REF);
+        if (!q)
+        {
+            pbuf_free(p);
+            return;
+        }
+
+        q->payload = Data + Offset;
+        pbuf_cat(p, q);
+
+        Remaining -= Length;
+        Offset += Length;
+    }
+
+    if (Remaining != 0)
+    {
+        /* The packet is shorter than the IP header claims */
+        pbuf_free(p);
+        return;
+    }
+
+    ((PNETIF)ifarg)->input(p, (PNETIF)ifarg);
+}
+
 void
 LibIPInitialize(void)
 {
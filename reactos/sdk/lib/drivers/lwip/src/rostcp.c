@@ -20,16 +20,13 @@ static const char * const tcp_state_str[] = {
   "TIME_WAIT"
 };
 
-/* The way that lwIP does multi-threading is really not ideal for our purposes but
- * we best go along with it unless we want another unstable TCP library. lwIP uses
- * a thread called the "tcpip thread" which is the only one allowed to call raw API
- * functions. Since this is the case, for each of our LibTCP* functions, we queue a request
- * for a callback to "tcpip thread" which calls our LibTCP*Callback functions. Yes, this is
- * a lot of unnecessary thread swapping and it could definitely be faster, but I don't want
- * to going messing around in lwIP because I have no desire to create another mess like oskittcp */
-
-extern KEVENT TerminationEvent;
-extern NPAGED_LOOKASIDE_LIST MessageLookasideList;
+/* lwIP is built with LWIP_TCPIP_CORE_LOCKING so we don't have to bounce every
+ * request through the "tcpip thread". Our LibTCP* functions call the raw API
+ * directly and expect the caller to hold the core lock (LibTCPLockCore). Received
+ * packets are processed under the same lock in the context they were indicated in,
+ * so the event handlers below run with the core lock held as well. The core lock
+ * is a spin lock and it must always be taken before any connection lock. */
+
 extern NPAGED_LOOKASIDE_LIST QueueEntryLookasideList;
 
 /* Required for ERR_T to NTSTATUS translation in receive error handling */
@@ -64,7 +61,7 @@ LibTCPEmptyQueue(PCONNECTION_ENDPOINT Connection)
         Entry = RemoveHeadList(&Connection->PacketQueue);
         qp = CONTAINING_RECORD(Entry, QUEUE_ENTRY, ListEntry);
 
-        /* We're in the tcpip thread here so this is safe */
+        /* We hold the core lock here so this is safe */
         pbuf_free(qp->p);
 
         ExFreeToNPagedLookasideList(&QueueEntryLookasideList, qp);
@@ -98,16 +95,28 @@ PQUEUE_ENTRY LibTCPDequeuePacket(PCONNECTION_ENDPOINT Connection)
     return qp;
 }
 
-NTSTATUS LibTCPGetDataFromConnectionQueue(PCONNECTION_ENDPOINT Connection, PUCHAR RecvBuffer, UINT RecvLen, UINT *Received)
+/* Called with the core lock held. The receive window is only reopened for the data
+ * that leaves the queue, so the remote host can't send more than we are buffering.
+ * The data is copied straight from the pbufs into the whole buffer chain, which is
+ * the caller's own buffer when AFD posts it down. */
+NTSTATUS LibTCPGetDataFromConnectionQueue(PCONNECTION_ENDPOINT Connection, PNDIS_BUFFER Buffer, UINT *Received)
 {
     PQUEUE_ENTRY qp;
     struct pbuf* p;
     NTSTATUS Status;
-    UINT ReadLength, PayloadLength, Offset, Copied;
+    PNDIS_BUFFER NextBuffer;
+    PUCHAR RecvBuffer;
+    UINT RecvLen, BufferLen, ReadLength, PayloadLength, Offset, Copied, Count;
     KIRQL OldIrql;
 
     (*Received) = 0;
 
+    RecvLen = 0;
+    for (NextBuffer = Buffer; NextBuffer != NULL; NextBuffer = NextBuffer->Next)
+        RecvLen += MmGetMdlByteCount(NextBuffer);
+
+    NdisQueryBuffer(Buffer, (PVOID)&RecvBuffer, &BufferLen);
+
     LockObject(Connection, &OldIrql);
 
     if (!IsListEmpty(&Connection->PacketQueue))
@@ -134,20 +143,31 @@ NTSTATUS LibTCPGetDataFromConnectionQueue(PCONNECTION_ENDPOINT Connection, PUCHA
 
             UnlockObject(Connection, OldIrql);
 
-            Copied = pbuf_copy_partial(p, RecvBuffer, ReadLength, Offset);
-            ASSERT(Copied == ReadLength);
+            for (Copied = 0; Copied < ReadLength; Copied += Count)
+            {
+                while (BufferLen == 0)
+                {
+                    NdisGetNextBuffer(Buffer, &Buffer);
+                    NdisQueryBuffer(Buffer, (PVOID)&RecvBuffer, &BufferLen);
+                }
+
+                Count = MIN(ReadLength - Copied, BufferLen);
+                Count = pbuf_copy_partial(p, RecvBuffer, (u16_t)Count, (u16_t)(Offset + Copied));
+                ASSERT(Count != 0);
+
+                RecvBuffer += Count;
+                BufferLen -= Count;
+            }
 
             LockObject(Connection, &OldIrql);
 
             /* Update trackers */
             RecvLen -= ReadLength;
-            RecvBuffer += ReadLength;
             (*Received) += ReadLength;
 
             if (qp != NULL)
             {
-                /* Use this special pbuf free callback function because we're outside tcpip thread */
-                pbuf_free_callback(qp->p);
+                pbuf_free(qp->p);
 
                 ExFreeToNPagedLookasideList(&QueueEntryLookasideList, qp);
             }
@@ -174,32 +194,72 @@ NTSTATUS LibTCPGetDataFromConnectionQueue(PCONNECTION_ENDPOINT Connection, PUCHA
 
     UnlockObject(Connection, OldIrql);
 
+    /* Open the window by what was taken out of the queue */
+    if ((*Received) != 0 && Connection->SocketContext)
+        tcp_recved((PTCP_PCB)Connection->SocketContext, (*Received));
+
     return Status;
 }
 
+/* Called with the core lock held. Received data can point straight into the NDIS
+ * packet it arrived in (see LibIPInsertPacketChain), which goes back to the miniport
+ * once lwIP is done with it. If the receive requests didn't take all of it, the rest
+ * is copied out so it can stay queued. Only the packet just received can be affected. */
 static
 BOOLEAN
-WaitForEventSafely(PRKEVENT Event)
+LibTCPKeepQueuedPacket(PCONNECTION_ENDPOINT Connection, struct pbuf *p)
 {
-    PVOID WaitObjects[] = {Event, &TerminationEvent};
-
-    if (KeWaitForMultipleObjects(2,
-                                 WaitObjects,
-                                 WaitAny,
-                                 Executive,
-                                 KernelMode,
-                                 FALSE,
-                                 NULL,
-                                 NULL) == STATUS_WAIT_0)
+    PQUEUE_ENTRY qp;
+    struct pbuf *q;
+    KIRQL OldIrql;
+
+    for (q = p; q != NULL; q = q->next)
+    {
+        if (q->type == PBUF_REF)
+            break;
+    }
+
+    if (q == NULL)
+        return TRUE;
+
+    LockObject(Connection, &OldIrql);
+
+    if (IsListEmpty(&Connection->PacketQueue))
+    {
+        UnlockObject(Connection, OldIrql);
+        return TRUE;
+    }
+
+    qp = CONTAINING_RECORD(Connection->PacketQueue.Blink, QUEUE_ENTRY, ListEntry);
+    if (qp->p != p)
     {
-        /* Signalled by the caller's event */
+        /* It was read completely */
+        UnlockObject(Connection, OldIrql);
         return TRUE;
     }
-    else /* if KeWaitForMultipleObjects() == STATUS_WAIT_1 */
+
+    q = pbuf_alloc(PBUF_RAW, (u16_t)(p->tot_len - qp->Offset), PBUF_RAM);
+    if (!q)
     {
-        /* Signalled by our termination event */
+        RemoveEntryList(&qp->ListEntry);
+        UnlockObject(Connection, OldIrql);
+
+        pbuf_free(p);
+        ExFreeToNPagedLookasideList(&QueueEntryLookasideList, qp);
+
         return FALSE;
     }
+
+    pbuf_copy_partial(p, q->payload, q->tot_len, (u16_t)qp->Offset);
+
+    qp->p = q;
+    qp->Offset = 0;
+
+    UnlockObject(Connection, OldIrql);
+
+    pbuf_free(p);
+
+    return TRUE;
 }
 
 static
@@ -231,11 +291,18 @@ InternalRecvEventHandler(void *arg, PTCP_PCB pcb, struct pbuf *p, const err_t er
 
     if (p)
     {
+        /* The window is reopened once the data is read from the queue */
         LibTCPEnqueuePacket(Connection, p);
 
-        tcp_recved(pcb, p->tot_len);
-
+        /* Pending receives get the data copied straight into their buffers */
         TCPRecvEventHandler(arg);
+
+        if (!LibTCPKeepQueuedPacket(Connection, p))
+        {
+            /* We already acknowledged the data we just lost */
+            tcp_abort(pcb);
+            return ERR_ABRT;
+        }
     }
     else if (err == ERR_OK)
     {
@@ -319,327 +386,150 @@ InternalErrorEventHandler(void *arg, const err_t err)
     TCPFinEventHandler(Connection, err);
 }
 
-static
-void
-LibTCPSocketCallback(void *arg)
-{
-    struct lwip_callback_msg *msg = arg;
-
-    ASSERT(msg);
-
-    msg->Output.Socket.NewPcb = tcp_new();
-
-    if (msg->Output.Socket.NewPcb)
-    {
-        tcp_arg(msg->Output.Socket.NewPcb, msg->Input.Socket.Arg);
-        tcp_err(msg->Output.Socket.NewPcb, InternalErrorEventHandler);
-    }
-
-    KeSetEvent(&msg->Event, IO_NO_INCREMENT, FALSE);
-}
-
 struct tcp_pcb *
 LibTCPSocket(void *arg)
 {
-    struct lwip_callback_msg *msg = ExAllocateFromNPagedLookasideList(&MessageLookasideList);
     struct tcp_pcb *ret;
 
-    if (msg)
-    {
-        KeInitializeEvent(&msg->Event, NotificationEvent, FALSE);
-        msg->Input.Socket.Arg = arg;
-
-        tcpip_callback_with_block(LibTCPSocketCallback, msg, 1);
-
-        if (WaitForEventSafely(&msg->Event))
-            ret = msg->Output.Socket.NewPcb;
-        else
-            ret = NULL;
-
-        ExFreeToNPagedLookasideList(&MessageLookasideList, msg);
-
-        return ret;
-    }
-
-    return NULL;
-}
-
-static
-void
-LibTCPBindCallback(void *arg)
-{
-    struct lwip_callback_msg *msg = arg;
-    PTCP_PCB pcb = msg->Input.Bind.Connection->SocketContext;
+    ret = tcp_new();
 
-    ASSERT(msg);
-
-    if (!msg->Input.Bind.Connection->SocketContext)
+    if (ret)
     {
-        msg->Output.Bind.Error = ERR_CLSD;
-        goto done;
+        tcp_arg(ret, arg);
+        tcp_err(ret, InternalErrorEventHandler);
     }
 
-    /* We're guaranteed that the local address is valid to bind at this point */
-    pcb->so_options |= SOF_REUSEADDR;
-
-    msg->Output.Bind.Error = tcp_bind(pcb,
-                                      msg->Input.Bind.IpAddress,
-                                      ntohs(msg->Input.Bind.Port));
-
-done:
-    KeSetEvent(&msg->Event, IO_NO_INCREMENT, FALSE);
+    return ret;
 }
 
 err_t
 LibTCPBind(PCONNECTION_ENDPOINT Connection, struct ip_addr *const ipaddr, const u16_t port)
 {
-    struct lwip_callback_msg *msg;
-    err_t ret;
-
-    msg = ExAllocateFromNPagedLookasideList(&MessageLookasideList);
-    if (msg)
-    {
-        KeInitializeEvent(&msg->Event, NotificationEvent, FALSE);
-        msg->Input.Bind.Connection = Connection;
-        msg->Input.Bind.IpAddress = ipaddr;
-        msg->Input.Bind.Port = port;
+    PTCP_PCB pcb = Connection->SocketContext;
 
-        tcpip_callback_with_block(LibTCPBindCallback, msg, 1);
-
-        if (WaitForEventSafely(&msg->Event))
-            ret = msg->Output.Bind.Error;
-        else
-            ret = ERR_CLSD;
-
-        ExFreeToNPagedLookasideList(&MessageLookasideList, msg);
-
-        return ret;
-    }
-
-    return ERR_MEM;
-}
-
-static
-void
-LibTCPListenCallback(void *arg)
-{
-    struct lwip_callback_msg *msg = arg;
-
-    ASSERT(msg);
-
-    if (!msg->Input.Listen.Connection->SocketContext)
-    {
-        msg->Output.Listen.NewPcb = NULL;
-        goto done;
-    }
-
-    msg->Output.Listen.NewPcb = tcp_listen_with_backlog((PTCP_PCB)msg->Input.Listen.Connection->SocketContext, msg->Input.Listen.Backlog);
+    if (!pcb)
+        return ERR_CLSD;
 
-    if (msg->Output.Listen.NewPcb)
-    {
-        tcp_accept(msg->Output.Listen.NewPcb, InternalAcceptEventHandler);
-    }
+    /* We're guaranteed that the local address is valid to bind at this point */
+    pcb->so_options |= SOF_REUSEADDR;
 
-done:
-    KeSetEvent(&msg->Event, IO_NO_INCREMENT, FALSE);
+    return tcp_bind(pcb, ipaddr, ntohs(port));
 }
 
 PTCP_PCB
 LibTCPListen(PCONNECTION_ENDPOINT Connection, const u8_t backlog)
 {
-    struct lwip_callback_msg *msg;
     PTCP_PCB ret;
 
-    msg = ExAllocateFromNPagedLookasideList(&MessageLookasideList);
-    if (msg)
-    {
-        KeInitializeEvent(&msg->Event, NotificationEvent, FALSE);
-        msg->Input.Listen.Connection = Connection;
-        msg->Input.Listen.Backlog = backlog;
-
-        tcpip_callback_with_block(LibTCPListenCallback, msg, 1);
-
-        if (WaitForEventSafely(&msg->Event))
-            ret = msg->Output.Listen.NewPcb;
-        else
-            ret = NULL;
+    if (!Connection->SocketContext)
+        return NULL;
 
-        ExFreeToNPagedLookasideList(&MessageLookasideList, msg);
+    ret = tcp_listen_with_backlog((PTCP_PCB)Connection->SocketContext, backlog);
 
-        return ret;
+    if (ret)
+    {
+        tcp_accept(ret, InternalAcceptEventHandler);
     }
 
-    return NULL;
+    return ret;
 }
 
-static
-void
-LibTCPSendCallback(void *arg)
+err_t
+LibTCPSend(PCONNECTION_ENDPOINT Connection, PNDIS_BUFFER Buffer, const u32_t len, u32_t *sent)
 {
-    struct lwip_callback_msg *msg = arg;
-    PTCP_PCB pcb = msg->Input.Send.Connection->SocketContext;
-    ULONG SendLength;
+    PTCP_PCB pcb = Connection->SocketContext;
+    ULONG SendLength, ChunkLength, Offset;
+    PUCHAR Data;
+    UINT DataLength;
     UCHAR SendFlags;
+    err_t ret = ERR_OK;
 
-    ASSERT(msg);
+    *sent = 0;
 
-    if (!msg->Input.Send.Connection->SocketContext)
-    {
-        msg->Output.Send.Error = ERR_CLSD;
-        goto done;
-    }
+    if (!pcb)
+        return ERR_CLSD;
 
-    if (msg->Input.Send.Connection->SendShutdown)
-    {
-        msg->Output.Send.Error = ERR_CLSD;
-        goto done;
-    }
+    if (Connection->SendShutdown)
+        return ERR_CLSD;
 
-    SendFlags = TCP_WRITE_FLAG_COPY;
-    SendLength = msg->Input.Send.DataLength;
     if (tcp_sndbuf(pcb) == 0)
     {
         /* No buffer space so return pending */
-        msg->Output.Send.Error = ERR_INPROGRESS;
-        goto done;
+        return ERR_INPROGRESS;
     }
-    else if (tcp_sndbuf(pcb) < SendLength)
-    {
-        /* We've got some room so let's send what we can */
-        SendLength = tcp_sndbuf(pcb);
 
-        /* Don't set the push flag */
-        SendFlags |= TCP_WRITE_FLAG_MORE;
-    }
+    /* We've got some room so let's send what we can */
+    SendLength = MIN(len, tcp_sndbuf(pcb));
 
-    msg->Output.Send.Error = tcp_write(pcb,
-                                       msg->Input.Send.Data,
-                                       SendLength,
-                                       SendFlags);
-    if (msg->Output.Send.Error == ERR_OK)
+    /* Queue the data from each buffer of the chain as it is, tcp_write()
+     * takes 64k at most so big buffers go in chunks */
+    while (Buffer && *sent < SendLength)
     {
-        /* Queued successfully so try to send it */
-        tcp_output((PTCP_PCB)msg->Input.Send.Connection->SocketContext);
-        msg->Output.Send.Information = SendLength;
-    }
-    else if (msg->Output.Send.Error == ERR_MEM)
-    {
-        /* The queue is too long */
-        msg->Output.Send.Error = ERR_INPROGRESS;
-    }
-
-done:
-    KeSetEvent(&msg->Event, IO_NO_INCREMENT, FALSE);
-}
-
-err_t
-LibTCPSend(PCONNECTION_ENDPOINT Connection, void *const dataptr, const u16_t len, u32_t *sent, const int safe)
-{
-    err_t ret;
-    struct lwip_callback_msg *msg;
+        NdisQueryBuffer(Buffer, (PVOID)&Data, &DataLength);
+        DataLength = MIN(DataLength, SendLength - *sent);
 
-    msg = ExAllocateFromNPagedLookasideList(&MessageLookasideList);
-    if (msg)
-    {
-        KeInitializeEvent(&msg->Event, NotificationEvent, FALSE);
-        msg->Input.Send.Connection = Connection;
-        msg->Input.Send.Data = dataptr;
-        msg->Input.Send.DataLength = len;
+        for (Offset = 0; Offset < DataLength; Offset += ChunkLength)
+        {
+            ChunkLength = MIN(DataLength - Offset, 0xFFFF);
 
-        if (safe)
-            LibTCPSendCallback(msg);
-        else
-            tcpip_callback_with_block(LibTCPSendCallback, msg, 1);
+            /* Only set the push flag on the end of the caller's data */
+            SendFlags = TCP_WRITE_FLAG_COPY;
+            if (*sent + ChunkLength < len)
+                SendFlags |= TCP_WRITE_FLAG_MORE;
 
-        if (WaitForEventSafely(&msg->Event))
-            ret = msg->Output.Send.Error;
-        else
-            ret = ERR_CLSD;
+            ret = tcp_write(pcb, Data + Offset, (u16_t)ChunkLength, SendFlags);
+            if (ret != ERR_OK)
+                break;
 
-        if (ret == ERR_OK)
-            *sent = msg->Output.Send.Information;
-        else
-            *sent = 0;
+            *sent += ChunkLength;
+        }
 
-        ExFreeToNPagedLookasideList(&MessageLookasideList, msg);
+        if (ret != ERR_OK)
+            break;
 
-        return ret;
+        NdisGetNextBuffer(Buffer, &Buffer);
     }
 
-    return ERR_MEM;
-}
-
-static
-void
-LibTCPConnectCallback(void *arg)
-{
-    struct lwip_callback_msg *msg = arg;
-    err_t Error;
-
-    ASSERT(arg);
-
-    if (!msg->Input.Connect.Connection->SocketContext)
+    if (*sent != 0)
     {
-        msg->Output.Connect.Error = ERR_CLSD;
-        goto done;
+        /* Queued successfully so try to send it */
+        tcp_output(pcb);
+        ret = ERR_OK;
+    }
+    else if (ret == ERR_MEM)
+    {
+        /* The queue is too long */
+        ret = ERR_INPROGRESS;
     }
 
-    tcp_recv((PTCP_PCB)msg->Input.Connect.Connection->SocketContext, InternalRecvEventHandler);
-    tcp_sent((PTCP_PCB)msg->Input.Connect.Connection->SocketContext, InternalSendEventHandler);
-
-    Error = tcp_connect((PTCP_PCB)msg->Input.Connect.Connection->SocketContext,
-                        msg->Input.Connect.IpAddress, ntohs(msg->Input.Connect.Port),
-                        InternalConnectEventHandler);
-
-    msg->Output.Connect.Error = Error == ERR_OK ? ERR_INPROGRESS : Error;
-
-done:
-    KeSetEvent(&msg->Event, IO_NO_INCREMENT, FALSE);
+    return ret;
 }
 
 err_t
 LibTCPConnect(PCONNECTION_ENDPOINT Connection, struct ip_addr *const ipaddr, const u16_t port)
 {
-    struct lwip_callback_msg *msg;
-    err_t ret;
-
-    msg = ExAllocateFromNPagedLookasideList(&MessageLookasideList);
-    if (msg)
-    {
-        KeInitializeEvent(&msg->Event, NotificationEvent, FALSE);
-        msg->Input.Connect.Connection = Connection;
-        msg->Input.Connect.IpAddress = ipaddr;
-        msg->Input.Connect.Port = port;
-
-        tcpip_callback_with_block(LibTCPConnectCallback, msg, 1);
+    PTCP_PCB pcb = Connection->SocketContext;
+    err_t Error;
 
-        if (WaitForEventSafely(&msg->Event))
-        {
-            ret = msg->Output.Connect.Error;
-        }
-        else
-            ret = ERR_CLSD;
+    if (!pcb)
+        return ERR_CLSD;
 
-        ExFreeToNPagedLookasideList(&MessageLookasideList, msg);
+    tcp_recv(pcb, InternalRecvEventHandler);
+    tcp_sent(pcb, InternalSendEventHandler);
 
-        return ret;
-    }
+    Error = tcp_connect(pcb, ipaddr, ntohs(port), InternalConnectEventHandler);
 
-    return ERR_MEM;
+    return Error == ERR_OK ? ERR_INPROGRESS : Error;
 }
 
-static
-void
-LibTCPShutdownCallback(void *arg)
+err_t
+LibTCPShutdown(PCONNECTION_ENDPOINT Connection, const int shut_rx, const int shut_tx)
 {
-    struct lwip_callback_msg *msg = arg;
-    PTCP_PCB pcb = msg->Input.Shutdown.Connection->SocketContext;
+    PTCP_PCB pcb = Connection->SocketContext;
+    err_t ret = ERR_OK;
 
-    if (!msg->Input.Shutdown.Connection->SocketContext)
-    {
-        msg->Output.Shutdown.Error = ERR_CLSD;
-        goto done;
-    }
+    if (!pcb)
+        return ERR_CLSD;
 
     /* LwIP makes the (questionable) assumption that SHUTDOWN_RDWR is equivalent to tcp_close().
      * This assumption holds even if the shutdown calls are done separately (even through multiple
@@ -647,149 +537,78 @@ LibTCPShutdownCallback(void *arg)
      * PCB without telling us if we shutdown TX and RX. To avoid these problems, we'll clear the
      * socket context if we have called shutdown for TX and RX.
      */
-    if (msg->Input.Shutdown.shut_rx) {
-        msg->Output.Shutdown.Error = tcp_shutdown(pcb, TRUE, FALSE);
+    if (shut_rx) {
+        ret = tcp_shutdown(pcb, TRUE, FALSE);
     }
-    if (msg->Input.Shutdown.shut_tx) {
-        msg->Output.Shutdown.Error = tcp_shutdown(pcb, FALSE, TRUE);
+    if (shut_tx) {
+        ret = tcp_shutdown(pcb, FALSE, TRUE);
     }
 
-    if (!msg->Output.Shutdown.Error)
+    if (!ret)
     {
-        if (msg->Input.Shutdown.shut_rx)
+        if (shut_rx)
         {
-            msg->Input.Shutdown.Connection->ReceiveShutdown = TRUE;
-            msg->Input.Shutdown.Connection->ReceiveShutdownStatus = STATUS_FILE_CLOSED;
+            Connection->ReceiveShutdown = TRUE;
+            Connection->ReceiveShutdownStatus = STATUS_FILE_CLOSED;
         }
 
-        if (msg->Input.Shutdown.shut_tx)
-            msg->Input.Shutdown.Connection->SendShutdown = TRUE;
+        if (shut_tx)
+            Connection->SendShutdown = TRUE;
 
-        if (msg->Input.Shutdown.Connection->ReceiveShutdown &&
-            msg->Input.Shutdown.Connection->SendShutdown)
+        if (Connection->ReceiveShutdown &&
+            Connection->SendShutdown)
         {
             /* The PCB is not ours anymore */
-            msg->Input.Shutdown.Connection->SocketContext = NULL;
+            Connection->SocketContext = NULL;
             tcp_arg(pcb, NULL);
-            TCPFinEventHandler(msg->Input.Shutdown.Connection, ERR_CLSD);
+            TCPFinEventHandler(Connection, ERR_CLSD);
         }
     }
 
-done:
-    KeSetEvent(&msg->Event, IO_NO_INCREMENT, FALSE);
+    return ret;
 }
 
 err_t
-LibTCPShutdown(PCONNECTION_ENDPOINT Connection, const int shut_rx, const int shut_tx)
+LibTCPClose(PCONNECTION_ENDPOINT Connection, const int callback)
 {
-    struct lwip_callback_msg *msg;
+    PTCP_PCB pcb = Connection->SocketContext;
     err_t ret;
 
-    msg = ExAllocateFromNPagedLookasideList(&MessageLookasideList);
-    if (msg)
-    {
-        KeInitializeEvent(&msg->Event, NotificationEvent, FALSE);
-
-        msg->Input.Shutdown.Connection = Connection;
-        msg->Input.Shutdown.shut_rx = shut_rx;
-        msg->Input.Shutdown.shut_tx = shut_tx;
-
-        tcpip_callback_with_block(LibTCPShutdownCallback, msg, 1);
-
-        if (WaitForEventSafely(&msg->Event))
-            ret = msg->Output.Shutdown.Error;
-        else
-            ret = ERR_CLSD;
-
-        ExFreeToNPagedLookasideList(&MessageLookasideList, msg);
-
-        return ret;
-    }
-
-    return ERR_MEM;
-}
-
-static
-void
-LibTCPCloseCallback(void *arg)
-{
-    struct lwip_callback_msg *msg = arg;
-    PTCP_PCB pcb = msg->Input.Close.Connection->SocketContext;
-
     /* Empty the queue even if we're already "closed" */
-    LibTCPEmptyQueue(msg->Input.Close.Connection);
+    LibTCPEmptyQueue(Connection);
 
     /* Check if we've already been closed */
-    if (msg->Input.Close.Connection->Closing)
-    {
-        msg->Output.Close.Error = ERR_OK;
-        goto done;
-    }
+    if (Connection->Closing)
+        return ERR_OK;
 
     /* Enter "closing" mode if we're doing a normal close */
-    if (msg->Input.Close.Callback)
-        msg->Input.Close.Connection->Closing = TRUE;
+    if (callback)
+        Connection->Closing = TRUE;
 
     /* Check if the PCB was already "closed" but the client doesn't know it yet */
-    if (!msg->Input.Close.Connection->SocketContext)
-    {
-        msg->Output.Close.Error = ERR_OK;
-        goto done;
-    }
+    if (!pcb)
+        return ERR_OK;
 
     /* Clear the PCB pointer and stop callbacks */
-    msg->Input.Close.Connection->SocketContext = NULL;
+    Connection->SocketContext = NULL;
     tcp_arg(pcb, NULL);
 
     /* This may generate additional callbacks but we don't care,
      * because they're too inconsistent to rely on */
-    msg->Output.Close.Error = tcp_close(pcb);
+    ret = tcp_close(pcb);
 
-    if (msg->Output.Close.Error)
+    if (ret)
     {
         /* Restore the PCB pointer */
-        msg->Input.Close.Connection->SocketContext = pcb;
-        msg->Input.Close.Connection->Closing = FALSE;
+        Connection->SocketContext = pcb;
+        Connection->Closing = FALSE;
     }
-    else if (msg->Input.Close.Callback)
+    else if (callback)
     {
-        TCPFinEventHandler(msg->Input.Close.Connection, ERR_CLSD);
+        TCPFinEventHandler(Connection, ERR_CLSD);
     }
 
-done:
-    KeSetEvent(&msg->Event, IO_NO_INCREMENT, FALSE);
-}
-
-err_t
-LibTCPClose(PCONNECTION_ENDPOINT Connection, const int safe, const int callback)
-{
-    err_t ret;
-    struct lwip_callback_msg *msg;
-
-    msg = ExAllocateFromNPagedLookasideList(&MessageLookasideList);
-    if (msg)
-    {
-        KeInitializeEvent(&msg->Event, NotificationEvent, FALSE);
-
-        msg->Input.Close.Connection = Connection;
-        msg->Input.Close.Callback = callback;
-
-        if (safe)
-            LibTCPCloseCallback(msg);
-        else
-            tcpip_callback_with_block(LibTCPCloseCallback, msg, 1);
-
-        if (WaitForEventSafely(&msg->Event))
-            ret = msg->Output.Close.Error;
-        else
-            ret = ERR_CLSD;
-
-        ExFreeToNPagedLookasideList(&MessageLookasideList, msg);
-
-        return ret;
-    }
-
-    return ERR_MEM;
+    return ret;
 }
 
 void
@@ -840,3 +659,55 @@ LibTCPSetNoDelay(
     else
         pcb->flags &= ~TF_NODELAY;
 }
+
+void
+LibTCPSetCork(
+    PTCP_PCB pcb,
+    BOOLEAN Set)
+{
+    /* A listening pcb has no flags */
+    if (pcb->state == LISTEN)
+        return;
+
+    if (Set)
+    {
+        pcb->flags |= TF_CORK;
+    }
+    else
+    {
+        /* Send what was held back */
+        pcb->flags &= ~TF_CORK;
+        tcp_output(pcb);
+    }
+}
+
+void
+LibTCPSetReceiveWindow(
+    PTCP_PCB pcb,
+    ULONG Size)
+{
+    tcp_setrcvbuf(pcb, Size);
+}
+
+void
+LibTCPGetDemuxStats(
+    struct tcp_demux_stats *stats)
+{
+    tcp_get_demux_stats(stats);
+}
+
+/*
+ * One lock covers the whole stack. lwIP keeps its pcb lists, port
+ * allocation and timers global, so a connection can't be locked on its own.
+ */
+void
+LibTCPLockCore(void)
+{
+    LOCK_TCPIP_CORE();
+}
+
+void
+LibTCPUnlockCore(void)
+{
+    UNLOCK_TCPIP_CORE();
+}
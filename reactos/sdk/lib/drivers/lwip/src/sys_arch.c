@@ -12,7 +12,6 @@ static LIST_ENTRY ThreadListHead;
 static KSPIN_LOCK ThreadListLock;
 
 KEVENT TerminationEvent;
-NPAGED_LOOKASIDE_LIST MessageLookasideList;
 NPAGED_LOOKASIDE_LIST QueueEntryLookasideList;
 
 static LARGE_INTEGER StartTime;
@@ -129,6 +128,47 @@ sys_arch_sem_wait(sys_sem_t* sem, u32_t timeout)
     return SYS_ARCH_TIMEOUT;
 }
 
+err_t
+sys_mutex_new(sys_mutex_t *mutex)
+{
+    KeInitializeSpinLock(&mutex->Lock);
+
+    mutex->Valid = 1;
+
+    return ERR_OK;
+}
+
+int sys_mutex_valid(sys_mutex_t *mutex)
+{
+    return mutex->Valid;
+}
+
+void sys_mutex_set_invalid(sys_mutex_t *mutex)
+{
+    mutex->Valid = 0;
+}
+
+void
+sys_mutex_free(sys_mutex_t *mutex)
+{
+    sys_mutex_set_invalid(mutex);
+}
+
+void
+sys_mutex_lock(sys_mutex_t *mutex)
+{
+    KIRQL OldIrql;
+
+    KeAcquireSpinLock(&mutex->Lock, &OldIrql);
+    mutex->OldIrql = OldIrql;
+}
+
+void
+sys_mutex_unlock(sys_mutex_t *mutex)
+{
+    KeReleaseSpinLock(&mutex->Lock, mutex->OldIrql);
+}
+
 err_t
 sys_mbox_new(sys_mbox_t *mbox, int size)
 {    
@@ -178,6 +218,12 @@ sys_mbox_post(sys_mbox_t *mbox, void *msg)
     KeSetEvent(&mbox->Event, IO_NO_INCREMENT, FALSE);
 }
 
+void
+sys_mbox_wake(sys_mbox_t *mbox)
+{
+    KeSetEvent(&mbox->Event, IO_NO_INCREMENT, FALSE);
+}
+
 u32_t
 sys_arch_mbox_fetch(sys_mbox_t *mbox, void **msg, u32_t timeout)
 {
@@ -206,15 +252,24 @@ sys_arch_mbox_fetch(sys_mbox_t *mbox, void **msg, u32_t timeout)
     if (Status == STATUS_WAIT_0)
     {
         KeAcquireSpinLock(&mbox->Lock, &OldIrql);
-        Entry = RemoveHeadList(&mbox->ListHead);
-        ASSERT(Entry);
         if (IsListEmpty(&mbox->ListHead))
+        {
+            /* Woken up by sys_mbox_wake */
             KeClearEvent(&mbox->Event);
-        KeReleaseSpinLock(&mbox->Lock, OldIrql);
-        
-        Container = CONTAINING_RECORD(Entry, LWIP_MESSAGE_CONTAINER, ListEntry);
-        Message = Container->Message;
-        ExFreePool(Container);
+            KeReleaseSpinLock(&mbox->Lock, OldIrql);
+            Message = NULL;
+        }
+        else
+        {
+            Entry = RemoveHeadList(&mbox->ListHead);
+            if (IsListEmpty(&mbox->ListHead))
+                KeClearEvent(&mbox->Event);
+            KeReleaseSpinLock(&mbox->Lock, OldIrql);
+
+            Container = CONTAINING_RECORD(Entry, LWIP_MESSAGE_CONTAINER, ListEntry);
+            Message = Container->Message;
+            ExFreePool(Container);
+        }
         
         if (msg)
             *msg = Message;
@@ -316,14 +371,6 @@ sys_init(void)
     
     KeInitializeEvent(&TerminationEvent, NotificationEvent, FALSE);
     
-    ExInitializeNPagedLookasideList(&MessageLookasideList,
-                                    NULL,
-                                    NULL,
-                                    0,
-                                    sizeof(struct lwip_callback_msg),
-                                    LWIP_MESSAGE_TAG,
-                                    0);
-    
     ExInitializeNPagedLookasideList(&QueueEntryLookasideList,
                                     NULL,
                                     NULL,
@@ -359,6 +406,5 @@ sys_shutdown(void)
         }
     }
     
-    ExDeleteNPagedLookasideList(&MessageLookasideList);
     ExDeleteNPagedLookasideList(&QueueEntryLookasideList);
 }
@@ -0,0 +1,129 @@
+/*
+ * PROJECT:     ReactOS Virtio Library
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        lib/drivers/virtio/virtio.c
+ * PURPOSE:     Legacy virtio PCI transport
+ * PROGRAMMERS: ReactOS Team
+ */
+
+/*
+ * Only the legacy (0.9.5) register layout is implemented. It is what QEMU
+ * exposes in BAR0 of every transitional device, and it doesn't need the
+ * vendor capabilities the modern layout is described with. We don't use
+ * MSI-X, so the device configuration always starts at VIRTIO_PCI_CONFIG.
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include <ntddk.h>
+#include "virtio.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* FUNCTIONS ******************************************************************/
+
+static
+VOID
+VirtioAddStatus(
+    _In_ PVIRTIO_DEVICE Device,
+    _In_ UCHAR Status)
+{
+    UCHAR Current;
+
+    Current = READ_PORT_UCHAR(Device->IoBase + VIRTIO_PCI_STATUS);
+    WRITE_PORT_UCHAR(Device->IoBase + VIRTIO_PCI_STATUS, Current | Status);
+}
+
+
+VOID
+VirtioReset(
+    _In_ PVIRTIO_DEVICE Device)
+{
+    /* Writing zero resets the device, reading back flushes the write */
+    WRITE_PORT_UCHAR(Device->IoBase + VIRTIO_PCI_STATUS, 0);
+    (VOID)READ_PORT_UCHAR(Device->IoBase + VIRTIO_PCI_STATUS);
+}
+
+
+VOID
+VirtioInitialize(
+    _Out_ PVIRTIO_DEVICE Device,
+    _In_ PUCHAR IoBase)
+{
+    Device->IoBase = IoBase;
+    Device->GuestFeatures = 0;
+
+    VirtioReset(Device);
+    VirtioAddStatus(Device, VIRTIO_STATUS_ACKNOWLEDGE);
+    VirtioAddStatus(Device, VIRTIO_STATUS_DRIVER);
+
+    Device->HostFeatures = READ_PORT_ULONG((PULONG)(IoBase + VIRTIO_PCI_HOST_FEATURES));
+
+    DPRINT("Virtio device at %p offers features 0x%08lx\n", IoBase, Device->HostFeatures);
+}
+
+
+ULONG
+VirtioNegotiateFeatures(
+    _Inout_ PVIRTIO_DEVICE Device,
+    _In_ ULONG Wanted)
+{
+    Device->GuestFeatures = Device->HostFeatures & Wanted;
+    WRITE_PORT_ULONG((PULONG)(Device->IoBase + VIRTIO_PCI_GUEST_FEATURES), Device->GuestFeatures);
+
+    return Device->GuestFeatures;
+}
+
+
+VOID
+VirtioSetDriverOk(
+    _In_ PVIRTIO_DEVICE Device)
+{
+    VirtioAddStatus(Device, VIRTIO_STATUS_DRIVER_OK);
+}
+
+
+VOID
+VirtioSetFailed(
+    _In_ PVIRTIO_DEVICE Device)
+{
+    VirtioAddStatus(Device, VIRTIO_STATUS_FAILED);
+}
+
+
+UCHAR
+VirtioReadIsr(
+    _In_ PVIRTIO_DEVICE Device)
+{
+    /* Reading the ISR status also deasserts the line interrupt */
+    return READ_PORT_UCHAR(Device->IoBase + VIRTIO_PCI_ISR);
+}
+
+
+VOID
+VirtioReadConfig(
+    _In_ PVIRTIO_DEVICE Device,
+    _In_ ULONG Offset,
+    _Out_writes_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length)
+{
+    PUCHAR Destination = Buffer;
+    ULONG i;
+
+    /* The legacy layout is guest endian and may be read byte by byte */
+    for (i = 0; i < Length; i++)
+        Destination[i] = READ_PORT_UCHAR(Device->IoBase + VIRTIO_PCI_CONFIG + Offset + i);
+}
+
+
+USHORT
+VirtioGetQueueSize(
+    _In_ PVIRTIO_DEVICE Device,
+    _In_ USHORT Index)
+{
+    WRITE_PORT_USHORT((PUSHORT)(Device->IoBase + VIRTIO_PCI_QUEUE_SEL), Index);
+    return READ_PORT_USHORT((PUSHORT)(Device->IoBase + VIRTIO_PCI_QUEUE_NUM));
+}
+
+/* EOF */
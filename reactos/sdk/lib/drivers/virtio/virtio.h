@@ -0,0 +1,229 @@
+/*
+ * PROJECT:     ReactOS Virtio Library
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        lib/drivers/virtio/virtio.h
+ * PURPOSE:     Virtio PCI transport and split virtqueue definitions
+ * PROGRAMMERS: ReactOS Team
+ */
+
+#ifndef _VIRTIO_H_
+#define _VIRTIO_H_
+
+/* Legacy PCI transport, register block in BAR0 (I/O space) */
+#define VIRTIO_PCI_HOST_FEATURES        0x00
+#define VIRTIO_PCI_GUEST_FEATURES       0x04
+#define VIRTIO_PCI_QUEUE_PFN            0x08
+#define VIRTIO_PCI_QUEUE_NUM            0x0C
+#define VIRTIO_PCI_QUEUE_SEL            0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY         0x10
+#define VIRTIO_PCI_STATUS               0x12
+#define VIRTIO_PCI_ISR                  0x13
+#define VIRTIO_PCI_CONFIG               0x14 /* without MSI-X */
+
+#define VIRTIO_PCI_QUEUE_ADDR_SHIFT     12
+#define VIRTIO_PCI_VRING_ALIGN          4096
+
+#define VIRTIO_PCI_VENDOR_ID            0x1AF4
+
+/* Device status */
+#define VIRTIO_STATUS_ACKNOWLEDGE       0x01
+#define VIRTIO_STATUS_DRIVER            0x02
+#define VIRTIO_STATUS_DRIVER_OK         0x04
+#define VIRTIO_STATUS_FAILED            0x80
+
+/* ISR status */
+#define VIRTIO_ISR_QUEUE                0x01
+#define VIRTIO_ISR_CONFIG               0x02
+
+/* Transport features, as bit numbers */
+#define VIRTIO_F_NOTIFY_ON_EMPTY        24
+#define VIRTIO_F_ANY_LAYOUT             27
+#define VIRTIO_RING_F_INDIRECT_DESC     28
+#define VIRTIO_RING_F_EVENT_IDX         29
+
+#define VIRTIO_FEATURE(Bit)             (1UL << (Bit))
+
+/* Ring structures, shared with the device */
+#define VRING_DESC_F_NEXT               0x0001
+#define VRING_DESC_F_WRITE              0x0002
+#define VRING_DESC_F_INDIRECT           0x0004
+
+#define VRING_AVAIL_F_NO_INTERRUPT      0x0001
+#define VRING_USED_F_NO_NOTIFY          0x0001
+
+typedef struct _VRING_DESC
+{
+    ULONGLONG Address;
+    ULONG Length;
+    USHORT Flags;
+    USHORT Next;
+} VRING_DESC, *PVRING_DESC;
+
+typedef struct _VRING_AVAIL
+{
+    USHORT Flags;
+    USHORT Index;
+    USHORT Ring[ANYSIZE_ARRAY]; /* followed by the used event index */
+} VRING_AVAIL, *PVRING_AVAIL;
+
+typedef struct _VRING_USED_ELEMENT
+{
+    ULONG Id;
+    ULONG Length;
+} VRING_USED_ELEMENT, *PVRING_USED_ELEMENT;
+
+typedef struct _VRING_USED
+{
+    USHORT Flags;
+    USHORT Index;
+    VRING_USED_ELEMENT Ring[ANYSIZE_ARRAY]; /* followed by the avail event index */
+} VRING_USED, *PVRING_USED;
+
+C_ASSERT(sizeof(VRING_DESC) == 16);
+C_ASSERT(sizeof(VRING_USED_ELEMENT) == 8);
+
+typedef struct _VIRTIO_DEVICE
+{
+    PUCHAR IoBase;
+    ULONG HostFeatures;
+    ULONG GuestFeatures;
+} VIRTIO_DEVICE, *PVIRTIO_DEVICE;
+
+/* One piece of a request, as handed to VirtioQueueAddBuffers */
+typedef struct _VIRTIO_BUFFER
+{
+    ULONGLONG Address;
+    ULONG Length;
+} VIRTIO_BUFFER, *PVIRTIO_BUFFER;
+
+typedef struct _VIRTQUEUE
+{
+    PVIRTIO_DEVICE Device;
+    USHORT Index;
+    USHORT Size;
+
+    PVRING_DESC Descriptors;
+    PVRING_AVAIL Avail;
+    PVRING_USED Used;
+    volatile USHORT *UsedEvent;
+    volatile USHORT *AvailEvent;
+
+    /* Descriptor free list, chained through Next */
+    USHORT FreeHead;
+    USHORT FreeCount;
+
+    /* Driver side copies of the ring indexes */
+    USHORT AvailIndex;
+    USHORT KickedIndex;
+    USHORT LastUsed;
+
+    BOOLEAN EventIndex;
+
+    /* Indirect tables, one per ring descriptor, MaxIndirect entries each */
+    ULONG MaxIndirect;
+    PVRING_DESC Indirect;
+    ULONGLONG IndirectPhysical;
+
+    /* Caller context of every request, indexed by its head descriptor */
+    PVOID *Contexts;
+} VIRTQUEUE, *PVIRTQUEUE;
+
+/* virtio.c */
+
+VOID
+VirtioInitialize(
+    _Out_ PVIRTIO_DEVICE Device,
+    _In_ PUCHAR IoBase);
+
+ULONG
+VirtioNegotiateFeatures(
+    _Inout_ PVIRTIO_DEVICE Device,
+    _In_ ULONG Wanted);
+
+VOID
+VirtioSetDriverOk(
+    _In_ PVIRTIO_DEVICE Device);
+
+VOID
+VirtioSetFailed(
+    _In_ PVIRTIO_DEVICE Device);
+
+VOID
+VirtioReset(
+    _In_ PVIRTIO_DEVICE Device);
+
+UCHAR
+VirtioReadIsr(
+    _In_ PVIRTIO_DEVICE Device);
+
+VOID
+VirtioReadConfig(
+    _In_ PVIRTIO_DEVICE Device,
+    _In_ ULONG Offset,
+    _Out_writes_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length);
+
+USHORT
+VirtioGetQueueSize(
+    _In_ PVIRTIO_DEVICE Device,
+    _In_ USHORT Index);
+
+#define VirtioHasFeature(Device, Bit) \
+    (((Device)->GuestFeatures & VIRTIO_FEATURE(Bit)) != 0)
+
+/* virtqueue.c */
+
+ULONG
+VirtioQueueMemorySize(
+    _In_ USHORT Size,
+    _In_ ULONG MaxIndirect);
+
+VOID
+VirtioQueueInitialize(
+    _Out_ PVIRTQUEUE Queue,
+    _In_ PVIRTIO_DEVICE Device,
+    _In_ USHORT Index,
+    _In_ USHORT Size,
+    _In_ ULONG MaxIndirect,
+    _In_ PVOID Memory,
+    _In_ PHYSICAL_ADDRESS Physical);
+
+VOID
+VirtioQueueDelete(
+    _In_ PVIRTQUEUE Queue);
+
+BOOLEAN
+VirtioQueueAddBuffers(
+    _Inout_ PVIRTQUEUE Queue,
+    _In_reads_(OutCount + InCount) PVIRTIO_BUFFER Buffers,
+    _In_ ULONG OutCount,
+    _In_ ULONG InCount,
+    _In_ PVOID Context);
+
+BOOLEAN
+VirtioQueueKickPrepare(
+    _Inout_ PVIRTQUEUE Queue);
+
+VOID
+VirtioQueueNotify(
+    _In_ PVIRTQUEUE Queue);
+
+PVOID
+VirtioQueueGetBuffer(
+    _Inout_ PVIRTQUEUE Queue,
+    _Out_opt_ PULONG Length);
+
+BOOLEAN
+VirtioQueueHasUsed(
+    _In_ PVIRTQUEUE Queue);
+
+VOID
+VirtioQueueDisableInterrupt(
+    _Inout_ PVIRTQUEUE Queue);
+
+BOOLEAN
+VirtioQueueEnableInterrupt(
+    _Inout_ PVIRTQUEUE Queue,
+    _In_ BOOLEAN Delayed);
+
+#endif /* _VIRTIO_H_ */
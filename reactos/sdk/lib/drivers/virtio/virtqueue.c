@@ -0,0 +1,339 @@
+/*
+ * PROJECT:     ReactOS Virtio Library
+ * LICENSE:     GPL - See COPYING in the top level directory
+ * FILE:        lib/drivers/virtio/virtqueue.c
+ * PURPOSE:     Split virtqueues with indirect descriptors and event index
+ * PROGRAMMERS: ReactOS Team
+ */
+
+/*
+ * The queue lives in one physically contiguous block supplied by the
+ * driver: the descriptor table and the available ring, the used ring on the
+ * next page boundary as the legacy transport requires, then one indirect
+ * table per ring descriptor and the context array.
+ *
+ * A request that fits an indirect table only takes one ring descriptor, so
+ * the ring holds as many requests as it has descriptors. The head
+ * descriptor index picks the indirect table, which means no allocation is
+ * ever needed on the I/O path.
+ *
+ * The caller serializes all calls for a given queue, except that
+ * VirtioQueueNotify may be called without the lock once
+ * VirtioQueueKickPrepare said so.
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include <ntddk.h>
+#include "virtio.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* FUNCTIONS ******************************************************************/
+
+static
+ULONG
+VirtioQueueUsedOffset(
+    _In_ USHORT Size)
+{
+    return ALIGN_UP_BY(Size * sizeof(VRING_DESC) +
+                       FIELD_OFFSET(VRING_AVAIL, Ring[Size]) + sizeof(USHORT),
+                       VIRTIO_PCI_VRING_ALIGN);
+}
+
+
+static
+ULONG
+VirtioQueueIndirectOffset(
+    _In_ USHORT Size)
+{
+    return ALIGN_UP_BY(VirtioQueueUsedOffset(Size) +
+                       FIELD_OFFSET(VRING_USED, Ring[Size]) + sizeof(USHORT),
+                       sizeof(VRING_DESC));
+}
+
+
+ULONG
+VirtioQueueMemorySize(
+    _In_ USHORT Size,
+    _In_ ULONG MaxIndirect)
+{
+    return VirtioQueueIndirectOffset(Size) +
+           Size * MaxIndirect * sizeof(VRING_DESC) +
+           Size * sizeof(PVOID);
+}
+
+
+VOID
+VirtioQueueInitialize(
+    _Out_ PVIRTQUEUE Queue,
+    _In_ PVIRTIO_DEVICE Device,
+    _In_ USHORT Index,
+    _In_ USHORT Size,
+    _In_ ULONG MaxIndirect,
+    _In_ PVOID Memory,
+    _In_ PHYSICAL_ADDRESS Physical)
+{
+    PUCHAR Base = Memory;
+    ULONG IndirectOffset, i;
+
+    ASSERT((Physical.QuadPart & (VIRTIO_PCI_VRING_ALIGN - 1)) == 0);
+
+    RtlZeroMemory(Memory, VirtioQueueMemorySize(Size, MaxIndirect));
+    RtlZeroMemory(Queue, sizeof(VIRTQUEUE));
+
+    Queue->Device = Device;
+    Queue->Index = Index;
+    Queue->Size = Size;
+
+    Queue->Descriptors = (PVRING_DESC)Base;
+    Queue->Avail = (PVRING_AVAIL)(Base + Size * sizeof(VRING_DESC));
+    Queue->Used = (PVRING_USED)(Base + VirtioQueueUsedOffset(Size));
+    Queue->UsedEvent = &Queue->Avail->Ring[Size];
+    Queue->AvailEvent = (volatile USHORT *)&Queue->Used->Ring[Size];
+
+    IndirectOffset = VirtioQueueIndirectOffset(Size);
+    if (MaxIndirect > 1 && VirtioHasFeature(Device, VIRTIO_RING_F_INDIRECT_DESC))
+    {
+        Queue->MaxIndirect = MaxIndirect;
+        Queue->Indirect = (PVRING_DESC)(Base + IndirectOffset);
+        Queue->IndirectPhysical = Physical.QuadPart + IndirectOffset;
+    }
+    Queue->Contexts = (PVOID *)(Base + IndirectOffset + Size * MaxIndirect * sizeof(VRING_DESC));
+
+    Queue->EventIndex = VirtioHasFeature(Device, VIRTIO_RING_F_EVENT_IDX);
+
+    /* Every descriptor starts out free */
+    for (i = 0; i < Size; i++)
+        Queue->Descriptors[i].Next = (USHORT)(i + 1);
+    Queue->FreeHead = 0;
+    Queue->FreeCount = Size;
+
+    WRITE_PORT_USHORT((PUSHORT)(Device->IoBase + VIRTIO_PCI_QUEUE_SEL), Index);
+    WRITE_PORT_ULONG((PULONG)(Device->IoBase + VIRTIO_PCI_QUEUE_PFN),
+                     (ULONG)(Physical.QuadPart >> VIRTIO_PCI_QUEUE_ADDR_SHIFT));
+
+    DPRINT("Queue %u: %u entries, indirect %lu, event index %u\n",
+           Index, Size, Queue->MaxIndirect, Queue->EventIndex);
+}
+
+
+VOID
+VirtioQueueDelete(
+    _In_ PVIRTQUEUE Queue)
+{
+    PVIRTIO_DEVICE Device = Queue->Device;
+
+    WRITE_PORT_USHORT((PUSHORT)(Device->IoBase + VIRTIO_PCI_QUEUE_SEL), Queue->Index);
+    WRITE_PORT_ULONG((PULONG)(Device->IoBase + VIRTIO_PCI_QUEUE_PFN), 0);
+}
+
+
+BOOLEAN
+VirtioQueueAddBuffers(
+    _Inout_ PVIRTQUEUE Queue,
+    _In_reads_(OutCount + InCount) PVIRTIO_BUFFER Buffers,
+    _In_ ULONG OutCount,
+    _In_ ULONG InCount,
+    _In_ PVOID Context)
+{
+    PVRING_DESC Descriptor, Table;
+    ULONG Count = OutCount + InCount;
+    USHORT Head, Current, Last;
+    ULONG i;
+
+    ASSERT(Count != 0);
+
+    Head = Queue->FreeHead;
+
+    if (Count > 1 && Count <= Queue->MaxIndirect)
+    {
+        if (Queue->FreeCount == 0)
+            return FALSE;
+
+        /* The device-readable part comes first, then the writable one */
+        Table = Queue->Indirect + Head * Queue->MaxIndirect;
+        for (i = 0; i < Count; i++)
+        {
+            Table[i].Address = Buffers[i].Address;
+            Table[i].Length = Buffers[i].Length;
+            Table[i].Flags = (i >= OutCount) ? VRING_DESC_F_WRITE : 0;
+            if (i + 1 < Count)
+                Table[i].Flags |= VRING_DESC_F_NEXT;
+            Table[i].Next = (USHORT)(i + 1);
+        }
+
+        Descriptor = &Queue->Descriptors[Head];
+        Queue->FreeHead = Descriptor->Next;
+        Queue->FreeCount--;
+
+        Descriptor->Address = Queue->IndirectPhysical +
+                              Head * Queue->MaxIndirect * sizeof(VRING_DESC);
+        Descriptor->Length = Count * sizeof(VRING_DESC);
+        Descriptor->Flags = VRING_DESC_F_INDIRECT;
+    }
+    else
+    {
+        if (Queue->FreeCount < Count)
+            return FALSE;
+
+        /* The free list is already chained through Next, just take its start */
+        Current = Last = Head;
+        for (i = 0; i < Count; i++)
+        {
+            Descriptor = &Queue->Descriptors[Current];
+            Descriptor->Address = Buffers[i].Address;
+            Descriptor->Length = Buffers[i].Length;
+            Descriptor->Flags = (i >= OutCount) ? VRING_DESC_F_WRITE : 0;
+            if (i + 1 < Count)
+                Descriptor->Flags |= VRING_DESC_F_NEXT;
+
+            Last = Current;
+            Current = Descriptor->Next;
+        }
+
+        Queue->FreeHead = Queue->Descriptors[Last].Next;
+        Queue->FreeCount -= (USHORT)Count;
+    }
+
+    Queue->Contexts[Head] = Context;
+
+    Queue->Avail->Ring[Queue->AvailIndex % Queue->Size] = Head;
+    Queue->AvailIndex++;
+
+    /* The descriptors must be visible before the index that publishes them */
+    KeMemoryBarrier();
+    Queue->Avail->Index = Queue->AvailIndex;
+
+    return TRUE;
+}
+
+
+BOOLEAN
+VirtioQueueKickPrepare(
+    _Inout_ PVIRTQUEUE Queue)
+{
+    USHORT Old, New, Event;
+
+    Old = Queue->KickedIndex;
+    New = Queue->AvailIndex;
+    Queue->KickedIndex = New;
+
+    if (Old == New)
+        return FALSE;
+
+    /* Order the index update against reading what the device asked for */
+    KeMemoryBarrier();
+
+    if (Queue->EventIndex)
+    {
+        /* Only notify if the device's event index lies in what we just added */
+        Event = *Queue->AvailEvent;
+        return (USHORT)(New - Event - 1) < (USHORT)(New - Old);
+    }
+
+    return !(Queue->Used->Flags & VRING_USED_F_NO_NOTIFY);
+}
+
+
+VOID
+VirtioQueueNotify(
+    _In_ PVIRTQUEUE Queue)
+{
+    WRITE_PORT_USHORT((PUSHORT)(Queue->Device->IoBase + VIRTIO_PCI_QUEUE_NOTIFY), Queue->Index);
+}
+
+
+BOOLEAN
+VirtioQueueHasUsed(
+    _In_ PVIRTQUEUE Queue)
+{
+    return (*(volatile USHORT *)&Queue->Used->Index != Queue->LastUsed);
+}
+
+
+PVOID
+VirtioQueueGetBuffer(
+    _Inout_ PVIRTQUEUE Queue,
+    _Out_opt_ PULONG Length)
+{
+    PVRING_USED_ELEMENT Element;
+    PVOID Context;
+    USHORT Head, Last, Count;
+
+    if (!VirtioQueueHasUsed(Queue))
+        return NULL;
+
+    /* Don't read the element before the index that published it */
+    KeMemoryBarrier();
+
+    Element = &Queue->Used->Ring[Queue->LastUsed % Queue->Size];
+    Head = (USHORT)Element->Id;
+    if (Length != NULL)
+        *Length = Element->Length;
+    Queue->LastUsed++;
+
+    ASSERT(Head < Queue->Size);
+
+    /* Give the chain back to the free list */
+    Last = Head;
+    Count = 1;
+    while (Queue->Descriptors[Last].Flags & VRING_DESC_F_NEXT)
+    {
+        Last = Queue->Descriptors[Last].Next;
+        Count++;
+    }
+    Queue->Descriptors[Last].Next = Queue->FreeHead;
+    Queue->FreeHead = Head;
+    Queue->FreeCount += Count;
+
+    Context = Queue->Contexts[Head];
+    Queue->Contexts[Head] = NULL;
+
+    return Context;
+}
+
+
+VOID
+VirtioQueueDisableInterrupt(
+    _Inout_ PVIRTQUEUE Queue)
+{
+    if (Queue->EventIndex)
+    {
+        /* An event index we already went past only fires after a full wrap */
+        *Queue->UsedEvent = Queue->LastUsed - 1;
+    }
+    else
+    {
+        Queue->Avail->Flags |= VRING_AVAIL_F_NO_INTERRUPT;
+    }
+}
+
+
+BOOLEAN
+VirtioQueueEnableInterrupt(
+    _Inout_ PVIRTQUEUE Queue,
+    _In_ BOOLEAN Delayed)
+{
+    USHORT Bump = 0;
+
+    if (Queue->EventIndex)
+    {
+        /* Delayed: only interrupt once three quarters of what's in flight is done */
+        if (Delayed)
+            Bump = (USHORT)(Queue->AvailIndex - Queue->LastUsed) * 3 / 4;
+        *Queue->UsedEvent = Queue->LastUsed + Bump;
+    }
+    else
+    {
+        Queue->Avail->Flags &= ~VRING_AVAIL_F_NO_INTERRUPT;
+    }
+
+    /* Catch what the device completed before it could see the change */
+    KeMemoryBarrier();
+
+    return (USHORT)(*(volatile USHORT *)&Queue->Used->Index - Queue->LastUsed) > Bump;
+}
+
+/* EOF */
@@ -65,34 +65,20 @@ typedef ULONG BITMAP_INDEX, *PBITMAP_INDEX;
 typedef ULONG BITMAP_BUFFER, *PBITMAP_BUFFER;
 #endif
 
-/* DATA *********************************************************************/
+/* PRIVATE FUNCTIONS ********************************************************/
 
-/* Number of set bits per byte value */
-static const
-UCHAR
-BitCountTable[256] =
+static __inline
+BITMAP_INDEX
+RtlpCountSetBits(
+    _In_ BITMAP_BUFFER Value)
 {
-    /* x0 x1 x2 x3 x4 x5 x6 x7 x8 x9 xA xB xC xD xE xF */
-       0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, /* 0x */
-       1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, /* 1x */
-       1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, /* 2x */
-       2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, /* 3x */
-       1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, /* 4x */
-       2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, /* 5x */
-       2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, /* 6c */
-       3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, /* 7x */
-       1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, /* 8x */
-       2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, /* 9x */
-       2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, /* Ax */
-       3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, /* Bx */
-       2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, /* Cx */
-       3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, /* Dx */
-       3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, /* Ex */
-       4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8  /* Fx */
-};
-
-
-/* PRIVATE FUNCTIONS ********************************************************/
+    /* Count the bits of a whole buffer word in parallel (SWAR) */
+    Value = Value - ((Value >> 1) & (BITMAP_BUFFER)0x5555555555555555ULL);
+    Value = (Value & (BITMAP_BUFFER)0x3333333333333333ULL) +
+            ((Value >> 2) & (BITMAP_BUFFER)0x3333333333333333ULL);
+    Value = (Value + (Value >> 4)) & (BITMAP_BUFFER)0x0F0F0F0F0F0F0F0FULL;
+    return (BITMAP_INDEX)((Value * (BITMAP_BUFFER)0x0101010101010101ULL) >> (_BITCOUNT - 8));
+}
 
 static __inline
 BITMAP_INDEX
@@ -474,22 +460,23 @@ NTAPI
 RtlNumberOfSetBits(
     _In_ PRTL_BITMAP BitMapHeader)
 {
-    PUCHAR Byte, MaxByte;
-    BITMAP_INDEX BitCount = 0;
-    ULONG Shift;
+    PBITMAP_BUFFER Buffer, MaxBuffer;
+    BITMAP_INDEX BitCount = 0, Remaining;
 
-    Byte = (PUCHAR)BitMapHeader->Buffer;
-    MaxByte = Byte + BitMapHeader->SizeOfBitMap / 8;
+    Buffer = BitMapHeader->Buffer;
+    MaxBuffer = Buffer + BitMapHeader->SizeOfBitMap / _BITCOUNT;
 
-    while (Byte < MaxByte)
+    /* Count all full buffer words */
+    while (Buffer < MaxBuffer)
     {
-        BitCount += BitCountTable[*Byte++];
+        BitCount += RtlpCountSetBits(*Buffer++);
     }
 
-    if (BitMapHeader->SizeOfBitMap & 7)
+    /* Count the bits of the last partial word, if any */
+    Remaining = BitMapHeader->SizeOfBitMap & (_BITCOUNT - 1);
+    if (Remaining)
     {
-        Shift = 8 - (BitMapHeader->SizeOfBitMap & 7);
-        BitCount += BitCountTable[((*Byte) << Shift) & 0xFF];
+        BitCount += RtlpCountSetBits(*Buffer & ~(MAXINDEX << Remaining));
     }
 
     return BitCount;
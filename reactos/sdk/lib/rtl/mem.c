@@ -30,6 +30,10 @@
  *  The length of the first byte at which Source1 and Source2 differ, or Length
  *  if they are the same.
  *
+ * NOTES
+ *  Only built for amd64 and arm. i386 uses the repe cmpsd version in
+ *  i386/rtlmem.s, which already compares a ULONG at a time.
+ *
  * @implemented
  */
 SIZE_T
@@ -38,8 +42,18 @@ RtlCompareMemory(IN const VOID *Source1,
                  IN const VOID *Source2,
                  IN SIZE_T Length)
 {
-    SIZE_T i;
-    for (i = 0; (i < Length) && (((PUCHAR)Source1)[i] == ((PUCHAR)Source2)[i]); i++)
+    SIZE_T i = 0;
+
+    /* Compare a machine word at a time while the blocks are equal */
+    while ((Length - i) >= sizeof(ULONG_PTR) &&
+           *(ULONG_PTR UNALIGNED *)((PUCHAR)Source1 + i) ==
+           *(ULONG_PTR UNALIGNED *)((PUCHAR)Source2 + i))
+    {
+        i += sizeof(ULONG_PTR);
+    }
+
+    /* Locate the differing byte, or finish the tail */
+    for (; (i < Length) && (((PUCHAR)Source1)[i] == ((PUCHAR)Source2)[i]); i++)
         ;
 
     return i;
@@ -2189,14 +2189,41 @@ RtlCompareUnicodeString(
     unsigned int len;
     LONG ret = 0;
     LPCWSTR p1, p2;
+    WCHAR c1, c2;
 
     len = min(s1->Length, s2->Length) / sizeof(WCHAR);
     p1 = s1->Buffer;
     p2 = s2->Buffer;
 
+    /* Skip the identical prefix four characters at a time */
+    while (len >= 4 &&
+           *(ULONGLONG UNALIGNED *)p1 == *(ULONGLONG UNALIGNED *)p2)
+    {
+        p1 += 4;
+        p2 += 4;
+        len -= 4;
+    }
+
     if (CaseInsensitive)
     {
-        while (!ret && len--) ret = RtlpUpcaseUnicodeChar(*p1++) - RtlpUpcaseUnicodeChar(*p2++);
+        while (!ret && len--)
+        {
+            c1 = *p1++;
+            c2 = *p2++;
+            if (c1 == c2) continue;
+
+            /* Upcase ASCII inline, only go to the NLS table for the rest */
+            if (c1 < 0x80 && c2 < 0x80)
+            {
+                if (c1 >= L'a' && c1 <= L'z') c1 -= L'a' - L'A';
+                if (c2 >= L'a' && c2 <= L'z') c2 -= L'a' - L'A';
+                ret = c1 - c2;
+            }
+            else
+            {
+                ret = RtlpUpcaseUnicodeChar(c1) - RtlpUpcaseUnicodeChar(c2);
+            }
+        }
     }
     else
     {
@@ -0,0 +1,276 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * PURPOSE:         Test for the RecvDatagrams extension function
+ * PROGRAMMERS:     ReactOS Team
+ */
+
+#include <apitest.h>
+
+#include <stdio.h>
+#include "ws2_32.h"
+#include <mswsock.h>
+#include <winsock/mswinsock.h>
+
+static const GUID RecvDatagramsGuid = WSAID_RECVDATAGRAMS;
+
+static LPFN_RECVDATAGRAMS GetRecvDatagrams(SOCKET sck)
+{
+    LPFN_RECVDATAGRAMS pRecvDatagrams = NULL;
+    DWORD BytesReturned;
+    int iResult;
+
+    iResult = WSAIoctl(sck,
+                       SIO_GET_EXTENSION_FUNCTION_POINTER,
+                       (PVOID)&RecvDatagramsGuid,
+                       sizeof(RecvDatagramsGuid),
+                       &pRecvDatagrams,
+                       sizeof(pRecvDatagrams),
+                       &BytesReturned,
+                       NULL,
+                       NULL);
+    ok(iResult == 0, "WSAIoctl failed with %d\n", WSAGetLastError());
+
+    return pRecvDatagrams;
+}
+
+/* Sends the datagrams from one loopback socket to another and receives
+ * them in batches, in the order they were sent */
+static void test_batch(void)
+{
+    static const char *Payloads[] = { "one", "two", "three" };
+    LPFN_RECVDATAGRAMS pRecvDatagrams;
+    PRECVDATAGRAM Record;
+    SOCKADDR_IN RxAddr, TxAddr, *From;
+    SOCKET rx, tx;
+    WSABUF Buffer;
+    CHAR Data[512];
+    DWORD BytesRecvd, Offset;
+    int AddrLen, iResult, i, Received = 0, Tries;
+
+    rx = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    tx = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    ok(rx != INVALID_SOCKET && tx != INVALID_SOCKET, "socket failed with %d\n", WSAGetLastError());
+
+    ZeroMemory(&RxAddr, sizeof(RxAddr));
+    RxAddr.sin_family = AF_INET;
+    RxAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    TxAddr = RxAddr;
+
+    iResult = bind(rx, (PSOCKADDR)&RxAddr, sizeof(RxAddr));
+    ok(iResult == 0, "bind failed with %d\n", WSAGetLastError());
+    iResult = bind(tx, (PSOCKADDR)&TxAddr, sizeof(TxAddr));
+    ok(iResult == 0, "bind failed with %d\n", WSAGetLastError());
+
+    AddrLen = sizeof(RxAddr);
+    iResult = getsockname(rx, (PSOCKADDR)&RxAddr, &AddrLen);
+    ok(iResult == 0, "getsockname failed with %d\n", WSAGetLastError());
+    AddrLen = sizeof(TxAddr);
+    iResult = getsockname(tx, (PSOCKADDR)&TxAddr, &AddrLen);
+    ok(iResult == 0, "getsockname failed with %d\n", WSAGetLastError());
+
+    pRecvDatagrams = GetRecvDatagrams(rx);
+    if (!pRecvDatagrams)
+    {
+        skip("No RecvDatagrams\n");
+        goto Cleanup;
+    }
+
+    for (i = 0; i < sizeof(Payloads) / sizeof(Payloads[0]); i++)
+    {
+        iResult = sendto(tx, Payloads[i], (int)strlen(Payloads[i]), 0,
+                         (PSOCKADDR)&RxAddr, sizeof(RxAddr));
+        ok(iResult == (int)strlen(Payloads[i]), "sendto returned %d\n", iResult);
+    }
+
+    /* A call completes with what is queued, so it may take more than one */
+    Buffer.buf = Data;
+    Buffer.len = sizeof(Data);
+    for (Tries = 0; Received < 3 && Tries < 3; Tries++)
+    {
+        BytesRecvd = 0;
+        iResult = pRecvDatagrams(rx, &Buffer, 0, &BytesRecvd, NULL);
+        ok(iResult == 0, "RecvDatagrams failed with %d\n", WSAGetLastError());
+        if (iResult != 0) break;
+
+        ok(BytesRecvd != 0, "Nothing received\n");
+        for (Offset = 0; Offset < BytesRecvd; Offset += Record->RecordLength)
+        {
+            Record = (PRECVDATAGRAM)(Data + Offset);
+            ok(Received < 3, "Received %d datagrams\n", Received + 1);
+            if (Received >= 3 || !Record->RecordLength) break;
+
+            ok(Record->Flags == 0, "Flags = %lx\n", Record->Flags);
+            ok(Record->DataLength == strlen(Payloads[Received]),
+               "DataLength = %lu\n", Record->DataLength);
+            ok(!memcmp(Record->Data, Payloads[Received], strlen(Payloads[Received])),
+               "Datagram %d out of order\n", Received);
+
+            From = (SOCKADDR_IN *)Record->Address;
+            ok(Record->AddressLength >= (INT)sizeof(SOCKADDR_IN),
+               "AddressLength = %d\n", Record->AddressLength);
+            ok(From->sin_family == AF_INET, "sin_family = %u\n", From->sin_family);
+            ok(From->sin_port == TxAddr.sin_port, "sin_port = %u\n", ntohs(From->sin_port));
+
+            Received++;
+        }
+    }
+    ok(Received == 3, "Received %d datagrams\n", Received);
+
+    /* The first datagram is cut short when it doesn't fit, and the limit
+     * on the count is kept */
+    iResult = sendto(tx, Payloads[2], (int)strlen(Payloads[2]), 0,
+                     (PSOCKADDR)&RxAddr, sizeof(RxAddr));
+    ok(iResult == (int)strlen(Payloads[2]), "sendto returned %d\n", iResult);
+    iResult = sendto(tx, Payloads[0], (int)strlen(Payloads[0]), 0,
+                     (PSOCKADDR)&RxAddr, sizeof(RxAddr));
+    ok(iResult == (int)strlen(Payloads[0]), "sendto returned %d\n", iResult);
+
+    Buffer.len = FIELD_OFFSET(RECVDATAGRAM, Data) + 2;
+    iResult = pRecvDatagrams(rx, &Buffer, 1, &BytesRecvd, NULL);
+    ok(iResult == 0, "RecvDatagrams failed with %d\n", WSAGetLastError());
+    Record = (PRECVDATAGRAM)Data;
+    ok(BytesRecvd == Buffer.len, "BytesRecvd = %lu\n", BytesRecvd);
+    ok(Record->DataLength == 2, "DataLength = %lu\n", Record->DataLength);
+    ok(Record->Flags == RECVDATAGRAM_TRUNCATED, "Flags = %lx\n", Record->Flags);
+
+    /* The second datagram is still queued */
+    Buffer.len = sizeof(Data);
+    iResult = pRecvDatagrams(rx, &Buffer, 1, &BytesRecvd, NULL);
+    ok(iResult == 0, "RecvDatagrams failed with %d\n", WSAGetLastError());
+    ok(Record->DataLength == strlen(Payloads[0]), "DataLength = %lu\n", Record->DataLength);
+    ok(BytesRecvd == Record->RecordLength, "BytesRecvd = %lu\n", BytesRecvd);
+
+Cleanup:
+    closesocket(tx);
+    closesocket(rx);
+}
+
+/* Times many small datagrams going round the loopback, sent with sendto
+ * and taken back in batches with RecvDatagrams */
+static void test_throughput(void)
+{
+    LPFN_RECVDATAGRAMS pRecvDatagrams;
+    PRECVDATAGRAM Record;
+    SOCKADDR_IN RxAddr;
+    SOCKET rx, tx;
+    WSABUF Buffer;
+    CHAR Data[8192], Payload[64];
+    DWORD BytesRecvd, Offset, Start, Elapsed;
+    struct timeval Timeout = { 5, 0 };
+    fd_set ReadSet;
+    int AddrLen, iResult, Round, i, Sent = 0, Received = 0;
+
+    rx = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    tx = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    ok(rx != INVALID_SOCKET && tx != INVALID_SOCKET, "socket failed with %d\n", WSAGetLastError());
+
+    ZeroMemory(&RxAddr, sizeof(RxAddr));
+    RxAddr.sin_family = AF_INET;
+    RxAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    iResult = bind(rx, (PSOCKADDR)&RxAddr, sizeof(RxAddr));
+    ok(iResult == 0, "bind failed with %d\n", WSAGetLastError());
+    AddrLen = sizeof(RxAddr);
+    iResult = getsockname(rx, (PSOCKADDR)&RxAddr, &AddrLen);
+    ok(iResult == 0, "getsockname failed with %d\n", WSAGetLastError());
+
+    pRecvDatagrams = GetRecvDatagrams(rx);
+    if (!pRecvDatagrams)
+    {
+        skip("No RecvDatagrams\n");
+        goto Cleanup;
+    }
+
+    memset(Payload, 0x5a, sizeof(Payload));
+    Buffer.buf = Data;
+    Buffer.len = sizeof(Data);
+
+    /* Send a few at a time, so the ring doesn't overflow, and take them
+     * back before the next round */
+    Start = GetTickCount();
+    for (Round = 0; Round < 2000; Round++)
+    {
+        for (i = 0; i < 8; i++)
+        {
+            iResult = sendto(tx, Payload, sizeof(Payload), 0,
+                             (PSOCKADDR)&RxAddr, sizeof(RxAddr));
+            if (iResult != sizeof(Payload)) break;
+            Sent++;
+        }
+        ok(iResult == sizeof(Payload), "sendto returned %d\n", iResult);
+        if (iResult != sizeof(Payload)) break;
+
+        while (Received < Sent)
+        {
+            /* Don't hang on a datagram that got lost */
+            FD_ZERO(&ReadSet);
+            FD_SET(rx, &ReadSet);
+            iResult = select(0, &ReadSet, NULL, NULL, &Timeout);
+            ok(iResult == 1, "select returned %d\n", iResult);
+            if (iResult != 1) goto Done;
+
+            BytesRecvd = 0;
+            iResult = pRecvDatagrams(rx, &Buffer, 0, &BytesRecvd, NULL);
+            ok(iResult == 0, "RecvDatagrams failed with %d\n", WSAGetLastError());
+            if (iResult != 0) goto Done;
+
+            for (Offset = 0; Offset < BytesRecvd; Offset += Record->RecordLength)
+            {
+                Record = (PRECVDATAGRAM)(Data + Offset);
+                if (!Record->RecordLength) break;
+                Received++;
+            }
+        }
+    }
+
+Done:
+    Elapsed = GetTickCount() - Start;
+
+    ok(Received == Sent, "Sent %d datagrams, received %d\n", Sent, Received);
+    if (!Elapsed) Elapsed = 1;
+    trace("%d datagrams of %u bytes in %lu ms, %lu datagrams/s\n",
+          Received, (UINT)sizeof(Payload), Elapsed, Received * 1000UL / Elapsed);
+
+Cleanup:
+    closesocket(tx);
+    closesocket(rx);
+}
+
+/* Stream sockets have no datagrams to hand out */
+static void test_stream(void)
+{
+    LPFN_RECVDATAGRAMS pRecvDatagrams;
+    WSABUF Buffer;
+    CHAR Data[64];
+    DWORD BytesRecvd;
+    SOCKET sck;
+    int iResult;
+
+    sck = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    ok(sck != INVALID_SOCKET, "socket failed with %d\n", WSAGetLastError());
+
+    pRecvDatagrams = GetRecvDatagrams(sck);
+    if (pRecvDatagrams)
+    {
+        Buffer.buf = Data;
+        Buffer.len = sizeof(Data);
+        iResult = pRecvDatagrams(sck, &Buffer, 0, &BytesRecvd, NULL);
+        ok(iResult == SOCKET_ERROR, "iResult = %d\n", iResult);
+        ok(WSAGetLastError() == WSAEINVAL, "error = %d\n", WSAGetLastError());
+    }
+
+    closesocket(sck);
+}
+
+START_TEST(recvdatagrams)
+{
+    int ret;
+    WSADATA wsad;
+
+    ret = WSAStartup(MAKEWORD(2, 2), &wsad);
+    ok(ret == 0, "WSAStartup failed with %d\n", ret);
+    test_batch();
+    test_throughput();
+    test_stream();
+    WSACleanup();
+}
@@ -0,0 +1,195 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * PURPOSE:         Loopback TCP throughput over many concurrent connections
+ * PROGRAMMERS:     ReactOS Team
+ */
+
+#include <apitest.h>
+
+#include <stdio.h>
+#include "ws2_32.h"
+
+#define CONNECTION_COUNT    16
+#define CHUNK_SIZE          16384
+#define BYTES_PER_CONNECTION (4 * 1024 * 1024)
+
+typedef struct _LOOPBACK_STREAM
+{
+    SOCKET Socket;
+    ULONG Bytes;
+    BOOL Failed;
+} LOOPBACK_STREAM, *PLOOPBACK_STREAM;
+
+static DWORD WINAPI SendThread(PVOID Context)
+{
+    PLOOPBACK_STREAM Stream = Context;
+    CHAR Buffer[CHUNK_SIZE];
+    int iResult;
+
+    memset(Buffer, 0x5a, sizeof(Buffer));
+
+    while (Stream->Bytes < BYTES_PER_CONNECTION)
+    {
+        iResult = send(Stream->Socket, Buffer, sizeof(Buffer), 0);
+        if (iResult <= 0)
+        {
+            Stream->Failed = TRUE;
+            break;
+        }
+        Stream->Bytes += iResult;
+    }
+
+    shutdown(Stream->Socket, SD_SEND);
+    return 0;
+}
+
+static DWORD WINAPI RecvThread(PVOID Context)
+{
+    PLOOPBACK_STREAM Stream = Context;
+    CHAR Buffer[CHUNK_SIZE];
+    int iResult;
+
+    for (;;)
+    {
+        iResult = recv(Stream->Socket, Buffer, sizeof(Buffer), 0);
+        if (iResult == 0)
+            break;
+        if (iResult < 0)
+        {
+            Stream->Failed = TRUE;
+            break;
+        }
+        Stream->Bytes += iResult;
+    }
+
+    return 0;
+}
+
+/* Every connection sends at the same time, so the transport has to keep
+ * many connections moving at once rather than one after the other */
+static void test_throughput(void)
+{
+    LOOPBACK_STREAM Senders[CONNECTION_COUNT], Receivers[CONNECTION_COUNT];
+    HANDLE Threads[CONNECTION_COUNT * 2];
+    SOCKADDR_IN Addr;
+    SYSTEM_INFO SystemInfo;
+    SOCKET Listener;
+    DWORD Start, Elapsed, Wait;
+    ULONGLONG Total = 0;
+    int AddrLen, iResult, i, Count, ThreadCount;
+
+    ZeroMemory(Senders, sizeof(Senders));
+    ZeroMemory(Receivers, sizeof(Receivers));
+    for (i = 0; i < CONNECTION_COUNT; i++)
+        Senders[i].Socket = Receivers[i].Socket = INVALID_SOCKET;
+
+    Listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    ok(Listener != INVALID_SOCKET, "socket failed with %d\n", WSAGetLastError());
+    if (Listener == INVALID_SOCKET)
+    {
+        skip("No socket\n");
+        return;
+    }
+
+    ZeroMemory(&Addr, sizeof(Addr));
+    Addr.sin_family = AF_INET;
+    Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    iResult = bind(Listener, (PSOCKADDR)&Addr, sizeof(Addr));
+    ok(iResult == 0, "bind failed with %d\n", WSAGetLastError());
+    AddrLen = sizeof(Addr);
+    iResult = getsockname(Listener, (PSOCKADDR)&Addr, &AddrLen);
+    ok(iResult == 0, "getsockname failed with %d\n", WSAGetLastError());
+    iResult = listen(Listener, CONNECTION_COUNT);
+    ok(iResult == 0, "listen failed with %d\n", WSAGetLastError());
+
+    for (Count = 0; Count < CONNECTION_COUNT; Count++)
+    {
+        Senders[Count].Socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (Senders[Count].Socket == INVALID_SOCKET)
+            break;
+
+        iResult = connect(Senders[Count].Socket, (PSOCKADDR)&Addr, sizeof(Addr));
+        ok(iResult == 0, "connect failed with %d\n", WSAGetLastError());
+        if (iResult != 0)
+        {
+            closesocket(Senders[Count].Socket);
+            break;
+        }
+
+        Receivers[Count].Socket = accept(Listener, NULL, NULL);
+        ok(Receivers[Count].Socket != INVALID_SOCKET, "accept failed with %d\n", WSAGetLastError());
+        if (Receivers[Count].Socket == INVALID_SOCKET)
+        {
+            closesocket(Senders[Count].Socket);
+            break;
+        }
+    }
+    ok(Count == CONNECTION_COUNT, "Connected %d of %d\n", Count, CONNECTION_COUNT);
+    if (!Count)
+    {
+        skip("No connections\n");
+        closesocket(Listener);
+        return;
+    }
+
+    Start = GetTickCount();
+    for (i = 0, ThreadCount = 0; i < Count; i++)
+    {
+        Threads[ThreadCount] = CreateThread(NULL, 0, RecvThread, &Receivers[i], 0, NULL);
+        ok(Threads[ThreadCount] != NULL, "CreateThread failed with %lu\n", GetLastError());
+        if (Threads[ThreadCount]) ThreadCount++;
+        Threads[ThreadCount] = CreateThread(NULL, 0, SendThread, &Senders[i], 0, NULL);
+        ok(Threads[ThreadCount] != NULL, "CreateThread failed with %lu\n", GetLastError());
+        if (Threads[ThreadCount]) ThreadCount++;
+    }
+
+    Wait = WaitForMultipleObjects(ThreadCount, Threads, TRUE, 120 * 1000);
+    Elapsed = GetTickCount() - Start;
+    ok(Wait != WAIT_TIMEOUT && Wait != WAIT_FAILED,
+       "WaitForMultipleObjects returned %lu\n", Wait);
+    if (Wait == WAIT_TIMEOUT)
+    {
+        /* Get the threads out of send and recv before the streams go away */
+        for (i = 0; i < Count; i++)
+        {
+            closesocket(Senders[i].Socket);
+            closesocket(Receivers[i].Socket);
+            Senders[i].Socket = Receivers[i].Socket = INVALID_SOCKET;
+        }
+        WaitForMultipleObjects(ThreadCount, Threads, TRUE, INFINITE);
+    }
+
+    for (i = 0; i < ThreadCount; i++)
+        CloseHandle(Threads[i]);
+
+    for (i = 0; i < Count; i++)
+    {
+        ok(!Senders[i].Failed, "Send on connection %d failed\n", i);
+        ok(!Receivers[i].Failed, "Receive on connection %d failed\n", i);
+        ok(Receivers[i].Bytes == Senders[i].Bytes,
+           "Connection %d: sent %lu, received %lu\n", i, Senders[i].Bytes, Receivers[i].Bytes);
+        Total += Receivers[i].Bytes;
+
+        if (Senders[i].Socket != INVALID_SOCKET) closesocket(Senders[i].Socket);
+        if (Receivers[i].Socket != INVALID_SOCKET) closesocket(Receivers[i].Socket);
+    }
+    closesocket(Listener);
+
+    GetSystemInfo(&SystemInfo);
+    if (!Elapsed) Elapsed = 1;
+    trace("%d connections, %lu processors: %I64u bytes in %lu ms, %I64u KB/s\n",
+          Count, SystemInfo.dwNumberOfProcessors, Total, Elapsed,
+          Total * 1000 / 1024 / Elapsed);
+}
+
+START_TEST(tcploopback)
+{
+    int ret;
+    WSADATA wsad;
+
+    ret = WSAStartup(MAKEWORD(2, 2), &wsad);
+    ok(ret == 0, "WSAStartup failed with %d\n", ret);
+    test_throughput();
+    WSACleanup();
+}
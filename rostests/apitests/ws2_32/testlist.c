@@ -9,7 +9,9 @@ extern void func_getservbyname(void);
 extern void func_getservbyport(void);
 extern void func_ioctlsocket(void);
 extern void func_recv(void);
+extern void func_recvdatagrams(void);
 extern void func_send(void);
+extern void func_tcploopback(void);
 extern void func_WSAStartup(void);
 extern void func_nostartup(void);
 
@@ -22,7 +24,9 @@ const struct test winetest_testlist[] =
     { "ioctlsocket", func_ioctlsocket },
     { "nostartup", func_nostartup },
     { "recv", func_recv },
+    { "recvdatagrams", func_recvdatagrams },
     { "send", func_send },
+    { "tcploopback", func_tcploopback },
     { "WSAStartup", func_WSAStartup },
     { 0, 0 }
 };